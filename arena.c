@@ -0,0 +1,231 @@
+/*
+ * arena.c
+ * =======
+ * 
+ * Implementation of arena.h
+ * 
+ * See the header for further information.
+ */
+
+#include "arena.h"
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diagnostic.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of bytes that blocks are carved from in each shared chunk.
+ */
+#define CHUNK_SIZE (65536)
+
+/*
+ * Blocks larger than this size in bytes get a chunk of their own, so
+ * that they don't waste the rest of a shared chunk.
+ */
+#define CHUNK_LARGE (CHUNK_SIZE / 4)
+
+/*
+ * The alignment of blocks in bytes, which must be a power of two.
+ */
+#define BLOCK_ALIGN (16)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * ARENA_CHUNK structure.  Prototype given in header.
+ * 
+ * The data of the chunk follows the structure, starting at offset
+ * CHUNK_HEAD from the start of the structure.
+ */
+struct ARENA_CHUNK_TAG {
+  
+  /*
+   * The chunk that was allocated before this one, or NULL if this is
+   * the first chunk.
+   */
+  ARENA_CHUNK *pPrev;
+  
+};
+
+/*
+ * The offset of the chunk data from the start of the chunk, which is
+ * the chunk structure size rounded up to the block alignment.
+ */
+#define CHUNK_HEAD \
+  (((sizeof(ARENA_CHUNK) + BLOCK_ALIGN - 1) / BLOCK_ALIGN) * BLOCK_ALIGN)
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static ARENA_CHUNK *newChunk(size_t sz);
+static uint8_t *chunkData(ARENA_CHUNK *pc);
+
+/*
+ * Allocate a new chunk with room for the given number of data bytes.
+ * 
+ * The data of the chunk is not initialized.
+ * 
+ * Parameters:
+ * 
+ *   sz - the number of data bytes
+ * 
+ * Return:
+ * 
+ *   the new chunk, unlinked
+ */
+static ARENA_CHUNK *newChunk(size_t sz) {
+  
+  ARENA_CHUNK *pc = NULL;
+  
+  if (sz > SIZE_MAX - CHUNK_HEAD) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  pc = (ARENA_CHUNK *) malloc(CHUNK_HEAD + sz);
+  if (pc == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  pc->pPrev = NULL;
+  
+  return pc;
+}
+
+/*
+ * Get a pointer to the data of a chunk.
+ * 
+ * Parameters:
+ * 
+ *   pc - the chunk
+ * 
+ * Return:
+ * 
+ *   the start of the chunk data
+ */
+static uint8_t *chunkData(ARENA_CHUNK *pc) {
+  if (pc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  return ((uint8_t *) pc) + CHUNK_HEAD;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * arena_alloc function.
+ */
+void *arena_alloc(ARENA *pa, size_t sz) {
+  
+  ARENA_CHUNK *pc = NULL;
+  uint8_t *pResult = NULL;
+  
+  /* Check parameters */
+  if ((pa == NULL) || (sz < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (sz > CHUNK_LARGE) {
+    /* Large block, so give it its own chunk, linked behind the current
+     * chunk so that the current chunk continues to be filled */
+    pc = newChunk(sz);
+    if (pa->pHead != NULL) {
+      pc->pPrev = (pa->pHead)->pPrev;
+      (pa->pHead)->pPrev = pc;
+    } else {
+      pa->pHead = pc;
+      pa->used = CHUNK_SIZE;
+      pa->last = CHUNK_SIZE;
+    }
+    pResult = chunkData(pc);
+    
+  } else {
+    /* Round the size up to the alignment */
+    sz = ((sz + BLOCK_ALIGN - 1) / BLOCK_ALIGN) * BLOCK_ALIGN;
+    
+    /* Start a new chunk if the block doesn't fit in the current one */
+    if ((pa->pHead == NULL) || (sz > CHUNK_SIZE - pa->used)) {
+      pc = newChunk(CHUNK_SIZE);
+      pc->pPrev = pa->pHead;
+      pa->pHead = pc;
+      pa->used = 0;
+    }
+    
+    /* Carve the block from the current chunk */
+    pResult = chunkData(pa->pHead) + pa->used;
+    pa->last = pa->used;
+    pa->used += sz;
+  }
+  
+  memset(pResult, 0, sz);
+  return (void *) pResult;
+}
+
+/*
+ * arena_unalloc function.
+ */
+void arena_unalloc(ARENA *pa, void *p) {
+  
+  if ((pa == NULL) || (p == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (pa->pHead != NULL) {
+    if (pa->last < pa->used) {
+      if (((uint8_t *) p) == chunkData(pa->pHead) + pa->last) {
+        pa->used = pa->last;
+      }
+    }
+  }
+}
+
+/*
+ * arena_free function.
+ */
+void arena_free(ARENA *pa) {
+  
+  ARENA_CHUNK *pCur = NULL;
+  ARENA_CHUNK *pPrev = NULL;
+  
+  if (pa == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pCur = pa->pHead;
+  while (pCur != NULL) {
+    pPrev = pCur->pPrev;
+    free(pCur);
+    pCur = pPrev;
+  }
+  
+  memset(pa, 0, sizeof(ARENA));
+}
@@ -0,0 +1,126 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+/*
+ * arena.h
+ * =======
+ * 
+ * Region allocator of Infrared.
+ * 
+ * An arena hands out zero-filled blocks of memory carved from large
+ * chunks, and all the blocks are released at once when the arena is
+ * released, one chunk at a time.  This suits the framework objects,
+ * which are immutable once constructed and only released when their
+ * module shuts down, so that each object need not be allocated and
+ * released separately.
+ * 
+ * Arenas are not thread-safe.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - diagnostic.c
+ */
+
+#include <stddef.h>
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * ARENA_CHUNK structure prototype.
+ * 
+ * See the implementation file for definition.
+ */
+struct ARENA_CHUNK_TAG;
+typedef struct ARENA_CHUNK_TAG ARENA_CHUNK;
+
+/*
+ * ARENA structure.
+ * 
+ * The fields should only be used by the arena module.  An arena
+ * structure that is filled with zero is a valid, empty arena, so
+ * arenas in static storage need no initialization.
+ */
+typedef struct {
+  
+  /*
+   * The chunk that blocks are currently carved from, which is linked to
+   * all the earlier chunks, or NULL if no chunks allocated.
+   */
+  ARENA_CHUNK *pHead;
+  
+  /*
+   * The number of bytes used in the current chunk.
+   */
+  size_t used;
+  
+  /*
+   * The offset in the current chunk of the most recently allocated
+   * block, which is equal to used if that block can't be returned.
+   */
+  size_t last;
+  
+} ARENA;
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Allocate a zero-filled block of memory from an arena.
+ * 
+ * The block is aligned suitably for any of the framework structures,
+ * and it remains valid until the arena is released.  Blocks that are
+ * large compared to the chunk size get a chunk of their own.
+ * 
+ * An error occurs if out of memory.
+ * 
+ * Parameters:
+ * 
+ *   pa - the arena
+ * 
+ *   sz - the size of the block in bytes, which must be greater than
+ *   zero
+ * 
+ * Return:
+ * 
+ *   the new block
+ */
+void *arena_alloc(ARENA *pa, size_t sz);
+
+/*
+ * Return the most recently allocated block of an arena, so that its
+ * memory is used for the next allocation.
+ * 
+ * This is for objects that turn out not to be needed right after they
+ * were constructed.  If the given block is not the most recent one, or
+ * if it has its own chunk, the call has no effect and the memory is
+ * kept until the arena is released.
+ * 
+ * Parameters:
+ * 
+ *   pa - the arena
+ * 
+ *   p - the block to return
+ */
+void arena_unalloc(ARENA *pa, void *p);
+
+/*
+ * Release all the memory of an arena.
+ * 
+ * Every block allocated from the arena becomes invalid, and the arena
+ * is left empty and ready for new allocations.
+ * 
+ * Parameters:
+ * 
+ *   pa - the arena
+ */
+void arena_free(ARENA *pa);
+
+#endif
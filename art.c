@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -45,15 +46,6 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 struct ART_TAG {
   
-  /*
-   * The next articulation in the allocated articulation chain, or NULL
-   * if this is the last articulation in the chain.
-   * 
-   * The articulation chain allows the shutdown function to free all
-   * articulations.
-   */
-  ART *pNext;
-  
   /*
    * The numerator of the duration scaling factor, with an assumed
    * denominator of 8.
@@ -116,11 +108,10 @@ static long srcLine(long lnum) {
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last articulations in the articulation
- * chain, or NULL for both if no articulations allocated.
+ * The arena that all articulations are allocated from, which releases
+ * them all at once when the module shuts down.
  */
-static ART *m_pFirst = NULL;
-static ART *m_pLast = NULL;
+static ARENA m_arena;
 
 /*
  * Public function implementations
@@ -170,10 +161,7 @@ ART *art_new(
       srcLine(lnum));
   }
   
-  pa = (ART *) calloc(1, sizeof(ART));
-  if (pa == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
+  pa = (ART *) arena_alloc(&m_arena, sizeof(ART));
   
   while (scale_denom < 8) {
     scale_num *= 2;
@@ -184,16 +172,6 @@ ART *art_new(
   pa->bumper = bumper;
   pa->gap    = gap;
   
-  if (m_pLast == NULL) {
-    m_pFirst = pa;
-    m_pLast = pa;
-    pa->pNext = NULL;
-  } else {
-    m_pLast->pNext = pa;
-    pa->pNext = NULL;
-    m_pLast = pa;
-  }
-  
   return pa;
 }
 
@@ -201,22 +179,20 @@ ART *art_new(
  * art_shutdown function.
  */
 void art_shutdown(void) {
-  ART *pCur = NULL;
-  ART *pNext = NULL;
-  
   if (!m_shutdown) {
     m_shutdown = 1;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
-    }
-    m_pFirst = NULL;
-    m_pLast = NULL;
+    arena_free(&m_arena);
   }
 }
 
+/*
+ * art_restart function.
+ */
+void art_restart(void) {
+  art_shutdown();
+  m_shutdown = 0;
+}
+
 /*
  * art_transform function.
  */
@@ -261,6 +237,86 @@ int32_t art_transform(ART *pa, int32_t dur) {
   return result;
 }
 
+/*
+ * art_transform_batch function.
+ */
+int32_t art_transform_batch(
+          ART     * pa,
+    const int32_t * pDur,
+          int32_t * pResult,
+          int32_t   n) {
+  
+  int32_t k = 0;
+  int32_t d = 0;
+  int32_t r = 0;
+  int32_t lim = 0;
+  int32_t bumper = 0;
+  int32_t gap = 0;
+  int32_t scale = 0;
+  int32_t fault = -1;
+  int bad = 0;
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Articulation module is shut down");
+  }
+  if ((pa == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((n > 0) && ((pDur == NULL) || (pResult == NULL))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  scale = (int32_t) pa->scale;
+  lim = INT32_MAX / scale;
+  bumper = pa->bumper;
+  gap = pa->gap;
+  
+  /* Flag durations that might be rejected, without branching on the
+   * data so that the loop can be vectorized */
+  for(k = 0; k < n; k++) {
+    bad |= (pDur[k] < 1) | (pDur[k] > lim / 8);
+  }
+  
+  /* If anything was flagged, find the first duration that
+   * art_transform() would reject */
+  if (bad) {
+    for(k = 0; k < n; k++) {
+      d = pDur[k];
+      if (d < 1) {
+        break;
+      }
+      if (d <= INT32_MAX / 8) {
+        d *= 8;
+      }
+      if (d > lim) {
+        break;
+      }
+    }
+    if (k < n) {
+      fault = k;
+    }
+  }
+  
+  /* Transform all the durations if none are rejected, again without
+   * branching on the data; durations that are flagged but accepted
+   * are not multiplied by eight, in the same way as art_transform() */
+  if (fault < 0) {
+    for(k = 0; k < n; k++) {
+      d = pDur[k];
+      d = (d <= INT32_MAX / 8) ? (d * 8) : d;
+      
+      r = (d * scale) / 8;
+      r = (r < bumper) ? bumper : r;
+      r = (r > d + gap) ? (d + gap) : r;
+      r = (r < 1) ? 1 : r;
+      
+      pResult[k] = r;
+    }
+  }
+  
+  return fault;
+}
+
 /*
  * art_print function.
  */
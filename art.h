@@ -12,6 +12,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  */
 
@@ -95,6 +96,13 @@ ART *art_new(
  */
 void art_shutdown(void);
 
+/*
+ * Restart the articulation system, releasing all articulations that have been
+ * allocated in the same way as art_shutdown(), but leaving the articulation
+ * system ready to be used again.  This also works after a shutdown.
+ */
+void art_restart(void);
+
 /*
  * Transform a measured NMF duration in quanta into a performance
  * duration in subquanta according to the articulation object.
@@ -111,6 +119,40 @@ void art_shutdown(void);
  */
 int32_t art_transform(ART *pa, int32_t dur);
 
+/*
+ * Transform an array of measured NMF durations in the same way as
+ * art_transform().
+ * 
+ * The array is processed in streaming passes that the compiler can
+ * vectorize.  Durations that art_transform() would reject do not raise
+ * an error here.  Instead, the index of the first of them is returned
+ * and no results are stored, so that the caller can report the error
+ * in order, for example by passing that duration to art_transform().
+ * 
+ * pDur and pResult may be the same array.
+ * 
+ * Parameters:
+ * 
+ *   pa - the articulation
+ * 
+ *   pDur - the input NMF durations in quanta
+ * 
+ *   pResult - the array that receives the performance durations in
+ *   subquanta
+ * 
+ *   n - the number of durations, zero or greater
+ * 
+ * Return:
+ * 
+ *   the index of the first duration that art_transform() would reject,
+ *   or -1 if there is none
+ */
+int32_t art_transform_batch(
+          ART     * pa,
+    const int32_t * pDur,
+          int32_t * pResult,
+          int32_t   n);
+
 /*
  * Print a textual representation of an articulation to the given output
  * file.
@@ -7,6 +7,8 @@
  * See the header for further information.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include "blob.h"
 
 #include <limits.h>
@@ -14,6 +16,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -45,6 +53,19 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 #define INIT_CAP INT32_C(256)
 
+/*
+ * Concatenations with at most this many bytes are copied into a new
+ * contiguous blob instead of being made into a view.
+ */
+#define VIEW_MIN_LEN (32)
+
+/*
+ * The maximum depth of views, which bounds the recursion when views
+ * are assembled.  Blobs that would be deeper are copied into a new
+ * contiguous blob instead.
+ */
+#define VIEW_MAX_DEPTH (32)
+
 /*
  * Type declarations
  * =================
@@ -52,30 +73,81 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 
 /*
  * BLOB structure.  Prototype given in header.
+ * 
+ * A blob is either contiguous, with its bytes stored in a single array
+ * that may belong to another blob, or a view that refers to other
+ * blobs.  A slice view refers to a range of a single source blob, while
+ * a concatenation view is a rope that refers to a list of parts.  Views
+ * are only assembled into contiguous storage when blob_ptr() needs it.
  */
 struct BLOB_TAG {
   
   /*
-   * The next blob in the allocated blob chain, or NULL if this is the
-   * last blob in the chain.
+   * The length of blob data in bytes.
+   */
+  int32_t blen;
+  
+  /*
+   * The depth of the blob, which is zero if the blob is contiguous, or
+   * else one greater than the greatest depth of the blobs it refers to.
    * 
-   * The blob chain allows the shutdown function to free all blobs.
+   * Never exceeds VIEW_MAX_DEPTH.
    */
-  BLOB *pNext;
+  int32_t depth;
   
   /*
-   * The length of blob data in bytes.
+   * Pointer to the contiguous blob data, or NULL if the blob is a view
+   * that has not been assembled yet.
    */
-  int32_t blen;
+  const uint8_t *pData;
   
   /*
-   * The start of the blob data buffer.  The rest of the buffer extends
-   * beyond the end of the structure.
+   * For slice views, the source blob and the offset of the slice
+   * within it.  The source is never itself a slice view.  NULL and zero
+   * for other blobs.
+   */
+  BLOB *pSrc;
+  int32_t offs;
+  
+  /*
+   * For concatenation views, the number of parts and the array of
+   * parts, none of which are empty.  Zero and NULL for other blobs.
+   */
+  int32_t parts;
+  BLOB **ppPart;
+  
+  /*
+   * The start of the blob data buffer for blobs that store their own
+   * data.  The rest of the buffer extends beyond the end of the
+   * structure.
    */
   uint8_t buf[1];
   
 };
 
+/*
+ * MAP_REC structure.
+ * 
+ * Records a file mapping that blob_file() made, so that the mapping
+ * can be released when the module shuts down.
+ */
+typedef struct MAP_REC_TAG MAP_REC;
+struct MAP_REC_TAG {
+  
+  /*
+   * The mapping that was recorded before this one, or NULL if this is
+   * the first.
+   */
+  MAP_REC *pPrev;
+  
+  /*
+   * The start and length in bytes of the mapping.
+   */
+  void *pMap;
+  size_t len;
+  
+};
+
 /*
  * Local functions
  * ===============
@@ -86,7 +158,8 @@ static long srcLine(long lnum);
 
 static BLOB *initBlob(int32_t *pCap);
 static BLOB *appendBlob(BLOB *pb, int32_t *pCap, int c, long lnum);
-static BLOB *finishBlob(BLOB *pb, int32_t *pCap);
+static BLOB *finishBlob(ARENA *pa, BLOB *pb, int32_t *pCap);
+static void fillBlob(BLOB *pb, int32_t i, int32_t len, uint8_t *pDst);
 
 /*
  * If the given line number is within valid range, return it as-is.  In
@@ -134,7 +207,6 @@ static BLOB *initBlob(int32_t *pCap) {
     raiseErr(__LINE__, "Out of memory");
   }
   
-  pb->pNext = NULL;
   pb->blen = 0;
   
   return pb;
@@ -201,41 +273,112 @@ static BLOB *appendBlob(BLOB *pb, int32_t *pCap, int c, long lnum) {
 /*
  * Finish the given blob in its current state.
  * 
- * The given buffer capacity variable can be forgotten about after this
- * call.
+ * The finished blob is copied into the given arena, and the initialized
+ * blob is released.  The given buffer capacity variable can be
+ * forgotten about after this call.
  * 
  * Parmeters:
  * 
+ *   pa - the arena to allocate the finished blob from
+ * 
  *   pb - the initialized blob
  * 
  *   pCap - the initialized buffer capacity variable
  * 
  * Return:
  * 
- *   the possibly re-allocated blob
+ *   the finished blob in the arena
  */
-static BLOB *finishBlob(BLOB *pb, int32_t *pCap) {
+static BLOB *finishBlob(ARENA *pa, BLOB *pb, int32_t *pCap) {
   
   size_t sz = 0;
+  BLOB *pResult = NULL;
   
-  if ((pb == NULL) || (pCap == NULL)) {
+  if ((pa == NULL) || (pb == NULL) || (pCap == NULL)) {
     raiseErr(__LINE__, NULL);
   }
   
-  if (*pCap > pb->blen) {
-    if (pb->blen > 0) {
-      sz = ((size_t) (pb->blen - 1)) + sizeof(BLOB);
+  if (pb->blen > 0) {
+    sz = ((size_t) (pb->blen - 1)) + sizeof(BLOB);
+  } else {
+    sz = sizeof(BLOB);
+  }
+  
+  pResult = (BLOB *) arena_alloc(pa, sz);
+  pResult->blen = pb->blen;
+  if (pb->blen > 0) {
+    memcpy(pResult->buf, pb->buf, (size_t) pb->blen);
+  }
+  pResult->pData = pResult->buf;
+  
+  free(pb);
+  *pCap = 0;
+  
+  return pResult;
+}
+
+/*
+ * Copy a range of bytes from a blob to a buffer.
+ * 
+ * Views are followed down to the contiguous blobs that hold the bytes,
+ * so this works for any kind of blob.
+ * 
+ * Parameters:
+ * 
+ *   pb - the blob to copy from
+ * 
+ *   i - the offset of the first byte to copy
+ * 
+ *   len - the number of bytes to copy
+ * 
+ *   pDst - the buffer to copy to
+ */
+static void fillBlob(BLOB *pb, int32_t i, int32_t len, uint8_t *pDst) {
+  
+  int32_t k = 0;
+  int32_t n = 0;
+  BLOB *pp = NULL;
+  
+  if ((pb == NULL) || (pDst == NULL) || (i < 0) || (len < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (len > pb->blen - i) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  while (len > 0) {
+    if (pb->pData != NULL) {
+      /* Contiguous, so copy directly */
+      memcpy(pDst, &((pb->pData)[i]), (size_t) len);
+      len = 0;
+      
+    } else if (pb->pSrc != NULL) {
+      /* Slice view, so continue with the source */
+      i += pb->offs;
+      pb = pb->pSrc;
+      
     } else {
-      sz = sizeof(BLOB);
-    }
-    
-    pb = (BLOB *) realloc(pb, sz);
-    if (pb == NULL) {
-      raiseErr(__LINE__, "Out of memory");
+      /* Concatenation view, so copy from each part that overlaps */
+      for(k = 0; (k < pb->parts) && (len > 0); k++) {
+        pp = (pb->ppPart)[k];
+        if (i >= pp->blen) {
+          i -= pp->blen;
+        } else {
+          n = pp->blen - i;
+          if (n > len) {
+            n = len;
+          }
+          fillBlob(pp, i, n, pDst);
+          pDst += n;
+          len -= n;
+          i = 0;
+        }
+      }
+      if (len > 0) {
+        raiseErr(__LINE__, NULL);
+      }
     }
   }
-  
-  return pb;
 }
 
 /*
@@ -249,11 +392,23 @@ static BLOB *finishBlob(BLOB *pb, int32_t *pCap) {
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last blobs in the blob chain, or NULL for
- * both if no blobs allocated.
+ * The arena that all blobs are allocated from, which releases them all
+ * at once when the module shuts down.
+ */
+static ARENA m_arena;
+
+/*
+ * The number of blobs allocated since the module was started or
+ * restarted, for profiling.
+ */
+static int32_t m_count = 0;
+
+/*
+ * The most recent file mapping made by blob_file(), which is linked to
+ * all the earlier ones, or NULL if there are none.  The records are
+ * allocated from the arena.
  */
-static BLOB *m_pFirst = NULL;
-static BLOB *m_pLast = NULL;
+static MAP_REC *m_pMap = NULL;
 
 /*
  * Public function implementations
@@ -314,17 +469,9 @@ BLOB *blob_fromHex(const char *pStr, long lnum) {
     pb = appendBlob(pb, &cap, v, lnum);
   }
   
-  pb = finishBlob(pb, &cap);
+  pb = finishBlob(&m_arena, pb, &cap);
   
-  if (m_pLast == NULL) {
-    m_pFirst = pb;
-    m_pLast = pb;
-    pb->pNext = NULL;
-  } else {
-    m_pLast->pNext = pb;
-    pb->pNext = NULL;
-    m_pLast = pb;
-  }
+  m_count++;
   
   return pb;
 }
@@ -336,6 +483,7 @@ BLOB *blob_concat(BLOB **ppList, int32_t list_len, long lnum) {
   
   int32_t i = 0;
   int32_t full_len = 0;
+  int32_t depth = 0;
   int32_t fill = 0;
   size_t sz = 0;
   BLOB *pb = NULL;
@@ -353,6 +501,7 @@ BLOB *blob_concat(BLOB **ppList, int32_t list_len, long lnum) {
   }
   
   full_len = 0;
+  depth = 0;
   for(i = 0; i < list_len; i++) {
     if (ppList[i] == NULL) {
       raiseErr(__LINE__, NULL);
@@ -363,40 +512,49 @@ BLOB *blob_concat(BLOB **ppList, int32_t list_len, long lnum) {
         "Concatenated blob length too large on script line %ld",
         srcLine(lnum));
     }
+    if ((ppList[i])->depth > depth) {
+      depth = (ppList[i])->depth;
+    }
   }
+  depth++;
   
-  if (full_len > 0) {
-    sz = ((size_t) (full_len - 1)) + sizeof(BLOB);
-  } else {
-    sz = sizeof(BLOB);
-  }
-  
-  pb = (BLOB *) calloc(1, sz);
-  if (pb == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
-  
-  pb->blen = full_len;
-  
-  fill = 0;
-  for(i = 0; i < list_len; i++) {
-    if ((ppList[i])->blen > 0) {
-      memcpy(
-        &((pb->buf)[fill]),
-        (ppList[i])->buf,
-        (size_t) (ppList[i])->blen);
+  if ((full_len <= VIEW_MIN_LEN) || (depth > VIEW_MAX_DEPTH)) {
+    /* Short or too deep, so copy into a new contiguous blob */
+    if (full_len > 0) {
+      sz = ((size_t) (full_len - 1)) + sizeof(BLOB);
+    } else {
+      sz = sizeof(BLOB);
+    }
+    
+    pb = (BLOB *) arena_alloc(&m_arena, sz);
+    pb->blen = full_len;
+    
+    fill = 0;
+    for(i = 0; i < list_len; i++) {
+      fillBlob(ppList[i], 0, (ppList[i])->blen, &((pb->buf)[fill]));
       fill += (ppList[i])->blen;
     }
-  }
-  
-  if (m_pLast == NULL) {
-    raiseErr(__LINE__, NULL);
+    
+    pb->pData = pb->buf;
+    
   } else {
-    m_pLast->pNext = pb;
-    pb->pNext = NULL;
-    m_pLast = pb;
+    /* Make a concatenation view of the non-empty parts */
+    pb = (BLOB *) arena_alloc(&m_arena, sizeof(BLOB));
+    pb->blen = full_len;
+    pb->depth = depth;
+    pb->ppPart = (BLOB **) arena_alloc(
+                    &m_arena, ((size_t) list_len) * sizeof(BLOB *));
+    
+    for(i = 0; i < list_len; i++) {
+      if ((ppList[i])->blen > 0) {
+        (pb->ppPart)[pb->parts] = ppList[i];
+        (pb->parts)++;
+      }
+    }
   }
   
+  m_count++;
+  
   return pb;
 }
 
@@ -406,7 +564,7 @@ BLOB *blob_concat(BLOB **ppList, int32_t list_len, long lnum) {
 BLOB *blob_slice(BLOB *pSrc, int32_t i, int32_t j, long lnum) {
   
   BLOB *pb = NULL;
-  size_t sz = 0;
+  uint8_t *pBuf = NULL;
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Blob module is shut down");
@@ -425,34 +583,118 @@ BLOB *blob_slice(BLOB *pSrc, int32_t i, int32_t j, long lnum) {
       srcLine(lnum));
   }
   
-  sz = (size_t) (j - i);
-  if (sz > 0) {
-    sz = (sz - 1) + sizeof(BLOB);
+  pb = (BLOB *) arena_alloc(&m_arena, sizeof(BLOB));
+  pb->blen = j - i;
+  
+  if (pSrc->pData != NULL) {
+    /* Contiguous source, so share its data */
+    pb->pData = &((pSrc->pData)[i]);
+    
+  } else if (pSrc->pSrc != NULL) {
+    /* Slice of a slice view, so refer to the underlying source */
+    pb->pSrc = pSrc->pSrc;
+    pb->offs = pSrc->offs + i;
+    pb->depth = pSrc->depth;
+    
+  } else if (pSrc->depth < VIEW_MAX_DEPTH) {
+    /* Slice of a concatenation view */
+    pb->pSrc = pSrc;
+    pb->offs = i;
+    pb->depth = pSrc->depth + 1;
+    
   } else {
-    sz = sizeof(BLOB);
+    /* Slice of a concatenation view that is too deep, so copy */
+    if (pb->blen > 0) {
+      pBuf = (uint8_t *) arena_alloc(&m_arena, (size_t) pb->blen);
+      fillBlob(pSrc, i, pb->blen, pBuf);
+      pb->pData = pBuf;
+    } else {
+      pb->pData = pb->buf;
+    }
   }
   
-  pb = (BLOB *) calloc(1, sz);
-  if (pb == NULL) {
-    raiseErr(__LINE__, "Out of memory");
+  m_count++;
+  
+  return pb;
+}
+
+/*
+ * blob_file function.
+ */
+BLOB *blob_file(const char *pPath, long lnum) {
+  
+  BLOB *pb = NULL;
+  MAP_REC *pRec = NULL;
+  struct stat st;
+  void *pMap = NULL;
+  int fd = -1;
+  int err = 0;
+  
+  memset(&st, 0, sizeof(struct stat));
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Blob module is shut down");
+  }
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
   }
   
-  pb->blen = j - i;
-  if (pb->blen > 0) {
-    memcpy(
-      pb->buf,
-      &((pSrc->buf)[i]),
-      (size_t) pb->blen);
+  fd = open(pPath, O_RDONLY);
+  if (fd < 0) {
+    raiseErr(__LINE__, "Can't open blob file on script line %ld",
+              srcLine(lnum));
   }
   
-  if (m_pLast == NULL) {
-    raiseErr(__LINE__, NULL);
+  if (fstat(fd, &st)) {
+    err = 1;
+  } else if (!S_ISREG(st.st_mode)) {
+    err = 2;
+  } else if (st.st_size > BLOB_MAXLEN) {
+    err = 3;
+  }
+  
+  if (!err && (st.st_size > 0)) {
+    pMap = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                fd, 0);
+    if (pMap == MAP_FAILED) {
+      pMap = NULL;
+      err = 1;
+    }
+  }
+  
+  /* The mapping remains valid after the descriptor is closed */
+  close(fd);
+  fd = -1;
+  
+  if (err == 1) {
+    raiseErr(__LINE__, "Can't read blob file on script line %ld",
+              srcLine(lnum));
+  } else if (err == 2) {
+    raiseErr(__LINE__,
+      "Blob file is not a regular file on script line %ld",
+      srcLine(lnum));
+  } else if (err == 3) {
+    raiseErr(__LINE__, "Blob file too large on script line %ld",
+              srcLine(lnum));
+  }
+  
+  pb = (BLOB *) arena_alloc(&m_arena, sizeof(BLOB));
+  pb->blen = (int32_t) st.st_size;
+  
+  if (pMap != NULL) {
+    pRec = (MAP_REC *) arena_alloc(&m_arena, sizeof(MAP_REC));
+    pRec->pPrev = m_pMap;
+    pRec->pMap = pMap;
+    pRec->len = (size_t) st.st_size;
+    m_pMap = pRec;
+    
+    pb->pData = (const uint8_t *) pMap;
   } else {
-    m_pLast->pNext = pb;
-    pb->pNext = NULL;
-    m_pLast = pb;
+    pb->pData = pb->buf;
   }
   
+  m_count++;
+  
   return pb;
 }
 
@@ -460,28 +702,42 @@ BLOB *blob_slice(BLOB *pSrc, int32_t i, int32_t j, long lnum) {
  * blob_shutdown function.
  */
 void blob_shutdown(void) {
-  BLOB *pCur = NULL;
-  BLOB *pNext = NULL;
+  
+  MAP_REC *pRec = NULL;
   
   if (!m_shutdown) {
     m_shutdown = 1;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
+    for(pRec = m_pMap; pRec != NULL; pRec = pRec->pPrev) {
+      munmap(pRec->pMap, pRec->len);
     }
-    m_pFirst = NULL;
-    m_pLast = NULL;
+    m_pMap = NULL;
+    arena_free(&m_arena);
   }
 }
 
+/*
+ * blob_restart function.
+ */
+void blob_restart(void) {
+  blob_shutdown();
+  m_shutdown = 0;
+  m_count = 0;
+}
+
+/*
+ * blob_count function.
+ */
+int32_t blob_count(void) {
+  return m_count;
+}
+
 /*
  * blob_ptr function.
  */
 const uint8_t *blob_ptr(BLOB *pb) {
   
   const uint8_t *pResult = NULL;
+  uint8_t *pBuf = NULL;
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Blob module is shut down");
@@ -490,8 +746,17 @@ const uint8_t *blob_ptr(BLOB *pb) {
     raiseErr(__LINE__, NULL);
   }
   
+  /* Assemble views into a new array the first time the data is
+   * needed */
+  if ((pb->pData == NULL) && (pb->blen > 0)) {
+    pBuf = (uint8_t *) arena_alloc(&m_arena, (size_t) pb->blen);
+    fillBlob(pb, 0, pb->blen, pBuf);
+    pb->pData = pBuf;
+    pb->depth = 0;
+  }
+  
   if (pb->blen > 0) {
-    pResult = pb->buf;
+    pResult = pb->pData;
   } else {
     pResult = NULL;
   }
@@ -520,6 +785,7 @@ int32_t blob_len(BLOB *pb) {
 void blob_print(BLOB *pb, FILE *pOut) {
   
   int32_t i = 0;
+  const uint8_t *pData = NULL;
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Blob module is shut down");
@@ -528,13 +794,15 @@ void blob_print(BLOB *pb, FILE *pOut) {
     raiseErr(__LINE__, NULL);
   }
   
+  pData = blob_ptr(pb);
+  
   fprintf(pOut, "<");
   
   for(i = 0; i < pb->blen; i++) {
     if (i > 0) {
       fprintf(pOut, " ");
     }
-    fprintf(pOut, "%02x", (int) (pb->buf)[i]);
+    fprintf(pOut, "%02x", (int) pData[i]);
   }
   
   fprintf(pOut, ">");
@@ -12,6 +12,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  */
 
@@ -97,6 +98,10 @@ BLOB *blob_fromHex(const char *pStr, long lnum);
  * The given lnum should be from the Shastina parser, for use in error
  * reports.
  * 
+ * Unless the result is short, the bytes are not copied.  The new blob
+ * is a view that refers to the component blobs, and it is only
+ * assembled when blob_ptr() is called on it.
+ * 
  * Parameters:
  * 
  *   ppList - the list of component blobs or NULL if empty
@@ -126,6 +131,10 @@ BLOB *blob_concat(BLOB **ppList, int32_t list_len, long lnum);
  * less than or equal to the length of the source blob.  If j is equal
  * to i, then the new blob will be empty.
  * 
+ * The bytes are not copied.  The new blob shares the data of the
+ * source blob if it is contiguous, or else it is a view that is only
+ * assembled when blob_ptr() is called on it.
+ * 
  * Parameters:
  * 
  *   pSrc - the source blob
@@ -142,6 +151,29 @@ BLOB *blob_concat(BLOB **ppList, int32_t list_len, long lnum);
  */
 BLOB *blob_slice(BLOB *pSrc, int32_t i, int32_t j, long lnum);
 
+/*
+ * Create a new blob holding the contents of a binary file.
+ * 
+ * The file is mapped into memory read-only rather than read, so the
+ * bytes are not copied.  The mapping is released when the blob system
+ * shuts down or restarts.  The file must not be modified while the
+ * blob is in use.
+ * 
+ * An error occurs if the file can't be opened or mapped, if it is not
+ * a regular file, or if it is longer than BLOB_MAXLEN bytes.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ * 
+ * Return:
+ * 
+ *   the new blob
+ */
+BLOB *blob_file(const char *pPath, long lnum);
+
 /*
  * Shut down the blob system, releasing all blobs that have been
  * allocated and preventing all further calls to blob functions, except
@@ -149,6 +181,25 @@ BLOB *blob_slice(BLOB *pSrc, int32_t i, int32_t j, long lnum);
  */
 void blob_shutdown(void);
 
+/*
+ * Restart the blob system, releasing all blobs that have been
+ * allocated in the same way as blob_shutdown(), but leaving the blob
+ * system ready to be used again.  This also works after a shutdown.
+ */
+void blob_restart(void);
+
+/*
+ * Return the number of blobs that have been allocated since the
+ * module was started or restarted.
+ * 
+ * This is intended for profiling.
+ * 
+ * Return:
+ * 
+ *   the number of blobs allocated
+ */
+int32_t blob_count(void);
+
 /*
  * Get a pointer to the data within a given blob.
  * 
@@ -158,6 +209,10 @@ void blob_shutdown(void);
  * 
  * The return value may be NULL if blob_len() indicates an empty blob.
  * 
+ * If the blob is a view, the bytes are copied into a contiguous array
+ * the first time this is called, and later calls return the same
+ * array.
+ * 
  * Parameters:
  * 
  *   pb - the blob
@@ -10,10 +10,13 @@
 #include "control.h"
 
 #include <limits.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+
 #include "diagnostic.h"
 #include "midi.h"
 
@@ -82,9 +85,96 @@ typedef struct {
    * The graph mapped to this controller.
    */
   GRAPH *pg;
-
+  
+  /*
+   * The rate limit of the controller, as the minimum interval in moment
+   * offsets and the minimum change in graph value between messages.
+   * Both are zero if there is no limit.
+   */
+  int32_t interval;
+  int32_t delta;
+  
+  /*
+   * The most significant and least significant 7-bit data bytes of the
+   * value most recently sent for 14BIT, NONREG, and REG controllers, or
+   * -1 if no value has been sent yet by the current tracking.
+   */
+  int16_t last_a;
+  int16_t last_b;
+  
+  /*
+   * For NONREG and REG controllers, non-zero if this is the only NONREG
+   * or REG controller on its channel, so that the controller index only
+   * needs to be selected before the first value.
+   */
+  int8_t sole;
+  
 } CTL_MAP;
 
+/*
+ * Tracking lane structure.
+ * 
+ * When controllers are tracked with multiple threads, each controller
+ * mapping record has a lane of this structure at the same index,
+ * holding the graph span of the controller and the run of changes that
+ * were selected from it.
+ */
+typedef struct {
+  
+  /*
+   * The graph span of the controller over the tracking range.
+   */
+  GRAPH_SPAN span;
+  
+  /*
+   * The index in m_run of the first time and value pair of the run.
+   * Room is reserved for one pair for each node in the span.
+   */
+  int32_t off;
+  
+  /*
+   * The number of time and value pairs in the run.
+   */
+  int32_t len;
+  
+} CTL_LANE;
+
+/*
+ * Tracking job structure.
+ * 
+ * Each worker thread used by control_track() is given one of these
+ * structures describing the range of lanes it should fill in.
+ */
+typedef struct {
+  
+  /*
+   * The index of the first lane in this job.
+   */
+  int32_t lo;
+  
+  /*
+   * One greater than the index of the last lane in this job.
+   */
+  int32_t hi;
+  
+  /*
+   * The index of the first lane in this job that raised an error, or -1
+   * if the job completed without errors.
+   */
+  int32_t fault;
+  
+  /*
+   * The worker thread running this job.
+   */
+  pthread_t thread;
+  
+  /*
+   * The error trap for the worker thread.
+   */
+  jmp_buf trap;
+  
+} CTL_JOB;
+
 /*
  * Local data
  * ==========
@@ -104,6 +194,32 @@ static int32_t m_map_cap = 0;
 static int32_t m_map_len = 0;
 static CTL_MAP *m_map = NULL;
 
+/*
+ * The rate limit that is applied to controllers declared with
+ * control_auto(), set by control_limit().
+ * 
+ * m_limit_interval is in moment offsets.
+ */
+static int32_t m_limit_interval = 0;
+static int32_t m_limit_delta = 0;
+
+/*
+ * The number of threads to use for tracking controllers.
+ * 
+ * One means all controllers are tracked on the calling thread.
+ */
+static int m_threads = 1;
+
+/*
+ * The tracking lanes, with one lane for each controller mapping record,
+ * and the time and value pairs of their runs.
+ * 
+ * These are only allocated while control_track() is tracking with
+ * multiple threads, and they are NULL otherwise.
+ */
+static CTL_LANE *m_lane = NULL;
+static int32_t *m_run = NULL;
+
 /*
  * Local functions
  * ===============
@@ -113,7 +229,12 @@ static CTL_MAP *m_map = NULL;
 static long srcLine(long lnum);
 static void capMap(int32_t n);
 static int32_t seekMap(int ctype, int ch, int idx);
+static void sendWide(CTL_MAP *pe, int32_t t, int idx, int32_t v);
 static void trackCtl(void *pCustom, int32_t t, int32_t v);
+static void trackLane(int32_t i, int32_t t_start, int32_t t_end);
+static void walkLane(int32_t i);
+static void *trackWorker(void *pArg);
+static void releaseLanes(void);
 
 /*
  * If the given line number is within valid range, return it as-is.  In
@@ -346,13 +467,64 @@ static int32_t seekMap(int ctype, int ch, int idx) {
 }
 
 /*
- * Graph tracking callback for generating automatic control messages.
+ * Send a 14-bit value to a pair of controllers, sending only the bytes
+ * that changed since the last value sent for the given controller
+ * mapping record.
+ * 
+ * Receivers reset the least significant byte when the most significant
+ * byte changes, so both bytes are sent whenever the most significant
+ * byte changes, or when no value has been sent yet.  Otherwise, only
+ * the least significant byte is sent, and nothing at all is sent if
+ * the value is unchanged.
+ * 
+ * Parameters:
+ * 
+ *   pe - the controller mapping record
  * 
- * The interface of this function matches the graph_fp_track function
+ *   t - the moment offset of the messages
+ * 
+ *   idx - the index of the most significant byte controller, which
+ *   has the least significant byte controller 0x20 above it
+ * 
+ *   v - the 14-bit value to send
+ */
+static void sendWide(CTL_MAP *pe, int32_t t, int idx, int32_t v) {
+  
+  int a = 0;
+  int b = 0;
+  
+  if (pe == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Parse value into most significant (a) and least significant (b)
+   * 7-bit data bytes */
+  a = (int) ((v >> 7) & 0x7f);
+  b = (int) ( v       & 0x7f);
+  
+  if ((pe->last_a < 0) || (pe->last_a != a)) {
+    midi_message(t, 0, (int) pe->ch, MIDI_MSG_CONTROL, idx, a);
+    midi_message(t, 0, (int) pe->ch, MIDI_MSG_CONTROL, idx + 0x20, b);
+    
+  } else if (pe->last_b != b) {
+    midi_message(t, 0, (int) pe->ch, MIDI_MSG_CONTROL, idx + 0x20, b);
+  }
+  
+  pe->last_a = (int16_t) a;
+  pe->last_b = (int16_t) b;
+}
+
+/*
+ * Generate the automatic control messages for a change in graph value.
+ * 
+ * This is invoked for each change in the graph span being tracked.  The
+ * interface of this function matches the graph_fp_track function
  * pointer type.
  * 
  * The custom pointer must be to the CTL_MAP structure that is currently
- * being tracked.
+ * being tracked.  The last value sent is recorded in the structure, so
+ * that 14-bit values and the selection of non-registered and
+ * registered controllers are only sent when they change.
  * 
  * Parameters:
  * 
@@ -364,9 +536,7 @@ static int32_t seekMap(int ctype, int ch, int idx) {
  */
 static void trackCtl(void *pCustom, int32_t t, int32_t v) {
   
-  const CTL_MAP *pe = NULL;
-  int a = 0;
-  int b = 0;
+  CTL_MAP *pe = NULL;
   int ia = 0;
   int ib = 0;
   
@@ -374,7 +544,7 @@ static void trackCtl(void *pCustom, int32_t t, int32_t v) {
   if (pCustom == NULL) {
     raiseErr(__LINE__, NULL);
   }
-  pe = (const CTL_MAP *) pCustom;
+  pe = (CTL_MAP *) pCustom;
   
   /* Different handling depending on controller type */
   if (pe->ctype == CONTROL_TYPE_TEMPO) { /* ========================= */
@@ -402,16 +572,8 @@ static void trackCtl(void *pCustom, int32_t t, int32_t v) {
       raiseErr(__LINE__, "14-bit controller graph value out of range");
     }
     
-    /* Parse value into most significant (a) and least significant (b)
-     * 7-bit data bytes */
-    a = (int) ((v >> 7) & 0x7f);
-    b = (int) ( v       & 0x7f);
-    
-    /* Generate automatic message */
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, (int) pe->idx, a);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, (int) (pe->idx + 0x20), b);
+    /* Generate automatic messages for the bytes that changed */
+    sendWide(pe, t, (int) pe->idx, v);
     
   } else if (pe->ctype == CONTROL_TYPE_NONREG) { /* ================= */
     /* Check graph value */
@@ -420,25 +582,23 @@ static void trackCtl(void *pCustom, int32_t t, int32_t v) {
         "Non-registered controller graph value out of range");
     }
     
-    /* Parse value into most significant (a) and least significant (b)
-     * 7-bit data bytes */
-    a = (int) ((v >> 7) & 0x7f);
-    b = (int) ( v       & 0x7f);
-    
     /* Parse index into most significant (ia) and least significant (ib)
      * 7-bit data types */
     ia = (int) ((pe->idx >> 7) & 0x7f);
     ib = (int) ( pe->idx       & 0x7f);
     
-    /* Generate automatic message */
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x62, ib);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x63, ia);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x06, a);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x26, b);
+    /* Select the controller unless it is the only one on the channel
+     * and it was already selected, in which case only the data entry
+     * bytes that changed need to be sent */
+    if ((!(pe->sole)) || (pe->last_a < 0)) {
+      midi_message(
+        t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x62, ib);
+      midi_message(
+        t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x63, ia);
+      pe->last_a = -1;
+      pe->last_b = -1;
+    }
+    sendWide(pe, t, 0x06, v);
     
   } else if (pe->ctype == CONTROL_TYPE_REG) { /* ==================== */
     /* Check graph value */
@@ -447,25 +607,23 @@ static void trackCtl(void *pCustom, int32_t t, int32_t v) {
         "Registered controller graph value out of range");
     }
     
-    /* Parse value into most significant (a) and least significant (b)
-     * 7-bit data bytes */
-    a = (int) ((v >> 7) & 0x7f);
-    b = (int) ( v       & 0x7f);
-    
     /* Parse index into most significant (ia) and least significant (ib)
      * 7-bit data types */
     ia = (int) ((pe->idx >> 7) & 0x7f);
     ib = (int) ( pe->idx       & 0x7f);
     
-    /* Generate automatic message */
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x64, ib);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x65, ia);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x06, a);
-    midi_message(
-      t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x26, b);
+    /* Select the controller unless it is the only one on the channel
+     * and it was already selected, in which case only the data entry
+     * bytes that changed need to be sent */
+    if ((!(pe->sole)) || (pe->last_a < 0)) {
+      midi_message(
+        t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x64, ib);
+      midi_message(
+        t, 0, (int) pe->ch, MIDI_MSG_CONTROL, 0x65, ia);
+      pe->last_a = -1;
+      pe->last_b = -1;
+    }
+    sendWide(pe, t, 0x06, v);
     
   } else if (pe->ctype == CONTROL_TYPE_PRESSURE) { /* =============== */
     /* Check graph value */
@@ -492,6 +650,153 @@ static void trackCtl(void *pCustom, int32_t t, int32_t v) {
   }
 }
 
+/*
+ * Generate the automatic control messages for a single controller
+ * mapping record on the calling thread.
+ * 
+ * Parameters:
+ * 
+ *   i - the index of the controller mapping record
+ * 
+ *   t_start - the starting moment offset of the tracking range
+ * 
+ *   t_end - the ending moment offset of the tracking range
+ */
+static void trackLane(int32_t i, int32_t t_start, int32_t t_end) {
+  
+  int32_t j = 0;
+  int32_t t = 0;
+  int32_t v = 0;
+  GRAPH_SPAN span;
+  
+  /* Initialize structures */
+  memset(&span, 0, sizeof(GRAPH_SPAN));
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= m_map_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  graph_span((m_map[i]).pg, &span, t_start, t_end, 0, 1, 0);
+  
+  for(j = 0; j < span.count;
+      j = graph_span_limit(
+            &span, j + 1,
+            (m_map[i]).interval, (m_map[i]).delta, t, v)) {
+    if (j > 0) {
+      t = ((span.pNode)[j]).t;
+    } else {
+      t = span.t_first;
+    }
+    v = ((span.pNode)[j]).v;
+    
+    trackCtl(&(m_map[i]), t, v);
+  }
+}
+
+/*
+ * Select the changes of a tracking lane that should generate messages
+ * and store them as the run of the lane.
+ * 
+ * The span of the lane must already be determined.  This only reads
+ * the graph nodes of the span and writes to the lane itself, so
+ * different lanes may be walked on different threads at once.
+ * 
+ * Parameters:
+ * 
+ *   i - the index of the lane
+ */
+static void walkLane(int32_t i) {
+  
+  CTL_LANE *pl = NULL;
+  const CTL_MAP *pe = NULL;
+  int32_t *pr = NULL;
+  int32_t j = 0;
+  int32_t t = 0;
+  int32_t v = 0;
+  
+  /* Check state and parameters */
+  if ((m_lane == NULL) || (i < 0) || (i >= m_map_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pl = &(m_lane[i]);
+  pe = &(m_map[i]);
+  pr = &(m_run[2 * pl->off]);
+  
+  pl->len = 0;
+  for(j = 0; j < (pl->span).count;
+      j = graph_span_limit(
+            &(pl->span), j + 1, pe->interval, pe->delta, t, v)) {
+    if (j > 0) {
+      t = (((pl->span).pNode)[j]).t;
+    } else {
+      t = (pl->span).t_first;
+    }
+    v = (((pl->span).pNode)[j]).v;
+    
+    pr[2 * pl->len] = t;
+    pr[(2 * pl->len) + 1] = v;
+    (pl->len)++;
+  }
+}
+
+/*
+ * Worker thread entrypoint for tracking controllers.
+ * 
+ * The interface of this function matches the start routine of the
+ * pthread_create() function.  The argument must be a CTL_JOB
+ * structure.
+ * 
+ * Errors are trapped rather than reported.  If an error occurs, the
+ * index of the lane that caused it is recorded in the job and the job
+ * stops.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the CTL_JOB structure
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *trackWorker(void *pArg) {
+  
+  CTL_JOB *pj = NULL;
+  volatile int32_t i = 0;
+  
+  pj = (CTL_JOB *) pArg;
+  
+  i = pj->lo;
+  pj->fault = -1;
+  
+  diagnostic_trap(&(pj->trap));
+  if (setjmp(pj->trap)) {
+    pj->fault = i;
+  } else {
+    for( ; i < pj->hi; i++) {
+      walkLane(i);
+    }
+  }
+  diagnostic_trap(NULL);
+  
+  return NULL;
+}
+
+/*
+ * Release the tracking lanes and their runs, if allocated.
+ */
+static void releaseLanes(void) {
+  if (m_lane != NULL) {
+    free(m_lane);
+    m_lane = NULL;
+  }
+  if (m_run != NULL) {
+    free(m_run);
+    m_run = NULL;
+  }
+}
+
 /*
  * Public function implementations
  * ===============================
@@ -785,6 +1090,26 @@ void control_modal(
   }
 }
 
+/*
+ * control_limit function.
+ */
+void control_limit(int32_t interval, int32_t delta, long lnum) {
+  
+  if ((interval < 0) || (interval > CONTROL_LIMIT_MAX)) {
+    raiseErr(__LINE__,
+      "Automation interval out of range on script line %ld",
+      srcLine(lnum));
+  }
+  if (delta < 0) {
+    raiseErr(__LINE__,
+      "Automation delta out of range on script line %ld",
+      srcLine(lnum));
+  }
+  
+  m_limit_interval = interval * 3;
+  m_limit_delta = delta;
+}
+
 /*
  * control_auto function.
  */
@@ -877,6 +1202,8 @@ void control_auto(
     (m_map[m_map_len]).ch    = (int8_t)  ch;
     (m_map[m_map_len]).idx   = (int16_t) idx;
     (m_map[m_map_len]).pg    = pg;
+    (m_map[m_map_len]).interval = m_limit_interval;
+    (m_map[m_map_len]).delta    = m_limit_delta;
     
     m_map_len++;
     
@@ -884,6 +1211,8 @@ void control_auto(
     /* An existing record already has a matching key, so just update its
      * graph value */
     (m_map[i]).pg = pg;
+    (m_map[i]).interval = m_limit_interval;
+    (m_map[i]).delta    = m_limit_delta;
     
   } else {
     /* A new record is required and insert it before the record at index
@@ -901,6 +1230,8 @@ void control_auto(
     (m_map[i]).ch    = (int8_t)  ch;
     (m_map[i]).idx   = (int16_t) idx;
     (m_map[i]).pg    = pg;
+    (m_map[i]).interval = m_limit_interval;
+    (m_map[i]).delta    = m_limit_delta;
   }
 }
 
@@ -913,22 +1244,206 @@ void control_track(void) {
   int32_t track_end   = 0;
   
   int32_t i = 0;
+  int32_t j = 0;
+  int32_t k = 0;
+  int32_t count = 0;
+  int32_t fault = -1;
+  int64_t total = 0;
+  int64_t target = 0;
+  const int32_t *pr = NULL;
+  CTL_JOB *pj = NULL;
+  int32_t regs[MIDI_CH_MAX + 1];
+  
+  /* Initialize arrays */
+  memset(regs, 0, sizeof(regs));
+  
+  /* Forget the values sent by any previous tracking, and determine
+   * which non-registered and registered controllers are the only ones
+   * on their channel */
+  for(i = 0; i < m_map_len; i++) {
+    (m_map[i]).last_a = -1;
+    (m_map[i]).last_b = -1;
+    if (((m_map[i]).ctype == CONTROL_TYPE_NONREG) ||
+        ((m_map[i]).ctype == CONTROL_TYPE_REG)) {
+      (regs[(m_map[i]).ch])++;
+    }
+  }
+  for(i = 0; i < m_map_len; i++) {
+    if ((((m_map[i]).ctype == CONTROL_TYPE_NONREG) ||
+          ((m_map[i]).ctype == CONTROL_TYPE_REG)) &&
+        (regs[(m_map[i]).ch] == 1)) {
+      (m_map[i]).sole = 1;
+    } else {
+      (m_map[i]).sole = 0;
+    }
+  }
   
   /* Determine the starting and ending moment offset of the event range
    * where the controller will be tracked */
   track_start = pointer_pack(midi_range_lower(), 0);
   track_end   = pointer_pack(midi_range_upper(), 2);
   
-  /* Track all of the mapped graphs */
-  for(i = 0; i < m_map_len; i++) {
-    graph_track(
-      (m_map[i]).pg,
-      &trackCtl,
-      &(m_map[i]),
-      track_start,
-      track_end,
-      0,
-      1,
-      0);
+  /* Determine the number of jobs, with no more jobs than controllers */
+  count = (int32_t) m_threads;
+  if (count > m_map_len) {
+    count = m_map_len;
   }
+  
+  if (count <= 1) {
+    /* Single-threaded tracking generates the messages of each mapped
+     * graph directly */
+    for(i = 0; i < m_map_len; i++) {
+      trackLane(i, track_start, track_end);
+    }
+    
+  } else {
+    /* Determine the spans on this thread, because the first span of a
+     * graph may materialize its nodes, and reserve room in the runs for
+     * every node of the spans */
+    releaseLanes();
+    m_lane = (CTL_LANE *) calloc((size_t) m_map_len, sizeof(CTL_LANE));
+    if (m_lane == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    total = 0;
+    for(i = 0; i < m_map_len; i++) {
+      graph_span(
+        (m_map[i]).pg,
+        &((m_lane[i]).span),
+        track_start,
+        track_end,
+        0,
+        1,
+        0);
+      
+      (m_lane[i]).off = (int32_t) total;
+      total += (int64_t) ((m_lane[i]).span).count;
+      if (total > INT32_MAX / 2) {
+        raiseErr(__LINE__, "Too many controller changes to track");
+      }
+    }
+    
+    if (total > 0) {
+      m_run = (int32_t *) calloc((size_t) (total * 2), sizeof(int32_t));
+      if (m_run == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+    }
+    
+    /* Split the lanes into contiguous ranges with about the same number
+     * of span nodes in each */
+    pj = (CTL_JOB *) calloc((size_t) count, sizeof(CTL_JOB));
+    if (pj == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    j = 0;
+    for(k = 0; k < count; k++) {
+      (pj[k]).lo = j;
+      if (k < count - 1) {
+        target = (total * ((int64_t) (k + 1))) / ((int64_t) count);
+        for( ; j < m_map_len; j++) {
+          if ((j > (pj[k]).lo) && ((m_lane[j]).off >= target)) {
+            break;
+          }
+        }
+      } else {
+        j = m_map_len;
+      }
+      (pj[k]).hi = j;
+      (pj[k]).fault = -1;
+    }
+    
+    /* Start all the workers and wait for them to finish */
+    for(k = 0; k < count; k++) {
+      if (pthread_create(&((pj[k]).thread), NULL,
+                          &trackWorker, &(pj[k]))) {
+        raiseErr(__LINE__, "Failed to start tracking thread");
+      }
+    }
+    for(k = 0; k < count; k++) {
+      if (pthread_join((pj[k]).thread, NULL)) {
+        raiseErr(__LINE__, "Failed to join tracking thread");
+      }
+    }
+    
+    /* Jobs are in lane order, so the first job that failed has the
+     * earliest failing lane */
+    fault = -1;
+    for(k = 0; k < count; k++) {
+      if ((pj[k]).fault >= 0) {
+        fault = (pj[k]).fault;
+        break;
+      }
+    }
+    
+    free(pj);
+    pj = NULL;
+    
+    /* Reserve room for the messages of the runs, which for each change
+     * is at most four for non-registered and registered controllers,
+     * two for 14-bit controllers, and one otherwise */
+    total = 0;
+    for(i = 0; i < m_map_len; i++) {
+      if (((m_map[i]).ctype == CONTROL_TYPE_NONREG) ||
+          ((m_map[i]).ctype == CONTROL_TYPE_REG)) {
+        total += ((int64_t) (m_lane[i]).len) * 4;
+      } else if ((m_map[i]).ctype == CONTROL_TYPE_14BIT) {
+        total += ((int64_t) (m_lane[i]).len) * 2;
+      } else {
+        total += (int64_t) (m_lane[i]).len;
+      }
+    }
+    if (total > INT32_MAX) {
+      total = INT32_MAX;
+    }
+    midi_reserve((int32_t) total);
+    
+    /* Generate the messages of the runs in lane order on this thread,
+     * which gives every message the same event ID as single-threaded
+     * tracking would; the failing lane is tracked again on this thread
+     * to report its error */
+    for(i = 0; i < m_map_len; i++) {
+      if (i == fault) {
+        trackLane(i, track_start, track_end);
+        raiseErr(__LINE__, NULL);
+      }
+      
+      pr = &(m_run[2 * (m_lane[i]).off]);
+      for(j = 0; j < (m_lane[i]).len; j++) {
+        trackCtl(&(m_map[i]), pr[2 * j], pr[(2 * j) + 1]);
+      }
+    }
+    
+    releaseLanes();
+  }
+}
+
+/*
+ * control_threads function.
+ */
+void control_threads(int32_t n) {
+  if ((n < 1) || (n > CONTROL_THREAD_MAX)) {
+    raiseErr(__LINE__, "Invalid control thread count");
+  }
+  m_threads = (int) n;
+}
+
+/*
+ * control_restart function.
+ */
+void control_restart(void) {
+  if (m_map != NULL) {
+    free(m_map);
+    m_map = NULL;
+  }
+  m_map_cap = 0;
+  m_map_len = 0;
+  
+  m_limit_interval = 0;
+  m_limit_delta = 0;
+  
+  releaseLanes();
+  m_threads = 1;
 }
@@ -18,6 +18,10 @@
  *   - midi.c
  *   - pointer.c
  *   - text.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - POSIX threads (may require -lpthread)
  */
 
 #include <stddef.h>
@@ -77,6 +81,18 @@
  */
 #define CONTROL_MAX_14BIT (0x3fff)
 
+/*
+ * The maximum minimum interval for rate-limited automation, in
+ * subquanta.
+ */
+#define CONTROL_LIMIT_MAX (INT32_C(0x2aaaaaaa))
+
+/*
+ * The maximum number of threads that may be used for tracking
+ * controllers.
+ */
+#define CONTROL_THREAD_MAX (64)
+
 /*
  * The index of the data entry controller.
  * 
@@ -330,6 +346,34 @@ void control_modal(
     int32_t   count,
     long      lnum);
 
+/*
+ * Set the rate limit for automatic controllers.
+ * 
+ * The limit applies to all controllers that are subsequently scheduled
+ * with control_auto(), until the limit is changed again.  It is stored
+ * with each controller, so changing the limit later does not affect
+ * controllers that were already scheduled.  The default is no limit.
+ * 
+ * interval is the minimum time between messages, in subquanta.  It must
+ * be in range zero to CONTROL_LIMIT_MAX inclusive.  delta is the
+ * minimum change in graph value between messages, and must be zero or
+ * greater.  If both are zero, there is no limit.  Changes that do not
+ * satisfy both limits are dropped, except that the value a graph
+ * settles at is always sent.  See graph_span_limit() for the details.
+ * 
+ * The given lnum should be from the Shastina parser, and it is used for
+ * error reports if necessary.
+ * 
+ * Parameters:
+ * 
+ *   interval - the minimum interval in subquanta
+ * 
+ *   delta - the minimum change in value
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+void control_limit(int32_t interval, int32_t delta, long lnum);
+
 /*
  * Schedule automatic graph tracking for a specific controller.
  * 
@@ -403,4 +447,31 @@ void control_auto(
  */ 
 void control_track(void);
 
+/*
+ * Set the number of threads used to track controllers in
+ * control_track().
+ * 
+ * n must be in range 1 to CONTROL_THREAD_MAX inclusive.  The default is
+ * one, which tracks all controllers on the calling thread.  Greater
+ * values split the controllers into contiguous ranges whose graph spans
+ * are walked in parallel by worker threads, which select the changes
+ * that pass the rate limits of each controller.  The selected changes
+ * are then added to the MIDI module on the calling thread in the same
+ * order as single-threaded tracking, so the generated MIDI output is
+ * the same regardless of the number of threads.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of threads
+ */
+void control_threads(int32_t n);
+
+/*
+ * Restart the control module, discarding all the controllers that were
+ * registered with control_auto(), the rate limit set by
+ * control_limit(), and the thread count set by control_threads(), so
+ * that the module is ready for another rendering.
+ */
+void control_restart(void);
+
 #endif
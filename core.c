@@ -61,6 +61,18 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 #define BANK_INIT_CAP   (64)
 #define BANK_MAX_CAP    (16384)
 
+/*
+ * The number of slots in the bank lookup cache, which must be a power
+ * of two.
+ */
+#define BANK_CACHE_SIZE (256)
+
+/*
+ * The maximum length of a variable or constant name, excluding the
+ * terminating nul.
+ */
+#define NAME_MAX_LEN    (31)
+
 /*
  * The initial and maximum capacities of the ruler stack.
  */
@@ -75,12 +87,14 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 /*
  * Structure used for tracking data in the variable and constant bank.
  * 
- * This simply contains a variant structure and a flag indicating
- * whether this is a constant or a variable.
+ * This contains a variant structure, a flag indicating whether this is
+ * a constant or a variable, and a copy of the name, which is used to
+ * verify hits in the bank lookup cache.
  */
 typedef struct {
   CORE_VARIANT cv;
   uint8_t is_const;
+  char name[NAME_MAX_LEN + 1];
 } BANK_CELL;
 
 /*
@@ -93,6 +107,14 @@ typedef struct {
  */
 static int m_shutdown = 0;
 
+/*
+ * The peak capacities of the interpreter stack and the memory bank,
+ * recorded when the state is released so that they remain available
+ * for statistics after a shutdown.
+ */
+static int32_t m_st_peak = 0;
+static int32_t m_bank_peak = 0;
+
 /*
  * The interpreter stack.
  * 
@@ -133,6 +155,19 @@ static int32_t m_bank_cap = 0;
 static int32_t m_bank_len = 0;
 static BANK_CELL *m_bank = NULL;
 
+/*
+ * The bank lookup cache.
+ * 
+ * This is a direct-mapped cache from variable and constant names to
+ * their index in the memory bank, so that names that are accessed
+ * repeatedly do not need to be looked up in m_bank_map each time.  The
+ * slot of a name is selected by hashName().  Each slot is either zero
+ * if it is empty, or one greater than the bank index of the last name
+ * looked up through that slot.  Since declared names can never be
+ * removed, slots never become stale.
+ */
+static int32_t m_bank_cache[BANK_CACHE_SIZE];
+
 /*
  * The ruler stack.
  * 
@@ -157,12 +192,16 @@ static RULER *m_ruler_default = NULL;
 /* Prototypes */
 static long srcLine(long lnum);
 static int validName(const char *pName);
+static uint32_t hashName(const char *pName);
+static long findBank(const char *pKey);
 
 static void capStack(int32_t n, long lnum);
 static void capGroup(int32_t n, long lnum);
 static void capBank(int32_t n, long lnum);
 static void capRStack(int32_t n, long lnum);
 
+static void releaseCore(void);
+
 /*
  * If the given line number is within valid range, return it as-is.  In
  * all other cases, return -1.
@@ -204,7 +243,7 @@ static int validName(const char *pName) {
   }
   
   slen = strlen(pName);
-  if ((slen < 1) || (slen > 31)) {
+  if ((slen < 1) || (slen > NAME_MAX_LEN)) {
     result = 0;
   }
   
@@ -230,6 +269,81 @@ static int validName(const char *pName) {
   return result;
 }
 
+/*
+ * Compute the bank lookup cache hash of a name.
+ * 
+ * This is the 32-bit FNV-1a hash of the bytes of the name.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name to hash
+ * 
+ * Return:
+ * 
+ *   the hash of the name
+ */
+static uint32_t hashName(const char *pName) {
+  
+  uint32_t result = UINT32_C(2166136261);
+  const char *pc = NULL;
+  
+  if (pName == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(pc = pName; *pc != 0; pc++) {
+    result ^= (uint32_t) ((unsigned char) *pc);
+    result *= UINT32_C(16777619);
+  }
+  
+  return result;
+}
+
+/*
+ * Find the index of a declared variable or constant in the memory
+ * bank.
+ * 
+ * The bank lookup cache is checked first.  On a miss, the name is
+ * looked up in m_bank_map and the result is stored in the cache.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the name to look up, which must be a valid name
+ * 
+ * Return:
+ * 
+ *   the index in the memory bank, or -1 if the name is not declared
+ */
+static long findBank(const char *pKey) {
+  
+  long result = -1;
+  int32_t slot = 0;
+  int32_t c = 0;
+  
+  if (pKey == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  slot = (int32_t) (hashName(pKey) & ((uint32_t) (BANK_CACHE_SIZE - 1)));
+  c = m_bank_cache[slot];
+  
+  if ((c > 0) && (strcmp((m_bank[c - 1]).name, pKey) == 0)) {
+    result = (long) (c - 1);
+    
+  } else {
+    if (m_bank_map == NULL) {
+      m_bank_map = rfdict_alloc(1);
+    }
+    
+    result = rfdict_get(m_bank_map, pKey, -1);
+    if (result >= 0) {
+      m_bank_cache[slot] = ((int32_t) result) + 1;
+    }
+  }
+  
+  return result;
+}
+
 /*
  * Make room in capacity for a given number of elements in the
  * interpreter stack.
@@ -586,6 +700,58 @@ static void capRStack(int32_t n, long lnum) {
   }
 }
 
+/*
+ * Release all the interpreter state, leaving the stacks and the memory
+ * bank empty.
+ * 
+ * This does not check that the state is a valid end-state, so that it
+ * can also be used to discard the state of a script that failed.
+ */
+static void releaseCore(void) {
+  if (m_st_cap > m_st_peak) {
+    m_st_peak = m_st_cap;
+  }
+  if (m_bank_cap > m_bank_peak) {
+    m_bank_peak = m_bank_cap;
+  }
+  
+  if (m_st_cap > 0) {
+    m_st_cap = 0;
+    m_st_len = 0;
+    free(m_st);
+    m_st = NULL;
+  }
+  
+  if (m_gs_cap > 0) {
+    m_gs_cap = 0;
+    m_gs_len = 0;
+    free(m_gs);
+    m_gs = NULL;
+  }
+  
+  if (m_bank_map != NULL) {
+    rfdict_free(m_bank_map);
+    m_bank_map = NULL;
+  }
+  
+  if (m_bank_cap > 0) {
+    m_bank_cap = 0;
+    m_bank_len = 0;
+    free(m_bank);
+    m_bank = NULL;
+  }
+  memset(m_bank_cache, 0, sizeof(m_bank_cache));
+  
+  if (m_rs_cap > 0) {
+    m_rs_cap = 0;
+    m_rs_len = 0;
+    free(m_rs);
+    m_rs = NULL;
+  }
+  
+  m_ruler_default = NULL;
+}
+
 /*
  * Public function implementations
  * ===============================
@@ -763,6 +929,7 @@ void core_declare(int is_const, const char *pKey, long lnum) {
   }
   
   core_pop(&((m_bank[m_bank_len]).cv), lnum);
+  strcpy((m_bank[m_bank_len]).name, pKey);
   
   if (!rfdict_insert(m_bank_map, pKey, (long) m_bank_len)) {
     raiseErr(__LINE__, NULL);
@@ -774,6 +941,20 @@ void core_declare(int is_const, const char *pKey, long lnum) {
  * core_get function.
  */
 void core_get(const char *pKey, long lnum) {
+  core_get_slot(core_slot(pKey, lnum), lnum);
+}
+
+/*
+ * core_assign function.
+ */
+void core_assign(const char *pKey, long lnum) {
+  core_assign_slot(core_slot(pKey, lnum), lnum);
+}
+
+/*
+ * core_slot function.
+ */
+int32_t core_slot(const char *pKey, long lnum) {
   
   long i = 0;
   
@@ -788,53 +969,48 @@ void core_get(const char *pKey, long lnum) {
       pKey, srcLine(lnum));
   }
   
-  if (m_bank_map == NULL) {
-    m_bank_map = rfdict_alloc(1);
-  }
-  
-  i = rfdict_get(m_bank_map, pKey, -1);
+  i = findBank(pKey);
   if (i < 0) {
     raiseErr(__LINE__, "Var/const '%s' not defined on script line %ld",
       pKey, srcLine(lnum));
   }
   
-  core_push(&((m_bank[i]).cv), lnum);
+  return (int32_t) i;
 }
 
 /*
- * core_assign function.
+ * core_get_slot function.
  */
-void core_assign(const char *pKey, long lnum) {
-  
-  long i = 0;
+void core_get_slot(int32_t slot, long lnum) {
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Core module is shut down");
   }
-  if (pKey == NULL) {
+  if ((slot < 0) || (slot >= m_bank_len)) {
     raiseErr(__LINE__, NULL);
   }
-  if (!validName(pKey)) {
-    raiseErr(__LINE__, "Invalid var/const name '%s' on script line %ld",
-      pKey, srcLine(lnum));
-  }
   
-  if (m_bank_map == NULL) {
-    m_bank_map = rfdict_alloc(1);
-  }
+  core_push(&((m_bank[slot]).cv), lnum);
+}
+
+/*
+ * core_assign_slot function.
+ */
+void core_assign_slot(int32_t slot, long lnum) {
   
-  i = rfdict_get(m_bank_map, pKey, -1);
-  if (i < 0) {
-    raiseErr(__LINE__, "Var/const '%s' not defined on script line %ld",
-      pKey, srcLine(lnum));
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Core module is shut down");
+  }
+  if ((slot < 0) || (slot >= m_bank_len)) {
+    raiseErr(__LINE__, NULL);
   }
   
-  if ((m_bank[i]).is_const) {
+  if ((m_bank[slot]).is_const) {
     raiseErr(__LINE__, "Can't assign to const '%s' on script line %ld",
-      pKey, srcLine(lnum));
+      (m_bank[slot]).name, srcLine(lnum));
   }
   
-  core_push(&((m_bank[i]).cv), lnum);
+  core_push(&((m_bank[slot]).cv), lnum);
 }
 
 /*
@@ -900,6 +1076,26 @@ RULER *core_rstack_current(long lnum) {
   return pResult;
 }
 
+/*
+ * core_stats function.
+ */
+void core_stats(CORE_STATS *ps) {
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  memset(ps, 0, sizeof(CORE_STATS));
+  
+  ps->st_cap = m_st_peak;
+  if (m_st_cap > ps->st_cap) {
+    ps->st_cap = m_st_cap;
+  }
+  
+  ps->bank_cap = m_bank_peak;
+  if (m_bank_cap > ps->bank_cap) {
+    ps->bank_cap = m_bank_cap;
+  }
+}
+
 /*
  * core_shutdown function.
  */
@@ -916,43 +1112,20 @@ void core_shutdown(void) {
         "Open group left at end of script");
     }
     
-    if (m_st_cap > 0) {
-      m_st_cap = 0;
-      m_st_len = 0;
-      free(m_st);
-      m_st = NULL;
-    }
-    
-    if (m_gs_cap > 0) {
-      m_gs_cap = 0;
-      m_gs_len = 0;
-      free(m_gs);
-      m_gs = NULL;
-    }
-    
-    if (m_bank_map != NULL) {
-      rfdict_free(m_bank_map);
-      m_bank_map = NULL;
-    }
-    
-    if (m_bank_cap > 0) {
-      m_bank_cap = 0;
-      m_bank_len = 0;
-      free(m_bank);
-      m_bank = NULL;
-    }
-    
-    if (m_rs_cap > 0) {
-      m_rs_cap = 0;
-      m_rs_len = 0;
-      free(m_rs);
-      m_rs = NULL;
-    }
-    
-    m_ruler_default = NULL;
+    releaseCore();
   }
 }
 
+/*
+ * core_restart function.
+ */
+void core_restart(void) {
+  releaseCore();
+  m_st_peak = 0;
+  m_bank_peak = 0;
+  m_shutdown = 0;
+}
+
 /*
  * core_push_i function.
  */
@@ -101,6 +101,20 @@ typedef struct {
   
 } CORE_VARIANT;
 
+/*
+ * Statistics about the interpreter state.
+ */
+typedef struct {
+  
+  /*
+   * The peak capacities of the interpreter stack and the memory bank,
+   * in elements.
+   */
+  int32_t st_cap;
+  int32_t bank_cap;
+  
+} CORE_STATS;
+
 /*
  * Public functions
  * ================
@@ -227,6 +241,55 @@ void core_get(const char *pKey, long lnum);
  */
 void core_assign(const char *pKey, long lnum);
 
+/*
+ * Resolve the name of a declared constant or variable to its slot in
+ * the memory bank.
+ * 
+ * Slots are assigned in declaration order starting at zero, so the
+ * same script always resolves the same names to the same slots.  The
+ * slot can then be used with core_get_slot() and core_assign_slot()
+ * without looking up the name again.  An error occurs if the name is
+ * not declared.
+ * 
+ * The given lnum should be from the Shastina parser, and it is used for
+ * error reports if necessary.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the name of the constant or variable
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ * 
+ * Return:
+ * 
+ *   the slot of the constant or variable
+ */
+int32_t core_slot(const char *pKey, long lnum);
+
+/*
+ * Same as core_get(), except the constant or variable is given by its
+ * slot returned from core_slot().
+ * 
+ * Parameters:
+ * 
+ *   slot - the slot of the constant or variable to get
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+void core_get_slot(int32_t slot, long lnum);
+
+/*
+ * Same as core_assign(), except the variable is given by its slot
+ * returned from core_slot().
+ * 
+ * Parameters:
+ * 
+ *   slot - the slot of the variable to assign to
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+void core_assign_slot(int32_t slot, long lnum);
+
 /*
  * Push a ruler onto the ruler stack.
  * 
@@ -278,6 +341,19 @@ RULER *core_rstack_pop(long lnum);
  */
 RULER *core_rstack_current(long lnum);
 
+/*
+ * Get statistics about the interpreter state.
+ * 
+ * This may also be called after core_shutdown(), in which case the
+ * peak capacities reached before the shutdown are reported.
+ * core_restart() resets the statistics.
+ * 
+ * Parameters:
+ * 
+ *   ps - receives the statistics
+ */
+void core_stats(CORE_STATS *ps);
+
 /*
  * Shut down the core interpreter state and check that it is in a valid
  * end-state.
@@ -291,6 +367,16 @@ RULER *core_rstack_current(long lnum);
  */
 void core_shutdown(void);
 
+/*
+ * Restart the core interpreter state, discarding anything left on the
+ * stacks and in the memory bank.
+ * 
+ * Unlike core_shutdown(), the state is not checked, and the module is
+ * ready to interpret a new script afterwards.  This also works after a
+ * shutdown, or after a script stopped with an error.
+ */
+void core_restart(void);
+
 /*
  * Wrapper around core_push() that pushes an integer.
  */
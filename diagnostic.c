@@ -9,8 +9,12 @@
 
 #include "diagnostic.h"
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
 
 /*
  * Diagnostics
@@ -31,6 +35,57 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
   va_end(ap);
 }
 
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of call sites that diagnostic_limit() tracks, which must
+ * be a power of two.
+ */
+#define SITE_MAX (1024)
+
+/*
+ * The size in bytes of the standard error buffer installed by
+ * diagnostic_buffer().
+ */
+#define BUFFER_SIZE (65536)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * A call site tracked for the message limit.
+ */
+typedef struct {
+  
+  /*
+   * The source file of a warning site or the format string of a log
+   * message site, or NULL if this record is not used.
+   */
+  const void *pKey;
+  
+  /*
+   * The source line of a warning site, or -1 for a log message site.
+   */
+  int lnum;
+  
+  /*
+   * Non-zero for a warning site, zero for a log message site.
+   */
+  int warn;
+  
+  /*
+   * The number of messages reported from the site, which saturates at
+   * INT32_MAX.
+   */
+  int32_t count;
+  
+} DIAGNOSTIC_SITE;
+
 /*
  * Local data
  * ==========
@@ -42,6 +97,153 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 static const char *pModule = NULL;
 
+/*
+ * The thread-specific key holding the error trap of each thread, and
+ * the once control used to create the key.
+ */
+static pthread_key_t m_trap_key;
+static pthread_once_t m_trap_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The lock that keeps the messages of different threads from being
+ * interleaved, and which also guards the rest of the local data below.
+ */
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The selected diagnostic level and the message limit for each call
+ * site, or zero if there is no limit.
+ */
+static int m_level = DIAGNOSTIC_INFO;
+static int32_t m_limit = 0;
+
+/*
+ * The call sites tracked for the message limit, as an open-addressed
+ * hash table.
+ */
+static DIAGNOSTIC_SITE m_site[SITE_MAX];
+
+/*
+ * The standard error buffer, and a flag that is set once it has been
+ * installed.
+ */
+static char m_buf[BUFFER_SIZE];
+static int m_buffered = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static void trapInit(void);
+static int admit(const void *pKey, int lnum, int warn);
+static void say(int level, const char *pFormat, va_list ap);
+
+/*
+ * Create the thread-specific key for error traps.
+ * 
+ * This is called through pthread_once() so that it only runs once.
+ */
+static void trapInit(void) {
+  if (pthread_key_create(&m_trap_key, NULL)) {
+    fprintf(stderr, "Failed to create diagnostic trap key\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Count a message from a call site and check whether it is within the
+ * message limit.
+ * 
+ * The caller must hold m_lock.  If there is no limit, if pKey is NULL,
+ * or if the call site table is full, the message is always admitted.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the source file or format string of the call site
+ * 
+ *   lnum - the source line of the call site, or -1
+ * 
+ *   warn - non-zero for a warning, zero for a log message
+ * 
+ * Return:
+ * 
+ *   non-zero if the message should be reported, zero if it should be
+ *   suppressed
+ */
+static int admit(const void *pKey, int lnum, int warn) {
+  
+  DIAGNOSTIC_SITE *ps = NULL;
+  uint32_t h = 0;
+  int32_t i = 0;
+  int result = 1;
+  
+  if ((m_limit > 0) && (pKey != NULL)) {
+    /* Find the record of the call site, or a free record for it */
+    h = ((uint32_t) (((uintptr_t) pKey) >> 3))
+          ^ (((uint32_t) lnum) * UINT32_C(2654435761));
+    for(i = 0; i < SITE_MAX; i++) {
+      ps = &(m_site[(h + ((uint32_t) i)) & (SITE_MAX - 1)]);
+      if ((ps->pKey == NULL) || ((ps->pKey == pKey) &&
+            (ps->lnum == lnum) && (ps->warn == warn))) {
+        break;
+      }
+    }
+    
+    /* Count the message if the call site can be tracked */
+    if (i < SITE_MAX) {
+      if (ps->pKey == NULL) {
+        ps->pKey = pKey;
+        ps->lnum = lnum;
+        ps->warn = warn;
+      }
+      if (ps->count < INT32_MAX) {
+        (ps->count)++;
+      }
+      if (ps->count > m_limit) {
+        result = 0;
+      }
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Report a log or debug message.
+ * 
+ * The message is discarded if its level is more detailed than the
+ * selected level or if its call site is over the message limit.
+ * Nothing is reported if pFormat is NULL.
+ * 
+ * Parameters:
+ * 
+ *   level - the diagnostic level of the message
+ * 
+ *   pFormat - the format string for the message, or NULL
+ * 
+ *   ap - the arguments to the format string
+ */
+static void say(int level, const char *pFormat, va_list ap) {
+  
+  if (pFormat != NULL) {
+    pthread_mutex_lock(&m_lock);
+    if ((level <= m_level) && admit(pFormat, -1, 0)) {
+      
+      /* Report module name if known */
+      if (pModule != NULL) {
+        fprintf(stderr, "%s: ", pModule);
+      }
+      
+      /* Print message and line break */
+      vfprintf(stderr, pFormat, ap);
+      fprintf(stderr, "\n");
+    }
+    pthread_mutex_unlock(&m_lock);
+  }
+}
+
 /*
  * Public function implementations
  * ===============================
@@ -66,6 +268,26 @@ void diagnostic_global(
     const char    * pDetail,
           va_list   ap) {
   
+  jmp_buf *pTrap = NULL;
+  
+  /* If an error and the calling thread has a trap, jump to the trap
+   * without reporting anything */
+  if (err) {
+    pthread_once(&m_trap_once, &trapInit);
+    pTrap = (jmp_buf *) pthread_getspecific(m_trap_key);
+    if (pTrap != NULL) {
+      longjmp(*pTrap, 1);
+    }
+  }
+  
+  /* Skip warnings that are filtered out by the level or the limit */
+  pthread_mutex_lock(&m_lock);
+  if ((!err) && ((m_level < DIAGNOSTIC_WARN) ||
+                  (!admit(pSource, lnum, 1)))) {
+    pthread_mutex_unlock(&m_lock);
+    return;
+  }
+  
   /* Report module name if known */
   if (pModule != NULL) {
     fprintf(stderr, "%s: ", pModule);
@@ -101,8 +323,13 @@ void diagnostic_global(
     vfprintf(stderr, pDetail, ap);
   }
   
-  /* Print line break */
+  /* Print line break, and write out errors right away so that they
+   * are not lost if the process is killed before it exits */
   fprintf(stderr, "\n");
+  if (err) {
+    fflush(stderr);
+  }
+  pthread_mutex_unlock(&m_lock);
   
   /* If an error, stop the program */
   if (err) {
@@ -126,8 +353,9 @@ void diagnostic_startup(int argc, char *argv[], const char *pDefault) {
     pName = pDefault;
   }
   
-  /* Register module name */
+  /* Register module name and buffer standard error */
   diagnostic_set_module(pName);
+  diagnostic_buffer();
   
   /* Check argc */
   if (argc < 0) {
@@ -156,50 +384,147 @@ void diagnostic_startup(int argc, char *argv[], const char *pDefault) {
 }
 
 /*
- * diagnostic_log function.
- * 
- * NOTE:  diagnostic_vlog is a slightly modified copy of this function.
+ * diagnostic_trap function.
  */
-void diagnostic_log(const char *pFormat, ...) {
+void diagnostic_trap(jmp_buf *pTrap) {
+  pthread_once(&m_trap_once, &trapInit);
+  if (pthread_setspecific(m_trap_key, (const void *) pTrap)) {
+    raiseErr(__LINE__, "Failed to set diagnostic trap");
+  }
+}
+
+/*
+ * diagnostic_fail function.
+ */
+void diagnostic_fail(void) {
   
-  va_list ap;
+  jmp_buf *pTrap = NULL;
   
-  /* Only proceed if non-NULL passed */
-  if (pFormat != NULL) {
-    
-    /* Report module name if known */
-    if (pModule != NULL) {
-      fprintf(stderr, "%s: ", pModule);
-    }
-    
-    /* Print log message */
-    va_start(ap, pFormat);
-    vfprintf(stderr, pFormat, ap);
-    va_end(ap);
-    
-    /* Print line break */
-    fprintf(stderr, "\n");
+  pthread_once(&m_trap_once, &trapInit);
+  pTrap = (jmp_buf *) pthread_getspecific(m_trap_key);
+  if (pTrap != NULL) {
+    longjmp(*pTrap, 1);
   }
+  
+  exit(EXIT_FAILURE);
+}
+
+/*
+ * diagnostic_log function.
+ */
+void diagnostic_log(const char *pFormat, ...) {
+  va_list ap;
+  va_start(ap, pFormat);
+  say(DIAGNOSTIC_INFO, pFormat, ap);
+  va_end(ap);
 }
 
 /*
  * diagnostic_vlog function.
- * 
- * NOTE:  slightly modified copy of diagnostic_log.
  */
 void diagnostic_vlog(const char *pFormat, va_list ap) {
-  /* Only proceed if non-NULL passed */
-  if (pFormat != NULL) {
-    
-    /* Report module name if known */
-    if (pModule != NULL) {
-      fprintf(stderr, "%s: ", pModule);
+  say(DIAGNOSTIC_INFO, pFormat, ap);
+}
+
+/*
+ * diagnostic_debug function.
+ */
+#ifndef INFRARED_NODEBUG
+void diagnostic_debug(const char *pFormat, ...) {
+  va_list ap;
+  va_start(ap, pFormat);
+  say(DIAGNOSTIC_DEBUG, pFormat, ap);
+  va_end(ap);
+}
+#endif
+
+/*
+ * diagnostic_level function.
+ */
+void diagnostic_level(int level) {
+  if ((level < DIAGNOSTIC_ERROR) || (level > DIAGNOSTIC_DEBUG)) {
+    raiseErr(__LINE__, NULL);
+  }
+  pthread_mutex_lock(&m_lock);
+  m_level = level;
+  pthread_mutex_unlock(&m_lock);
+}
+
+/*
+ * diagnostic_limit function.
+ */
+void diagnostic_limit(int32_t count) {
+  if (count < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  pthread_mutex_lock(&m_lock);
+  m_limit = count;
+  memset(m_site, 0, sizeof(m_site));
+  pthread_mutex_unlock(&m_lock);
+}
+
+/*
+ * diagnostic_buffer function.
+ */
+void diagnostic_buffer(void) {
+  if (!m_buffered) {
+    m_buffered = 1;
+    if (setvbuf(stderr, m_buf, _IOFBF, BUFFER_SIZE)) {
+      sayWarn(__LINE__, "Failed to buffer standard error");
+    }
+    if (atexit(&diagnostic_flush)) {
+      raiseErr(__LINE__, "Failed to register diagnostic flush");
     }
-    
-    /* Print log message */
-    vfprintf(stderr, pFormat, ap);
-    
-    /* Print line break */
-    fprintf(stderr, "\n");
   }
 }
+
+/*
+ * diagnostic_sync function.
+ */
+void diagnostic_sync(void) {
+  pthread_mutex_lock(&m_lock);
+  fflush(stderr);
+  pthread_mutex_unlock(&m_lock);
+}
+
+/*
+ * diagnostic_flush function.
+ */
+void diagnostic_flush(void) {
+  
+  DIAGNOSTIC_SITE *ps = NULL;
+  int32_t i = 0;
+  
+  pthread_mutex_lock(&m_lock);
+  
+  for(i = 0; i < SITE_MAX; i++) {
+    ps = &(m_site[i]);
+    if ((m_limit > 0) && (ps->pKey != NULL) && (ps->count > m_limit)) {
+      
+      /* Report module name if known */
+      if (pModule != NULL) {
+        fprintf(stderr, "%s: ", pModule);
+      }
+      
+      /* Warning sites are identified by their source location, while
+       * log message sites only have their format string */
+      if (ps->warn) {
+        fprintf(stderr, "[Warning in \"%s\"", (const char *) ps->pKey);
+        if (ps->lnum >= 0) {
+          fprintf(stderr, " at line %d", ps->lnum);
+        }
+        fprintf(stderr, "] and %ld more similar warnings\n",
+          (long) (ps->count - m_limit));
+      } else {
+        fprintf(stderr, "and %ld more similar messages\n",
+          (long) (ps->count - m_limit));
+      }
+      
+      /* Keep the site at the limit, but clear its suppressed count */
+      ps->count = m_limit;
+    }
+  }
+  
+  fflush(stderr);
+  pthread_mutex_unlock(&m_lock);
+}
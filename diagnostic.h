@@ -8,17 +8,45 @@
  * Error and warning handling module.
  * 
  * Dependencies:
- *   (none)
+ *   POSIX threads (may require -lpthread)
  * 
  * Use diagnostic_startup() at the start of the program to set the
  * executable module name for use in diagnostic messages and also to
  * check the parameters passed to the main() function.
+ * 
+ * Warnings, log messages, and debug messages each have a level, and
+ * diagnostic_level() selects the most detailed level that is reported.
+ * diagnostic_limit() caps the number of messages reported from each
+ * call site, and the messages that are suppressed by the cap are
+ * counted and summarized by diagnostic_flush().
+ * 
+ * If INFRARED_NODEBUG is defined when compiling, diagnostic_debug()
+ * calls are removed by the preprocessor, so that debug logging costs
+ * nothing, including the evaluation of its arguments.
  */
 
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The diagnostic levels, from the least to the most detailed.
+ * 
+ * Errors are always reported.  Warnings are reported at the warning
+ * level and above, diagnostic_log() messages at the information level
+ * and above, and diagnostic_debug() messages only at the debug level.
+ */
+#define DIAGNOSTIC_ERROR (0)
+#define DIAGNOSTIC_WARN  (1)
+#define DIAGNOSTIC_INFO  (2)
+#define DIAGNOSTIC_DEBUG (3)
+
 /*
  * Public functions
  * ================
@@ -104,11 +132,20 @@ void diagnostic_set_module(const char *pName);
  * 
  *   program_name: [Warning in "source.c" at line 25] Detail message
  * 
+ * Warnings are not printed if diagnostic_level() selected a level below
+ * DIAGNOSTIC_WARN, or if the warning's call site has already reported
+ * as many warnings as diagnostic_limit() allows.  Errors are always
+ * printed.
+ * 
  * If a warning is reported, then the function returns after printing
  * the diagnostic message.  If an error was reported, then the function
  * will call exit() to stop the process with EXIT_FAILURE, and this
  * function will not return.
  * 
+ * The exception is if the calling thread has an error trap installed
+ * with diagnostic_trap().  In that case, errors print nothing and
+ * instead longjmp() to the trap.  Warnings are not affected by traps.
+ * 
  * Parameters:
  * 
  *   err - non-zero if error, zero if warning
@@ -139,6 +176,10 @@ void diagnostic_global(
  * Pass the argc and the argv parameters through that were passed to
  * main().  Neither argument is modified by this function.
  * 
+ * Standard error is also buffered with diagnostic_buffer(), so this
+ * function must be called before anything is written to standard
+ * error.
+ * 
  * pDefault is the default name to use for diagnostic_set_module() if
  * the executable name can not be determined from argv[0].  This should
  * just be the usual name of the program.  It should be a string
@@ -161,12 +202,46 @@ void diagnostic_global(
  */
 void diagnostic_startup(int argc, char *argv[], const char *pDefault);
 
+/*
+ * Install or remove an error trap for the calling thread.
+ * 
+ * This is intended for worker threads that must not stop the process
+ * on their own.  While a trap is installed, errors reported on the
+ * calling thread with diagnostic_global() will not print anything nor
+ * stop the program, but will instead longjmp() to the given trap with
+ * a value of one.  The caller is then responsible for reporting the
+ * error, usually by repeating the failed work on the main thread so
+ * that the error is reported normally.
+ * 
+ * Traps only affect the thread that installed them.  Pass NULL to
+ * remove the trap for the calling thread.  The trap must be removed
+ * before the jmp_buf goes out of scope.
+ * 
+ * Parameters:
+ * 
+ *   pTrap - the jump buffer to trap errors to, or NULL
+ */
+void diagnostic_trap(jmp_buf *pTrap);
+
+/*
+ * Stop with a failure after the caller has already reported why.
+ * 
+ * If the calling thread has an error trap installed with
+ * diagnostic_trap(), this jumps to the trap in the same way as an
+ * error.  Otherwise, the process is stopped with EXIT_FAILURE.  This
+ * function does not return.
+ */
+void diagnostic_fail(void);
+
 /*
  * Write a log message to standard error.
  * 
  * If the executable module name is known, it will be prefixed to the
  * log message.  A line break will be appended to the log message.
  * 
+ * Log messages are at the DIAGNOSTIC_INFO level, and each format string
+ * counts as a separate call site for diagnostic_limit().
+ * 
  * pFormat is the log message, which is a printf-style format string.
  * The variable argument list is passed afterwards.
  * 
@@ -184,4 +259,100 @@ void diagnostic_log(const char *pFormat, ...);
  */
 void diagnostic_vlog(const char *pFormat, va_list ap);
 
+/*
+ * Write a debug message to standard error.
+ * 
+ * This is the same as diagnostic_log() except that the message is at
+ * the DIAGNOSTIC_DEBUG level, so it is only reported if that level was
+ * selected with diagnostic_level().
+ * 
+ * If INFRARED_NODEBUG is defined, this is instead a macro that expands
+ * to nothing, and its arguments are not evaluated.
+ * 
+ * Parameters:
+ * 
+ *   pFormat - the format string for the debug message
+ * 
+ *   [variable] - the arguments to the format string
+ */
+#ifdef INFRARED_NODEBUG
+#define diagnostic_debug(...) ((void) 0)
+#else
+void diagnostic_debug(const char *pFormat, ...);
+#endif
+
+/*
+ * Select the most detailed diagnostic level that is reported.
+ * 
+ * level is one of the DIAGNOSTIC constants.  Messages at more detailed
+ * levels are discarded.  The default is DIAGNOSTIC_INFO, which reports
+ * everything except debug messages.
+ * 
+ * Parameters:
+ * 
+ *   level - the diagnostic level
+ */
+void diagnostic_level(int level);
+
+/*
+ * Limit the number of messages reported from each call site.
+ * 
+ * A call site is a source file and line number for warnings, or a
+ * format string for log and debug messages.  Once a call site has
+ * reported the given number of messages, its further messages are only
+ * counted, and diagnostic_flush() reports how many were suppressed.
+ * Errors are not limited.
+ * 
+ * Only a fixed number of call sites are tracked.  Messages from call
+ * sites beyond that number are never suppressed.
+ * 
+ * The default of zero means there is no limit.
+ * 
+ * Parameters:
+ * 
+ *   count - the maximum number of messages for each call site, or zero
+ *   for no limit
+ */
+void diagnostic_limit(int32_t count);
+
+/*
+ * Buffer standard error in a large block buffer.
+ * 
+ * This must be called before anything is written to standard error.
+ * Diagnostic messages are then collected in the buffer and written in
+ * large blocks instead of one small write for each part of each
+ * message.  The buffer is flushed with diagnostic_flush(), and
+ * diagnostic_flush() is also registered to run when the process exits.
+ * 
+ * So that buffered messages are not held back for long in processes
+ * that keep running, or lost when a process is killed, error messages
+ * are written out as soon as they are reported, and the buffer is also
+ * written out with diagnostic_sync() at the end of each processing
+ * phase.
+ * 
+ * diagnostic_startup() calls this function, so it is only needed by
+ * programs that do not use diagnostic_startup().
+ */
+void diagnostic_buffer(void);
+
+/*
+ * Write out the messages held in the standard error buffer.
+ * 
+ * Unlike diagnostic_flush(), suppressed messages are not reported, so
+ * this can be called at every phase boundary without breaking up the
+ * summary of suppressed messages.
+ */
+void diagnostic_sync(void);
+
+/*
+ * Report the messages suppressed by diagnostic_limit() and flush
+ * standard error.
+ * 
+ * Each call site that had messages suppressed gets one line saying how
+ * many, and the suppressed counts are then cleared.  This should be
+ * called before fork(), so that the child process does not report the
+ * messages of its parent again.
+ */
+void diagnostic_flush(void);
+
 #endif
@@ -0,0 +1,1430 @@
+/*
+ * driver.c
+ * ========
+ * 
+ * Implementation of driver.h
+ * 
+ * See the header for further information.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "driver.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "diagnostic.h"
+#include "midi.h"
+#include "pointer.h"
+#include "profile.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+static void sayWarn(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(0, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The initial and maximum capacities of the batch list, and the maximum
+ * length in bytes of a path in the batch list, excluding the line
+ * break.
+ */
+#define BATCH_INIT_CAP (16)
+#define BATCH_MAX_CAP  (INT32_C(1) << 20)
+#define BATCH_LINE_MAX (4095)
+
+/*
+ * The initial and maximum capacities of the data file list.
+ */
+#define INPUT_INIT_CAP (16)
+#define INPUT_MAX_CAP  (INT32_C(1) << 16)
+
+/*
+ * The extension of NMF files that is replaced in batch output paths,
+ * and the extension of the MIDI files generated in batch mode.
+ */
+#define BATCH_NMF_EXT ".nmf"
+#define BATCH_MIDI_EXT ".mid"
+
+/*
+ * The exit status of a watch session that stopped because the script
+ * or the section table of the NMF file changed, which tells the watch
+ * supervisor to start a new session right away.
+ */
+#define WATCH_RESTART (3)
+
+/*
+ * The maximum length in bytes of a data file path that a watch session
+ * reports to the watch supervisor, excluding the terminating nul.
+ * Longer paths are not waited on after a failed session.
+ */
+#define WATCH_PATH_MAX (4095)
+
+/*
+ * The change flags returned by watchWait().
+ */
+#define WATCH_SCRIPT (1)
+#define WATCH_NMF    (2)
+#define WATCH_DATA   (4)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * Signature of a file watched with the -watch program option.
+ * 
+ * Signatures are compared between polls to detect changes.  If the
+ * file could not be examined, missing is set and the other fields are
+ * zero.
+ */
+typedef struct {
+  int missing;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+} WATCH_SIG;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The batch list.
+ * 
+ * m_batch holds the dynamically allocated NMF paths listed in the batch
+ * file, with a capacity and length following the usual pattern.
+ */
+static int32_t m_batch_cap = 0;
+static int32_t m_batch_len = 0;
+static char **m_batch = NULL;
+
+/*
+ * The data file list.
+ * 
+ * m_input holds the dynamically allocated paths of the data files that
+ * the script read, as recorded with driver_input(), with a capacity and
+ * length following the usual pattern.  m_input_sig is a parallel array
+ * with the signature each file had when it was recorded, which -watch
+ * uses to notice changes to the data files.
+ */
+static int32_t m_input_cap = 0;
+static int32_t m_input_len = 0;
+static char **m_input = NULL;
+static WATCH_SIG *m_input_sig = NULL;
+
+/*
+ * The process ID of the watch supervisor in a watch session, or zero
+ * outside of watch sessions.
+ * 
+ * A session stops once it is no longer a child of the supervisor, so
+ * that interrupting only the supervisor does not leave it running.
+ */
+static pid_t m_watch_parent = 0;
+
+/*
+ * In a watch session, the write end of the pipe on which driver_input()
+ * reports each recorded data file path to the watch supervisor, as a
+ * string with its terminating nul; otherwise, -1.
+ * 
+ * The supervisor keeps the list of a failed session, so that it can
+ * wait for a fix to one of the data files as well.
+ */
+static int m_watch_fd = -1;
+
+/*
+ * The signatures of the script and of the NMF file in watch mode.
+ * 
+ * The supervisor records them at the start of each session, and the
+ * session process starts out with a copy of them, so that changes are
+ * noticed from the same starting point.
+ */
+static WATCH_SIG m_script_sig;
+static WATCH_SIG m_in_sig;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static void capInput(int32_t n);
+static void releaseInput(void);
+static void compileMap(
+    NMF_DATA   * pd,
+    const char * pPath,
+    int32_t      lo,
+    int32_t      hi);
+static void markSections(NMF_DATA *pd, int32_t lo, int32_t hi);
+
+static void capBatch(int32_t n);
+static void readBatch(const char *pPath);
+static void releaseBatch(void);
+static char *batchOutput(const char *pPath);
+static void renderWorker(NMF_DATA *pRef, int32_t i);
+static int reapWorker(pid_t *pPid, int32_t *pJob, int32_t *pCount);
+static int sameSections(NMF_DATA *pA, NMF_DATA *pB);
+
+static void watchSig(const char *pPath, WATCH_SIG *ps);
+static int watchSame(const WATCH_SIG *pA, const WATCH_SIG *pB);
+static void watchSleep(int32_t ms);
+static int watchWait(
+    const char * pScriptPath,
+    const char * pInPath,
+    WATCH_SIG  * pScriptSig,
+    WATCH_SIG  * pInSig,
+    int32_t      ms);
+static void watchCollect(int fd);
+
+/*
+ * Make room in capacity for a given number of paths in the data file
+ * list.
+ * 
+ * n is the number of additional elements beyond current length to make
+ * room for.  It must be zero or greater.  An error occurs if the
+ * requested expansion would go beyond the maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of elements to make room for
+ */
+static void capInput(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Only proceed if n is non-zero */
+  if (n > 0) {
+    
+    /* Make initial allocation if necessary */
+    if (m_input_cap < 1) {
+      m_input = (char **) calloc(
+                  (size_t) INPUT_INIT_CAP, sizeof(char *));
+      m_input_sig = (WATCH_SIG *) calloc(
+                      (size_t) INPUT_INIT_CAP, sizeof(WATCH_SIG));
+      if ((m_input == NULL) || (m_input_sig == NULL)) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      m_input_cap = INPUT_INIT_CAP;
+      m_input_len = 0;
+    }
+    
+    /* Compute target length */
+    if (n <= INT32_MAX - m_input_len) {
+      target = m_input_len + n;
+    } else {
+      raiseErr(__LINE__, "Data file list capacity exceeded");
+    }
+    
+    /* Only proceed if target length exceeds current capacity */
+    if (target > m_input_cap) {
+      /* Check that target within maximum capacity */
+      if (target > INPUT_MAX_CAP) {
+        raiseErr(__LINE__, "Data file list capacity exceeded");
+      }
+      
+      /* Compute new capacity by doubling current capacity until greater
+       * than or equal to target length, and then limiting to maximum
+       * capacity */
+      new_cap = m_input_cap;
+      while (new_cap < target) {
+        new_cap *= 2;
+      }
+      if (new_cap > INPUT_MAX_CAP) {
+        new_cap = INPUT_MAX_CAP;
+      }
+      
+      /* Expand capacity */
+      m_input = (char **) realloc(m_input,
+                            ((size_t) new_cap) * sizeof(char *));
+      m_input_sig = (WATCH_SIG *) realloc(m_input_sig,
+                            ((size_t) new_cap) * sizeof(WATCH_SIG));
+      if ((m_input == NULL) || (m_input_sig == NULL)) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      memset(
+        &(m_input[m_input_cap]),
+        0,
+        ((size_t) (new_cap - m_input_cap)) * sizeof(char *));
+      memset(
+        &(m_input_sig[m_input_cap]),
+        0,
+        ((size_t) (new_cap - m_input_cap)) * sizeof(WATCH_SIG));
+      
+      m_input_cap = new_cap;
+    }
+  }
+}
+
+/*
+ * Release the data file list, leaving it empty.
+ */
+static void releaseInput(void) {
+  
+  int32_t i = 0;
+  
+  for(i = 0; i < m_input_len; i++) {
+    free(m_input[i]);
+    m_input[i] = NULL;
+  }
+  
+  if (m_input != NULL) {
+    free(m_input);
+    m_input = NULL;
+  }
+  if (m_input_sig != NULL) {
+    free(m_input_sig);
+    m_input_sig = NULL;
+  }
+  m_input_cap = 0;
+  m_input_len = 0;
+}
+
+/*
+ * Compile a section map to the given output file path.
+ * 
+ * Makes use of the pointer module and the event range in the MIDI
+ * module, so this should be done just before compiling the MIDI file.
+ * Offsets are written in the time division of the MIDI module.
+ * 
+ * Only sections lo to hi inclusive are listed.  hi must be less than
+ * the number of sections in the NMF data.
+ * 
+ * Parameters:
+ * 
+ *   pd - the parsed NMF data
+ * 
+ *   pPath - the path to the map file to generate
+ * 
+ *   lo - the first section to list
+ * 
+ *   hi - the last section to list
+ */
+static void compileMap(
+    NMF_DATA   * pd,
+    const char * pPath,
+    int32_t      lo,
+    int32_t      hi) {
+  
+  FILE *fh = NULL;
+  POINTER *pp = NULL;
+  int32_t i = 0;
+  int64_t r = 0;
+  
+  if ((pd == NULL) || (pPath == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((lo < 0) || (hi >= nmf_sections(pd))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fh = fopen(pPath, "w");
+  if (fh == NULL) {
+    raiseErr(__LINE__, "Failed to create file: %s", pPath);
+  }
+  
+  pp = pointer_new();
+  for(i = lo; i <= hi; i++) {
+    pointer_reset(pp);
+    pointer_jump(pp, i, -1);
+    pointer_moment(pp, -1, -1);
+    
+    r = (int64_t) midi_ticks(pointer_compute(pp, -1) / 3);
+    r = r - ((int64_t) midi_ticks(midi_range_lower()));
+    
+    if ((r < INT32_MIN) || (r > INT32_MAX)) {
+      raiseErr(__LINE__, "Section offset out of range");
+    }
+    
+    fprintf(fh, "%ld:%ld\n", (long) i, (long) r);
+  }
+  
+  if (fclose(fh)) {
+    sayWarn(__LINE__, "Failed to close file");
+  }
+  fh = NULL;
+}
+
+/*
+ * Add the start of each section as a seek point target of the MIDI
+ * seek index.
+ * 
+ * Makes use of the pointer module, so the NMF data must be the one the
+ * pointer module was initialized with.  Only sections lo to hi
+ * inclusive are added.  hi must be less than the number of sections in
+ * the NMF data.
+ * 
+ * Parameters:
+ * 
+ *   pd - the parsed NMF data
+ * 
+ *   lo - the first section to add
+ * 
+ *   hi - the last section to add
+ */
+static void markSections(NMF_DATA *pd, int32_t lo, int32_t hi) {
+  
+  POINTER *pp = NULL;
+  int32_t i = 0;
+  
+  if (pd == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((lo < 0) || (hi >= nmf_sections(pd))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pp = pointer_new();
+  for(i = lo; i <= hi; i++) {
+    pointer_reset(pp);
+    pointer_jump(pp, i, -1);
+    pointer_moment(pp, -1, -1);
+    midi_index_mark(pointer_compute(pp, -1) / 3);
+  }
+}
+
+/*
+ * Make room in capacity for a given number of paths in the batch list.
+ * 
+ * n is the number of additional elements beyond current length to make
+ * room for.  It must be zero or greater.  An error occurs if the
+ * requested expansion would go beyond the maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of elements to make room for
+ */
+static void capBatch(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Only proceed if n is non-zero */
+  if (n > 0) {
+    
+    /* Make initial allocation if necessary */
+    if (m_batch_cap < 1) {
+      m_batch = (char **) calloc(
+                  (size_t) BATCH_INIT_CAP, sizeof(char *));
+      if (m_batch == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      m_batch_cap = BATCH_INIT_CAP;
+      m_batch_len = 0;
+    }
+    
+    /* Compute target length */
+    if (n <= INT32_MAX - m_batch_len) {
+      target = m_batch_len + n;
+    } else {
+      raiseErr(__LINE__, "Batch list capacity exceeded");
+    }
+    
+    /* Only proceed if target length exceeds current capacity */
+    if (target > m_batch_cap) {
+      /* Check that target within maximum capacity */
+      if (target > BATCH_MAX_CAP) {
+        raiseErr(__LINE__, "Batch list capacity exceeded");
+      }
+      
+      /* Compute new capacity by doubling current capacity until greater
+       * than or equal to target length, and then limiting to maximum
+       * capacity */
+      new_cap = m_batch_cap;
+      while (new_cap < target) {
+        new_cap *= 2;
+      }
+      if (new_cap > BATCH_MAX_CAP) {
+        new_cap = BATCH_MAX_CAP;
+      }
+      
+      /* Expand capacity */
+      m_batch = (char **) realloc(m_batch,
+                            ((size_t) new_cap) * sizeof(char *));
+      if (m_batch == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      memset(
+        &(m_batch[m_batch_cap]),
+        0,
+        ((size_t) (new_cap - m_batch_cap)) * sizeof(char *));
+      
+      m_batch_cap = new_cap;
+    }
+  }
+}
+
+/*
+ * Read the batch list file into the batch list.
+ * 
+ * Each line of the file is one NMF path.  A carriage return before the
+ * line break is ignored, as are blank lines.  An error occurs if the
+ * file can't be read or does not list any paths.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the batch list file
+ */
+static void readBatch(const char *pPath) {
+  
+  FILE *fh = NULL;
+  char buf[BATCH_LINE_MAX + 1];
+  int32_t len = 0;
+  int c = 0;
+  
+  memset(buf, 0, sizeof(buf));
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (m_batch_len > 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    raiseErr(__LINE__, "Failed to open batch list: %s", pPath);
+  }
+  
+  /* Read each line, including a last line without a line break */
+  do {
+    c = getc(fh);
+    if ((c == '\n') || (c == EOF)) {
+      if ((len > 0) && (buf[len - 1] == '\r')) {
+        len--;
+      }
+      
+      if (len > 0) {
+        buf[len] = (char) 0;
+        capBatch(1);
+        m_batch[m_batch_len] = (char *) malloc((size_t) (len + 1));
+        if (m_batch[m_batch_len] == NULL) {
+          raiseErr(__LINE__, "Out of memory");
+        }
+        strcpy(m_batch[m_batch_len], buf);
+        m_batch_len++;
+      }
+      len = 0;
+      
+    } else {
+      if (c == 0) {
+        raiseErr(__LINE__, "Null character in batch list: %s", pPath);
+      }
+      if (len >= BATCH_LINE_MAX) {
+        raiseErr(__LINE__, "Batch list line too long: %s", pPath);
+      }
+      buf[len] = (char) c;
+      len++;
+    }
+  } while (c != EOF);
+  
+  if (ferror(fh)) {
+    raiseErr(__LINE__, "I/O error reading batch list: %s", pPath);
+  }
+  
+  fclose(fh);
+  fh = NULL;
+  
+  if (m_batch_len < 1) {
+    raiseErr(__LINE__, "Batch list is empty: %s", pPath);
+  }
+}
+
+/*
+ * Release the batch list.
+ */
+static void releaseBatch(void) {
+  
+  int32_t i = 0;
+  
+  for(i = 0; i < m_batch_len; i++) {
+    free(m_batch[i]);
+    m_batch[i] = NULL;
+  }
+  
+  if (m_batch != NULL) {
+    free(m_batch);
+    m_batch = NULL;
+  }
+  m_batch_cap = 0;
+  m_batch_len = 0;
+}
+
+/*
+ * Determine the MIDI output path for an NMF path in the batch list.
+ * 
+ * If the NMF path ends with the NMF extension, the extension is
+ * replaced with the MIDI extension.  Otherwise, the MIDI extension is
+ * appended.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the NMF path
+ * 
+ * Return:
+ * 
+ *   the dynamically allocated MIDI path, which the caller must free
+ */
+static char *batchOutput(const char *pPath) {
+  
+  size_t len = 0;
+  size_t ext = 0;
+  char *pResult = NULL;
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  len = strlen(pPath);
+  ext = strlen(BATCH_NMF_EXT);
+  if ((len > ext) && (strcmp(pPath + (len - ext), BATCH_NMF_EXT) == 0)) {
+    len = len - ext;
+  }
+  
+  pResult = (char *) malloc(len + strlen(BATCH_MIDI_EXT) + 1);
+  if (pResult == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  memcpy(pResult, pPath, len);
+  strcpy(pResult + len, BATCH_MIDI_EXT);
+  
+  return pResult;
+}
+
+/*
+ * Render one file of the batch list in a worker process and then exit
+ * the worker process.
+ * 
+ * The worker starts with a copy of the state that the script left, so
+ * only the render buffers are filled in by the worker.  The first file
+ * of the batch list is the reference NMF that was already parsed before
+ * running the script.  Any other file is parsed here and must have the
+ * same section table as the reference NMF, since the script resolved
+ * its pointers against that table.
+ * 
+ * This function does not return.  The worker exits successfully after
+ * the MIDI file is written, and errors exit the worker unsuccessfully.
+ * 
+ * Parameters:
+ * 
+ *   pRef - the reference NMF
+ * 
+ *   i - the index of the file in the batch list
+ */
+static void renderWorker(NMF_DATA *pRef, int32_t i) {
+  
+  NMF_DATA *pd = NULL;
+  char *pOut = NULL;
+  
+  if ((pRef == NULL) || (i < 0) || (i >= m_batch_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get the NMF and check its section table against the reference */
+  if (i > 0) {
+    pd = nmf_parse_path(m_batch[i]);
+    if (pd == NULL) {
+      raiseErr(__LINE__, "Failed to parse NMF file: %s", m_batch[i]);
+    }
+    
+    if (!sameSections(pd, pRef)) {
+      raiseErr(__LINE__,
+        "Sections differ from first batch file: %s", m_batch[i]);
+    }
+    
+  } else {
+    pd = pRef;
+  }
+  
+  /* Render the NMF and write its MIDI file */
+  render_nmf(pd);
+  control_track();
+  
+  pOut = batchOutput(m_batch[i]);
+  midi_compile_path(pOut);
+  free(pOut);
+  pOut = NULL;
+  
+  exit(EXIT_SUCCESS);
+}
+
+/*
+ * Wait for one batch worker process to finish and remove it from the
+ * table of running workers.
+ * 
+ * pPid and pJob are the process IDs of the running workers and the
+ * batch list indices they are rendering.  pCount points to the number
+ * of running workers, which must be at least one and is decremented.
+ * A warning is reported if the worker did not exit successfully.
+ * 
+ * Parameters:
+ * 
+ *   pPid - the process IDs of the running workers
+ * 
+ *   pJob - the batch list indices of the running workers
+ * 
+ *   pCount - the number of running workers
+ * 
+ * Return:
+ * 
+ *   non-zero if the worker succeeded, zero if it failed
+ */
+static int reapWorker(pid_t *pPid, int32_t *pJob, int32_t *pCount) {
+  
+  pid_t pid = 0;
+  int status = 0;
+  int32_t k = 0;
+  int result = 1;
+  
+  if ((pPid == NULL) || (pJob == NULL) || (pCount == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (*pCount < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pid = waitpid((pid_t) -1, &status, 0);
+  if (pid < 0) {
+    raiseErr(__LINE__, "Failed to wait for batch worker");
+  }
+  
+  for(k = 0; k < *pCount; k++) {
+    if (pPid[k] == pid) {
+      break;
+    }
+  }
+  if (k >= *pCount) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if ((!WIFEXITED(status)) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+    sayWarn(__LINE__,
+      "Failed to render batch file: %s", m_batch[pJob[k]]);
+    result = 0;
+  }
+  
+  /* Move the last running worker into the freed table entry */
+  (*pCount)--;
+  pPid[k] = pPid[*pCount];
+  pJob[k] = pJob[*pCount];
+  
+  return result;
+}
+
+/*
+ * Check whether two NMF files have the same section table.
+ * 
+ * Interpreted script objects resolve their pointers against the
+ * section table, so they can only be used to render another NMF file
+ * if it has the same table.
+ * 
+ * Parameters:
+ * 
+ *   pA - the first NMF file
+ * 
+ *   pB - the second NMF file
+ * 
+ * Return:
+ * 
+ *   non-zero if the section tables are the same, zero if they differ
+ */
+static int sameSections(NMF_DATA *pA, NMF_DATA *pB) {
+  
+  int32_t s = 0;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if ((nmf_basis(pA) != nmf_basis(pB)) ||
+      (nmf_sections(pA) != nmf_sections(pB))) {
+    return 0;
+  }
+  for(s = 0; s < nmf_sections(pA); s++) {
+    if (nmf_offset(pA, s) != nmf_offset(pB, s)) {
+      return 0;
+    }
+  }
+  
+  return 1;
+}
+
+/*
+ * Get the signature of a watched file.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path of the file
+ * 
+ *   ps - receives the signature
+ */
+static void watchSig(const char *pPath, WATCH_SIG *ps) {
+  
+  struct stat st;
+  
+  memset(&st, 0, sizeof(struct stat));
+  
+  if ((pPath == NULL) || (ps == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(ps, 0, sizeof(WATCH_SIG));
+  if (stat(pPath, &st)) {
+    ps->missing = 1;
+    return;
+  }
+  
+  ps->dev = st.st_dev;
+  ps->ino = st.st_ino;
+  ps->size = st.st_size;
+  ps->mtime = st.st_mtime;
+}
+
+/*
+ * Compare two signatures of a watched file.
+ * 
+ * Parameters:
+ * 
+ *   pA - the first signature
+ * 
+ *   pB - the second signature
+ * 
+ * Return:
+ * 
+ *   non-zero if the signatures are the same, zero if they differ
+ */
+static int watchSame(const WATCH_SIG *pA, const WATCH_SIG *pB) {
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  return ((pA->missing == pB->missing) &&
+          (pA->dev == pB->dev) &&
+          (pA->ino == pB->ino) &&
+          (pA->size == pB->size) &&
+          (pA->mtime == pB->mtime));
+}
+
+/*
+ * Sleep for a polling interval.
+ * 
+ * Parameters:
+ * 
+ *   ms - the interval in milliseconds
+ */
+static void watchSleep(int32_t ms) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if ((ms < 1) || (ms > DRIVER_INTERVAL_MAX)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  ts.tv_sec = (time_t) (ms / 1000);
+  ts.tv_nsec = ((long) (ms % 1000)) * 1000000L;
+  
+  /* An interrupted sleep just ends the interval early */
+  nanosleep(&ts, NULL);
+}
+
+/*
+ * Wait until the script, the NMF file, or one of the data files in the
+ * data file list changes.
+ * 
+ * The files are polled at the given interval.  A change is only
+ * reported once the new signatures have stayed the same for one more
+ * interval, so that a file still being written is not read, and a file
+ * that is missing is waited for until it exists again.  The given
+ * signatures and the signatures in the data file list are updated to
+ * those of the change.  In a watch session, the process exits once the
+ * watch supervisor is gone.
+ * 
+ * Parameters:
+ * 
+ *   pScriptPath - the script path
+ * 
+ *   pInPath - the NMF path
+ * 
+ *   pScriptSig - the signature of the script when it was last used
+ * 
+ *   pInSig - the signature of the NMF file when it was last used
+ * 
+ *   ms - the polling interval in milliseconds
+ * 
+ * Return:
+ * 
+ *   the combination of WATCH_SCRIPT, WATCH_NMF, and WATCH_DATA flags
+ *   for the files that changed, which is never zero
+ */
+static int watchWait(
+    const char * pScriptPath,
+    const char * pInPath,
+    WATCH_SIG  * pScriptSig,
+    WATCH_SIG  * pInSig,
+    int32_t      ms) {
+  
+  WATCH_SIG prev_script;
+  WATCH_SIG prev_in;
+  WATCH_SIG cur_script;
+  WATCH_SIG cur_in;
+  WATCH_SIG *pPrevData = NULL;
+  WATCH_SIG *pCurData = NULL;
+  int32_t i = 0;
+  int settled = 0;
+  int result = 0;
+  
+  memset(&prev_script, 0, sizeof(WATCH_SIG));
+  memset(&prev_in, 0, sizeof(WATCH_SIG));
+  memset(&cur_script, 0, sizeof(WATCH_SIG));
+  memset(&cur_in, 0, sizeof(WATCH_SIG));
+  
+  if ((pScriptPath == NULL) || (pInPath == NULL) ||
+      (pScriptSig == NULL) || (pInSig == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memcpy(&prev_script, pScriptSig, sizeof(WATCH_SIG));
+  memcpy(&prev_in, pInSig, sizeof(WATCH_SIG));
+  
+  if (m_input_len > 0) {
+    pPrevData = (WATCH_SIG *) calloc(
+                  (size_t) m_input_len, sizeof(WATCH_SIG));
+    pCurData = (WATCH_SIG *) calloc(
+                  (size_t) m_input_len, sizeof(WATCH_SIG));
+    if ((pPrevData == NULL) || (pCurData == NULL)) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    memcpy(pPrevData, m_input_sig,
+      ((size_t) m_input_len) * sizeof(WATCH_SIG));
+  }
+  
+  while (!result) {
+    watchSleep(ms);
+    if ((m_watch_parent != 0) && (getppid() != m_watch_parent)) {
+      exit(EXIT_SUCCESS);
+    }
+    
+    watchSig(pScriptPath, &cur_script);
+    watchSig(pInPath, &cur_in);
+    for(i = 0; i < m_input_len; i++) {
+      watchSig(m_input[i], &(pCurData[i]));
+    }
+    
+    /* Only report changes that are settled and to existing files, and
+     * only once no file is still changing */
+    settled = (watchSame(&cur_script, &prev_script) &&
+                watchSame(&cur_in, &prev_in) &&
+                (!cur_script.missing) && (!cur_in.missing));
+    for(i = 0; (i < m_input_len) && settled; i++) {
+      if ((!watchSame(&(pCurData[i]), &(pPrevData[i]))) ||
+          pCurData[i].missing) {
+        settled = 0;
+      }
+    }
+    
+    if (settled) {
+      if (!watchSame(&cur_script, pScriptSig)) {
+        result |= WATCH_SCRIPT;
+      }
+      if (!watchSame(&cur_in, pInSig)) {
+        result |= WATCH_NMF;
+      }
+      for(i = 0; i < m_input_len; i++) {
+        if (!watchSame(&(pCurData[i]), &(m_input_sig[i]))) {
+          result |= WATCH_DATA;
+        }
+      }
+    }
+    
+    memcpy(&prev_script, &cur_script, sizeof(WATCH_SIG));
+    memcpy(&prev_in, &cur_in, sizeof(WATCH_SIG));
+    if (m_input_len > 0) {
+      memcpy(pPrevData, pCurData,
+        ((size_t) m_input_len) * sizeof(WATCH_SIG));
+    }
+  }
+  
+  memcpy(pScriptSig, &cur_script, sizeof(WATCH_SIG));
+  memcpy(pInSig, &cur_in, sizeof(WATCH_SIG));
+  if (m_input_len > 0) {
+    memcpy(m_input_sig, pCurData,
+      ((size_t) m_input_len) * sizeof(WATCH_SIG));
+    free(pPrevData);
+    free(pCurData);
+    pPrevData = NULL;
+    pCurData = NULL;
+  }
+  
+  return result;
+}
+
+/*
+ * Read the data file paths that a watch session reports into the data
+ * file list, until the session and its render workers have closed the
+ * pipe.
+ * 
+ * Each path is terminated by a nul.  Paths longer than WATCH_PATH_MAX
+ * and an unterminated path at the end are ignored.
+ * 
+ * Parameters:
+ * 
+ *   fd - the read end of the pipe
+ */
+static void watchCollect(int fd) {
+  
+  char buf[WATCH_PATH_MAX + 1];
+  char c = 0;
+  int32_t len = 0;
+  int skip = 0;
+  ssize_t r = 0;
+  
+  memset(buf, 0, sizeof(buf));
+  
+  if (fd < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(r = read(fd, &c, 1); r != 0; r = read(fd, &c, 1)) {
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    
+    if (c == 0) {
+      if ((!skip) && (len > 0)) {
+        buf[len] = (char) 0;
+        driver_input(buf);
+      }
+      len = 0;
+      skip = 0;
+      
+    } else if (len < WATCH_PATH_MAX) {
+      buf[len] = c;
+      len++;
+      
+    } else {
+      skip = 1;
+    }
+  }
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * driver_input function.
+ */
+void driver_input(const char *pPath) {
+  
+  int32_t i = 0;
+  size_t len = 0;
+  size_t done = 0;
+  ssize_t r = 0;
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 0; i < m_input_len; i++) {
+    if (strcmp(m_input[i], pPath) == 0) {
+      return;
+    }
+  }
+  
+  capInput(1);
+  m_input[m_input_len] = (char *) malloc(strlen(pPath) + 1);
+  if (m_input[m_input_len] == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  strcpy(m_input[m_input_len], pPath);
+  watchSig(pPath, &(m_input_sig[m_input_len]));
+  m_input_len++;
+  
+  /* In a watch session, report the path to the supervisor; if that
+   * fails, the supervisor just does not wait on this file after a
+   * failed session */
+  if (m_watch_fd >= 0) {
+    len = strlen(pPath) + 1;
+    for(done = 0; done < len; done += (size_t) r) {
+      r = write(m_watch_fd, pPath + done, len - done);
+      if (r < 1) {
+        close(m_watch_fd);
+        m_watch_fd = -1;
+        break;
+      }
+    }
+  }
+}
+
+/*
+ * driver_inputs function.
+ */
+int32_t driver_inputs(void) {
+  return m_input_len;
+}
+
+/*
+ * driver_input_path function.
+ */
+const char *driver_input_path(int32_t i) {
+  if ((i < 0) || (i >= m_input_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  return m_input[i];
+}
+
+/*
+ * driver_render function.
+ */
+void driver_render(
+    NMF_DATA   * pd,
+    const char * pMapPath,
+    const char * pLivePath,
+    const char * pOutPath,
+    const char * pStatsPath,
+    int          index,
+    int32_t      sect_lo,
+    int32_t      sect_hi) {
+  
+  FILE *hLive = NULL;
+  
+  if (pd == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Render NMF to MIDI */
+  profile_begin();
+  render_nmf(pd);
+  profile_end(PROFILE_RENDER);
+  
+  /* Add automatic controller tracking to MIDI */
+  profile_begin();
+  control_track();
+  profile_end(PROFILE_CONTROL);
+  
+  /* Generate map file if requested */
+  if (pMapPath != NULL) {
+    profile_begin();
+    compileMap(pd, pMapPath, sect_lo, sect_hi);
+    profile_end(PROFILE_MAP);
+  }
+  
+  /* Mark the sections in the seek index if requested */
+  if (index) {
+    markSections(pd, sect_lo, sect_hi);
+  }
+  
+  /* Compile MIDI to output, or play it live */
+  profile_begin();
+  if (pLivePath != NULL) {
+    hLive = fopen(pLivePath, "wb");
+    if (hLive == NULL) {
+      raiseErr(__LINE__, "Failed to open live output: %s", pLivePath);
+    }
+    midi_live(hLive);
+    if (fclose(hLive)) {
+      sayWarn(__LINE__, "Failed to close live output");
+    }
+    hLive = NULL;
+    
+  } else if (pOutPath != NULL) {
+    midi_compile_path(pOutPath);
+  } else {
+    midi_compile(stdout);
+  }
+  profile_end(PROFILE_COMPILE);
+  
+  /* Report statistics if requested */
+  if (pStatsPath != NULL) {
+    profile_stats(pStatsPath);
+  }
+}
+
+/*
+ * driver_batch_load function.
+ */
+NMF_DATA *driver_batch_load(const char *pPath) {
+  
+  NMF_DATA *pd = NULL;
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  readBatch(pPath);
+  pd = nmf_parse_path(m_batch[0]);
+  if (pd == NULL) {
+    raiseErr(__LINE__, "Failed to parse NMF file: %s", m_batch[0]);
+  }
+  
+  return pd;
+}
+
+/*
+ * driver_batch function.
+ */
+void driver_batch(NMF_DATA *pRef, int32_t workers) {
+  
+  pid_t pid[DRIVER_WORKER_MAX];
+  int32_t job[DRIVER_WORKER_MAX];
+  int32_t count = 0;
+  int32_t failed = 0;
+  int32_t i = 0;
+  
+  memset(pid, 0, sizeof(pid));
+  memset(job, 0, sizeof(job));
+  
+  if (pRef == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((workers < 1) || (workers > DRIVER_WORKER_MAX)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Flush buffered output so that workers do not write it again, and
+   * report suppressed messages so that workers do not count them */
+  fflush(stdout);
+  diagnostic_flush();
+  
+  for(i = 0; i < m_batch_len; i++) {
+    /* If all workers are busy, wait for one of them to finish */
+    if (count >= workers) {
+      if (!reapWorker(pid, job, &count)) {
+        failed++;
+      }
+    }
+    
+    /* Start a worker for this file */
+    pid[count] = fork();
+    if (pid[count] < 0) {
+      raiseErr(__LINE__, "Failed to start batch worker");
+      
+    } else if (pid[count] == 0) {
+      renderWorker(pRef, i);
+    }
+    
+    job[count] = i;
+    count++;
+  }
+  
+  /* Wait for the remaining workers */
+  while (count > 0) {
+    if (!reapWorker(pid, job, &count)) {
+      failed++;
+    }
+  }
+  
+  if (failed > 0) {
+    raiseErr(__LINE__, "Failed to render %ld of %ld batch files",
+      (long) failed, (long) m_batch_len);
+  }
+  
+  releaseBatch();
+}
+
+/*
+ * driver_supervise function.
+ */
+void driver_supervise(
+    const char * pScriptPath,
+    const char * pInPath,
+    int32_t      ms) {
+  
+  pid_t pid = 0;
+  int status = 0;
+  int fd[2];
+  
+  memset(fd, 0, sizeof(fd));
+  
+  if ((pScriptPath == NULL) || (pInPath == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  watchSig(pScriptPath, &m_script_sig);
+  watchSig(pInPath, &m_in_sig);
+  
+  for( ; ; ) {
+    /* Flush buffered output so that the session does not write it
+     * again */
+    fflush(stdout);
+    diagnostic_flush();
+    
+    /* Each session records its own data files */
+    releaseInput();
+    if (pipe(fd)) {
+      raiseErr(__LINE__, "Failed to start watch session");
+    }
+    
+    pid = fork();
+    if (pid < 0) {
+      raiseErr(__LINE__, "Failed to start watch session");
+      
+    } else if (pid == 0) {
+      close(fd[0]);
+      m_watch_fd = fd[1];
+      m_watch_parent = getppid();
+      return;
+    }
+    
+    /* Collect the data file paths until the session ends */
+    close(fd[1]);
+    watchCollect(fd[0]);
+    close(fd[0]);
+    
+    if (waitpid(pid, &status, 0) < 0) {
+      raiseErr(__LINE__, "Failed to wait for watch session");
+    }
+    
+    /* A session that stopped for a change has already waited for the
+     * change to settle, so take the new signatures and start again;
+     * otherwise, wait for a change first */
+    if (WIFEXITED(status) && (WEXITSTATUS(status) == WATCH_RESTART)) {
+      watchSig(pScriptPath, &m_script_sig);
+      watchSig(pInPath, &m_in_sig);
+      
+    } else {
+      sayWarn(__LINE__, "Watch session failed, waiting for changes");
+      diagnostic_flush();
+      watchWait(pScriptPath, pInPath, &m_script_sig, &m_in_sig, ms);
+    }
+  }
+}
+
+/*
+ * driver_session function.
+ */
+void driver_session(
+    NMF_DATA   * pRef,
+    const char * pScriptPath,
+    const char * pInPath,
+    int32_t      ms,
+    const char * pMapPath,
+    const char * pOutPath,
+    const char * pStatsPath,
+    int          index,
+    int32_t      sect_lo,
+    int32_t      sect_hi) {
+  
+  NMF_DATA *pd = NULL;
+  pid_t pid = 0;
+  int status = 0;
+  int change = 0;
+  
+  if ((pRef == NULL) || (pScriptPath == NULL) || (pInPath == NULL) ||
+      (pOutPath == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pd = pRef;
+  for( ; ; ) {
+    /* Render the current NMF in a worker */
+    fflush(stdout);
+    diagnostic_flush();
+    
+    pid = fork();
+    if (pid < 0) {
+      raiseErr(__LINE__, "Failed to start render worker");
+      
+    } else if (pid == 0) {
+      driver_render(pd, pMapPath, NULL, pOutPath, pStatsPath, index,
+        sect_lo, sect_hi);
+      exit(EXIT_SUCCESS);
+    }
+    
+    if (waitpid(pid, &status, 0) < 0) {
+      raiseErr(__LINE__, "Failed to wait for render worker");
+    }
+    if (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS)) {
+      diagnostic_log("Rendered %s", pOutPath);
+    } else {
+      sayWarn(__LINE__, "Failed to render: %s", pInPath);
+    }
+    
+    if (pd != pRef) {
+      nmf_free(pd);
+    }
+    pd = NULL;
+    
+    /* Wait for the next change that this session can render, letting
+     * the messages reported so far appear before blocking */
+    while (pd == NULL) {
+      diagnostic_flush();
+      change = watchWait(pScriptPath, pInPath, &m_script_sig, &m_in_sig,
+                  ms);
+      if (change & (WATCH_SCRIPT | WATCH_DATA)) {
+        exit(WATCH_RESTART);
+      }
+      
+      pd = nmf_parse_path(pInPath);
+      if (pd == NULL) {
+        sayWarn(__LINE__, "Failed to parse NMF file: %s", pInPath);
+        
+      } else if (!sameSections(pd, pRef)) {
+        nmf_free(pd);
+        pd = NULL;
+        exit(WATCH_RESTART);
+      }
+    }
+  }
+}
+
+/*
+ * driver_restart function.
+ */
+void driver_restart(void) {
+  releaseInput();
+  releaseBatch();
+}
@@ -0,0 +1,272 @@
+#ifndef DRIVER_H_INCLUDED
+#define DRIVER_H_INCLUDED
+
+/*
+ * driver.h
+ * ========
+ * 
+ * Render driver module of Infrared.
+ * 
+ * After the script has run, a driver renders the NMF notes from the
+ * interpreted script objects and writes the output.  This module has
+ * the single-output driver, the batch driver of the -batch program
+ * option, and the watch driver of the -watch program option.  It also
+ * keeps the list of data files that the script read, which keys the
+ * render cache and is watched for changes.  See main.c for the program
+ * options.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the POSIX realtime library with -lrt for nanosleep()
+ * 
+ * Batch and watch modes require the POSIX fork() and waitpid()
+ * functions
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - control.c
+ *   - diagnostic.c
+ *   - midi.c
+ *   - pointer.c
+ *   - profile.c
+ *   - render.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libnmf
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "render.h"
+
+#include "nmf.h"
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum number of batch worker processes, which matches the
+ * range of the -threads program option.
+ */
+#define DRIVER_WORKER_MAX (RENDER_THREAD_MAX)
+
+/*
+ * The maximum polling interval in milliseconds of the -watch program
+ * option.
+ */
+#define DRIVER_INTERVAL_MAX (60000)
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Add a data file to the data file list.
+ * 
+ * Paths that are already in the list are ignored.  The signature of
+ * the file is recorded along with the path, so that the watch driver
+ * can notice changes.  In a watch session, the path is also reported
+ * to the watch supervisor.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the data file
+ */
+void driver_input(const char *pPath);
+
+/*
+ * Get the number of data files in the data file list.
+ * 
+ * Return:
+ * 
+ *   the number of data files
+ */
+int32_t driver_inputs(void);
+
+/*
+ * Get the path of a data file in the data file list.
+ * 
+ * Parameters:
+ * 
+ *   i - the index of the data file, in the order they were added
+ * 
+ * Return:
+ * 
+ *   the path of the data file
+ */
+const char *driver_input_path(int32_t i);
+
+/*
+ * Render an NMF file to a single output after the script has run.
+ * 
+ * The notes are rendered, automatic controllers are tracked, the
+ * section map is generated if requested, the section starts are added
+ * to the seek index if one is generated, and the MIDI messages are
+ * played live, written to an output file, or written to standard
+ * output.  Statistics are reported at the end if requested.
+ * 
+ * Parameters:
+ * 
+ *   pd - the NMF file to render
+ * 
+ *   pMapPath - the section map path, or NULL
+ * 
+ *   pLivePath - the live output path, or NULL
+ * 
+ *   pOutPath - the MIDI output path, or NULL for standard output
+ * 
+ *   pStatsPath - the statistics path, or NULL
+ * 
+ *   index - non-zero if a seek index is generated by the MIDI module
+ * 
+ *   sect_lo - the first section to list in the section map
+ * 
+ *   sect_hi - the last section to list in the section map
+ */
+void driver_render(
+    NMF_DATA   * pd,
+    const char * pMapPath,
+    const char * pLivePath,
+    const char * pOutPath,
+    const char * pStatsPath,
+    int          index,
+    int32_t      sect_lo,
+    int32_t      sect_hi);
+
+/*
+ * Read the batch list file and parse the first NMF file it lists.
+ * 
+ * Each line of the file is one NMF path.  A carriage return before the
+ * line break is ignored, as are blank lines.  An error occurs if the
+ * file can't be read, does not list any paths, or the first NMF file
+ * can't be parsed.
+ * 
+ * The first NMF file is the reference NMF that the script should be
+ * run with before driver_batch() is called.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the batch list file
+ * 
+ * Return:
+ * 
+ *   the parsed reference NMF, which the caller must free
+ */
+NMF_DATA *driver_batch_load(const char *pPath);
+
+/*
+ * Render every file of the batch list to its own MIDI file, and then
+ * release the batch list.
+ * 
+ * This is called after the script has run.  Each file is rendered by a
+ * worker process forked from this process, so the workers share the
+ * interpreted script objects without repeating the script, while each
+ * has its own copy of the render and MIDI buffers.  At most the given
+ * number of workers run at the same time.  Every file other than the
+ * reference NMF must have the same section table as the reference NMF,
+ * since the script resolved its pointers against that table.
+ * 
+ * An error occurs after all the workers have finished if any of them
+ * failed.
+ * 
+ * Parameters:
+ * 
+ *   pRef - the reference NMF from driver_batch_load()
+ * 
+ *   workers - the maximum number of workers running at the same time
+ */
+void driver_batch(NMF_DATA *pRef, int32_t workers);
+
+/*
+ * Supervise watch sessions for the -watch program option.
+ * 
+ * This is called after the program options have been checked.  Each
+ * watch session is a process forked from this process.  The session
+ * returns from this function and goes on to parse the NMF file, run the
+ * script, and call driver_session(), so that a failure in the script or
+ * the NMF file only ends the session.  If a session stops because the
+ * script, a data file, or the section table changed, a new session is
+ * started right away.  If a session fails, a warning is reported and a
+ * new session is started once the script, the NMF file, or one of the
+ * data files that the failed session added with driver_input()
+ * changes.
+ * 
+ * The supervisor itself never returns, and runs until the program is
+ * interrupted.  A session ends on its own once the supervisor is gone.
+ * 
+ * Parameters:
+ * 
+ *   pScriptPath - the script path
+ * 
+ *   pInPath - the NMF path
+ * 
+ *   ms - the polling interval in milliseconds
+ */
+void driver_supervise(
+    const char * pScriptPath,
+    const char * pInPath,
+    int32_t      ms);
+
+/*
+ * Run a watch session for the -watch program option.
+ * 
+ * This is called in the session process after the script has run with
+ * the reference NMF.  The reference NMF is rendered first, and then
+ * every time the NMF file changes, the new NMF file is rendered from
+ * the interpreted script objects that this process holds.  Each render
+ * is done by a worker process forked from this process, so that the
+ * render buffers start out empty and a failed render does not end the
+ * session.
+ * 
+ * This function does not return.  The session exits once the script or
+ * one of the data files that it read changes, or the NMF file has a
+ * different section table than the reference NMF, so that the
+ * supervisor starts a new session that runs the script again.
+ * 
+ * Parameters:
+ * 
+ *   pRef - the reference NMF that the script was run with
+ * 
+ *   pScriptPath - the script path
+ * 
+ *   pInPath - the NMF path
+ * 
+ *   ms - the polling interval in milliseconds
+ * 
+ *   pMapPath - the section map path, or NULL
+ * 
+ *   pOutPath - the MIDI output path
+ * 
+ *   pStatsPath - the statistics path, or NULL
+ * 
+ *   index - non-zero if a seek index is generated by the MIDI module
+ * 
+ *   sect_lo - the first section to list in the section map
+ * 
+ *   sect_hi - the last section to list in the section map
+ */
+void driver_session(
+    NMF_DATA   * pRef,
+    const char * pScriptPath,
+    const char * pInPath,
+    int32_t      ms,
+    const char * pMapPath,
+    const char * pOutPath,
+    const char * pStatsPath,
+    int          index,
+    int32_t      sect_lo,
+    int32_t      sect_hi);
+
+/*
+ * Restart the render driver module, releasing the data file list and
+ * any batch list, so that the module is ready for another script.
+ */
+void driver_restart(void);
+
+#endif
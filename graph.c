@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -43,9 +44,18 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 
 /*
  * The maximum number of nodes in a graph object's table.
+ * 
+ * Ramp regions only take a single node in the graph table, since their
+ * steps are stored as a ramp segment instead.
  */
 #define GRAPH_MAX_TABLE (16384)
 
+/*
+ * The maximum number of nodes when a graph with ramp segments is
+ * expanded into a graph table.
+ */
+#define GRAPH_MAX_EXPAND (INT32_C(1) << 22)
+
 /*
  * The initial and maximum capacity in entries of the constant graph
  * cache.
@@ -61,6 +71,64 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 #define ACC_INIT_CAP (32)
 
+/*
+ * The initial capacity of the ramp segment accumulator, measured in
+ * ramp segments.
+ * 
+ * The maximum capacity is equal to GRAPH_MAX_TABLE, since each ramp
+ * segment has its own node in the graph accumulator.
+ */
+#define RAMP_INIT_CAP (8)
+
+/*
+ * Graphs with at least this many nodes get an Eytzinger search index
+ * when they are constructed.
+ */
+#define EYTZ_MIN (128)
+
+/*
+ * The maximum number of derived views that may be stacked on top of
+ * each other.  A derived graph that would be stacked deeper than this
+ * is copied into a graph table right away instead.
+ */
+#define VIEW_DEPTH_MAX (8)
+
+/*
+ * The initial and maximum capacities of the graph intern table, which
+ * must be powers of two.
+ */
+#define HCONS_INIT_CAP (256)
+#define HCONS_MAX_CAP  (INT32_C(1) << 24)
+
+/*
+ * Graphs with at most this many nodes are searched in batch queries by
+ * counting the nodes at or before each offset, which is a fixed-length
+ * loop without branches that compilers can vectorize.  Larger graphs
+ * use their Eytzinger search index if they have one, or else an
+ * interleaved branchless binary search.
+ */
+#define BATCH_SCAN_MAX (16)
+
+/*
+ * The number of queries that are interleaved by the branchless binary
+ * search of batch queries.
+ * 
+ * All queries of the same graph take the same number of search steps,
+ * so the queries of a group can run in lockstep, overlapping their
+ * memory loads.
+ */
+#define BATCH_WAYS (8)
+
+/*
+ * Logarithmic ramps are computed incrementally by multiplying by a
+ * constant ratio at each step.  Every LOG_SYNC steps, and whenever the
+ * incremental value is within the relative tolerance LOG_TOL of an
+ * integer boundary, the exact formula is used instead, so that the
+ * floored values are always the same as the exact formula.
+ */
+#define LOG_SYNC (64)
+#define LOG_TOL (1.0e-9)
+
 /*
  * Region state constants, used in the REGION structure.
  */
@@ -75,15 +143,65 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 
 /*
- * Graph node structure.
+ * Ramp segment structure.
+ * 
+ * A ramp segment stores the steps of a ramp region symbolically, so
+ * that they do not need to be expanded into graph nodes.  The ramp is
+ * attached to the graph node at the start of the ramp region, which
+ * has the start value of the ramp.  The steps are at the subquantum
+ * offsets first, first + c, and so on up to last inclusive, each at
+ * the moment part of the start of the region.  Their values are
+ * computed on demand with rampValue().
  * 
- * This associates a moment offset t with a graph value at that moment
- * v.  The graph value must be zero or greater.
+ * Structures are always cleared to zero before being filled in, so that
+ * they can be compared with memcmp().
  */
 typedef struct {
-  int32_t t;
-  int32_t v;
-} NODE;
+  
+  /*
+   * The index of the graph node at the start of the ramp region.
+   */
+  int32_t node;
+  
+  /*
+   * The subquantum offsets of the start of the ramp region and of the
+   * region that follows it.
+   */
+  int32_t ts;
+  int32_t te;
+  
+  /*
+   * The subquantum offsets of the first and last steps.  There is
+   * always at least one step.
+   */
+  int32_t first;
+  int32_t last;
+  
+  /*
+   * The start value, target value, and step distance of the ramp.
+   */
+  int32_t a;
+  int32_t b;
+  int32_t c;
+  
+  /*
+   * The moment part of the start of the ramp region.
+   */
+  int32_t mp;
+  
+  /*
+   * Non-zero for logarithmic interpolation, zero for linear.
+   */
+  int32_t use_log;
+  
+  /*
+   * For logarithmic ramps, the natural logarithms of the start and
+   * target values plus one.  Zero for linear ramps.
+   */
+  double la;
+  double lb;
+  
+} RAMP;
 
 /*
  * GRAPH structure.  Prototype given in header.
@@ -91,19 +209,88 @@ typedef struct {
 struct GRAPH_TAG {
   
   /*
-   * The next graph in the allocated graph chain, or NULL if this is the
-   * last graph in the chain.
+   * The number of entries in the graph table.
+   * 
+   * Must be in range 1 to GRAPH_MAX_EXPAND inclusive, except for
+   * derived views, where it is zero and the graph table is not used.
+   * Only graphs that were expanded from ramp segments may have more
+   * than GRAPH_MAX_TABLE nodes.
+   */
+  int32_t len;
+  
+  /*
+   * The number of ramp segments and the dynamically allocated array
+   * holding them, sorted by node, or zero and NULL if the graph has no
+   * ramp segments.
    * 
-   * The graph chain allows the shutdown function to free all graphs.
+   * Each node of the graph table has at most one ramp segment attached,
+   * which covers moment offsets from the node up to the next node.
    */
-  GRAPH *pNext;
+  int32_t ramps;
+  RAMP *pRamp;
   
   /*
-   * The number of entries in the graph table.
+   * For derived views, the source graph.  NULL for graphs that have
+   * their own graph table.
    * 
-   * Must be in range 1 to GRAPH_MAX_TABLE inclusive.
+   * A derived view is a graph consisting of a single derived region,
+   * which is evaluated on demand from its source rather than having its
+   * nodes copied.  Its value at moment offset t is the transformed
+   * value of the source at t_src + t, with t clamped to zero or
+   * greater, matching the nodes that resolveTrack() would have added.
    */
-  int32_t len;
+  GRAPH *pSrc;
+  
+  /*
+   * For derived views and graphs with ramp segments, the materialized
+   * graph, or NULL if the graph has not been materialized yet.
+   * 
+   * These graphs are materialized into a separate graph object the
+   * first time a graph table with every change in value is needed, such
+   * as for spans.
+   */
+  GRAPH *pMat;
+  
+  /*
+   * For derived views, the moment offset in the source graph that the
+   * view starts at and the parameters of the value transformation, as
+   * passed to graph_add_derived().
+   */
+  int32_t t_src;
+  int32_t num;
+  int32_t denom;
+  int32_t add;
+  int32_t min_val;
+  int32_t max_val;
+  
+  /*
+   * For derived views, the number of views in the chain of sources,
+   * including this view.  Zero for other graphs.
+   */
+  int32_t depth;
+  
+  /*
+   * The hash of the graph as computed by hashNodes() or hashView(), used
+   * by the graph intern table.
+   */
+  uint32_t hash;
+  
+  /*
+   * The Eytzinger search index, or NULL if the graph has no index.
+   * 
+   * Only graphs with at least EYTZ_MIN nodes have an index.  If present,
+   * this is a dynamically allocated array of 2 * (len + 1) integers.
+   * Elements 1 to len inclusive hold the node moment offsets arranged
+   * in Eytzinger order, which is the breadth-first order of a balanced
+   * binary search tree where element k has children 2k and 2k + 1.
+   * Elements len + 1 + k then hold the graph table index of the node
+   * at element k.  Element zero and element len + 1 are unused.
+   * 
+   * Searches descend the tree from element one, so the first few levels
+   * are packed into a few cache lines and only moment offsets are
+   * fetched during the search.
+   */
+  int32_t *pEytz;
   
   /*
    * The graph table.
@@ -116,7 +303,7 @@ struct GRAPH_TAG {
    * offset.  Furthermore, nodes after the first node should always have
    * different graph values than the node that precedes them.
    */
-  NODE table[1];
+  GRAPH_NODE table[1];
   
 };
 
@@ -206,11 +393,16 @@ typedef struct {
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last graphs in the graph chain, or NULL for 
- * both if no graphs allocated.
+ * The arena that all graphs are allocated from, which releases them all
+ * at once when the module shuts down.
  */
-static GRAPH *m_pFirst = NULL;
-static GRAPH *m_pLast = NULL;
+static ARENA m_arena;
+
+/*
+ * The number of graphs allocated since the module was started or
+ * restarted, for profiling.
+ */
+static int32_t m_count = 0;
 
 /*
  * The constant graph cache.
@@ -250,11 +442,47 @@ static int m_load = 0;
  * because accAppend() only actually adds nodes if they have a different
  * graph value, but it still needs to make sure entries are
  * chronological, even if they are not present in the accumulator.
+ * 
+ * m_acc_v is the graph value after the last node entered into the
+ * accumulator, if m_acc_len is greater than zero.  After a ramp segment,
+ * this is the value of its last step rather than the value of its node.
  */
 static int32_t m_acc_cap = 0;
 static int32_t m_acc_len = 0;
 static int32_t m_acc_t = 0;
-static NODE *m_acc = NULL;
+static int32_t m_acc_v = 0;
+static GRAPH_NODE *m_acc = NULL;
+
+/*
+ * The ramp segment accumulator, which holds the ramp segments attached
+ * to nodes of the graph accumulator.
+ * 
+ * m_ramp_cap is the current capacity in ramp segments, m_ramp_len is
+ * the number of ramp segments actually in use, and m_ramp is the
+ * dynamically allocated array, which may be NULL only if the capacity
+ * is zero.
+ */
+static int32_t m_ramp_cap = 0;
+static int32_t m_ramp_len = 0;
+static RAMP *m_ramp = NULL;
+
+/*
+ * The graph intern table.
+ * 
+ * This is an open-addressing hash table with linear probing that
+ * indexes all graphs with a graph table by their nodes, and all derived
+ * views by their source and parameters, so that identical graphs share
+ * a single graph object.  Constant graphs are not included, since they
+ * are shared through the constant graph cache instead.
+ * 
+ * The fields here are the current capacity as a record count, which is
+ * always a power of two, the number of records actually in use, and a
+ * pointer to the dynamically allocated record array, where empty slots
+ * are NULL.
+ */
+static int32_t m_hcons_cap = 0;
+static int32_t m_hcons_len = 0;
+static GRAPH **m_hcons = NULL;
 
 /*
  * The buffered region that should be added to the accumulator.
@@ -283,13 +511,67 @@ static long srcLine(long lnum);
 static GRAPH *cache_get(int32_t v);
 
 static void accReset(void);
+static void accPush(int32_t t, int32_t v, long lnum);
 static void accAppend(int32_t t, int32_t v, long lnum);
+static void accRamp(int32_t t, const RAMP *pr, long lnum);
 static GRAPH *accTake(long lnum);
+static GRAPH *graphAlloc(
+    const GRAPH_NODE *pNodes,
+    int32_t len,
+    const RAMP *pRamps,
+    int32_t ramps);
+
+static uint32_t hashNodes(
+    const GRAPH_NODE *pNodes,
+    int32_t len,
+    const RAMP *pRamps,
+    int32_t ramps);
+static uint32_t hashView(const GRAPH *pView);
+static void growHcons(void);
+static int32_t hconsSlot(
+    uint32_t hash,
+    const GRAPH *pView,
+    const GRAPH_NODE *pNodes,
+    int32_t len,
+    const RAMP *pRamps,
+    int32_t ramps);
 
+static int32_t eytzFill(GRAPH *pg, int32_t i, int32_t k);
+static void eytzBuild(GRAPH *pg);
+static int32_t eytzSeek(GRAPH *pg, int32_t t);
+
+static int32_t deriveValue(
+    int32_t v,
+    int32_t num,
+    int32_t denom,
+    int32_t add,
+    int32_t min_val,
+    int32_t max_val);
 static void resolveTrack(void *pCustom, int32_t t, int32_t v);
+static double logRamp(double la, double lb, double tv);
+static double rampPos(const RAMP *pr, int64_t s);
+static int32_t rampRound(double tv);
+static int32_t rampValue(const RAMP *pr, int64_t s);
+static const RAMP *rampFind(GRAPH *pg, int32_t i);
+static int32_t rampEval(const RAMP *pr, int32_t v, int32_t t);
+static int32_t rampExpand(
+    const RAMP *pr, GRAPH_NODE *pNodes, int32_t count);
 static void resolve(int32_t t_next, int has_next);
 
+static int32_t graphRange(GRAPH *pg, int32_t lo, int32_t hi, int32_t t);
 static int32_t graphSeek(GRAPH *pg, int32_t t);
+static int32_t graphGallop(GRAPH *pg, int32_t i, int32_t t);
+
+static GRAPH *viewNew(void);
+static int32_t viewTime(GRAPH *pg, int32_t t);
+static int32_t viewEval(GRAPH *pg, int32_t t, GRAPH_CURSOR *pc);
+static GRAPH *viewBody(GRAPH *pg);
+static GRAPH *graphNodes(GRAPH *pg);
+
+static void batchScan(
+    GRAPH *pg, const int32_t *pT, int32_t *pOut, int32_t n);
+static void batchSearch(
+    GRAPH *pg, const int32_t *pT, int32_t *pOut, int32_t n);
 
 /*
  * If the given line number is within valid range, return it as-is.  In
@@ -463,26 +745,14 @@ static GRAPH *cache_get(int32_t v) {
     
     /* Construct a new graph object for the cache entry and also for the
      * result */
-    pResult = (GRAPH *) calloc(1, sizeof(GRAPH));
-    if (pResult == NULL) {
-      raiseErr(__LINE__, "Out of memory");
-    }
+    pResult = (GRAPH *) arena_alloc(&m_arena, sizeof(GRAPH));
     
     /* Initialize as a constant graph with the requested value */
     pResult->len = 1;
     ((pResult->table)[0]).t = 0;
     ((pResult->table)[0]).v = v;
     
-    /* Link into graph chain */
-    if (m_pLast == NULL) {
-      m_pFirst = pResult;
-      m_pLast = pResult;
-      pResult->pNext = NULL;
-    } else {
-      m_pLast->pNext = pResult;
-      pResult->pNext = NULL;
-      m_pLast = pResult;
-    }
+    m_count++;
     
     /* Cache the new graph */
     (m_cache[pos]).pg = pResult;
@@ -505,7 +775,7 @@ static GRAPH *cache_get(int32_t v) {
  */
 static void accReset(void) {
   if (m_acc_cap < 1) {
-    m_acc = (NODE *) calloc((size_t) ACC_INIT_CAP, sizeof(NODE));
+    m_acc = (GRAPH_NODE *) calloc((size_t) ACC_INIT_CAP, sizeof(GRAPH_NODE));
     if (m_acc == NULL) {
       raiseErr(__LINE__, "Out of memory");
     }
@@ -513,16 +783,91 @@ static void accReset(void) {
   }
   
   if (m_acc_cap != ACC_INIT_CAP) {
-    m_acc = (NODE *) realloc(m_acc,
-                        ((size_t) ACC_INIT_CAP) * sizeof(NODE));
+    m_acc = (GRAPH_NODE *) realloc(m_acc,
+                        ((size_t) ACC_INIT_CAP) * sizeof(GRAPH_NODE));
     if (m_acc == NULL) {
       raiseErr(__LINE__, "Out of memory");
     }
     m_acc_cap = ACC_INIT_CAP;
   }
   
+  if (m_ramp_cap < 1) {
+    m_ramp = (RAMP *) calloc((size_t) RAMP_INIT_CAP, sizeof(RAMP));
+    if (m_ramp == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_ramp_cap = RAMP_INIT_CAP;
+  }
+  
+  if (m_ramp_cap != RAMP_INIT_CAP) {
+    m_ramp = (RAMP *) realloc(m_ramp,
+                        ((size_t) RAMP_INIT_CAP) * sizeof(RAMP));
+    if (m_ramp == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_ramp_cap = RAMP_INIT_CAP;
+  }
+  
   m_acc_len = 0;
   m_acc_t = 0;
+  m_acc_v = 0;
+  m_ramp_len = 0;
+}
+
+/*
+ * Add a node to the end of the accumulator register, expanding its
+ * capacity if necessary.
+ * 
+ * This does not check the node against the others or update m_acc_t
+ * and m_acc_v, which is up to the caller.  The accumulator must
+ * already be initialized.
+ * 
+ * Parameters:
+ * 
+ *   t - the moment offset of the node to add
+ * 
+ *   v - the graph value of the node to add
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+static void accPush(int32_t t, int32_t v, long lnum) {
+  
+  int32_t new_cap = 0;
+  
+  if (m_acc_cap < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Expand capacity if necessary */
+  if (m_acc_len >= m_acc_cap) {
+    if (m_acc_len >= GRAPH_MAX_TABLE) {
+      raiseErr(__LINE__, "Graph too complex on script line %ld",
+        srcLine(lnum));
+    }
+    
+    new_cap = m_acc_cap * 2;
+    if (new_cap > GRAPH_MAX_TABLE) {
+      new_cap = GRAPH_MAX_TABLE;
+    }
+    
+    m_acc = (GRAPH_NODE *) realloc(m_acc,
+                      ((size_t) new_cap) * sizeof(GRAPH_NODE));
+    if (m_acc == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    memset(
+      &(m_acc[m_acc_cap]),
+      0,
+      ((size_t) (new_cap - m_acc_cap) * sizeof(GRAPH_NODE)));
+    
+    m_acc_cap = new_cap;
+  }
+  
+  /* Add the node */
+  (m_acc[m_acc_len]).t = t;
+  (m_acc[m_acc_len]).v = v;
+  m_acc_len++;
 }
 
 /*
@@ -552,7 +897,6 @@ static void accReset(void) {
 static void accAppend(int32_t t, int32_t v, long lnum) {
   
   int proceed = 0;
-  int32_t new_cap = 0;
   
   /* Check state */
   if (m_shutdown) {
@@ -581,52 +925,107 @@ static void accAppend(int32_t t, int32_t v, long lnum) {
     }
   }
   
-  /* Update the accumulator t value */
-  m_acc_t = t;
-  
   /* Determine whether we need to actually add the node */
   proceed = 1;
   if (m_acc_len > 0) {
-    if ((m_acc[m_acc_len - 1]).v == v) {
-      /* The accumulator is not empty and the last node has the same
+    if (m_acc_v == v) {
+      /* The accumulator is not empty and the graph already has the same
        * graph value as this new node, so we do not need to add it */
       proceed = 0;
     }
   }
   
+  /* Update the accumulator t and v values */
+  m_acc_t = t;
+  m_acc_v = v;
+  
   /* Add node if needed */
   if (proceed) {
-    /* Expand capacity if necessary */
-    if (m_acc_len >= m_acc_cap) {
-      if (m_acc_len >= GRAPH_MAX_TABLE) {
-        raiseErr(__LINE__, "Graph too complex on script line %ld",
-          srcLine(lnum));
-      }
-      
-      new_cap = m_acc_cap * 2;
-      if (new_cap > GRAPH_MAX_TABLE) {
-        new_cap = GRAPH_MAX_TABLE;
-      }
-      
-      m_acc = (NODE *) realloc(m_acc,
-                        ((size_t) new_cap) * sizeof(NODE));
-      if (m_acc == NULL) {
-        raiseErr(__LINE__, "Out of memory");
-      }
-      
-      memset(
-        &(m_acc[m_acc_cap]),
-        0,
-        ((size_t) (new_cap - m_acc_cap) * sizeof(NODE)));
-      
-      m_acc_cap = new_cap;
+    accPush(t, v, lnum);
+  }
+}
+
+/*
+ * Append a ramp segment to the accumulator register.
+ * 
+ * The same conditions apply as for accAppend().  A node is always added
+ * at moment offset t with the start value of the ramp, even if the
+ * graph already has that value, so that the ramp segment can be
+ * attached to it.  The node fields of the given ramp segment are
+ * ignored and filled in by this function.
+ * 
+ * Parameters:
+ * 
+ *   t - the moment offset of the start of the ramp
+ * 
+ *   pr - the ramp segment
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+static void accRamp(int32_t t, const RAMP *pr, long lnum) {
+  
+  int32_t new_cap = 0;
+  
+  /* Check state */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (!m_load) {
+    raiseErr(__LINE__, "Accumulator not loaded");
+  }
+  if (pr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Initialize accumulator if necessary */
+  if (m_acc_cap < 1) {
+    accReset();
+  }
+  
+  /* Check values */
+  if (m_acc_len > 0) {
+    if (t <= m_acc_t) {
+      raiseErr(__LINE__,
+        "Graph must be ascending chronological on script line %ld",
+        srcLine(lnum));
+    }
+  }
+  
+  /* Add the node at the start of the ramp */
+  accPush(t, pr->a, lnum);
+  
+  /* Expand ramp capacity if necessary */
+  if (m_ramp_len >= m_ramp_cap) {
+    new_cap = m_ramp_cap * 2;
+    if (new_cap > GRAPH_MAX_TABLE) {
+      new_cap = GRAPH_MAX_TABLE;
+    }
+    if (new_cap <= m_ramp_len) {
+      raiseErr(__LINE__, NULL);
     }
     
-    /* Add the node */
-    (m_acc[m_acc_len]).t = t;
-    (m_acc[m_acc_len]).v = v;
-    m_acc_len++;
+    m_ramp = (RAMP *) realloc(m_ramp,
+                      ((size_t) new_cap) * sizeof(RAMP));
+    if (m_ramp == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    memset(
+      &(m_ramp[m_ramp_cap]),
+      0,
+      ((size_t) (new_cap - m_ramp_cap) * sizeof(RAMP)));
+    
+    m_ramp_cap = new_cap;
   }
+  
+  /* Add the ramp segment, attached to the new node */
+  memcpy(&(m_ramp[m_ramp_len]), pr, sizeof(RAMP));
+  (m_ramp[m_ramp_len]).node = m_acc_len - 1;
+  m_ramp_len++;
+  
+  /* The graph ends up at the value of the last step */
+  m_acc_t = pointer_pack(pr->last, (int) pr->mp);
+  m_acc_v = rampValue(pr, (int64_t) pr->last);
 }
 
 /*
@@ -640,10 +1039,10 @@ static void accAppend(int32_t t, int32_t v, long lnum) {
  * Graphs must have at least one node, so an error occurs if the graph
  * accumulator is empty.
  * 
- * If the graph accumulator has exactly one node, then the graph is a
- * constant graph.  In this case, cache_get() is used to construct the
- * graph object, so that graph object instances can be shared and
- * reused.
+ * If the graph accumulator has exactly one node and no ramp segments,
+ * then the graph is a constant graph.  In this case, cache_get() is
+ * used to construct the graph object, so that graph object instances
+ * can be shared and reused.
  * 
  * This function will also clear m_load back to zero to unload the
  * accumulator after resetting it.
@@ -683,35 +1082,14 @@ static GRAPH *accTake(long lnum) {
       "Empty graphs are not allowed on script line %ld",
       srcLine(lnum));
     
-  } else if (m_acc_len == 1) {
+  } else if ((m_acc_len == 1) && (m_ramp_len < 1)) {
     /* Graph has single node, so use the constant graph cache */
     pGraph = cache_get((m_acc[0]).v);
     
-  } else if (m_acc_len > 1) {
-    /* Graph has multiple nodes, so allocate a graph object with
-     * sufficient space for a copy of the nodes */
-    pGraph = (GRAPH *) calloc(1,
-                (((size_t) (m_acc_len - 1)) * sizeof(NODE))
-                  + sizeof(GRAPH));
-    if (pGraph == NULL) {
-      raiseErr(__LINE__, "Out of memory");
-    }
-    
-    /* Initialize the graph and copy the nodes */
-    pGraph->len = m_acc_len;
-    memcpy(&((pGraph->table)[0]), &(m_acc[0]),
-            ((size_t) m_acc_len) * sizeof(NODE));
-    
-    /* Link into graph chain */
-    if (m_pLast == NULL) {
-      m_pFirst = pGraph;
-      m_pLast = pGraph;
-      pGraph->pNext = NULL;
-    } else {
-      m_pLast->pNext = pGraph;
-      pGraph->pNext = NULL;
-      m_pLast = pGraph;
-    }
+  } else if (m_acc_len >= 1) {
+    /* Graph has multiple nodes or ramp segments, so allocate a graph
+     * object with a copy of them */
+    pGraph = graphAlloc(m_acc, m_acc_len, m_ramp, m_ramp_len);
     
   } else {
     raiseErr(__LINE__, NULL);
@@ -726,357 +1104,1753 @@ static GRAPH *accTake(long lnum) {
 }
 
 /*
- * Tracking algorithm callback used for resolving derived nodes.  See
- * documentation of graph_fp_track function pointer type for
- * specification.
+ * Get a graph object with a copy of the given nodes and ramp segments.
  * 
- * The custom parameter is not used, since the static region buffer can
- * be used instead.
+ * If an identical graph is already in the graph intern table, that
+ * graph is returned.  Otherwise, a new graph object is allocated and
+ * added to the graph intern table.
+ * 
+ * The nodes must satisfy the requirements of the graph table, and there
+ * must be at least two of them unless there are ramp segments.
+ * Single-node graphs without ramp segments should use cache_get()
+ * instead.
+ * 
+ * Parameters:
+ * 
+ *   pNodes - the nodes to copy
+ * 
+ *   len - the number of nodes
+ * 
+ *   pRamps - the ramp segments to copy, or NULL if there are none
+ * 
+ *   ramps - the number of ramp segments
+ * 
+ * Return:
+ * 
+ *   the graph object
  */
-static void resolveTrack(void *pCustom, int32_t t, int32_t v) {
-  
-  int64_t iv64 = 0;
+static GRAPH *graphAlloc(
+    const GRAPH_NODE *pNodes,
+    int32_t len,
+    const RAMP *pRamps,
+    int32_t ramps) {
   
-  /* Ignore custom parameter */
-  (void) pCustom;
+  GRAPH *pGraph = NULL;
+  uint32_t hash = 0;
+  int32_t slot = 0;
   
-  /* Check parameters */
-  if (v < 0) {
+  if ((pNodes == NULL) || (len < 1) || (len > GRAPH_MAX_EXPAND) ||
+      (ramps < 0) || (ramps > len)) {
     raiseErr(__LINE__, NULL);
   }
-  
-  /* Check state */
-  if (m_shutdown) {
-    raiseErr(__LINE__, "Graph module is shut down");
-  }
-  if (!m_load) {
-    raiseErr(__LINE__, "Accumulator not loaded");
-  }
-  if (m_buf.state != STATE_DERIVE) {
+  if ((ramps > 0) ? (pRamps == NULL) : (len < 2)) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Check that reported t is at least the t_src parameter value in the
-   * region, and then reduce reported t as an offset of t_src */
-  if (t >= m_buf.t_src) {
-    t = t - m_buf.t_src;
-  } else {
-    raiseErr(__LINE__, NULL);
+  /* Look for an identical graph */
+  hash = hashNodes(pNodes, len, pRamps, ramps);
+  slot = hconsSlot(hash, NULL, pNodes, len, pRamps, ramps);
+  if (slot >= 0) {
+    pGraph = m_hcons[slot];
   }
   
-  /* Transform the value */
-  iv64 = (((int64_t) v) * ((int64_t) m_buf.a)) / ((int64_t) m_buf.b);
+  if (pGraph == NULL) {
+    /* Allocate a graph object with sufficient space for the nodes */
+    pGraph = (GRAPH *) arena_alloc(&m_arena,
+                (((size_t) (len - 1)) * sizeof(GRAPH_NODE))
+                  + sizeof(GRAPH));
+    
+    /* Initialize the graph and copy the nodes */
+    pGraph->len = len;
+    pGraph->hash = hash;
+    memcpy(&((pGraph->table)[0]), pNodes,
+            ((size_t) len) * sizeof(GRAPH_NODE));
+    
+    /* Copy the ramp segments */
+    if (ramps > 0) {
+      pGraph->pRamp = (RAMP *) arena_alloc(
+                        &m_arena, ((size_t) ramps) * sizeof(RAMP));
+      memcpy(pGraph->pRamp, pRamps, ((size_t) ramps) * sizeof(RAMP));
+      pGraph->ramps = ramps;
+    }
+    
+    /* Build the search index for large graphs */
+    if (pGraph->len >= EYTZ_MIN) {
+      eytzBuild(pGraph);
+    }
+    
+    /* Intern the graph, if the table has room */
+    if (slot >= 0) {
+      m_hcons[slot] = pGraph;
+      m_hcons_len++;
+    }
+    m_count++;
+  }
+  
+  return pGraph;
+}
+
+/*
+ * Compute the intern hash of a graph table.
+ * 
+ * This is the 32-bit FNV-1a hash of the moment offsets and values of
+ * the nodes, followed by the integer fields of the ramp segments, each
+ * taken as four bytes in little-endian order.  The logarithms in the
+ * ramp segments are not hashed, since they follow from the start and
+ * target values.
+ * 
+ * Parameters:
+ * 
+ *   pNodes - the nodes
+ * 
+ *   len - the number of nodes
+ * 
+ *   pRamps - the ramp segments, or NULL if there are none
+ * 
+ *   ramps - the number of ramp segments
+ * 
+ * Return:
+ * 
+ *   the hash of the nodes
+ */
+static uint32_t hashNodes(
+    const GRAPH_NODE *pNodes,
+    int32_t len,
+    const RAMP *pRamps,
+    int32_t ramps) {
+  
+  uint32_t result = UINT32_C(2166136261);
+  uint32_t w[10];
+  int32_t i = 0;
+  int32_t j = 0;
+  int k = 0;
+  
+  if ((pNodes == NULL) || (len < 0) || (ramps < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((ramps > 0) && (pRamps == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 0; i < len; i++) {
+    w[0] = (uint32_t) (pNodes[i]).t;
+    w[1] = (uint32_t) (pNodes[i]).v;
+    for(j = 0; j < 2; j++) {
+      for(k = 0; k < 4; k++) {
+        result ^= (w[j] & UINT32_C(0xff));
+        result *= UINT32_C(16777619);
+        w[j] >>= 8;
+      }
+    }
+  }
+  
+  for(i = 0; i < ramps; i++) {
+    w[0] = (uint32_t) (pRamps[i]).node;
+    w[1] = (uint32_t) (pRamps[i]).ts;
+    w[2] = (uint32_t) (pRamps[i]).te;
+    w[3] = (uint32_t) (pRamps[i]).first;
+    w[4] = (uint32_t) (pRamps[i]).last;
+    w[5] = (uint32_t) (pRamps[i]).a;
+    w[6] = (uint32_t) (pRamps[i]).b;
+    w[7] = (uint32_t) (pRamps[i]).c;
+    w[8] = (uint32_t) (pRamps[i]).mp;
+    w[9] = (uint32_t) (pRamps[i]).use_log;
+    for(j = 0; j < 10; j++) {
+      for(k = 0; k < 4; k++) {
+        result ^= (w[j] & UINT32_C(0xff));
+        result *= UINT32_C(16777619);
+        w[j] >>= 8;
+      }
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Compute the intern hash of a derived view.
+ * 
+ * This is the 32-bit FNV-1a hash of the intern hash of the source graph
+ * and the parameters of the view, each taken as four bytes in
+ * little-endian order.
+ * 
+ * Parameters:
+ * 
+ *   pView - the view, which need only have the source and parameter
+ *   fields filled in
+ * 
+ * Return:
+ * 
+ *   the hash of the view
+ */
+static uint32_t hashView(const GRAPH *pView) {
+  
+  uint32_t result = UINT32_C(2166136261);
+  uint32_t w[7];
+  int32_t i = 0;
+  int k = 0;
+  
+  if (pView == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pView->pSrc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  w[0] = (pView->pSrc)->hash;
+  w[1] = (uint32_t) pView->t_src;
+  w[2] = (uint32_t) pView->num;
+  w[3] = (uint32_t) pView->denom;
+  w[4] = (uint32_t) pView->add;
+  w[5] = (uint32_t) pView->min_val;
+  w[6] = (uint32_t) pView->max_val;
+  
+  for(i = 0; i < 7; i++) {
+    for(k = 0; k < 4; k++) {
+      result ^= (w[i] & UINT32_C(0xff));
+      result *= UINT32_C(16777619);
+      w[i] >>= 8;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Allocate the graph intern table or double its capacity.
+ * 
+ * When the capacity is doubled, all the existing records are inserted
+ * into the new table.  The table must not already be at its maximum
+ * capacity.
+ */
+static void growHcons(void) {
+  
+  int32_t old_cap = 0;
+  int32_t new_cap = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  GRAPH **pOld = NULL;
+  
+  /* Determine new capacity */
+  old_cap = m_hcons_cap;
+  if (old_cap < 1) {
+    new_cap = HCONS_INIT_CAP;
+  } else if (old_cap < HCONS_MAX_CAP) {
+    new_cap = old_cap * 2;
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Allocate new table with all slots empty */
+  pOld = m_hcons;
+  m_hcons = (GRAPH **) calloc((size_t) new_cap, sizeof(GRAPH *));
+  if (m_hcons == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  m_hcons_cap = new_cap;
+  
+  /* Reinsert existing records */
+  for(i = 0; i < old_cap; i++) {
+    if (pOld[i] != NULL) {
+      j = (int32_t) ((pOld[i])->hash & ((uint32_t) (new_cap - 1)));
+      while (m_hcons[j] != NULL) {
+        j = (j + 1) & (new_cap - 1);
+      }
+      m_hcons[j] = pOld[i];
+    }
+  }
+  
+  /* Release old table */
+  if (pOld != NULL) {
+    free(pOld);
+    pOld = NULL;
+  }
+}
+
+/*
+ * Find the slot of the graph intern table for a graph.
+ * 
+ * The graph is either a derived view, in which case pView has the
+ * source and parameter fields filled in and pNodes is NULL; or else a
+ * graph table given by pNodes and len with the ramp segments given by
+ * pRamps and ramps, in which case pView is NULL.  The hash must be the
+ * intern hash of the graph.
+ * 
+ * The table is grown first if it is at least half full.  The result is
+ * the slot holding an identical graph if there is one, or else the
+ * empty slot where the graph should be added.  If the table is full,
+ * -1 is returned and the graph should not be interned.
+ * 
+ * Parameters:
+ * 
+ *   hash - the intern hash of the graph
+ * 
+ *   pView - the derived view, or NULL
+ * 
+ *   pNodes - the graph table, or NULL
+ * 
+ *   len - the number of nodes in the graph table, ignored for views
+ * 
+ *   pRamps - the ramp segments, or NULL if there are none
+ * 
+ *   ramps - the number of ramp segments, ignored for views
+ * 
+ * Return:
+ * 
+ *   the slot in the graph intern table, or -1
+ */
+static int32_t hconsSlot(
+    uint32_t hash,
+    const GRAPH *pView,
+    const GRAPH_NODE *pNodes,
+    int32_t len,
+    const RAMP *pRamps,
+    int32_t ramps) {
+  
+  int32_t result = -1;
+  int32_t i = 0;
+  GRAPH *pc = NULL;
+  
+  if (((pView == NULL) && (pNodes == NULL)) ||
+      ((pView != NULL) && (pNodes != NULL))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Make sure the table is less than half full, if possible */
+  if ((m_hcons_len >= m_hcons_cap / 2) &&
+      (m_hcons_cap < HCONS_MAX_CAP)) {
+    growHcons();
+  }
+  
+  /* Only proceed if there is an empty slot in the table */
+  if (m_hcons_len < m_hcons_cap - 1) {
+    
+    /* Probe for an identical graph or an empty slot */
+    i = (int32_t) (hash & ((uint32_t) (m_hcons_cap - 1)));
+    while (m_hcons[i] != NULL) {
+      pc = m_hcons[i];
+      if (pc->hash == hash) {
+        if (pView != NULL) {
+          if ((pc->pSrc == pView->pSrc) &&
+              (pc->t_src == pView->t_src) &&
+              (pc->num == pView->num) &&
+              (pc->denom == pView->denom) &&
+              (pc->add == pView->add) &&
+              (pc->min_val == pView->min_val) &&
+              (pc->max_val == pView->max_val)) {
+            break;
+          }
+          
+        } else if ((pc->pSrc == NULL) && (pc->len == len) &&
+                    (pc->ramps == ramps)) {
+          if ((memcmp(
+                &((pc->table)[0]),
+                pNodes,
+                ((size_t) len) * sizeof(GRAPH_NODE)) == 0) &&
+              ((ramps < 1) || (memcmp(
+                pc->pRamp,
+                pRamps,
+                ((size_t) ramps) * sizeof(RAMP)) == 0))) {
+            break;
+          }
+        }
+      }
+      i = (i + 1) & (m_hcons_cap - 1);
+    }
+    
+    result = i;
+  }
+  
+  return result;
+}
+
+/*
+ * Recursively fill the Eytzinger search index of a graph.
+ * 
+ * The subtree rooted at element k is filled by an in-order traversal,
+ * assigning graph table nodes in ascending order starting at node i.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   i - the index of the next graph table node to assign
+ * 
+ *   k - the index of the root element of the subtree
+ * 
+ * Return:
+ * 
+ *   the index of the next graph table node to assign after the subtree
+ */
+static int32_t eytzFill(GRAPH *pg, int32_t i, int32_t k) {
+  
+  if (k <= pg->len) {
+    i = eytzFill(pg, i, 2 * k);
+    
+    (pg->pEytz)[k] = ((pg->table)[i]).t;
+    (pg->pEytz)[pg->len + 1 + k] = i;
+    i++;
+    
+    i = eytzFill(pg, i, 2 * k + 1);
+  }
+  
+  return i;
+}
+
+/*
+ * Build the Eytzinger search index of a graph.
+ * 
+ * The graph must not already have an index.  See the pEytz field of the
+ * GRAPH structure for the index format.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ */
+static void eytzBuild(GRAPH *pg) {
+  
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((pg->pEytz != NULL) || (pg->len < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pg->pEytz = (int32_t *) arena_alloc(&m_arena,
+                ((size_t) (2 * (pg->len + 1))) * sizeof(int32_t));
+  
+  if (eytzFill(pg, 0, 1) != pg->len) {
+    raiseErr(__LINE__, NULL);
+  }
+}
+
+/*
+ * Find the graph node that covers the given moment offset using the
+ * Eytzinger search index of a graph.
+ * 
+ * The result is the same as graphSeek().  The graph must have an index.
+ * 
+ * The search descends from the root, going right at each element that
+ * is at or before t, which finds the first node after t.  The right
+ * turns taken at the end of the descent are the trailing one bits of
+ * the final element index, and dropping them along with one more bit
+ * gives the element where the last left turn was taken, which is the
+ * first node after t.  The result is the node just before that one.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   t - the moment offset
+ * 
+ * Return:
+ * 
+ *   the index in the graph table of the node that covers the moment
+ *   offset, or -1 if no graph node covers it
+ */
+static int32_t eytzSeek(GRAPH *pg, int32_t t) {
+  
+  int32_t result = 0;
+  int32_t k = 0;
+  const int32_t *pe = NULL;
+  
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pg->pEytz == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  pe = pg->pEytz;
+  
+  /* Descend the tree */
+  k = 1;
+  while (k <= pg->len) {
+    k = 2 * k + (pe[k] <= t);
+  }
+  
+  /* Recover the element of the first node after t */
+  while (k & 1) {
+    k >>= 1;
+  }
+  k >>= 1;
+  
+  /* The result is the node before it, or the last node if all nodes are
+   * at or before t */
+  if (k > 0) {
+    result = pe[pg->len + 1 + k] - 1;
+  } else {
+    result = pg->len - 1;
+  }
+  
+  return result;
+}
+
+/*
+ * Transform a source graph value for a derived region.
+ * 
+ * See graph_add_derived() for the specification of the transformation.
+ * 
+ * Parameters:
+ * 
+ *   v - the source graph value, which must be zero or greater
+ * 
+ *   num - the numerator of the scaling value
+ * 
+ *   denom - the denominator of the scaling value
+ * 
+ *   add - the value to add after scaling
+ * 
+ *   min_val - the minimum transformed value
+ * 
+ *   max_val - the maximum transformed value, or -1 if no maximum
+ * 
+ * Return:
+ * 
+ *   the transformed value
+ */
+static int32_t deriveValue(
+    int32_t v,
+    int32_t num,
+    int32_t denom,
+    int32_t add,
+    int32_t min_val,
+    int32_t max_val) {
+  
+  int64_t iv64 = 0;
+  
+  if ((v < 0) || (num < 0) || (denom < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  iv64 = (((int64_t) v) * ((int64_t) num)) / ((int64_t) denom);
   if (iv64 < INT32_MIN) {
     iv64 = (int64_t) INT32_MIN;
   } else if (iv64 > INT32_MAX) {
     iv64 = (int64_t) INT32_MAX;
   }
   
-  iv64 += ((int64_t) m_buf.c);
+  iv64 += ((int64_t) add);
   if (iv64 < INT32_MIN) {
     iv64 = (int64_t) INT32_MIN;
   } else if (iv64 > INT32_MAX) {
     iv64 = (int64_t) INT32_MAX;
   }
   
-  if (iv64 < m_buf.min_val) {
-    iv64 = (int64_t) m_buf.min_val;
-  }
-  if (m_buf.max_val >= 0) {
-    if (iv64 > m_buf.max_val) {
-      iv64 = (int64_t) m_buf.max_val;
+  if (iv64 < min_val) {
+    iv64 = (int64_t) min_val;
+  }
+  if (max_val >= 0) {
+    if (iv64 > max_val) {
+      iv64 = (int64_t) max_val;
+    }
+  }
+  
+  return (int32_t) iv64;
+}
+
+/*
+ * Tracking algorithm callback used for resolving derived nodes.  See
+ * documentation of graph_fp_track function pointer type for
+ * specification.
+ * 
+ * The custom parameter is not used, since the static region buffer can
+ * be used instead.
+ */
+static void resolveTrack(void *pCustom, int32_t t, int32_t v) {
+  
+  /* Ignore custom parameter */
+  (void) pCustom;
+  
+  /* Check parameters */
+  if (v < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Check state */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (!m_load) {
+    raiseErr(__LINE__, "Accumulator not loaded");
+  }
+  if (m_buf.state != STATE_DERIVE) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Check that reported t is at least the t_src parameter value in the
+   * region, and then reduce reported t as an offset of t_src */
+  if (t >= m_buf.t_src) {
+    t = t - m_buf.t_src;
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Transform the value */
+  v = deriveValue(
+        v, m_buf.a, m_buf.b, m_buf.c, m_buf.min_val, m_buf.max_val);
+  
+  /* Append this graph value to the accumulator */
+  accAppend(t, v, m_buf_lnum);
+}
+
+/*
+ * Compute the exact value of a logarithmic ramp plus one.
+ * 
+ * This is the formula that incremental computation of logarithmic
+ * ramps must match after flooring.
+ * 
+ * Parameters:
+ * 
+ *   la - the natural logarithm of the start value of the ramp plus one
+ * 
+ *   lb - the natural logarithm of the end value of the ramp plus one
+ * 
+ *   tv - the position on the ramp on a normalized 0.0-1.0 scale
+ * 
+ * Return:
+ * 
+ *   the interpolated ramp value plus one
+ */
+static double logRamp(double la, double lb, double tv) {
+  return exp(la + (tv * (lb - la)));
+}
+
+/*
+ * Compute the position of a step on a ramp on a normalized 0.0-1.0
+ * scale.
+ * 
+ * Parameters:
+ * 
+ *   pr - the ramp segment
+ * 
+ *   s - the subquantum offset of the step
+ * 
+ * Return:
+ * 
+ *   the position on the ramp
+ */
+static double rampPos(const RAMP *pr, int64_t s) {
+  
+  double tv = 0.0;
+  
+  if (pr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  tv = (((double) s) - ((double) pr->ts))
+        / (((double) pr->te) - ((double) pr->ts));
+  if (!(tv >= 0.0)) {
+    tv = 0.0;
+  } else if (!(tv <= 1.0)) {
+    tv = 1.0;
+  }
+  
+  return tv;
+}
+
+/*
+ * Floor an interpolated ramp value to an integer and clamp it to the
+ * range of graph values.
+ * 
+ * Parameters:
+ * 
+ *   tv - the interpolated value
+ * 
+ * Return:
+ * 
+ *   the graph value
+ */
+static int32_t rampRound(double tv) {
+  
+  tv = floor(tv);
+  if (!(tv >= 0.0)) {
+    tv = 0.0;
+  } else if (!(tv <= (double) INT32_MAX)) {
+    tv = (double) INT32_MAX;
+  }
+  
+  return (int32_t) tv;
+}
+
+/*
+ * Compute the exact value of a ramp at a step.
+ * 
+ * Parameters:
+ * 
+ *   pr - the ramp segment
+ * 
+ *   s - the subquantum offset of the step
+ * 
+ * Return:
+ * 
+ *   the graph value at the step
+ */
+static int32_t rampValue(const RAMP *pr, int64_t s) {
+  
+  double tv = 0.0;
+  
+  if (pr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  tv = rampPos(pr, s);
+  if (pr->use_log) {
+    tv = logRamp(pr->la, pr->lb, tv) - 1.0;
+  } else {
+    tv = ((double) pr->a) + ((((double) pr->b) - ((double) pr->a)) * tv);
+  }
+  
+  return rampRound(tv);
+}
+
+/*
+ * Find the ramp segment attached to a graph node.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   i - the index of the node in the graph table
+ * 
+ * Return:
+ * 
+ *   the ramp segment attached to the node, or NULL if there is none
+ */
+static const RAMP *rampFind(GRAPH *pg, int32_t i) {
+  
+  const RAMP *pResult = NULL;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  lo = 0;
+  hi = pg->ramps - 1;
+  while (lo <= hi) {
+    mid = lo + ((hi - lo) / 2);
+    if (((pg->pRamp)[mid]).node < i) {
+      lo = mid + 1;
+    } else if (((pg->pRamp)[mid]).node > i) {
+      hi = mid - 1;
+    } else {
+      pResult = &((pg->pRamp)[mid]);
+      break;
+    }
+  }
+  
+  return pResult;
+}
+
+/*
+ * Evaluate a ramp segment at a moment offset.
+ * 
+ * The moment offset must be covered by the node that the ramp segment
+ * is attached to, or be before that node if it is the first node.  The
+ * result is the value of the last step that is at or before the moment
+ * offset, or the value of the node if there is no such step.
+ * 
+ * Parameters:
+ * 
+ *   pr - the ramp segment
+ * 
+ *   v - the value of the node the ramp segment is attached to
+ * 
+ *   t - the moment offset
+ * 
+ * Return:
+ * 
+ *   the graph value
+ */
+static int32_t rampEval(const RAMP *pr, int32_t v, int32_t t) {
+  
+  int32_t result = 0;
+  int64_t s = 0;
+  int p = 0;
+  
+  if (pr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get the latest subquantum offset whose step would be at or before
+   * t, given the moment part of the steps */
+  s = (int64_t) pointer_unpack(t, &p);
+  if (p < pr->mp) {
+    s--;
+  }
+  
+  /* Round down to a step */
+  if (s < pr->first) {
+    result = v;
+  } else {
+    if (s > pr->last) {
+      s = (int64_t) pr->last;
+    }
+    s -= (s - ((int64_t) pr->first)) % ((int64_t) pr->c);
+    result = rampValue(pr, s);
+  }
+  
+  return result;
+}
+
+/*
+ * Expand the steps of a ramp segment into graph nodes.
+ * 
+ * Each step whose value differs from the last node in the array is
+ * added to the array after the count nodes already there, of which
+ * there must be at least one.  The array must have room for all the
+ * steps.
+ * 
+ * Logarithmic ramps are computed incrementally, as explained for
+ * LOG_SYNC, so the values are the same as rampValue() would give.
+ * 
+ * Parameters:
+ * 
+ *   pr - the ramp segment
+ * 
+ *   pNodes - the node array
+ * 
+ *   count - the number of nodes already in the array
+ * 
+ * Return:
+ * 
+ *   the number of nodes in the array after the expansion
+ */
+static int32_t rampExpand(
+    const RAMP *pr, GRAPH_NODE *pNodes, int32_t count) {
+  
+  int log_sync = 0;
+  double lr = 0.0;
+  double ly = 0.0;
+  double lf = 0.0;
+  int64_t s = 0;
+  int32_t v = 0;
+  
+  if ((pr == NULL) || (pNodes == NULL) || (count < 1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* For logarithmic ramps, compute the constant ratio between
+   * successive steps */
+  if (pr->use_log) {
+    lr = exp(
+          (((double) pr->c) / (((double) pr->te) - ((double) pr->ts)))
+            * (pr->lb - pr->la));
+    log_sync = 0;
+  }
+  
+  for(s = (int64_t) pr->first;
+      s <= (int64_t) pr->last;
+      s += (int64_t) pr->c) {
+    
+    if (pr->use_log) {
+      /* Logarithmic interpolation, stepping the previous value by the
+       * constant ratio except when the exact formula is needed */
+      if (log_sync < 1) {
+        ly = logRamp(pr->la, pr->lb, rampPos(pr, s));
+        log_sync = LOG_SYNC;
+        
+      } else {
+        ly *= lr;
+        log_sync--;
+        
+        lf = floor(ly);
+        if ((ly - lf < ly * LOG_TOL) || (lf + 1.0 - ly < ly * LOG_TOL)) {
+          ly = logRamp(pr->la, pr->lb, rampPos(pr, s));
+          log_sync = LOG_SYNC;
+        }
+      }
+      v = rampRound(ly - 1.0);
+      
+    } else {
+      /* Linear interpolation */
+      v = rampValue(pr, s);
+    }
+    
+    if (v != (pNodes[count - 1]).v) {
+      (pNodes[count]).t = pointer_pack((int32_t) s, (int) pr->mp);
+      (pNodes[count]).v = v;
+      count++;
+    }
+  }
+  
+  return count;
+}
+
+/*
+ * Resolve any buffered regions by adding nodes into the accumulator
+ * with accAppend(), or ramp segments with accRamp().
+ * 
+ * May only be used when not shut down and when the accumulator register
+ * is loaded.
+ * 
+ * If there is a region after the one buffered in m_buf, t_next should
+ * be the moment offset of the next region and has_next should be
+ * non-zero.
+ * 
+ * If the region buffered in m_buf is the last region, has_next should
+ * be zero and t_next is ignored.
+ * 
+ * If the region has STATE_EMPTY, then the call does nothing.
+ * Otherwise, the buffered region is resolved by appending all the
+ * necessary nodes and ramp segments and the buffered region is reset
+ * back to STATE_EMPTY.
+ * 
+ * This function will change STATE_RAMP regions to STATE_CONST if both
+ * the start and target values of the ramp are the same.
+ * 
+ * Parameters:
+ * 
+ *   t_next - moment offset of next region, ignored if none
+ * 
+ *   has_next - non-zero if there is a next region, zero otherwise
+ */
+static void resolve(int32_t t_next, int has_next) {
+  
+  int track_has_end = 0;
+  int32_t track_end_t = 0;
+  int64_t iv64 = 0;
+  int32_t ts = 0;
+  int32_t te = 0;
+  int64_t t = 0;
+  int mp = 0;
+  RAMP ramp;
+  
+  /* Initialize structures */
+  memset(&ramp, 0, sizeof(RAMP));
+  
+  /* Check state */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (!m_load) {
+    raiseErr(__LINE__, "Accumulator not loaded");
+  }
+  
+  /* If there is a next region and region buffer is not empty, make sure
+   * start of next region is after start of current region */
+  if (has_next && (m_buf.state != STATE_EMPTY)) {
+    if (t_next <= m_buf.t) {
+      raiseErr(__LINE__,
+        "Graph regions must be chronological on script line %ld",
+        srcLine(m_buf_lnum));
+    }
+  }
+  
+  /* Convert ramp to constant if possible */
+  if (m_buf.state == STATE_RAMP) {
+    if (m_buf.a == m_buf.b) {
+      m_buf.state = STATE_CONST;
+    }
+  }
+  
+  /* Handle the different region types */
+  if (m_buf.state == STATE_CONST) {
+    /* Constant region, so just append the constant node */
+    accAppend(m_buf.t, m_buf.a, m_buf_lnum);
+    
+  } else if (m_buf.state == STATE_DERIVE) {
+    /* Derived region, so first figure out the end within the source
+     * graph, if there is an endpoint; an overflow of the source range
+     * is handled as though there were no endpoint */
+    if (has_next) {
+      /* There is a next node, so compute the endpoint of the source
+       * track in 64-bit space */
+      iv64 = (((int64_t) t_next) - ((int64_t) m_buf.t))
+              + ((int64_t) m_buf.t_src);
+      
+      /* If this result is in 32-bit range, use it as endpoint; else,
+       * no endpoint */
+      if ((iv64 >= INT32_MIN) && (iv64 <= INT32_MAX)) {
+        track_has_end = 1;
+        track_end_t = (int32_t) iv64;
+      } else {
+        track_has_end = 0;
+      }
+      
+    } else {
+      /* No next node, so there is no endpoint in source track */
+      track_has_end = 0;
+    }
+    
+    /* Use tracking algorithm to add all the necessary nodes */
+    graph_track(
+      m_buf.pg,
+      &resolveTrack,
+      NULL,
+      m_buf.t_src,
+      track_end_t,
+      0,
+      track_has_end,
+      0);
+    
+  } else if (m_buf.state == STATE_RAMP) {
+    /* Ramp region, so first verify that there is a next node */
+    if (!has_next) {
+      raiseErr(__LINE__,
+        "Ramp may not be last region in graph on script line %ld",
+        srcLine(m_buf_lnum));
+    }
+    
+    /* Parse start of region in subquantum offset in ts and moment part
+     * in mp */
+    ts = pointer_unpack(m_buf.t, &mp);
+    
+    /* Round the start of region offset down to a step distance boundary
+     * value in 64-bit space */
+    if (t < 0) {
+      t = (0 - ((int64_t) ts)) / ((int64_t) m_buf.c);
+      t *= (0 - ((int64_t) m_buf.c));
+      if (t > ts) {
+        t -= ((int64_t) m_buf.c);
+      }
+      
+    } else if (m_buf.t >= 0) {
+      t = ((int64_t) ts) / ((int64_t) m_buf.c);
+      t *= ((int64_t) m_buf.c);
+      
+    } else {
+      raiseErr(__LINE__, NULL);
+    }
+    
+    /* Now set te to the subquantum offset of the region following the
+     * ramp */
+    te = pointer_unpack(t_next, NULL);
+    
+    /* The first step is one step distance after the rounded start of
+     * the region */
+    t += ((int64_t) m_buf.c);
+    
+    if (t < te) {
+      /* The ramp has steps, so store them as a ramp segment, with the
+       * last step being the last one before the next region */
+      ramp.ts = ts;
+      ramp.te = te;
+      ramp.first = (int32_t) t;
+      ramp.last = (int32_t) (t + (((((int64_t) te) - 1 - t)
+                                    / ((int64_t) m_buf.c))
+                                  * ((int64_t) m_buf.c)));
+      ramp.a = m_buf.a;
+      ramp.b = m_buf.b;
+      ramp.c = m_buf.c;
+      ramp.mp = (int32_t) mp;
+      ramp.use_log = (int32_t) m_buf.use_log;
+      if (m_buf.use_log) {
+        ramp.la = log(((double) m_buf.a) + 1.0);
+        ramp.lb = log(((double) m_buf.b) + 1.0);
+      }
+      
+      accRamp(m_buf.t, &ramp, m_buf_lnum);
+      
+    } else {
+      /* No steps, so the start value of the ramp holds until the next
+       * region */
+      accAppend(m_buf.t, m_buf.a, m_buf_lnum);
+    }
+    
+  } else {
+    if (m_buf.state != STATE_EMPTY) {
+      raiseErr(__LINE__, NULL);
+    }
+  }
+  
+  /* Clear the region buffer */
+  memset(&m_buf, 0, sizeof(REGION));
+  m_buf_lnum = 0;
+}
+
+/*
+ * Find the graph node that covers the given moment offset within a
+ * range of graph nodes.
+ * 
+ * The selected graph node is the node with latest time offset in the
+ * set of nodes in the range lo to hi inclusive that have time offsets
+ * less than or equal to the given offset.  If there is no such graph
+ * node, -1 is returned.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   lo - the index of the first node in the range
+ * 
+ *   hi - the index of the last node in the range
+ * 
+ *   t - the moment offset
+ * 
+ * Return:
+ * 
+ *   the index in the graph table of the node that covers the moment
+ *   offset, or -1 if no graph node in the range covers it
+ */
+static int32_t graphRange(GRAPH *pg, int32_t lo, int32_t hi, int32_t t) {
+  
+  int32_t result = 0;
+  int32_t mid = 0;
+  int32_t m = 0;
+  
+  /* Check state and parameters */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((lo < 0) || (hi < lo) || (hi >= pg->len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Zoom in on the relevant node */
+  while (lo < hi) {
+    /* Midpoint is halfway between boundaries, and always greater than
+     * the lower boundary */
+    mid = lo + ((hi - lo) / 2);
+    if (mid <= lo) {
+      mid = lo + 1;
+    }
+    
+    /* Compare midpoint node time to given time */
+    m = ((pg->table)[mid]).t;
+    if (m < t) {
+      /* Node is less than requested time, so new lower boundary is the
+       * midpoint */
+      lo = mid;
+      
+    } else if (m > t) {
+      /* Node is greater than requested time, so new upper boundary is
+       * below this node */
+      hi = mid - 1;
+      
+    } else if (m == t) {
+      /* Node exactly matches time, so zoom in */
+      lo = mid;
+      hi = mid;
+      
+    } else {
+      raiseErr(__LINE__, NULL);
+    }
+  }
+  
+  /* If selected node has time less than or equal to requested time,
+   * that node is the result; otherwise, -1 is the result */
+  if (((pg->table)[lo]).t <= t) {
+    result = lo;
+  } else {
+    result = -1;
+  }
+  
+  return result;
+}
+
+/*
+ * Find the graph node that covers the given moment offset.
+ * 
+ * The selected graph node is the node with latest time offset in the
+ * set of nodes that have time offsets less than or equal to the given
+ * offset.  If there is no such graph node, -1 is returned.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   t - the moment offset
+ * 
+ * Return:
+ * 
+ *   the index in the graph table of the node that covers the moment
+ *   offset, or -1 if no graph node covers it
+ */
+static int32_t graphSeek(GRAPH *pg, int32_t t) {
+  
+  int32_t result = 0;
+  
+  /* Check state and parameters */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pg->len < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Search the whole graph table, using the search index if there is
+   * one */
+  if (pg->pEytz != NULL) {
+    result = eytzSeek(pg, t);
+  } else {
+    result = graphRange(pg, 0, pg->len - 1, t);
+  }
+  
+  return result;
+}
+
+/*
+ * Find the graph node that determines the value at the given moment
+ * offset, starting from a known node index.
+ * 
+ * The selected node is the node that graphSeek() would select, except
+ * that if graphSeek() would return -1, the first node is selected
+ * instead, since the first node determines the value of the graph
+ * before its start.
+ * 
+ * The search gallops away from node i in the direction of t, doubling
+ * the step each time, until it passes t.  It then searches the nodes
+ * that were passed over in the last step.  The time taken is therefore
+ * logarithmic in the distance between node i and the result.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   i - the index of the node to start from
+ * 
+ *   t - the moment offset
+ * 
+ * Return:
+ * 
+ *   the index in the graph table of the node that determines the value
+ *   at the moment offset
+ */
+static int32_t graphGallop(GRAPH *pg, int32_t i, int32_t t) {
+  
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t step = 0;
+  
+  /* Check state and parameters */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((i < 0) || (i >= pg->len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (((pg->table)[i]).t <= t) {
+    /* Gallop forward, keeping lo at a node that is not after t, until
+     * hi reaches a node that is after t or the last node */
+    lo = i;
+    hi = i;
+    step = 1;
+    while (hi < pg->len - 1) {
+      if (step < pg->len - 1 - lo) {
+        hi = lo + step;
+      } else {
+        hi = pg->len - 1;
+      }
+      
+      if (((pg->table)[hi]).t > t) {
+        break;
+      }
+      
+      lo = hi;
+      step *= 2;
+    }
+    
+  } else {
+    /* Gallop backward, keeping hi at a node that is after t, until lo
+     * reaches a node that is not after t or the first node */
+    lo = i;
+    hi = i;
+    step = 1;
+    while (lo > 0) {
+      if (step < hi) {
+        lo = hi - step;
+      } else {
+        lo = 0;
+      }
+      
+      if (((pg->table)[lo]).t <= t) {
+        break;
+      }
+      
+      hi = lo;
+      step *= 2;
+    }
+  }
+  
+  /* Search the range passed over in the last step, using the first
+   * node if no node covers t */
+  i = graphRange(pg, lo, hi, t);
+  if (i < 0) {
+    i = 0;
+  }
+  
+  return i;
+}
+
+/*
+ * Query a small graph at many moment offsets by counting nodes.
+ * 
+ * For each offset, the number of nodes after the first node that are at
+ * or before the offset is the index of the node that determines the
+ * value, since node offsets are strictly ascending.  This also selects
+ * the first node for offsets before the start of the graph.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   pT - the moment offsets to query
+ * 
+ *   pOut - the array that receives the graph values
+ * 
+ *   n - the number of offsets
+ */
+static void batchScan(
+    GRAPH *pg, const int32_t *pT, int32_t *pOut, int32_t n) {
+  
+  int32_t i = 0;
+  int32_t k = 0;
+  int32_t c = 0;
+  int32_t t = 0;
+  const GRAPH_NODE *pn = NULL;
+  
+  if ((pg == NULL) || (pT == NULL) || (pOut == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pn = pg->table;
+  for(i = 0; i < n; i++) {
+    t = pT[i];
+    c = 0;
+    for(k = 1; k < pg->len; k++) {
+      c += (pn[k].t <= t);
     }
+    pOut[i] = pn[c].v;
   }
-  
-  v = (int32_t) iv64;
-  
-  /* Append this graph value to the accumulator */
-  accAppend(t, v, m_buf_lnum);
 }
 
 /*
- * Resolve any buffered regions by adding nodes into the accumulator
- * with accAppend().
+ * Query a large graph at many moment offsets with an interleaved
+ * branchless binary search.
  * 
- * May only be used when not shut down and when the accumulator register
- * is loaded.
+ * Each search narrows a window starting at node base with len nodes,
+ * keeping the invariant that the result is within the window.  Each
+ * step halves the window and moves base with a conditional select
+ * rather than a branch.  Up to BATCH_WAYS queries are advanced together
+ * in each step.
  * 
- * If there is a region after the one buffered in m_buf, t_next should
- * be the moment offset of the next region and has_next should be
- * non-zero.
+ * Parameters:
  * 
- * If the region buffered in m_buf is the last region, has_next should
- * be zero and t_next is ignored.
+ *   pg - the graph
  * 
- * If the region has STATE_EMPTY, then the call does nothing.
- * Otherwise, the buffered region is resolved by appending all the
- * necessary nodes with accAppend() and the buffered region is reset
- * back to STATE_EMPTY.
+ *   pT - the moment offsets to query
  * 
- * This function will change STATE_RAMP regions to STATE_CONST if both
- * the start and target values of the ramp are the same.
+ *   pOut - the array that receives the graph values
  * 
- * Parameters:
+ *   n - the number of offsets
+ */
+static void batchSearch(
+    GRAPH *pg, const int32_t *pT, int32_t *pOut, int32_t n) {
+  
+  int32_t base[BATCH_WAYS];
+  int32_t i = 0;
+  int32_t k = 0;
+  int32_t w = 0;
+  int32_t len = 0;
+  int32_t half = 0;
+  const GRAPH_NODE *pn = NULL;
+  
+  if ((pg == NULL) || (pT == NULL) || (pOut == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pn = pg->table;
+  for(i = 0; i < n; i += BATCH_WAYS) {
+    /* Get the number of queries in this group */
+    if (n - i < BATCH_WAYS) {
+      w = n - i;
+    } else {
+      w = BATCH_WAYS;
+    }
+    
+    /* Run the searches of the group in lockstep */
+    for(k = 0; k < w; k++) {
+      base[k] = 0;
+    }
+    for(len = pg->len; len > 1; len -= half) {
+      half = len / 2;
+      for(k = 0; k < w; k++) {
+        base[k] = (pn[base[k] + half].t <= pT[i + k])
+                    ? (base[k] + half) : base[k];
+      }
+    }
+    
+    /* Store the results of the group */
+    for(k = 0; k < w; k++) {
+      pOut[i + k] = pn[base[k]].v;
+    }
+  }
+}
+
+/*
+ * Construct a derived view from the derived region in the region
+ * buffer, and then reset the accumulator.
  * 
- *   t_next - moment offset of next region, ignored if none
+ * May only be used when the accumulator register is loaded, the region
+ * buffer holds a derived region, and no nodes have been added to the
+ * accumulator, so that the derived region is the whole graph.  The
+ * source must not be a derived view that has been materialized; use
+ * its materialized graph instead.
  * 
- *   has_next - non-zero if there is a next region, zero otherwise
+ * Return:
+ * 
+ *   the new derived view
  */
-static void resolve(int32_t t_next, int has_next) {
+static GRAPH *viewNew(void) {
   
-  int track_has_end = 0;
-  int32_t track_end_t = 0;
-  int64_t iv64 = 0;
-  int32_t ts = 0;
-  int32_t te = 0;
-  int32_t to = 0;
-  int64_t t = 0;
-  int mp = 0;
-  double tv = 0.0;
+  GRAPH key;
+  GRAPH *pGraph = NULL;
+  int32_t slot = 0;
+  
+  memset(&key, 0, sizeof(GRAPH));
   
   /* Check state */
   if (m_shutdown) {
     raiseErr(__LINE__, "Graph module is shut down");
   }
-  if (!m_load) {
-    raiseErr(__LINE__, "Accumulator not loaded");
+  if ((!m_load) || (m_buf.state != STATE_DERIVE) || (m_acc_len > 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (m_buf.pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (m_buf.pg->pMat != NULL) {
+    raiseErr(__LINE__, NULL);
   }
   
-  /* If there is a next region and region buffer is not empty, make sure
-   * start of next region is after start of current region */
-  if (has_next && (m_buf.state != STATE_EMPTY)) {
-    if (t_next <= m_buf.t) {
-      raiseErr(__LINE__,
-        "Graph regions must be chronological on script line %ld",
-        srcLine(m_buf_lnum));
+  /* Fill in the key of the view and look for an identical view */
+  key.len = 0;
+  key.pSrc = m_buf.pg;
+  key.pMat = NULL;
+  key.t_src = m_buf.t_src;
+  key.num = m_buf.a;
+  key.denom = m_buf.b;
+  key.add = m_buf.c;
+  key.min_val = m_buf.min_val;
+  key.max_val = m_buf.max_val;
+  key.depth = (m_buf.pg)->depth + 1;
+  key.hash = hashView(&key);
+  
+  slot = hconsSlot(key.hash, &key, NULL, 0, NULL, 0);
+  if (slot >= 0) {
+    pGraph = m_hcons[slot];
+  }
+  
+  /* Allocate the view if necessary, which does not use the graph
+   * table, then intern it if the table has room */
+  if (pGraph == NULL) {
+    pGraph = (GRAPH *) arena_alloc(&m_arena, sizeof(GRAPH));
+    memcpy(pGraph, &key, sizeof(GRAPH));
+    
+    if (slot >= 0) {
+      m_hcons[slot] = pGraph;
+      m_hcons_len++;
     }
+    m_count++;
   }
   
-  /* Convert ramp to constant if possible */
-  if (m_buf.state == STATE_RAMP) {
-    if (m_buf.a == m_buf.b) {
-      m_buf.state = STATE_CONST;
-    }
+  /* Clear the region buffer, reset the accumulator, and clear the load
+   * flag */
+  memset(&m_buf, 0, sizeof(REGION));
+  m_buf_lnum = 0;
+  accReset();
+  m_load = 0;
+  
+  return pGraph;
+}
+
+/*
+ * Map a moment offset in a derived view to the moment offset in its
+ * source graph that determines the value of the view.
+ * 
+ * Parameters:
+ * 
+ *   pg - the derived view
+ * 
+ *   t - the moment offset in the view
+ * 
+ * Return:
+ * 
+ *   the moment offset in the source graph
+ */
+static int32_t viewTime(GRAPH *pg, int32_t t) {
+  
+  int64_t iv64 = 0;
+  
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pg->pSrc == NULL) {
+    raiseErr(__LINE__, NULL);
   }
   
-  /* Handle the different region types */
-  if (m_buf.state == STATE_CONST) {
-    /* Constant region, so just append the constant node */
-    accAppend(m_buf.t, m_buf.a, m_buf_lnum);
-    
-  } else if (m_buf.state == STATE_DERIVE) {
-    /* Derived region, so first figure out the end within the source
-     * graph, if there is an endpoint; an overflow of the source range
-     * is handled as though there were no endpoint */
-    if (has_next) {
-      /* There is a next node, so compute the endpoint of the source
-       * track in 64-bit space */
-      iv64 = (((int64_t) t_next) - ((int64_t) m_buf.t))
-              + ((int64_t) m_buf.t_src);
-      
-      /* If this result is in 32-bit range, use it as endpoint; else,
-       * no endpoint */
-      if ((iv64 >= INT32_MIN) && (iv64 <= INT32_MAX)) {
-        track_has_end = 1;
-        track_end_t = (int32_t) iv64;
-      } else {
-        track_has_end = 0;
-      }
-      
-    } else {
-      /* No next node, so there is no endpoint in source track */
-      track_has_end = 0;
-    }
-    
-    /* Use tracking algorithm to add all the necessary nodes */
-    graph_track(
-      m_buf.pg,
-      &resolveTrack,
-      NULL,
-      m_buf.t_src,
-      track_end_t,
-      0,
-      track_has_end,
-      0);
-    
-  } else if (m_buf.state == STATE_RAMP) {
-    /* Ramp region, so first verify that there is a next node */
-    if (!has_next) {
-      raiseErr(__LINE__,
-        "Ramp may not be last region in graph on script line %ld",
-        srcLine(m_buf_lnum));
-    }
-    
-    /* At the start of the region, there is always the start value of
-     * the ramp */
-    accAppend(m_buf.t, m_buf.a, m_buf_lnum);
-    
-    /* Parse start of region in subquantum offset in ts and moment part
-     * in mp */
-    ts = pointer_unpack(m_buf.t, &mp);
+  if (t < 0) {
+    t = 0;
+  }
+  
+  iv64 = ((int64_t) t) + ((int64_t) pg->t_src);
+  if (iv64 > INT32_MAX) {
+    iv64 = (int64_t) INT32_MAX;
+  }
+  
+  return (int32_t) iv64;
+}
+
+/*
+ * Evaluate a graph at a moment offset, following derived views back to
+ * the graph that has a graph table and computing ramp segments on
+ * demand.
+ * 
+ * If pc is NULL, the graph table is searched directly.  Otherwise, the
+ * search gallops from the current node of the given cursor, which must
+ * already be bound to the graph returned by viewBody() for pg.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   t - the moment offset
+ * 
+ *   pc - the cursor to search with, or NULL
+ * 
+ * Return:
+ * 
+ *   the value of the graph
+ */
+static int32_t viewEval(GRAPH *pg, int32_t t, GRAPH_CURSOR *pc) {
+  
+  int32_t result = 0;
+  int32_t i = 0;
+  const RAMP *pr = NULL;
+  
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (pg->pMat != NULL) {
+    pg = pg->pMat;
+  }
+  
+  if (pg->pSrc != NULL) {
+    /* Derived view, so transform the source value */
+    result = deriveValue(
+              viewEval(pg->pSrc, viewTime(pg, t), pc),
+              pg->num,
+              pg->denom,
+              pg->add,
+              pg->min_val,
+              pg->max_val);
     
-    /* Round the start of region offset down to a step distance boundary
-     * value in 64-bit space */
-    if (t < 0) {
-      t = (0 - ((int64_t) ts)) / ((int64_t) m_buf.c);
-      t *= (0 - ((int64_t) m_buf.c));
-      if (t > ts) {
-        t -= ((int64_t) m_buf.c);
-      }
-      
-    } else if (m_buf.t >= 0) {
-      t = ((int64_t) ts) / ((int64_t) m_buf.c);
-      t *= ((int64_t) m_buf.c);
-      
-    } else {
+  } else if (pc != NULL) {
+    /* Graph table with cursor */
+    if (pc->pBody != pg) {
       raiseErr(__LINE__, NULL);
     }
-    
-    /* Now set te to the subquantum offset of the region following the
-     * ramp */
-    te = pointer_unpack(t_next, NULL);
-    
-    /* Compute the rest of the ramp and add the changes in value to the
-     * accumulator */
-    for(t += ((int64_t) m_buf.c);
-        t < te;
-        t += ((int64_t) m_buf.c)) {
-   
-      /* Compute position on ramp on a normalized 0.0-1.0 scale */
-      tv = (((double) t) - ((double) ts))
-            / (((double) te) - ((double) ts));
-      if (!(tv >= 0.0)) {
-        tv = 0.0;
-      } else if (!(tv <= 1.0)) {
-        tv = 1.0;
-      }
-      
-      /* Perform the requested interpolation */
-      if (m_buf.use_log) {
-        /* Logarithmic interpolation */
-        tv = exp(
-          log(((double) m_buf.a) + 1.0)
-          + (
-              tv * (
-                    log(((double) m_buf.b) + 1.0)
-                    - log(((double) m_buf.a) + 1.0)
-                   )
-            )
-        ) - 1.0;
-        
-      } else {
-        /* Linear interpolation */
-        tv = ((double) m_buf.a)
-              + ((((double) m_buf.b) - ((double) m_buf.a)) * tv);
-      }
-      
-      /* Floor interpolation to integer and clamp to 32-bit integer
-       * range */
-      tv = floor(tv);
-      if (!(tv >= 0.0)) {
-        tv = 0.0;
-      } else if (!(tv <= (double) INT32_MAX)) {
-        tv = (double) INT32_MAX;
-      }
-      
-      /* Get a moment offset from the current subquantum offset and the
-       * moment part that was used at the start of the region */
-      to = pointer_pack((int32_t) t, mp);
-
-      /* Add the interpolated position to the accumuator */
-      accAppend(to, (int32_t) tv, m_buf_lnum);
-    }
+    pc->i = graphGallop(pg, pc->i, t);
+    i = pc->i;
+    result = ((pg->table)[i]).v;
     
   } else {
-    if (m_buf.state != STATE_EMPTY) {
-      raiseErr(__LINE__, NULL);
+    /* Graph table without cursor */
+    i = graphSeek(pg, t);
+    if (i < 0) {
+      i = 0;
     }
+    result = ((pg->table)[i]).v;
   }
   
-  /* Clear the region buffer */
-  memset(&m_buf, 0, sizeof(REGION));
-  m_buf_lnum = 0;
+  /* If the node has a ramp segment, compute the step value */
+  if ((pg->pSrc == NULL) && (pg->ramps > 0)) {
+    pr = rampFind(pg, i);
+    if (pr != NULL) {
+      result = rampEval(pr, result, t);
+    }
+  }
+  
+  return result;
 }
 
 /*
- * Find the graph node that covers the given moment offset.
+ * Get the graph with a graph table that viewEval() searches when
+ * evaluating the given graph.
  * 
- * The selected graph node is the node with latest time offset in the
- * set of nodes that have time offsets less than or equal to the given
- * offset.  If there is no such graph node, -1 is returned.
+ * This is the graph itself if it has a graph table and has not been
+ * materialized.  Otherwise, materialized graphs and the chain of derived
+ * views are followed back to the first graph that has a graph table and
+ * has not been materialized.
  * 
  * Parameters:
  * 
  *   pg - the graph
  * 
- *   t - the moment offset
+ * Return:
+ * 
+ *   the graph that is searched
+ */
+static GRAPH *viewBody(GRAPH *pg) {
+  
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  while ((pg->pSrc != NULL) || (pg->pMat != NULL)) {
+    if (pg->pMat != NULL) {
+      pg = pg->pMat;
+    } else {
+      pg = pg->pSrc;
+    }
+  }
+  
+  return pg;
+}
+
+/*
+ * Get a graph with a graph table that has the same values as the given
+ * graph and a node for every change in value.
+ * 
+ * For graphs that have a graph table without ramp segments, the graph
+ * itself is returned.  For derived views and graphs with ramp segments,
+ * the graph is materialized if it has not been materialized already,
+ * and the materialized graph is returned.  The materialized nodes of a
+ * view are the same nodes that resolveTrack() would have added to the
+ * accumulator, and ramp segments are expanded into a node for each
+ * step that changes the value.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
  * 
  * Return:
  * 
- *   the index in the graph table of the node that covers the moment
- *   offset, or -1 if no graph node covers it
+ *   a graph with a graph table
  */
-static int32_t graphSeek(GRAPH *pg, int32_t t) {
+static GRAPH *graphNodes(GRAPH *pg) {
   
-  int32_t result = 0;
-  int32_t lo = 0;
-  int32_t hi = 0;
-  int32_t mid = 0;
-  int32_t m = 0;
+  GRAPH *pb = NULL;
+  GRAPH_NODE *pNodes = NULL;
+  const RAMP *pr = NULL;
+  int32_t count = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t v = 0;
+  int64_t iv64 = 0;
   
-  /* Check state and parameters */
   if (m_shutdown) {
     raiseErr(__LINE__, "Graph module is shut down");
   }
   if (pg == NULL) {
     raiseErr(__LINE__, NULL);
   }
-  if (pg->len < 1) {
-    raiseErr(__LINE__, NULL);
-  }
   
-  /* Zoom in on the relevant node */
-  lo = 0;
-  hi = pg->len - 1;
-  while (lo < hi) {
-    /* Midpoint is halfway between boundaries, and always greater than
-     * the lower boundary */
-    mid = lo + ((hi - lo) / 2);
-    if (mid <= lo) {
-      mid = lo + 1;
+  if ((pg->pSrc != NULL) && (pg->pMat == NULL)) {
+    /* Get the source nodes, materializing the source if necessary */
+    pb = graphNodes(pg->pSrc);
+    
+    pNodes = (GRAPH_NODE *) calloc(
+                (size_t) pb->len, sizeof(GRAPH_NODE));
+    if (pNodes == NULL) {
+      raiseErr(__LINE__, "Out of memory");
     }
     
-    /* Compare midpoint node time to given time */
-    m = ((pg->table)[mid]).t;
-    if (m < t) {
-      /* Node is less than requested time, so new lower boundary is the
-       * midpoint */
-      lo = mid;
-      
-    } else if (m > t) {
-      /* Node is greater than requested time, so new upper boundary is
-       * below this node */
-      hi = mid - 1;
-      
-    } else if (m == t) {
-      /* Node exactly matches time, so zoom in */
-      lo = mid;
-      hi = mid;
+    /* The first node is at offset zero with the transformed value of
+     * the source node covering t_src */
+    i = graphSeek(pb, pg->t_src);
+    if (i < 0) {
+      i = 0;
+    }
+    (pNodes[0]).t = 0;
+    (pNodes[0]).v = deriveValue(
+                      ((pb->table)[i]).v,
+                      pg->num, pg->denom, pg->add,
+                      pg->min_val, pg->max_val);
+    count = 1;
+    
+    /* Each later source node whose transformed value changes gives a
+     * node at its offset relative to t_src */
+    for(i++; i < pb->len; i++) {
+      v = deriveValue(
+            ((pb->table)[i]).v,
+            pg->num, pg->denom, pg->add,
+            pg->min_val, pg->max_val);
+      if (v != (pNodes[count - 1]).v) {
+        iv64 = ((int64_t) ((pb->table)[i]).t) - ((int64_t) pg->t_src);
+        if (iv64 > INT32_MAX) {
+          raiseErr(__LINE__, "Derived graph out of range");
+        }
+        (pNodes[count]).t = (int32_t) iv64;
+        (pNodes[count]).v = v;
+        count++;
+      }
+    }
+    
+    /* Construct the materialized graph */
+    if (count > 1) {
+      pg->pMat = graphAlloc(pNodes, count, NULL, 0);
+    } else {
+      pg->pMat = cache_get((pNodes[0]).v);
+    }
+    
+    free(pNodes);
+    pNodes = NULL;
+    
+  } else if ((pg->ramps > 0) && (pg->pMat == NULL)) {
+    /* Count the nodes of the expanded graph */
+    iv64 = (int64_t) pg->len;
+    for(j = 0; j < pg->ramps; j++) {
+      pr = &((pg->pRamp)[j]);
+      iv64 += ((((int64_t) pr->last) - ((int64_t) pr->first))
+                / ((int64_t) pr->c)) + 1;
+    }
+    if (iv64 > GRAPH_MAX_EXPAND) {
+      raiseErr(__LINE__, "Graph too complex to expand");
+    }
+    
+    pNodes = (GRAPH_NODE *) calloc((size_t) iv64, sizeof(GRAPH_NODE));
+    if (pNodes == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    /* Copy each node that changes the value, followed by the steps of
+     * its ramp segment if it has one */
+    j = 0;
+    for(i = 0; i < pg->len; i++) {
+      if ((count < 1) || (((pg->table)[i]).v != (pNodes[count - 1]).v)) {
+        memcpy(&(pNodes[count]), &((pg->table)[i]), sizeof(GRAPH_NODE));
+        count++;
+      }
       
+      if (j < pg->ramps) {
+        if (((pg->pRamp)[j]).node == i) {
+          count = rampExpand(&((pg->pRamp)[j]), pNodes, count);
+          j++;
+        }
+      }
+    }
+    
+    /* Construct the materialized graph */
+    if (count > 1) {
+      pg->pMat = graphAlloc(pNodes, count, NULL, 0);
     } else {
-      raiseErr(__LINE__, NULL);
+      pg->pMat = cache_get((pNodes[0]).v);
     }
+    
+    free(pNodes);
+    pNodes = NULL;
   }
   
-  /* If selected node has time less than or equal to requested time,
-   * that node is the result; otherwise, -1 is the result */
-  if (((pg->table)[lo]).t <= t) {
-    result = lo;
-  } else {
-    result = -1;
+  if (pg->pMat != NULL) {
+    pg = pg->pMat;
   }
   
-  return result;
+  return pg;
 }
 
 /*
@@ -1299,11 +3073,99 @@ void graph_add_derived(
   m_buf.t_src = t_src;
 }
 
+/*
+ * graph_add_points function.
+ */
+void graph_add_points(
+    POINTER       * pp,
+    const int32_t * pPoint,
+    int32_t         count,
+    long            lnum) {
+  
+  int32_t i = 0;
+  int32_t t = 0;
+  int32_t v = 0;
+  int32_t prev_t = 0;
+  int32_t prev_v = 0;
+  int64_t t64 = 0;
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (!m_load) {
+    raiseErr(__LINE__,
+      "Graph accumulator not loaded on script line %ld",
+      srcLine(lnum));
+  }
+  
+  if ((pp == NULL) || (count < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((count > 0) && (pPoint == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (pointer_isHeader(pp)) {
+    raiseErr(__LINE__,
+      "Can't use header pointers in a graph on script line %ld",
+      srcLine(lnum));
+  }
+  
+  t = pointer_compute(pp, lnum);
+  
+  for(i = 0; i < count; i++) {
+    /* Get the moment offset and value of the point, with three moment
+     * offsets to each subquantum */
+    t64 = ((int64_t) t) + (((int64_t) pPoint[2 * i]) * 3);
+    if ((t64 < INT32_MIN) || (t64 > INT32_MAX)) {
+      raiseErr(__LINE__,
+        "Overflow while computing graph point on script line %ld",
+        srcLine(lnum));
+    }
+    v = pPoint[(2 * i) + 1];
+    if (v < 0) {
+      raiseErr(__LINE__,
+        "Graph values must be zero or greater on script line %ld",
+        srcLine(lnum));
+    }
+    
+    if (i < 1) {
+      /* First point, so resolve whatever region was buffered before */
+      resolve((int32_t) t64, 1);
+      
+    } else {
+      /* Later points follow constant regions, so they can be appended
+       * straight to the accumulator without buffering */
+      if (t64 <= prev_t) {
+        raiseErr(__LINE__,
+          "Graph regions must be chronological on script line %ld",
+          srcLine(lnum));
+      }
+      accAppend(prev_t, prev_v, lnum);
+    }
+    
+    prev_t = (int32_t) t64;
+    prev_v = v;
+  }
+  
+  /* Buffer the last point as a constant region, so that a ramp or
+   * derived region may follow it */
+  if (count > 0) {
+    m_buf_lnum = lnum;
+    m_buf.state = STATE_CONST;
+    m_buf.t = prev_t;
+    m_buf.a = prev_v;
+  }
+}
+
 /*
  * graph_end function.
  */
 GRAPH *graph_end(long lnum) {
   
+  GRAPH *pResult = NULL;
+  int use_view = 0;
+  
   if (m_shutdown) {
     raiseErr(__LINE__, "Graph module is shut down");
   }
@@ -1313,27 +3175,37 @@ GRAPH *graph_end(long lnum) {
       srcLine(lnum));
   }
   
-  resolve(0, 0);
-  return accTake(lnum);
+  /* A graph that consists only of a derived region becomes a derived
+   * view of its source, unless the source is constant or views would
+   * be stacked too deep */
+  if ((m_buf.state == STATE_DERIVE) && (m_acc_len < 1)) {
+    if ((m_buf.pg)->pMat != NULL) {
+      m_buf.pg = (m_buf.pg)->pMat;
+    }
+    if ((((m_buf.pg)->pSrc != NULL) || ((m_buf.pg)->len > 1) ||
+          ((m_buf.pg)->ramps > 0)) &&
+        ((m_buf.pg)->depth < VIEW_DEPTH_MAX)) {
+      use_view = 1;
+    }
+  }
+  
+  if (use_view) {
+    pResult = viewNew();
+  } else {
+    resolve(0, 0);
+    pResult = accTake(lnum);
+  }
+  
+  return pResult;
 }
 
 /*
  * graph_shutdown function.
  */
 void graph_shutdown(void) {
-  GRAPH *pCur = NULL;
-  GRAPH *pNext = NULL;
-  
   if (!m_shutdown) {
     m_shutdown = 1;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
-    }
-    m_pFirst = NULL;
-    m_pLast = NULL;
+    arena_free(&m_arena);
     
     if (m_cache_cap > 0) {
       free(m_cache);
@@ -1342,6 +3214,13 @@ void graph_shutdown(void) {
       m_cache_len = 0;
     }
     
+    if (m_hcons != NULL) {
+      free(m_hcons);
+      m_hcons = NULL;
+      m_hcons_cap = 0;
+      m_hcons_len = 0;
+    }
+    
     m_load = 0;
     if (m_acc_cap > 0) {
       free(m_acc);
@@ -1349,30 +3228,161 @@ void graph_shutdown(void) {
       m_acc_cap = 0;
       m_acc_len = 0;
       m_acc_t = 0;
+      m_acc_v = 0;
+    }
+    if (m_ramp_cap > 0) {
+      free(m_ramp);
+      m_ramp = NULL;
+      m_ramp_cap = 0;
+      m_ramp_len = 0;
     }
   }
 }
 
+/*
+ * graph_restart function.
+ */
+void graph_restart(void) {
+  graph_shutdown();
+  m_shutdown = 0;
+  m_count = 0;
+  
+  memset(&m_buf, 0, sizeof(REGION));
+  m_buf_lnum = 0;
+}
+
+/*
+ * graph_count function.
+ */
+int32_t graph_count(void) {
+  return m_count;
+}
+
 /*
  * graph_query function.
  */
 int32_t graph_query(GRAPH *pg, int32_t t) {
   
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (pg == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  return viewEval(pg, t, NULL);
+}
+
+/*
+ * graph_query_batch function.
+ */
+void graph_query_batch(
+    GRAPH *pg, const int32_t *pT, int32_t *pOut, int32_t n) {
+  
   int32_t i = 0;
+  int32_t j = 0;
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Graph module is shut down");
   }
-  if (pg == NULL) {
+  if ((pg == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((n > 0) && ((pT == NULL) || (pOut == NULL))) {
     raiseErr(__LINE__, NULL);
   }
   
-  i = graphSeek(pg, t);
-  if (i < 0) {
-    i = 0;
+  /* Graphs with tables are searched directly, while derived views and
+   * graphs with ramp segments that are not materialized are evaluated
+   * one offset at a time */
+  if (pg->pMat != NULL) {
+    pg = pg->pMat;
+  }
+  
+  if ((n > 0) && ((pg->pSrc != NULL) || (pg->ramps > 0))) {
+    for(i = 0; i < n; i++) {
+      pOut[i] = viewEval(pg, pT[i], NULL);
+    }
+    
+  } else if (n > 0) {
+    if (pg->len <= BATCH_SCAN_MAX) {
+      batchScan(pg, pT, pOut, n);
+    } else if (pg->pEytz != NULL) {
+      for(i = 0; i < n; i++) {
+        j = eytzSeek(pg, pT[i]);
+        if (j < 0) {
+          j = 0;
+        }
+        pOut[i] = ((pg->table)[j]).v;
+      }
+    } else {
+      batchSearch(pg, pT, pOut, n);
+    }
+  }
+}
+
+/*
+ * graph_cursor_init function.
+ */
+void graph_cursor_init(GRAPH_CURSOR *pc, GRAPH *pg) {
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if ((pc == NULL) || (pg == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  memset(pc, 0, sizeof(GRAPH_CURSOR));
+  pc->pg = pg;
+  pc->pBody = viewBody(pg);
+  pc->i = 0;
+}
+
+/*
+ * graph_cursor_advance function.
+ */
+void graph_cursor_advance(GRAPH_CURSOR *pc, int32_t t) {
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (pc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pc->pg == NULL) {
+    raiseErr(__LINE__, "Graph cursor not initialized");
+  }
+  
+  (void) graph_cursor_query(pc, t);
+}
+
+/*
+ * graph_cursor_query function.
+ */
+int32_t graph_cursor_query(GRAPH_CURSOR *pc, int32_t t) {
+  
+  GRAPH *pb = NULL;
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Graph module is shut down");
+  }
+  if (pc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pc->pg == NULL) {
+    raiseErr(__LINE__, "Graph cursor not initialized");
+  }
+  
+  /* Rebind the cursor index if the graph that is searched changed
+   * because a derived view was materialized */
+  pb = viewBody(pc->pg);
+  if (pc->pBody != pb) {
+    pc->pBody = pb;
+    pc->i = 0;
   }
   
-  return ((pg->table)[i]).v;
+  return viewEval(pc->pg, t, pc);
 }
 
 /*
@@ -1389,15 +3399,79 @@ void graph_track(
     int              has_v_start) {
   
   int32_t i = 0;
-  int proceed = 0;
+  GRAPH_SPAN span;
+  
+  /* Initialize structures */
+  memset(&span, 0, sizeof(GRAPH_SPAN));
+  
+  /* Check parameters */
+  if (fp == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get the span of changes */
+  graph_span(pg, &span, t_start, t_end, v_start, has_end, has_v_start);
+  
+  /* Report each change in the span to the callback, with the first
+   * change at the clipped starting time */
+  for(i = 0; i < span.count; i++) {
+    if (i > 0) {
+      fp(pCustom, ((span.pNode)[i]).t, ((span.pNode)[i]).v);
+    } else {
+      fp(pCustom, span.t_first, ((span.pNode)[i]).v);
+    }
+  }
+}
+
+/*
+ * graph_span function.
+ */
+void graph_span(
+    GRAPH      * pg,
+    GRAPH_SPAN * ps,
+    int32_t      t_start,
+    int32_t      t_end,
+    int32_t      v_start,
+    int          has_end,
+    int          has_v_start) {
+  
+  GRAPH_CURSOR cur;
+  
+  /* Initialize structures */
+  memset(&cur, 0, sizeof(GRAPH_CURSOR));
+  
+  /* Determine span through a temporary cursor */
+  graph_cursor_init(&cur, pg);
+  graph_cursor_span(
+    &cur, ps, t_start, t_end, v_start, has_end, has_v_start);
+}
+
+/*
+ * graph_cursor_span function.
+ */
+void graph_cursor_span(
+    GRAPH_CURSOR * pc,
+    GRAPH_SPAN   * ps,
+    int32_t        t_start,
+    int32_t        t_end,
+    int32_t        v_start,
+    int            has_end,
+    int            has_v_start) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  GRAPH *pg = NULL;
   
   /* Check state and parameters */
   if (m_shutdown) {
     raiseErr(__LINE__, "Graph module is shut down");
   }
-  if ((pg == NULL) || (fp == NULL)) {
+  if ((pc == NULL) || (ps == NULL)) {
     raiseErr(__LINE__, NULL);
   }
+  if (pc->pg == NULL) {
+    raiseErr(__LINE__, "Graph cursor not initialized");
+  }
   if (has_end) {
     if (t_end < t_start) {
       raiseErr(__LINE__, NULL);
@@ -1409,40 +3483,126 @@ void graph_track(
     }
   }
   
-  /* Figure out node index that covers starting time, or use first node
-   * if no node covers starting time */
-  i = graphSeek(pg, t_start);
-  if (i < 0) {
-    i = 0;
+  /* Get the graph with the nodes, materializing a derived view if
+   * necessary, and reset span */
+  pg = graphNodes(pc->pg);
+  if (pc->pBody != pg) {
+    pc->pBody = pg;
+    pc->i = 0;
   }
+  memset(ps, 0, sizeof(GRAPH_SPAN));
   
-  /* If has_v_start was specified and the starting node has the same
-   * value as v_start, then we won't send the initial node; else, we
-   * will */
-  proceed = 1;
+  /* Move the cursor to the node that covers the starting time, or the
+   * first node if no node covers the starting time */
+  pc->i = graphGallop(pg, pc->i, t_start);
+  i = pc->i;
+  
+  /* Figure out the index of the last node that starts within the time
+   * range by galloping on from the starting node, which is never after
+   * the result since the end of the range is not before its start */
+  j = pg->len - 1;
+  if (has_end) {
+    j = graphGallop(pg, i, t_end);
+  }
+  
+  /* The first node reports its change at time value t_start (which
+   * might actually be before the start of the node) -- but if
+   * has_v_start was specified and the starting node has the same value
+   * as v_start, then the starting node is left out of the span and the
+   * next node reports its change at its own time */
+  ps->t_first = t_start;
   if (has_v_start) {
     if (((pg->table)[i]).v == v_start) {
-      proceed = 0;
+      i++;
+      if (i < pg->len) {
+        ps->t_first = ((pg->table)[i]).t;
+      }
     }
   }
   
-  /* Unless suppressed in previous step, send the first node to the
-   * callback with time value t_start (which might actually be before
-   * the start of the node) and graph value from the node */
-  if (proceed) {
-    fp(pCustom, t_start, ((pg->table)[i]).v);
+  /* Fill in the slice */
+  if (i <= j) {
+    ps->pNode = &((pg->table)[i]);
+    ps->count = j - i + 1;
+  } else {
+    ps->pNode = NULL;
+    ps->count = 0;
   }
+}
+
+/*
+ * graph_span_limit function.
+ */
+int32_t graph_span_limit(
+    const GRAPH_SPAN * ps,
+    int32_t            j,
+    int32_t            interval,
+    int32_t            delta,
+    int32_t            t_prev,
+    int32_t            v_prev) {
   
-  /* Iterate through the rest of the graph nodes and report any within
-   * the time range to the callback */
-  for(i++; i < pg->len; i++) {
-    if (has_end) {
-      if (((pg->table)[i]).t > t_end) {
-        break;
-      }
+  int32_t result = 0;
+  int64_t t = 0;
+  int64_t t_before = 0;
+  int64_t t_next = 0;
+  int64_t dv = 0;
+  
+  /* Check parameters */
+  if ((ps == NULL) || (j < 0) || (interval < 0) || (delta < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Look for the next change to report */
+  for(result = j; result < ps->count; result++) {
+    /* Without any limit, every change is reported */
+    if ((interval < 1) && (delta < 1)) {
+      break;
+    }
+    
+    /* Get the time and difference in value of this change */
+    if (result > 0) {
+      t = (int64_t) ((ps->pNode)[result]).t;
+    } else {
+      t = (int64_t) ps->t_first;
+    }
+    
+    dv = ((int64_t) ((ps->pNode)[result]).v) - ((int64_t) v_prev);
+    if (dv < 0) {
+      dv = 0 - dv;
+    }
+    
+    /* Never repeat the value that was last reported */
+    if (dv == 0) {
+      continue;
+    }
+    
+    /* The last change is always reported */
+    if (result >= ps->count - 1) {
+      break;
+    }
+    
+    /* Report changes that satisfy both limits */
+    if ((t - ((int64_t) t_prev) >= (int64_t) interval) &&
+        (dv >= (int64_t) delta)) {
+      break;
+    }
+    
+    /* Report a value that the graph holds on to */
+    t_next = (int64_t) ((ps->pNode)[result + 1]).t;
+    if (result > 1) {
+      t_before = t - ((int64_t) ((ps->pNode)[result - 1]).t);
+    } else if (result > 0) {
+      t_before = t - ((int64_t) ps->t_first);
+    } else {
+      t_before = 0;
+    }
+    
+    if ((t_next - t > (int64_t) interval) && (t_next - t > t_before)) {
+      break;
     }
-    fp(pCustom, ((pg->table)[i]).t, ((pg->table)[i]).v);
   }
+  
+  return result;
 }
 
 /*
@@ -1460,6 +3620,7 @@ void graph_print(GRAPH *pg, FILE *pOut) {
     raiseErr(__LINE__, NULL);
   }
   
+  pg = graphNodes(pg);
   for(i = 0; i < pg->len; i++) {
     
     if (is_filled) {
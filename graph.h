@@ -14,6 +14,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - pointer.c
  */
@@ -37,6 +38,89 @@
 struct GRAPH_TAG;
 typedef struct GRAPH_TAG GRAPH;
 
+/*
+ * Graph node structure.
+ * 
+ * This associates a moment offset t with a graph value at that moment
+ * v.  The graph value must be zero or greater.
+ */
+typedef struct {
+  int32_t t;
+  int32_t v;
+} GRAPH_NODE;
+
+/*
+ * Graph span structure.
+ * 
+ * Describes the slice of a graph table that holds all the changes in
+ * graph value within a tracked time range.  See graph_span() for
+ * further information.
+ */
+typedef struct {
+  
+  /*
+   * Pointer to the first node of the slice within the graph table, or
+   * NULL if count is zero.
+   * 
+   * The slice is owned by the graph object and remains valid until the
+   * graph module is shut down.
+   */
+  const GRAPH_NODE *pNode;
+  
+  /*
+   * The number of nodes in the slice, which may be zero.
+   */
+  int32_t count;
+  
+  /*
+   * The moment offset of the change reported by the first node in the
+   * slice.
+   * 
+   * This is clipped to the start of the tracked time range, so it may
+   * differ from the moment offset stored in the first node.  All other
+   * nodes in the slice report a change at their own moment offset.
+   */
+  int32_t t_first;
+  
+} GRAPH_SPAN;
+
+/*
+ * Graph cursor structure.
+ * 
+ * A cursor remembers the graph node that covered the most recent query
+ * made through it, so that a sequence of queries at nearby moment
+ * offsets does not need to search the whole graph table each time.
+ * The cursor gallops from its current node to the node covering each
+ * new query, so a query costs time logarithmic in the distance moved
+ * rather than in the size of the graph.  Queries may move the cursor in
+ * either direction, but they are fastest when moment offsets are
+ * ascending.
+ * 
+ * Cursors must be initialized with graph_cursor_init() before use.
+ * The fields should not be accessed directly.
+ */
+typedef struct {
+  
+  /*
+   * The graph the cursor is bound to.
+   */
+  GRAPH *pg;
+  
+  /*
+   * The graph whose graph table contains the current node.
+   * 
+   * This is the bound graph, except for derived graphs that are
+   * evaluated on demand from their source graph.
+   */
+  GRAPH *pBody;
+  
+  /*
+   * The index in the graph table of the current node.
+   */
+  int32_t i;
+  
+} GRAPH_CURSOR;
+
 /*
  * Function pointer types
  * ======================
@@ -160,6 +244,12 @@ void graph_add_constant(POINTER *pp, int32_t v, long lnum);
  * the start of a following region to determine the duration of the
  * ramp.
  * 
+ * The steps of the ramp are stored as a single ramp segment rather than
+ * a graph node for each step, and their values are computed when the
+ * graph is queried.  The steps are only expanded into graph nodes the
+ * first time the graph is tracked or spanned, so long ramps do not
+ * count against the limit on the number of nodes in a graph.
+ * 
  * The given lnum should be from the Shastina parser, and it is used for
  * error reports if necessary.
  * 
@@ -214,6 +304,14 @@ void graph_add_ramp(
  * and max_val must be greater than or equal to min_val.  If max_val has
  * the special value -1, there is no maximum value limit.
  * 
+ * If the derived region is the only region in the graph, the graph is
+ * constructed as a view that refers to the source graph instead of
+ * copying its nodes.  Queries and cursors evaluate such views on demand
+ * through the source, and the nodes are only copied the first time
+ * they are needed, such as for graph spans.  Views stacked on views
+ * are copied right away once they are more than eight deep.  This
+ * does not change the values of the graph.
+ * 
  * The given lnum should be from the Shastina parser, and it is used for
  * error reports if necessary.
  * 
@@ -249,11 +347,55 @@ void graph_add_derived(
     int32_t   max_val,
     long      lnum);
 
+/*
+ * Add a sequence of constant regions to the open graph definition.
+ * 
+ * There must be a graph definition in progress or an error occurs.
+ * 
+ * pPoint is an array of count pairs of integers.  The first integer of
+ * each pair is a time offset in subquanta, which is added to the
+ * moment offset that the provided pointer computes to in order to get
+ * the start of a region.  (Header pointers may not be used.)  The
+ * second integer of each pair is the constant value of the region,
+ * which must be zero or greater.
+ * 
+ * The result is the same as calling graph_add_constant() once for each
+ * pair with the pointer tilted by the time offset, so the same
+ * chronological requirements apply, but the regions are appended
+ * directly to the accumulator without going through a pointer for
+ * each of them.  If count is zero, the call has no effect.
+ * 
+ * The given lnum should be from the Shastina parser, and it is used for
+ * error reports if necessary.
+ * 
+ * Parameters:
+ * 
+ *   pp - pointer that the time offsets are relative to
+ * 
+ *   pPoint - the array of time offset and value pairs, or NULL if
+ *   count is zero
+ * 
+ *   count - the number of pairs in the array
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+void graph_add_points(
+    POINTER       * pp,
+    const int32_t * pPoint,
+    int32_t         count,
+    long            lnum);
+
 /*
  * End the definition of a new graph object.
  * 
  * There must be a graph definition in progress or an error occurs.
  * 
+ * Graph objects are interned.  If an identical graph already exists,
+ * that graph object is returned instead of a new one, so graphs with
+ * the same nodes can be compared by pointer.  Derived graphs that are
+ * evaluated as views of their source are only shared with other views
+ * of the same source with the same parameters.
+ * 
  * The given lnum should be from the Shastina parser, and it is used for
  * error reports if necessary.
  * 
@@ -274,6 +416,25 @@ GRAPH *graph_end(long lnum);
  */
 void graph_shutdown(void);
 
+/*
+ * Restart the graph system, releasing all graphs that have been
+ * allocated in the same way as graph_shutdown(), but leaving the graph
+ * system ready to be used again.  This also works after a shutdown.
+ */
+void graph_restart(void);
+
+/*
+ * Return the number of graphs that have been allocated since the
+ * module was started or restarted.
+ * 
+ * This is intended for profiling.
+ * 
+ * Return:
+ * 
+ *   the number of graphs allocated
+ */
+int32_t graph_count(void);
+
 /*
  * Determine the value of a given graph at the given moment offset.
  * 
@@ -289,6 +450,78 @@ void graph_shutdown(void);
  */
 int32_t graph_query(GRAPH *pg, int32_t t);
 
+/*
+ * Query the value of a graph at many moment offsets at once.
+ * 
+ * The value stored in pOut at each index is the same as graph_query()
+ * would return for the moment offset at the same index in pT.  The
+ * offsets may be in any order.  This is faster than calling
+ * graph_query() for each offset, because the searches are branchless
+ * and interleaved with each other.  For offsets in ascending order
+ * that are close together, a graph cursor may be faster still.
+ * 
+ * pT and pOut may be NULL only if n is zero.  pT and pOut may be the
+ * same array, in which case the offsets are overwritten by the values.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   pT - the moment offsets to query
+ * 
+ *   pOut - the array that receives the graph values
+ * 
+ *   n - the number of offsets, which must be zero or greater
+ */
+void graph_query_batch(
+    GRAPH *pg, const int32_t *pT, int32_t *pOut, int32_t n);
+
+/*
+ * Initialize a graph cursor so that it is bound to the given graph.
+ * 
+ * The cursor starts out at the first node of the graph.  Cursors do not
+ * need to be released, but they may not be used after the graph module
+ * is shut down.
+ * 
+ * Parameters:
+ * 
+ *   pc - the cursor to initialize
+ * 
+ *   pg - the graph to bind the cursor to
+ */
+void graph_cursor_init(GRAPH_CURSOR *pc, GRAPH *pg);
+
+/*
+ * Move a graph cursor to the graph node that determines the value at a
+ * given moment offset.
+ * 
+ * Parameters:
+ * 
+ *   pc - the cursor
+ * 
+ *   t - the moment offset
+ */
+void graph_cursor_advance(GRAPH_CURSOR *pc, int32_t t);
+
+/*
+ * Query the value of a graph at a given moment offset through a graph
+ * cursor.
+ * 
+ * The result is the same as graph_query() on the graph the cursor is
+ * bound to.  The cursor is moved as if by graph_cursor_advance().
+ * 
+ * Parameters:
+ * 
+ *   pc - the cursor
+ * 
+ *   t - the moment offset
+ * 
+ * Return:
+ * 
+ *   the value of the graph, which is always zero or greater
+ */
+int32_t graph_cursor_query(GRAPH_CURSOR *pc, int32_t t);
+
 /*
  * Use the tracking algorithm to report all changes in graph value to a
  * given callback function.
@@ -310,6 +543,10 @@ int32_t graph_query(GRAPH *pg, int32_t t);
  * Changes in graph value will be reported to the given callback
  * function in chronological order.
  * 
+ * This is a wrapper around graph_span() that invokes the callback for
+ * each change in the span.  Callers that handle many changes should use
+ * graph_span() directly.
+ * 
  * Parameters:
  * 
  *   pg - the graph
@@ -338,6 +575,130 @@ void graph_track(
     int              has_end,
     int              has_v_start);
 
+/*
+ * Use the tracking algorithm to determine the slice of the graph table
+ * that holds all changes in graph value within a time range.
+ * 
+ * The t_start, t_end, v_start, has_end, and has_v_start parameters
+ * have the same meaning as for graph_track().
+ * 
+ * The span is written to the given structure.  The changes in graph
+ * value are the nodes of the slice in chronological order, except that
+ * the first node reports its change at the t_first moment offset of the
+ * span instead of its own moment offset.  The changes are exactly the
+ * ones that graph_track() would report.
+ * 
+ * Locating the span takes logarithmic time in the size of the graph
+ * table, regardless of the number of nodes in the span.  The first span
+ * of a derived view or a graph with ramps also copies or expands its
+ * nodes into a graph table, which is kept until shutdown.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   ps - the span structure to fill
+ * 
+ *   t_start - the starting offset for tracking
+ * 
+ *   t_end - the ending offset for tracking, if has_end is non-zero
+ * 
+ *   v_start - the starting value, if has_v_start is non-zero
+ * 
+ *   has_end - non-zero if t_end is provided
+ * 
+ *   has_v_start - non-zero if v_start is provided
+ */
+void graph_span(
+    GRAPH      * pg,
+    GRAPH_SPAN * ps,
+    int32_t      t_start,
+    int32_t      t_end,
+    int32_t      v_start,
+    int          has_end,
+    int          has_v_start);
+
+/*
+ * Determine a graph span through a graph cursor.
+ * 
+ * The result is the same as graph_span() on the graph the cursor is
+ * bound to.  The cursor is moved as if by graph_cursor_advance() to
+ * t_start, so that a following query at a moment offset shortly after
+ * t_start is fast.
+ * 
+ * Parameters:
+ * 
+ *   pc - the cursor
+ * 
+ *   ps - the span structure to fill
+ * 
+ *   t_start - the starting offset for tracking
+ * 
+ *   t_end - the ending offset for tracking, if has_end is non-zero
+ * 
+ *   v_start - the starting value, if has_v_start is non-zero
+ * 
+ *   has_end - non-zero if t_end is provided
+ * 
+ *   has_v_start - non-zero if v_start is provided
+ */
+void graph_cursor_span(
+    GRAPH_CURSOR * pc,
+    GRAPH_SPAN   * ps,
+    int32_t        t_start,
+    int32_t        t_end,
+    int32_t        v_start,
+    int            has_end,
+    int            has_v_start);
+
+/*
+ * Find the next change in a graph span to report when the rate of
+ * reported changes is limited.
+ * 
+ * The changes of the span are the same as described for graph_span().
+ * t_prev and v_prev are the moment offset and value of the change that
+ * was last reported.  The result is the index of the first node at or
+ * after node j that should be reported next, or the count of the span
+ * if no further change should be reported.  The first change of a span
+ * is always reported, so this is used for the changes after it.
+ * 
+ * A change is skipped if it repeats v_prev.  Otherwise, it is reported
+ * if it is at least interval moment offsets after t_prev and its value
+ * differs from v_prev by at least delta.  Changes that fail this test
+ * are still reported if they are the last change in the span, or if
+ * the graph then holds the value for longer than interval and longer
+ * than the time since the preceding change, so that the final value of
+ * each ramp is always reached.
+ * 
+ * If interval and delta are both zero, then no limit applies and every
+ * change is reported.
+ * 
+ * Parameters:
+ * 
+ *   ps - the span
+ * 
+ *   j - the index of the first node to consider
+ * 
+ *   interval - the minimum moment offset interval, zero or greater
+ * 
+ *   delta - the minimum change in value, zero or greater
+ * 
+ *   t_prev - the moment offset of the last reported change
+ * 
+ *   v_prev - the value of the last reported change
+ * 
+ * Return:
+ * 
+ *   the index of the next node to report, or the count of the span
+ */
+int32_t graph_span_limit(
+    const GRAPH_SPAN * ps,
+    int32_t            j,
+    int32_t            interval,
+    int32_t            delta,
+    int32_t            t_prev,
+    int32_t            v_prev);
+
 /*
  * Print a textual representation of a graph to the given output file.
  * 
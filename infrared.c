@@ -0,0 +1,352 @@
+/*
+ * infrared.c
+ * ==========
+ * 
+ * Implementation of infrared.h
+ * 
+ * See the header for further information.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "infrared.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "art.h"
+#include "blob.h"
+#include "control.h"
+#include "core.h"
+#include "diagnostic.h"
+#include "graph.h"
+#include "main.h"
+#include "midi.h"
+#include "pointer.h"
+#include "render.h"
+#include "ruler.h"
+#include "set.h"
+#include "text.h"
+
+#include "nmf.h"
+#include "shastina.h"
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * INFRARED structure, holding the options of a rendering context.
+ * 
+ * The prototype is given in the header.
+ */
+struct INFRARED_TAG {
+  int format;
+  int prune;
+  int32_t threads;
+  int32_t window;
+  int32_t ppq;
+};
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The lock that serializes renders, since all the modules share their
+ * state across the process.
+ */
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static void restartAll(void);
+static int renderLocked(
+          INFRARED *   pc,
+    const void     *   pNMF,
+          size_t       nmf_len,
+    const char     *   pScript,
+          size_t       script_len,
+          uint8_t  * * ppMidi,
+          size_t   *   pMidiLen);
+
+/*
+ * Restart all the modules, releasing everything left by a previous
+ * render and leaving them ready for a new render.
+ */
+static void restartAll(void) {
+  main_restart();
+  core_restart();
+  control_restart();
+  render_restart();
+  midi_restart();
+  pointer_restart();
+  art_restart();
+  blob_restart();
+  graph_restart();
+  ruler_restart();
+  set_restart();
+  text_restart();
+}
+
+/*
+ * Render an NMF file to a MIDI file while holding the render lock.
+ * 
+ * This is the implementation of infrared_render() after the parameters
+ * have been checked and the lock acquired.  Errors from the modules are
+ * trapped on the calling thread and turned into the error code of the
+ * stage that was running, and all the modules are restarted afterwards
+ * to release their memory.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context holding the options
+ * 
+ *   pNMF - the NMF data
+ * 
+ *   nmf_len - the length of the NMF data in bytes
+ * 
+ *   pScript - the Infrared script
+ * 
+ *   script_len - the length of the script in bytes
+ * 
+ *   ppMidi - receives the MIDI file buffer on success
+ * 
+ *   pMidiLen - receives the length of the MIDI file on success
+ * 
+ * Return:
+ * 
+ *   INFRARED_OK or one of the other error codes
+ */
+static int renderLocked(
+          INFRARED *   pc,
+    const void     *   pNMF,
+          size_t       nmf_len,
+    const char     *   pScript,
+          size_t       script_len,
+          uint8_t  * * ppMidi,
+          size_t   *   pMidiLen) {
+  
+  jmp_buf trap;
+  volatile int status = INFRARED_OK;
+  NMF_DATA * volatile pd = NULL;
+  FILE * volatile fh = NULL;
+  SNSOURCE * volatile pSrc = NULL;
+  
+  memset(&trap, 0, sizeof(jmp_buf));
+  
+  main_register();
+  restartAll();
+  
+  /* Trap errors on this thread while rendering, with status always
+   * holding the error code of the current stage */
+  diagnostic_trap(&trap);
+  if (setjmp(trap) == 0) {
+    
+    /* Apply the options */
+    status = INFRARED_ERR_PARAM;
+    midi_format(pc->format);
+    midi_prune(pc->prune);
+    render_threads(pc->threads);
+    control_threads(pc->threads);
+    midi_threads(pc->threads);
+    render_window(pc->window);
+    midi_division(pc->ppq);
+    
+    /* Parse the NMF straight from the caller's buffer */
+    status = INFRARED_ERR_NMF;
+    fh = fmemopen((void *) pNMF, nmf_len, "rb");
+    if (fh == NULL) {
+      diagnostic_fail();
+    }
+    pd = nmf_parse(fh);
+    fclose(fh);
+    fh = NULL;
+    if (pd == NULL) {
+      diagnostic_fail();
+    }
+    pointer_init(pd);
+    
+    /* Run the script straight from the caller's buffer */
+    status = INFRARED_ERR_SCRIPT;
+    fh = fmemopen((void *) pScript, script_len, "rb");
+    if (fh == NULL) {
+      diagnostic_fail();
+    }
+    pSrc = snsource_stream(fh, SNSTREAM_OWNER | SNSTREAM_RANDOM);
+    fh = NULL;
+    main_script(pSrc);
+    snsource_free(pSrc);
+    pSrc = NULL;
+    
+    /* Render and compile the MIDI file into the caller's buffer */
+    status = INFRARED_ERR_RENDER;
+    render_nmf(pd);
+    control_track();
+    midi_compile_mem(ppMidi, pMidiLen);
+    
+    status = INFRARED_OK;
+  }
+  diagnostic_trap(NULL);
+  
+  /* Release everything except the MIDI file */
+  if (pSrc != NULL) {
+    snsource_free(pSrc);
+    pSrc = NULL;
+  }
+  if (fh != NULL) {
+    fclose(fh);
+    fh = NULL;
+  }
+  
+  restartAll();
+  
+  if (pd != NULL) {
+    nmf_free(pd);
+    pd = NULL;
+  }
+  
+  return status;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * infrared_new function.
+ */
+INFRARED *infrared_new(void) {
+  
+  INFRARED *pc = NULL;
+  
+  pc = (INFRARED *) calloc(1, sizeof(INFRARED));
+  if (pc != NULL) {
+    pc->format = 0;
+    pc->prune = 0;
+    pc->threads = 1;
+    pc->window = 0;
+    pc->ppq = MIDI_PPQ_MAX;
+  }
+  
+  return pc;
+}
+
+/*
+ * infrared_free function.
+ */
+void infrared_free(INFRARED *pc) {
+  if (pc != NULL) {
+    free(pc);
+  }
+}
+
+/*
+ * infrared_option function.
+ */
+int infrared_option(INFRARED *pc, int opt, int32_t val) {
+  
+  int status = INFRARED_OK;
+  
+  if (pc == NULL) {
+    status = INFRARED_ERR_PARAM;
+    
+  } else if (opt == INFRARED_OPT_FORMAT) {
+    if ((val == 0) || (val == 1)) {
+      pc->format = (int) val;
+    } else {
+      status = INFRARED_ERR_PARAM;
+    }
+    
+  } else if (opt == INFRARED_OPT_PRUNE) {
+    if ((val == 0) || (val == 1)) {
+      pc->prune = (int) val;
+    } else {
+      status = INFRARED_ERR_PARAM;
+    }
+    
+  } else if (opt == INFRARED_OPT_THREADS) {
+    if ((val >= 1) && (val <= RENDER_THREAD_MAX)) {
+      pc->threads = val;
+    } else {
+      status = INFRARED_ERR_PARAM;
+    }
+    
+  } else if (opt == INFRARED_OPT_WINDOW) {
+    if (val >= 0) {
+      pc->window = val;
+    } else {
+      status = INFRARED_ERR_PARAM;
+    }
+    
+  } else if (opt == INFRARED_OPT_PPQ) {
+    if ((val >= MIDI_PPQ_MIN) && (val <= MIDI_PPQ_MAX)) {
+      pc->ppq = val;
+    } else {
+      status = INFRARED_ERR_PARAM;
+    }
+    
+  } else {
+    status = INFRARED_ERR_PARAM;
+  }
+  
+  return status;
+}
+
+/*
+ * infrared_render function.
+ */
+int infrared_render(
+          INFRARED *   pc,
+    const void     *   pNMF,
+          size_t       nmf_len,
+    const char     *   pScript,
+          size_t       script_len,
+          uint8_t  * * ppMidi,
+          size_t   *   pMidiLen) {
+  
+  int status = INFRARED_OK;
+  
+  /* Check parameters */
+  if ((ppMidi == NULL) || (pMidiLen == NULL)) {
+    status = INFRARED_ERR_PARAM;
+  } else {
+    *ppMidi = NULL;
+    *pMidiLen = 0;
+    if ((pc == NULL) || (pNMF == NULL) || (pScript == NULL) ||
+        (nmf_len < 1) || (script_len < 1)) {
+      status = INFRARED_ERR_PARAM;
+    }
+  }
+  
+  /* Render while holding the lock */
+  if (status == INFRARED_OK) {
+    if (pthread_mutex_lock(&m_lock)) {
+      status = INFRARED_ERR_PARAM;
+    } else {
+      status = renderLocked(
+                pc, pNMF, nmf_len, pScript, script_len, ppMidi, pMidiLen);
+      pthread_mutex_unlock(&m_lock);
+    }
+  }
+  
+  /* Never leave a partial result on failure */
+  if ((status != INFRARED_OK) && (ppMidi != NULL) && (pMidiLen != NULL)) {
+    *ppMidi = NULL;
+    *pMidiLen = 0;
+  }
+  
+  return status;
+}
@@ -0,0 +1,195 @@
+#ifndef INFRARED_H_INCLUDED
+#define INFRARED_H_INCLUDED
+
+/*
+ * infrared.h
+ * ==========
+ * 
+ * Library API of Infrared, for rendering NMF to MIDI from within
+ * another program without starting an Infrared process.
+ * 
+ * The input NMF and the script are given as memory buffers, and the
+ * generated MIDI file is returned in a memory buffer owned by the
+ * caller, so no files are involved.  Errors are returned as error codes
+ * instead of stopping the process.  Warnings and script diagnostics are
+ * still written to standard error.
+ * 
+ * The library API may be used from any number of threads, but see the
+ * limitations below.
+ * 
+ * Limitations
+ * -----------
+ * 
+ * The modules of Infrared keep their state in process-wide variables
+ * rather than in the context, so renders can't actually run at the same
+ * time.  All renders in the process are serialized by a single lock,
+ * even when they use different contexts, and a context only holds the
+ * render options.  Concurrent renders in separate contexts are not yet
+ * supported, and would need the module state to be moved into the
+ * context.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * Requires all the framework modules and operation modules listed in
+ * main.c, with main.c compiled with INFRARED_LIBRARY defined so that
+ * the program entrypoint is left out.
+ * 
+ * Requires the POSIX threads library (may require -lpthread) and the
+ * POSIX fmemopen() function.
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libnmf
+ *   - librfdict
+ *   - libshastina
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * Error codes returned by the library functions.
+ * 
+ * INFRARED_ERR_PARAM is for invalid parameters or option values,
+ * INFRARED_ERR_NMF is for NMF input that failed to parse,
+ * INFRARED_ERR_SCRIPT is for errors while running the script, and
+ * INFRARED_ERR_RENDER is for errors while rendering and compiling the
+ * MIDI file.
+ */
+#define INFRARED_OK         (0)
+#define INFRARED_ERR_PARAM  (1)
+#define INFRARED_ERR_NMF    (2)
+#define INFRARED_ERR_SCRIPT (3)
+#define INFRARED_ERR_RENDER (4)
+
+/*
+ * The options that can be set with infrared_option().
+ * 
+ * These correspond to the -format, -prune, -threads, -window, and -ppq
+ * program options of the infrared program, and they have the same
+ * defaults.
+ */
+#define INFRARED_OPT_FORMAT  (1)
+#define INFRARED_OPT_PRUNE   (2)
+#define INFRARED_OPT_THREADS (3)
+#define INFRARED_OPT_WINDOW  (4)
+#define INFRARED_OPT_PPQ     (5)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * INFRARED structure prototype.
+ * 
+ * See the implementation file for definition.
+ */
+struct INFRARED_TAG;
+typedef struct INFRARED_TAG INFRARED;
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Allocate a new rendering context with all options at their defaults.
+ * 
+ * Return:
+ * 
+ *   the new context, or NULL if out of memory
+ */
+INFRARED *infrared_new(void);
+
+/*
+ * Release a rendering context.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context to release, or NULL
+ */
+void infrared_free(INFRARED *pc);
+
+/*
+ * Set an option of a rendering context.
+ * 
+ * opt is one of the INFRARED_OPT constants.  The format must be 0 or 1,
+ * the prune flag must be 0 or 1, the thread count must be in range 1
+ * to 64 inclusive, the window must be zero or greater, and the time
+ * division must be in range 1 to 768 inclusive.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context
+ * 
+ *   opt - the option to set
+ * 
+ *   val - the new value of the option
+ * 
+ * Return:
+ * 
+ *   INFRARED_OK, or INFRARED_ERR_PARAM if the option or value is not
+ *   valid
+ */
+int infrared_option(INFRARED *pc, int opt, int32_t val);
+
+/*
+ * Render an NMF file to a MIDI file using an Infrared script.
+ * 
+ * pNMF points to nmf_len bytes of NMF data, and pScript points to
+ * script_len bytes of Infrared script.  Neither buffer needs to be nul
+ * terminated, and neither is modified.
+ * 
+ * On success, *ppMidi receives a buffer holding the MIDI file and
+ * *pMidiLen receives its length in bytes.  The caller owns the buffer
+ * and must release it with free().  On failure, *ppMidi is set to NULL
+ * and *pMidiLen to zero.
+ * 
+ * Each render starts from a fresh state, so nothing is carried over
+ * from previous renders or from renders that failed.  When a render
+ * fails, all the memory that the modules were using for it is released
+ * before this function returns, including the script parser, the
+ * render worker jobs, and any partially loaded data files.
+ * 
+ * Renders hold the process-wide render lock, so a render blocks while
+ * any other thread is rendering, whatever context it uses.
+ * 
+ * Parameters:
+ * 
+ *   pc - the context holding the options
+ * 
+ *   pNMF - the NMF data
+ * 
+ *   nmf_len - the length of the NMF data in bytes
+ * 
+ *   pScript - the Infrared script
+ * 
+ *   script_len - the length of the script in bytes
+ * 
+ *   ppMidi - receives the MIDI file buffer
+ * 
+ *   pMidiLen - receives the length of the MIDI file
+ * 
+ * Return:
+ * 
+ *   INFRARED_OK or one of the other error codes
+ */
+int infrared_render(
+          INFRARED *   pc,
+    const void     *   pNMF,
+          size_t       nmf_len,
+    const char     *   pScript,
+          size_t       script_len,
+          uint8_t  * * ppMidi,
+          size_t   *   pMidiLen);
+
+#endif
@@ -0,0 +1,1119 @@
+/*
+ * ircode.c
+ * ========
+ * 
+ * Implementation of ircode.h
+ * 
+ * See the header for further information.
+ */
+
+#include "ircode.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blob.h"
+#include "core.h"
+#include "diagnostic.h"
+#include "optable.h"
+#include "pointer.h"
+#include "primitive.h"
+#include "profile.h"
+#include "text.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+static void sayWarn(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(0, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The instruction codes of compiled scripts.
+ * 
+ * See the CODE_REC structure for the meaning of the instruction fields.
+ */
+#define CODE_INT      (1)
+#define CODE_ADJUST   (2)
+#define CODE_BLOB     (3)
+#define CODE_TEXT     (4)
+#define CODE_DECLARE  (5)
+#define CODE_GET      (6)
+#define CODE_ASSIGN   (7)
+#define CODE_BEGIN    (8)
+#define CODE_END      (9)
+#define CODE_OP       (10)
+
+#define CODE_MIN      (1)
+#define CODE_MAX      (10)
+
+/*
+ * The initial and maximum capacities of the compiled instruction array
+ * and of the compiled string pool in bytes.
+ */
+#define CODE_INIT_CAP (1024)
+#define CODE_MAX_CAP  (INT32_C(1) << 24)
+
+#define POOL_INIT_CAP (4096)
+#define POOL_MAX_CAP  (INT32_C(1) << 28)
+
+/*
+ * The signature at the start of compiled script files.
+ */
+#define IRC_SIGNATURE "IRSC0001"
+#define IRC_SIGNATURE_LEN (8)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * Instruction of a compiled script.
+ * 
+ * code is one of the CODE constants.  lnum is the script line number of
+ * the entity that the instruction was compiled from, which is used for
+ * diagnostics when running the instruction.
+ * 
+ * For CODE_INT, val is the integer to push.  For CODE_ADJUST, arg is
+ * the numeric suffix character and val is the integer to adjust the
+ * pointer on top of the stack with.  For CODE_BLOB and CODE_TEXT, val
+ * is the offset in the string pool of the base-16 string or the text
+ * with escapes already removed.  For CODE_DECLARE, arg is non-zero for
+ * a constant and val is the offset of the name in the string pool.  For
+ * CODE_GET and CODE_ASSIGN, val is the memory bank slot.  For CODE_OP,
+ * val is the index in the operator table.  CODE_BEGIN and CODE_END have
+ * no arguments.
+ */
+typedef struct {
+  uint8_t code;
+  uint8_t arg;
+  int32_t lnum;
+  int32_t val;
+} CODE_REC;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The compiled script.
+ * 
+ * m_compile is set while ircode_run() should record each entity it
+ * interprets as an instruction.
+ * 
+ * m_code holds the instructions and m_pool holds the nul-terminated
+ * strings they refer to, each with a capacity and length following the
+ * usual pattern.
+ */
+static int m_compile = 0;
+static int32_t m_code_cap = 0;
+static int32_t m_code_len = 0;
+static CODE_REC *m_code = NULL;
+static int32_t m_pool_cap = 0;
+static int32_t m_pool_len = 0;
+static char *m_pool = NULL;
+
+/*
+ * The Shastina parser of the script that ircode_run() is running, or
+ * NULL.
+ * 
+ * This is kept here rather than only in ircode_run() so that
+ * ircode_restart() can release it if the script stopped with an error.
+ */
+static SNPARSER *m_parser = NULL;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static long srcLine(long lnum);
+static void shiftString(char *pStr);
+
+static void capCode(int32_t n);
+static void capPool(int32_t n);
+static void emitCode(int code, int arg, int32_t val, long lnum);
+static void emitString(int code, int arg, const char *pStr, long lnum);
+static void codePut(FILE *pOut, uint64_t val, int bytes);
+static int codeGet(FILE *pIn, uint64_t *pVal, int bytes);
+static void releaseCode(void);
+
+static void adjustPointer(int suf, int32_t iv, long lnum);
+static void runString(SNENTITY *pEnt, long lnum);
+static void runNumeric(SNENTITY *pEnt, long lnum);
+
+/*
+ * If the given line number is within valid range, return it as-is.  In
+ * all other cases, return -1.
+ * 
+ * Parameters:
+ * 
+ *   lnum - the candidate line number
+ * 
+ * Return:
+ * 
+ *   the line number as-is if valid, else -1
+ */
+static long srcLine(long lnum) {
+  if ((lnum < 1) || (lnum >= LONG_MAX)) {
+    lnum = -1;
+  }
+  return lnum;
+}
+
+/*
+ * Shift all the characters in a nul-terminated string to the left, so
+ * that the first character of the string is deleted.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the string to modify
+ */
+static void shiftString(char *pStr) {
+  if (pStr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  for( ; *pStr != 0; pStr++) {
+    pStr[0] = pStr[1];
+  }
+}
+
+/*
+ * Make room in capacity for a given number of instructions in the
+ * compiled script.
+ * 
+ * n is the number of additional elements beyond current length to make
+ * room for.  It must be zero or greater.  An error occurs if the
+ * requested expansion would go beyond the maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of elements to make room for
+ */
+static void capCode(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (n <= CODE_MAX_CAP - m_code_len) {
+    target = m_code_len + n;
+  } else {
+    raiseErr(__LINE__, "Compiled script capacity exceeded");
+  }
+  
+  if (target > m_code_cap) {
+    new_cap = m_code_cap;
+    if (new_cap < CODE_INIT_CAP) {
+      new_cap = CODE_INIT_CAP;
+    }
+    while (new_cap < target) {
+      new_cap *= 2;
+    }
+    if (new_cap > CODE_MAX_CAP) {
+      new_cap = CODE_MAX_CAP;
+    }
+    
+    m_code = (CODE_REC *) realloc(m_code,
+                ((size_t) new_cap) * sizeof(CODE_REC));
+    if (m_code == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_code_cap = new_cap;
+  }
+}
+
+/*
+ * Make room in capacity for a given number of bytes in the string pool
+ * of the compiled script.
+ * 
+ * n is the number of additional bytes beyond current length to make
+ * room for.  It must be zero or greater.  An error occurs if the
+ * requested expansion would go beyond the maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of bytes to make room for
+ */
+static void capPool(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (n <= POOL_MAX_CAP - m_pool_len) {
+    target = m_pool_len + n;
+  } else {
+    raiseErr(__LINE__, "Compiled script capacity exceeded");
+  }
+  
+  if (target > m_pool_cap) {
+    new_cap = m_pool_cap;
+    if (new_cap < POOL_INIT_CAP) {
+      new_cap = POOL_INIT_CAP;
+    }
+    while (new_cap < target) {
+      new_cap *= 2;
+    }
+    if (new_cap > POOL_MAX_CAP) {
+      new_cap = POOL_MAX_CAP;
+    }
+    
+    m_pool = (char *) realloc(m_pool, (size_t) new_cap);
+    if (m_pool == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_pool_cap = new_cap;
+  }
+}
+
+/*
+ * Append an instruction to the compiled script.
+ * 
+ * Parameters:
+ * 
+ *   code - the CODE constant of the instruction
+ * 
+ *   arg - the argument byte of the instruction
+ * 
+ *   val - the value of the instruction
+ * 
+ *   lnum - the script line number of the instruction
+ */
+static void emitCode(int code, int arg, int32_t val, long lnum) {
+  
+  CODE_REC *pc = NULL;
+  
+  if ((code < CODE_MIN) || (code > CODE_MAX) ||
+      (arg < 0) || (arg > 255)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  capCode(1);
+  pc = &(m_code[m_code_len]);
+  pc->code = (uint8_t) code;
+  pc->arg = (uint8_t) arg;
+  pc->lnum = (int32_t) srcLine(lnum);
+  pc->val = val;
+  m_code_len++;
+}
+
+/*
+ * Append an instruction that refers to a string to the compiled
+ * script, adding the string to the string pool.
+ * 
+ * Parameters:
+ * 
+ *   code - the CODE constant of the instruction
+ * 
+ *   arg - the argument byte of the instruction
+ * 
+ *   pStr - the string
+ * 
+ *   lnum - the script line number of the instruction
+ */
+static void emitString(int code, int arg, const char *pStr, long lnum) {
+  
+  size_t slen = 0;
+  int32_t off = 0;
+  
+  if (pStr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  slen = strlen(pStr);
+  if (slen >= (size_t) POOL_MAX_CAP) {
+    raiseErr(__LINE__, "Compiled script capacity exceeded");
+  }
+  
+  capPool(((int32_t) slen) + 1);
+  off = m_pool_len;
+  memcpy(&(m_pool[off]), pStr, slen + 1);
+  m_pool_len += ((int32_t) slen) + 1;
+  
+  emitCode(code, arg, off, lnum);
+}
+
+/*
+ * Write an unsigned integer in big-endian order to a compiled script
+ * file.
+ * 
+ * Parameters:
+ * 
+ *   pOut - the file
+ * 
+ *   val - the value to write
+ * 
+ *   bytes - the number of bytes to write, in range 1 to 8 inclusive
+ */
+static void codePut(FILE *pOut, uint64_t val, int bytes) {
+  
+  if ((pOut == NULL) || (bytes < 1) || (bytes > 8)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for( ; bytes > 0; bytes--) {
+    putc((int) ((val >> ((bytes - 1) * 8)) & 0xff), pOut);
+  }
+}
+
+/*
+ * Read an unsigned integer in big-endian order from a compiled script
+ * file.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file
+ * 
+ *   pVal - receives the value
+ * 
+ *   bytes - the number of bytes to read, in range 1 to 8 inclusive
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file ended or there was an
+ *   error
+ */
+static int codeGet(FILE *pIn, uint64_t *pVal, int bytes) {
+  
+  int status = 1;
+  int c = 0;
+  
+  if ((pIn == NULL) || (pVal == NULL) || (bytes < 1) || (bytes > 8)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  *pVal = 0;
+  for( ; bytes > 0; bytes--) {
+    c = getc(pIn);
+    if (c == EOF) {
+      status = 0;
+      break;
+    }
+    *pVal = (*pVal << 8) | ((uint64_t) c);
+  }
+  
+  return status;
+}
+
+/*
+ * Adjust the pointer on top of the interpreter stack according to a
+ * numeric suffix.
+ * 
+ * The pointer is popped off the stack, adjusted, and pushed back.
+ * 
+ * Parameters:
+ * 
+ *   suf - the suffix character
+ * 
+ *   iv - the integer value of the numeric literal
+ * 
+ *   lnum - the script line number of the numeric entity
+ */
+static void adjustPointer(int suf, int32_t iv, long lnum) {
+  
+  POINTER *pp = NULL;
+  
+  /* First we need to pop a pointer off the stack */
+  pp = core_pop_p(lnum);
+  
+  /* If the suffix is anything other than "s", make sure that this is
+   * not a header pointer */
+  if (suf != 's') {
+    if (pointer_isHeader(pp)) {
+      raiseErr(__LINE__,
+        "Can't adjust header pointer on script line %ld",
+        srcLine(lnum));
+    }
+  }
+  
+  /* Adjust the pointer based on suffix */
+  if (suf == 's') {
+    pointer_jump(pp, iv, lnum);
+    
+  } else if (suf == 'q') {
+    pointer_seek(pp, iv, lnum);
+    
+  } else if (suf == 'r') {
+    pointer_advance(pp, iv, lnum);
+    
+  } else if (suf == 'g') {
+    pointer_grace(
+      pp,
+      iv,
+      core_rstack_current(lnum),
+      lnum);
+    
+  } else if (suf == 't') {
+    pointer_tilt(pp, iv, lnum);
+    
+  } else if (suf == 'm') {
+    pointer_moment(pp, iv, lnum);
+    
+  } else {
+    raiseErr(__LINE__,
+      "Unsupported numeric suffix on script line %ld",
+      srcLine(lnum));
+  }
+  
+  /* Push updated pointer back on stack */
+  core_push_p(pp, lnum);
+}
+
+/*
+ * Interpret a Shastina string entity.
+ * 
+ * Parameters:
+ * 
+ *   pEnt - the string entity to interpret
+ * 
+ *   lnum - the script line number of the string entity
+ */
+static void runString(SNENTITY *pEnt, long lnum) {
+  
+  BLOB *pBlob = NULL;
+  TEXT *pText = NULL;
+  char *pc = NULL;
+  
+  /* Check parameters */
+  if (pEnt == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pEnt->status != SNENTITY_STRING) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Handle the different string types */
+  if (pEnt->str_type == SNSTRING_CURLY) {
+    /* Curly string -- check no string prefix */
+    if (strlen(pEnt->pKey) > 0) {
+      raiseErr(__LINE__,
+        "String prefixes not supported on script line %ld",
+        srcLine(lnum));
+    }
+   
+    /* Parse string text as base-16 and push blob onto stack */
+    pBlob = blob_fromHex(pEnt->pValue, lnum);
+    core_push_b(pBlob, lnum);
+    if (m_compile) {
+      emitString(CODE_BLOB, 0, pEnt->pValue, lnum);
+    }
+    
+  } else if (pEnt->str_type == SNSTRING_QUOTED) {
+    /* Quoted string -- check no string prefix */
+    if (strlen(pEnt->pKey) > 0) {
+      raiseErr(__LINE__,
+        "String prefixes not supported on script line %ld",
+        srcLine(lnum));
+    }
+    
+    /* Go through string literal, check each character in range, and
+     * replace escape sequences with the escaped literals */
+    for(pc = pEnt->pValue; *pc != 0; pc++) {
+      /* Check character in range */
+      if ((*pc < 0x20) || (*pc > 0x7e)) {
+        raiseErr(__LINE__,
+          "String literal has bad characters on script line %ld",
+          srcLine(lnum));
+      }
+      
+      /* Handle escape sequences */
+      if (*pc == '\\') {
+        /* Make sure next character is either another backslash or a
+         * double quote */
+        if ((pc[1] != '\\') && (pc[1] != '"')) {
+          raiseErr(__LINE__,
+            "String literal has invalid escapes on script line %ld",
+            srcLine(lnum));
+        }
+        
+        /* Shift the string to the left and leave the pointer as it is
+         * so we will skip the escaped character */
+        shiftString(pc);
+      }
+    }
+    
+    /* Create a text literal and push it onto stack */
+    pText = text_literal(pEnt->pValue, lnum);
+    core_push_t(pText, lnum);
+    if (m_compile) {
+      emitString(CODE_TEXT, 0, pEnt->pValue, lnum);
+    }
+    
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
+}
+
+/*
+ * Interpret a Shastina numeric entity.
+ * 
+ * Parameters:
+ * 
+ *   pEnt - the string entity to interpret
+ * 
+ *   lnum - the script line number of the numeric entity
+ */
+static void runNumeric(SNENTITY *pEnt, long lnum) {
+  
+  size_t slen = 0;
+  int suf = 0;
+  int is_neg = 0;
+  int c = 0;
+  int32_t iv = 0;
+  char *pc = NULL;
+  
+  /* Check parameters */
+  if (pEnt == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pEnt->status != SNENTITY_NUMERIC) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* If numeric ends with a lowercase letter, store this suffix and drop
+   * from the literal */
+  slen = strlen(pEnt->pKey);
+  if (slen > 0) {
+    if (((pEnt->pKey)[slen - 1] >= 'a') &&
+        ((pEnt->pKey)[slen - 1] <= 'z')) {
+      suf = (pEnt->pKey)[slen - 1];
+      (pEnt->pKey)[slen - 1] = (char) 0;
+    }
+  }
+  
+  /* Start numeric parsing at start of literal */
+  pc = pEnt->pKey;
+  
+  /* If first character is a sign, update is_neg flag and move beyond
+   * it */
+  is_neg = 0;
+  if (*pc == '+') {
+    is_neg = 0;
+    pc++;
+    
+  } else if (*pc == '-') {
+    is_neg = 1;
+    pc++;
+  }
+  
+  /* Make sure remaining numeric string is not empty */
+  if (*pc == 0) {
+    raiseErr(__LINE__, "Invalid numeric literal on script line %ld",
+      srcLine(lnum));
+  }
+  
+  /* Parse integer value */
+  iv = 0;
+  for( ; *pc != 0; pc++) {
+    c = *pc;
+    if ((c < '0') || (c > '9')) {
+      raiseErr(__LINE__, "Invalid numeric literal on script line %ld",
+        srcLine(lnum));
+    }
+    c = c - '0';
+    
+    if (iv <= PRIMITIVE_INT_MAX / 10) {
+      iv *= 10;
+    } else {
+      raiseErr(__LINE__,
+        "Numeric literal out of range on script line %ld",
+        srcLine(lnum));
+    }
+    
+    if (iv <= PRIMITIVE_INT_MAX - c) {
+      iv += ((int32_t) c);
+    } else {
+      raiseErr(__LINE__,
+        "Numeric literal out of range on script line %ld",
+        srcLine(lnum));
+    }
+  }
+  
+  /* Apply sign */
+  if (is_neg) {
+    iv = 0 - iv;
+  }
+  
+  /* Perform appropriate action depending on suffix */
+  if (suf == 0) {
+    /* No suffix, so just push the integer literal */
+    core_push_i(iv, lnum);
+    if (m_compile) {
+      emitCode(CODE_INT, 0, iv, lnum);
+    }
+    
+  } else {
+    /* We have a suffix, so adjust the pointer on top of the stack */
+    adjustPointer(suf, iv, lnum);
+    if (m_compile) {
+      emitCode(CODE_ADJUST, suf, iv, lnum);
+    }
+  }
+}
+
+/*
+ * Release the compiled script, leaving it empty.
+ */
+static void releaseCode(void) {
+  if (m_code != NULL) {
+    free(m_code);
+    m_code = NULL;
+  }
+  if (m_pool != NULL) {
+    free(m_pool);
+    m_pool = NULL;
+  }
+  m_code_cap = 0;
+  m_code_len = 0;
+  m_pool_cap = 0;
+  m_pool_len = 0;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * ircode_run function.
+ */
+void ircode_run(SNSOURCE *pSrc, int compile) {
+  
+  SNPARSER *pp = NULL;
+  SNENTITY ent;
+  long retval = 0;
+  int32_t slot = 0;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SNENTITY));
+  
+  /* Check parameters */
+  if (pSrc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get a parser */
+  if (m_parser != NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_parser = snparser_alloc();
+  pp = m_parser;
+  m_compile = compile;
+  
+  /* Parse the header */
+  snparser_read(pp, &ent, pSrc);
+  if (ent.status != SNENTITY_BEGIN_META) {
+    raiseErr(__LINE__, "Failed to read Infrared script header");
+  }
+  
+  snparser_read(pp, &ent, pSrc);
+  if (ent.status != SNENTITY_META_TOKEN) {
+    raiseErr(__LINE__, "Failed to read Infrared script header");
+  }
+  if (strcmp(ent.pKey, "infrared") != 0) {
+    raiseErr(__LINE__, "Failed to read Infrared script header");
+  }
+  
+  snparser_read(pp, &ent, pSrc);
+  if (ent.status != SNENTITY_END_META) {
+    if (ent.status > 0) {
+      raiseErr(__LINE__, "Unsupported Infrared script version");
+    } else {
+      raiseErr(__LINE__, "Failed to read Infrared script header");
+    }
+  }
+  
+  /* Interpret all the script entities */
+  for(snparser_read(pp, &ent, pSrc);
+      ent.status > 0;
+      snparser_read(pp, &ent, pSrc)) {
+    
+    if (ent.status == SNENTITY_STRING) {
+      runString(&ent, snparser_count(pp));
+      
+    } else if (ent.status == SNENTITY_NUMERIC) {
+      runNumeric(&ent, snparser_count(pp));
+      
+    } else if (ent.status == SNENTITY_VARIABLE) {
+      core_declare(0, ent.pKey, snparser_count(pp));
+      if (m_compile) {
+        emitString(CODE_DECLARE, 0, ent.pKey, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_CONSTANT) {
+      core_declare(1, ent.pKey, snparser_count(pp));
+      if (m_compile) {
+        emitString(CODE_DECLARE, 1, ent.pKey, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_ASSIGN) {
+      slot = core_slot(ent.pKey, snparser_count(pp));
+      core_assign_slot(slot, snparser_count(pp));
+      if (m_compile) {
+        emitCode(CODE_ASSIGN, 0, slot, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_GET) {
+      slot = core_slot(ent.pKey, snparser_count(pp));
+      core_get_slot(slot, snparser_count(pp));
+      if (m_compile) {
+        emitCode(CODE_GET, 0, slot, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_BEGIN_GROUP) {
+      core_begin_group(snparser_count(pp));
+      if (m_compile) {
+        emitCode(CODE_BEGIN, 0, 0, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_END_GROUP) {
+      core_end_group(snparser_count(pp));
+      if (m_compile) {
+        emitCode(CODE_END, 0, 0, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_ARRAY) {
+      if (ent.count > PRIMITIVE_INT_MAX) {
+        raiseErr(__LINE__, "Array count too high on script line %ld",
+          srcLine(snparser_count(pp)));
+      }
+      core_push_i((int32_t) ent.count, snparser_count(pp));
+      if (m_compile) {
+        emitCode(CODE_INT, 0, (int32_t) ent.count, snparser_count(pp));
+      }
+      
+    } else if (ent.status == SNENTITY_OPERATION) {
+      if (!optable_valid(ent.pKey)) {
+        raiseErr(__LINE__, "Invalid operation '%s' on script line %ld",
+          ent.pKey, srcLine(snparser_count(pp)));
+      }
+      retval = (long) optable_find(ent.pKey);
+      if (retval < 0) {
+        raiseErr(__LINE__, "Invalid operation '%s' on script line %ld",
+          ent.pKey, srcLine(snparser_count(pp)));
+      }
+      if (m_compile) {
+        emitCode(CODE_OP, 0, (int32_t) retval, snparser_count(pp));
+      }
+      profile_call((int32_t) retval, snparser_count(pp));
+    
+    } else {
+      raiseErr(__LINE__, "Unsupported Shastina entity type on line %ld",
+        srcLine(snparser_count(pp)));
+    }
+  }
+  if (ent.status < 0) {
+    raiseErr(__LINE__, "Shastina parsing error on line %ld: %s",
+      srcLine(snparser_count(pp)), snerror_str(ent.status));
+  }
+  
+  /* Shutdown core module and verify that in valid state */
+  core_shutdown();
+  
+  /* Release parser */
+  snparser_free(m_parser);
+  m_parser = NULL;
+  pp = NULL;
+  m_compile = 0;
+}
+
+/*
+ * ircode_load function.
+ * 
+ * The file format begins with IRC_SIGNATURE, followed by the hash of
+ * the script, the hash of the operator table from optable_hash(), the
+ * instruction count, and the string pool length.  Each instruction is
+ * then its code, argument, line number, and value.  The string pool
+ * comes last.  All integers are big-endian.
+ */
+int ircode_load(const char *pPath, uint64_t h) {
+  
+  FILE *fh = NULL;
+  char sig[IRC_SIGNATURE_LEN];
+  uint64_t v = 0;
+  int32_t count = 0;
+  int32_t plen = 0;
+  int32_t decl = 0;
+  int32_t i = 0;
+  int ok = 1;
+  int match = 1;
+  CODE_REC *pc = NULL;
+  
+  memset(sig, 0, sizeof(sig));
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    return 0;
+  }
+  
+  /* Check the signature and the hashes, and read the lengths */
+  if (fread(sig, 1, IRC_SIGNATURE_LEN, fh) != IRC_SIGNATURE_LEN) {
+    ok = 0;
+  } else if (memcmp(sig, IRC_SIGNATURE, IRC_SIGNATURE_LEN) != 0) {
+    ok = 0;
+  } else if (!codeGet(fh, &v, 8)) {
+    ok = 0;
+  } else if (v != h) {
+    match = 0;
+  } else if (!codeGet(fh, &v, 8)) {
+    ok = 0;
+  } else if (v != optable_hash()) {
+    match = 0;
+  } else if (!codeGet(fh, &v, 4)) {
+    ok = 0;
+  } else if (v > (uint64_t) CODE_MAX_CAP) {
+    ok = 0;
+  } else {
+    count = (int32_t) v;
+    if (!codeGet(fh, &v, 4)) {
+      ok = 0;
+    } else if (v > (uint64_t) POOL_MAX_CAP) {
+      ok = 0;
+    } else {
+      plen = (int32_t) v;
+    }
+  }
+  
+  /* Read and check each instruction */
+  if (ok && match) {
+    capCode(count);
+    for(i = 0; i < count; i++) {
+      pc = &(m_code[i]);
+      if (!codeGet(fh, &v, 2)) {
+        ok = 0;
+        break;
+      }
+      pc->code = (uint8_t) (v >> 8);
+      pc->arg = (uint8_t) (v & 0xff);
+      if (!codeGet(fh, &v, 4)) {
+        ok = 0;
+        break;
+      }
+      pc->lnum = (int32_t) (uint32_t) v;
+      if (!codeGet(fh, &v, 4)) {
+        ok = 0;
+        break;
+      }
+      pc->val = (int32_t) (uint32_t) v;
+      
+      if ((pc->code == CODE_BLOB) || (pc->code == CODE_TEXT) ||
+          (pc->code == CODE_DECLARE)) {
+        if ((pc->val < 0) || (pc->val >= plen)) {
+          ok = 0;
+        }
+        if (pc->code == CODE_DECLARE) {
+          decl++;
+        }
+        
+      } else if ((pc->code == CODE_GET) || (pc->code == CODE_ASSIGN)) {
+        if ((pc->val < 0) || (pc->val >= decl)) {
+          ok = 0;
+        }
+        
+      } else if (pc->code == CODE_OP) {
+        if ((pc->val < 0) || (pc->val >= optable_count())) {
+          ok = 0;
+        }
+        
+      } else if ((pc->code < CODE_MIN) || (pc->code > CODE_MAX)) {
+        ok = 0;
+      }
+      
+      if (!ok) {
+        break;
+      }
+    }
+    m_code_len = i;
+  }
+  
+  /* Read the string pool, which must end with a nul */
+  if (ok && match) {
+    capPool(plen);
+    if (fread(m_pool, 1, (size_t) plen, fh) != (size_t) plen) {
+      ok = 0;
+    } else if ((plen > 0) && (m_pool[plen - 1] != 0)) {
+      ok = 0;
+    } else {
+      m_pool_len = plen;
+    }
+  }
+  
+  fclose(fh);
+  fh = NULL;
+  
+  if (!ok) {
+    sayWarn(__LINE__, "Ignoring invalid compiled script file: %s",
+      pPath);
+  }
+  if ((!ok) || (!match)) {
+    releaseCode();
+  }
+  
+  return (ok && match);
+}
+
+/*
+ * ircode_save function.
+ */
+void ircode_save(const char *pPath, uint64_t h) {
+  
+  FILE *fh = NULL;
+  int32_t i = 0;
+  int ok = 1;
+  const CODE_REC *pc = NULL;
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fh = fopen(pPath, "wb");
+  if (fh == NULL) {
+    sayWarn(__LINE__, "Failed to write compiled script file: %s", pPath);
+    releaseCode();
+    return;
+  }
+  
+  fwrite(IRC_SIGNATURE, 1, IRC_SIGNATURE_LEN, fh);
+  codePut(fh, h, 8);
+  codePut(fh, optable_hash(), 8);
+  codePut(fh, (uint64_t) m_code_len, 4);
+  codePut(fh, (uint64_t) m_pool_len, 4);
+  
+  for(i = 0; i < m_code_len; i++) {
+    pc = &(m_code[i]);
+    codePut(fh, (((uint64_t) pc->code) << 8) | ((uint64_t) pc->arg), 2);
+    codePut(fh, (uint64_t) (uint32_t) pc->lnum, 4);
+    codePut(fh, (uint64_t) (uint32_t) pc->val, 4);
+  }
+  
+  if (m_pool_len > 0) {
+    fwrite(m_pool, 1, (size_t) m_pool_len, fh);
+  }
+  
+  if (ferror(fh)) {
+    ok = 0;
+  }
+  if (fclose(fh)) {
+    ok = 0;
+  }
+  fh = NULL;
+  
+  if (!ok) {
+    sayWarn(__LINE__, "Failed to write compiled script file: %s", pPath);
+  }
+  
+  releaseCode();
+}
+
+/*
+ * ircode_exec function.
+ */
+void ircode_exec(void) {
+  
+  int32_t i = 0;
+  long lnum = 0;
+  const CODE_REC *pc = NULL;
+  
+  for(i = 0; i < m_code_len; i++) {
+    pc = &(m_code[i]);
+    lnum = (long) pc->lnum;
+    
+    switch (pc->code) {
+      case CODE_INT:
+        core_push_i(pc->val, lnum);
+        break;
+      
+      case CODE_ADJUST:
+        adjustPointer((int) pc->arg, pc->val, lnum);
+        break;
+      
+      case CODE_BLOB:
+        core_push_b(blob_fromHex(&(m_pool[pc->val]), lnum), lnum);
+        break;
+      
+      case CODE_TEXT:
+        core_push_t(text_literal(&(m_pool[pc->val]), lnum), lnum);
+        break;
+      
+      case CODE_DECLARE:
+        core_declare((int) pc->arg, &(m_pool[pc->val]), lnum);
+        break;
+      
+      case CODE_GET:
+        core_get_slot(pc->val, lnum);
+        break;
+      
+      case CODE_ASSIGN:
+        core_assign_slot(pc->val, lnum);
+        break;
+      
+      case CODE_BEGIN:
+        core_begin_group(lnum);
+        break;
+      
+      case CODE_END:
+        core_end_group(lnum);
+        break;
+      
+      case CODE_OP:
+        profile_call(pc->val, lnum);
+        break;
+      
+      default:
+        raiseErr(__LINE__, NULL);
+    }
+  }
+  
+  /* Shutdown core module and verify that in valid state */
+  core_shutdown();
+  
+  releaseCode();
+}
+
+/*
+ * ircode_restart function.
+ */
+void ircode_restart(void) {
+  m_compile = 0;
+  releaseCode();
+  if (m_parser != NULL) {
+    snparser_free(m_parser);
+    m_parser = NULL;
+  }
+}
@@ -0,0 +1,131 @@
+#ifndef IRCODE_H_INCLUDED
+#define IRCODE_H_INCLUDED
+
+/*
+ * ircode.h
+ * ========
+ * 
+ * Script interpreter module of Infrared.
+ * 
+ * This module interprets Infrared scripts read from Shastina sources,
+ * and implements the compiled script cache of the -irc program option.
+ * While a script is interpreted, each entity can also be recorded as an
+ * instruction of a compact bytecode, which can be saved to a compiled
+ * script file, loaded again on a later run, and run directly without
+ * parsing the script.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - blob.c
+ *   - core.c
+ *   - diagnostic.c
+ *   - optable.c
+ *   - pointer.c
+ *   - primitive.c
+ *   - profile.c
+ *   - text.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libshastina
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shastina.h"
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The file extension that is appended to the script path to get the
+ * path of its compiled script file.
+ */
+#define IRCODE_EXT ".irc"
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Run an Infrared script using the given source file.
+ * 
+ * The pointer system must be initialized before calling this function,
+ * and all operation modules should already be registered with the main
+ * module.
+ * 
+ * If compile is non-zero, each entity is also recorded as an
+ * instruction of the compiled script, which can then be written with
+ * ircode_save().
+ * 
+ * This function will shut down the core module, but not other modules.
+ * The source is not released.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the Shastina source for the Infrared script to run
+ * 
+ *   compile - non-zero to compile the script while running it
+ */
+void ircode_run(SNSOURCE *pSrc, int compile);
+
+/*
+ * Load a compiled script file into the compiled script.
+ * 
+ * If the file does not exist or was compiled from a different script
+ * or operator table, zero is returned and the compiled script is left
+ * empty.  If the file is not a valid compiled script, a warning is
+ * issued and zero is returned.  Instructions are checked when loading,
+ * so that invalid files can not cause internal errors when running.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the compiled script file
+ * 
+ *   h - the hash of the script
+ * 
+ * Return:
+ * 
+ *   non-zero if the compiled script was loaded, zero if not
+ */
+int ircode_load(const char *pPath, uint64_t h);
+
+/*
+ * Write the compiled script to a compiled script file, replacing its
+ * previous contents, and then release the compiled script.
+ * 
+ * Failure to write the file only issues a warning.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the compiled script file
+ * 
+ *   h - the hash of the script
+ */
+void ircode_save(const char *pPath, uint64_t h);
+
+/*
+ * Run the compiled script.
+ * 
+ * The compiled script must have been loaded by ircode_load().  Running
+ * it has the same effect as running the script it was compiled from
+ * with ircode_run(), including shutting down the core module at the
+ * end.  The compiled script is released afterwards.
+ */
+void ircode_exec(void);
+
+/*
+ * Restart the script interpreter module, releasing any partially
+ * compiled script and the parser of a script that stopped with an
+ * error, so that the module is ready for another script.
+ */
+void ircode_restart(void);
+
+#endif
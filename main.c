@@ -9,34 +9,259 @@
  * 
  *   infrared [options] [script] < [input.nmf] > [output.mid]
  * 
+ *   infrared -in [input.nmf] [options] [script] > [output.mid]
+ * 
+ *   infrared -batch [list] [options] [script]
+ * 
+ *   infrared -watch [ms] -in [nmf] -out [midi] [options] [script]
+ * 
  * Options
  * -------
  * 
+ *   -batch [path]
+ * 
+ * Renders each NMF file listed in the given text file, which has one
+ * path per line, with blank lines ignored.  The script is run only
+ * once, and each NMF file is then rendered to its own MIDI file, which
+ * has the same path as the NMF file with any ".nmf" extension replaced
+ * by ".mid".  Since the script resolves its pointers against the NMF
+ * section table, all the listed NMF files must have the same section
+ * table as the first one.  Standard input is not used.  The -threads
+ * count selects how many NMF files are rendered at the same time, by
+ * worker processes that share the interpreted script objects, and each
+ * worker imports its notes on a single thread.  May not be combined
+ * with -cache, -in, -index, -live, -map, -out, -sections, or -stats.
+ * 
+ *   -cache [path]
+ * 
+ * Uses the given path as a render cache file.  The MIDI messages
+ * rendered for each NMF section are stored in the cache file, keyed by
+ * the contents of the section, the NMF basis and section table, the
+ * script, and the data files that the script read with graph_load,
+ * graph_load_bin, or blob_file.  On later
+ * runs, sections that have not changed are copied from the cache
+ * instead of being rendered again.  The cache is only used if the NMF
+ * notes are grouped by section and the keyboard process is not enabled
+ * by the script.  The output is the same as without a cache.
+ * 
+ *   -fastexit [flag]
+ * 
+ * Skips shutting down the modules at the end of the program if the flag
+ * is 1, leaving all their memory for the operating system to reclaim
+ * when the process exits, or shuts down each module normally if the
+ * flag is 0, which is the default.  Scripts that construct very many
+ * objects finish sooner with a fast exit, while the normal shutdown
+ * keeps memory checkers from reporting the objects as leaks.
+ * 
+ *   -format [type]
+ * 
+ * Selects the Standard MIDI File format of the generated MIDI file.
+ * The type is either 0 or 1.  The default of 0 generates a single
+ * track.  Type 1 generates a conductor track for tempo and other
+ * messages without a MIDI channel, plus one track for each MIDI channel
+ * that is used.
+ * 
+ *   -in [path]
+ * 
+ * Reads the input NMF file from the given path instead of standard
+ * input.  The file is parsed directly by the NMF library, which avoids
+ * copying the whole file through a pipe when it is large.
+ * 
+ *   -index [path]
+ * 
+ * Generates a seek index of the generated MIDI file at the given path.
+ * The seek index is a binary file with seek points at the start of
+ * each track, at the start of each NMF section, and every -indexstep
+ * delta time units.  Each seek point has the byte offset in the MIDI
+ * file of the delta time of the first message at or after its time,
+ * along with the running status and a snapshot of the controller,
+ * parameter number, data entry, program, pressure, and pitch bend
+ * state of the track at that point, so that players can start decoding
+ * at any seek point.  The seek index is built while the MIDI file is
+ * encoded, and the tracks are then encoded on the main thread.  See
+ * midi_index() in midi.h for the file format.  May not be combined
+ * with -live.
+ * 
+ *   -indexstep [count]
+ * 
+ * Selects the spacing of the seek points of -index in delta time units,
+ * in the time division selected with -ppq.  The count is an unsigned
+ * decimal.  The default of zero only places seek points at the start of
+ * each track and each NMF section.  Requires -index.
+ * 
+ *   -irc [flag]
+ * 
+ * Enables the compiled script cache if the flag is 1, or disables it
+ * if the flag is 0, which is the default.  When enabled, the script is
+ * compiled into a compact bytecode the first time it runs, and the
+ * bytecode is stored in a file with the same path as the script plus
+ * an ".irc" extension.  On later runs, the bytecode is loaded and run
+ * directly instead of parsing the script, if the script has not
+ * changed since it was compiled.  The output is the same as without
+ * the cache.
+ * 
+ *   -live [path]
+ * 
+ * Plays the generated MIDI messages in real time as a raw MIDI byte
+ * stream to the given path instead of generating a MIDI file.  The path
+ * is intended to be a raw MIDI device, or a pipe or FIFO read by a
+ * bridge to a sequencer or network transport.  Meta-events are not
+ * sent, and tempo changes are applied to the timing.  May not be
+ * combined with -out.
+ * 
+ *   -log [level]
+ * 
+ * Selects the most detailed level of diagnostic messages that is
+ * reported to standard error.  The level is 0 for errors only, 1 to add
+ * warnings, 2 to add log messages, which is the default, or 3 to add
+ * debug messages.  Script messages and the reports of -profile and
+ * -stats are not affected.  Debug messages are only available if the
+ * program was compiled without INFRARED_NODEBUG.
+ * 
+ *   -loglimit [count]
+ * 
+ * Reports at most the given number of warnings or log messages from
+ * each place in the program that reports them.  The rest are counted,
+ * and a line saying how many more similar messages were suppressed is
+ * reported when the program finishes.  The count is an unsigned
+ * decimal.  The default of zero has no limit.
+ * 
  *   -map [path]
  * 
  * Generates a section map file at the given path.  The section map is a
  * text file that has one record per line.  Each record begins with an
  * NMF section number as an unsigned decimal, followed by a colon,
  * followed by the delta time offset of the NMF section in the generated
- * MIDI file as an unsigned decimal.
+ * MIDI file as an unsigned decimal, in the time division selected with
+ * -ppq.
+ * 
+ *   -out [path]
+ * 
+ * Writes the generated MIDI file to the given path instead of standard
+ * output.  The MIDI file is encoded directly into a temporary file
+ * mapped into memory, which then replaces the output file, so that the
+ * output file is never seen half written.  Symbolic links, devices,
+ * and pipes such as /dev/stdout are written to directly.
+ * 
+ *   -ppq [count]
+ * 
+ * Selects the time division of the generated MIDI file in delta time
+ * units per quarter note.  The count is an unsigned decimal in range 1
+ * to 768 inclusive.  The default of 768 encodes every moment exactly.
+ * Smaller counts round each moment to the nearest delta time unit,
+ * with exact halves rounded up, which gives smaller delta times and
+ * files.  Note-off messages still come before note-on messages that
+ * round to the same delta time, and notes are kept at least one delta
+ * time unit long.
+ * 
+ *   -profile [count]
+ * 
+ * Profiles the script and reports its most expensive parts to standard
+ * error after the script has run.  Each operation call is timed, and
+ * the calls, wall-clock time, and number of graph, set, text, and blob
+ * objects allocated are accumulated both for each operation and for
+ * each script line.  The count is the number of entries to report in
+ * each of the two lists, which are ordered by decreasing time.  It is
+ * an unsigned decimal that must be at least one.
+ * 
+ *   -prune [flag]
+ * 
+ * Enables the redundant event elimination pass if the flag is 1, or
+ * disables it if the flag is 0, which is the default.  The pass drops
+ * messages that set a controller, program, pressure, or pitch bend
+ * value to the value the channel already has.
+ * 
+ *   -sections [A]-[B]
+ * 
+ * Renders only NMF sections A to B inclusive, where A and B are
+ * unsigned decimal section indices and A is less than or equal to B,
+ * for quickly previewing part of a composition.  Only the notes in
+ * those sections are imported and rendered, and the MIDI file starts
+ * at the beginning of section A, or at the earliest note of the
+ * selected sections if that is earlier, such as a grace note leading
+ * into section A.  Controller, program, tempo, and meta messages that
+ * would come before that start are moved to it, and automatically
+ * tracked controllers begin with their graph values at that point.
+ * Other messages after the sections are dropped, except for note
+ * releases.  The render cache is not used, and the section map only
+ * lists the selected sections.
+ * 
+ *   -stats [path]
+ * 
+ * Reports statistics to standard error when the program finishes.  The
+ * report includes the wall-clock and CPU time of each processing phase,
+ * the peak capacities of the main buffers, and counts of deleted notes,
+ * aftertouch messages, controller messages, and pruned messages.  If
+ * the path is not "-" then the statistics are also written to the given
+ * path as a JSON object.
+ * 
+ *   -threads [count]
+ * 
+ * Imports NMF notes, tracks automatic controllers, and encodes large
+ * MIDI tracks using the given number of worker threads.  The count is
+ * an unsigned decimal in range 1 to 64 inclusive.  The default is one,
+ * which does all the work on the main thread.  Tracks are encoded on
+ * the main thread if -index is given.  The output is the same
+ * regardless of the thread count.
+ * 
+ *   -watch [interval]
+ * 
+ * Stays resident and renders again whenever the script, the -in NMF
+ * file, or a data file that the script read with graph_load,
+ * graph_load_bin, or blob_file changes, checking the files every
+ * interval milliseconds.  The interval is an unsigned decimal in range
+ * 1 to 60000 inclusive.  A file counts as changed when its modification
+ * time, size, or file identity differs, and the change is acted on once
+ * the file has stayed the same for one more interval, so that partly
+ * written files are not read.  If only the NMF file changed and its
+ * section table is the same as before, the new notes are rendered from
+ * the interpreted script objects already in memory, without running the
+ * script again.  Otherwise, the NMF file is parsed and the script is
+ * run again.  Each render is done by a worker process, so errors in the
+ * script, the NMF file, or the data files are reported and watching
+ * continues.  With -cache, sections that have not changed are copied
+ * from the render cache.  The program runs until it is interrupted.
+ * Requires -in and -out, and may not be combined with -batch or -live.
+ * 
+ *   -window [count]
+ * 
+ * Renders the NMF notes in windows of at most the given number of
+ * notes, so that only one window of rendering events is held in memory
+ * at a time.  The count is an unsigned decimal.  The default of zero
+ * renders all notes in a single window.  The window is ignored if the
+ * keyboard process is enabled by the script.  The output is the same
+ * regardless of the window size.
  * 
  * Requirements
  * ------------
  * 
  * May require the <math.h> library with -lm
  * 
+ * May require the POSIX threads library with -lpthread
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Batch and watch modes require the POSIX fork() and waitpid()
+ * functions
+ * 
  * Infrared consists of the following framework modules:
  * 
+ *   - arena.c
  *   - art.c
  *   - blob.c
  *   - control.c
  *   - core.c
  *   - diagnostic.c
+ *   - driver.c
  *   - graph.c
+ *   - ircode.c
  *   - main.c
  *   - midi.c
+ *   - optable.c
  *   - pointer.c
  *   - primitive.c
+ *   - profile.c
  *   - render.c
  *   - ruler.c
  *   - set.c
@@ -52,6 +277,13 @@
  *   - op_set.c
  *   - op_string.c
  * 
+ * When main.c is compiled with INFRARED_LIBRARY defined, the program
+ * entrypoint is left out, so that the modules can be linked into the
+ * libinfrared library described in infrared.h.
+ * 
+ * When the modules are compiled with INFRARED_NODEBUG defined, debug
+ * logging is removed from them entirely.
+ * 
  * Infrared requires the following external libraries:
  * 
  *   - libnmf
@@ -72,10 +304,13 @@
 #include "control.h"
 #include "core.h"
 #include "diagnostic.h"
+#include "driver.h"
 #include "graph.h"
+#include "ircode.h"
 #include "midi.h"
+#include "optable.h"
 #include "pointer.h"
-#include "primitive.h"
+#include "profile.h"
 #include "render.h"
 #include "ruler.h"
 #include "set.h"
@@ -90,7 +325,6 @@
 #include "op_string.h"
 
 #include "nmf.h"
-#include "rfdict.h"
 #include "shastina.h"
 
 /*
@@ -137,25 +371,9 @@ static void registerModules(void) {
  */
 
 /*
- * The initial and maximum allocation of the operator registration
- * table.
- */
-#define OP_INIT_CAP (32)
-#define OP_MAX_CAP (16384)
-
-/*
- * Type declarations
- * =================
+ * The offset basis of the 64-bit FNV-1a hash.
  */
-
-/*
- * Record structure for the operator table, which each store a callback
- * and the custom data to pass to that callback.
- */
-typedef struct {
-  main_fp_op fp;
-  void *pCustom;
-} OP_REC;
+#define HASH_FNV_BASIS UINT64_C(14695981039346656037)
 
 /*
  * Local data
@@ -167,6 +385,12 @@ typedef struct {
  */
 static const char *pModule = NULL;
 
+/*
+ * Flag indicating whether the operation modules have been registered
+ * with main_register().
+ */
+static int m_registered = 0;
+
 /*
  * The newline flag, which is used for the print and newline public
  * functions.
@@ -176,23 +400,6 @@ static const char *pModule = NULL;
  */
 static int m_newline = 1;
 
-/*
- * The operator registration table.
- * 
- * m_op_cap is the current capacity in operator records.  m_op_len is
- * the number of operator records actually in use.
- * 
- * m_op is the dynamically allocated operator table array, which may be
- * NULL only if the capacity is zero.
- * 
- * m_op_map is the mapping of operator names to their indices in the
- * operator table array.
- */
-static RFDICT *m_op_map = NULL;
-static int32_t m_op_cap = 0;
-static int32_t m_op_len = 0;
-static OP_REC *m_op = NULL;
-
 /*
  * Local functions
  * ===============
@@ -200,15 +407,14 @@ static OP_REC *m_op = NULL;
 
 /* Prototypes */
 static long srcLine(long lnum);
-static void shiftString(char *pStr);
-static int validName(const char *pName);
-
-static void capOp(int32_t n);
-static void compileMap(NMF_DATA *pd, const char *pPath);
-
-static void runString(SNENTITY *pEnt, long lnum);
-static void runNumeric(SNENTITY *pEnt, long lnum);
-static void runScript(SNSOURCE *pSrc);
+static int32_t parseOptInt(const char *pOpt, const char *pStr);
+static void parseOptRange(
+    const char * pOpt,
+    const char * pStr,
+    int32_t    * pLo,
+    int32_t    * pHi);
+static uint64_t hashFile(const char *pPath, uint64_t h);
+static uint64_t hashSections(NMF_DATA *pd, uint64_t h);
 
 /*
  * If the given line number is within valid range, return it as-is.  In
@@ -230,547 +436,207 @@ static long srcLine(long lnum) {
 }
 
 /*
- * Shift all the characters in a nul-terminated string to the left, so
- * that the first character of the string is deleted.
- * 
- * Parameters:
+ * Parse the value of a program option as an unsigned decimal integer.
  * 
- *   pStr - the string to modify
- */
-static void shiftString(char *pStr) {
-  if (pStr == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
-  for( ; *pStr != 0; pStr++) {
-    pStr[0] = pStr[1];
-  }
-}
-
-/*
- * Check whether a given name is a valid operation name.
+ * An error occurs if the value is empty, contains anything other than
+ * decimal digits, or is greater than INT32_MAX.
  * 
  * Parameters:
  * 
- *   pName - the name to check
+ *   pOpt - the name of the program option, for error messages
+ * 
+ *   pStr - the option value to parse
  * 
  * Return:
  * 
- *   non-zero if valid, zero otherwise
+ *   the parsed integer value
  */
-static int validName(const char *pName) {
+static int32_t parseOptInt(const char *pOpt, const char *pStr) {
   
-  size_t slen = 0;
-  int result = 1;
-  const char *pc = NULL;
+  int32_t iv = 0;
+  int c = 0;
   
-  if (pName == NULL) {
+  /* Check parameters */
+  if ((pOpt == NULL) || (pStr == NULL)) {
     raiseErr(__LINE__, NULL);
   }
   
-  slen = strlen(pName);
-  if ((slen < 1) || (slen > 31)) {
-    result = 0;
+  /* Make sure value is not empty */
+  if (*pStr == 0) {
+    raiseErr(__LINE__, "Invalid value for %s program option", pOpt);
   }
   
-  if (result) {
-    if (((pName[0] < 'A') || (pName[0] > 'Z')) &&
-        ((pName[0] < 'a') || (pName[0] > 'z'))) {
-      result = 0;
+  /* Parse the decimal digits */
+  for( ; *pStr != 0; pStr++) {
+    c = *pStr;
+    if ((c < '0') || (c > '9')) {
+      raiseErr(__LINE__, "Invalid value for %s program option", pOpt);
     }
-  }
-  
-  if (result) {
-    for(pc = pName; *pc != 0; pc++) {
-      if (((*pc < 'A') || (*pc > 'Z')) &&
-          ((*pc < 'a') || (*pc > 'z')) &&
-          ((*pc < '0') || (*pc > '9')) &&
-          (*pc != '_')) {
-        result = 0;
-        break;
-      }
+    c = c - '0';
+    
+    if (iv <= (INT32_MAX - c) / 10) {
+      iv = (iv * 10) + ((int32_t) c);
+    } else {
+      raiseErr(__LINE__, "Value out of range for %s program option",
+        pOpt);
     }
   }
   
-  return result;
+  return iv;
 }
 
 /*
- * Make room in capacity for a given number of elements in the operator
- * table.
+ * Parse the value of a program option as a range of two unsigned
+ * decimal integers separated by a hyphen.
  * 
- * n is the number of additional elements beyond current length to make
- * room for.  It must be zero or greater.
+ * Each integer is parsed with parseOptInt().  An error occurs if there
+ * is no hyphen or if the first integer is greater than the second.
  * 
- * Upon return, the capacity will be at least n elements higher than the
- * current length.
+ * Parameters:
  * 
- * An error occurs if the requested expansion would go beyond the
- * maximum allowed capacity.
+ *   pOpt - the name of the program option, for error messages
  * 
- * Parameters:
+ *   pStr - the option value to parse
+ * 
+ *   pLo - receives the first integer
  * 
- *   n - the number of elements to make room for
+ *   pHi - receives the second integer
  */
-static void capOp(int32_t n) {
+static void parseOptRange(
+    const char * pOpt,
+    const char * pStr,
+    int32_t    * pLo,
+    int32_t    * pHi) {
+  
+  char buf[32];
+  const char *pc = NULL;
+  size_t slen = 0;
   
-  int32_t target = 0;
-  int32_t new_cap = 0;
+  /* Initialize buffer */
+  memset(buf, 0, sizeof(buf));
   
   /* Check parameters */
-  if (n < 0) {
+  if ((pOpt == NULL) || (pStr == NULL) ||
+      (pLo == NULL) || (pHi == NULL)) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Only proceed if n is non-zero */
-  if (n > 0) {
-    
-    /* Make initial allocation if necessary */
-    if (m_op_cap < 1) {
-      m_op = (OP_REC *) calloc(
-                (size_t) OP_INIT_CAP, sizeof(OP_REC));
-      if (m_op == NULL) {
-        raiseErr(__LINE__, "Out of memory");
-      }
-      
-      m_op_cap = OP_INIT_CAP;
-      m_op_len = 0;
-    }
-    
-    /* Compute target length */
-    if (n <= INT32_MAX - m_op_len) {
-      target = m_op_len + n;
-    } else {
-      raiseErr(__LINE__, "Operator table capacity exceeded");
-    }
-    
-    /* Only proceed if target length exceeds current capacity */
-    if (target > m_op_cap) {
-      /* Check that target within maximum capacity */
-      if (target > OP_MAX_CAP) {
-        raiseErr(__LINE__, "Operator table capacity exceeded");
-      }
-      
-      /* Compute new capacity by doubling current capacity until greater
-       * than or equal to target length, and then limiting to maximum
-       * capacity */
-      new_cap = m_op_cap;
-      while (new_cap < target) {
-        new_cap *= 2;
-      }
-      if (new_cap > OP_MAX_CAP) {
-        new_cap = OP_MAX_CAP;
-      }
-      
-      /* Expand capacity */
-      m_op = (OP_REC *) realloc(m_op,
-                            ((size_t) new_cap) * sizeof(OP_REC));
-      if (m_op == NULL) {
-        raiseErr(__LINE__, "Out of memory");
-      }
-      
-      memset(
-        &(m_op[m_op_cap]),
-        0,
-        ((size_t) (new_cap - m_op_cap)) * sizeof(OP_REC));
-      
-      m_op_cap = new_cap;
-    }
-  }
-}
-
-/*
- * Compile a section map to the given output file path.
- * 
- * Makes use of the pointer module and the event range in the MIDI
- * module, so this should be done just before compiling the MIDI file.
- * 
- * Parameters:
- * 
- *   pd - the parsed NMF data
- * 
- *   pPath - the path to the map file to generate
- */
-static void compileMap(NMF_DATA *pd, const char *pPath) {
-  FILE *fh = NULL;
-  POINTER *pp = NULL;
-  int32_t i = 0;
-  int64_t r = 0;
-  
-  if ((pd == NULL) || (pPath == NULL)) {
-    raiseErr(__LINE__, NULL);
+  /* Split the value at the hyphen */
+  pc = strchr(pStr, '-');
+  if (pc == NULL) {
+    raiseErr(__LINE__, "Invalid value for %s program option", pOpt);
   }
   
-  fh = fopen(pPath, "w");
-  if (fh == NULL) {
-    raiseErr(__LINE__, "Failed to create file: %s", pPath);
+  slen = (size_t) (pc - pStr);
+  if (slen >= sizeof(buf)) {
+    raiseErr(__LINE__, "Value out of range for %s program option",
+      pOpt);
   }
+  memcpy(buf, pStr, slen);
+  buf[slen] = (char) 0;
   
-  pp = pointer_new();
-  for(i = 0; i < nmf_sections(pd); i++) {
-    pointer_reset(pp);
-    pointer_jump(pp, i, -1);
-    pointer_moment(pp, -1, -1);
-    
-    r = ((int64_t) (pointer_compute(pp, -1) / 3));
-    r = r - ((int64_t) midi_range_lower());
-    
-    if ((r < INT32_MIN) || (r > INT32_MAX)) {
-      raiseErr(__LINE__, "Section offset out of range");
-    }
-    
-    fprintf(fh, "%ld:%ld\n", (long) i, (long) r);
-  }
+  /* Parse each side of the range */
+  *pLo = parseOptInt(pOpt, buf);
+  *pHi = parseOptInt(pOpt, pc + 1);
   
-  if (fclose(fh)) {
-    sayWarn(__LINE__, "Failed to close file");
+  if (*pLo > *pHi) {
+    raiseErr(__LINE__, "Invalid range for %s program option", pOpt);
   }
-  fh = NULL;
 }
 
 /*
- * Interpret a Shastina string entity.
+ * Fold the contents of a file into a 64-bit FNV-1a hash.
  * 
- * Parameters:
+ * This is used for the context hash of the render cache, so that
+ * cached sections are not reused after the script or a data file that
+ * it read changes, and for the hash of the script that identifies its
+ * compiled script file.  Start with HASH_FNV_BASIS for the first file.
  * 
- *   pEnt - the string entity to interpret
+ * Parameters:
  * 
- *   lnum - the script line number of the string entity
- */
-static void runString(SNENTITY *pEnt, long lnum) {
-  
-  BLOB *pBlob = NULL;
-  TEXT *pText = NULL;
-  char *pc = NULL;
-  
-  /* Check parameters */
-  if (pEnt == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
-  if (pEnt->status != SNENTITY_STRING) {
-    raiseErr(__LINE__, NULL);
-  }
-  
-  /* Handle the different string types */
-  if (pEnt->str_type == SNSTRING_CURLY) {
-    /* Curly string -- check no string prefix */
-    if (strlen(pEnt->pKey) > 0) {
-      raiseErr(__LINE__,
-        "String prefixes not supported on script line %ld",
-        srcLine(lnum));
-    }
-   
-    /* Parse string text as base-16 and push blob onto stack */
-    pBlob = blob_fromHex(pEnt->pValue, lnum);
-    core_push_b(pBlob, lnum);
-    
-  } else if (pEnt->str_type == SNSTRING_QUOTED) {
-    /* Quoted string -- check no string prefix */
-    if (strlen(pEnt->pKey) > 0) {
-      raiseErr(__LINE__,
-        "String prefixes not supported on script line %ld",
-        srcLine(lnum));
-    }
-    
-    /* Go through string literal, check each character in range, and
-     * replace escape sequences with the escaped literals */
-    for(pc = pEnt->pValue; *pc != 0; pc++) {
-      /* Check character in range */
-      if ((*pc < 0x20) || (*pc > 0x7e)) {
-        raiseErr(__LINE__,
-          "String literal has bad characters on script line %ld",
-          srcLine(lnum));
-      }
-      
-      /* Handle escape sequences */
-      if (*pc == '\\') {
-        /* Make sure next character is either another backslash or a
-         * double quote */
-        if ((pc[1] != '\\') && (pc[1] != '"')) {
-          raiseErr(__LINE__,
-            "String literal has invalid escapes on script line %ld",
-            srcLine(lnum));
-        }
-        
-        /* Shift the string to the left and leave the pointer as it is
-         * so we will skip the escaped character */
-        shiftString(pc);
-      }
-    }
-    
-    /* Create a text literal and push it onto stack */
-    pText = text_literal(pEnt->pValue, lnum);
-    core_push_t(pText, lnum);
-    
-  } else {
-    raiseErr(__LINE__, NULL);
-  }
-}
-
-/*
- * Interpret a Shastina numeric entity.
+ *   pPath - the path to the file
  * 
- * Parameters:
+ *   h - the hash so far
  * 
- *   pEnt - the string entity to interpret
+ * Return:
  * 
- *   lnum - the script line number of the numeric entity
+ *   the hash with the contents of the file folded in
  */
-static void runNumeric(SNENTITY *pEnt, long lnum) {
+static uint64_t hashFile(const char *pPath, uint64_t h) {
   
-  size_t slen = 0;
-  int suf = 0;
-  int is_neg = 0;
+  FILE *fh = NULL;
   int c = 0;
-  int32_t iv = 0;
-  char *pc = NULL;
-  POINTER *pp = NULL;
   
-  /* Check parameters */
-  if (pEnt == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
-  if (pEnt->status != SNENTITY_NUMERIC) {
+  if (pPath == NULL) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* If numeric ends with a lowercase letter, store this suffix and drop
-   * from the literal */
-  slen = strlen(pEnt->pKey);
-  if (slen > 0) {
-    if (((pEnt->pKey)[slen - 1] >= 'a') &&
-        ((pEnt->pKey)[slen - 1] <= 'z')) {
-      suf = (pEnt->pKey)[slen - 1];
-      (pEnt->pKey)[slen - 1] = (char) 0;
-    }
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    raiseErr(__LINE__, "Failed to open file: %s", pPath);
   }
   
-  /* Start numeric parsing at start of literal */
-  pc = pEnt->pKey;
-  
-  /* If first character is a sign, update is_neg flag and move beyond
-   * it */
-  is_neg = 0;
-  if (*pc == '+') {
-    is_neg = 0;
-    pc++;
-    
-  } else if (*pc == '-') {
-    is_neg = 1;
-    pc++;
+  for(c = getc(fh); c != EOF; c = getc(fh)) {
+    h ^= (uint64_t) c;
+    h *= UINT64_C(1099511628211);
   }
-  
-  /* Make sure remaining numeric string is not empty */
-  if (*pc == 0) {
-    raiseErr(__LINE__, "Invalid numeric literal on script line %ld",
-      srcLine(lnum));
+  if (ferror(fh)) {
+    raiseErr(__LINE__, "I/O error reading file: %s", pPath);
   }
   
-  /* Parse integer value */
-  iv = 0;
-  for( ; *pc != 0; pc++) {
-    c = *pc;
-    if ((c < '0') || (c > '9')) {
-      raiseErr(__LINE__, "Invalid numeric literal on script line %ld",
-        srcLine(lnum));
-    }
-    c = c - '0';
-    
-    if (iv <= PRIMITIVE_INT_MAX / 10) {
-      iv *= 10;
-    } else {
-      raiseErr(__LINE__,
-        "Numeric literal out of range on script line %ld",
-        srcLine(lnum));
-    }
-    
-    if (iv <= PRIMITIVE_INT_MAX - c) {
-      iv += ((int32_t) c);
-    } else {
-      raiseErr(__LINE__,
-        "Numeric literal out of range on script line %ld",
-        srcLine(lnum));
-    }
-  }
-  
-  /* Apply sign */
-  if (is_neg) {
-    iv = 0 - iv;
-  }
+  fclose(fh);
+  fh = NULL;
   
-  /* Perform appropriate action depending on suffix */
-  if (suf == 0) {
-    /* No suffix, so just push the integer literal */
-    core_push_i(iv, lnum);
-    
-  } else {
-    /* We have a suffix, so first we need to pop a pointer off the
-     * stack */
-    pp = core_pop_p(lnum);
-    
-    /* If the suffix is anything other than "s", make sure that this is
-     * not a header pointer */
-    if (suf != 's') {
-      if (pointer_isHeader(pp)) {
-        raiseErr(__LINE__,
-          "Can't adjust header pointer on script line %ld",
-          srcLine(lnum));
-      }
-    }
-    
-    /* Adjust the pointer based on suffix */
-    if (suf == 's') {
-      pointer_jump(pp, iv, lnum);
-      
-    } else if (suf == 'q') {
-      pointer_seek(pp, iv, lnum);
-      
-    } else if (suf == 'r') {
-      pointer_advance(pp, iv, lnum);
-      
-    } else if (suf == 'g') {
-      pointer_grace(
-        pp,
-        iv,
-        core_rstack_current(lnum),
-        lnum);
-      
-    } else if (suf == 't') {
-      pointer_tilt(pp, iv, lnum);
-      
-    } else if (suf == 'm') {
-      pointer_moment(pp, iv, lnum);
-      
-    } else {
-      raiseErr(__LINE__,
-        "Unsupported numeric suffix on script line %ld",
-        srcLine(lnum));
-    }
-    
-    /* Push updated pointer back on stack */
-    core_push_p(pp, lnum);
-  }
+  return h;
 }
 
 /*
- * Run an Infrared script using the given source file.
+ * Fold the time basis and the section table of an NMF file into a
+ * 64-bit FNV-1a hash.
  * 
- * The pointer system must be initialized before calling this function,
- * and all operation modules should already be registered with this main
- * module.
- * 
- * This function will shut down the core module, but not other modules.
+ * This is used for the context hash of the render cache, since every
+ * pointer in the script is resolved against the section table, so the
+ * same notes can render differently once the sections move.
  * 
  * Parameters:
  * 
- *   pSrc - the Shastina source for the Infrared script to run
+ *   pd - the NMF data
+ * 
+ *   h - the hash so far
+ * 
+ * Return:
+ * 
+ *   the hash with the basis and the section offsets folded in
  */
-static void runScript(SNSOURCE *pSrc) {
-  
-  SNPARSER *pp = NULL;
-  SNENTITY ent;
-  long retval = 0;
+static uint64_t hashSections(NMF_DATA *pd, uint64_t h) {
   
-  /* Initialize structures */
-  memset(&ent, 0, sizeof(SNENTITY));
+  uint32_t v = 0;
+  int32_t i = 0;
+  int32_t count = 0;
+  int b = 0;
   
-  /* Check parameters */
-  if (pSrc == NULL) {
+  if (pd == NULL) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Get a parser */
-  pp = snparser_alloc();
-  
-  /* Parse the header */
-  snparser_read(pp, &ent, pSrc);
-  if (ent.status != SNENTITY_BEGIN_META) {
-    raiseErr(__LINE__, "Failed to read Infrared script header");
-  }
-  
-  snparser_read(pp, &ent, pSrc);
-  if (ent.status != SNENTITY_META_TOKEN) {
-    raiseErr(__LINE__, "Failed to read Infrared script header");
-  }
-  if (strcmp(ent.pKey, "infrared") != 0) {
-    raiseErr(__LINE__, "Failed to read Infrared script header");
-  }
-  
-  snparser_read(pp, &ent, pSrc);
-  if (ent.status != SNENTITY_END_META) {
-    if (ent.status > 0) {
-      raiseErr(__LINE__, "Unsupported Infrared script version");
+  count = nmf_sections(pd);
+  for(i = -2; i < count; i++) {
+    if (i == -2) {
+      v = (uint32_t) nmf_basis(pd);
+    } else if (i == -1) {
+      v = (uint32_t) count;
     } else {
-      raiseErr(__LINE__, "Failed to read Infrared script header");
+      v = (uint32_t) nmf_offset(pd, i);
     }
-  }
-  
-  /* Interpret all the script entities */
-  for(snparser_read(pp, &ent, pSrc);
-      ent.status > 0;
-      snparser_read(pp, &ent, pSrc)) {
     
-    if (ent.status == SNENTITY_STRING) {
-      runString(&ent, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_NUMERIC) {
-      runNumeric(&ent, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_VARIABLE) {
-      core_declare(0, ent.pKey, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_CONSTANT) {
-      core_declare(1, ent.pKey, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_ASSIGN) {
-      core_assign(ent.pKey, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_GET) {
-      core_get(ent.pKey, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_BEGIN_GROUP) {
-      core_begin_group(snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_END_GROUP) {
-      core_end_group(snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_ARRAY) {
-      if (ent.count > PRIMITIVE_INT_MAX) {
-        raiseErr(__LINE__, "Array count too high on script line %ld",
-          srcLine(snparser_count(pp)));
-      }
-      core_push_i((int32_t) ent.count, snparser_count(pp));
-      
-    } else if (ent.status == SNENTITY_OPERATION) {
-      if (!validName(ent.pKey)) {
-        raiseErr(__LINE__, "Invalid operation '%s' on script line %ld",
-          srcLine(snparser_count(pp)));
-      }
-      if (m_op_map == NULL) {
-        m_op_map = rfdict_alloc(1);
-      }
-      retval = rfdict_get(m_op_map, ent.pKey, -1);
-      if (retval < 0) {
-        raiseErr(__LINE__, "Invalid operation '%s' on script line %ld",
-          srcLine(snparser_count(pp)));
-      }
-      ((m_op[retval]).fp)((m_op[retval]).pCustom, snparser_count(pp));
-    
-    } else {
-      raiseErr(__LINE__, "Unsupported Shastina entity type on line %ld",
-        srcLine(snparser_count(pp)));
+    for(b = 0; b < 4; b++) {
+      h ^= (uint64_t) (v & 0xff);
+      h *= UINT64_C(1099511628211);
+      v >>= 8;
     }
   }
-  if (ent.status < 0) {
-    raiseErr(__LINE__, "Shastina parsing error on line %ld: %s",
-      srcLine(snparser_count(pp)), snerror_str(ent.status));
-  }
   
-  /* Shutdown core module and verify that in valid state */
-  core_shutdown();
-  
-  /* Release parser */
-  snparser_free(pp);
-  pp = NULL;
+  return h;
 }
 
 /*
@@ -787,23 +653,7 @@ void main_op(const char *pKey, main_fp_op fp, void *pCustom) {
   if ((pKey == NULL) || (fp == NULL)) {
     raiseErr(__LINE__, NULL);
   }
-  if (!validName(pKey)) {
-    raiseErr(__LINE__, "Invalid operation name registered");
-  }
-  
-  if (m_op_map == NULL) {
-    m_op_map = rfdict_alloc(1);
-  }
-  
-  capOp(1);
-  if (!rfdict_insert(m_op_map, pKey, (long) m_op_len)) {
-    raiseErr(__LINE__, "Duplicate operation name registration: %s",
-      pKey);
-  }
-  
-  (m_op[m_op_len]).fp = fp;
-  (m_op[m_op_len]).pCustom = pCustom;
-  m_op_len++;
+  optable_add(pKey, fp, pCustom);
 }
 
 /*
@@ -870,7 +720,65 @@ void main_stop(long lnum) {
   
   fprintf(stderr,
     "\n%s: [Stopped on script line %ld]\n", pModule, srcLine(lnum));
-  exit(EXIT_FAILURE);
+  diagnostic_fail();
+}
+
+/*
+ * main_input function.
+ */
+void main_input(const char *pPath) {
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  driver_input(pPath);
+}
+
+/*
+ * main_module function.
+ */
+const char *main_module(void) {
+  if (pModule == NULL) {
+    return "infrared";
+  }
+  return pModule;
+}
+
+/*
+ * main_register function.
+ */
+void main_register(void) {
+  if (!m_registered) {
+    m_registered = 1;
+    if (pModule == NULL) {
+      pModule = "infrared";
+    }
+    registerModules();
+    optable_build();
+  }
+}
+
+/*
+ * main_script function.
+ */
+void main_script(SNSOURCE *pSrc) {
+  if (pSrc == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (!m_registered) {
+    raiseErr(__LINE__, "Operation modules not registered");
+  }
+  ircode_run(pSrc, 0);
+}
+
+/*
+ * main_restart function.
+ */
+void main_restart(void) {
+  m_newline = 1;
+  ircode_restart();
+  profile_restart();
+  driver_restart();
+  op_graph_restart();
 }
 
 /*
@@ -878,11 +786,47 @@ void main_stop(long lnum) {
  * ==================
  */
 
+#ifndef INFRARED_LIBRARY
+
 int main(int argc, char *argv[]) {
   
   int i = 0;
+  int has_fastexit = 0;
+  int has_format = 0;
+  int has_indexstep = 0;
+  int has_irc = 0;
+  int has_log = 0;
+  int has_loglimit = 0;
+  int has_profile = 0;
+  int has_ppq = 0;
+  int has_prune = 0;
+  int use_irc = 0;
+  int fast_exit = 0;
+  int has_threads = 0;
+  int has_watch = 0;
+  int has_window = 0;
+  int has_sections = 0;
+  int32_t sect_lo = 0;
+  int32_t sect_hi = 0;
+  int32_t t_lo = 0;
+  int32_t t_hi = 0;
+  int32_t thread_count = 1;
+  int32_t watch_ms = 0;
+  int32_t profile_count = 0;
+  int32_t index_step = 0;
+  int32_t ppq = MIDI_PPQ_MAX;
+  const char *pBatchPath = NULL;
+  const char *pCachePath = NULL;
+  const char *pInPath = NULL;
+  const char *pIndexPath = NULL;
+  const char *pLivePath = NULL;
   const char *pMapPath = NULL;
+  const char *pOutPath = NULL;
   const char *pScriptPath = NULL;
+  const char *pStatsPath = NULL;
+  char *pIrcPath = NULL;
+  uint64_t script_hash = 0;
+  uint64_t cache_ctx = 0;
   NMF_DATA *pNMF = NULL;
   SNSOURCE *pSrc = NULL;
   FILE *hScript = NULL;
@@ -898,13 +842,17 @@ int main(int argc, char *argv[]) {
   }
   
   /* Register all operation modules */
-  registerModules();
+  main_register();
   
   /* If no program arguments, show help screen and end unsuccessfully */
   if (argc < 2) {
     fprintf(stderr, "Syntax:\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "  infrared [options] [script] < [nmf] > [midi]\n");
+    fprintf(stderr, "  infrared -in [nmf] [options] [script] > [midi]\n");
+    fprintf(stderr, "  infrared -batch [list] [options] [script]\n");
+    fprintf(stderr,
+      "  infrared -watch [ms] -in [nmf] -out [midi] [options] [script]\n");
     fprintf(stderr, "\n");
     exit(EXIT_FAILURE);
   }
@@ -912,7 +860,135 @@ int main(int argc, char *argv[]) {
   /* Interpret any options after the executable module name but before
    * the last parameter */
   for(i = 1; i <= argc - 2; i++) {
-    if (strcmp(argv[i], "-map") == 0) {
+    if (strcmp(argv[i], "-batch") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pBatchPath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -batch program option");
+      }
+      pBatchPath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-cache") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pCachePath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -cache program option");
+      }
+      pCachePath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-fastexit") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_fastexit) {
+        raiseErr(__LINE__, "Redefinition of -fastexit program option");
+      }
+      has_fastexit = 1;
+      if (parseOptInt("-fastexit", argv[i + 1]) > 1) {
+        raiseErr(__LINE__,
+          "Value out of range for -fastexit program option");
+      }
+      fast_exit = (int) parseOptInt("-fastexit", argv[i + 1]);
+      i++;
+      
+    } else if (strcmp(argv[i], "-format") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_format) {
+        raiseErr(__LINE__, "Redefinition of -format program option");
+      }
+      has_format = 1;
+      midi_format((int) parseOptInt("-format", argv[i + 1]));
+      i++;
+      
+    } else if (strcmp(argv[i], "-in") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pInPath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -in program option");
+      }
+      pInPath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-index") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pIndexPath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -index program option");
+      }
+      pIndexPath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-indexstep") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_indexstep) {
+        raiseErr(__LINE__, "Redefinition of -indexstep program option");
+      }
+      has_indexstep = 1;
+      index_step = parseOptInt("-indexstep", argv[i + 1]);
+      i++;
+      
+    } else if (strcmp(argv[i], "-irc") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_irc) {
+        raiseErr(__LINE__, "Redefinition of -irc program option");
+      }
+      has_irc = 1;
+      if (parseOptInt("-irc", argv[i + 1]) > 1) {
+        raiseErr(__LINE__,
+          "Value out of range for -irc program option");
+      }
+      use_irc = (int) parseOptInt("-irc", argv[i + 1]);
+      i++;
+      
+    } else if (strcmp(argv[i], "-live") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pLivePath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -live program option");
+      }
+      pLivePath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-log") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_log) {
+        raiseErr(__LINE__, "Redefinition of -log program option");
+      }
+      has_log = 1;
+      if (parseOptInt("-log", argv[i + 1]) > DIAGNOSTIC_DEBUG) {
+        raiseErr(__LINE__,
+          "Value out of range for -log program option");
+      }
+      diagnostic_level((int) parseOptInt("-log", argv[i + 1]));
+      i++;
+      
+    } else if (strcmp(argv[i], "-loglimit") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_loglimit) {
+        raiseErr(__LINE__, "Redefinition of -loglimit program option");
+      }
+      has_loglimit = 1;
+      diagnostic_limit(parseOptInt("-loglimit", argv[i + 1]));
+      i++;
+      
+    } else if (strcmp(argv[i], "-map") == 0) {
       if (i >= argc - 2) {
         raiseErr(__LINE__, "Program argument syntax error");
       }
@@ -922,32 +998,287 @@ int main(int argc, char *argv[]) {
       pMapPath = argv[i + 1];
       i++;
       
+    } else if (strcmp(argv[i], "-out") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pOutPath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -out program option");
+      }
+      pOutPath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-profile") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_profile) {
+        raiseErr(__LINE__, "Redefinition of -profile program option");
+      }
+      has_profile = 1;
+      profile_count = parseOptInt("-profile", argv[i + 1]);
+      if (profile_count < 1) {
+        raiseErr(__LINE__,
+          "Value out of range for -profile program option");
+      }
+      profile_enable(profile_count);
+      i++;
+      
+    } else if (strcmp(argv[i], "-ppq") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_ppq) {
+        raiseErr(__LINE__, "Redefinition of -ppq program option");
+      }
+      has_ppq = 1;
+      ppq = parseOptInt("-ppq", argv[i + 1]);
+      if ((ppq < MIDI_PPQ_MIN) || (ppq > MIDI_PPQ_MAX)) {
+        raiseErr(__LINE__,
+          "Value out of range for -ppq program option");
+      }
+      midi_division(ppq);
+      i++;
+      
+    } else if (strcmp(argv[i], "-prune") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_prune) {
+        raiseErr(__LINE__, "Redefinition of -prune program option");
+      }
+      has_prune = 1;
+      if (parseOptInt("-prune", argv[i + 1]) > 1) {
+        raiseErr(__LINE__,
+          "Value out of range for -prune program option");
+      }
+      midi_prune((int) parseOptInt("-prune", argv[i + 1]));
+      i++;
+      
+    } else if (strcmp(argv[i], "-sections") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_sections) {
+        raiseErr(__LINE__, "Redefinition of -sections program option");
+      }
+      has_sections = 1;
+      parseOptRange("-sections", argv[i + 1], &sect_lo, &sect_hi);
+      i++;
+      
+    } else if (strcmp(argv[i], "-stats") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (pStatsPath != NULL) {
+        raiseErr(__LINE__, "Redefinition of -stats program option");
+      }
+      pStatsPath = argv[i + 1];
+      i++;
+      
+    } else if (strcmp(argv[i], "-threads") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_threads) {
+        raiseErr(__LINE__, "Redefinition of -threads program option");
+      }
+      has_threads = 1;
+      thread_count = parseOptInt("-threads", argv[i + 1]);
+      if ((thread_count < 1) || (thread_count > DRIVER_WORKER_MAX)) {
+        raiseErr(__LINE__,
+          "Value out of range for -threads program option");
+      }
+      i++;
+      
+    } else if (strcmp(argv[i], "-watch") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_watch) {
+        raiseErr(__LINE__, "Redefinition of -watch program option");
+      }
+      has_watch = 1;
+      watch_ms = parseOptInt("-watch", argv[i + 1]);
+      if ((watch_ms < 1) || (watch_ms > DRIVER_INTERVAL_MAX)) {
+        raiseErr(__LINE__,
+          "Value out of range for -watch program option");
+      }
+      i++;
+      
+    } else if (strcmp(argv[i], "-window") == 0) {
+      if (i >= argc - 2) {
+        raiseErr(__LINE__, "Program argument syntax error");
+      }
+      if (has_window) {
+        raiseErr(__LINE__, "Redefinition of -window program option");
+      }
+      has_window = 1;
+      render_window(parseOptInt("-window", argv[i + 1]));
+      i++;
+      
     } else {
       raiseErr(__LINE__, "Unrecognized program option: %s", argv[i]);
     }
   }
   
+  /* Live output can't be combined with an output file or seek index */
+  if ((pLivePath != NULL) && (pOutPath != NULL)) {
+    raiseErr(__LINE__, "Can't combine -live and -out program options");
+  }
+  if ((pLivePath != NULL) && (pIndexPath != NULL)) {
+    raiseErr(__LINE__, "Can't combine -live and -index program options");
+  }
+  
+  /* The seek index spacing only applies to a seek index */
+  if (has_indexstep && (pIndexPath == NULL)) {
+    raiseErr(__LINE__, "-indexstep program option requires -index");
+  }
+  
+  /* Batch mode writes its own output files, doesn't use the render
+   * cache, and renders every section of each file; otherwise, the
+   * thread count is for importing notes */
+  if (pBatchPath != NULL) {
+    if ((pCachePath != NULL) || (pInPath != NULL) ||
+        (pIndexPath != NULL) || (pLivePath != NULL) ||
+        (pMapPath != NULL) || (pOutPath != NULL) || has_sections ||
+        (pStatsPath != NULL)) {
+      raiseErr(__LINE__,
+        "Can't combine -batch with -cache, -in, -index, -live, -map, "
+        "-out, -sections, or -stats program options");
+    }
+  } else if (has_threads) {
+    render_threads(thread_count);
+    control_threads(thread_count);
+    midi_threads(thread_count);
+  }
+  
+  /* Set up the seek index if requested */
+  if (pIndexPath != NULL) {
+    midi_index(pIndexPath, index_step);
+  }
+  
+  /* Watch mode rereads the NMF file and rewrites the output file, and
+   * does not play live or render batches */
+  if (has_watch) {
+    if ((pInPath == NULL) || (pOutPath == NULL)) {
+      raiseErr(__LINE__, "-watch program option requires -in and -out");
+    }
+    if ((pBatchPath != NULL) || (pLivePath != NULL)) {
+      raiseErr(__LINE__,
+        "Can't combine -watch with -batch or -live program options");
+    }
+  }
+  
   /* Last parameter is the script path */
   pScriptPath = argv[argc - 1];
   
-  /* Parse the input NMF */
-  pNMF = nmf_parse(stdin);
-  if (pNMF == NULL) {
-    raiseErr(__LINE__, "Failed to parse NMF input");
+  /* In watch mode, the rest of the program runs in watch sessions
+   * started by the supervisor, which never returns here itself */
+  if (has_watch) {
+    driver_supervise(pScriptPath, pInPath, watch_ms);
+  }
+  
+  /* Hash the script contents if any cache is keyed to them */
+  if ((pCachePath != NULL) || use_irc) {
+    script_hash = hashFile(pScriptPath, HASH_FNV_BASIS);
+  }
+  
+  /* Determine the path of the compiled script file */
+  if (use_irc) {
+    pIrcPath = (char *) malloc(
+      strlen(pScriptPath) + strlen(IRCODE_EXT) + 1);
+    if (pIrcPath == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    strcpy(pIrcPath, pScriptPath);
+    strcat(pIrcPath, IRCODE_EXT);
   }
   
+  /* Parse the input NMF, which in batch mode is the first file in the
+   * batch list, and otherwise is the -in file or standard input */
+  profile_begin();
+  if (pBatchPath != NULL) {
+    pNMF = driver_batch_load(pBatchPath);
+    
+  } else if (pInPath != NULL) {
+    pNMF = nmf_parse_path(pInPath);
+    if (pNMF == NULL) {
+      raiseErr(__LINE__, "Failed to parse NMF file: %s", pInPath);
+    }
+    
+  } else {
+    pNMF = nmf_parse(stdin);
+    if (pNMF == NULL) {
+      raiseErr(__LINE__, "Failed to parse NMF input");
+    }
+  }
+  profile_end(PROFILE_PARSE);
+  
   /* Initialize the pointer system */
   pointer_init(pNMF);
   
-  /* Open the script file and wrap in a Shastina source */
-  hScript = fopen(pScriptPath, "rb");
-  if (hScript == NULL) {
-    raiseErr(__LINE__, "Failed to open script file: %s", pScriptPath);
+  /* If a section range was selected, restrict rendering to it and set
+   * the MIDI window from the start of the first section to the start of
+   * the section after the last, or to the end of time if the last
+   * section is the final one; otherwise, the whole section range is
+   * used for the section map */
+  if (has_sections) {
+    if (sect_hi >= nmf_sections(pNMF)) {
+      raiseErr(__LINE__,
+        "Section out of range for -sections program option");
+    }
+    
+    if (nmf_offset(pNMF, sect_lo) <= INT32_MAX / 8) {
+      t_lo = nmf_offset(pNMF, sect_lo) * 8;
+    } else {
+      raiseErr(__LINE__, "Subquantum offset overflow");
+    }
+    
+    if (sect_hi < nmf_sections(pNMF) - 1) {
+      if (nmf_offset(pNMF, sect_hi + 1) <= INT32_MAX / 8) {
+        t_hi = nmf_offset(pNMF, sect_hi + 1) * 8;
+      } else {
+        raiseErr(__LINE__, "Subquantum offset overflow");
+      }
+    } else {
+      t_hi = INT32_MAX;
+    }
+    
+    render_sections(sect_lo, sect_hi);
+    midi_window(t_lo, t_hi);
+    
+  } else {
+    sect_lo = 0;
+    sect_hi = nmf_sections(pNMF) - 1;
   }
-  pSrc = snsource_stream(hScript, SNSTREAM_OWNER | SNSTREAM_RANDOM);
   
-  /* Run the Infrared script */
-  runScript(pSrc);
+  /* Run the Infrared script, using the compiled script file if it is
+   * enabled and up to date, or else parsing the script, compiling it
+   * if the compiled script file is enabled */
+  profile_begin();
+  if (use_irc && ircode_load(pIrcPath, script_hash)) {
+    ircode_exec();
+    
+  } else {
+    /* Open the script file and wrap in a Shastina source */
+    hScript = fopen(pScriptPath, "rb");
+    if (hScript == NULL) {
+      raiseErr(__LINE__, "Failed to open script file: %s", pScriptPath);
+    }
+    pSrc = snsource_stream(hScript, SNSTREAM_OWNER | SNSTREAM_RANDOM);
+    
+    ircode_run(pSrc, use_irc);
+    
+    /* Close the Shastina source */
+    snsource_free(pSrc);
+    pSrc = NULL;
+    
+    if (use_irc) {
+      ircode_save(pIrcPath, script_hash);
+    }
+  }
+  profile_end(PROFILE_SCRIPT);
   
   /* If there is a script message that is missing a newline, add it */
   if (!m_newline) {
@@ -955,38 +1286,69 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "\n");
   }
   
-  /* Close the Shastina source */
-  snsource_free(pSrc);
-  pSrc = NULL;
-  
-  /* Render NMF to MIDI */
-  render_nmf(pNMF);
+  /* Report the script profile if requested */
+  profile_report();
   
-  /* Add automatic controller tracking to MIDI */
-  control_track();
+  /* Let the script messages appear before rendering starts */
+  diagnostic_flush();
   
-  /* Generate map file if requested */
-  if (pMapPath != NULL) {
-    compileMap(pNMF, pMapPath);
+  /* Set up the render cache, keyed to the script contents, to the
+   * contents of the data files the script read, to the NMF basis and
+   * section table that the script pointers were resolved against, and
+   * to any time division other than the default, which changes how
+   * short notes are rendered */
+  if (pCachePath != NULL) {
+    cache_ctx = script_hash;
+    for(i = 0; i < driver_inputs(); i++) {
+      cache_ctx = hashFile(driver_input_path(i), cache_ctx);
+    }
+    cache_ctx = hashSections(pNMF, cache_ctx);
+    if (ppq != MIDI_PPQ_MAX) {
+      cache_ctx ^= ((uint64_t) ppq) * UINT64_C(0x9e3779b97f4a7c15);
+    }
+    render_cache(pCachePath, cache_ctx);
   }
   
-  /* Compile MIDI to output */
-  midi_compile(stdout);
+  if (pIrcPath != NULL) {
+    free(pIrcPath);
+    pIrcPath = NULL;
+  }
   
-  /* Shut down modules */
-  art_shutdown();
-  blob_shutdown();
-  core_shutdown();
-  graph_shutdown();
-  pointer_shutdown();
-  ruler_shutdown();
-  set_shutdown();
-  text_shutdown();
+  /* In batch mode, render each listed file from the state the script
+   * left; in watch mode, render the input NMF again whenever it
+   * changes; otherwise, render the input NMF to a single output */
+  if (pBatchPath != NULL) {
+    driver_batch(pNMF, thread_count);
+    
+  } else if (has_watch) {
+    driver_session(pNMF, pScriptPath, pInPath, watch_ms,
+      pMapPath, pOutPath, pStatsPath, (pIndexPath != NULL),
+      sect_lo, sect_hi);
+    
+  } else {
+    driver_render(pNMF, pMapPath, pLivePath, pOutPath, pStatsPath,
+      (pIndexPath != NULL), sect_lo, sect_hi);
+  }
   
-  /* Free NMF object */
-  nmf_free(pNMF);
+  /* Shut down modules and free NMF object, unless a fast exit was
+   * requested */
+  if (!fast_exit) {
+    art_shutdown();
+    blob_shutdown();
+    core_shutdown();
+    graph_shutdown();
+    pointer_shutdown();
+    ruler_shutdown();
+    set_shutdown();
+    text_shutdown();
+    
+    driver_restart();
+    nmf_free(pNMF);
+  }
   pNMF = NULL;
   
   /* If we got here, return successfully */
   return EXIT_SUCCESS;
 }
+
+#endif
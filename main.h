@@ -15,6 +15,8 @@
 
 #include "core.h"
 
+#include "shastina.h"
+
 /*
  * Function pointer types
  * ======================
@@ -142,11 +144,74 @@ void main_newline(void);
  * 
  * The given line number is the script line number the stop request
  * originated from.  Values that are out range will be replaced with -1.
- *
+ * 
  * Parameters:
  * 
  *   lnum - the Shastina line number where the print occurred
  */
 void main_stop(long lnum);
 
+/*
+ * Record the path of a data file that the script reads.
+ * 
+ * This function may only be used during script interpretation.  It is
+ * intended for operations that load data from files, which should call
+ * it with the path of each file before reading it.  The contents of the
+ * recorded files are part of the context hash of the render cache, so
+ * that cached sections are not reused after a data file changes.  A
+ * path that has already been recorded is not recorded again.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path of the data file
+ */
+void main_input(const char *pPath);
+
+/*
+ * Get the executable module name for messages.
+ * 
+ * Return:
+ * 
+ *   the module name, which is "infrared" if the program entrypoint has
+ *   not set it
+ */
+const char *main_module(void);
+
+/*
+ * Register the operations of all the built-in operation modules with
+ * the script interpreter.
+ * 
+ * Only the first call has any effect.  The program entrypoint does this
+ * at startup.  Programs that embed Infrared through the library API
+ * must do this before using main_script().
+ */
+void main_register(void);
+
+/*
+ * Interpret an Infrared script read from a Shastina source.
+ * 
+ * main_register() must have been called first.  The script runs
+ * against the current state of the other modules, and the core module
+ * is shut down at the end of the script, which checks that the script
+ * left the interpreter in a valid end-state.  The source is not
+ * released.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the Shastina source to read the script from
+ */
+void main_script(SNSOURCE *pSrc);
+
+/*
+ * Return the main module to the state it has before any script has
+ * run, clearing the print state, the list of data files recorded with
+ * main_input(), and any partially compiled script.  The script parser
+ * and any buffers that operations were holding when a script stopped
+ * with an error are released.
+ * 
+ * The registered operations are kept.  The library API does this along
+ * with restarting all the other modules before it runs another script.
+ */
+void main_restart(void);
+
 #endif
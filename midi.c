@@ -7,13 +7,23 @@
  * See header for further information.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include "midi.h"
 
 #include <limits.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
 #include "diagnostic.h"
 #include "pointer.h"
 
@@ -47,14 +57,44 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 #define H_INIT_CAP  (16)
 #define H_MAX_CAP   (16384)
 
+/*
+ * The capacity of the handle deduplication table, which must be a power
+ * of two.  This is twice the maximum capacity of the handle table, so
+ * that the deduplication table is never more than half full.
+ */
+#define H_DEDUP_CAP (32768)
+
+/*
+ * The number of entries in the handle pointer cache, which must be a
+ * power of two.
+ */
+#define H_PTR_CACHE (64)
+
 /*
  * The initial and maximum capacities of the message buffer.
- * 
- * The maximum capacity can't go beyond 16777215 because selectors only
- * have 24 bits for byte offsets in the message buffer.
  */
 #define MSG_INIT_CAP  (4096)
-#define MSG_MAX_CAP   INT32_C(16777215)
+#define MSG_MAX_CAP   INT32_MAX
+
+/*
+ * Layout of message selectors.
+ * 
+ * The status byte is stored in bits 32 to 39.  For channel messages,
+ * which have status bytes in range 0x80 to 0xEF inclusive, the first
+ * data byte is stored in bits 8 to 15 and the second data byte (if
+ * there is one) in bits 0 to 7.  For all other messages, the least
+ * significant 32 bits hold the byte offset in the message buffer.
+ */
+#define SEL_STATUS_SHIFT  (32)
+#define SEL_DATA1_SHIFT   (8)
+#define SEL_OFFSET_MASK   UINT64_C(0xffffffff)
+
+/*
+ * The initial and maximum capacities of the intern table, which must be
+ * powers of two.
+ */
+#define INTERN_INIT_CAP (256)
+#define INTERN_MAX_CAP  (INT32_C(1) << 28)
 
 /*
  * The initial and maximum capacities of the header buffer.
@@ -63,10 +103,105 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 #define HEAD_MAX_CAP  (16384)
 
 /*
- * The initial and maximum capacities of the moment buffer.
+ * The moment buffer is stored in fixed-size chunks while messages are
+ * being entered.  MOMENT_CHUNK_SHIFT is the base-2 logarithm of the
+ * number of records in each chunk.  The chunk directory has an initial
+ * and maximum capacity in chunks.
+ */
+#define MOMENT_CHUNK_SHIFT  (16)
+#define MOMENT_CHUNK_LEN    (INT32_C(1) << MOMENT_CHUNK_SHIFT)
+#define MOMENT_DIR_INIT_CAP (16)
+#define MOMENT_DIR_MAX_CAP  (16384)
+
+/*
+ * The maximum capacity of the moment buffer in records.
+ */
+#define MOMENT_MAX_CAP (MOMENT_CHUNK_LEN * MOMENT_DIR_MAX_CAP)
+
+/*
+ * Layout of the 40-bit moment sort keys computed by momentKey().
+ * 
+ * The moment offset biased to be unsigned is in the most significant
+ * 32 bits, followed by one bit for the status class and seven bits for
+ * the status group.
+ */
+#define KEY_BITS          (40)
+#define KEY_T_SHIFT       (8)
+#define KEY_CLASS_SHIFT   (7)
+
+/*
+ * The number of bits sorted in each pass of the moment radix sort, and
+ * the number of buckets in each pass.
+ */
+#define RADIX_BITS  (8)
+#define RADIX_SIZE  (256)
+
+/*
+ * The number of radix sort passes, which cover all the bits of moment
+ * sort keys.
+ */
+#define RADIX_PASSES (KEY_BITS / RADIX_BITS)
+
+/*
+ * The maximum number of tracks in a MIDI file, which is one conductor
+ * track plus one track for each MIDI channel.
  */
-#define MOMENT_INIT_CAP (1024)
-#define MOMENT_MAX_CAP  INT32_C(8388608)
+#define TRACK_MAX (MIDI_CH_MAX + 1)
+
+/*
+ * The number of subquantum units per quarter note, which is also the
+ * default number of delta time units per quarter note in the generated
+ * MIDI file, and the default tempo in microseconds per quarter note
+ * that applies until the first tempo meta-event.
+ */
+#define DELTA_PER_QUARTER (MIDI_PPQ_MAX)
+#define DEFAULT_TEMPO     INT32_C(500000)
+
+/*
+ * The initial and maximum capacities of the output buffer in bytes.
+ */
+#define OUT_INIT_CAP INT32_C(65536)
+#define OUT_MAX_CAP  INT32_C(1073741824)
+
+/*
+ * The minimum number of moment buffer records in each chunk of a track
+ * that is encoded on a worker thread.  Tracks with fewer than two
+ * chunks of records are encoded on the calling thread.
+ */
+#define ENCODE_CHUNK_MIN (INT32_C(1) << 16)
+
+/*
+ * The signature at the start of seek index files, and its length in
+ * bytes.
+ */
+#define INDEX_SIGNATURE     "IRSX0001"
+#define INDEX_SIGNATURE_LEN (8)
+
+/*
+ * The initial and maximum capacities of the seek index buffer in bytes.
+ */
+#define INDEX_INIT_CAP INT32_C(4096)
+#define INDEX_MAX_CAP  INT32_C(1073741824)
+
+/*
+ * The initial and maximum capacities of the seek index mark table.
+ */
+#define MARK_INIT_CAP (64)
+#define MARK_MAX_CAP  (INT32_C(1) << 24)
+
+/*
+ * The results of windowMsg().
+ */
+#define WIN_DROP  (0)
+#define WIN_KEEP  (1)
+#define WIN_CLAMP (2)
+
+/*
+ * The kinds of parameter number tracked by the redundant event
+ * elimination pass.
+ */
+#define PRUNE_PARAM_REG    (0)
+#define PRUNE_PARAM_NONREG (1)
 
 /*
  * Type declarations
@@ -94,6 +229,91 @@ typedef struct {
   
 } HANDLE_ENTRY;
 
+/*
+ * Record format for the handle deduplication table.
+ */
+typedef struct {
+  
+  /*
+   * The handle table index, or -1 if this slot of the table is empty.
+   */
+  int32_t h;
+  
+  /*
+   * The hash of the payload of the handle, as computed by hashH().
+   */
+  uint32_t hash;
+  
+} HDEDUP_ENTRY;
+
+/*
+ * Record format for the handle pointer cache.
+ */
+typedef struct {
+  
+  /*
+   * The blob or text pointer, or NULL if this entry is empty.
+   */
+  const void *p;
+  
+  /*
+   * The handle table index of the pointer.
+   */
+  int32_t h;
+  
+} HPTR_ENTRY;
+
+/*
+ * Channel state tracked by the redundant event elimination pass.
+ * 
+ * Each field is the last value sent on each MIDI channel (zero-indexed)
+ * or -1 if the value is unknown.  ctl holds controller values, poly
+ * holds polyphonic aftertouch values for each key, and bend holds the
+ * 14-bit pitch bend value.
+ * 
+ * The selected parameter number is tracked apart from the controllers,
+ * since registered and non-registered parameter numbers share a single
+ * selection on receivers.  pkind is PRUNE_PARAM_REG or
+ * PRUNE_PARAM_NONREG for the kind that was selected last, and pmsb and
+ * plsb are the MSB and LSB of the parameter number of that kind.  dmsb
+ * and dlsb are the last data entry MSB and LSB sent to that parameter.
+ */
+typedef struct {
+  int16_t ctl[MIDI_CH_MAX][128];
+  int16_t poly[MIDI_CH_MAX][128];
+  int16_t prog[MIDI_CH_MAX];
+  int16_t pres[MIDI_CH_MAX];
+  int16_t bend[MIDI_CH_MAX];
+  int16_t pkind[MIDI_CH_MAX];
+  int16_t pmsb[MIDI_CH_MAX];
+  int16_t plsb[MIDI_CH_MAX];
+  int16_t dmsb[MIDI_CH_MAX];
+  int16_t dlsb[MIDI_CH_MAX];
+} PRUNE_STATE;
+
+/*
+ * Record format for the intern table.
+ */
+typedef struct {
+  
+  /*
+   * The byte offset of the interned message data in the message
+   * buffer, or -1 if this slot of the table is empty.
+   */
+  int32_t off;
+  
+  /*
+   * The length in bytes of the interned message data.
+   */
+  int32_t len;
+  
+  /*
+   * The hash of the interned message data.
+   */
+  uint32_t hash;
+  
+} INTERN_ENTRY;
+
 /*
  * Record format for the moment buffer.
  */
@@ -116,13 +336,65 @@ typedef struct {
   /*
    * The message selector.
    * 
-   * The most significant 8 bits are the status byte of the MIDI
-   * message.  The lower 24 bits are a byte offset into the byte buffer.
+   * Bits 32 to 39 are the status byte of the MIDI message.  The lower
+   * 32 bits are a byte offset into the byte buffer.
    */
-  uint32_t sel;
+  uint64_t sel;
   
 } MOMENT;
 
+/*
+ * Job for a worker thread that encodes a chunk of a track.
+ */
+typedef struct {
+  
+  /*
+   * The index of the first moment buffer record in the chunk.
+   */
+  int32_t lo;
+  
+  /*
+   * One greater than the index of the last record in the chunk.
+   */
+  int32_t hi;
+  
+  /*
+   * The time in delta time units of the message before the chunk, from
+   * the lower bound of the event range.
+   */
+  int32_t prev_t;
+  
+  /*
+   * The running status byte before the chunk, which the worker updates
+   * to the running status byte after the chunk.
+   */
+  int rstatus;
+  
+  /*
+   * The dynamically allocated buffer holding the encoded chunk, with
+   * its capacity and the length of the encoded chunk in bytes.
+   */
+  uint8_t *pBuf;
+  int32_t cap;
+  int32_t len;
+  
+  /*
+   * Non-zero if the job raised an error.
+   */
+  int fault;
+  
+  /*
+   * The worker thread running this job.
+   */
+  pthread_t thread;
+  
+  /*
+   * The error trap for the worker thread.
+   */
+  jmp_buf trap;
+  
+} ENCODE_JOB;
+
 /*
  * Local data
  * ==========
@@ -133,6 +405,87 @@ typedef struct {
  */
 static int m_compiled = 0;
 
+/*
+ * Statistics reported by midi_stats().
+ * 
+ * The peak capacities are updated by statPeaks() before buffers are
+ * released, while the counts are updated as messages are added and
+ * pruned.
+ */
+static MIDI_STATS m_stats;
+
+/*
+ * The MIDI file format to compile, either 0 or 1.
+ */
+static int m_format = 0;
+
+/*
+ * The time division to compile, in delta time units per quarter note.
+ * 
+ * If this is less than DELTA_PER_QUARTER, subquantum offsets are
+ * rounded to the coarser division by quantize() when the moment buffer
+ * is sorted and encoded.
+ */
+static int32_t m_ppq = DELTA_PER_QUARTER;
+
+/*
+ * Flag indicating whether the redundant event elimination pass is run
+ * before encoding.
+ */
+static int m_prune = 0;
+
+/*
+ * The number of threads used to encode each track.
+ * 
+ * One means all tracks are encoded on the calling thread.
+ */
+static int m_threads = 1;
+
+/*
+ * The seek index options set with midi_index().
+ * 
+ * m_idx_path is a dynamically allocated copy of the seek index path,
+ * or NULL if no seek index is generated.  m_idx_step is the spacing of
+ * seek points in delta time units, or zero.
+ */
+static char *m_idx_path = NULL;
+static int32_t m_idx_step = 0;
+
+/*
+ * The seek index mark table.
+ * 
+ * Holds the subquantum offsets added with midi_index_mark().  When the
+ * MIDI file is encoded, prepareIndex() converts them into delta time
+ * units from the lower bound of the event range and sorts them.
+ */
+static int32_t m_mark_cap = 0;
+static int32_t m_mark_len = 0;
+static int32_t *m_mark = NULL;
+
+/*
+ * The seek index buffer.
+ * 
+ * While the MIDI file is encoded, the seek points are appended to this
+ * buffer of m_idx_cap bytes, of which m_idx_len have been written, and
+ * m_idx_count is the number of seek points.  See midi_index() for the
+ * format.
+ */
+static uint8_t *m_idx = NULL;
+static int32_t m_idx_cap = 0;
+static int32_t m_idx_len = 0;
+static int32_t m_idx_count = 0;
+
+/*
+ * The output window set with midi_window().
+ * 
+ * If m_win is non-zero, only moment buffer events with subquantum
+ * offsets at least m_win_lo and less than m_win_hi are kept, subject
+ * to the exceptions described at midi_window().
+ */
+static int m_win = 0;
+static int32_t m_win_lo = 0;
+static int32_t m_win_hi = 0;
+
 /*
  * The handle table.
  * 
@@ -148,6 +501,27 @@ static int32_t m_h_cap = 0;
 static int32_t m_h_len = 0;
 static HANDLE_ENTRY *m_h = NULL;
 
+/*
+ * The handle deduplication table.
+ * 
+ * This is an open-addressing hash table with linear probing that
+ * indexes all the records of the handle table by the type and content
+ * of their payloads, so that repeated payloads share a single handle.
+ * It has H_DEDUP_CAP records and is allocated on first use.
+ */
+static HDEDUP_ENTRY *m_hdedup = NULL;
+
+/*
+ * The handle pointer cache.
+ * 
+ * This is a direct-mapped cache from blob and text pointers to handle
+ * table indices, which allows payloads that are recorded repeatedly
+ * through the same object to skip hashing the payload.  Blobs and text
+ * objects are never released before the MIDI module, so pointers are
+ * unique for the whole run.
+ */
+static HPTR_ENTRY m_hptr[H_PTR_CACHE];
+
 /*
  * The event ID assignment variable.
  * 
@@ -177,19 +551,14 @@ static int32_t m_upper = 0;
  * The message buffer.
  * 
  * This contains message data that is referred to from selectors in the
- * header buffer and moment buffer.  The selectors store a byte offset
- * into this buffer in their 24 least significant bits.
+ * header buffer and moment buffer, except for channel messages, which
+ * store their data bytes in the selector itself.  The other selectors
+ * store a byte offset into this buffer in their 32 least significant
+ * bits.  Message data is interned with internMsg(), so selectors for
+ * messages with identical data share the same offset.
  * 
  * The format of the data in the message buffer depends on the status
- * byte that is stored in the 8 most significant bits of the selector.
- * 
- * For status bytes in range 0x80 to 0xBF inclusive and 0xE0 to 0xEF
- * inclusive, there are two data bytes in the message buffer that should
- * be appended to the status byte in the selector.
- * 
- * For status bytes in range 0xC0 to 0xDF inclusive, there is one data
- * byte in the message buffer that should be appended to the status byte
- * in the selector.
+ * byte that is stored in bits 32 to 39 of the selector.
  * 
  * For status bytes 0xF0 and 0xF7, the byte buffer contains a MIDI
  * variable-length integer that encodes an index in the handle table
@@ -209,6 +578,20 @@ static int32_t m_msg_cap = 0;
 static int32_t m_msg_len = 0;
 static uint8_t *m_msg = NULL;
 
+/*
+ * The intern table.
+ * 
+ * This is an open-addressing hash table with linear probing that
+ * indexes all the message data in the message buffer by content.
+ * 
+ * The fields here are the current capacity as a record count, which is
+ * always a power of two, the number of records actually in use, and a
+ * pointer to the dynamically allocated record array.
+ */
+static int32_t m_intern_cap = 0;
+static int32_t m_intern_len = 0;
+static INTERN_ENTRY *m_intern = NULL;
+
 /*
  * The header buffer.
  * 
@@ -226,7 +609,7 @@ static uint8_t *m_msg = NULL;
  */
 static int32_t m_head_cap = 0;
 static int32_t m_head_len = 0;
-static uint32_t *m_head = NULL;
+static uint64_t *m_head = NULL;
 
 /*
  * The moment buffer.
@@ -234,10 +617,22 @@ static uint32_t *m_head = NULL;
  * Be sure to update the m_lower and m_upper event range values when
  * entering events into this buffer, and also to set m_filled.
  * 
- * The fields here are the current capacity as a record count, the
- * number of records actually in use, and a pointer to the dynamically
- * allocated record array.
+ * While messages are being entered, records are stored in a directory
+ * of chunks that each hold MOMENT_CHUNK_LEN records, so that growing
+ * the buffer never needs to move existing records.  The fields for the
+ * directory are its capacity in chunks, the number of chunks allocated,
+ * and a pointer to the dynamically allocated array of chunk pointers.
+ * 
+ * When the MIDI file is compiled, prepareTracks() moves all records
+ * into the single array m_moment, releasing the chunks.
+ * 
+ * The remaining fields are the current capacity as a record count and
+ * the number of records actually in use.
  */
+static int32_t m_dir_cap = 0;
+static int32_t m_dir_len = 0;
+static MOMENT **m_dir = NULL;
+
 static int32_t m_moment_cap = 0;
 static int32_t m_moment_len = 0;
 static MOMENT *m_moment = NULL;
@@ -253,188 +648,399 @@ static MOMENT *m_moment = NULL;
  */
 static int m_rstatus = 0;
 
+/*
+ * The output buffer.
+ * 
+ * While a MIDI file is being encoded, m_out points to a buffer of
+ * m_out_cap bytes that receives the encoded file, and m_out_len is the
+ * number of bytes that have been written so far.  The buffer grows as
+ * needed with capOut().  m_out is NULL when no encoding is in progress.
+ * 
+ * If m_out_fd is -1, the buffer is allocated memory.  Otherwise, it is
+ * the descriptor of the output file, and the buffer is the output file
+ * mapped into memory, with the file length equal to the capacity.
+ * 
+ * m_out_tmp is the dynamically allocated path of the temporary file
+ * that midi_compile_path() encodes into before renaming it over the
+ * target, or NULL if there is none.
+ */
+static uint8_t *m_out = NULL;
+static int32_t m_out_cap = 0;
+static int32_t m_out_len = 0;
+static int m_out_fd = -1;
+static char *m_out_tmp = NULL;
+
 /*
  * Local functions
  * ===============
  */
 
 /* Prototypes */
-static void writeByte(FILE *pOut, int c);
-static void writeBinary(FILE *pOut, const uint8_t *pData, int32_t len);
+static void mapOut(int32_t cap);
+static void openOut(int fd);
+static void capOut(int32_t n);
 
-static void writeString(FILE *pOut, const char *pStr);
-static void writeUint32BE(FILE *pOut, uint32_t val);
-static void writeUint16BE(FILE *pOut, uint16_t val);
+static void writeByte(int c);
+static void writeBinary(const uint8_t *pData, int32_t len);
+
+static void writeString(const char *pStr);
+static void writeUint32BE(uint32_t val);
+static void writeUint16BE(uint16_t val);
 
 static int encodeVInt(uint8_t *pBuf, int32_t val);
 static int decodeVInt(const uint8_t *pBuf, int32_t *pVal, int32_t lim);
-static void printVInt(FILE *pOut, int32_t val);
+static void printVInt(int32_t val);
 
 static void capH(int32_t n);
+static uint32_t hashH(int is_blob, const uint8_t *pData, int32_t len);
+static int32_t addH(int is_blob, const void *p,
+                    const uint8_t *pData, int32_t len);
 static int32_t addBlobH(BLOB *pBlob);
 static int32_t addTextH(TEXT *pText);
 
 static int32_t eventID(void);
 static void eventRange(int32_t t);
+static int windowMsg(int32_t t, uint64_t sel);
+static void clampWindow(void);
 
 static void capMsg(int32_t n);
-static uint32_t addMsg1(int status, int b);
-static uint32_t addMsg2(int status, int b1, int b2);
-static uint32_t addMsgB(int status, BLOB *pBlob);
-static uint32_t addMsgMB(int status, int ty, BLOB *pBlob);
-static uint32_t addMsgMT(int status, int ty, TEXT *pText);
-static uint32_t addMsgMD(
+static uint32_t hashMsg(int32_t off, int32_t len);
+static void growIntern(void);
+static int32_t internMsg(int32_t off);
+static uint64_t addMsg1(int status, int b);
+static uint64_t addMsg2(int status, int b1, int b2);
+static uint64_t addMsgB(int status, BLOB *pBlob);
+static uint64_t addMsgMB(int status, int ty, BLOB *pBlob);
+static uint64_t addMsgMT(int status, int ty, TEXT *pText);
+static uint64_t addMsgMD(
           int       status,
           int       ty,
     const uint8_t * pData,
           int32_t   len);
 
-static void printMsg(FILE *pOut, uint32_t sel);
-static int32_t sizeMsg(uint32_t sel, uint32_t prev);
+static int32_t packMsg(
+    uint8_t  * pBuf,
+    int32_t    avail,
+    uint64_t   sel,
+    int      * pRStatus);
+static void printMsg(uint64_t sel);
 
 static void capHead(int32_t n);
-static void addHeadMsg(uint32_t sel);
+static void addHeadMsg(uint64_t sel);
 
 static void capMoment(int32_t n);
-static void addMomentMsg(int32_t t, uint32_t sel);
+static int addMomentMsg(int32_t t, uint64_t sel);
+
+static int32_t quantize(int32_t s);
+static int32_t quantizeMoment(int32_t m);
+static uint64_t momentKey(const MOMENT *pm);
+static void sortMoments(int32_t lo, int32_t hi);
 
-static int cmpMoment(const void *pA, const void *pB);
+static int trackOf(uint64_t sel);
+static void prepareTracks(int32_t *pStart);
+static void pruneReset(PRUNE_STATE *ps, int ch);
+static int pruneMsg(PRUNE_STATE *ps, uint64_t sel);
+static int32_t pruneTrack(int tr, int32_t lo, int32_t hi, int32_t *pStart);
+static int32_t momentTicks(int32_t i);
+static void assembleHandles(void);
+static void capJob(ENCODE_JOB *pj, int32_t n);
+static void *encodeWorker(void *pArg);
+static int encodeChunks(int32_t lo, int32_t hi);
+static void capIndex(int32_t n);
+static void indexPut(uint32_t val, int bytes);
+static void capMark(int32_t n);
+static int cmpMark(const void *pA, const void *pB);
+static void prepareIndex(void);
+static int32_t nextTarget(int32_t after, int32_t *pMark);
+static void indexPoint(
+    int                 tr,
+    int32_t             t,
+    int32_t             prev_t,
+    const PRUNE_STATE * ps);
+static void writeIndex(void);
+static void encodeTrack(int tr, int32_t lo, int32_t hi, uint64_t eot);
+static void encodeFile(void);
+static int32_t liveTempo(uint64_t sel, int32_t tempo);
+static void liveWait(const struct timespec *pStart, int64_t us);
+static void liveSystem(uint64_t sel);
+static void playLive(FILE *pOut);
+static void statPeaks(void);
+static void releaseAll(void);
 
 /*
- * Write an unsigned byte value to the output file.
+ * Map the output file into memory as the output buffer, after setting
+ * the length of the file to the given capacity.
  * 
- * This is one of the two low-level output functions, the other being
- * writeBinary().
+ * The output buffer must be in file mode and must not currently be
+ * mapped.  Any data already in the file within the new capacity is
+ * preserved.
  * 
  * Parameters:
  * 
- *   pOut - the file
- *   
- *   c - the unsigned byte value (0-255)
+ *   cap - the new capacity of the output buffer
  */
-static void writeByte(FILE *pOut, int c) {
-  if (pOut == NULL) {
+static void mapOut(int32_t cap) {
+  
+  void *pMap = NULL;
+  
+  /* Check state and parameters */
+  if ((m_out_fd < 0) || (m_out != NULL)) {
     raiseErr(__LINE__, NULL);
   }
-  if ((c < 0) || (c > 255)) {
+  if (cap < 1) {
     raiseErr(__LINE__, NULL);
   }
-  if (putc(c, pOut) != c) {
+  
+  /* Set the file length and map it */
+  if (ftruncate(m_out_fd, (off_t) cap)) {
     raiseErr(__LINE__, "I/O error during output");
   }
+  
+  pMap = mmap(
+            NULL,
+            (size_t) cap,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            m_out_fd,
+            0);
+  if (pMap == MAP_FAILED) {
+    raiseErr(__LINE__, "Failed to map output file");
+  }
+  
+  m_out = (uint8_t *) pMap;
+  m_out_cap = cap;
 }
 
 /*
- * Write a binary string to the output file.
- * 
- * This is one of the two low-level output functions, the other being
- * writeByte().
+ * Open the output buffer at its initial capacity.
  * 
- * The length in bytes must be zero or greater.  If zero, the function
- * does nothing.
+ * If fd is -1, the output buffer will be allocated memory.  Otherwise,
+ * fd is the descriptor of an open output file that was created or
+ * truncated for reading and writing, and the output buffer will be the
+ * file mapped into memory.
  * 
  * Parameters:
  * 
- *   pOut - the file
- * 
- *   pData - the data to write
- * 
- *   len - the number of bytes to write
+ *   fd - the output file descriptor, or -1 for memory
  */
-static void writeBinary(FILE *pOut, const uint8_t *pData, int32_t len) {
-  if (len < 0) {
+static void openOut(int fd) {
+  
+  /* Check state and parameters */
+  if (m_out != NULL) {
     raiseErr(__LINE__, NULL);
   }
-  if (len > 0) {
-    if ((pOut == NULL) || (pData == NULL)) {
-      raiseErr(__LINE__, NULL);
-    }
-    if (fwrite(pData, 1, (size_t) len, pOut) != len) {
-      raiseErr(__LINE__, "I/O error during output");
+  if (fd < -1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Allocate or map the initial buffer */
+  m_out_fd = fd;
+  m_out_len = 0;
+  
+  if (fd < 0) {
+    m_out = (uint8_t *) malloc((size_t) OUT_INIT_CAP);
+    if (m_out == NULL) {
+      raiseErr(__LINE__, "Out of memory");
     }
+    m_out_cap = OUT_INIT_CAP;
+    
+  } else {
+    mapOut(OUT_INIT_CAP);
   }
 }
 
 /*
- * Write a nul-terminated string to the output file, not including the
- * terminating nul.
- * 
- * This is a wrapper around writeBinary().  If the string starts
- * immediately with the terminating nul, nothing is written.
- * 
- * Parameters:
+ * Make room in capacity for a given number of bytes in the output
+ * buffer.
  * 
- *   pOut - the file
+ * n is the number of additional bytes beyond current length to make
+ * room for.  It must be zero or greater.
  * 
- *   pStr - the nul-terminated string
- */
-static void writeString(FILE *pOut, const char *pStr) {
-  if ((pOut == NULL) || (pStr == NULL)) {
-    raiseErr(__LINE__, NULL);
-  }
-  writeBinary(pOut, (const uint8_t *) pStr, (int32_t) strlen(pStr));
-}
-
-/*
- * Write a 32-bit unsigned integer to the output file in big endian
- * order.
+ * Upon return, the capacity will be at least n bytes higher than the
+ * current length.
  * 
- * This is a wrapper around writeByte().
+ * An error occurs if the requested expansion would go beyond the
+ * maximum allowed capacity.
  * 
  * Parameters:
  * 
- *   pOut - the file
- * 
- *   val - the value to write
+ *   n - the number of bytes to make room for
  */
-static void writeUint32BE(FILE *pOut, uint32_t val) {
+static void capOut(int32_t n) {
   
-  int c1 = 0;
-  int c2 = 0;
-  int c3 = 0;
-  int c4 = 0;
+  int32_t target = 0;
+  int32_t new_cap = 0;
   
-  if (pOut == NULL) {
+  /* Check state and parameters */
+  if (m_out == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (n < 0) {
     raiseErr(__LINE__, NULL);
   }
   
-  c1 = (int)  (val >> 24)        ;
-  c2 = (int) ((val >> 16) & 0xff);
-  c3 = (int) ((val >>  8) & 0xff);
-  c4 = (int) ( val        & 0xff);
+  /* Compute target length */
+  if (n <= INT32_MAX - m_out_len) {
+    target = m_out_len + n;
+  } else {
+    raiseErr(__LINE__, "Compiled MIDI file too large");
+  }
   
-  writeByte(pOut, c1);
-  writeByte(pOut, c2);
-  writeByte(pOut, c3);
-  writeByte(pOut, c4);
+  /* Only proceed if target length exceeds current capacity */
+  if (target > m_out_cap) {
+    /* Check that target within maximum capacity */
+    if (target > OUT_MAX_CAP) {
+      raiseErr(__LINE__, "Compiled MIDI file too large");
+    }
+    
+    /* Compute new capacity by doubling current capacity until greater
+     * than or equal to target length, and then limiting to maximum
+     * capacity */
+    new_cap = m_out_cap;
+    while (new_cap < target) {
+      if (new_cap <= OUT_MAX_CAP / 2) {
+        new_cap *= 2;
+      } else {
+        new_cap = OUT_MAX_CAP;
+      }
+    }
+    
+    /* Expand capacity */
+    if (m_out_fd < 0) {
+      m_out = (uint8_t *) realloc(m_out, (size_t) new_cap);
+      if (m_out == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      m_out_cap = new_cap;
+      
+    } else {
+      if (munmap(m_out, (size_t) m_out_cap)) {
+        raiseErr(__LINE__, "I/O error during output");
+      }
+      m_out = NULL;
+      mapOut(new_cap);
+    }
+  }
+}
+
+/*
+ * Write an unsigned byte value to the output buffer.
+ * 
+ * This is one of the two low-level output functions, the other being
+ * writeBinary().
+ * 
+ * Parameters:
+ * 
+ *   c - the unsigned byte value (0-255)
+ */
+static void writeByte(int c) {
+  if ((c < 0) || (c > 255)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (m_out_len >= m_out_cap) {
+    capOut(1);
+  }
+  m_out[m_out_len] = (uint8_t) c;
+  m_out_len++;
+}
+
+/*
+ * Write a binary string to the output buffer.
+ * 
+ * This is one of the two low-level output functions, the other being
+ * writeByte().
+ * 
+ * The length in bytes must be zero or greater.  If zero, the function
+ * does nothing.
+ * 
+ * Parameters:
+ * 
+ *   pData - the data to write
+ * 
+ *   len - the number of bytes to write
+ */
+static void writeBinary(const uint8_t *pData, int32_t len) {
+  if (len < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (len > 0) {
+    if (pData == NULL) {
+      raiseErr(__LINE__, NULL);
+    }
+    if (len > m_out_cap - m_out_len) {
+      capOut(len);
+    }
+    memcpy(&(m_out[m_out_len]), pData, (size_t) len);
+    m_out_len += len;
+  }
+}
+
+/*
+ * Write a nul-terminated string to the output buffer, not including the
+ * terminating nul.
+ * 
+ * This is a wrapper around writeBinary().  If the string starts
+ * immediately with the terminating nul, nothing is written.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the nul-terminated string
+ */
+static void writeString(const char *pStr) {
+  if (pStr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  writeBinary((const uint8_t *) pStr, (int32_t) strlen(pStr));
 }
 
 /*
- * Write a 16-bit unsigned integer to the output file in big endian
+ * Write a 32-bit unsigned integer to the output buffer in big endian
  * order.
  * 
  * This is a wrapper around writeByte().
  * 
  * Parameters:
  * 
- *   pOut - the file
- * 
  *   val - the value to write
  */
-static void writeUint16BE(FILE *pOut, uint16_t val) {
+static void writeUint32BE(uint32_t val) {
   
   int c1 = 0;
   int c2 = 0;
+  int c3 = 0;
+  int c4 = 0;
   
-  if (pOut == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
+  c1 = (int)  (val >> 24)        ;
+  c2 = (int) ((val >> 16) & 0xff);
+  c3 = (int) ((val >>  8) & 0xff);
+  c4 = (int) ( val        & 0xff);
+  
+  writeByte(c1);
+  writeByte(c2);
+  writeByte(c3);
+  writeByte(c4);
+}
+
+/*
+ * Write a 16-bit unsigned integer to the output buffer in big endian
+ * order.
+ * 
+ * This is a wrapper around writeByte().
+ * 
+ * Parameters:
+ * 
+ *   val - the value to write
+ */
+static void writeUint16BE(uint16_t val) {
+  
+  int c1 = 0;
+  int c2 = 0;
   
   c1 = (int) (val >>    8);
   c2 = (int) (val &  0xff);
   
-  writeByte(pOut, c1);
-  writeByte(pOut, c2);
+  writeByte(c1);
+  writeByte(c2);
 }
 
 /*
@@ -592,33 +1198,28 @@ static int sizeVInt(int32_t val) {
 }
 
 /*
- * Print an encoded MIDI variable-length integer to an output file.
+ * Print an encoded MIDI variable-length integer to the output buffer.
  * 
  * The given integer value must be in range zero to 0x0FFFFFFF.  This
  * function is a wrapper around encodeVInt() and writeBinary().
  * 
  * Parameters:
  * 
- *   pOut - the file to write
- * 
  *   val - the integer value to encode
  */
-static void printVInt(FILE *pOut, int32_t val) {
+static void printVInt(int32_t val) {
   
   uint8_t buf[4];
   int len = 0;
   
   memset(buf, 0, 4);
   
-  if (pOut == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
   if ((val < 0) || (val > INT32_C(0x0FFFFFFF))) {
     raiseErr(__LINE__, NULL);
   }
   
   len = encodeVInt(buf, val);
-  writeBinary(pOut, buf, (int32_t) len);
+  writeBinary(buf, (int32_t) len);
 }
 
 /*
@@ -706,8 +1307,153 @@ static void capH(int32_t n) {
 }
 
 /*
- * Add a blob handle to the handle table and return the handle table
- * index of the blob that was just added.
+ * Compute the hash of a handle payload.
+ * 
+ * This is the 32-bit FNV-1a hash of the is_blob flag as a single byte
+ * followed by the payload bytes, so that blobs and text with the same
+ * bytes do not share a handle.
+ * 
+ * Parameters:
+ * 
+ *   is_blob - non-zero for a blob payload, zero for a text payload
+ * 
+ *   pData - the payload bytes
+ * 
+ *   len - the length in bytes of the payload
+ * 
+ * Return:
+ * 
+ *   the hash of the payload
+ */
+static uint32_t hashH(int is_blob, const uint8_t *pData, int32_t len) {
+  
+  uint32_t result = UINT32_C(2166136261);
+  int32_t i = 0;
+  
+  if ((len < 0) || ((pData == NULL) && (len > 0))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  result ^= (uint32_t) (is_blob ? 1 : 0);
+  result *= UINT32_C(16777619);
+  
+  for(i = 0; i < len; i++) {
+    result ^= (uint32_t) pData[i];
+    result *= UINT32_C(16777619);
+  }
+  
+  return result;
+}
+
+/*
+ * Find or add a handle for a blob or text payload and return its handle
+ * table index.
+ * 
+ * If the same object pointer or an object of the same type with
+ * identical payload bytes already has a handle, that handle is
+ * returned.  Otherwise, a new handle is added to the handle table.
+ * 
+ * Parameters:
+ * 
+ *   is_blob - non-zero if p is a blob, zero if it is text
+ * 
+ *   p - the blob or text object
+ * 
+ *   pData - the payload bytes of the object
+ * 
+ *   len - the length in bytes of the payload
+ * 
+ * Return:
+ * 
+ *   the handle table index of the payload
+ */
+static int32_t addH(int is_blob, const void *p,
+                    const uint8_t *pData, int32_t len) {
+  
+  int32_t result = -1;
+  int32_t i = 0;
+  int32_t h = 0;
+  uint32_t hash = 0;
+  HPTR_ENTRY *pc = NULL;
+  const uint8_t *pOther = NULL;
+  int32_t other_len = 0;
+  
+  if (p == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Check the pointer cache first */
+  pc = &(m_hptr[
+          (((uintptr_t) p) >> 4) & ((uintptr_t) (H_PTR_CACHE - 1))]);
+  if (pc->p == p) {
+    result = pc->h;
+  }
+  
+  /* Otherwise, look up the payload by content */
+  if (result < 0) {
+    if (m_hdedup == NULL) {
+      m_hdedup = (HDEDUP_ENTRY *) calloc(
+                    (size_t) H_DEDUP_CAP, sizeof(HDEDUP_ENTRY));
+      if (m_hdedup == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      for(i = 0; i < H_DEDUP_CAP; i++) {
+        (m_hdedup[i]).h = -1;
+      }
+    }
+    
+    hash = hashH(is_blob, pData, len);
+    i = (int32_t) (hash & ((uint32_t) (H_DEDUP_CAP - 1)));
+    while ((m_hdedup[i]).h >= 0) {
+      if ((m_hdedup[i]).hash == hash) {
+        h = (m_hdedup[i]).h;
+        if (((m_h[h]).is_blob != 0) == (is_blob != 0)) {
+          if (is_blob) {
+            pOther = blob_ptr((m_h[h]).ptr.pBlob);
+            other_len = blob_len((m_h[h]).ptr.pBlob);
+          } else {
+            pOther = (const uint8_t *) text_ptr((m_h[h]).ptr.pText);
+            other_len = text_len((m_h[h]).ptr.pText);
+          }
+          if ((other_len == len) &&
+                ((len < 1) ||
+                  (memcmp(pOther, pData, (size_t) len) == 0))) {
+            result = h;
+            break;
+          }
+        }
+      }
+      i = (i + 1) & (H_DEDUP_CAP - 1);
+    }
+    
+    /* Add a new handle if no match */
+    if (result < 0) {
+      capH(1);
+      
+      (m_h[m_h_len]).is_blob = is_blob ? 1 : 0;
+      if (is_blob) {
+        (m_h[m_h_len]).ptr.pBlob = (BLOB *) p;
+      } else {
+        (m_h[m_h_len]).ptr.pText = (TEXT *) p;
+      }
+      result = m_h_len;
+      m_h_len++;
+      
+      (m_hdedup[i]).h = result;
+      (m_hdedup[i]).hash = hash;
+    }
+    
+    /* Update the pointer cache */
+    pc->p = p;
+    pc->h = result;
+  }
+  
+  return result;
+}
+
+/*
+ * Find or add a blob handle in the handle table and return the handle
+ * table index of the blob.
  * 
  * Parameters:
  * 
@@ -722,18 +1468,12 @@ static int32_t addBlobH(BLOB *pBlob) {
     raiseErr(__LINE__, NULL);
   }
   
-  capH(1);
-  
-  (m_h[m_h_len]).is_blob = 1;
-  (m_h[m_h_len]).ptr.pBlob = pBlob;
-  m_h_len++;
-  
-  return (m_h_len - 1);
+  return addH(1, pBlob, blob_ptr(pBlob), blob_len(pBlob));
 }
 
 /*
- * Add a text handle to the handle table and return the handle table
- * index of the text that was just added.
+ * Find or add a text handle in the handle table and return the handle
+ * table index of the text.
  * 
  * Parameters:
  * 
@@ -748,13 +1488,8 @@ static int32_t addTextH(TEXT *pText) {
     raiseErr(__LINE__, NULL);
   }
   
-  capH(1);
-  
-  (m_h[m_h_len]).is_blob = 0;
-  (m_h[m_h_len]).ptr.pText = pText;
-  m_h_len++;
-  
-  return (m_h_len - 1);
+  return addH(0, pText,
+          (const uint8_t *) text_ptr(pText), text_len(pText));
 }
 
 /*
@@ -806,6 +1541,90 @@ static void eventRange(int32_t t) {
   }
 }
 
+/*
+ * Apply the output window to a message that is about to be added to
+ * the moment buffer.
+ * 
+ * This may only be used when m_win is set.  Note-on, note-off, and
+ * polyphonic aftertouch messages before the window are kept, and they
+ * extend the event range below the start of the window, so that grace
+ * notes leading into the first selected section are not lost.  All
+ * other messages before the window are kept at their own offsets but do
+ * not extend the event range; clampWindow() later moves those that are
+ * still before the start of the event range up to it, so that the state
+ * they establish is in effect when the output begins.  Messages after
+ * the window are dropped, except for note-off messages and note-on
+ * messages with zero velocity, so that notes sounding at the end of the
+ * window are still released.
+ * 
+ * Parameters:
+ * 
+ *   t - the moment offset of the message
+ * 
+ *   sel - the selector of the MIDI message
+ * 
+ * Return:
+ * 
+ *   WIN_KEEP if the message should be added, WIN_CLAMP if it should be
+ *   added without extending the event range, or WIN_DROP if it should be
+ *   dropped
+ */
+static int windowMsg(int32_t t, uint64_t sel) {
+  
+  int result = WIN_KEEP;
+  int status = 0;
+  
+  if (!m_win) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  status = (int) ((sel >> SEL_STATUS_SHIFT) & 0xff);
+  t = pointer_unpack(t, NULL);
+  
+  if (t < m_win_lo) {
+    if ((status < 0x80) || (status > 0xaf)) {
+      result = WIN_CLAMP;
+    }
+    
+  } else if (t >= m_win_hi) {
+    if ((status < 0x80) || (status > 0x9f)) {
+      result = WIN_DROP;
+    } else if ((status >= 0x90) && ((sel & 0xff) != 0)) {
+      result = WIN_DROP;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Move the messages that windowMsg() kept before the start of the event
+ * range up to the start of the event range, keeping their moment parts.
+ * 
+ * This may only be used when m_win is set, once all the messages have
+ * been added to the moment buffer and before it is prepared for
+ * encoding.
+ */
+static void clampWindow(void) {
+  
+  int32_t i = 0;
+  int32_t t = 0;
+  int part = 0;
+  MOMENT *pm = NULL;
+  
+  if (!m_win) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 0; i < m_moment_len; i++) {
+    pm = &((m_dir[i >> MOMENT_CHUNK_SHIFT])[i & (MOMENT_CHUNK_LEN - 1)]);
+    t = pointer_unpack(pm->t, &part);
+    if (t < m_lower) {
+      pm->t = pointer_pack(m_lower, part);
+    }
+  }
+}
+
 /*
  * Make room in capacity for a given number of bytes in the message
  * table.
@@ -838,7 +1657,7 @@ static void capMsg(int32_t n) {
     
     /* Make initial allocation if necessary */
     if (m_msg_cap < 1) {
-      m_msg = (uint8_t *) calloc((size_t) MSG_INIT_CAP, 1);
+      m_msg = (uint8_t *) malloc((size_t) MSG_INIT_CAP);
       if (m_msg == NULL) {
         raiseErr(__LINE__, "Out of memory");
       }
@@ -866,107 +1685,260 @@ static void capMsg(int32_t n) {
        * capacity */
       new_cap = m_msg_cap;
       while (new_cap < target) {
-        new_cap *= 2;
-      }
-      if (new_cap > MSG_MAX_CAP) {
-        new_cap = MSG_MAX_CAP;
+        if (new_cap <= MSG_MAX_CAP / 2) {
+          new_cap *= 2;
+        } else {
+          new_cap = MSG_MAX_CAP;
+        }
       }
       
-      /* Expand capacity */
+      /* Expand capacity -- the new space is not cleared, since bytes
+       * are always written before they are used */
       m_msg = (uint8_t *) realloc(m_msg, (size_t) new_cap);
       if (m_msg == NULL) {
         raiseErr(__LINE__, "Out of memory");
       }
       
-      memset(
-        &(m_msg[m_msg_cap]),
-        0,
-        (size_t) (new_cap - m_msg_cap));
-      
       m_msg_cap = new_cap;
     }
   }
 }
 
 /*
- * Add a MIDI message that has a single data byte to the message buffer
- * and return a selector for this MIDI message.
+ * Compute the hash of message data in the message buffer.
  * 
- * The supported status bytes are in range 0xC0 to 0xDF inclusive.  The
- * data byte must be in range 0 to 127 inclusive.
+ * This is the 32-bit FNV-1a hash of the bytes.
  * 
  * Parameters:
  * 
- *   status - the status byte
+ *   off - the byte offset of the message data
  * 
- *   b - the data byte
+ *   len - the length in bytes of the message data
  * 
  * Return:
  * 
- *   the selector
+ *   the hash of the message data
  */
-static uint32_t addMsg1(int status, int b) {
+static uint32_t hashMsg(int32_t off, int32_t len) {
   
-  uint32_t sel = 0;
+  uint32_t result = UINT32_C(2166136261);
+  int32_t i = 0;
   
-  if ((status < 0xc0) || (status > 0xdf)) {
+  if ((off < 0) || (len < 0) || (len > m_msg_len - off)) {
     raiseErr(__LINE__, NULL);
   }
-  if ((b < 0) || (b > 127)) {
-    raiseErr(__LINE__, NULL);
+  
+  for(i = 0; i < len; i++) {
+    result ^= (uint32_t) m_msg[off + i];
+    result *= UINT32_C(16777619);
   }
   
-  capMsg(1);
+  return result;
+}
+
+/*
+ * Allocate the intern table or double its capacity.
+ * 
+ * When the capacity is doubled, all the existing records are inserted
+ * into the new table.  The intern table must not already be at its
+ * maximum capacity.
+ */
+static void growIntern(void) {
   
-  sel = (uint32_t) m_msg_len;
-  m_msg[sel] = (uint8_t) b;
-  m_msg_len++;
+  int32_t old_cap = 0;
+  int32_t new_cap = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  INTERN_ENTRY *pOld = NULL;
+  
+  /* Determine new capacity */
+  old_cap = m_intern_cap;
+  if (old_cap < 1) {
+    new_cap = INTERN_INIT_CAP;
+  } else if (old_cap < INTERN_MAX_CAP) {
+    new_cap = old_cap * 2;
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
   
-  sel |= (((uint32_t) status) << 24);
+  /* Allocate new table with all slots empty */
+  pOld = m_intern;
+  m_intern = (INTERN_ENTRY *) calloc(
+                (size_t) new_cap, sizeof(INTERN_ENTRY));
+  if (m_intern == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  for(i = 0; i < new_cap; i++) {
+    (m_intern[i]).off = -1;
+  }
+  m_intern_cap = new_cap;
+  
+  /* Reinsert existing records */
+  for(i = 0; i < old_cap; i++) {
+    if ((pOld[i]).off >= 0) {
+      j = (int32_t) ((pOld[i]).hash & ((uint32_t) (new_cap - 1)));
+      while ((m_intern[j]).off >= 0) {
+        j = (j + 1) & (new_cap - 1);
+      }
+      memcpy(&(m_intern[j]), &(pOld[i]), sizeof(INTERN_ENTRY));
+    }
+  }
   
-  return sel;
+  /* Release old table */
+  if (pOld != NULL) {
+    free(pOld);
+    pOld = NULL;
+  }
 }
 
 /*
- * Add a MIDI message that has two data bytes to the message buffer and
- * return a selector for this MIDI message.
+ * Intern message data that was just written to the end of the message
+ * buffer.
  * 
- * The supported status bytes are in range 0x80 to 0xBF, and 0xE0 to
- * 0xEF inclusive.  The data bytes must be in range 0 to 127 inclusive.
- * 
- * Parameters:
+ * off is the byte offset where the message data begins.  The message
+ * data runs from there to the end of the message buffer.
  * 
- *   status - the status byte
+ * If identical message data is already in the message buffer, the new
+ * copy is removed from the end of the message buffer and the offset of
+ * the existing copy is returned.  Otherwise, the new message data is
+ * added to the intern table and off is returned.  If the intern table
+ * is full, the new message data is kept without being interned.
  * 
- *   b1 - the first data byte
+ * Parameters:
  * 
- *   b2 - the second data byte
+ *   off - the byte offset of the new message data
  * 
  * Return:
  * 
- *   the selector
+ *   the byte offset of the interned message data
  */
-static uint32_t addMsg2(int status, int b1, int b2) {
+static int32_t internMsg(int32_t off) {
   
-  uint32_t sel = 0;
+  int32_t result = 0;
+  int32_t len = 0;
+  int32_t i = 0;
+  int found = 0;
+  uint32_t hash = 0;
   
-  if (((status < 0x80) || (status > 0xbf)) &&
-      ((status < 0xe0) || (status > 0xef))) {
+  /* Check parameters */
+  if ((off < 0) || (off >= m_msg_len)) {
     raiseErr(__LINE__, NULL);
   }
-  if ((b1 < 0) || (b1 > 127) ||
-      (b2 < 0) || (b2 > 127)) {
+  result = off;
+  
+  /* Compute length and hash */
+  len = m_msg_len - off;
+  hash = hashMsg(off, len);
+  
+  /* Make sure the table is less than half full, if possible */
+  if ((m_intern_len >= m_intern_cap / 2) &&
+      (m_intern_cap < INTERN_MAX_CAP)) {
+    growIntern();
+  }
+  
+  /* Only proceed if there is an empty slot in the table */
+  if (m_intern_len < m_intern_cap - 1) {
+    
+    /* Probe for identical message data or an empty slot */
+    i = (int32_t) (hash & ((uint32_t) (m_intern_cap - 1)));
+    while ((m_intern[i]).off >= 0) {
+      if (((m_intern[i]).hash == hash) && ((m_intern[i]).len == len)) {
+        if (memcmp(
+              &(m_msg[(m_intern[i]).off]),
+              &(m_msg[off]),
+              (size_t) len) == 0) {
+          found = 1;
+          break;
+        }
+      }
+      i = (i + 1) & (m_intern_cap - 1);
+    }
+    
+    /* Use the existing copy if found, else add to the table */
+    if (found) {
+      result = (m_intern[i]).off;
+      m_msg_len = off;
+      
+    } else {
+      (m_intern[i]).off = off;
+      (m_intern[i]).len = len;
+      (m_intern[i]).hash = hash;
+      m_intern_len++;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Return a selector for a MIDI message that has a single data byte.
+ * 
+ * The data byte is stored directly in the selector.  The supported
+ * status bytes are in range 0xC0 to 0xDF inclusive.  The data byte must
+ * be in range 0 to 127 inclusive.
+ * 
+ * Parameters:
+ * 
+ *   status - the status byte
+ * 
+ *   b - the data byte
+ * 
+ * Return:
+ * 
+ *   the selector
+ */
+static uint64_t addMsg1(int status, int b) {
+  
+  uint64_t sel = 0;
+  
+  if ((status < 0xc0) || (status > 0xdf)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((b < 0) || (b > 127)) {
     raiseErr(__LINE__, NULL);
   }
   
-  capMsg(2);
+  sel = ((uint64_t) b) << SEL_DATA1_SHIFT;
+  sel |= (((uint64_t) status) << SEL_STATUS_SHIFT);
+  
+  return sel;
+}
+
+/*
+ * Return a selector for a MIDI message that has two data bytes.
+ * 
+ * The data bytes are stored directly in the selector.  The supported
+ * status bytes are in range 0x80 to 0xBF, and 0xE0 to 0xEF inclusive.
+ * The data bytes must be in range 0 to 127 inclusive.
+ * 
+ * Parameters:
+ * 
+ *   status - the status byte
+ * 
+ *   b1 - the first data byte
+ * 
+ *   b2 - the second data byte
+ * 
+ * Return:
+ * 
+ *   the selector
+ */
+static uint64_t addMsg2(int status, int b1, int b2) {
+  
+  uint64_t sel = 0;
   
-  sel = (uint32_t) m_msg_len;
-  m_msg[sel    ] = (uint8_t) b1;
-  m_msg[sel + 1] = (uint8_t) b2;
-  m_msg_len += 2;
+  if (((status < 0x80) || (status > 0xbf)) &&
+      ((status < 0xe0) || (status > 0xef))) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((b1 < 0) || (b1 > 127) ||
+      (b2 < 0) || (b2 > 127)) {
+    raiseErr(__LINE__, NULL);
+  }
   
-  sel |= (((uint32_t) status) << 24);
+  sel = ((uint64_t) b1) << SEL_DATA1_SHIFT;
+  sel |= (uint64_t) b2;
+  sel |= (((uint64_t) status) << SEL_STATUS_SHIFT);
   
   return sel;
 }
@@ -989,10 +1961,10 @@ static uint32_t addMsg2(int status, int b1, int b2) {
  * 
  *   the selector
  */
-static uint32_t addMsgB(int status, BLOB *pBlob) {
+static uint64_t addMsgB(int status, BLOB *pBlob) {
   
   int32_t bh = 0;
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   
   if ((status != 0xf0) && (status != 0xf7)) {
     raiseErr(__LINE__, NULL);
@@ -1014,10 +1986,11 @@ static uint32_t addMsgB(int status, BLOB *pBlob) {
   
   capMsg((int32_t) sizeVInt(bh));
   
-  sel = (uint32_t) m_msg_len;
+  sel = (uint64_t) m_msg_len;
   m_msg_len += (int32_t) encodeVInt(&(m_msg[sel]), bh);
   
-  sel |= (((uint32_t) status) << 24);
+  sel = (uint64_t) internMsg((int32_t) sel);
+  sel |= (((uint64_t) status) << SEL_STATUS_SHIFT);
   
   return sel;
 }
@@ -1041,10 +2014,10 @@ static uint32_t addMsgB(int status, BLOB *pBlob) {
  * 
  *   the selector
  */
-static uint32_t addMsgMB(int status, int ty, BLOB *pBlob) {
+static uint64_t addMsgMB(int status, int ty, BLOB *pBlob) {
   
   int32_t bh = 0;
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   
   if (status != 0xff) {
     raiseErr(__LINE__, NULL);
@@ -1060,13 +2033,14 @@ static uint32_t addMsgMB(int status, int ty, BLOB *pBlob) {
   
   capMsg((int32_t) (sizeVInt(bh) + 1));
   
-  sel = (uint32_t) m_msg_len;
+  sel = (uint64_t) m_msg_len;
   m_msg[sel] = (uint8_t) (ty | 0x80);
   m_msg_len++;
   
   m_msg_len += (int32_t) encodeVInt(&(m_msg[sel + 1]), bh);
   
-  sel |= (((uint32_t) status) << 24);
+  sel = (uint64_t) internMsg((int32_t) sel);
+  sel |= (((uint64_t) status) << SEL_STATUS_SHIFT);
   
   return sel;
 }
@@ -1090,10 +2064,10 @@ static uint32_t addMsgMB(int status, int ty, BLOB *pBlob) {
  * 
  *   the selector
  */
-static uint32_t addMsgMT(int status, int ty, TEXT *pText) {
+static uint64_t addMsgMT(int status, int ty, TEXT *pText) {
   
   int32_t th = 0;
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   
   if (status != 0xff) {
     raiseErr(__LINE__, NULL);
@@ -1109,13 +2083,14 @@ static uint32_t addMsgMT(int status, int ty, TEXT *pText) {
   
   capMsg((int32_t) (sizeVInt(th) + 1));
   
-  sel = (uint32_t) m_msg_len;
+  sel = (uint64_t) m_msg_len;
   m_msg[sel] = (uint8_t) (ty | 0x80);
   m_msg_len++;
   
   m_msg_len += (int32_t) encodeVInt(&(m_msg[sel + 1]), th);
   
-  sel |= (((uint32_t) status) << 24);
+  sel = (uint64_t) internMsg((int32_t) sel);
+  sel |= (((uint64_t) status) << SEL_STATUS_SHIFT);
   
   return sel;
 }
@@ -1147,13 +2122,13 @@ static uint32_t addMsgMT(int status, int ty, TEXT *pText) {
  * 
  *   the selector
  */
-static uint32_t addMsgMD(
+static uint64_t addMsgMD(
           int       status,
           int       ty,
     const uint8_t * pData,
           int32_t   len) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   
   if (status != 0xff) {
     raiseErr(__LINE__, NULL);
@@ -1176,7 +2151,7 @@ static uint32_t addMsgMD(
   
   capMsg(len + ((int32_t) sizeVInt(len)) + 1);
   
-  sel = (uint32_t) m_msg_len;
+  sel = (uint64_t) m_msg_len;
   m_msg[sel] = (uint8_t) ty;
   m_msg_len++;
   
@@ -1191,89 +2166,102 @@ static uint32_t addMsgMD(
     m_msg_len += len;
   }
   
-  sel |= (((uint32_t) status) << 24);
+  sel = (uint64_t) internMsg((int32_t) sel);
+  sel |= (((uint64_t) status) << SEL_STATUS_SHIFT);
   
   return sel;
 }
 
 /*
- * Print a MIDI message to the given output file.
+ * Pack a MIDI message into a buffer.
  * 
- * sel is the selector of the MIDI message to print.  Only the MIDI
- * message is printed, not the delta time preceding it.
+ * sel is the selector of the MIDI message to pack.  Only the MIDI
+ * message is packed, not the delta time preceding it.
  * 
- * This function will use running status byte optimization.  Therefore,
- * it assumes that messages are being printed in sequential order.
- * Otherwise, the running status bytes won't work correctly.
+ * pRStatus points to the running status byte before the message, which
+ * has the same meaning as m_rstatus.  The status byte is left out of
+ * the packed message if it matches the running status byte.
+ * 
+ * The packed length of the message is always returned.  If the length
+ * is greater than avail, nothing is written and the running status
+ * byte is left alone, so that the caller can make room and try again.
+ * Otherwise, the message is written to the start of pBuf and the
+ * running status byte is updated for the next message.
+ * 
+ * Only module state is read, so this may be called on worker threads
+ * once the data of every handle has been assembled with
+ * assembleHandles().
  * 
  * Parameters:
  * 
- *   pOut - the output file
+ *   pBuf - the buffer to write the message to
  * 
- *   sel - the selector of the MIDI message to print
+ *   avail - the number of bytes available in the buffer
+ * 
+ *   sel - the selector of the MIDI message to pack
+ * 
+ *   pRStatus - the running status byte, which is updated
+ * 
+ * Return:
+ * 
+ *   the packed length of the message in bytes
  */
-static void printMsg(FILE *pOut, uint32_t sel) {
-  
+static int32_t packMsg(
+    uint8_t  * pBuf,
+    int32_t    avail,
+    uint64_t   sel,
+    int      * pRStatus) {
+  
+  const uint8_t *pData = NULL;
+  uint8_t pre[8];
+  int32_t pre_len = 0;
   int status = 0;
-  int proceed = 0;
   int ty = 0;
   int32_t msg = 0;
   int32_t h = 0;
   int32_t len = 0;
   int32_t cl = 0;
   
-  /* Check parameters */
-  if (pOut == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
-  
-  /* Parse selector into status and message buffer offset */
-  status = (int) (sel >> 24);
-  msg = (int32_t) (sel & UINT32_C(0xffffff));
+  memset(pre, 0, sizeof(pre));
   
-  /* Determine whether to write the status byte -- write it in all cases
-   * except when a status byte is buffered that equals the current
-   * status byte */
-  proceed = 1;
-  if (m_rstatus != 0) {
-    if (m_rstatus == status) {
-      proceed = 0;
-    }
+  if ((avail < 0) || (pRStatus == NULL)) {
+    raiseErr(__LINE__, NULL);
   }
   
-  /* Write status byte if necessary */
-  if (proceed) {
-    writeByte(pOut, status);
-  }
+  /* Parse selector into status and either the message buffer offset or
+   * the data bytes */
+  status = (int) (sel >> SEL_STATUS_SHIFT);
+  msg = (int32_t) (sel & SEL_OFFSET_MASK);
   
-  /* If status byte is in range 0x80 to 0xEF inclusive, then store it as
-   * the running status state; otherwise, clear running status state */
-  if ((status >= 0x80) && (status <= 0xef)) {
-    m_rstatus = status;
-  } else {
-    m_rstatus = 0;
+  /* Include the status byte in all cases except when a status byte is
+   * buffered that equals the current status byte */
+  if ((*pRStatus == 0) || (*pRStatus != status)) {
+    pre[pre_len] = (uint8_t) status;
+    pre_len++;
   }
   
-  /* Check that message offset is in range of message buffer */
-  if ((msg < 0) || (msg >= m_msg_len)) {
-    raiseErr(__LINE__, NULL);
+  /* Check that message offset is in range of message buffer for all
+   * messages that are not channel messages */
+  if ((status < 0x80) || (status > 0xef)) {
+    if ((msg < 0) || (msg >= m_msg_len)) {
+      raiseErr(__LINE__, NULL);
+    }
   }
   
-  /* Print the appropriate message data in a format based on the status
-   * byte */
+  /* Determine the bytes that follow the status byte in a format based
+   * on the status byte, with the fixed bytes in pre and any payload in
+   * pData */
   if (((status >= 0x80) && (status <= 0xbf)) ||
       ((status >= 0xe0) && (status <= 0xef))) {
-    /* Two data bytes -- make sure enough bytes remain */
-    if (msg > m_msg_len - 2) {
-      raiseErr(__LINE__, NULL);
-    }
-    
-    /* Write the data bytes */
-    writeBinary(pOut, &(m_msg[msg]), 2);
+    /* Two data bytes stored in the selector */
+    pre[pre_len] = (uint8_t) ((msg >> SEL_DATA1_SHIFT) & 0x7f);
+    pre[pre_len + 1] = (uint8_t) (msg & 0x7f);
+    pre_len += 2;
     
   } else if ((status >= 0xc0) && (status <= 0xdf)) {
-    /* One data byte -- write the byte */
-    writeByte(pOut, (int) m_msg[msg]);
+    /* One data byte stored in the selector */
+    pre[pre_len] = (uint8_t) ((msg >> SEL_DATA1_SHIFT) & 0x7f);
+    pre_len++;
     
   } else if (status == 0xf0) {
     /* Blob where first byte is implicit 0xF0 -- decode the handle
@@ -1295,17 +2283,13 @@ static void printMsg(FILE *pOut, uint32_t sel) {
       raiseErr(__LINE__, NULL);
     }
     
-    /* Write one less than the length of the blob as a variable-length
-     * integer */
-    printVInt(pOut, blob_len((m_h[h]).ptr.pBlob) - 1);
-    
-    /* If blob length more than one, write everything in the blob after
-     * the first byte */
-    if (blob_len((m_h[h]).ptr.pBlob) > 1) {
-      writeBinary(
-        pOut,
-        &((blob_ptr((m_h[h]).ptr.pBlob))[1]),
-        blob_len((m_h[h]).ptr.pBlob) - 1);
+    /* One less than the length of the blob as a variable-length
+     * integer, followed by everything in the blob after the first
+     * byte */
+    len = blob_len((m_h[h]).ptr.pBlob) - 1;
+    pre_len += (int32_t) encodeVInt(&(pre[pre_len]), len);
+    if (len > 0) {
+      pData = &((blob_ptr((m_h[h]).ptr.pBlob))[1]);
     }
     
   } else if (status == 0xf7) {
@@ -1320,15 +2304,12 @@ static void printMsg(FILE *pOut, uint32_t sel) {
       raiseErr(__LINE__, NULL);
     }
     
-    /* Write the length of the blob as a variable-length integer */
-    printVInt(pOut, blob_len((m_h[h]).ptr.pBlob));
-    
-    /* If blob is not empty, write everything in the blob */
-    if (blob_len((m_h[h]).ptr.pBlob) > 0) {
-      writeBinary(
-        pOut,
-        &((blob_ptr((m_h[h]).ptr.pBlob))[0]),
-        blob_len((m_h[h]).ptr.pBlob));
+    /* The length of the blob as a variable-length integer, followed by
+     * everything in the blob */
+    len = blob_len((m_h[h]).ptr.pBlob);
+    pre_len += (int32_t) encodeVInt(&(pre[pre_len]), len);
+    if (len > 0) {
+      pData = blob_ptr((m_h[h]).ptr.pBlob);
     }
     
   } else if (status == 0xff) {
@@ -1338,10 +2319,10 @@ static void printMsg(FILE *pOut, uint32_t sel) {
     
     /* Process depending on payload format */
     if ((ty & 0x80) != 0) {
-      /* Indirect format, so first clear the flag on the type code and
-       * then write the type code */
-      ty = ty & 0x7f;
-      writeByte(pOut, ty);
+      /* Indirect format, so first clear the flag on the type code for
+       * the type code byte */
+      pre[pre_len] = (uint8_t) (ty & 0x7f);
+      pre_len++;
       
       /* Decode the handle index */
       decodeVInt(&(m_msg[msg + 1]), &h, m_msg_len - msg - 1);
@@ -1351,26 +2332,25 @@ static void printMsg(FILE *pOut, uint32_t sel) {
         raiseErr(__LINE__, NULL);
       }
       
-      /* Print the blob or text length followed by the data */
+      /* The blob or text length followed by the data */
       if ((m_h[h]).is_blob) {
-        printVInt(pOut, blob_len((m_h[h]).ptr.pBlob));
-        if (blob_len((m_h[h]).ptr.pBlob) > 0) {
-          writeBinary(
-            pOut,
-            &((blob_ptr((m_h[h]).ptr.pBlob))[0]),
-            blob_len((m_h[h]).ptr.pBlob));
+        len = blob_len((m_h[h]).ptr.pBlob);
+        if (len > 0) {
+          pData = blob_ptr((m_h[h]).ptr.pBlob);
         }
         
       } else {
-        printVInt(pOut, text_len((m_h[h]).ptr.pText));
-        if (text_len((m_h[h]).ptr.pText) > 0) {
-          writeString(pOut, text_ptr((m_h[h]).ptr.pText));
+        len = text_len((m_h[h]).ptr.pText);
+        if (len > 0) {
+          pData = (const uint8_t *) text_ptr((m_h[h]).ptr.pText);
         }
       }
+      pre_len += (int32_t) encodeVInt(&(pre[pre_len]), len);
       
     } else {
-      /* Direct format, so first write the type code */
-      writeByte(pOut, ty);
+      /* Direct format, so first the type code byte */
+      pre[pre_len] = (uint8_t) ty;
+      pre_len++;
       
       /* Decode the data length and get the length of this length
        * declaration */
@@ -1385,173 +2365,69 @@ static void printMsg(FILE *pOut, uint32_t sel) {
         raiseErr(__LINE__, NULL);
       }
       
-      /* Write the data length and the data */
-      writeBinary(pOut, &(m_msg[msg + 1]), cl + len);
+      /* The data length and the data are copied as they are stored */
+      len = cl + len;
+      pData = &(m_msg[msg + 1]);
     }
     
   } else {
     raiseErr(__LINE__, NULL);
   }
+  
+  /* Write the message if it fits */
+  if (len > INT32_MAX - pre_len) {
+    raiseErr(__LINE__, "Compiled MIDI file too large");
+  }
+  if (pre_len + len <= avail) {
+    memcpy(pBuf, pre, (size_t) pre_len);
+    if (len > 0) {
+      memcpy(&(pBuf[pre_len]), pData, (size_t) len);
+    }
+    
+    /* If status byte is in range 0x80 to 0xEF inclusive, then store it
+     * as the running status state; otherwise, clear running status
+     * state */
+    if ((status >= 0x80) && (status <= 0xef)) {
+      *pRStatus = status;
+    } else {
+      *pRStatus = 0;
+    }
+  }
+  
+  return pre_len + len;
 }
 
 /*
- * Compute the full size in bytes of a MIDI message, not including the
- * delta time.
- * 
- * sel is the selector of the MIDI message to size.  prev is the
- * selector of the previous MIDI message, or zero if no previous
- * message.  prev is only used for determining whether there is a
- * running status byte.
+ * Print a MIDI message to the output buffer.
  * 
- * Parameters:
+ * sel is the selector of the MIDI message to print.  Only the MIDI
+ * message is printed, not the delta time preceding it.
  * 
- *   sel - selector of MIDI message
+ * This function will use running status byte optimization.  Therefore,
+ * it assumes that messages are being printed in sequential order.
+ * Otherwise, the running status bytes won't work correctly.
  * 
- *   prev - selector of previous MIDI message, or zero if none
+ * This is a wrapper around packMsg() with m_rstatus.
  * 
- * Return:
+ * Parameters:
  * 
- *   the encoded size in bytes of this MIDI message, accounting for
- *   running status bytes, but not including any delta time
+ *   sel - the selector of the MIDI message to print
  */
-static int32_t sizeMsg(uint32_t sel, uint32_t prev) {
+static void printMsg(uint64_t sel) {
   
-  int32_t result = 0;
-  int status = 0;
-  int prev_status = 0;
-  int ty = 0;
-  int32_t msg = 0;
-  int32_t h = 0;
   int32_t len = 0;
-  int32_t cl = 0;
-  
-  /* Parse selector into status and message buffer offset */
-  status = (int) (sel >> 24);
-  msg = (int32_t) (sel & UINT32_C(0xffffff));
-  
-  /* Get previous status byte, zero if none */
-  prev_status = (int) (prev >> 24);
-  
-  /* Increment size by one to account for the status byte */
-  result++;
   
-  /* If previous status byte is in range 0x80 to 0xEF inclusive, and it
-   * matches the current status byte, then decrement size by one since
-   * we won't write status byte due to running status */
-  if ((prev_status >= 0x80) && (prev_status <= 0xef) &&
-      (prev_status == status)) {
-    result--;
-  }
-  
-  /* Check that message offset is in range of message buffer */
-  if ((msg < 0) || (msg >= m_msg_len)) {
+  if (m_out == NULL) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Compute the remaining size of the MIDI message */
-  if (((status >= 0x80) && (status <= 0xbf)) ||
-      ((status >= 0xe0) && (status <= 0xef))) {
-    /* Two data bytes */
-    result += 2;
-    
-  } else if ((status >= 0xc0) && (status <= 0xdf)) {
-    /* One data byte */
-    result++;
-    
-  } else if (status == 0xf0) {
-    /* Blob where first byte is implicit 0xF0 -- decode the handle
-     * index */
-    decodeVInt(&(m_msg[msg]), &h, m_msg_len - msg);
-    
-    /* Make sure handle exists and it is to a non-empty blob where the
-     * first byte is 0xF0 */
-    if ((h < 0) || (h >= m_h_len)) {
-      raiseErr(__LINE__, NULL);
-    }
-    if (!((m_h[h]).is_blob)) {
-      raiseErr(__LINE__, NULL);
-    }
-    if (blob_len((m_h[h]).ptr.pBlob) < 1) {
-      raiseErr(__LINE__, NULL);
-    }
-    if ((blob_ptr((m_h[h]).ptr.pBlob))[0] != 0xf0) {
-      raiseErr(__LINE__, NULL);
-    }
-    
-    /* Add the size of the length declaration and the size of the blob
-     * data */
-    result += sizeVInt(blob_len((m_h[h]).ptr.pBlob) - 1);
-    result += blob_len((m_h[h]).ptr.pBlob) - 1;
-    
-  } else if (status == 0xf7) {
-    /* Blob without any implicit bytes -- decode the handle index */
-    decodeVInt(&(m_msg[msg]), &h, m_msg_len - msg);
-    
-    /* Make sure the handle exists and it is a blob */
-    if ((h < 0) || (h >= m_h_len)) {
-      raiseErr(__LINE__, NULL);
-    }
-    if (!((m_h[h]).is_blob)) {
-      raiseErr(__LINE__, NULL);
-    }
-    
-    /* Add the size of the length declaration and the size of the blob
-     * data */
-    result += sizeVInt(blob_len((m_h[h]).ptr.pBlob));
-    result += blob_len((m_h[h]).ptr.pBlob);
-    
-  } else if (status == 0xff) {
-    /* Meta-event -- begin by getting the type code with the flag
-     * indicating the payload format */
-    ty = (int) m_msg[msg];
-    
-    /* Add a byte in length for type code */
-    result++;
-    
-    /* Process depending on payload format */
-    if ((ty & 0x80) != 0) {
-      /* Indirect format, so decode the handle index */
-      decodeVInt(&(m_msg[msg + 1]), &h, m_msg_len - msg - 1);
-      
-      /* Make sure the handle exists */
-      if ((h < 0) || (h >= m_h_len)) {
-        raiseErr(__LINE__, NULL);
-      }
-      
-      /* Add space for length declaration and the data */
-      if ((m_h[h]).is_blob) {
-        result += sizeVInt(blob_len((m_h[h]).ptr.pBlob));
-        result += blob_len((m_h[h]).ptr.pBlob);
-        
-      } else {
-        result += sizeVInt(text_len((m_h[h]).ptr.pText));
-        result += text_len((m_h[h]).ptr.pText);
-      }
-      
-    } else {
-      /* Direct format, so decode the data length and get the length of
-       * this length declaration */
-      cl = (int32_t) decodeVInt(
-                        &(m_msg[msg + 1]),
-                        &len,
-                        m_msg_len - msg - 1);
-      
-      /* Make sure the type code, the data length declaration, and the
-       * data all fit within the message buffer */
-      if (len > m_msg_len - msg - cl - 1) {
-        raiseErr(__LINE__, NULL);
-      }
-      
-      /* Add space for the data length and the data */
-      result += cl + len;
-    }
-    
-  } else {
-    raiseErr(__LINE__, NULL);
+  len = packMsg(
+          &(m_out[m_out_len]), m_out_cap - m_out_len, sel, &m_rstatus);
+  if (len > m_out_cap - m_out_len) {
+    capOut(len);
+    packMsg(&(m_out[m_out_len]), m_out_cap - m_out_len, sel, &m_rstatus);
   }
-  
-  /* Return encoded size */
-  return result;
+  m_out_len += len;
 }
 
 /*
@@ -1586,8 +2462,8 @@ static void capHead(int32_t n) {
     
     /* Make initial allocation if necessary */
     if (m_head_cap < 1) {
-      m_head = (uint32_t *) calloc(
-                (size_t) HEAD_INIT_CAP, sizeof(uint32_t));
+      m_head = (uint64_t *) calloc(
+                (size_t) HEAD_INIT_CAP, sizeof(uint64_t));
       if (m_head == NULL) {
         raiseErr(__LINE__, "Out of memory");
       }
@@ -1622,8 +2498,8 @@ static void capHead(int32_t n) {
       }
       
       /* Expand capacity */
-      m_head = (uint32_t *) realloc(m_head,
-                            ((size_t) new_cap) * sizeof(uint32_t));
+      m_head = (uint64_t *) realloc(m_head,
+                            ((size_t) new_cap) * sizeof(uint64_t));
       if (m_head == NULL) {
         raiseErr(__LINE__, "Out of memory");
       }
@@ -1631,7 +2507,7 @@ static void capHead(int32_t n) {
       memset(
         &(m_head[m_head_cap]),
         0,
-        ((size_t) (new_cap - m_head_cap)) * sizeof(uint32_t));
+        ((size_t) (new_cap - m_head_cap)) * sizeof(uint64_t));
       
       m_head_cap = new_cap;
     }
@@ -1651,7 +2527,7 @@ static void capHead(int32_t n) {
  * 
  *   sel - the selector of the MIDI message
  */
-static void addHeadMsg(uint32_t sel) {
+static void addHeadMsg(uint64_t sel) {
   capHead(1);
   m_head[m_head_len] = sel;
   m_head_len++;
@@ -1684,60 +2560,68 @@ static void capMoment(int32_t n) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Only proceed if n is non-zero */
-  if (n > 0) {
+  /* Check state */
+  if (m_moment != NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Compute target length */
+  if (n <= INT32_MAX - m_moment_len) {
+    target = m_moment_len + n;
+  } else {
+    raiseErr(__LINE__, "MIDI moment table capacity exceeded");
+  }
+  
+  /* Check that target within maximum capacity */
+  if (target > MOMENT_MAX_CAP) {
+    raiseErr(__LINE__, "MIDI moment table capacity exceeded");
+  }
+  
+  /* Add chunks until capacity reaches target */
+  while (m_moment_cap < target) {
     
-    /* Make initial allocation if necessary */
-    if (m_moment_cap < 1) {
-      m_moment = (MOMENT *) calloc(
-                (size_t) MOMENT_INIT_CAP, sizeof(MOMENT));
-      if (m_moment == NULL) {
+    /* Make initial allocation of directory if necessary */
+    if (m_dir_cap < 1) {
+      m_dir = (MOMENT **) calloc(
+                (size_t) MOMENT_DIR_INIT_CAP, sizeof(MOMENT *));
+      if (m_dir == NULL) {
         raiseErr(__LINE__, "Out of memory");
       }
       
-      m_moment_cap = MOMENT_INIT_CAP;
-      m_moment_len = 0;
+      m_dir_cap = MOMENT_DIR_INIT_CAP;
+      m_dir_len = 0;
     }
     
-    /* Compute target length */
-    if (n <= INT32_MAX - m_moment_len) {
-      target = m_moment_len + n;
-    } else {
-      raiseErr(__LINE__, "MIDI moment table capacity exceeded");
-    }
-    
-    /* Only proceed if target length exceeds current capacity */
-    if (target > m_moment_cap) {
-      /* Check that target within maximum capacity */
-      if (target > MOMENT_MAX_CAP) {
-        raiseErr(__LINE__, "MIDI moment table capacity exceeded");
-      }
-      
-      /* Compute new capacity by doubling current capacity until greater
-       * than or equal to target length, and then limiting to maximum
-       * capacity */
-      new_cap = m_moment_cap;
-      while (new_cap < target) {
-        new_cap *= 2;
-      }
-      if (new_cap > MOMENT_MAX_CAP) {
-        new_cap = MOMENT_MAX_CAP;
+    /* Expand the directory if it is full */
+    if (m_dir_len >= m_dir_cap) {
+      new_cap = m_dir_cap * 2;
+      if (new_cap > MOMENT_DIR_MAX_CAP) {
+        new_cap = MOMENT_DIR_MAX_CAP;
       }
       
-      /* Expand capacity */
-      m_moment = (MOMENT *) realloc(m_moment,
-                            ((size_t) new_cap) * sizeof(MOMENT));
-      if (m_moment == NULL) {
+      m_dir = (MOMENT **) realloc(m_dir,
+                            ((size_t) new_cap) * sizeof(MOMENT *));
+      if (m_dir == NULL) {
         raiseErr(__LINE__, "Out of memory");
       }
       
       memset(
-        &(m_moment[m_moment_cap]),
+        &(m_dir[m_dir_cap]),
         0,
-        ((size_t) (new_cap - m_moment_cap)) * sizeof(MOMENT));
+        ((size_t) (new_cap - m_dir_cap)) * sizeof(MOMENT *));
       
-      m_moment_cap = new_cap;
+      m_dir_cap = new_cap;
+    }
+    
+    /* Allocate another chunk */
+    m_dir[m_dir_len] = (MOMENT *) malloc(
+                          ((size_t) MOMENT_CHUNK_LEN) * sizeof(MOMENT));
+    if (m_dir[m_dir_len] == NULL) {
+      raiseErr(__LINE__, "Out of memory");
     }
+    
+    m_dir_len++;
+    m_moment_cap += MOMENT_CHUNK_LEN;
   }
 }
 
@@ -1754,128 +2638,2013 @@ static void capMoment(int32_t n) {
  * This function will automatically assign a unique event ID to the
  * message using eventID().
  * 
+ * If an output window is set, it is applied with windowMsg(), which may
+ * drop the message or leave it to be moved by clampWindow().
+ * 
  * Parameters:
  * 
  *   t - moment offset
  * 
  *   sel - the selector of the MIDI message
+ * 
+ * Return:
+ * 
+ *   non-zero if the message was added, zero if it was dropped by the
+ *   output window
  */
-static void addMomentMsg(int32_t t, uint32_t sel) {
-  capMoment(1);
-  (m_moment[m_moment_len]).eid = eventID();
-  (m_moment[m_moment_len]).t   = t;
-  (m_moment[m_moment_len]).sel = sel;
-  m_moment_len++;
-  eventRange(t);
+static int addMomentMsg(int32_t t, uint64_t sel) {
+  
+  int result = WIN_KEEP;
+  MOMENT *pm = NULL;
+  
+  if (m_win) {
+    result = windowMsg(t, sel);
+  }
+  
+  if (result != WIN_DROP) {
+    capMoment(1);
+    pm = &((m_dir[m_moment_len >> MOMENT_CHUNK_SHIFT])
+              [m_moment_len & (MOMENT_CHUNK_LEN - 1)]);
+    
+    pm->eid = eventID();
+    pm->t   = t;
+    pm->sel = sel;
+    m_moment_len++;
+    if (result != WIN_CLAMP) {
+      eventRange(t);
+    }
+  }
+  
+  return (result != WIN_DROP);
 }
 
 /*
- * Comparison function for sorting the moment buffer.
+ * Convert a subquantum offset into delta time units at the selected
+ * time division.
  * 
- * The interface of this function matches the standard library qsort()
- * callback function.
+ * The offset is scaled by m_ppq over DELTA_PER_QUARTER and rounded to
+ * the nearest unit, with exact halves rounded up, so the result only
+ * depends on the offset itself.  At the default division, the offset
+ * is returned unchanged.
  * 
- * Both of the elements should be MOMENT structures.
+ * Parameters:
  * 
- * The first comparison is by moment offsets.  Further comparisons are
- * only used if both moment offsets are identical.
+ *   s - the subquantum offset
  * 
- * The second comparison is by status class from the status byte in the
- * message selectors.  Status bytes in range 0x80 to 0xAF inclusive are
- * class 2 and all other status bytes are class 1.  Class 1 sorts before
- * class 2.  Further comparisons are only used if both classes are the
- * same.
+ * Return:
  * 
- * The third comparison is by specific status byte.  However, status
- * bytes in range 0xF0 to 0xFF inclusive are treated as if they are the
- * same.  Further comparisons are only used if both status bytes are
+ *   the offset in delta time units
+ */
+static int32_t quantize(int32_t s) {
+  
+  int64_t n = 0;
+  int64_t q = 0;
+  
+  if (m_ppq == DELTA_PER_QUARTER) {
+    return s;
+  }
+  
+  n = (((int64_t) s) * m_ppq * 2) + DELTA_PER_QUARTER;
+  q = n / (DELTA_PER_QUARTER * 2);
+  if ((n < 0) && ((n % (DELTA_PER_QUARTER * 2)) != 0)) {
+    q--;
+  }
+  
+  return (int32_t) q;
+}
+
+/*
+ * Quantize the subquantum part of a moment offset with quantize(),
+ * keeping the moment part.
+ * 
+ * Moments that round to the same delta time then compare equal except
+ * for their moment parts, so that the rest of the sort order applies
+ * within each delta time unit.
+ * 
+ * Parameters:
+ * 
+ *   m - the moment offset
+ * 
+ * Return:
+ * 
+ *   the quantized moment offset
+ */
+static int32_t quantizeMoment(int32_t m) {
+  
+  int32_t s = 0;
+  int part = 0;
+  
+  if (m_ppq == DELTA_PER_QUARTER) {
+    return m;
+  }
+  
+  s = pointer_unpack(m, &part);
+  return pointer_pack(quantize(s), part);
+}
+
+/*
+ * Compute the sort key of a record in the moment buffer.
+ * 
+ * Sorting the keys in ascending numeric order puts records in the order
+ * that they must be output in.
+ * 
+ * The first comparison is by moment offsets, quantized to the selected
+ * time division with quantizeMoment().  Further comparisons are only
+ * used if both quantized moment offsets are identical, so note-off
+ * messages still come before note-on messages when several moments
+ * round to the same delta time.
+ * 
+ * The second comparison is by status class from the status byte in the
+ * message selectors.  Status bytes in range 0x80 to 0xAF inclusive are
+ * class 2 and all other status bytes are class 1.  Class 1 sorts before
+ * class 2.  Further comparisons are only used if both classes are the
+ * same.
+ * 
+ * The third comparison is by specific status byte.  However, status
+ * bytes in range 0xF0 to 0xFF inclusive are treated as if they are the
+ * same.  Further comparisons are only used if both status bytes are
  * the same or both are in range 0xF0 to 0xFF inclusive.
  * 
- * The fourth and final comparison is by event ID.  All moment
- * structures are supposed to have unique event IDs, so this should
- * resolve all remaining ambiguities.
+ * The fourth and final comparison is by event ID.  This is not part of
+ * the key.  Event IDs are assigned in ascending order as records are
+ * added to the moment buffer, so a stable sort of the keys orders
+ * records with equal keys by event ID.
+ * 
+ * See the KEY constants for the layout of the key.
+ * 
+ * Parameters:
+ * 
+ *   pm - the record
+ * 
+ * Return:
+ * 
+ *   the sort key of the record
+ */
+static uint64_t momentKey(const MOMENT *pm) {
+  
+  uint64_t result = 0;
+  int s = 0;
+  int c = 0;
+  
+  /* Check parameters */
+  if (pm == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get the status byte, which always has its high bit set */
+  s = (int) (pm->sel >> SEL_STATUS_SHIFT);
+  if (s < 0x80) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Determine the status class */
+  if ((s >= 0x80) && (s <= 0xaf)) {
+    c = 1;
+  } else {
+    c = 0;
+  }
+  
+  /* Determine the status group */
+  if ((s >= 0xf0) && (s <= 0xff)) {
+    s = 0xf0;
+  }
+  
+  /* Pack the key */
+  result = ((uint64_t) (((uint32_t) quantizeMoment(pm->t))
+                ^ UINT32_C(0x80000000))) << KEY_T_SHIFT;
+  result |= ((uint64_t) c) << KEY_CLASS_SHIFT;
+  result |= (uint64_t) (s & 0x7f);
+  
+  return result;
+}
+
+/*
+ * Sort a range of the moment buffer into the order that it must be
+ * output in.
+ * 
+ * See momentKey() for the ordering.  The keys of all records are
+ * computed up front and then sorted with a least-significant-digit
+ * radix sort, carrying the position of each record along with its key.
+ * Since records are already in event ID order within the range and
+ * each radix pass is stable, records with equal keys stay in event ID
+ * order.  Passes where all keys share the same digit are skipped.
+ * Finally, the records are gathered into sorted order according to the
+ * positions carried with the sorted keys.
  * 
  * Parameters:
  * 
- *   pA - the first structure to compare
+ *   lo - the index of the first record in the range
  * 
- *   pB - the second structure to compare
+ *   hi - one greater than the index of the last record in the range
+ */
+static void sortMoments(int32_t lo, int32_t hi) {
+  
+  int32_t i = 0;
+  int32_t n = 0;
+  int32_t p = 0;
+  int32_t d = 0;
+  int32_t sum = 0;
+  int32_t c = 0;
+  int shift = 0;
+  uint64_t *pKey = NULL;
+  uint64_t *pTmp = NULL;
+  uint64_t *pSwap = NULL;
+  int32_t *pPos = NULL;
+  int32_t *pPosTmp = NULL;
+  int32_t *pPosSwap = NULL;
+  MOMENT *pSorted = NULL;
+  int32_t *pCount = NULL;
+  
+  /* Check parameters */
+  if ((lo < 0) || (hi < lo) || (hi > m_moment_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  n = hi - lo;
+  
+  /* Only proceed if at least two records */
+  if (n > 1) {
+    
+    /* Allocate key and position buffers, sorted record buffer, and
+     * counts */
+    pKey = (uint64_t *) calloc((size_t) n, sizeof(uint64_t));
+    pTmp = (uint64_t *) calloc((size_t) n, sizeof(uint64_t));
+    pPos = (int32_t *) calloc((size_t) n, sizeof(int32_t));
+    pPosTmp = (int32_t *) calloc((size_t) n, sizeof(int32_t));
+    pSorted = (MOMENT *) calloc((size_t) n, sizeof(MOMENT));
+    pCount = (int32_t *) calloc(
+                (size_t) (RADIX_PASSES * RADIX_SIZE), sizeof(int32_t));
+    if ((pKey == NULL) || (pTmp == NULL) ||
+        (pPos == NULL) || (pPosTmp == NULL) ||
+        (pSorted == NULL) || (pCount == NULL)) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    /* Compute the keys and the digit counts of every pass */
+    for(i = 0; i < n; i++) {
+      if (i > 0) {
+        if ((m_moment[lo + i]).eid <= (m_moment[lo + i - 1]).eid) {
+          raiseErr(__LINE__, NULL);
+        }
+      }
+      
+      pKey[i] = momentKey(&(m_moment[lo + i]));
+      pPos[i] = i;
+      for(p = 0; p < RADIX_PASSES; p++) {
+        d = (int32_t) ((pKey[i] >> (p * RADIX_BITS)) & (RADIX_SIZE - 1));
+        (pCount[(p * RADIX_SIZE) + d])++;
+      }
+    }
+    
+    /* Perform each pass, from least to most significant digit */
+    for(p = 0; p < RADIX_PASSES; p++) {
+      shift = p * RADIX_BITS;
+      
+      /* Skip the pass if all keys have the same digit */
+      d = (int32_t) ((pKey[0] >> shift) & (RADIX_SIZE - 1));
+      if (pCount[(p * RADIX_SIZE) + d] == n) {
+        continue;
+      }
+      
+      /* Convert the counts into bucket starting positions */
+      sum = 0;
+      for(d = 0; d < RADIX_SIZE; d++) {
+        c = pCount[(p * RADIX_SIZE) + d];
+        pCount[(p * RADIX_SIZE) + d] = sum;
+        sum += c;
+      }
+      
+      /* Scatter the keys and positions into their buckets */
+      for(i = 0; i < n; i++) {
+        d = (int32_t) ((pKey[i] >> shift) & (RADIX_SIZE - 1));
+        pTmp[pCount[(p * RADIX_SIZE) + d]] = pKey[i];
+        pPosTmp[pCount[(p * RADIX_SIZE) + d]] = pPos[i];
+        (pCount[(p * RADIX_SIZE) + d])++;
+      }
+      
+      pSwap = pKey;
+      pKey = pTmp;
+      pTmp = pSwap;
+      
+      pPosSwap = pPos;
+      pPos = pPosTmp;
+      pPosTmp = pPosSwap;
+    }
+    
+    /* Gather the records in sorted order and copy them back into the
+     * moment buffer */
+    for(i = 0; i < n; i++) {
+      memcpy(
+        &(pSorted[i]),
+        &(m_moment[lo + pPos[i]]),
+        sizeof(MOMENT));
+    }
+    memcpy(&(m_moment[lo]), pSorted, ((size_t) n) * sizeof(MOMENT));
+    
+    /* Release the temporary buffers */
+    free(pKey);
+    free(pTmp);
+    free(pPos);
+    free(pPosTmp);
+    free(pSorted);
+    free(pCount);
+    pKey = NULL;
+    pTmp = NULL;
+    pPos = NULL;
+    pPosTmp = NULL;
+    pSorted = NULL;
+    pCount = NULL;
+  }
+}
+
+/*
+ * Determine the track that a MIDI message belongs to.
+ * 
+ * In Format 0, all messages belong to track zero.  In Format 1, track
+ * zero is the conductor track, which holds all messages that do not
+ * have a MIDI channel, while messages for MIDI channel n (one-indexed)
+ * belong to track n.
+ * 
+ * Parameters:
+ * 
+ *   sel - the selector of the MIDI message
  * 
  * Return:
  * 
- *   less than zero, equal to zero, or greater than zero as the first
- *   element is less than, equal to, or greater than the second
+ *   the track index, in range zero to MIDI_CH_MAX inclusive
  */
-static int cmpMoment(const void *pA, const void *pB) {
+static int trackOf(uint64_t sel) {
   
   int result = 0;
-  const MOMENT *e1 = NULL;
-  const MOMENT *e2 = NULL;
-  int s1 = 0;
-  int s2 = 0;
-  int c1 = 0;
-  int c2 = 0;
+  int status = 0;
+  
+  if (m_format == 1) {
+    status = (int) (sel >> SEL_STATUS_SHIFT);
+    if ((status >= 0x80) && (status <= 0xef)) {
+      result = (status & 0x0f) + 1;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Prepare the MIDI tracks for encoding.
+ * 
+ * The records in the chunks of the moment buffer are moved into a
+ * single array with a stable counting pass that partitions them by
+ * track, so that the records of each track are contiguous and remain in
+ * event ID order.  Each chunk is released as soon as it has been moved.
+ * The records of each track are then sorted separately.
+ * 
+ * pStart must point to an array of TRACK_MAX + 1 elements.  Upon
+ * return, the records of track i are at indices pStart[i] up to but
+ * excluding pStart[i + 1] in m_moment.
+ * 
+ * Parameters:
+ * 
+ *   pStart - array that receives the starting index of each track
+ */
+static void prepareTracks(int32_t *pStart) {
+  
+  int32_t i = 0;
+  int32_t c = 0;
+  int32_t sum = 0;
+  int32_t pos[TRACK_MAX];
+  const MOMENT *pm = NULL;
+  
+  /* Check parameters */
+  if (pStart == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Check state */
+  if (m_moment != NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Move state messages from before the output window to its start */
+  if (m_win) {
+    clampWindow();
+  }
+  
+  /* Record peak capacities before the chunks are released */
+  statPeaks();
+  
+  /* Count the records in each track */
+  memset(pos, 0, sizeof(pos));
+  for(i = 0; i < m_moment_len; i++) {
+    pm = &((m_dir[i >> MOMENT_CHUNK_SHIFT])[i & (MOMENT_CHUNK_LEN - 1)]);
+    (pos[trackOf(pm->sel)])++;
+  }
+  
+  /* Convert the counts into track starting indices */
+  for(i = 0; i < TRACK_MAX; i++) {
+    c = pos[i];
+    pStart[i] = sum;
+    pos[i] = sum;
+    sum += c;
+  }
+  pStart[TRACK_MAX] = sum;
+  
+  /* Allocate the record array, with at least one record */
+  if (m_moment_len > 0) {
+    m_moment = (MOMENT *) calloc((size_t) m_moment_len, sizeof(MOMENT));
+  } else {
+    m_moment = (MOMENT *) calloc(1, sizeof(MOMENT));
+  }
+  if (m_moment == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  /* Move the records into the array partitioned by track, releasing
+   * each chunk after its last record is moved */
+  for(i = 0; i < m_moment_len; i++) {
+    pm = &((m_dir[i >> MOMENT_CHUNK_SHIFT])[i & (MOMENT_CHUNK_LEN - 1)]);
+    c = trackOf(pm->sel);
+    memcpy(&(m_moment[pos[c]]), pm, sizeof(MOMENT));
+    (pos[c])++;
+    
+    if ((i == m_moment_len - 1) ||
+        ((i & (MOMENT_CHUNK_LEN - 1)) == MOMENT_CHUNK_LEN - 1)) {
+      free(m_dir[i >> MOMENT_CHUNK_SHIFT]);
+      m_dir[i >> MOMENT_CHUNK_SHIFT] = NULL;
+    }
+  }
+  m_moment_cap = m_moment_len;
+  
+  /* Release the chunk directory, along with any chunks that were never
+   * used */
+  for(i = 0; i < m_dir_len; i++) {
+    if (m_dir[i] != NULL) {
+      free(m_dir[i]);
+      m_dir[i] = NULL;
+    }
+  }
+  if (m_dir != NULL) {
+    free(m_dir);
+    m_dir = NULL;
+  }
+  m_dir_cap = 0;
+  m_dir_len = 0;
+  
+  /* Sort each track */
+  for(i = 0; i < TRACK_MAX; i++) {
+    sortMoments(pStart[i], pStart[i + 1]);
+  }
+}
+
+/*
+ * Mark the state of a MIDI channel as unknown, or the state of all
+ * channels if ch is -1.
+ * 
+ * Parameters:
+ * 
+ *   ps - the channel state
+ * 
+ *   ch - the zero-indexed channel, or -1 for all channels
+ */
+static void pruneReset(PRUNE_STATE *ps, int ch) {
+  
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((ch < -1) || (ch >= MIDI_CH_MAX)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (ch < 0) {
+    memset(ps, 0xff, sizeof(PRUNE_STATE));
+  } else {
+    memset(ps->ctl[ch], 0xff, sizeof(ps->ctl[ch]));
+    memset(ps->poly[ch], 0xff, sizeof(ps->poly[ch]));
+    ps->prog[ch] = -1;
+    ps->pres[ch] = -1;
+    ps->bend[ch] = -1;
+    ps->pkind[ch] = -1;
+    ps->pmsb[ch] = -1;
+    ps->plsb[ch] = -1;
+    ps->dmsb[ch] = -1;
+    ps->dlsb[ch] = -1;
+  }
+}
+
+/*
+ * Update the channel state with a MIDI message and determine whether
+ * the message is redundant.
+ * 
+ * A message is redundant if it sets a controller, program, channel
+ * pressure, pitch bend, or polyphonic aftertouch value to the value the
+ * channel already has.  Data entry, data increment, and data decrement
+ * controllers are never redundant, since their effect depends on the
+ * selected parameter.  A parameter number selection is only redundant
+ * if the kind, MSB, and LSB of the parameter number it selects are all
+ * already known to be selected; selecting one kind forgets the other
+ * kind, since receivers have a single selected parameter.  The values
+ * sent with data entry are tracked for the selected parameter, but
+ * only for the seek index, and are forgotten when another parameter is
+ * selected or after a data increment or decrement.  Channel mode
+ * messages reset the state of their
+ * channel, a note-on resets the polyphonic aftertouch of its key, a
+ * change to a controller below 32 resets its LSB controller, since
+ * receivers clear the LSB when the MSB changes, and a bank select that
+ * changes the bank resets the program.  System
+ * exclusive messages reset the state of all channels, since they may
+ * change anything.
+ * 
+ * Parameters:
+ * 
+ *   ps - the channel state
+ * 
+ *   sel - the selector of the MIDI message
+ * 
+ * Return:
+ * 
+ *   non-zero if the message is redundant, zero if it must be kept
+ */
+static int pruneMsg(PRUNE_STATE *ps, uint64_t sel) {
+  
+  int result = 0;
+  int status = 0;
+  int ch = 0;
+  int d1 = 0;
+  int d2 = 0;
+  int kind = 0;
+  int16_t *pb = NULL;
+  
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  status = (int) (sel >> SEL_STATUS_SHIFT);
+  ch = status & 0x0f;
+  d1 = (int) ((sel >> SEL_DATA1_SHIFT) & 0x7f);
+  d2 = (int) (sel & 0x7f);
+  
+  if ((status >= 0x90) && (status <= 0x9f)) {
+    /* Note-on resets aftertouch of the key */
+    if (d2 > 0) {
+      ps->poly[ch][d1] = -1;
+    }
+    
+  } else if ((status >= 0xa0) && (status <= 0xaf)) {
+    /* Polyphonic aftertouch */
+    if (ps->poly[ch][d1] == d2) {
+      result = 1;
+    } else {
+      ps->poly[ch][d1] = (int16_t) d2;
+    }
+    
+  } else if ((status >= 0xb0) && (status <= 0xbf)) {
+    /* Control change */
+    if (d1 >= 120) {
+      pruneReset(ps, ch);
+      
+    } else if ((d1 >= 98) && (d1 <= 101)) {
+      /* Parameter number selection, where 101 and 100 select the MSB
+       * and LSB of a registered parameter, and 99 and 98 of a
+       * non-registered parameter */
+      if (d1 >= 100) {
+        kind = PRUNE_PARAM_REG;
+      } else {
+        kind = PRUNE_PARAM_NONREG;
+      }
+      if ((d1 & 1) != 0) {
+        pb = &(ps->pmsb[ch]);
+      } else {
+        pb = &(ps->plsb[ch]);
+      }
+      
+      if ((ps->pkind[ch] == kind) && (*pb == d2) &&
+          (ps->pmsb[ch] >= 0) && (ps->plsb[ch] >= 0)) {
+        result = 1;
+      } else {
+        if (ps->pkind[ch] != kind) {
+          ps->pkind[ch] = (int16_t) kind;
+          ps->pmsb[ch] = -1;
+          ps->plsb[ch] = -1;
+        }
+        *pb = (int16_t) d2;
+        ps->dmsb[ch] = -1;
+        ps->dlsb[ch] = -1;
+      }
+      
+    } else if (d1 == 6) {
+      /* Data entry MSB, which resets the LSB when it changes */
+      if (ps->dmsb[ch] != d2) {
+        ps->dmsb[ch] = (int16_t) d2;
+        ps->dlsb[ch] = -1;
+      }
+      
+    } else if (d1 == 38) {
+      /* Data entry LSB */
+      ps->dlsb[ch] = (int16_t) d2;
+      
+    } else if ((d1 == 96) || (d1 == 97)) {
+      /* Data increment and decrement */
+      ps->dmsb[ch] = -1;
+      ps->dlsb[ch] = -1;
+      
+    } else {
+      if (ps->ctl[ch][d1] == d2) {
+        result = 1;
+      } else {
+        ps->ctl[ch][d1] = (int16_t) d2;
+        if (d1 < 32) {
+          ps->ctl[ch][d1 + 32] = -1;
+        }
+        if ((d1 == 0) || (d1 == 32)) {
+          ps->prog[ch] = -1;
+        }
+      }
+    }
+    
+  } else if ((status >= 0xc0) && (status <= 0xcf)) {
+    /* Program change */
+    if (ps->prog[ch] == d1) {
+      result = 1;
+    } else {
+      ps->prog[ch] = (int16_t) d1;
+    }
+    
+  } else if ((status >= 0xd0) && (status <= 0xdf)) {
+    /* Channel pressure */
+    if (ps->pres[ch] == d1) {
+      result = 1;
+    } else {
+      ps->pres[ch] = (int16_t) d1;
+    }
+    
+  } else if ((status >= 0xe0) && (status <= 0xef)) {
+    /* Pitch bend */
+    if (ps->bend[ch] == ((d2 << 7) | d1)) {
+      result = 1;
+    } else {
+      ps->bend[ch] = (int16_t) ((d2 << 7) | d1);
+    }
+    
+  } else if ((status == 0xf0) || (status == 0xf7)) {
+    /* System exclusive */
+    pruneReset(ps, -1);
+  }
+  
+  return result;
+}
+
+/*
+ * Run the redundant event elimination pass on a sorted track.
+ * 
+ * The header messages of the track are used to establish the initial
+ * channel state but are never removed.  Redundant records in the given
+ * range of the moment buffer are then removed, and the remaining
+ * records are moved down to fill the gaps.  See pruneMsg() for which
+ * messages are redundant.
+ * 
+ * In Format 1, system exclusive messages are in the conductor track, so
+ * the channel state is reset at the start of every moment offset at or
+ * after a system exclusive message in the conductor track.  pStart is
+ * the array of track starting indices from prepareTracks().
+ * 
+ * Parameters:
+ * 
+ *   tr - the track index
+ * 
+ *   lo - the index of the first record of the track
+ * 
+ *   hi - one greater than the index of the last record of the track
+ * 
+ *   pStart - the track starting indices
+ * 
+ * Return:
+ * 
+ *   one greater than the index of the last remaining record of the
+ *   track
+ */
+static int32_t pruneTrack(int tr, int32_t lo, int32_t hi, int32_t *pStart) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t sp = 0;
+  int32_t sp_end = 0;
+  int s = 0;
+  PRUNE_STATE ps;
+  
+  /* Initialize structures */
+  pruneReset(&ps, -1);
+  
+  /* Check parameters */
+  if ((tr < 0) || (tr >= TRACK_MAX) || (pStart == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((lo < 0) || (hi < lo) || (hi > m_moment_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Establish initial state from the header messages of the track */
+  for(i = 0; i < m_head_len; i++) {
+    if (trackOf(m_head[i]) == tr) {
+      pruneMsg(&ps, m_head[i]);
+    }
+  }
+  
+  /* In Format 1, channel tracks must watch the conductor track for
+   * system exclusive messages */
+  if ((m_format == 1) && (tr > 0)) {
+    sp = pStart[0];
+    sp_end = pStart[1];
+  }
+  
+  /* Remove redundant records */
+  j = lo;
+  for(i = lo; i < hi; i++) {
+    while (sp < sp_end) {
+      if (quantizeMoment((m_moment[sp]).t) >
+            quantizeMoment((m_moment[i]).t)) {
+        break;
+      }
+      s = (int) ((m_moment[sp]).sel >> SEL_STATUS_SHIFT);
+      if ((s == 0xf0) || (s == 0xf7)) {
+        pruneReset(&ps, -1);
+      }
+      sp++;
+    }
+    
+    if (!pruneMsg(&ps, (m_moment[i]).sel)) {
+      if (j != i) {
+        memcpy(&(m_moment[j]), &(m_moment[i]), sizeof(MOMENT));
+      }
+      j++;
+    }
+  }
+  
+  m_stats.pruned_count += (hi - j);
+  
+  return j;
+}
+
+/*
+ * Get the time of a moment buffer record in delta time units from the
+ * lower bound of the event range.
+ * 
+ * Parameters:
+ * 
+ *   i - the index of the record in the moment buffer
+ * 
+ * Return:
+ * 
+ *   the time of the record in delta time units
+ */
+static int32_t momentTicks(int32_t i) {
+  if ((i < 0) || (i >= m_moment_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  return quantize(pointer_unpack((m_moment[i]).t, NULL))
+            - quantize(m_lower);
+}
+
+/*
+ * Assemble the data of every blob and text in the handle table.
+ * 
+ * Blobs and texts built from views assemble their data the first time
+ * it is needed, so this is called before messages are packed on worker
+ * threads, which then only read the data.
+ */
+static void assembleHandles(void) {
+  
+  int32_t i = 0;
+  
+  for(i = 0; i < m_h_len; i++) {
+    if ((m_h[i]).is_blob) {
+      blob_ptr((m_h[i]).ptr.pBlob);
+    } else {
+      text_ptr((m_h[i]).ptr.pText);
+    }
+  }
+}
+
+/*
+ * Make room in capacity for a given number of bytes in the buffer of
+ * an encoding job.
+ * 
+ * n is the number of additional bytes beyond current length to make
+ * room for.  It must be zero or greater.  The buffer is limited to the
+ * same maximum capacity as the output buffer.
+ * 
+ * Parameters:
+ * 
+ *   pj - the encoding job
+ * 
+ *   n - the number of bytes to make room for
+ */
+static void capJob(ENCODE_JOB *pj, int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  if (pj == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (n <= INT32_MAX - pj->len) {
+    target = pj->len + n;
+  } else {
+    raiseErr(__LINE__, "Compiled MIDI file too large");
+  }
+  
+  if (target > pj->cap) {
+    if (target > OUT_MAX_CAP) {
+      raiseErr(__LINE__, "Compiled MIDI file too large");
+    }
+    
+    new_cap = pj->cap;
+    if (new_cap < 1) {
+      new_cap = OUT_INIT_CAP;
+    }
+    while (new_cap < target) {
+      if (new_cap <= OUT_MAX_CAP / 2) {
+        new_cap *= 2;
+      } else {
+        new_cap = OUT_MAX_CAP;
+      }
+    }
+    
+    pj->pBuf = (uint8_t *) realloc(pj->pBuf, (size_t) new_cap);
+    if (pj->pBuf == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    pj->cap = new_cap;
+  }
+}
+
+/*
+ * Worker thread entrypoint for encoding a chunk of a track.
+ * 
+ * The interface of this function matches the start routine of the
+ * pthread_create() function.  The argument must be an ENCODE_JOB
+ * structure.  Each message of the chunk is encoded with its delta time
+ * into the buffer of the job, in the same way as encodeTrack().
+ * 
+ * Errors are trapped rather than reported.  If an error occurs, the
+ * fault flag of the job is set and the job stops.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the ENCODE_JOB structure
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *encodeWorker(void *pArg) {
+  
+  ENCODE_JOB *pj = NULL;
+  int32_t i = 0;
+  int32_t t = 0;
+  int32_t delta = 0;
+  int32_t len = 0;
+  
+  pj = (ENCODE_JOB *) pArg;
+  pj->fault = 0;
+  
+  diagnostic_trap(&(pj->trap));
+  if (setjmp(pj->trap)) {
+    pj->fault = 1;
+  } else {
+    for(i = pj->lo; i < pj->hi; i++) {
+      t = momentTicks(i);
+      delta = t - pj->prev_t;
+      pj->prev_t = t;
+      
+      if ((delta < 0) || (delta > INT32_C(0x0FFFFFFF))) {
+        raiseErr(__LINE__, "MIDI delta time overflow");
+      }
+      
+      if (pj->cap - pj->len < 4) {
+        capJob(pj, 4);
+      }
+      pj->len += (int32_t) encodeVInt(&((pj->pBuf)[pj->len]), delta);
+      
+      len = packMsg(&((pj->pBuf)[pj->len]), pj->cap - pj->len,
+              (m_moment[i]).sel, &(pj->rstatus));
+      if (len > pj->cap - pj->len) {
+        capJob(pj, len);
+        packMsg(&((pj->pBuf)[pj->len]), pj->cap - pj->len,
+          (m_moment[i]).sel, &(pj->rstatus));
+      }
+      pj->len += len;
+    }
+  }
+  diagnostic_trap(NULL);
+  
+  return NULL;
+}
+
+/*
+ * Encode a range of the moment buffer into the output buffer on worker
+ * threads.
+ * 
+ * This is used by encodeTrack() after the header messages of the track
+ * have been written.  The range is split into one chunk for each
+ * thread, with at least ENCODE_CHUNK_MIN records in each chunk.  Each
+ * chunk only depends on the chunk before it through the time of its
+ * first delta and the running status byte, and both of these follow
+ * directly from the last record before the chunk.  The chunks are
+ * therefore encoded independently into their own buffers and then
+ * appended to the output buffer in order, giving the same bytes as
+ * encoding the range on the calling thread.  m_rstatus is updated to
+ * the running status byte after the range.
+ * 
+ * Nothing is encoded if there are not enough records or threads for
+ * more than one chunk, or if any chunk raises an error.  The caller
+ * must then encode the range itself, which also reports the error.
+ * 
+ * Parameters:
+ * 
+ *   lo - the index of the first record in the moment buffer
+ * 
+ *   hi - one greater than the index of the last record
+ * 
+ * Return:
+ * 
+ *   non-zero if the range was encoded, zero if the caller must encode
+ *   it
+ */
+static int encodeChunks(int32_t lo, int32_t hi) {
+  
+  ENCODE_JOB *pj = NULL;
+  int64_t est = 0;
+  int32_t count = 0;
+  int32_t k = 0;
+  int s = 0;
+  int fault = 0;
+  
+  if ((lo < 0) || (hi < lo) || (hi > m_moment_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Determine the number of chunks */
+  count = (hi - lo) / ENCODE_CHUNK_MIN;
+  if (count > (int32_t) m_threads) {
+    count = (int32_t) m_threads;
+  }
+  if (count < 2) {
+    return 0;
+  }
+  
+  /* Make sure the workers only read blob and text data */
+  assembleHandles();
+  
+  /* Split the range evenly, with the time and running status before
+   * each chunk taken from the record before it, and the track start
+   * taking the running status left by the header messages */
+  pj = (ENCODE_JOB *) calloc((size_t) count, sizeof(ENCODE_JOB));
+  if (pj == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  for(k = 0; k < count; k++) {
+    (pj[k]).lo = lo + (int32_t) ((((int64_t) (hi - lo)) * k) / count);
+    (pj[k]).hi = lo + (int32_t) ((((int64_t) (hi - lo)) * (k + 1))
+                    / count);
+    
+    if (k > 0) {
+      (pj[k]).prev_t = momentTicks((pj[k]).lo - 1);
+      s = (int) ((m_moment[(pj[k]).lo - 1]).sel >> SEL_STATUS_SHIFT);
+      if ((s >= 0x80) && (s <= 0xef)) {
+        (pj[k]).rstatus = s;
+      } else {
+        (pj[k]).rstatus = 0;
+      }
+    } else {
+      (pj[k]).prev_t = 0;
+      (pj[k]).rstatus = m_rstatus;
+    }
+    
+    /* Most messages take three or four bytes with their delta */
+    est = ((int64_t) ((pj[k]).hi - (pj[k]).lo)) * 4;
+    if (est > OUT_MAX_CAP) {
+      est = OUT_MAX_CAP;
+    }
+    capJob(&(pj[k]), (int32_t) est);
+  }
+  
+  /* Start all the workers and wait for them to finish */
+  for(k = 0; k < count; k++) {
+    if (pthread_create(&((pj[k]).thread), NULL,
+                        &encodeWorker, &(pj[k]))) {
+      raiseErr(__LINE__, "Failed to start encoding thread");
+    }
+  }
+  for(k = 0; k < count; k++) {
+    if (pthread_join((pj[k]).thread, NULL)) {
+      raiseErr(__LINE__, "Failed to join encoding thread");
+    }
+    if ((pj[k]).fault) {
+      fault = 1;
+    }
+  }
+  
+  /* Append the chunks in order */
+  if (!fault) {
+    for(k = 0; k < count; k++) {
+      writeBinary((pj[k]).pBuf, (pj[k]).len);
+    }
+    m_rstatus = (pj[count - 1]).rstatus;
+  }
+  
+  for(k = 0; k < count; k++) {
+    free((pj[k]).pBuf);
+    (pj[k]).pBuf = NULL;
+  }
+  free(pj);
+  pj = NULL;
+  
+  return !fault;
+}
+
+/*
+ * Make room in capacity for a given number of bytes in the seek index
+ * buffer.
+ * 
+ * n is the number of additional bytes beyond current length to make
+ * room for.  It must be zero or greater.  An error occurs if the
+ * requested expansion would go beyond the maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of bytes to make room for
+ */
+static void capIndex(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Compute target length */
+  if (n <= INDEX_MAX_CAP - m_idx_len) {
+    target = m_idx_len + n;
+  } else {
+    raiseErr(__LINE__, "Seek index capacity exceeded");
+  }
+  
+  /* Expand capacity by doubling until greater than or equal to target
+   * length, limited to the maximum capacity */
+  if (target > m_idx_cap) {
+    new_cap = m_idx_cap;
+    if (new_cap < INDEX_INIT_CAP) {
+      new_cap = INDEX_INIT_CAP;
+    }
+    while (new_cap < target) {
+      new_cap *= 2;
+    }
+    if (new_cap > INDEX_MAX_CAP) {
+      new_cap = INDEX_MAX_CAP;
+    }
+    
+    m_idx = (uint8_t *) realloc(m_idx, (size_t) new_cap);
+    if (m_idx == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_idx_cap = new_cap;
+  }
+}
+
+/*
+ * Append an unsigned big-endian integer to the seek index buffer.
+ * 
+ * Parameters:
+ * 
+ *   val - the value to append
+ * 
+ *   bytes - the number of bytes, in range 1 to 4 inclusive
+ */
+static void indexPut(uint32_t val, int bytes) {
+  
+  if ((bytes < 1) || (bytes > 4)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  capIndex((int32_t) bytes);
+  for( ; bytes > 0; bytes--) {
+    m_idx[m_idx_len] = (uint8_t) ((val >> ((bytes - 1) * 8)) & 0xff);
+    m_idx_len++;
+  }
+}
+
+/*
+ * Make room in capacity for a given number of entries in the seek index
+ * mark table.
+ * 
+ * n is the number of additional entries beyond current length to make
+ * room for.  It must be zero or greater.  An error occurs if the
+ * requested expansion would go beyond the maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of entries to make room for
+ */
+static void capMark(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Compute target length */
+  if (n <= MARK_MAX_CAP - m_mark_len) {
+    target = m_mark_len + n;
+  } else {
+    raiseErr(__LINE__, "Seek index mark table capacity exceeded");
+  }
+  
+  /* Expand capacity by doubling until greater than or equal to target
+   * length, limited to the maximum capacity */
+  if (target > m_mark_cap) {
+    new_cap = m_mark_cap;
+    if (new_cap < MARK_INIT_CAP) {
+      new_cap = MARK_INIT_CAP;
+    }
+    while (new_cap < target) {
+      new_cap *= 2;
+    }
+    if (new_cap > MARK_MAX_CAP) {
+      new_cap = MARK_MAX_CAP;
+    }
+    
+    m_mark = (int32_t *) realloc(m_mark,
+                          ((size_t) new_cap) * sizeof(int32_t));
+    if (m_mark == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_mark_cap = new_cap;
+  }
+}
+
+/*
+ * Comparison function for sorting the seek index mark table in
+ * ascending order with qsort().
+ * 
+ * Parameters:
+ * 
+ *   pA - the first entry
+ * 
+ *   pB - the second entry
+ * 
+ * Return:
+ * 
+ *   less than, equal to, or greater than zero as the first entry is
+ *   less than, equal to, or greater than the second
+ */
+static int cmpMark(const void *pA, const void *pB) {
+  
+  int32_t a = 0;
+  int32_t b = 0;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  a = *((const int32_t *) pA);
+  b = *((const int32_t *) pB);
+  
+  if (a < b) {
+    return -1;
+  } else if (a > b) {
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Prepare the seek index before the tracks are encoded.
+ * 
+ * The marks are converted into delta time units from the lower bound
+ * of the event range and sorted, and the seek index buffer is emptied.
+ * Marks outside the range of 32-bit delta times are dropped.
+ */
+static void prepareIndex(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int64_t t = 0;
+  
+  for(i = 0; i < m_mark_len; i++) {
+    t = ((int64_t) quantize(m_mark[i])) - ((int64_t) quantize(m_lower));
+    if ((t >= 0) && (t <= INT32_MAX)) {
+      m_mark[j] = (int32_t) t;
+      j++;
+    }
+  }
+  m_mark_len = j;
+  
+  if (m_mark_len > 1) {
+    qsort(m_mark, (size_t) m_mark_len, sizeof(int32_t), &cmpMark);
+  }
+  
+  m_idx_len = 0;
+  m_idx_count = 0;
+}
+
+/*
+ * Find the next seek point target after a given time.
+ * 
+ * The target is the smallest multiple of the seek point spacing or
+ * mark that is greater than the given time.  pMark is the index of the
+ * first mark that may still be returned, which is advanced past the
+ * marks that are not greater than the given time.
+ * 
+ * Parameters:
+ * 
+ *   after - the time in delta time units
+ * 
+ *   pMark - the mark cursor
+ * 
+ * Return:
+ * 
+ *   the next target in delta time units, or INT32_MAX if there is none
+ */
+static int32_t nextTarget(int32_t after, int32_t *pMark) {
+  
+  int32_t result = INT32_MAX;
+  int64_t r = 0;
+  
+  if ((after < 0) || (pMark == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  while ((*pMark < m_mark_len) && (m_mark[*pMark] <= after)) {
+    (*pMark)++;
+  }
+  if (*pMark < m_mark_len) {
+    result = m_mark[*pMark];
+  }
+  
+  if (m_idx_step > 0) {
+    r = ((((int64_t) after) / m_idx_step) + 1) * m_idx_step;
+    if (r < result) {
+      result = (int32_t) r;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Append a seek point to the seek index buffer.
+ * 
+ * The point refers to the delta time that is about to be written at the
+ * current end of the output buffer, with the current running status.
+ * 
+ * Parameters:
+ * 
+ *   tr - the track index
+ * 
+ *   t - the time of the message in delta time units
+ * 
+ *   prev_t - the time of the previous message in delta time units
+ * 
+ *   ps - the channel state of the track before the message
+ */
+static void indexPoint(
+    int                 tr,
+    int32_t             t,
+    int32_t             prev_t,
+    const PRUNE_STATE * ps) {
+  
+  int32_t count_pos = 0;
+  int32_t count = 0;
+  int ch = 0;
+  int c = 0;
+  
+  /* Check parameters */
+  if ((tr < 0) || (tr >= TRACK_MAX) || (t < 0) || (prev_t < 0) ||
+      (ps == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Check state */
+  if (m_idx_count >= INT32_MAX) {
+    raiseErr(__LINE__, "Seek index capacity exceeded");
+  }
+  
+  /* Write the fixed fields, with a placeholder for the count */
+  indexPut((uint32_t) t, 4);
+  indexPut((uint32_t) m_out_len, 4);
+  indexPut((uint32_t) prev_t, 4);
+  indexPut((uint32_t) tr, 1);
+  indexPut((uint32_t) m_rstatus, 1);
+  count_pos = m_idx_len;
+  indexPut(0, 2);
+  
+  /* Write the snapshot of each channel */
+  for(ch = 0; ch < MIDI_CH_MAX; ch++) {
+    if (ps->ctl[ch][0] >= 0) {
+      indexPut(0xb00000 | (((uint32_t) ch) << 16)
+                | ((uint32_t) ps->ctl[ch][0]), 3);
+      count++;
+    }
+    if (ps->ctl[ch][32] >= 0) {
+      indexPut(0xb02000 | (((uint32_t) ch) << 16)
+                | ((uint32_t) ps->ctl[ch][32]), 3);
+      count++;
+    }
+    if (ps->prog[ch] >= 0) {
+      indexPut(0xc00000 | (((uint32_t) ch) << 16)
+                | (((uint32_t) ps->prog[ch]) << 8), 3);
+      count++;
+    }
+    for(c = 1; c < 120; c++) {
+      if ((c != 32) && (ps->ctl[ch][c] >= 0)) {
+        indexPut(0xb00000 | (((uint32_t) ch) << 16)
+                  | (((uint32_t) c) << 8)
+                  | ((uint32_t) ps->ctl[ch][c]), 3);
+        count++;
+      }
+    }
+    if (ps->pkind[ch] >= 0) {
+      if (ps->pkind[ch] == PRUNE_PARAM_REG) {
+        c = 101;
+      } else {
+        c = 99;
+      }
+      if (ps->pmsb[ch] >= 0) {
+        indexPut(0xb00000 | (((uint32_t) ch) << 16)
+                  | (((uint32_t) c) << 8)
+                  | ((uint32_t) ps->pmsb[ch]), 3);
+        count++;
+      }
+      if (ps->plsb[ch] >= 0) {
+        indexPut(0xb00000 | (((uint32_t) ch) << 16)
+                  | (((uint32_t) (c - 1)) << 8)
+                  | ((uint32_t) ps->plsb[ch]), 3);
+        count++;
+      }
+      if ((ps->pmsb[ch] >= 0) && (ps->plsb[ch] >= 0)) {
+        if (ps->dmsb[ch] >= 0) {
+          indexPut(0xb00600 | (((uint32_t) ch) << 16)
+                    | ((uint32_t) ps->dmsb[ch]), 3);
+          count++;
+        }
+        if (ps->dlsb[ch] >= 0) {
+          indexPut(0xb02600 | (((uint32_t) ch) << 16)
+                    | ((uint32_t) ps->dlsb[ch]), 3);
+          count++;
+        }
+      }
+    }
+    if (ps->pres[ch] >= 0) {
+      indexPut(0xd00000 | (((uint32_t) ch) << 16)
+                | (((uint32_t) ps->pres[ch]) << 8), 3);
+      count++;
+    }
+    if (ps->bend[ch] >= 0) {
+      indexPut(0xe00000 | (((uint32_t) ch) << 16)
+                | ((((uint32_t) ps->bend[ch]) & 0x7f) << 8)
+                | (((uint32_t) ps->bend[ch]) >> 7), 3);
+      count++;
+    }
+  }
+  
+  /* Patch the count */
+  m_idx[count_pos] = (uint8_t) (count >> 8);
+  m_idx[count_pos + 1] = (uint8_t) (count & 0xff);
+  
+  m_idx_count++;
+}
+
+/*
+ * Write the seek index buffer to the seek index file.
+ * 
+ * This is called after all the tracks have been encoded.
+ */
+static void writeIndex(void) {
+  
+  FILE *fh = NULL;
+  uint8_t head[INDEX_SIGNATURE_LEN + 8];
+  int32_t i = 0;
+  
+  memset(head, 0, sizeof(head));
+  
+  /* Check state */
+  if (m_idx_path == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Build the file header */
+  memcpy(head, INDEX_SIGNATURE, (size_t) INDEX_SIGNATURE_LEN);
+  i = INDEX_SIGNATURE_LEN;
+  head[i++] = (uint8_t) (m_format >> 8);
+  head[i++] = (uint8_t) (m_format & 0xff);
+  head[i++] = (uint8_t) (m_ppq >> 8);
+  head[i++] = (uint8_t) (m_ppq & 0xff);
+  head[i++] = (uint8_t) (((uint32_t) m_idx_count) >> 24);
+  head[i++] = (uint8_t) ((((uint32_t) m_idx_count) >> 16) & 0xff);
+  head[i++] = (uint8_t) ((((uint32_t) m_idx_count) >> 8) & 0xff);
+  head[i++] = (uint8_t) (((uint32_t) m_idx_count) & 0xff);
+  
+  /* Write the header and the seek points */
+  fh = fopen(m_idx_path, "wb");
+  if (fh == NULL) {
+    raiseErr(__LINE__, "Failed to create file: %s", m_idx_path);
+  }
+  
+  if (fwrite(head, 1, sizeof(head), fh) != sizeof(head)) {
+    raiseErr(__LINE__, "I/O error writing seek index");
+  }
+  if (m_idx_len > 0) {
+    if (fwrite(m_idx, 1, (size_t) m_idx_len, fh) != (size_t) m_idx_len) {
+      raiseErr(__LINE__, "I/O error writing seek index");
+    }
+  }
+  
+  if (fclose(fh)) {
+    raiseErr(__LINE__, "I/O error writing seek index");
+  }
+  fh = NULL;
+}
+
+/*
+ * Encode a MIDI track chunk into the output buffer.
+ * 
+ * The track holds all messages in the header buffer that belong to the
+ * track, followed by the given range of the moment buffer, followed by
+ * an End Of Track message at the upper bound of the event range.  The
+ * length of the track is written as zero at first and then filled in
+ * once the track is complete.
+ * 
+ * If a seek index is generated, the channel state of the track is
+ * tracked with pruneMsg() while the messages are written, and seek
+ * points are added before the messages at the seek point targets.
+ * 
+ * Parameters:
+ * 
+ *   tr - the track index
+ * 
+ *   lo - the index of the first record of the track in the moment
+ *   buffer
+ * 
+ *   hi - one greater than the index of the last record of the track in
+ *   the moment buffer
+ * 
+ *   eot - the selector of an End Of Track message
+ */
+static void encodeTrack(int tr, int32_t lo, int32_t hi, uint64_t eot) {
+  
+  int32_t i = 0;
+  int32_t t = 0;
+  int32_t prev_t = 0;
+  int32_t delta = 0;
+  int32_t start = 0;
+  int32_t next = 0;
+  int32_t mk = 0;
+  uint32_t len = 0;
+  PRUNE_STATE ps;
+  
+  /* Initialize structures */
+  pruneReset(&ps, -1);
+  
+  /* Check parameters */
+  if ((tr < 0) || (tr >= TRACK_MAX)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((lo < 0) || (hi < lo) || (hi > m_moment_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Open the track chunk so that we are ready to start writing delta
+   * times and MIDI events; running status never carries across
+   * chunks */
+  writeString("MTrk");
+  writeUint32BE((uint32_t) 0);    /* Length of MIDI track, patched */
+  start = m_out_len;
+  m_rstatus = 0;
+  
+  /* Write all the MIDI messages of this track in the header buffer,
+   * each with a delta time of zero */
+  for(i = 0; i < m_head_len; i++) {
+    if (trackOf(m_head[i]) == tr) {
+      printVInt(0);
+      printMsg(m_head[i]);
+      if (m_idx_path != NULL) {
+        pruneMsg(&ps, m_head[i]);
+      }
+    }
+  }
+  
+  /* Write the MIDI messages in the moment buffer range on worker
+   * threads if there are enough of them and no seek index is
+   * generated, continuing after the range with the time of its last
+   * message */
+  i = lo;
+  if ((m_idx_path == NULL) && encodeChunks(lo, hi)) {
+    i = hi;
+    if (hi > lo) {
+      prev_t = momentTicks(hi - 1);
+    }
+  }
+  
+  /* Write all the remaining MIDI messages in the moment buffer range,
+   * followed by the End Of Track message, each with the encoded delta
+   * time -- moment offsets are converted into delta time units from the
+   * lower bound of the event range, and then into the delta time from
+   * the previous event */
+  for( ; i <= hi; i++) {
+    if (i < hi) {
+      t = momentTicks(i);
+    } else {
+      t = quantize(m_upper) - quantize(m_lower);
+    }
+    delta = t - prev_t;
+    
+    if ((delta < 0) || (delta > INT32_C(0x0FFFFFFF))) {
+      raiseErr(__LINE__, "MIDI delta time overflow");
+    }
+    
+    if ((m_idx_path != NULL) && (i < hi) && (t >= next)) {
+      indexPoint(tr, t, prev_t, &ps);
+      next = nextTarget(t, &mk);
+    }
+    prev_t = t;
+    
+    printVInt(delta);
+    if (i < hi) {
+      printMsg((m_moment[i]).sel);
+      if (m_idx_path != NULL) {
+        pruneMsg(&ps, (m_moment[i]).sel);
+      }
+    } else {
+      printMsg(eot);
+    }
+  }
+  
+  /* Patch the length of the MIDI track into the track chunk header */
+  len = (uint32_t) (m_out_len - start);
+  
+  m_out[start - 4] = (uint8_t)  (len >> 24)        ;
+  m_out[start - 3] = (uint8_t) ((len >> 16) & 0xff);
+  m_out[start - 2] = (uint8_t) ((len >>  8) & 0xff);
+  m_out[start - 1] = (uint8_t) ( len        & 0xff);
+}
+
+/*
+ * Encode the complete MIDI file into the output buffer.
+ * 
+ * The output buffer must have been opened with openOut().  Each track
+ * is prepared with prepareTracks() and then encoded in a single pass
+ * over its messages with encodeTrack(), after the redundant event
+ * elimination pass if it is enabled.  In Format 1, the conductor
+ * track is always present, while channel tracks are only present if
+ * they have at least one message.  Upon return, m_out_len is the length
+ * of the file.
+ * 
+ * If a seek index is generated, it is written once all the tracks have
+ * been encoded.
+ */
+static void encodeFile(void) {
+  
+  int32_t i = 0;
+  int track_count = 0;
+  uint64_t eot = 0;
+  int32_t start[TRACK_MAX + 1];
+  int32_t end[TRACK_MAX];
+  int used[TRACK_MAX];
+  
+  /* Initialize arrays */
+  memset(start, 0, sizeof(start));
+  memset(end, 0, sizeof(end));
+  memset(used, 0, sizeof(used));
+  
+  /* Check state */
+  if ((m_out == NULL) || (m_out_len != 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Prepare the tracks and get an End Of Track message */
+  prepareTracks(start);
+  eot = addMsgMD(0xff, 0x2f, NULL, 0);
+  
+  /* Remove redundant records if requested -- the conductor track is
+   * pruned last since channel tracks watch it for system exclusive
+   * messages */
+  for(i = TRACK_MAX - 1; i >= 0; i--) {
+    if (m_prune) {
+      end[i] = pruneTrack((int) i, start[i], start[i + 1], start);
+    } else {
+      end[i] = start[i + 1];
+    }
+  }
+  
+  /* Determine which tracks are used */
+  used[0] = 1;
+  for(i = 0; i < m_head_len; i++) {
+    used[trackOf(m_head[i])] = 1;
+  }
+  for(i = 0; i < TRACK_MAX; i++) {
+    if (start[i + 1] > start[i]) {
+      used[i] = 1;
+    }
+    if (used[i]) {
+      track_count++;
+    }
+  }
+  
+  /* Write the MIDI file header */
+  writeString("MThd");
+  writeUint32BE((uint32_t) 6);            /* Length of head chunk */
+  writeUint16BE((uint16_t) m_format);     /* Format */
+  writeUint16BE((uint16_t) track_count);  /* Number of tracks */
+  writeUint16BE((uint16_t) m_ppq);        /* Units per quarter */
+  
+  /* Write each used track, followed by the seek index if requested */
+  if (m_idx_path != NULL) {
+    prepareIndex();
+  }
+  for(i = 0; i < TRACK_MAX; i++) {
+    if (used[i]) {
+      encodeTrack((int) i, start[i], end[i], eot);
+    }
+  }
+  if (m_idx_path != NULL) {
+    writeIndex();
+  }
+}
+
+/*
+ * Determine the tempo after a MIDI message during live output.
+ * 
+ * If the message is a tempo meta-event with a direct payload, the new
+ * tempo it sets is returned.  Otherwise, the current tempo is returned.
+ * 
+ * Parameters:
+ * 
+ *   sel - the selector of the MIDI message
+ * 
+ *   tempo - the current tempo in microseconds per quarter note
+ * 
+ * Return:
+ * 
+ *   the tempo after the message in microseconds per quarter note
+ */
+static int32_t liveTempo(uint64_t sel, int32_t tempo) {
+  
+  int32_t msg = 0;
+  int32_t len = 0;
+  int32_t cl = 0;
+  
+  if ((int) (sel >> SEL_STATUS_SHIFT) == 0xff) {
+    msg = (int32_t) (sel & SEL_OFFSET_MASK);
+    if ((msg < 0) || (msg >= m_msg_len - 1)) {
+      raiseErr(__LINE__, NULL);
+    }
+    
+    if ((int) m_msg[msg] == 0x51) {
+      cl = (int32_t) decodeVInt(
+                        &(m_msg[msg + 1]),
+                        &len,
+                        m_msg_len - msg - 1);
+      if ((len == 3) && (len <= m_msg_len - msg - cl - 1)) {
+        tempo = (((int32_t) m_msg[msg + cl + 1]) << 16)
+                  | (((int32_t) m_msg[msg + cl + 2]) << 8)
+                  | ((int32_t) m_msg[msg + cl + 3]);
+      }
+    }
+  }
+  
+  return tempo;
+}
+
+/*
+ * Wait until a given number of microseconds have elapsed since a start
+ * time on the monotonic clock.
+ * 
+ * Returns immediately if the time has already passed.
+ * 
+ * Parameters:
+ * 
+ *   pStart - the start time
+ * 
+ *   us - the number of microseconds after the start time to wait for
+ */
+static void liveWait(const struct timespec *pStart, int64_t us) {
+  
+  struct timespec now;
+  struct timespec req;
+  int64_t elapsed = 0;
+  
+  memset(&now, 0, sizeof(struct timespec));
+  memset(&req, 0, sizeof(struct timespec));
+  
+  if (pStart == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for( ; ; ) {
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+      raiseErr(__LINE__, "Failed to read clock");
+    }
+    
+    elapsed = (((int64_t) (now.tv_sec - pStart->tv_sec)) * 1000000)
+                + (((int64_t) (now.tv_nsec - pStart->tv_nsec)) / 1000);
+    if (elapsed >= us) {
+      break;
+    }
+    
+    req.tv_sec = (time_t) ((us - elapsed) / 1000000);
+    req.tv_nsec = (long) (((us - elapsed) % 1000000) * 1000);
+    nanosleep(&req, NULL);
+  }
+}
+
+/*
+ * Write a system exclusive message to the output buffer as raw MIDI
+ * bytes.
+ * 
+ * Unlike in MIDI files, raw MIDI system exclusive messages have no
+ * length declaration.  For status 0xF0, the whole blob is written,
+ * which begins with the 0xF0 status byte.  For status 0xF7, the blob is
+ * written as-is without any status byte, since it is an escape for
+ * arbitrary bytes.  Running status is cleared.
+ * 
+ * Parameters:
+ * 
+ *   sel - the selector of the system exclusive message
+ */
+static void liveSystem(uint64_t sel) {
+  
+  int status = 0;
+  int32_t msg = 0;
+  int32_t h = 0;
+  
+  status = (int) (sel >> SEL_STATUS_SHIFT);
+  msg = (int32_t) (sel & SEL_OFFSET_MASK);
+  
+  if ((status != 0xf0) && (status != 0xf7)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((msg < 0) || (msg >= m_msg_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  decodeVInt(&(m_msg[msg]), &h, m_msg_len - msg);
+  if ((h < 0) || (h >= m_h_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (!((m_h[h]).is_blob)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (blob_len((m_h[h]).ptr.pBlob) > 0) {
+    writeBinary(
+      blob_ptr((m_h[h]).ptr.pBlob),
+      blob_len((m_h[h]).ptr.pBlob));
+  }
+  m_rstatus = 0;
+}
+
+/*
+ * Play all the messages of the MIDI module in real time as a raw MIDI
+ * byte stream to the given output file.
+ * 
+ * The messages are prepared in the same way as for a Format 0 file.
+ * Header messages are sent immediately, followed by the sorted moment
+ * buffer.  All the messages at the same delta time are encoded together
+ * into the output buffer, which is then written and flushed once the
+ * real time of that delta time arrives.  Real times are computed from
+ * the tempo meta-events in the messages.
+ * 
+ * Every channel message is sent with its status byte, so that receivers
+ * never depend on running status.  System exclusive messages are sent
+ * with liveSystem().  Meta-events are not sent, since they only exist
+ * in MIDI files.
+ * 
+ * The output buffer must have been opened with openOut() in memory
+ * mode.
+ * 
+ * Parameters:
+ * 
+ *   pOut - the file to send the raw MIDI byte stream to
+ */
+static void playLive(FILE *pOut) {
+  
+  int32_t i = 0;
+  int32_t t = 0;
+  int32_t group_t = 0;
+  int32_t base_t = 0;
+  int32_t tempo = DEFAULT_TEMPO;
+  int64_t base_us = 0;
+  int64_t us = 0;
+  uint64_t sel = 0;
+  int32_t start[TRACK_MAX + 1];
+  int32_t end = 0;
+  struct timespec clock_start;
+  
+  /* Initialize structures */
+  memset(start, 0, sizeof(start));
+  memset(&clock_start, 0, sizeof(struct timespec));
+  
+  /* Check parameters and state */
+  if (pOut == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((m_out == NULL) || (m_out_fd >= 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Prepare a single track, running the redundant event elimination
+   * pass if requested */
+  m_format = 0;
+  prepareTracks(start);
+  if (m_prune) {
+    end = pruneTrack(0, start[0], start[1], start);
+  } else {
+    end = start[1];
+  }
+  
+  /* Get the start time */
+  if (clock_gettime(CLOCK_MONOTONIC, &clock_start) != 0) {
+    raiseErr(__LINE__, "Failed to read clock");
+  }
+  
+  /* Go through the header messages and then the moment buffer, sending
+   * the accumulated group of messages each time the delta time changes
+   * and after the last message */
+  for(i = 0 - m_head_len; i <= end; i++) {
+    
+    /* Get message and delta time, with a negative index into the header
+     * messages, and the index at the end of the moment buffer
+     * representing the end of the stream */
+    if (i < 0) {
+      sel = m_head[m_head_len + i];
+      t = 0;
+    } else if (i < end) {
+      sel = (m_moment[i]).sel;
+      t = quantize(pointer_unpack((m_moment[i]).t, NULL))
+            - quantize(m_lower);
+    } else {
+      t = -1;
+    }
+    
+    /* If delta time changed, send the group for the previous delta
+     * time at its real time */
+    if ((t != group_t) && (m_out_len > 0)) {
+      liveWait(&clock_start, base_us + (((int64_t) (group_t - base_t))
+                                * tempo) / m_ppq);
+      
+      if (fwrite(m_out, 1, (size_t) m_out_len, pOut) !=
+            (size_t) m_out_len) {
+        raiseErr(__LINE__, "I/O error during output");
+      }
+      if (fflush(pOut) != 0) {
+        raiseErr(__LINE__, "I/O error during output");
+      }
+      m_out_len = 0;
+    }
+    
+    if (i >= end) {
+      break;
+    }
+    group_t = t;
+    
+    /* Encode channel and system exclusive messages into the group and
+     * apply tempo changes, rebasing the real time at each change */
+    if ((int) (sel >> SEL_STATUS_SHIFT) == 0xff) {
+      us = base_us + (((int64_t) (t - base_t)) * tempo) / m_ppq;
+      tempo = liveTempo(sel, tempo);
+      base_us = us;
+      base_t = t;
+      
+    } else if (((int) (sel >> SEL_STATUS_SHIFT) == 0xf0) ||
+                ((int) (sel >> SEL_STATUS_SHIFT) == 0xf7)) {
+      liveSystem(sel);
+      
+    } else {
+      m_rstatus = 0;
+      printMsg(sel);
+    }
+  }
+}
+
+/*
+ * Update the peak capacities in m_stats from the current buffer
+ * capacities.
+ */
+static void statPeaks(void) {
+  
+  int32_t c = 0;
+  
+  if (m_h_cap > m_stats.h_cap) {
+    m_stats.h_cap = m_h_cap;
+  }
+  if (m_msg_cap > m_stats.msg_cap) {
+    m_stats.msg_cap = m_msg_cap;
+  }
+  if (m_head_cap > m_stats.head_cap) {
+    m_stats.head_cap = m_head_cap;
+  }
+  
+  c = m_moment_cap;
+  if (m_dir_len > c / MOMENT_CHUNK_LEN) {
+    c = m_dir_len * MOMENT_CHUNK_LEN;
+  }
+  if (c > m_stats.moment_cap) {
+    m_stats.moment_cap = c;
+  }
+}
+
+/*
+ * Release all the buffers of the MIDI module after compilation.
+ */
+static void releaseAll(void) {
+  
+  int32_t i = 0;
+  
+  statPeaks();
+  
+  if (m_h != NULL) {
+    free(m_h);
+    m_h = NULL;
+  }
+  
+  if (m_hdedup != NULL) {
+    free(m_hdedup);
+    m_hdedup = NULL;
+  }
+  memset(m_hptr, 0, sizeof(m_hptr));
   
-  if ((pA == NULL) || (pB == NULL)) {
-    raiseErr(__LINE__, NULL);
+  if (m_msg != NULL) {
+    free(m_msg);
+    m_msg = NULL;
   }
   
-  e1 = (const MOMENT *) pA;
-  e2 = (const MOMENT *) pB;
+  if (m_intern != NULL) {
+    free(m_intern);
+    m_intern = NULL;
+  }
   
-  if (e1->t > e2->t) {
-    result = 1;
-  } else if (e1->t < e2->t) {
-    result = -1;
+  if (m_head != NULL) {
+    free(m_head);
+    m_head = NULL;
   }
   
-  if (result == 0) {
-    s1 = (int) (e1->sel >> 24);
-    s2 = (int) (e2->sel >> 24);
-    
-    if ((s1 >= 0x80) && (s1 <= 0xaf)) {
-      c1 = 2;
-    } else {
-      c1 = 1;
-    }
-    
-    if ((s2 >= 0x80) && (s2 <= 0xaf)) {
-      c2 = 2;
-    } else {
-      c2 = 1;
-    }
-    
-    if (c1 > c2) {
-      result = 1;
-    } else if (c1 < c2) {
-      result = -1;
-    }
+  if (m_moment != NULL) {
+    free(m_moment);
+    m_moment = NULL;
   }
   
-  if (result == 0) {
-    if ((s1 >= 0xf0) && (s1 <= 0xff)) {
-      s1 = 0xf0;
-    }
-    if ((s2 >= 0xf0) && (s2 <= 0xff)) {
-      s2 = 0xf0;
-    }
-    
-    if (s1 > s2) {
-      result = 1;
-    } else if (s1 < s2) {
-      result = -1;
+  if (m_dir != NULL) {
+    for(i = 0; i < m_dir_len; i++) {
+      if (m_dir[i] != NULL) {
+        free(m_dir[i]);
+        m_dir[i] = NULL;
+      }
     }
+    free(m_dir);
+    m_dir = NULL;
   }
   
-  if (result == 0) {
-    if (e1->eid > e2->eid) {
-      result = 1;
-    } else if (e1->eid < e2->eid) {
-      result = -1;
-    }
+  if (m_mark != NULL) {
+    free(m_mark);
+    m_mark = NULL;
   }
   
-  return result;
+  if (m_idx != NULL) {
+    free(m_idx);
+    m_idx = NULL;
+  }
+  
+  m_h_cap = 0;
+  m_h_len = 0;
+  
+  m_msg_cap = 0;
+  m_msg_len = 0;
+  
+  m_intern_cap = 0;
+  m_intern_len = 0;
+  
+  m_head_cap = 0;
+  m_head_len = 0;
+  
+  m_dir_cap = 0;
+  m_dir_len = 0;
+  
+  m_moment_cap = 0;
+  m_moment_len = 0;
+  
+  m_mark_cap = 0;
+  m_mark_len = 0;
+  
+  m_idx_cap = 0;
+  m_idx_len = 0;
+  m_idx_count = 0;
 }
 
 /*
@@ -1889,11 +4658,17 @@ static int cmpMoment(const void *pA, const void *pB) {
  * midi_null function.
  */
 void midi_null(int32_t t, int head) {
+  
+  int32_t st = 0;
+  
   if (m_compiled) {
     raiseErr(__LINE__, "MIDI module already compiled");
   }
   if (!head) {
-    eventRange(t);
+    st = pointer_unpack(t, NULL);
+    if ((!m_win) || ((st >= m_win_lo) && (st < m_win_hi))) {
+      eventRange(t);
+    }
   }
 }
 
@@ -1902,7 +4677,7 @@ void midi_null(int32_t t, int head) {
  */
 void midi_text(int32_t t, int head, int tclass, TEXT *pText) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   
   if (m_compiled) {
     raiseErr(__LINE__, "MIDI module already compiled");
@@ -1928,7 +4703,7 @@ void midi_text(int32_t t, int head, int tclass, TEXT *pText) {
  */
 void midi_tempo(int32_t t, int head, int32_t val) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   uint8_t buf[3];
   
   memset(buf, 0, 3);
@@ -1939,11 +4714,11 @@ void midi_tempo(int32_t t, int head, int32_t val) {
   if ((val < MIDI_TEMPO_MIN) || (val > MIDI_TEMPO_MAX)) {
     raiseErr(__LINE__, NULL);
   }
-
+  
   buf[0] = (uint8_t) ((val >> 16) & 0xff);
   buf[1] = (uint8_t) ((val >>  8) & 0xff);
   buf[2] = (uint8_t) ( val        & 0xff);
-
+  
   sel = addMsgMD(0xff, 0x51, buf, 3);
   
   if (head) {
@@ -1958,7 +4733,7 @@ void midi_tempo(int32_t t, int head, int32_t val) {
  */
 void midi_time_sig(int32_t t, int head, int num, int denom, int metro) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   int i = 0;
   int j = 0;
   uint8_t buf[4];
@@ -2003,7 +4778,7 @@ void midi_time_sig(int32_t t, int head, int num, int denom, int metro) {
  */
 void midi_key_sig(int32_t t, int head, int count, int minor) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   uint8_t buf[2];
   
   memset(buf, 0, 2);
@@ -2040,7 +4815,7 @@ void midi_key_sig(int32_t t, int head, int count, int minor) {
  */
 void midi_custom(int32_t t, int head, BLOB *pData) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   
   if (m_compiled) {
     raiseErr(__LINE__, "MIDI module already compiled");
@@ -2063,7 +4838,7 @@ void midi_custom(int32_t t, int head, BLOB *pData) {
  */
 void midi_system(int32_t t, int head, BLOB *pData) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   int stype = 0;
   
   if (m_compiled) {
@@ -2100,8 +4875,9 @@ void midi_message(
     int     idx,
     int     val) {
   
-  uint32_t sel = 0;
+  uint64_t sel = 0;
   int status = 0;
+  int added = 1;
   int a = 0;
   int b = 0;
   
@@ -2152,7 +4928,16 @@ void midi_message(
   if (head) {
     addHeadMsg(sel);
   } else {
-    addMomentMsg(t, sel);
+    added = addMomentMsg(t, sel);
+  }
+  
+  if (added) {
+    if ((msg == MIDI_MSG_POLY_AFTERTOUCH) ||
+        (msg == MIDI_MSG_CH_AFTERTOUCH)) {
+      (m_stats.after_count)++;
+    } else if (msg == MIDI_MSG_CONTROL) {
+      (m_stats.control_count)++;
+    }
   }
 }
 
@@ -2176,20 +4961,144 @@ int32_t midi_range_upper(void) {
   return m_upper;
 }
 
+/*
+ * midi_window function.
+ */
+void midi_window(int32_t lo, int32_t hi) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if ((lo < 0) || (hi < lo)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (m_filled || m_win) {
+    raiseErr(__LINE__, "MIDI window must be set before any events");
+  }
+  
+  m_win = 1;
+  m_win_lo = lo;
+  m_win_hi = hi;
+  
+  m_filled = 1;
+  m_lower = lo;
+  m_upper = lo;
+}
+
+/*
+ * midi_reserve function.
+ */
+void midi_reserve(int32_t n) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (n > MOMENT_MAX_CAP - m_moment_len) {
+    n = MOMENT_MAX_CAP - m_moment_len;
+  }
+  capMoment(n);
+}
+
+/*
+ * midi_format function.
+ */
+void midi_format(int fmt) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if ((fmt != 0) && (fmt != 1)) {
+    raiseErr(__LINE__, "Unsupported MIDI file format");
+  }
+  m_format = fmt;
+}
+
+/*
+ * midi_division function.
+ */
+void midi_division(int32_t ppq) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if ((ppq < MIDI_PPQ_MIN) || (ppq > MIDI_PPQ_MAX)) {
+    raiseErr(__LINE__, "MIDI time division out of range");
+  }
+  m_ppq = ppq;
+}
+
+/*
+ * midi_ticks function.
+ */
+int32_t midi_ticks(int32_t s) {
+  return quantize(s);
+}
+
+/*
+ * midi_prune function.
+ */
+void midi_prune(int enable) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if (enable) {
+    m_prune = 1;
+  } else {
+    m_prune = 0;
+  }
+}
+
+/*
+ * midi_threads function.
+ */
+void midi_threads(int32_t n) {
+  if ((n < 1) || (n > MIDI_THREAD_MAX)) {
+    raiseErr(__LINE__, "Invalid encoding thread count");
+  }
+  m_threads = (int) n;
+}
+
+/*
+ * midi_index function.
+ */
+void midi_index(const char *pPath, int32_t step) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if ((pPath == NULL) || (step < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (m_idx_path != NULL) {
+    raiseErr(__LINE__, "MIDI seek index already set");
+  }
+  
+  m_idx_path = (char *) malloc(strlen(pPath) + 1);
+  if (m_idx_path == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  strcpy(m_idx_path, pPath);
+  m_idx_step = step;
+}
+
+/*
+ * midi_index_mark function.
+ */
+void midi_index_mark(int32_t s) {
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  if (m_idx_path != NULL) {
+    capMark(1);
+    m_mark[m_mark_len] = s;
+    m_mark_len++;
+  }
+}
+
 /*
  * midi_compile function.
  */
 void midi_compile(FILE *pOut) {
   
-  uint32_t sel = 0;
-  uint32_t prev_sel = 0;
-  int32_t i = 0;
-  int32_t t = 0;
-  int32_t prev_t = 0;
-  int32_t len = 0;
-  int32_t mlen = 0;
-  int32_t dlen = 0;
-  
   /* Check state and set compilation flag */
   if (m_compiled) {
     raiseErr(__LINE__, "MIDI module already compiled");
@@ -2201,124 +5110,245 @@ void midi_compile(FILE *pOut) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* If at least two records in moment buffer, sort the moment buffer */
-  if (m_moment_len > 1) {
-    qsort(m_moment, (size_t) m_moment_len, sizeof(MOMENT), &cmpMoment);
+  /* Encode the file into a memory buffer */
+  openOut(-1);
+  encodeFile();
+  
+  /* Write the whole buffer at once */
+  if (fwrite(m_out, 1, (size_t) m_out_len, pOut) !=
+        (size_t) m_out_len) {
+    raiseErr(__LINE__, "I/O error during output");
   }
   
-  /* Cap the moment buffer by appending End Of Track message, using
-   * upper bound of event range with end-of-moment moment part */
-  sel = addMsgMD(0xff, 0x2f, NULL, 0);
-  addMomentMsg(pointer_pack(m_upper, 2), sel);
+  /* Release the output buffer */
+  free(m_out);
+  m_out = NULL;
+  m_out_cap = 0;
+  m_out_len = 0;
   
-  /* Convert moment offsets within moment structures into subquantum
-   * offsets from the lower bound of event range, and then convert to
-   * delta time from previous event */
-  for(i = 0; i < m_moment_len; i++) {
-    (m_moment[i]).t = pointer_unpack((m_moment[i]).t, NULL) - m_lower;
-    t = (m_moment[i]).t;
-    if (i > 0) {
-      (m_moment[i]).t = t - prev_t;
-    }
-    prev_t = t;
+  /* Shut down the MIDI module */
+  releaseAll();
+}
+
+/*
+ * midi_live function.
+ */
+void midi_live(FILE *pOut) {
+  
+  /* Check state and set compilation flag */
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
   }
+  m_compiled = 1;
   
-  /* Compute the length of the MIDI track by first computing the encoded
-   * length of all messages in the header buffer, along with one byte
-   * each for the delta codes of zero */
-  for(i = 0; i < m_head_len; i++) {
-    sel = m_head[i];
-    mlen = sizeMsg(sel, prev_sel);
-    dlen = 1;
-    
-    if (len <= INT32_MAX - mlen - dlen) {
-      len += mlen + dlen;
-    } else {
-      raiseErr(__LINE__, "Compiled MIDI track too large");
-    }
-    
-    prev_sel = sel;
+  /* Check parameters */
+  if (pOut == NULL) {
+    raiseErr(__LINE__, NULL);
   }
   
-  /* Finish length computation by computing the encoded length of all
-   * messages in the moment buffer, along with the encoded length of
-   * their delta values; also check that delta times are all within
-   * range */
-  for(i = 0; i < m_moment_len; i++) {
-    sel = (m_moment[i]).sel;
-    mlen = sizeMsg(sel, prev_sel);
-    
-    if (((m_moment[i]).t < 0) ||
-        ((m_moment[i]).t > INT32_C(0x0FFFFFFF))) {
-      raiseErr(__LINE__, "MIDI delta time overflow");
-    }
-    
-    dlen = sizeVInt((m_moment[i]).t);
-    
-    if (len <= INT32_MAX - mlen - dlen) {
-      len += mlen + dlen;
-    } else {
-      raiseErr(__LINE__, "Compiled MIDI track too large");
+  /* Play the messages through a memory output buffer */
+  openOut(-1);
+  playLive(pOut);
+  
+  /* Release the output buffer */
+  free(m_out);
+  m_out = NULL;
+  m_out_cap = 0;
+  m_out_len = 0;
+  
+  /* Shut down the MIDI module */
+  releaseAll();
+}
+
+/*
+ * midi_compile_path function.
+ */
+void midi_compile_path(const char *pPath) {
+  
+  int fd = -1;
+  int exists = 0;
+  FILE *fh = NULL;
+  struct stat st;
+  
+  memset(&st, 0, sizeof(struct stat));
+  
+  /* Check state */
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
+  }
+  
+  /* Check parameters */
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Devices, pipes, and other special files can't be mapped or
+   * replaced, and replacing a symbolic link would replace the link
+   * rather than the file it refers to, so write to anything other than
+   * a regular file with a single sequential write */
+  if (lstat(pPath, &st) == 0) {
+    exists = 1;
+    if (!S_ISREG(st.st_mode)) {
+      fh = fopen(pPath, "wb");
+      if (fh == NULL) {
+        raiseErr(__LINE__, "Failed to create file: %s", pPath);
+      }
+      midi_compile(fh);
+      if (fclose(fh)) {
+        raiseErr(__LINE__, "I/O error during output");
+      }
+      fh = NULL;
+      return;
     }
-    
-    prev_sel = sel;
   }
   
-  /* Now write the MIDI headers and open the track chunk so that we are
-   * ready to start writing delta times and MIDI events */
-  writeString(pOut, "MThd");
-  writeUint32BE(pOut, (uint32_t) 6);    /* Length of head chunk */
-  writeUint16BE(pOut, 0);               /* Format 0 */
-  writeUint16BE(pOut, (uint16_t) 1);    /* One track */
-  writeUint16BE(pOut, (uint16_t) 768);  /* Delta units per quarter */
+  /* Set compilation flag */
+  m_compiled = 1;
   
-  writeString(pOut, "MTrk");
-  writeUint32BE(pOut, (uint32_t) len);  /* Length of MIDI track */
+  /* Create a temporary file next to the output file, so that the output
+   * file is replaced all at once and readers never see it half
+   * written */
+  m_out_tmp = (char *) malloc(strlen(pPath) + 32);
+  if (m_out_tmp == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  sprintf(m_out_tmp, "%s.%ld.tmp", pPath, (long) getpid());
   
-  /* Write all the MIDI messages in the header buffer, each with a delta
-   * time of zero */
-  for(i = 0; i < m_head_len; i++) {
-    printVInt(pOut, 0);
-    printMsg(pOut, m_head[i]);
+  unlink(m_out_tmp);
+  fd = open(m_out_tmp, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) {
+    raiseErr(__LINE__, "Failed to create file: %s", m_out_tmp);
+  }
+  if (exists) {
+    fchmod(fd, st.st_mode & 07777);
   }
   
-  /* Write all the MIDI messages in the moment buffer, each with the
-   * encoded delta time */
-  for(i = 0; i < m_moment_len; i++) {
-    printVInt(pOut, (m_moment[i]).t);
-    printMsg(pOut, (m_moment[i]).sel);
+  /* Encode the file directly into the mapped temporary file */
+  openOut(fd);
+  encodeFile();
+  
+  /* Unmap the file, cut it down to the encoded length, and close it */
+  if (munmap(m_out, (size_t) m_out_cap)) {
+    raiseErr(__LINE__, "I/O error during output");
   }
+  m_out = NULL;
   
-  /* Shut down the MIDI module */
-  if (m_h != NULL) {
-    free(m_h);
-    m_h = NULL;
+  if (ftruncate(fd, (off_t) m_out_len)) {
+    raiseErr(__LINE__, "I/O error during output");
   }
   
-  if (m_msg != NULL) {
-    free(m_msg);
-    m_msg = NULL;
+  m_out_fd = -1;
+  if (close(fd)) {
+    raiseErr(__LINE__, "I/O error during output");
   }
+  fd = -1;
   
-  if (m_head != NULL) {
-    free(m_head);
-    m_head = NULL;
+  /* Replace the output file */
+  if (rename(m_out_tmp, pPath)) {
+    raiseErr(__LINE__, "Failed to replace file: %s", pPath);
   }
+  free(m_out_tmp);
+  m_out_tmp = NULL;
   
-  if (m_moment != NULL) {
-    free(m_moment);
-    m_moment = NULL;
+  m_out_cap = 0;
+  m_out_len = 0;
+  
+  /* Shut down the MIDI module */
+  releaseAll();
+}
+
+/*
+ * midi_compile_mem function.
+ */
+void midi_compile_mem(uint8_t **ppData, size_t *pLen) {
+  
+  /* Check state and set compilation flag */
+  if (m_compiled) {
+    raiseErr(__LINE__, "MIDI module already compiled");
   }
+  m_compiled = 1;
   
-  m_h_cap = 0;
-  m_h_len = 0;
+  /* Check parameters */
+  if ((ppData == NULL) || (pLen == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
   
-  m_msg_cap = 0;
-  m_msg_len = 0;
+  /* Encode the file into a memory buffer */
+  openOut(-1);
+  encodeFile();
   
-  m_head_cap = 0;
-  m_head_len = 0;
+  /* Hand the output buffer over to the caller */
+  *ppData = m_out;
+  *pLen = (size_t) m_out_len;
   
-  m_moment_cap = 0;
-  m_moment_len = 0;
+  m_out = NULL;
+  m_out_cap = 0;
+  m_out_len = 0;
+  
+  /* Shut down the MIDI module */
+  releaseAll();
+}
+
+/*
+ * midi_stats function.
+ */
+void midi_stats(MIDI_STATS *ps) {
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  statPeaks();
+  memcpy(ps, &m_stats, sizeof(MIDI_STATS));
+}
+
+/*
+ * midi_restart function.
+ */
+void midi_restart(void) {
+  
+  /* Release any output buffer left by a failed compilation */
+  if (m_out != NULL) {
+    if (m_out_fd >= 0) {
+      munmap(m_out, (size_t) m_out_cap);
+    } else {
+      free(m_out);
+    }
+    m_out = NULL;
+  }
+  if (m_out_fd >= 0) {
+    close(m_out_fd);
+  }
+  m_out_fd = -1;
+  m_out_cap = 0;
+  m_out_len = 0;
+  
+  /* Remove the temporary file of a failed compilation to a path */
+  if (m_out_tmp != NULL) {
+    unlink(m_out_tmp);
+    free(m_out_tmp);
+    m_out_tmp = NULL;
+  }
+  
+  /* Release the message buffers */
+  releaseAll();
+  
+  /* Return the remaining state to its defaults */
+  memset(&m_stats, 0, sizeof(MIDI_STATS));
+  m_compiled = 0;
+  m_format = 0;
+  m_ppq = DELTA_PER_QUARTER;
+  m_prune = 0;
+  m_threads = 1;
+  if (m_idx_path != NULL) {
+    free(m_idx_path);
+    m_idx_path = NULL;
+  }
+  m_idx_step = 0;
+  m_win = 0;
+  m_win_lo = 0;
+  m_win_hi = 0;
+  m_unique = 0;
+  m_filled = 0;
+  m_lower = 0;
+  m_upper = 0;
+  m_rstatus = 0;
 }
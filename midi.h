@@ -16,6 +16,12 @@
  *   - diagnostic.c
  *   - pointer.c
  *   - text.c
+ * 
+ * Requires a POSIX platform for memory-mapped output files and for the
+ * monotonic clock used by live output (may require -lrt).
+ * 
+ * Requires POSIX threads for encoding with several threads (may
+ * require -lpthread).
  */
 
 #include <stddef.h>
@@ -57,6 +63,19 @@
 #define MIDI_TEMPO_MIN (1)
 #define MIDI_TEMPO_MAX INT32_C(16777215)
 
+/*
+ * The full range of valid time divisions, in delta time units per
+ * quarter note.  The maximum is the subquantum resolution, which is
+ * also the default division.
+ */
+#define MIDI_PPQ_MIN (1)
+#define MIDI_PPQ_MAX (768)
+
+/*
+ * The maximum number of threads that may be used for encoding tracks.
+ */
+#define MIDI_THREAD_MAX (64)
+
 /*
  * Maximum values for time signature events.
  */
@@ -97,6 +116,42 @@
 #define MIDI_MSG_CH_AFTERTOUCH    (0xd)
 #define MIDI_MSG_PITCH_BEND       (0xe)
 
+/*
+ * Data type declarations
+ * ======================
+ */
+
+/*
+ * Statistics about the buffers and messages of the MIDI module.
+ */
+typedef struct {
+  
+  /*
+   * The peak capacities of the handle table, the message buffer, the
+   * header buffer, and the moment buffer.  The message buffer is
+   * counted in bytes, the moment buffer in records, and the others in
+   * entries.
+   */
+  int32_t h_cap;
+  int32_t msg_cap;
+  int32_t head_cap;
+  int32_t moment_cap;
+  
+  /*
+   * The number of polyphonic and channel aftertouch messages, and the
+   * number of control change messages, that were added.
+   */
+  int32_t after_count;
+  int32_t control_count;
+  
+  /*
+   * The number of records removed by the redundant event elimination
+   * pass.  This is zero until the MIDI module is compiled.
+   */
+  int32_t pruned_count;
+  
+} MIDI_STATS;
+
 /*
  * Public functions
  * ================
@@ -345,14 +400,245 @@ int32_t midi_range_lower(void);
  */
 int32_t midi_range_upper(void);
 
+/*
+ * Restrict the moment buffer to an output window.
+ * 
+ * lo and hi are subquantum (not moment!) offsets.  lo must be zero or
+ * greater and hi must be greater than or equal to lo.  The window
+ * includes offsets at least lo and less than hi.
+ * 
+ * The event range starts out as the single offset lo.  Note-on,
+ * note-off, and polyphonic aftertouch messages before the window are
+ * kept and extend the event range, so that notes such as grace notes
+ * that lead into the window are still heard; the caller is responsible
+ * for only entering notes that belong in the output.  The start of the
+ * event range is time zero in the compiled MIDI file.  Messages before
+ * the window that set state, such as controller, program, tempo, and
+ * meta messages, do not extend the event range, and those that are
+ * before its start at compilation are moved to it, so that the state
+ * is in effect when the output begins.  Messages after the window are
+ * dropped, except for note-off messages and note-on messages with zero
+ * velocity, which release notes that are still sounding at the end of
+ * the window.  Null events outside the window are ignored.  Header
+ * buffer messages are not affected.
+ * 
+ * This must be called before any events are entered into the moment
+ * buffer.
+ * 
+ * Parameters:
+ * 
+ *   lo - the subquantum offset of the start of the window
+ * 
+ *   hi - the subquantum offset just past the end of the window
+ */
+void midi_window(int32_t lo, int32_t hi);
+
+/*
+ * Reserve room in the moment buffer for a number of further messages.
+ * 
+ * Callers that know how many messages they are about to add, or an
+ * upper bound on it, can call this first so that the buffer grows in a
+ * single step instead of chunk by chunk as messages arrive.  The
+ * reservation is only a hint: it is limited to the maximum capacity of
+ * the moment buffer, unused room costs nothing but memory, and adding
+ * more messages than reserved still works.
+ * 
+ * This must be called before the MIDI file is compiled.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of messages to reserve room for, zero or greater
+ */
+void midi_reserve(int32_t n);
+
+/*
+ * Set the Standard MIDI File format that will be compiled.
+ * 
+ * fmt must be either 0 or 1.  The default is 0, which compiles all
+ * messages into a single track.  Format 1 compiles a conductor track
+ * that holds all messages without a MIDI channel, such as tempo and
+ * other meta events, plus one track for each MIDI channel that has at
+ * least one message.  Each track is sorted and encoded separately.
+ * 
+ * This must be called before the MIDI file is compiled.
+ * 
+ * Parameters:
+ * 
+ *   fmt - the MIDI file format
+ */
+void midi_format(int fmt);
+
+/*
+ * Set the time division that will be compiled, in delta time units per
+ * quarter note.
+ * 
+ * ppq must be in range MIDI_PPQ_MIN to MIDI_PPQ_MAX inclusive.  The
+ * default is MIDI_PPQ_MAX, which encodes every subquantum offset
+ * exactly.  Coarser divisions round each subquantum offset to the
+ * nearest delta time unit, with exact halves rounded up, which gives
+ * smaller delta times and files.  Messages that round to the same delta
+ * time are ordered as if they had the same moment offset, so note-off
+ * messages still come before note-on messages.  Live output is timed
+ * at the same division.
+ * 
+ * This must be called before the MIDI file is compiled.
+ * 
+ * Parameters:
+ * 
+ *   ppq - the time division
+ */
+void midi_division(int32_t ppq);
+
+/*
+ * Convert a subquantum offset into delta time units at the time
+ * division selected with midi_division().
+ * 
+ * The delta time of an event in the compiled MIDI file is the
+ * converted offset of the event minus the converted lower bound of the
+ * event range.
+ * 
+ * Parameters:
+ * 
+ *   s - the subquantum offset
+ * 
+ * Return:
+ * 
+ *   the offset in delta time units
+ */
+int32_t midi_ticks(int32_t s);
+
+/*
+ * Enable or disable the redundant event elimination pass.
+ * 
+ * When enabled, the sorted messages of each track are scanned before
+ * encoding while tracking the state of each MIDI channel, and messages
+ * that set a controller, program, channel pressure, pitch bend, or
+ * polyphonic aftertouch value to the value the channel already has are
+ * dropped.  Data entry controllers are always kept.  Registered and
+ * non-registered parameter number selections share a single selected
+ * parameter on each channel, and are only dropped if they select the
+ * parameter that is already selected.  The tracked state is forgotten
+ * after channel mode messages, after system exclusive messages, for
+ * the aftertouch of a key after each note-on, and for the LSB of a
+ * controller below 32 after its MSB changes.
+ * 
+ * The pass is disabled by default.
+ * 
+ * This must be called before the MIDI file is compiled.
+ * 
+ * Parameters:
+ * 
+ *   enable - non-zero to enable the pass, zero to disable it
+ */
+void midi_prune(int enable);
+
+/*
+ * Set the number of threads used to encode each track when the MIDI
+ * file is compiled.
+ * 
+ * n must be in range 1 to MIDI_THREAD_MAX inclusive.  The default is
+ * one, which encodes everything on the calling thread.  Greater values
+ * split the sorted messages of large tracks into consecutive chunks
+ * that are encoded in parallel by worker threads and then joined in
+ * order.  Running status and delta times are carried across the chunk
+ * boundaries, so the compiled MIDI file is the same regardless of the
+ * number of threads.  Tracks that are too small to split, and live
+ * output, are always encoded on the calling thread.
+ * 
+ * This must be called before the MIDI file is compiled.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of threads
+ */
+void midi_threads(int32_t n);
+
+/*
+ * Generate a seek index of the compiled MIDI file at the given path.
+ * 
+ * The seek index is built while the tracks are encoded and written to
+ * the path after the MIDI file has been compiled with midi_compile(),
+ * midi_compile_path(), or midi_compile_mem().  It is not generated by
+ * midi_live().  While a seek index is generated, tracks are always
+ * encoded on the calling thread.
+ * 
+ * The seek index has seek points at the first message of each track
+ * at or after delta time zero, every step delta time units, and each
+ * offset added with midi_index_mark().  Several targets that fall
+ * before the same message give a single seek point.  If step is zero,
+ * seek points are only placed at the start of each track and at the
+ * marks.  Delta time units use the division selected with
+ * midi_division().
+ * 
+ * The file starts with the eight ASCII characters "IRSX0001", followed
+ * by the 16-bit format of the MIDI file, the 16-bit time division, and
+ * the 32-bit number of seek points.  Each seek point then has the
+ * following fields:
+ * 
+ *   - 32-bit delta time of the message, from the start of the file
+ *   - 32-bit byte offset of the delta time of the message in the file
+ *   - 32-bit delta time of the previous message of the track
+ *   - 8-bit track number
+ *   - 8-bit running status before the message, or zero if none
+ *   - 16-bit count of channel messages in the snapshot
+ *   - the snapshot, as three bytes for each channel message
+ * 
+ * All integers are unsigned and big endian.  Seek points are in track
+ * order and then in file order.  The track number is always zero in
+ * Format 0.  In Format 1, it is zero for the conductor track and
+ * otherwise the MIDI channel of the track, in range 1 to MIDI_CH_MAX.
+ * 
+ * The snapshot holds the channel messages that recreate the state of
+ * the track before the message, for each channel in ascending order:
+ * bank select MSB and LSB, program change, the other controllers below
+ * 120 apart from parameter number selection and data entry, the MSB and
+ * LSB of the selected registered or non-registered parameter number
+ * followed by the data entry MSB and LSB last sent to it, channel
+ * pressure, and pitch bend.  Program change and channel pressure
+ * messages have a zero third byte.  Only the parameter number of the
+ * kind that was selected last is included, and data entry values only
+ * if the whole parameter number is known.  The state is forgotten like
+ * in the redundant event elimination pass of midi_prune(), which also
+ * forgets data entry values after a data increment or decrement or a
+ * new parameter number selection, except that a system exclusive
+ * message only affects the snapshots of its own track.
+ * 
+ * pPath is copied.  This must be called before the MIDI file is
+ * compiled, and at most once.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path of the seek index file to generate
+ * 
+ *   step - the spacing of seek points in delta time units, or zero
+ */
+void midi_index(const char *pPath, int32_t step);
+
+/*
+ * Add a seek point target to the seek index at the given subquantum
+ * offset.
+ * 
+ * The seek point is placed at the first message of each track at or
+ * after the offset.  This may be called any number of times before the
+ * MIDI file is compiled, in any order.  It has no effect unless a seek
+ * index is generated with midi_index().
+ * 
+ * Parameters:
+ * 
+ *   s - the subquantum offset
+ */
+void midi_index_mark(int32_t s);
+
 /*
  * Compile all the messages that have been entered into the MIDI module
  * into a MIDI file and write it to the given output file.
  * 
- * Writing is entirely sequential, so you can pass stdout.
+ * The whole MIDI file is encoded into a memory buffer and then written
+ * with a single sequential write, so you can pass stdout.
  * 
  * After this function is called, it may not be called again, nor may
- * any further messages be added to the MIDI module.
+ * any further messages be added to the MIDI module.  Neither may
+ * midi_compile_path() or midi_live() be called.
  * 
  * Parameters:
  * 
@@ -360,4 +646,97 @@ int32_t midi_range_upper(void);
  */
 void midi_compile(FILE *pOut);
 
+/*
+ * Compile all the messages that have been entered into the MIDI module
+ * into a MIDI file at the given path.
+ * 
+ * The MIDI file is encoded directly into a temporary file in the same
+ * directory, which is mapped into memory and grows as needed.  Once
+ * the MIDI file is complete, the temporary file is renamed over the
+ * given path, so that readers of the path only ever see a complete
+ * MIDI file.  If the path is a symbolic link, a device, a pipe, or
+ * anything else that is not a regular file, the MIDI file is instead
+ * written to it like with midi_compile().
+ * 
+ * After this function is called, it may not be called again, nor may
+ * any further messages be added to the MIDI module.  Neither may
+ * midi_compile() or midi_live() be called.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the MIDI file to create
+ */
+void midi_compile_path(const char *pPath);
+
+/*
+ * Compile all the messages that have been entered into the MIDI module
+ * into a MIDI file in memory.
+ * 
+ * The MIDI file is encoded into a dynamically allocated buffer, which
+ * is handed over to the caller without copying.  The caller must
+ * release it with free().
+ * 
+ * After this function is called, it may not be called again, nor may
+ * any further messages be added to the MIDI module.  Neither may
+ * midi_compile(), midi_compile_path(), or midi_live() be called.
+ * 
+ * Parameters:
+ * 
+ *   ppData - receives the buffer holding the MIDI file
+ * 
+ *   pLen - receives the length of the MIDI file in bytes
+ */
+void midi_compile_mem(uint8_t **ppData, size_t *pLen);
+
+/*
+ * Play all the messages that have been entered into the MIDI module in
+ * real time as a raw MIDI byte stream to the given output file, instead
+ * of compiling a MIDI file.
+ * 
+ * The output file is intended to be a raw MIDI device, such as a
+ * /dev/snd/midiC*D* node, or a pipe or FIFO read by a bridge to a
+ * sequencer or network transport.  Playback starts as soon as the
+ * messages are sorted, without waiting for a MIDI file to be encoded.
+ * The messages at each delta time are written and flushed when their
+ * real time arrives, according to the tempo meta-events.
+ * 
+ * Messages are ordered the same way as in a Format 0 file, regardless
+ * of midi_format().  Every channel message includes its status byte.
+ * Meta-events are not sent.  The redundant event elimination pass is
+ * used if it is enabled with midi_prune().
+ * 
+ * After this function is called, it may not be called again, nor may
+ * any further messages be added to the MIDI module.  Neither may
+ * midi_compile() or midi_compile_path() be called.
+ * 
+ * Parameters:
+ * 
+ *   pOut - the file to send the raw MIDI byte stream to
+ */
+void midi_live(FILE *pOut);
+
+/*
+ * Get statistics about the buffers and messages of the MIDI module.
+ * 
+ * This may be called at any time, including after the MIDI module has
+ * been compiled, in which case the statistics are final.
+ * 
+ * Parameters:
+ * 
+ *   ps - receives the statistics
+ */
+void midi_stats(MIDI_STATS *ps);
+
+/*
+ * Restart the MIDI module, discarding all the messages that have been
+ * entered and returning the statistics, the window, the seek index, and
+ * the options to their defaults, so that another MIDI file can be
+ * built.
+ * 
+ * This works whether or not the MIDI module has been compiled, and also
+ * after compilation stopped with an error.  Any partially written
+ * output file is closed but not removed.
+ */
+void midi_restart(void);
+
 #endif
@@ -306,6 +306,21 @@ static void op_auto_ch(void *pCustom, long lnum) {
   control_auto(*pt, ch, 0, pg, lnum);
 }
 
+/*
+ * pCustom is ignored.
+ */
+static void op_auto_limit(void *pCustom, long lnum) {
+  int32_t interval = 0;
+  int32_t delta = 0;
+  
+  (void) pCustom;
+  
+  delta = core_pop_i(lnum);
+  interval = core_pop_i(lnum);
+  
+  control_limit(interval, delta, lnum);
+}
+
 /*
  * Registration function
  * =====================
@@ -349,4 +364,5 @@ void op_control_register(void) {
   main_op("auto_reg", &op_auto_idx, &i_reg);
   main_op("auto_pressure", &op_auto_ch, &i_pressure);
   main_op("auto_pitch", &op_auto_ch, &i_pitch);
+  main_op("auto_limit", &op_auto_limit, NULL);
 }
@@ -23,6 +23,7 @@
 #include "graph.h"
 #include "pointer.h"
 #include "main.h"
+#include "text.h"
 
 /*
  * Diagnostics
@@ -43,6 +44,27 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
   va_end(ap);
 }
 
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum number of points in a graph point file.
+ */
+#define MAX_POINTS INT32_C(1048576)
+
+/*
+ * The initial capacity in points of the point array.
+ */
+#define POINTS_INIT_CAP INT32_C(256)
+
+/*
+ * The maximum length in characters of a line in a text point file,
+ * not including the line break.
+ */
+#define POINT_LINE_MAX (255)
+
 /*
  * Local data
  * ==========
@@ -51,6 +73,15 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 static int m_true = 1;
 static int m_false = 0;
 
+/*
+ * The point array of the graph point file that is being loaded, or NULL
+ * if no load in progress.
+ * 
+ * This is kept here rather than in a local variable so that
+ * op_graph_restart() can release it if the load stopped with an error.
+ */
+static int32_t *m_points = NULL;
+
 /*
  * Local functions
  * ===============
@@ -63,6 +94,240 @@ static long srcLine(long lnum) {
   return lnum;
 }
 
+/*
+ * Parse an optionally signed decimal integer from a text point file,
+ * skipping any spaces and tabs before it.
+ * 
+ * Parameters:
+ * 
+ *   ppc - pointer to the parsing position, which is advanced past the
+ *   integer
+ * 
+ *   pv - variable to receive the integer
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if there is no valid integer
+ */
+static int parsePoint(const char **ppc, int32_t *pv) {
+  
+  const char *pc = NULL;
+  int64_t v = 0;
+  int neg = 0;
+  int digits = 0;
+  int status = 1;
+  
+  if ((ppc == NULL) || (pv == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  pc = *ppc;
+  
+  for( ; (*pc == ' ') || (*pc == '\t'); pc++);
+  
+  if (*pc == '-') {
+    neg = 1;
+    pc++;
+  } else if (*pc == '+') {
+    pc++;
+  }
+  
+  for( ; (*pc >= '0') && (*pc <= '9'); pc++) {
+    v = (v * 10) + (*pc - '0');
+    digits++;
+    if (v > ((int64_t) INT32_MAX) + 1) {
+      status = 0;
+      break;
+    }
+  }
+  
+  if (digits < 1) {
+    status = 0;
+  }
+  if (neg) {
+    v = 0 - v;
+  }
+  if ((v < INT32_MIN) || (v > INT32_MAX)) {
+    status = 0;
+  }
+  
+  if (status) {
+    *pv = (int32_t) v;
+    *ppc = pc;
+  }
+  return status;
+}
+
+/*
+ * Read a graph point file into a newly allocated array of time offset
+ * and value pairs, in the format that graph_add_points() expects.
+ * 
+ * Text point files have one point per line, with the time offset and
+ * the value separated by a comma or by whitespace.  Blank lines and
+ * lines that begin with # are ignored.  Binary point files are a
+ * sequence of eight-byte records, each holding the time offset and the
+ * value as signed 32-bit little-endian integers.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the point file
+ * 
+ *   binary - non-zero for a binary point file, zero for text
+ * 
+ *   pCount - variable to receive the number of points
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ * 
+ * Return:
+ * 
+ *   the point array, which the caller must free, or NULL if the file
+ *   has no points
+ */
+static int32_t *readPoints(
+    const char * pPath,
+    int          binary,
+    int32_t    * pCount,
+    long         lnum) {
+  
+  FILE *pIn = NULL;
+  int32_t *pa = NULL;
+  int32_t cap = 0;
+  int32_t count = 0;
+  int32_t pt[2];
+  uint8_t rec[8];
+  char line[POINT_LINE_MAX + 2];
+  const char *pc = NULL;
+  size_t n = 0;
+  uint32_t u = 0;
+  int err = 0;
+  int i = 0;
+  
+  memset(pt, 0, sizeof(pt));
+  memset(rec, 0, sizeof(rec));
+  memset(line, 0, sizeof(line));
+  
+  if ((pPath == NULL) || (pCount == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pIn = fopen(pPath, binary ? "rb" : "r");
+  if (pIn == NULL) {
+    raiseErr(__LINE__, "Can't open graph point file on script line %ld",
+              srcLine(lnum));
+  }
+  
+  while (!err) {
+    /* Read the next point */
+    if (binary) {
+      n = fread(rec, 1, sizeof(rec), pIn);
+      if (n < 1) {
+        break;
+      } else if (n != sizeof(rec)) {
+        err = 2;
+        break;
+      }
+      
+      for(i = 0; i < 2; i++) {
+        u = ((uint32_t) rec[4 * i]) |
+              (((uint32_t) rec[(4 * i) + 1]) << 8) |
+              (((uint32_t) rec[(4 * i) + 2]) << 16) |
+              (((uint32_t) rec[(4 * i) + 3]) << 24);
+        if (u <= INT32_MAX) {
+          pt[i] = (int32_t) u;
+        } else {
+          pt[i] = (int32_t) (((int64_t) u) - (INT64_C(1) << 32));
+        }
+      }
+      
+    } else {
+      if (fgets(line, (int) sizeof(line), pIn) == NULL) {
+        break;
+      }
+      if ((strchr(line, '\n') == NULL) && (!feof(pIn))) {
+        err = 2;
+        break;
+      }
+      
+      pc = line;
+      for( ; (*pc == ' ') || (*pc == '\t') || (*pc == '\r'); pc++);
+      if ((*pc == 0) || (*pc == '\n') || (*pc == '#')) {
+        continue;
+      }
+      
+      if (!parsePoint(&pc, &(pt[0]))) {
+        err = 2;
+        break;
+      }
+      for( ; (*pc == ' ') || (*pc == '\t'); pc++);
+      if (*pc == ',') {
+        pc++;
+      }
+      if (!parsePoint(&pc, &(pt[1]))) {
+        err = 2;
+        break;
+      }
+      for( ;
+          (*pc == ' ') || (*pc == '\t') ||
+          (*pc == '\r') || (*pc == '\n');
+          pc++);
+      if (*pc != 0) {
+        err = 2;
+        break;
+      }
+    }
+    
+    /* Expand capacity if necessary */
+    if (count >= cap) {
+      if (count >= MAX_POINTS) {
+        err = 3;
+        break;
+      }
+      if (cap < 1) {
+        cap = POINTS_INIT_CAP;
+      } else {
+        cap *= 2;
+      }
+      pa = (int32_t *) realloc(pa, ((size_t) cap) * 2 * sizeof(int32_t));
+      if (pa == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+    }
+    
+    /* Add the point */
+    pa[2 * count] = pt[0];
+    pa[(2 * count) + 1] = pt[1];
+    count++;
+  }
+  
+  if (!err && ferror(pIn)) {
+    err = 1;
+  }
+  fclose(pIn);
+  pIn = NULL;
+  
+  if (err) {
+    if (pa != NULL) {
+      free(pa);
+      pa = NULL;
+    }
+    if (err == 1) {
+      raiseErr(__LINE__,
+        "Can't read graph point file on script line %ld",
+        srcLine(lnum));
+    } else if (err == 2) {
+      raiseErr(__LINE__,
+        "Invalid graph point file on script line %ld",
+        srcLine(lnum));
+    } else {
+      raiseErr(__LINE__,
+        "Too many points in graph point file on script line %ld",
+        srcLine(lnum));
+    }
+  }
+  
+  *pCount = count;
+  return pa;
+}
+
 /*
  * Operation functions
  * ===================
@@ -149,6 +414,47 @@ static void op_graph_derive(void *pCustom, long lnum) {
   graph_add_derived(pp, pg, pSrc, num, denom, c, min, max, lnum);
 }
 
+/*
+ * pCustom points to an int that is non-zero for binary point files or
+ * zero for text point files.
+ */
+static void op_graph_load(void *pCustom, long lnum) {
+  POINTER *pp = NULL;
+  TEXT *pPath = NULL;
+  int32_t count = 0;
+  int *pt = NULL;
+  
+  if (pCustom == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  pt = (int *) pCustom;
+  
+  pPath = core_pop_t(lnum);
+  pp = core_pop_p(lnum);
+  
+  main_input(text_ptr(pPath));
+  op_graph_restart();
+  m_points = readPoints(text_ptr(pPath), *pt, &count, lnum);
+  graph_add_points(pp, m_points, count, lnum);
+  
+  op_graph_restart();
+}
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * op_graph_restart function.
+ */
+void op_graph_restart(void) {
+  if (m_points != NULL) {
+    free(m_points);
+    m_points = NULL;
+  }
+}
+
 /*
  * Registration function
  * =====================
@@ -164,4 +470,7 @@ void op_graph_register(void) {
   main_op("graph_ramp_log", &op_graph_ramp, &m_true);
   
   main_op("graph_derive", &op_graph_derive, NULL);
+  
+  main_op("graph_load", &op_graph_load, &m_false);
+  main_op("graph_load_bin", &op_graph_load, &m_true);
 }
@@ -23,8 +23,18 @@
  *   - graph.c
  *   - main.c
  *   - pointer.c
+ *   - text.c
  */
 
+/*
+ * Release the point array of a graph point file load that stopped with
+ * an error.
+ * 
+ * This does nothing if no point array is held.  It is called by
+ * main_restart().
+ */
+void op_graph_restart(void);
+
 void op_graph_register(void);
 
 #endif
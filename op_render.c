@@ -171,6 +171,41 @@ static void op_note_class(void *pCustom, long lnum) {
   }
 }
 
+/*
+ * pCustom is ignored.
+ */
+static void op_keyboard_enable(void *pCustom, long lnum) {
+  (void) pCustom;
+  (void) lnum;
+  
+  render_keyboard(1);
+}
+
+/*
+ * pCustom is ignored.
+ */
+static void op_aftertouch_collapse(void *pCustom, long lnum) {
+  (void) pCustom;
+  (void) lnum;
+  
+  render_after_collapse(1);
+}
+
+/*
+ * pCustom is ignored.
+ */
+static void op_aftertouch_limit(void *pCustom, long lnum) {
+  int32_t interval = 0;
+  int32_t delta = 0;
+  
+  (void) pCustom;
+  
+  delta = core_pop_i(lnum);
+  interval = core_pop_i(lnum);
+  
+  render_after_limit(interval, delta, lnum);
+}
+
 /*
  * Registration function
  * =====================
@@ -184,4 +219,7 @@ void op_render_register(void) {
   main_op("note_release", &op_note_class, &i_note_release);
   main_op("aftertouch_enable", &op_note_class, &i_aftertouch_enable);
   main_op("aftertouch_disable", &op_note_class, &i_aftertouch_disable);
+  main_op("aftertouch_limit", &op_aftertouch_limit, NULL);
+  main_op("aftertouch_collapse", &op_aftertouch_collapse, NULL);
+  main_op("keyboard_enable", &op_keyboard_enable, NULL);
 }
@@ -180,6 +180,17 @@ static void op_slice(void *pCustom, long lnum) {
   }
 }
 
+static void op_blob_file(void *pCustom, long lnum) {
+  
+  TEXT *pPath = NULL;
+  
+  (void) pCustom;
+  
+  pPath = core_pop_t(lnum);
+  main_input(text_ptr(pPath));
+  core_push_b(blob_file(text_ptr(pPath), lnum), lnum);
+}
+
 /*
  * Registration function
  * =====================
@@ -188,4 +199,5 @@ static void op_slice(void *pCustom, long lnum) {
 void op_string_register(void) {
   main_op("concat", &op_concat, NULL);
   main_op("slice", &op_slice, NULL);
+  main_op("blob_file", &op_blob_file, NULL);
 }
@@ -0,0 +1,459 @@
+/*
+ * optable.c
+ * =========
+ * 
+ * Implementation of optable.h
+ * 
+ * See the header for further information.
+ */
+
+#include "optable.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diagnostic.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The initial and maximum allocation of the operator registration
+ * table.
+ */
+#define OP_INIT_CAP (32)
+#define OP_MAX_CAP (16384)
+
+/*
+ * The minimum and maximum number of slots in the operator hash table,
+ * which are powers of two, and the number of hash seeds to try at each
+ * table size before doubling it.
+ */
+#define OP_HASH_MIN_CAP (64)
+#define OP_HASH_MAX_CAP (INT32_C(1) << 20)
+#define OP_SEED_COUNT (4096)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * Record structure for the operator table, which each store a callback
+ * and the custom data to pass to that callback, along with a copy of
+ * the operation name for identifying the operator table in compiled
+ * scripts.
+ */
+typedef struct {
+  main_fp_op fp;
+  void *pCustom;
+  char name[32];
+} OP_REC;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The operator registration table.
+ * 
+ * m_op_cap is the current capacity in operator records.  m_op_len is
+ * the number of operator records actually in use.
+ * 
+ * m_op is the dynamically allocated operator table array, which may be
+ * NULL only if the capacity is zero.
+ * 
+ * m_op_hash is the perfect hash table that maps operator names to their
+ * indices in the operator table array.  It has m_op_hash_cap slots,
+ * which is a power of two, and the slot of each name is selected by
+ * hashOp() with the seed m_op_seed.  Each slot is either zero if unused
+ * or one greater than the index of the operator whose name hashes to
+ * it, with no two registered names sharing a slot, so lookups never
+ * probe.  The table is built by buildOpHash() on the first lookup after
+ * registration, and it is NULL before that.
+ */
+static int32_t m_op_cap = 0;
+static int32_t m_op_len = 0;
+static OP_REC *m_op = NULL;
+
+static int32_t m_op_hash_cap = 0;
+static int32_t *m_op_hash = NULL;
+static uint32_t m_op_seed = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static void capOp(int32_t n);
+static uint32_t hashOp(uint32_t seed, const char *pKey);
+static void buildOpHash(void);
+
+/*
+ * Make room in capacity for a given number of elements in the operator
+ * table.
+ * 
+ * n is the number of additional elements beyond current length to make
+ * room for.  It must be zero or greater.
+ * 
+ * Upon return, the capacity will be at least n elements higher than the
+ * current length.
+ * 
+ * An error occurs if the requested expansion would go beyond the
+ * maximum allowed capacity.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of elements to make room for
+ */
+static void capOp(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Only proceed if n is non-zero */
+  if (n > 0) {
+    
+    /* Make initial allocation if necessary */
+    if (m_op_cap < 1) {
+      m_op = (OP_REC *) calloc(
+                (size_t) OP_INIT_CAP, sizeof(OP_REC));
+      if (m_op == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      m_op_cap = OP_INIT_CAP;
+      m_op_len = 0;
+    }
+    
+    /* Compute target length */
+    if (n <= INT32_MAX - m_op_len) {
+      target = m_op_len + n;
+    } else {
+      raiseErr(__LINE__, "Operator table capacity exceeded");
+    }
+    
+    /* Only proceed if target length exceeds current capacity */
+    if (target > m_op_cap) {
+      /* Check that target within maximum capacity */
+      if (target > OP_MAX_CAP) {
+        raiseErr(__LINE__, "Operator table capacity exceeded");
+      }
+      
+      /* Compute new capacity by doubling current capacity until greater
+       * than or equal to target length, and then limiting to maximum
+       * capacity */
+      new_cap = m_op_cap;
+      while (new_cap < target) {
+        new_cap *= 2;
+      }
+      if (new_cap > OP_MAX_CAP) {
+        new_cap = OP_MAX_CAP;
+      }
+      
+      /* Expand capacity */
+      m_op = (OP_REC *) realloc(m_op,
+                            ((size_t) new_cap) * sizeof(OP_REC));
+      if (m_op == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      memset(
+        &(m_op[m_op_cap]),
+        0,
+        ((size_t) (new_cap - m_op_cap)) * sizeof(OP_REC));
+      
+      m_op_cap = new_cap;
+    }
+  }
+}
+
+/*
+ * Compute the hash of an operator name for the operator hash table.
+ * 
+ * This is FNV-1a with the seed mixed into the offset basis, so that
+ * different seeds give unrelated hashes.
+ * 
+ * Parameters:
+ * 
+ *   seed - the hash seed
+ * 
+ *   pKey - the operator name
+ * 
+ * Return:
+ * 
+ *   the hash of the name
+ */
+static uint32_t hashOp(uint32_t seed, const char *pKey) {
+  
+  uint32_t h = 0;
+  
+  if (pKey == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  h = UINT32_C(2166136261) ^ (seed * UINT32_C(2654435761));
+  for( ; *pKey != 0; pKey++) {
+    h ^= (uint32_t) ((unsigned char) *pKey);
+    h *= UINT32_C(16777619);
+  }
+  
+  return h;
+}
+
+/*
+ * Build the perfect hash table for all the registered operators.
+ * 
+ * Seeds are tried in order at the smallest table size that is at least
+ * twice the operator count, until one places every name in its own
+ * slot.  If no seed works, the table size is doubled and the seeds are
+ * tried again.  The search only depends on the registered names, so the
+ * same table is built on every run.
+ * 
+ * Two operators with the same name always share a slot, so this is
+ * also where duplicate registrations are detected.
+ */
+static void buildOpHash(void) {
+  
+  int32_t cap = 0;
+  uint32_t seed = 0;
+  int32_t i = 0;
+  int32_t slot = 0;
+  int32_t *pTable = NULL;
+  int found = 0;
+  
+  if (m_op_hash != NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Determine the initial table size */
+  cap = OP_HASH_MIN_CAP;
+  while (cap < m_op_len * 2) {
+    cap *= 2;
+  }
+  
+  /* Search for a seed without collisions */
+  while (!found) {
+    if (cap > OP_HASH_MAX_CAP) {
+      raiseErr(__LINE__, "Failed to build operator hash table");
+    }
+    
+    pTable = (int32_t *) calloc((size_t) cap, sizeof(int32_t));
+    if (pTable == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    for(seed = 0; seed < OP_SEED_COUNT; seed++) {
+      memset(pTable, 0, ((size_t) cap) * sizeof(int32_t));
+      
+      for(i = 0; i < m_op_len; i++) {
+        slot = (int32_t) (hashOp(seed, (m_op[i]).name) &
+                            ((uint32_t) (cap - 1)));
+        if (pTable[slot] != 0) {
+          if (strcmp((m_op[pTable[slot] - 1]).name,
+                      (m_op[i]).name) == 0) {
+            raiseErr(__LINE__,
+              "Duplicate operation name registration: %s",
+              (m_op[i]).name);
+          }
+          break;
+        }
+        pTable[slot] = i + 1;
+      }
+      
+      if (i >= m_op_len) {
+        found = 1;
+        break;
+      }
+    }
+    
+    if (!found) {
+      free(pTable);
+      pTable = NULL;
+      cap *= 2;
+    }
+  }
+  
+  m_op_hash = pTable;
+  m_op_hash_cap = cap;
+  m_op_seed = seed;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * optable_valid function.
+ */
+int optable_valid(const char *pName) {
+  
+  size_t slen = 0;
+  int result = 1;
+  const char *pc = NULL;
+  
+  if (pName == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  slen = strlen(pName);
+  if ((slen < 1) || (slen > 31)) {
+    result = 0;
+  }
+  
+  if (result) {
+    if (((pName[0] < 'A') || (pName[0] > 'Z')) &&
+        ((pName[0] < 'a') || (pName[0] > 'z'))) {
+      result = 0;
+    }
+  }
+  
+  if (result) {
+    for(pc = pName; *pc != 0; pc++) {
+      if (((*pc < 'A') || (*pc > 'Z')) &&
+          ((*pc < 'a') || (*pc > 'z')) &&
+          ((*pc < '0') || (*pc > '9')) &&
+          (*pc != '_')) {
+        result = 0;
+        break;
+      }
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * optable_add function.
+ */
+void optable_add(const char *pKey, main_fp_op fp, void *pCustom) {
+  if ((pKey == NULL) || (fp == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (!optable_valid(pKey)) {
+    raiseErr(__LINE__, "Invalid operation name registered");
+  }
+  
+  /* Any hash table that was already built no longer covers all the
+   * operators, so it is rebuilt on the next lookup */
+  if (m_op_hash != NULL) {
+    free(m_op_hash);
+    m_op_hash = NULL;
+    m_op_hash_cap = 0;
+  }
+  
+  capOp(1);
+  (m_op[m_op_len]).fp = fp;
+  (m_op[m_op_len]).pCustom = pCustom;
+  strcpy((m_op[m_op_len]).name, pKey);
+  m_op_len++;
+}
+
+/*
+ * optable_build function.
+ */
+void optable_build(void) {
+  if (m_op_hash == NULL) {
+    buildOpHash();
+  }
+}
+
+/*
+ * optable_find function.
+ */
+int32_t optable_find(const char *pKey) {
+  
+  int32_t result = -1;
+  int32_t e = 0;
+  
+  if (pKey == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Since every registered name has its own slot, only the name in the
+   * slot the key hashes to needs to be compared */
+  optable_build();
+  e = m_op_hash[hashOp(m_op_seed, pKey) &
+                  ((uint32_t) (m_op_hash_cap - 1))];
+  if (e > 0) {
+    if (strcmp((m_op[e - 1]).name, pKey) == 0) {
+      result = e - 1;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * optable_count function.
+ */
+int32_t optable_count(void) {
+  return m_op_len;
+}
+
+/*
+ * optable_name function.
+ */
+const char *optable_name(int32_t op) {
+  if ((op < 0) || (op >= m_op_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  return (m_op[op]).name;
+}
+
+/*
+ * optable_call function.
+ */
+void optable_call(int32_t op, long lnum) {
+  if ((op < 0) || (op >= m_op_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  ((m_op[op]).fp)((m_op[op]).pCustom, lnum);
+}
+
+/*
+ * optable_hash function.
+ */
+uint64_t optable_hash(void) {
+  
+  uint64_t h = UINT64_C(14695981039346656037);
+  int32_t i = 0;
+  const char *pc = NULL;
+  
+  for(i = 0; i < m_op_len; i++) {
+    for(pc = (m_op[i]).name; ; pc++) {
+      h ^= (uint64_t) ((unsigned char) *pc);
+      h *= UINT64_C(1099511628211);
+      if (*pc == 0) {
+        break;
+      }
+    }
+  }
+  
+  return h;
+}
@@ -0,0 +1,140 @@
+#ifndef OPTABLE_H_INCLUDED
+#define OPTABLE_H_INCLUDED
+
+/*
+ * optable.h
+ * =========
+ * 
+ * Operator table module of Infrared.
+ * 
+ * The operator table holds every operation registered with main_op(),
+ * in registration order, and maps operation names to their indices in
+ * the table with a perfect hash table, so that looking up an operation
+ * in the script interpreter never probes.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - diagnostic.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "main.h"
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Check whether a given name is a valid operation name.
+ * 
+ * Valid names are between 1 and 31 characters, each character is an
+ * ASCII alphanumeric or underscore, and the first character is
+ * alphabetic.
+ * 
+ * Parameters:
+ * 
+ *   pName - the name to check
+ * 
+ * Return:
+ * 
+ *   non-zero if valid, zero otherwise
+ */
+int optable_valid(const char *pName);
+
+/*
+ * Add an operation to the end of the operator table.
+ * 
+ * An error occurs if the name is not valid according to
+ * optable_valid().  Duplicate names are detected when the hash table is
+ * built.  Any hash table that was already built is discarded, so that
+ * it is rebuilt on the next lookup.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the name of the operation
+ * 
+ *   fp - the function to implement the operation
+ * 
+ *   pCustom - the custom parameter to pass through, or NULL
+ */
+void optable_add(const char *pKey, main_fp_op fp, void *pCustom);
+
+/*
+ * Build the perfect hash table for all the operations in the operator
+ * table, if it is not already built.
+ * 
+ * The table is also built on the first lookup with optable_find(), but
+ * building it right after registration reports duplicate operation
+ * names before any script runs.  An error occurs if two operations have
+ * the same name.
+ */
+void optable_build(void);
+
+/*
+ * Find an operation by name.
+ * 
+ * Parameters:
+ * 
+ *   pKey - the operation name
+ * 
+ * Return:
+ * 
+ *   the index of the operation in the operator table, or -1 if there is
+ *   no operation with that name
+ */
+int32_t optable_find(const char *pKey);
+
+/*
+ * Get the number of operations in the operator table.
+ * 
+ * Return:
+ * 
+ *   the number of operations
+ */
+int32_t optable_count(void);
+
+/*
+ * Get the name of an operation in the operator table.
+ * 
+ * Parameters:
+ * 
+ *   op - the index in the operator table
+ * 
+ * Return:
+ * 
+ *   the name of the operation
+ */
+const char *optable_name(int32_t op);
+
+/*
+ * Invoke an operation from the operator table.
+ * 
+ * Parameters:
+ * 
+ *   op - the index in the operator table
+ * 
+ *   lnum - the script line number
+ */
+void optable_call(int32_t op, long lnum);
+
+/*
+ * Compute a 64-bit FNV-1a hash of the names in the operator table, in
+ * registration order.
+ * 
+ * Compiled scripts refer to operations by their index in the operator
+ * table, so this hash identifies the operator table that a compiled
+ * script was compiled against.
+ * 
+ * Return:
+ * 
+ *   the hash of the operator table
+ */
+uint64_t optable_hash(void);
+
+#endif
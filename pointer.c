@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -45,15 +46,6 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 struct POINTER_TAG {
   
-  /*
-   * The next pointer in the allocated pointer chain, or NULL if this is
-   * the last pointer in the chain.
-   * 
-   * The pointer chain allows the shutdown function to free all
-   * pointers.
-   */
-  POINTER *pNext;
-  
   /*
    * Non-zero if this is a header pointer; else, zero.
    */
@@ -151,11 +143,10 @@ static NMF_DATA *m_pd = NULL;
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last pointers in the pointer chain, or NULL
- * for both if no pointers allocated.
+ * The arena that all pointers are allocated from, which releases them
+ * all at once when the module shuts down.
  */
-static POINTER *m_pFirst = NULL;
-static POINTER *m_pLast = NULL;
+static ARENA m_arena;
 
 /*
  * Public function implementations
@@ -201,10 +192,7 @@ POINTER *pointer_new(void) {
     raiseErr(__LINE__, "Pointer module not initialized");
   }
   
-  pp = (POINTER *) calloc(1, sizeof(POINTER));
-  if (pp == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
+  pp = (POINTER *) arena_alloc(&m_arena, sizeof(POINTER));
   
   pp->head = 1;
   pp->sect = 0;
@@ -214,16 +202,6 @@ POINTER *pointer_new(void) {
   pp->tilt = 0;
   pp->m    = 0;
   
-  if (m_pLast == NULL) {
-    m_pFirst = pp;
-    m_pLast = pp;
-    pp->pNext = NULL;
-  } else {
-    m_pLast->pNext = pp;
-    pp->pNext = NULL;
-    m_pLast = pp;
-  }
-  
   return pp;
 }
 
@@ -231,23 +209,21 @@ POINTER *pointer_new(void) {
  * pointer_shutdown function.
  */
 void pointer_shutdown(void) {
-  POINTER *pCur = NULL;
-  POINTER *pNext = NULL;
-  
   if (!m_shutdown) {
     m_shutdown = 1;
     m_pd = NULL;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
-    }
-    m_pFirst = NULL;
-    m_pLast = NULL;
+    arena_free(&m_arena);
   }
 }
 
+/*
+ * pointer_restart function.
+ */
+void pointer_restart(void) {
+  pointer_shutdown();
+  m_shutdown = 0;
+}
+
 /*
  * pointer_reset function.
  */
@@ -697,7 +673,7 @@ int32_t pointer_unpack(int32_t m, int *pPart) {
 int32_t pointer_pack(int32_t s, int p) {
   
   int32_t result = 0;
-
+  
   if ((p < 0) || (p > 2)) {
     raiseErr(__LINE__, NULL);
   }
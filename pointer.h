@@ -12,6 +12,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - ruler.c
  * 
@@ -80,6 +81,16 @@ POINTER *pointer_new(void);
  */
 void pointer_shutdown(void);
 
+/*
+ * Restart the pointer system, releasing all pointers that have been
+ * allocated in the same way as pointer_shutdown(), but leaving the pointer
+ * system ready to be used again.  This also works after a shutdown.
+ * 
+ * pointer_init() must be called again before pointers can be used
+ * after a restart.
+ */
+void pointer_restart(void);
+
 /*
  * Reset a pointer back to its initial state as a header pointer.
  * 
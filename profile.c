@@ -0,0 +1,562 @@
+/*
+ * profile.c
+ * =========
+ * 
+ * Implementation of profile.h
+ * 
+ * See the header for further information.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "profile.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blob.h"
+#include "core.h"
+#include "diagnostic.h"
+#include "graph.h"
+#include "main.h"
+#include "midi.h"
+#include "optable.h"
+#include "render.h"
+#include "set.h"
+#include "text.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+static void sayWarn(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(0, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of processing phases.
+ */
+#define PHASE_COUNT (6)
+
+/*
+ * The initial and maximum capacities of the script line profile table.
+ */
+#define PROF_LINE_INIT_CAP (256)
+#define PROF_LINE_MAX_CAP  (INT32_C(1) << 24)
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * Timing record for a processing phase.
+ * 
+ * wall and cpu are the accumulated wall-clock and CPU time in seconds.
+ */
+typedef struct {
+  const char *pName;
+  double wall;
+  double cpu;
+} PHASE_REC;
+
+/*
+ * Profile record for an operation or a script line.
+ * 
+ * key is the index in the operator table or the script line number.
+ * calls is the number of operation calls, sec is their accumulated
+ * wall-clock time in seconds, and objects is the number of graph, set,
+ * text, and blob objects they allocated.
+ */
+typedef struct {
+  int32_t key;
+  long calls;
+  double sec;
+  long objects;
+} PROF_REC;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The phase timing table, indexed by the PROFILE constants.
+ * 
+ * m_phase_wall and m_phase_cpu are the starting times recorded by
+ * profile_begin().
+ */
+static PHASE_REC m_phase[PHASE_COUNT] = {
+  {"nmf_parse", 0.0, 0.0},
+  {"run_script", 0.0, 0.0},
+  {"render_nmf", 0.0, 0.0},
+  {"control_track", 0.0, 0.0},
+  {"compile_map", 0.0, 0.0},
+  {"midi_compile", 0.0, 0.0}
+};
+static double m_phase_wall = 0.0;
+static double m_phase_cpu = 0.0;
+
+/*
+ * The script profile.
+ * 
+ * m_profile is the number of entries to report in each list, or zero
+ * if profiling is disabled.
+ * 
+ * m_prof_op has m_prof_op_len records, one for each operator in the
+ * operator table, allocated when the first call is profiled.
+ * m_prof_line has one record for each script line number less than
+ * m_prof_line_cap, and it is grown as needed, with NULL only if the
+ * capacity is zero.
+ */
+static int32_t m_profile = 0;
+static int32_t m_prof_op_len = 0;
+static PROF_REC *m_prof_op = NULL;
+static int32_t m_prof_line_cap = 0;
+static PROF_REC *m_prof_line = NULL;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static long srcLine(long lnum);
+static double wallTime(void);
+static long objCount(void);
+static void capProfLine(long lnum);
+static int cmpProf(const void *pA, const void *pB);
+static void releaseProfile(void);
+
+/*
+ * If the given line number is within valid range, return it as-is.  In
+ * all other cases, return -1.
+ * 
+ * Parameters:
+ * 
+ *   lnum - the candidate line number
+ * 
+ * Return:
+ * 
+ *   the line number as-is if valid, else -1
+ */
+static long srcLine(long lnum) {
+  if ((lnum < 1) || (lnum >= LONG_MAX)) {
+    lnum = -1;
+  }
+  return lnum;
+}
+
+/*
+ * Get the current wall-clock time from the monotonic clock.
+ * 
+ * Return:
+ * 
+ *   the time in seconds from an arbitrary starting point
+ */
+static double wallTime(void) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read monotonic clock");
+  }
+  
+  return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0);
+}
+
+/*
+ * Count the objects allocated so far by the graph, set, text, and blob
+ * modules.
+ * 
+ * Return:
+ * 
+ *   the total number of objects allocated
+ */
+static long objCount(void) {
+  return ((long) graph_count()) + ((long) set_count()) +
+          ((long) text_count()) + ((long) blob_count());
+}
+
+/*
+ * Make sure the script line profile table has a record for the given
+ * script line number.
+ * 
+ * The table is grown by doubling, with new records zeroed and keyed to
+ * their line numbers.  An error occurs if the line number is beyond the
+ * maximum capacity.
+ * 
+ * Parameters:
+ * 
+ *   lnum - the script line number, which must be zero or greater
+ */
+static void capProfLine(long lnum) {
+  
+  int32_t new_cap = 0;
+  int32_t i = 0;
+  PROF_REC *pNew = NULL;
+  
+  /* Check parameters */
+  if (lnum < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (lnum >= PROF_LINE_MAX_CAP) {
+    raiseErr(__LINE__, "Profile line table capacity exceeded");
+  }
+  
+  /* Only proceed if the line is not already in the table */
+  if (lnum >= m_prof_line_cap) {
+    
+    /* Determine the new capacity */
+    new_cap = m_prof_line_cap;
+    if (new_cap < PROF_LINE_INIT_CAP) {
+      new_cap = PROF_LINE_INIT_CAP;
+    }
+    while (new_cap <= lnum) {
+      new_cap *= 2;
+    }
+    
+    /* Expand the table and initialize the new records */
+    pNew = (PROF_REC *) realloc(m_prof_line,
+                          ((size_t) new_cap) * sizeof(PROF_REC));
+    if (pNew == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_prof_line = pNew;
+    
+    memset(&(m_prof_line[m_prof_line_cap]), 0,
+      ((size_t) (new_cap - m_prof_line_cap)) * sizeof(PROF_REC));
+    for(i = m_prof_line_cap; i < new_cap; i++) {
+      (m_prof_line[i]).key = i;
+    }
+    
+    m_prof_line_cap = new_cap;
+  }
+}
+
+/*
+ * Comparison function for sorting profile records.
+ * 
+ * The interface of this function matches the callback function of the
+ * standard library qsort().  Both elements should be PROF_REC records.
+ * Records are ordered by decreasing time, with ties broken by
+ * increasing key so that the order is stable.
+ * 
+ * Parameters:
+ * 
+ *   pA - pointer to first element
+ * 
+ *   pB - pointer to second element
+ * 
+ * Return:
+ * 
+ *   less than zero, zero, or greater than zero as the first element
+ *   should come before, at the same place, or after the second element
+ */
+static int cmpProf(const void *pA, const void *pB) {
+  
+  int result = 0;
+  const PROF_REC *a = NULL;
+  const PROF_REC *b = NULL;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  a = (const PROF_REC *) pA;
+  b = (const PROF_REC *) pB;
+  
+  if (a->sec > b->sec) {
+    result = -1;
+  } else if (a->sec < b->sec) {
+    result = 1;
+  } else if (a->key < b->key) {
+    result = -1;
+  } else if (a->key > b->key) {
+    result = 1;
+  }
+  
+  return result;
+}
+
+/*
+ * Release the script profile tables, if they were allocated.
+ */
+static void releaseProfile(void) {
+  if (m_prof_op != NULL) {
+    free(m_prof_op);
+    m_prof_op = NULL;
+  }
+  if (m_prof_line != NULL) {
+    free(m_prof_line);
+    m_prof_line = NULL;
+  }
+  m_prof_op_len = 0;
+  m_prof_line_cap = 0;
+}
+
+/*
+ * Public function implementations
+ * ===============================
+ * 
+ * See the header for specifications.
+ */
+
+/*
+ * profile_begin function.
+ */
+void profile_begin(void) {
+  m_phase_wall = wallTime();
+  m_phase_cpu = ((double) clock()) / ((double) CLOCKS_PER_SEC);
+}
+
+/*
+ * profile_end function.
+ */
+void profile_end(int phase) {
+  
+  double cpu = 0.0;
+  
+  if ((phase < 0) || (phase >= PHASE_COUNT)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  cpu = ((double) clock()) / ((double) CLOCKS_PER_SEC);
+  (m_phase[phase]).wall += wallTime() - m_phase_wall;
+  (m_phase[phase]).cpu += cpu - m_phase_cpu;
+  
+  /* Write out the messages of the phase */
+  diagnostic_sync();
+}
+
+/*
+ * profile_stats function.
+ */
+void profile_stats(const char *pPath) {
+  
+  FILE *fh = NULL;
+  int i = 0;
+  MIDI_STATS ms;
+  RENDER_STATS rs;
+  CORE_STATS cs;
+  
+  memset(&ms, 0, sizeof(MIDI_STATS));
+  memset(&rs, 0, sizeof(RENDER_STATS));
+  memset(&cs, 0, sizeof(CORE_STATS));
+  
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  midi_stats(&ms);
+  render_stats(&rs);
+  core_stats(&cs);
+  
+  /* Human-readable report */
+  fprintf(stderr, "%s: Statistics\n", main_module());
+  for(i = 0; i < PHASE_COUNT; i++) {
+    fprintf(stderr, "  %-14s wall %10.6f s  cpu %10.6f s\n",
+      (m_phase[i]).pName, (m_phase[i]).wall, (m_phase[i]).cpu);
+  }
+  fprintf(stderr, "  Peak capacity:\n");
+  fprintf(stderr, "    midi messages  %ld bytes\n", (long) ms.msg_cap);
+  fprintf(stderr, "    midi moments   %ld\n", (long) ms.moment_cap);
+  fprintf(stderr, "    midi handles   %ld\n", (long) ms.h_cap);
+  fprintf(stderr, "    midi header    %ld\n", (long) ms.head_cap);
+  fprintf(stderr, "    pipeline       %ld\n", (long) rs.pipe_cap);
+  fprintf(stderr, "    core stack     %ld\n", (long) cs.st_cap);
+  fprintf(stderr, "    core bank      %ld\n", (long) cs.bank_cap);
+  fprintf(stderr, "  Counts:\n");
+  fprintf(stderr, "    deleted notes  %ld\n", (long) rs.deleted_count);
+  fprintf(stderr, "    aftertouch     %ld\n", (long) ms.after_count);
+  fprintf(stderr, "    controller     %ld\n", (long) ms.control_count);
+  fprintf(stderr, "    pruned         %ld\n", (long) ms.pruned_count);
+  
+  /* JSON output if requested */
+  if (strcmp(pPath, "-") != 0) {
+    fh = fopen(pPath, "w");
+    if (fh == NULL) {
+      raiseErr(__LINE__, "Failed to create file: %s", pPath);
+    }
+    
+    fprintf(fh, "{\n  \"phases\": {\n");
+    for(i = 0; i < PHASE_COUNT; i++) {
+      fprintf(fh, "    \"%s\": {\"wall\": %.6f, \"cpu\": %.6f}%s\n",
+        (m_phase[i]).pName, (m_phase[i]).wall, (m_phase[i]).cpu,
+        (i < PHASE_COUNT - 1) ? "," : "");
+    }
+    fprintf(fh, "  },\n  \"peak\": {\n");
+    fprintf(fh, "    \"midi_msg\": %ld,\n", (long) ms.msg_cap);
+    fprintf(fh, "    \"midi_moment\": %ld,\n", (long) ms.moment_cap);
+    fprintf(fh, "    \"midi_h\": %ld,\n", (long) ms.h_cap);
+    fprintf(fh, "    \"midi_head\": %ld,\n", (long) ms.head_cap);
+    fprintf(fh, "    \"render_pipe\": %ld,\n", (long) rs.pipe_cap);
+    fprintf(fh, "    \"core_stack\": %ld,\n", (long) cs.st_cap);
+    fprintf(fh, "    \"core_bank\": %ld\n", (long) cs.bank_cap);
+    fprintf(fh, "  },\n  \"counts\": {\n");
+    fprintf(fh, "    \"deleted\": %ld,\n", (long) rs.deleted_count);
+    fprintf(fh, "    \"aftertouch\": %ld,\n", (long) ms.after_count);
+    fprintf(fh, "    \"controller\": %ld,\n", (long) ms.control_count);
+    fprintf(fh, "    \"pruned\": %ld\n", (long) ms.pruned_count);
+    fprintf(fh, "  }\n}\n");
+    
+    if (fclose(fh)) {
+      sayWarn(__LINE__, "Failed to close file: %s", pPath);
+    }
+    fh = NULL;
+  }
+}
+
+/*
+ * profile_enable function.
+ */
+void profile_enable(int32_t count) {
+  if (count < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_profile = count;
+}
+
+/*
+ * profile_call function.
+ */
+void profile_call(int32_t op, long lnum) {
+  
+  double t = 0.0;
+  long objects = 0;
+  PROF_REC *pr = NULL;
+  
+  if ((op < 0) || (op >= optable_count())) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (m_profile > 0) {
+    /* Allocate the operation profile when the first call is made */
+    if (m_prof_op == NULL) {
+      m_prof_op_len = optable_count();
+      m_prof_op = (PROF_REC *) calloc(
+                    (size_t) m_prof_op_len, sizeof(PROF_REC));
+      if (m_prof_op == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+    }
+    
+    /* Time the call */
+    objects = objCount();
+    t = wallTime();
+    optable_call(op, lnum);
+    t = wallTime() - t;
+    objects = objCount() - objects;
+    
+    /* Add to the profile of the operation */
+    pr = &(m_prof_op[op]);
+    pr->key = op;
+    (pr->calls)++;
+    pr->sec += t;
+    pr->objects += objects;
+    
+    /* Add to the profile of the script line, if it is valid */
+    if (srcLine(lnum) >= 0) {
+      capProfLine(lnum);
+      pr = &(m_prof_line[lnum]);
+      (pr->calls)++;
+      pr->sec += t;
+      pr->objects += objects;
+    }
+    
+  } else {
+    optable_call(op, lnum);
+  }
+}
+
+/*
+ * profile_report function.
+ */
+void profile_report(void) {
+  
+  int32_t i = 0;
+  int32_t n = 0;
+  const PROF_REC *pr = NULL;
+  
+  if (m_profile < 1) {
+    return;
+  }
+  
+  /* Report the operations */
+  fprintf(stderr, "%s: Profile by operation\n", main_module());
+  fprintf(stderr, "  %-24s %10s %12s %10s\n",
+    "operation", "calls", "seconds", "objects");
+  if (m_prof_op != NULL) {
+    qsort(m_prof_op, (size_t) m_prof_op_len, sizeof(PROF_REC),
+      &cmpProf);
+    for(i = 0; (i < m_prof_op_len) && (n < m_profile); i++) {
+      pr = &(m_prof_op[i]);
+      if (pr->calls > 0) {
+        fprintf(stderr, "  %-24s %10ld %12.6f %10ld\n",
+          optable_name(pr->key), pr->calls, pr->sec, pr->objects);
+        n++;
+      }
+    }
+  }
+  
+  /* Report the script lines */
+  n = 0;
+  fprintf(stderr, "%s: Profile by script line\n", main_module());
+  fprintf(stderr, "  %-24s %10s %12s %10s\n",
+    "line", "calls", "seconds", "objects");
+  if (m_prof_line != NULL) {
+    qsort(m_prof_line, (size_t) m_prof_line_cap, sizeof(PROF_REC),
+      &cmpProf);
+    for(i = 0; (i < m_prof_line_cap) && (n < m_profile); i++) {
+      pr = &(m_prof_line[i]);
+      if (pr->calls > 0) {
+        fprintf(stderr, "  %-24ld %10ld %12.6f %10ld\n",
+          (long) pr->key, pr->calls, pr->sec, pr->objects);
+        n++;
+      }
+    }
+  }
+  
+  /* The tables are sorted now, so they can't take more calls */
+  releaseProfile();
+}
+
+/*
+ * profile_restart function.
+ */
+void profile_restart(void) {
+  
+  int i = 0;
+  
+  m_profile = 0;
+  releaseProfile();
+  
+  for(i = 0; i < PHASE_COUNT; i++) {
+    (m_phase[i]).wall = 0.0;
+    (m_phase[i]).cpu = 0.0;
+  }
+  m_phase_wall = 0.0;
+  m_phase_cpu = 0.0;
+}
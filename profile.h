@@ -0,0 +1,136 @@
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+/*
+ * profile.h
+ * =========
+ * 
+ * Profiler module of Infrared.
+ * 
+ * This module times the processing phases of the program and reports
+ * them with the statistics of the other modules for the -stats program
+ * option, and profiles the operation calls of the script for the
+ * -profile program option.  See main.c for the reports.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - blob.c
+ *   - core.c
+ *   - diagnostic.c
+ *   - graph.c
+ *   - main.c
+ *   - midi.c
+ *   - optable.c
+ *   - render.c
+ *   - set.c
+ *   - text.c
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The processing phases that are timed for statistics.
+ */
+#define PROFILE_PARSE   (0)
+#define PROFILE_SCRIPT  (1)
+#define PROFILE_RENDER  (2)
+#define PROFILE_CONTROL (3)
+#define PROFILE_MAP     (4)
+#define PROFILE_COMPILE (5)
+
+/*
+ * Public functions
+ * ================
+ */
+
+/*
+ * Record the starting time of a processing phase.
+ * 
+ * Phases do not nest, so each call must be followed by profile_end()
+ * before the next call.
+ */
+void profile_begin(void);
+
+/*
+ * Add the time since the last profile_begin() call to the given phase.
+ * 
+ * The messages reported during the phase are then written out with
+ * diagnostic_sync(), so that buffered messages never wait longer than a
+ * phase.
+ * 
+ * Parameters:
+ * 
+ *   phase - the PROFILE constant of the phase
+ */
+void profile_end(int phase);
+
+/*
+ * Report statistics to standard error, and also write them as a JSON
+ * object to the given path unless the path is "-".
+ * 
+ * The report includes the timing of each phase, the peak capacities of
+ * the main buffers, and the counts kept by the MIDI and rendering
+ * modules.  This must be called before the core module is shut down.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the JSON output path, or "-"
+ */
+void profile_stats(const char *pPath);
+
+/*
+ * Enable the script profile.
+ * 
+ * Once enabled, every operation called through profile_call() is timed
+ * and the objects it allocates are counted.
+ * 
+ * Parameters:
+ * 
+ *   count - the number of entries to report in each list, which must be
+ *   at least one
+ */
+void profile_enable(int32_t count);
+
+/*
+ * Invoke an operation from the operator table.
+ * 
+ * If the script profile is enabled, the call is timed and the objects
+ * it allocates are counted, and the results are added to the profile
+ * of the operation and of the script line.
+ * 
+ * Parameters:
+ * 
+ *   op - the index in the operator table
+ * 
+ *   lnum - the script line number
+ */
+void profile_call(int32_t op, long lnum);
+
+/*
+ * Report the most expensive operations and script lines of the script
+ * profile to standard error, and then release the profile.
+ * 
+ * This does nothing if the script profile is not enabled.  Operations
+ * and lines that were never called are not listed.
+ */
+void profile_report(void);
+
+/*
+ * Disable the script profile and release it, and clear the phase
+ * timing, so that the module is ready for another script.
+ */
+void profile_restart(void);
+
+#endif
@@ -10,10 +10,14 @@
 #include "render.h"
 
 #include <limits.h>
+#include <setjmp.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+
 #include "diagnostic.h"
 #include "pointer.h"
 
@@ -58,6 +62,81 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 #define PIPE_INIT_CAP (64)
 #define PIPE_MAX_CAP  (16384)
 
+/*
+ * The maximum number of cells in the compiled pipeline lookup table.
+ * 
+ * If the product of the class counts along the section, layer, and
+ * articulation axes would exceed this, the pipeline is not compiled and
+ * each note is run through the full pipeline instead.
+ */
+#define LOOKUP_MAX_CELLS (1048576)
+
+/*
+ * The initial capacity of the compiled pipeline result array.  The
+ * maximum capacity is LOOKUP_MAX_CELLS.
+ */
+#define RES_INIT_CAP (64)
+
+/*
+ * The different axes of the compiled pipeline lookup table.
+ */
+#define AXIS_SECT   (0)
+#define AXIS_LAYER  (1)
+#define AXIS_ART    (2)
+
+/*
+ * The number of (channel, key) buckets used by the keyboard process.
+ */
+#define KEY_BUCKETS (MIDI_CH_MAX * (MIDI_DATA_MAX + 1))
+
+/*
+ * Bit layout of the packed note codes in the event store.
+ * 
+ * The low seven bits are the MIDI key.  The next four bits are the
+ * zero-indexed MIDI channel, such that the low eleven bits together are
+ * the keyboard bucket of the event.  The next eight bits are the
+ * aftertouch mode, and the eight bits after that are the release
+ * velocity plus one, so that the special release value -1 is stored as
+ * zero.
+ */
+#define CODE_KEY_SHIFT      (0)
+#define CODE_CH_SHIFT       (7)
+#define CODE_AFTER_SHIFT    (11)
+#define CODE_RELEASE_SHIFT  (19)
+
+#define CODE_BUCKET_MASK    (0x7ffUL)
+
+/*
+ * The number of entries in the aftertouch span cache.  Must be a power
+ * of two no greater than 65536.
+ */
+#define AFTER_CACHE_SIZE (256)
+
+/*
+ * The maximum number of distinct aftertouch rate limits, including the
+ * unlimited rate limit.  The aftertouch mode of an event is zero if
+ * aftertouch is disabled, or else one plus the index of its rate limit,
+ * so this may be at most 255.
+ */
+#define AFTER_LIMIT_MAX (255)
+
+/*
+ * The signature at the start of fragment cache files, including the
+ * format version.
+ */
+#define FRAG_SIGNATURE "IRFC0001"
+#define FRAG_SIGNATURE_LEN (8)
+
+/*
+ * The initial and maximum capacities of the fragment run and fragment
+ * message tables.
+ */
+#define FRAG_RUN_INIT_CAP (64)
+#define FRAG_RUN_MAX_CAP  INT32_C(1048576)
+
+#define FRAG_MSG_INIT_CAP (4096)
+#define FRAG_MSG_MAX_CAP  INT32_C(268435456)
+
 /*
  * Data types
  * ==========
@@ -113,6 +192,16 @@ typedef struct {
     
   } v;
   
+  /*
+   * For CLASS_GRAPH only, one greater than the index of the first graph
+   * classifier in the pipeline that has the same graph.
+   * 
+   * Since graph objects are interned, classifiers with identical graphs
+   * select the same graph index, and so share a graph cursor and
+   * aftertouch cache entries.
+   */
+  int32_t gi;
+  
 } PIPE_CLASS;
 
 /*
@@ -132,8 +221,12 @@ typedef struct {
   
   /*
    * The graph selected by the pipeline.
+   * 
+   * This is zero for the default graph, or else one greater than the
+   * index in the pipeline of the graph classifier that was selected.
+   * Use eventGraph() to get the graph object.
    */
-  GRAPH *pGraph;
+  int32_t gi;
   
   /*
    * The one-indexed MIDI channel selected by the pipeline.
@@ -151,29 +244,53 @@ typedef struct {
   int release;
   
   /*
-   * The aftertouch enable flag selected by the pipeline.
+   * The aftertouch mode selected by the pipeline.
    * 
-   * Either zero or one.
+   * Zero if aftertouch is disabled, else one plus the index of the
+   * aftertouch rate limit in m_alim.
    */
   int after;
   
 } PIPE_RESULT;
 
 /*
- * Infrared note event structure.
+ * Compiled pipeline axis structure.
+ * 
+ * An axis partitions one of the three classification dimensions
+ * (section, layer, or articulation) into equivalence classes.  Every
+ * value within a class is in exactly the same classifier sets along
+ * that dimension, so all values in a class are classified identically.
  */
 typedef struct {
   
   /*
-   * Event ID.
+   * The number of classes on this axis.
    * 
-   * Each note event gets a unique event ID, assigned in ascending
-   * order.
+   * Zero if the axis has not been compiled, otherwise at least one.
+   */
+  int32_t len;
+  
+  /*
+   * The starting value of each class, in strictly ascending order.
    * 
-   * If the event ID is negative, this has the special interpretation
-   * that the event has been deleted.
+   * The array has len elements.  The first element is always zero.  A
+   * class includes its starting value and all values greater than that
+   * up to but excluding the starting value of the next class.  The last
+   * class continues to the end of the integer range.
    */
-  int32_t eid;
+  int32_t *pStart;
+  
+} PIPE_AXIS;
+
+/*
+ * Infrared note event structure.
+ * 
+ * Events are not stored in this form.  Instead, the event store holds
+ * each field in a separate array (see m_ev_t and related variables).
+ * This structure is used for working with one event at a time, with
+ * storeEvent() and loadEvent() converting to and from the event store.
+ */
+typedef struct {
   
   /*
    * The subquantum performance offset of the start of the note.
@@ -185,7 +302,8 @@ typedef struct {
   /*
    * The subquantum performance duration of the note.
    * 
-   * This must be greater than zero.
+   * This must be greater than zero, except that in the event store a
+   * duration of zero marks a "deleted" event.
    */
   int32_t dur;
   
@@ -214,15 +332,16 @@ typedef struct {
   int8_t release;
   
   /*
-   * The aftertouch enable flag.
+   * The aftertouch mode.
    * 
-   * This is either one, enabling polyphonic aftertouch; or zero,
-   * disabling polyphonic aftertouch.
+   * This is zero, disabling polyphonic aftertouch; or one plus the
+   * index in m_alim of the rate limit of enabled polyphonic aftertouch.
    */
   uint8_t after;
   
   /*
-   * The graph determining the velocity of the note.
+   * The graph determining the velocity of the note, as an index that
+   * can be passed to eventGraph().
    * 
    * The note-on velocity is always the result of querying the graph at
    * moment offset corresponding to the t field of this event, with a
@@ -235,22 +354,149 @@ typedef struct {
    *
    * This graph does NOT determine the release velocity of the note.
    */
-  GRAPH *pg;
+  uint16_t gi;
   
 } IR_EVENT;
 
 /*
- * Structure holding state for the graph tracking callback.
+ * Note import job structure.
+ * 
+ * Each worker thread used by importNotes() is given one of these
+ * structures describing the range of NMF notes it should import.
  */
 typedef struct {
   
-  /* The MIDI channel */
-  int ch;
+  /*
+   * The NMF data being imported.
+   */
+  NMF_DATA *pd;
+  
+  /*
+   * The index of the first NMF note in this job.
+   */
+  int32_t lo;
+  
+  /*
+   * One greater than the index of the last NMF note in this job.
+   */
+  int32_t hi;
+  
+  /*
+   * The index of the first NMF note in this job that raised an error,
+   * or -1 if the job completed without errors.
+   */
+  int32_t fault;
+  
+  /*
+   * The worker thread running this job.
+   */
+  pthread_t thread;
+  
+  /*
+   * The error trap for the worker thread.
+   */
+  jmp_buf trap;
+  
+} IMPORT_JOB;
+
+/*
+ * Aftertouch span cache entry.
+ * 
+ * Records the graph span of aftertouch changes for notes with a given
+ * graph index, starting subquantum offset, and subquantum duration.
+ * The span of a note is fully determined by these three values.
+ */
+typedef struct {
+  
+  /* The starting subquantum offset of the note */
+  int32_t t;
   
-  /* The MIDI key */
-  int key;
+  /* The subquantum duration of the note, or zero if entry is unused */
+  int32_t dur;
+  
+  /* The graph index of the note */
+  int32_t gi;
   
-} AFTER_STATE;
+  /* The cached span */
+  GRAPH_SPAN span;
+  
+} AFTER_CACHE;
+
+/*
+ * Aftertouch rate limit.
+ * 
+ * interval is the minimum interval in moment offsets and delta is the
+ * minimum change in graph value between aftertouch messages of a note.
+ * Both are zero if there is no limit.
+ */
+typedef struct {
+  int32_t interval;
+  int32_t delta;
+} AFTER_LIMIT;
+
+/*
+ * A chord whose aftertouch is collapsed into channel pressure.
+ * 
+ * t and t_end are the subquantum offsets of the first note-on and the
+ * last note-off of the chord.  ch is the one-indexed MIDI channel, and
+ * after and gi are the aftertouch mode and graph index shared by all
+ * the notes of the chord.
+ */
+typedef struct {
+  int32_t t;
+  int32_t t_end;
+  uint8_t ch;
+  uint8_t after;
+  uint16_t gi;
+} CHORD;
+
+/*
+ * Sort record used by collapse() to order events by MIDI channel and
+ * then by time offset, with key holding both and i the event index.
+ */
+typedef struct {
+  uint64_t key;
+  int32_t i;
+} CHORD_SLOT;
+
+/*
+ * A MIDI message recorded in the fragment cache.
+ * 
+ * The fields are the arguments that were passed to midi_message().
+ */
+typedef struct {
+  int32_t t;
+  int32_t val;
+  uint8_t ch;
+  uint8_t msg;
+  uint8_t idx;
+} FRAG_MSG;
+
+/*
+ * A run of MIDI messages recorded in the fragment cache for one section.
+ * 
+ * key is the hash that identifies the rendering inputs of the section.
+ * The messages of the run are at indices off up to but excluding
+ * (off + len) in the fragment message table.
+ */
+typedef struct {
+  uint64_t key;
+  int32_t off;
+  int32_t len;
+} FRAG_RUN;
+
+/*
+ * A fragment table, holding runs and their messages.
+ */
+typedef struct {
+  int32_t run_cap;
+  int32_t run_len;
+  FRAG_RUN *pRun;
+  
+  int32_t msg_cap;
+  int32_t msg_len;
+  FRAG_MSG *pMsg;
+} FRAG_TABLE;
 
 /*
  * Local data
@@ -279,6 +525,40 @@ static int32_t m_pipe_cap = 0;
 static int32_t m_pipe_len = 0;
 static PIPE_CLASS *m_pipe = NULL;
 
+/*
+ * The compiled pipeline.
+ * 
+ * m_axis holds the section, layer, and articulation axes, indexed by
+ * the AXIS constants.
+ * 
+ * m_cell is the lookup table, with one cell for each combination of
+ * section, layer, and articulation classes.  Cells are stored with the
+ * articulation class varying fastest and the section class varying
+ * slowest.  Each cell is either zero, meaning the combination has not
+ * been resolved yet, or it is one greater than the index of the
+ * resolved result in m_res.  m_cell is NULL if the pipeline has not
+ * been compiled or if the table would be too large.  m_cell_len is the
+ * number of cells in the table, or zero if there is no table.
+ * 
+ * m_res is the dynamically allocated array holding the resolved results
+ * referenced from the lookup table.
+ */
+static PIPE_AXIS m_axis[3];
+static int32_t m_cell_len = 0;
+static int32_t *m_cell = NULL;
+
+/*
+ * Flag that is set while worker threads are importing notes.
+ * 
+ * While set, runPipe() will not resolve new lookup table cells, since
+ * the lookup table is shared between threads.
+ */
+static int m_frozen = 0;
+
+static int32_t m_res_cap = 0;
+static int32_t m_res_len = 0;
+static PIPE_RESULT *m_res = NULL;
+
 /*
  * The default articulation, ruler, and graph objects used in pipelines,
  * or NULL if they have not been allocated yet.
@@ -288,23 +568,140 @@ static RULER *m_def_ruler = NULL;
 static GRAPH *m_def_graph = NULL;
 
 /*
- * The event ID assignment variable.
+ * The graph cursors used while rendering events, indexed by graph index
+ * as selected by the pipeline.
+ * 
+ * The array has one more element than the pipeline, or it is NULL if it
+ * has not been allocated yet.  Cursors that have not been used yet have
+ * a NULL graph pointer.  Events are rendered in roughly ascending time
+ * order, so each cursor usually only needs to move a short distance.
+ */
+static GRAPH_CURSOR *m_cursor = NULL;
+
+/*
+ * The number of threads to use for importing notes.
+ * 
+ * One means all notes are imported on the calling thread.
+ */
+static int m_threads = 1;
+
+/*
+ * Flag indicating whether the keyboard process is enabled.
+ */
+static int m_keyboard = 0;
+
+/*
+ * Flag indicating whether the aftertouch of chords is collapsed into
+ * channel pressure.
+ */
+static int m_collapse = 0;
+
+/*
+ * The aftertouch span cache.
+ * 
+ * This is a direct-mapped cache, with each note hashed to a single
+ * entry by afterSpan().  Notes within chords and repeated patterns
+ * usually share the same graph and time window, so they can reuse the
+ * span without searching the graph again.
+ */
+static AFTER_CACHE m_after[AFTER_CACHE_SIZE];
+
+/*
+ * The table of aftertouch rate limits.
+ * 
+ * The first entry is always the unlimited rate limit.  m_alim_cur is
+ * the index of the rate limit applied to aftertouch classifiers that
+ * enable aftertouch, which is set by render_after_limit().
+ */
+static AFTER_LIMIT m_alim[AFTER_LIMIT_MAX];
+static int32_t m_alim_len = 1;
+static int32_t m_alim_cur = 0;
+
+/*
+ * The maximum number of NMF notes in each rendering window, or zero to
+ * render all notes in a single window.
+ */
+static int32_t m_window = 0;
+
+/*
+ * The number of events with zero duration that compactEvents() has
+ * removed.
+ */
+static int32_t m_deleted = 0;
+
+/*
+ * The section range set with render_sections().
+ * 
+ * If m_sect_set is non-zero, only notes in sections m_sect_lo to
+ * m_sect_hi inclusive are rendered.
+ */
+static int m_sect_set = 0;
+static int32_t m_sect_lo = 0;
+static int32_t m_sect_hi = 0;
+
+/*
+ * The fragment cache.
+ * 
+ * m_frag_path is the path to the fragment cache file, or NULL if the
+ * fragment cache is not in use.  m_frag_ctx is the context hash given
+ * to render_cache().
+ * 
+ * m_frag_old holds the runs loaded from the cache file.  m_frag_new
+ * receives the runs of the current rendering, which are written back to
+ * the cache file.  While m_frag_capture is set, every MIDI message that
+ * is rendered is also recorded to m_frag_new.
+ */
+static const char *m_frag_path = NULL;
+static uint64_t m_frag_ctx = 0;
+static FRAG_TABLE m_frag_old;
+static FRAG_TABLE m_frag_new;
+static int m_frag_capture = 0;
+
+/*
+ * The event store.
  * 
- * Each time an event ID is assigned, this variable is incremented and
- * the incremented value is the new event ID.  Therefore, the first
- * assigned event ID will be 1.
+ * Events are stored by column, with each field in a separate array of
+ * m_ev_len elements.  m_ev_t and m_ev_dur hold the subquantum offset
+ * and duration, m_ev_code holds the MIDI key, channel, aftertouch flag,
+ * and release velocity packed according to the CODE constants, and
+ * m_ev_gi holds the graph index.
+ * 
+ * The store holds the notes of one rendering window at a time.  It is
+ * initially allocated with one event for each note in the window, with
+ * note index i stored at index (i - m_ev_base).  Events with a duration
+ * of zero are "deleted," and events with a negative duration are
+ * outside the section range of render_sections().  compactEvents()
+ * removes both kinds from the store while keeping the remaining events
+ * in the order they were defined.  Event order therefore matches the
+ * order of event IDs in the rendering documentation.
+ * 
+ * While a window is being imported, m_ev_art holds the articulation of
+ * each measured note and m_ev_ruler holds the ruler of each unmeasured
+ * grace note, with NULL for all other events.  Until timeEvents() runs,
+ * measured notes have their NMF duration in m_ev_dur, and grace notes
+ * have their main beat offset in m_ev_t and their grace note index in
+ * m_ev_dur.
  */
-static int32_t m_unique = 0;
+static int32_t m_ev_base = 0;
+static int32_t m_ev_len = 0;
+static int32_t *m_ev_t = NULL;
+static int32_t *m_ev_dur = NULL;
+static uint32_t *m_ev_code = NULL;
+static uint16_t *m_ev_gi = NULL;
+static ART **m_ev_art = NULL;
+static RULER **m_ev_ruler = NULL;
 
 /*
- * The event buffer.
+ * The chords found by collapse() in the current rendering window.
  * 
- * This will be allocated with the same length in event as the number of
- * notes in the parsed NMF data file.  Event structures with negative
- * event IDs in the buffer represent "deleted" structures.
+ * m_chord holds m_chord_len chords.  m_ev_chord has a flag for each
+ * event in the store, which is non-zero if the event belongs to one of
+ * the chords, so that the channel pressure of the chord replaces the
+ * polyphonic aftertouch of the event.
  */
-static int32_t m_buf_len = 0;
-static IR_EVENT *m_buf = NULL;
+static CHORD *m_chord = NULL;
+static int32_t m_chord_len = 0;
+static uint8_t *m_ev_chord = NULL;
 
 /*
  * Local functions
@@ -315,17 +712,61 @@ static IR_EVENT *m_buf = NULL;
 static long srcLine(long lnum);
 
 static void capPipe(int32_t n);
+static void capRes(int32_t n);
+
+static void classify(
+    int32_t       n_sect,
+    int32_t       n_layer,
+    int32_t       n_art,
+    PIPE_RESULT * pResult);
+
+static int cmpBound(const void *pA, const void *pB);
+static void buildAxis(int axis);
+static int32_t seekAxis(int axis, int32_t val);
+static void compilePipe(void);
+static void resolvePipe(void);
+static void releasePipe(void);
+
 static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult);
+static GRAPH *eventGraph(int32_t gi);
+static GRAPH_CURSOR *eventCursor(int32_t gi);
 
-static int32_t eventID(void);
+static void storeEvent(int32_t i, const IR_EVENT *pe);
+static void loadEvent(int32_t i, IR_EVENT *pe);
+static void compactEvents(void);
+static void timeEvents(void);
 
-static void importNotes(NMF_DATA *pd);
+static void importNote(NMF_DATA *pd, int32_t i);
+static void *importWorker(void *pArg);
+static void importNotes(NMF_DATA *pd, int32_t lo, int32_t hi);
+static void releaseEvents(void);
 
-static int cmpEvent(const void *pA, const void *pB);
+static int cmpSlot(const void *pA, const void *pB);
 static int overlaps(int32_t t1, int32_t dur, int32_t t2);
 static void keyboard(void);
 
-static void afterTrack(void *pCustom, int32_t t, int32_t v);
+static int cmpChordSlot(const void *pA, const void *pB);
+static void releaseChords(void);
+static void collapse(void);
+static void renderChords(void);
+
+static void afterSpan(const IR_EVENT *pe, int32_t v, GRAPH_SPAN *ps);
+static void emitMsg(int32_t t, int ch, int msg, int idx, int val);
+static void renderEvents(void);
+static void renderRange(NMF_DATA *pd, int32_t lo, int32_t hi);
+
+static void fragCapRun(FRAG_TABLE *pt, int32_t n);
+static void fragCapMsg(FRAG_TABLE *pt, int32_t n);
+static void fragRelease(FRAG_TABLE *pt);
+static uint64_t fragHash(uint64_t h, uint32_t val);
+static uint64_t fragKey(NMF_DATA *pd, int32_t lo, int32_t hi);
+static int32_t fragFind(uint64_t key);
+static void fragPut(FILE *pOut, uint64_t val, int bytes);
+static int fragGet(FILE *pIn, uint64_t *pVal, int bytes);
+static void fragLoad(void);
+static void fragSave(void);
+static int fragGrouped(NMF_DATA *pd);
+static void renderCached(NMF_DATA *pd);
 
 /*
  * If the given line number is within valid range, return it as-is.  In
@@ -430,41 +871,127 @@ static void capPipe(int32_t n) {
 }
 
 /*
- * Run an NMF note through the pipeline to determine rendering
- * information.
+ * Make room in capacity for a given number of elements in the compiled
+ * pipeline result array.
+ * 
+ * n is the number of additional elements beyond current length to make
+ * room for.  It must be zero or greater.
+ * 
+ * Upon return, the capacity will be at least n elements higher than the
+ * current length.
+ * 
+ * An error occurs if the requested expansion would go beyond the
+ * maximum allowed capacity.
  * 
  * Parameters:
  * 
- *   pn - the NMF note to run through the pipeline
+ *   n - the number of elements to make room for
+ */
+static void capRes(int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  /* Check parameters */
+  if (n < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Only proceed if n is non-zero */
+  if (n > 0) {
+    
+    /* Make initial allocation if necessary */
+    if (m_res_cap < 1) {
+      m_res = (PIPE_RESULT *) calloc(
+                  (size_t) RES_INIT_CAP, sizeof(PIPE_RESULT));
+      if (m_res == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      m_res_cap = RES_INIT_CAP;
+      m_res_len = 0;
+    }
+    
+    /* Compute target length */
+    if (n <= INT32_MAX - m_res_len) {
+      target = m_res_len + n;
+    } else {
+      raiseErr(__LINE__, "Pipeline result capacity exceeded");
+    }
+    
+    /* Only proceed if target length exceeds current capacity */
+    if (target > m_res_cap) {
+      /* Check that target within maximum capacity */
+      if (target > LOOKUP_MAX_CELLS) {
+        raiseErr(__LINE__, "Pipeline result capacity exceeded");
+      }
+      
+      /* Compute new capacity by doubling current capacity until greater
+       * than or equal to target length, and then limiting to maximum
+       * capacity */
+      new_cap = m_res_cap;
+      while (new_cap < target) {
+        new_cap *= 2;
+      }
+      if (new_cap > LOOKUP_MAX_CELLS) {
+        new_cap = LOOKUP_MAX_CELLS;
+      }
+      
+      /* Expand capacity */
+      m_res = (PIPE_RESULT *) realloc(m_res,
+                            ((size_t) new_cap) * sizeof(PIPE_RESULT));
+      if (m_res == NULL) {
+        raiseErr(__LINE__, "Out of memory");
+      }
+      
+      memset(
+        &(m_res[m_res_cap]),
+        0,
+        ((size_t) (new_cap - m_res_cap)) * sizeof(PIPE_RESULT));
+      
+      m_res_cap = new_cap;
+    }
+  }
+}
+
+/*
+ * Run decoded note fields through every classifier in the pipeline to
+ * determine rendering information.
+ * 
+ * Since sets are interned, classifiers with identical selectors share
+ * the same set pointers.  When a classifier has the same selector sets
+ * as the classifier before it, the membership result of the previous
+ * classifier is reused rather than checking the sets again.
+ * 
+ * Parameters:
+ * 
+ *   n_sect - the NMF section of the note
+ * 
+ *   n_layer - the one-indexed NMF layer of the note
+ * 
+ *   n_art - the NMF articulation of the note
  * 
  *   pResult - structure to store the results of the pipeline
  */
-static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult) {
+static void classify(
+    int32_t       n_sect,
+    int32_t       n_layer,
+    int32_t       n_art,
+    PIPE_RESULT * pResult) {
   
-  int32_t n_art = 0;
-  int32_t n_sect = 0;
-  int32_t n_layer = 0;
   int32_t i = 0;
+  int match = 0;
   const PIPE_CLASS *pc = NULL;
+  const PIPE_CLASS *pPrev = NULL;
   
   /* Check parameters */
-  if ((pn == NULL) || (pResult == NULL)) {
+  if (pResult == NULL) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Clear the result structure and check the input structure's relevant
-   * fields, then get the decoded articulation, section, and layer
-   * fields */
+  /* Clear the result structure */
   memset(pResult, 0, sizeof(PIPE_RESULT));
   
-  if (pn->art > NMF_MAXART) {
-    raiseErr(__LINE__, NULL);
-  }
-  
-  n_art = (int32_t) pn->art;
-  n_sect = (int32_t) pn->sect;
-  n_layer = ((int32_t) pn->layer_i) + 1;
-  
   /* Allocate default objects if not allocated yet */
   if (m_def_art == NULL) {
     m_def_art = art_new(1, 1, 8, 0, -1);
@@ -479,7 +1006,7 @@ static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult) {
   /* Set the defaults in result */
   pResult->pArt = m_def_art;
   pResult->pRuler = m_def_ruler;
-  pResult->pGraph = m_def_graph;
+  pResult->gi = 0;
   pResult->ch = 1;
   pResult->release = -1;
   pResult->after = 0;
@@ -487,9 +1014,17 @@ static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult) {
   /* Apply classifiers in the pipeline */
   for(i = 0; i < m_pipe_len; i++) {
     pc = &(m_pipe[i]);
-    if (set_has(pc->pSect , n_sect ) &&
-        set_has(pc->pLayer, n_layer) &&
-        set_has(pc->pArt  , n_art  )) {
+    if ((pPrev == NULL) ||
+        (pc->pSect != pPrev->pSect) ||
+        (pc->pLayer != pPrev->pLayer) ||
+        (pc->pArt != pPrev->pArt)) {
+      match = (set_has(pc->pSect , n_sect ) &&
+               set_has(pc->pLayer, n_layer) &&
+               set_has(pc->pArt  , n_art  ));
+    }
+    pPrev = pc;
+    
+    if (match) {
       
       switch (pc->ctype) {
         case CLASS_ART:
@@ -501,7 +1036,7 @@ static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult) {
           break;
         
         case CLASS_GRAPH:
-          pResult->pGraph = (pc->v).pg;
+          pResult->gi = pc->gi;
           break;
         
         case CLASS_CHANNEL:
@@ -524,428 +1059,2304 @@ static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult) {
 }
 
 /*
- * Return a newly generated event ID.
+ * Comparison function for sorting axis boundaries.
  * 
- * The first generated event ID is 1 and all subsequent calls are one
- * greater than the previous return value.  An error occurs if the range
- * of the 32-bit integer would be exceeded.
+ * The interface of this function matches the callback function of the
+ * standard library qsort().  Both elements should be int32_t values.
+ * 
+ * Parameters:
+ * 
+ *   pA - pointer to first element
+ * 
+ *   pB - pointer to second element
  * 
  * Return:
  * 
- *   a new event ID
- */
-static int32_t eventID(void) {
-  if (m_unique < INT32_MAX) {
-    m_unique++;
+ *   less than zero, zero, or greater than zero as the first element is
+ *   less than, equal to, or greater than the second element
+ */
+static int cmpBound(const void *pA, const void *pB) {
+  
+  int result = 0;
+  int32_t a = 0;
+  int32_t b = 0;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  a = *((const int32_t *) pA);
+  b = *((const int32_t *) pB);
+  
+  if (a < b) {
+    result = -1;
+  } else if (a > b) {
+    result = 1;
+  }
+  
+  return result;
+}
+
+/*
+ * Compile one axis of the pipeline lookup table.
+ * 
+ * The boundaries of the relevant set in every classifier of the
+ * pipeline are gathered, together with a boundary at zero, and then
+ * sorted and deduplicated to form the class starting values.  Since
+ * sets are interned, a set that is the same pointer as the set of the
+ * previous classifier on this axis has nothing new to contribute and is
+ * skipped.
+ * 
+ * The axis must not already be compiled.
+ * 
+ * Parameters:
+ * 
+ *   axis - one of the AXIS constants
+ */
+static void buildAxis(int axis) {
+  
+  PIPE_AXIS *pa = NULL;
+  SET *ps = NULL;
+  SET *pPrev = NULL;
+  int32_t count = 0;
+  int32_t pos = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  
+  /* Check parameters and state */
+  if ((axis != AXIS_SECT) && (axis != AXIS_LAYER) &&
+      (axis != AXIS_ART)) {
+    raiseErr(__LINE__, NULL);
+  }
+  pa = &(m_axis[axis]);
+  if (pa->len > 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* First pass counts the total number of boundaries, including the
+   * boundary at zero */
+  count = 1;
+  for(i = 0; i < m_pipe_len; i++) {
+    if (axis == AXIS_SECT) {
+      ps = (m_pipe[i]).pSect;
+    } else if (axis == AXIS_LAYER) {
+      ps = (m_pipe[i]).pLayer;
+    } else {
+      ps = (m_pipe[i]).pArt;
+    }
+    if (ps != pPrev) {
+      count += set_bounds(ps, NULL, 0);
+    }
+    pPrev = ps;
+  }
+  
+  /* Allocate the boundary array */
+  pa->pStart = (int32_t *) calloc((size_t) count, sizeof(int32_t));
+  if (pa->pStart == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  /* Second pass gathers all the boundaries */
+  (pa->pStart)[0] = 0;
+  pos = 1;
+  pPrev = NULL;
+  for(i = 0; i < m_pipe_len; i++) {
+    if (axis == AXIS_SECT) {
+      ps = (m_pipe[i]).pSect;
+    } else if (axis == AXIS_LAYER) {
+      ps = (m_pipe[i]).pLayer;
+    } else {
+      ps = (m_pipe[i]).pArt;
+    }
+    if (ps != pPrev) {
+      pos += set_bounds(ps, &((pa->pStart)[pos]), count - pos);
+    }
+    pPrev = ps;
+  }
+  if (pos != count) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Sort the boundaries and then remove duplicates */
+  if (count > 1) {
+    qsort(pa->pStart, (size_t) count, sizeof(int32_t), &cmpBound);
+  }
+  
+  j = 1;
+  for(i = 1; i < count; i++) {
+    if ((pa->pStart)[i] != (pa->pStart)[j - 1]) {
+      (pa->pStart)[j] = (pa->pStart)[i];
+      j++;
+    }
+  }
+  
+  pa->len = j;
+}
+
+/*
+ * Determine which class of a compiled axis a value belongs to.
+ * 
+ * Parameters:
+ * 
+ *   axis - one of the AXIS constants
+ * 
+ *   val - the value to look up, which must be zero or greater
+ * 
+ * Return:
+ * 
+ *   the class index on the axis
+ */
+static int32_t seekAxis(int axis, int32_t val) {
+  
+  const PIPE_AXIS *pa = NULL;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t mid = 0;
+  
+  /* Check parameters and state */
+  if ((axis != AXIS_SECT) && (axis != AXIS_LAYER) &&
+      (axis != AXIS_ART)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (val < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  pa = &(m_axis[axis]);
+  if (pa->len < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Find the last class starting value that is less than or equal to
+   * the given value; the first class always starts at zero */
+  lo = 0;
+  hi = pa->len - 1;
+  while (lo < hi) {
+    mid = lo + ((hi - lo) / 2);
+    if (mid <= lo) {
+      mid = lo + 1;
+    }
+    
+    if ((pa->pStart)[mid] <= val) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  
+  return lo;
+}
+
+/*
+ * Compile the pipeline into a lookup table.
+ * 
+ * Each axis is partitioned into classes and an empty lookup table is
+ * allocated with one cell for each class combination.  Cells are
+ * resolved lazily by runPipe() the first time a note falls into them.
+ * 
+ * If the lookup table would exceed LOOKUP_MAX_CELLS, the table is not
+ * allocated and runPipe() will fall back to running each note through
+ * the full pipeline.
+ */
+static void compilePipe(void) {
+  
+  int64_t cells = 0;
+  
+  /* Check state */
+  if (m_cell != NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Compile each axis */
+  buildAxis(AXIS_SECT);
+  buildAxis(AXIS_LAYER);
+  buildAxis(AXIS_ART);
+  
+  /* Compute the number of cells, stopping early if the limit is
+   * exceeded */
+  cells = (int64_t) (m_axis[AXIS_SECT]).len;
+  if (cells <= LOOKUP_MAX_CELLS) {
+    cells *= (int64_t) (m_axis[AXIS_LAYER]).len;
+  }
+  if (cells <= LOOKUP_MAX_CELLS) {
+    cells *= (int64_t) (m_axis[AXIS_ART]).len;
+  }
+  
+  /* Allocate the lookup table if within limits */
+  if (cells <= LOOKUP_MAX_CELLS) {
+    m_cell = (int32_t *) calloc((size_t) cells, sizeof(int32_t));
+    if (m_cell == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_cell_len = (int32_t) cells;
+  }
+  
+  /* Allocate the default objects now rather than leaving them to
+   * classify(), which may run on several import threads at once */
+  if (m_def_art == NULL) {
+    m_def_art = art_new(1, 1, 8, 0, -1);
+  }
+  if (m_def_ruler == NULL) {
+    m_def_ruler = ruler_new(48, 0, -1);
+  }
+  if (m_def_graph == NULL) {
+    m_def_graph = graph_constant(64, -1);
+  }
+}
+
+/*
+ * Resolve every cell in the compiled pipeline lookup table.
+ * 
+ * This is used before importing notes with multiple threads, since the
+ * worker threads can not resolve cells in the shared table.  Does
+ * nothing if the lookup table was not allocated.
+ */
+static void resolvePipe(void) {
+  
+  int32_t ci = 0;
+  int32_t c_sect = 0;
+  int32_t c_layer = 0;
+  int32_t c_art = 0;
+  
+  /* Only proceed if there is a lookup table */
+  if (m_cell != NULL) {
+    
+    /* Iterate through all cells in table order */
+    ci = 0;
+    for(c_sect = 0; c_sect < (m_axis[AXIS_SECT]).len; c_sect++) {
+      for(c_layer = 0; c_layer < (m_axis[AXIS_LAYER]).len; c_layer++) {
+        for(c_art = 0; c_art < (m_axis[AXIS_ART]).len; c_art++) {
+          
+          /* Resolve the cell if not already resolved */
+          if (m_cell[ci] == 0) {
+            capRes(1);
+            classify(
+              ((m_axis[AXIS_SECT ]).pStart)[c_sect ],
+              ((m_axis[AXIS_LAYER]).pStart)[c_layer],
+              ((m_axis[AXIS_ART  ]).pStart)[c_art  ],
+              &(m_res[m_res_len]));
+            m_res_len++;
+            m_cell[ci] = m_res_len;
+          }
+          
+          ci++;
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Release the compiled pipeline lookup table, if it has been compiled.
+ */
+static void releasePipe(void) {
+  
+  int i = 0;
+  
+  if (m_cell != NULL) {
+    free(m_cell);
+    m_cell = NULL;
+    m_cell_len = 0;
+  }
+  
+  if (m_res_cap > 0) {
+    free(m_res);
+    m_res = NULL;
+    m_res_cap = 0;
+    m_res_len = 0;
+  }
+  
+  for(i = 0; i < 3; i++) {
+    if ((m_axis[i]).len > 0) {
+      free((m_axis[i]).pStart);
+      (m_axis[i]).pStart = NULL;
+      (m_axis[i]).len = 0;
+    }
+  }
+}
+
+/*
+ * Run an NMF note through the pipeline to determine rendering
+ * information.
+ * 
+ * If the pipeline has been compiled with compilePipe(), the result is
+ * taken from the lookup table, resolving the table cell first if this
+ * is the first note to fall into it.  Otherwise, the note is run
+ * through every classifier in the pipeline.
+ * 
+ * While m_frozen is set, unresolved cells are not written to the table,
+ * and notes that fall into them are run through the full pipeline.
+ * 
+ * Parameters:
+ * 
+ *   pn - the NMF note to run through the pipeline
+ * 
+ *   pResult - structure to store the results of the pipeline
+ */
+static void runPipe(const NMF_NOTE *pn, PIPE_RESULT *pResult) {
+  
+  int32_t n_art = 0;
+  int32_t n_sect = 0;
+  int32_t n_layer = 0;
+  int32_t c_art = 0;
+  int32_t c_sect = 0;
+  int32_t c_layer = 0;
+  int32_t ci = 0;
+  
+  /* Check parameters */
+  if ((pn == NULL) || (pResult == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Check the input structure's relevant fields, then get the decoded
+   * articulation, section, and layer fields */
+  if (pn->art > NMF_MAXART) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  n_art = (int32_t) pn->art;
+  n_sect = (int32_t) pn->sect;
+  n_layer = ((int32_t) pn->layer_i) + 1;
+  
+  /* If pipeline is not compiled, run the full pipeline */
+  if (m_cell == NULL) {
+    classify(n_sect, n_layer, n_art, pResult);
+    return;
+  }
+  
+  /* Find the lookup table cell */
+  c_sect = seekAxis(AXIS_SECT, n_sect);
+  c_layer = seekAxis(AXIS_LAYER, n_layer);
+  c_art = seekAxis(AXIS_ART, n_art);
+  
+  ci = (((c_sect * (m_axis[AXIS_LAYER]).len) + c_layer)
+          * (m_axis[AXIS_ART]).len) + c_art;
+  
+  /* If the cell is not resolved yet, resolve it using the starting
+   * values of its classes, which are classified the same as every other
+   * value in the classes */
+  if ((m_cell[ci] == 0) && m_frozen) {
+    classify(n_sect, n_layer, n_art, pResult);
+    return;
+    
+  } else if (m_cell[ci] == 0) {
+    capRes(1);
+    classify(
+      ((m_axis[AXIS_SECT ]).pStart)[c_sect ],
+      ((m_axis[AXIS_LAYER]).pStart)[c_layer],
+      ((m_axis[AXIS_ART  ]).pStart)[c_art  ],
+      &(m_res[m_res_len]));
+    m_res_len++;
+    m_cell[ci] = m_res_len;
+  }
+  
+  /* Copy the resolved result */
+  memcpy(pResult, &(m_res[m_cell[ci] - 1]), sizeof(PIPE_RESULT));
+}
+
+/*
+ * Get the graph object for a graph index selected by the pipeline.
+ * 
+ * Parameters:
+ * 
+ *   gi - zero for the default graph, or one greater than the index of a
+ *   graph classifier in the pipeline
+ * 
+ * Return:
+ * 
+ *   the graph object
+ */
+static GRAPH *eventGraph(int32_t gi) {
+  
+  GRAPH *pg = NULL;
+  
+  if ((gi < 0) || (gi > m_pipe_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (gi > 0) {
+    if ((m_pipe[gi - 1]).ctype != CLASS_GRAPH) {
+      raiseErr(__LINE__, NULL);
+    }
+    pg = (m_pipe[gi - 1]).v.pg;
+    
+  } else {
+    if (m_def_graph == NULL) {
+      m_def_graph = graph_constant(64, -1);
+    }
+    pg = m_def_graph;
+  }
+  
+  return pg;
+}
+
+/*
+ * Get the graph cursor for a graph index selected by the pipeline.
+ * 
+ * The cursor array is allocated and the cursor is bound to the graph
+ * from eventGraph() on first use.
+ * 
+ * Parameters:
+ * 
+ *   gi - zero for the default graph, or one greater than the index of a
+ *   graph classifier in the pipeline
+ * 
+ * Return:
+ * 
+ *   the graph cursor
+ */
+static GRAPH_CURSOR *eventCursor(int32_t gi) {
+  
+  if ((gi < 0) || (gi > m_pipe_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (m_cursor == NULL) {
+    m_cursor = (GRAPH_CURSOR *) calloc(
+                  (size_t) (m_pipe_len + 1), sizeof(GRAPH_CURSOR));
+    if (m_cursor == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+  }
+  
+  if ((m_cursor[gi]).pg == NULL) {
+    graph_cursor_init(&(m_cursor[gi]), eventGraph(gi));
+  }
+  
+  return &(m_cursor[gi]);
+}
+
+/*
+ * Store an event in the event store.
+ * 
+ * Parameters:
+ * 
+ *   i - the index in the event store
+ * 
+ *   pe - the event to store
+ */
+static void storeEvent(int32_t i, const IR_EVENT *pe) {
+  
+  uint32_t code = 0;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= m_ev_len) || (pe == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((pe->ch < 1) || (pe->ch > MIDI_CH_MAX) ||
+      (pe->key > MIDI_DATA_MAX) ||
+      (pe->release < -1)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Pack the note code */
+  code = (((uint32_t) pe->key) << CODE_KEY_SHIFT)
+        | (((uint32_t) (pe->ch - 1)) << CODE_CH_SHIFT)
+        | (((uint32_t) pe->after) << CODE_AFTER_SHIFT)
+        | (((uint32_t) (pe->release + 1)) << CODE_RELEASE_SHIFT);
+  
+  /* Store the columns */
+  m_ev_t[i] = pe->t;
+  m_ev_dur[i] = pe->dur;
+  m_ev_code[i] = code;
+  m_ev_gi[i] = pe->gi;
+}
+
+/*
+ * Load an event from the event store.
+ * 
+ * Parameters:
+ * 
+ *   i - the index in the event store
+ * 
+ *   pe - the structure to receive the event
+ */
+static void loadEvent(int32_t i, IR_EVENT *pe) {
+  
+  uint32_t code = 0;
+  
+  /* Check parameters */
+  if ((i < 0) || (i >= m_ev_len) || (pe == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Load the columns and unpack the note code */
+  code = m_ev_code[i];
+  
+  pe->t = m_ev_t[i];
+  pe->dur = m_ev_dur[i];
+  pe->key = (uint8_t) ((code >> CODE_KEY_SHIFT) & 0x7f);
+  pe->ch = (uint8_t) (((code >> CODE_CH_SHIFT) & 0xf) + 1);
+  pe->after = (uint8_t) ((code >> CODE_AFTER_SHIFT) & 0xff);
+  pe->release = (int8_t) (((int) ((code >> CODE_RELEASE_SHIFT) & 0xff))
+                            - 1);
+  pe->gi = m_ev_gi[i];
+}
+
+/*
+ * Remove all deleted and skipped events from the event store.
+ * 
+ * Only the deleted events are counted in m_deleted.  The remaining
+ * events stay in the same relative order.  The store
+ * arrays are then shrunk to the new length, or released if no events
+ * remain.
+ */
+static void compactEvents(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  
+  /* Move each event that is not deleted down to the next free index */
+  j = 0;
+  for(i = 0; i < m_ev_len; i++) {
+    if (m_ev_dur[i] > 0) {
+      if (j < i) {
+        m_ev_t[j] = m_ev_t[i];
+        m_ev_dur[j] = m_ev_dur[i];
+        m_ev_code[j] = m_ev_code[i];
+        m_ev_gi[j] = m_ev_gi[i];
+      }
+      j++;
+      
+    } else if (m_ev_dur[i] == 0) {
+      m_deleted++;
+    }
+  }
+  
+  /* Shrink or release the arrays if anything was removed */
+  if ((j < m_ev_len) && (j > 0)) {
+    m_ev_t = (int32_t *) realloc(m_ev_t, ((size_t) j) * sizeof(int32_t));
+    m_ev_dur = (int32_t *) realloc(
+                  m_ev_dur, ((size_t) j) * sizeof(int32_t));
+    m_ev_code = (uint32_t *) realloc(
+                  m_ev_code, ((size_t) j) * sizeof(uint32_t));
+    m_ev_gi = (uint16_t *) realloc(
+                  m_ev_gi, ((size_t) j) * sizeof(uint16_t));
+    if ((m_ev_t == NULL) || (m_ev_dur == NULL) ||
+        (m_ev_code == NULL) || (m_ev_gi == NULL)) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    m_ev_len = j;
+    
+  } else if (j < m_ev_len) {
+    free(m_ev_t);
+    free(m_ev_dur);
+    free(m_ev_code);
+    free(m_ev_gi);
+    m_ev_t = NULL;
+    m_ev_dur = NULL;
+    m_ev_code = NULL;
+    m_ev_gi = NULL;
+    m_ev_len = 0;
+  }
+}
+
+/*
+ * Compute the performance timing of all the notes that importNote()
+ * deferred.
+ * 
+ * Events are handled in runs of consecutive events that share the same
+ * articulation or ruler, so that each run goes through one call to the
+ * batch kernels.  If a kernel rejects an input, the scalar function is
+ * called on that input to report the error.  The pending articulation
+ * and ruler columns are released when this function returns.
+ */
+static void timeEvents(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t f = 0;
+  int32_t d = 0;
+  
+  i = 0;
+  while (i < m_ev_len) {
+    j = i + 1;
+    if (m_ev_art[i] != NULL) {
+      /* Run of measured notes sharing an articulation */
+      while ((j < m_ev_len) && (m_ev_art[j] == m_ev_art[i])) {
+        j++;
+      }
+      f = art_transform_batch(
+            m_ev_art[i], &(m_ev_dur[i]), &(m_ev_dur[i]), j - i);
+      if (f >= 0) {
+        art_transform(m_ev_art[i], m_ev_dur[i + f]);
+        raiseErr(__LINE__, NULL);
+      }
+      
+    } else if (m_ev_ruler[i] != NULL) {
+      /* Run of grace notes sharing a ruler */
+      while ((j < m_ev_len) && (m_ev_ruler[j] == m_ev_ruler[i])) {
+        j++;
+      }
+      f = ruler_pos_batch(m_ev_ruler[i], &(m_ev_t[i]), &(m_ev_dur[i]),
+                          &(m_ev_t[i]), j - i);
+      if (f >= 0) {
+        ruler_pos(m_ev_ruler[i], m_ev_t[i + f], m_ev_dur[i + f]);
+        raiseErr(__LINE__, NULL);
+      }
+      
+      d = ruler_dur(m_ev_ruler[i]);
+      for( ; i < j; i++) {
+        m_ev_dur[i] = d;
+      }
+    }
+    i = j;
+  }
+  
+  free(m_ev_art);
+  free(m_ev_ruler);
+  m_ev_art = NULL;
+  m_ev_ruler = NULL;
+}
+
+/*
+ * Release the event store, leaving it empty.
+ */
+static void releaseEvents(void) {
+  releaseChords();
+  free(m_ev_art);
+  free(m_ev_ruler);
+  m_ev_art = NULL;
+  m_ev_ruler = NULL;
+  if (m_ev_len > 0) {
+    free(m_ev_t);
+    free(m_ev_dur);
+    free(m_ev_code);
+    free(m_ev_gi);
+    m_ev_t = NULL;
+    m_ev_dur = NULL;
+    m_ev_code = NULL;
+    m_ev_gi = NULL;
+    m_ev_len = 0;
+  }
+  m_ev_base = 0;
+}
+
+/*
+ * Import a single note from a parsed NMF data object into the event
+ * store.
+ * 
+ * The event store must already be allocated with one event for each
+ * note in the current window.  The imported note is written to the
+ * event at the same position in the store as the note's position in the
+ * window, so that the store order matches the order of event IDs
+ * regardless of which thread imports the note.
+ * 
+ * The performance timing of the note is not computed here.  Instead,
+ * its articulation or ruler is recorded in the pending columns so that
+ * timeEvents() can compute the timing of the whole window in batches.
+ * 
+ * Parameters:
+ * 
+ *   pd - the NMF data to import from
+ * 
+ *   i - the index of the note to import
+ */
+static void importNote(NMF_DATA *pd, int32_t i) {
+  
+  IR_EVENT *pe = NULL;
+  IR_EVENT e;
+  NMF_NOTE ns;
+  PIPE_RESULT r;
+  
+  /* Initialize structures */
+  memset(&e, 0, sizeof(IR_EVENT));
+  memset(&ns, 0, sizeof(NMF_NOTE));
+  memset(&r, 0, sizeof(PIPE_RESULT));
+  pe = &e;
+  
+  /* Check parameters */
+  if (pd == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((i < m_ev_base) || (i - m_ev_base >= m_ev_len)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get the NMF note */
+  nmf_get(pd, i, &ns);
+  
+  /* If a section range is selected and the note is outside of it, skip
+   * the note by storing a negative duration */
+  if (m_sect_set && (((int32_t) ns.sect < m_sect_lo) ||
+                      ((int32_t) ns.sect > m_sect_hi))) {
+    m_ev_dur[i - m_ev_base] = -1;
+    return;
+  }
+  
+  /* If NMF duration is zero, then delete the corresponding Infrared
+   * event by storing a duration of zero and skip rest of processing */
+  if (ns.dur == 0) {
+    m_ev_dur[i - m_ev_base] = 0;
+    return;
+  }
+  
+  /* Use the pipeline to classify this note */
+  runPipe(&ns, &r);
+  
+  /* Determine performance offset and duration based on whether note is
+   * measured or unmeasured */
+  if (ns.dur > 0) {
+    /* Measured note, so determine performance offset by multiplying NMF
+     * offset by 8 */
+    if (ns.t < 0) {
+      raiseErr(__LINE__, NULL);
+    }
+    if (ns.t <= INT32_MAX / 8) {
+      pe->t = ns.t * 8;
+    } else {
+      raiseErr(__LINE__, "Subquantum offset overflow");
+    }
+    
+    /* Keep the NMF duration and record the articulation object assigned
+     * to this note by the pipeline, which timeEvents() uses to compute
+     * the performance duration */
+    pe->dur = ns.dur;
+    m_ev_art[i - m_ev_base] = r.pArt;
+    
+  } else if (ns.dur < 0) {
+    /* Unmeasured grace note, so determine the main beat offset by
+     * multiplying NMF offset by 8 and record the ruler, which
+     * timeEvents() applies to get the performance offset and duration */
+    if (ns.t < 0) {
+      raiseErr(__LINE__, NULL);
+    }
+    if (ns.t <= INT32_MAX / 8) {
+      pe->t = ns.t * 8;
+    } else {
+      raiseErr(__LINE__, "Subquantum offset overflow");
+    }
+    pe->dur = ns.dur;
+    m_ev_ruler[i - m_ev_base] = r.pRuler;
+    
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Determine MIDI key number by adding 60 to the NMF pitch, since MIDI
+   * key 60 is middle C, which is NMF pitch zero; if the NMF pitch is in
+   * range, the MIDI key number will be in range too */
+  if ((ns.pitch < NMF_MINPITCH) || (ns.pitch > NMF_MAXPITCH)) {
+    raiseErr(__LINE__, NULL);
+  }
+  pe->key = (uint8_t) (ns.pitch + 60);
+  
+  /* The rest of the note data comes from the pipeline, with the
+   * aftertouch mode checked before it is narrowed */
+  if ((r.after < 0) || (r.after > AFTER_LIMIT_MAX)) {
+    raiseErr(__LINE__, NULL);
+  }
+  pe->ch = (uint8_t) r.ch;
+  pe->release = (int8_t) r.release;
+  pe->after = (uint8_t) r.after;
+  pe->gi = (uint16_t) r.gi;
+  
+  /* Store the event */
+  storeEvent(i - m_ev_base, pe);
+}
+
+/*
+ * Worker thread entrypoint for importing notes.
+ * 
+ * The interface of this function matches the start routine of the
+ * pthread_create() function.  The argument must be an IMPORT_JOB
+ * structure.
+ * 
+ * Errors are trapped rather than reported.  If an error occurs, the
+ * index of the note that caused it is recorded in the job and the job
+ * stops.
+ * 
+ * Parameters:
+ * 
+ *   pArg - the IMPORT_JOB structure
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *importWorker(void *pArg) {
+  
+  IMPORT_JOB *pj = NULL;
+  volatile int32_t i = 0;
+  
+  pj = (IMPORT_JOB *) pArg;
+  
+  i = pj->lo;
+  pj->fault = -1;
+  
+  diagnostic_trap(&(pj->trap));
+  if (setjmp(pj->trap)) {
+    pj->fault = i;
+  } else {
+    for( ; i < pj->hi; i++) {
+      importNote(pj->pd, i);
+    }
+  }
+  diagnostic_trap(NULL);
+  
+  return NULL;
+}
+
+/*
+ * Import a window of notes from a parsed NMF data object into the event
+ * store.
+ * 
+ * The window includes all notes with index at least lo and less than
+ * hi.  The window must not be empty.
+ * 
+ * The pipeline should be set up, as it will be used to get performance
+ * data for the notes.  The event store must be empty or an error
+ * occurs.
+ * 
+ * The result will be held in the event store, with length given by
+ * m_ev_len.  Deleted events are compacted out of the store before this
+ * function returns.
+ * 
+ * If render_threads() selected more than one thread, the notes are
+ * split into contiguous ranges that are imported by worker threads.
+ * If any worker fails, the earliest failing note is imported again on
+ * the calling thread, so that the same error is reported as would have
+ * been reported by a single-threaded import.
+ * 
+ * Parameters:
+ * 
+ *   pd - the NMF data to import
+ * 
+ *   lo - the index of the first note in the window
+ * 
+ *   hi - one greater than the index of the last note in the window
+ */
+static void importNotes(NMF_DATA *pd, int32_t lo, int32_t hi) {
+  
+  int32_t i = 0;
+  int32_t count = 0;
+  int32_t per = 0;
+  int32_t fault = -1;
+  IMPORT_JOB *pj = NULL;
+  
+  /* Check state and parameters */
+  if (m_ev_len > 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pd == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((lo < 0) || (hi <= lo) || (hi > nmf_notes(pd))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Allocate store with same length as the number of notes in the
+   * window */
+  m_ev_base = lo;
+  m_ev_len = hi - lo;
+  m_ev_t = (int32_t *) calloc((size_t) m_ev_len, sizeof(int32_t));
+  m_ev_dur = (int32_t *) calloc((size_t) m_ev_len, sizeof(int32_t));
+  m_ev_code = (uint32_t *) calloc(
+                (size_t) m_ev_len, sizeof(uint32_t));
+  m_ev_gi = (uint16_t *) calloc((size_t) m_ev_len, sizeof(uint16_t));
+  m_ev_art = (ART **) calloc((size_t) m_ev_len, sizeof(ART *));
+  m_ev_ruler = (RULER **) calloc((size_t) m_ev_len, sizeof(RULER *));
+  if ((m_ev_t == NULL) || (m_ev_dur == NULL) ||
+      (m_ev_code == NULL) || (m_ev_gi == NULL) ||
+      (m_ev_art == NULL) || (m_ev_ruler == NULL)) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  /* Determine the number of jobs, with no more jobs than notes */
+  count = (int32_t) m_threads;
+  if (count > m_ev_len) {
+    count = m_ev_len;
+  }
+  
+  /* Single-threaded import just imports each NMF note directly */
+  if (count <= 1) {
+    for(i = lo; i < hi; i++) {
+      importNote(pd, i);
+    }
+    timeEvents();
+    compactEvents();
+    return;
+  }
+  
+  /* Resolve the whole lookup table ahead of time if it is no larger
+   * than the number of notes, and then freeze it so that the worker
+   * threads can share it */
+  if (m_cell_len <= m_ev_len) {
+    resolvePipe();
+  }
+  m_frozen = 1;
+  
+  /* Allocate the jobs and split the note range between them */
+  pj = (IMPORT_JOB *) calloc((size_t) count, sizeof(IMPORT_JOB));
+  if (pj == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  per = m_ev_len / count;
+  for(i = 0; i < count; i++) {
+    (pj[i]).pd = pd;
+    (pj[i]).lo = lo + (i * per);
+    if (i < count - 1) {
+      (pj[i]).hi = lo + ((i + 1) * per);
+    } else {
+      (pj[i]).hi = hi;
+    }
+    (pj[i]).fault = -1;
+  }
+  
+  /* Start all the workers and wait for them to finish */
+  for(i = 0; i < count; i++) {
+    if (pthread_create(&((pj[i]).thread), NULL,
+                        &importWorker, &(pj[i]))) {
+      raiseErr(__LINE__, "Failed to start import thread");
+    }
+  }
+  for(i = 0; i < count; i++) {
+    if (pthread_join((pj[i]).thread, NULL)) {
+      raiseErr(__LINE__, "Failed to join import thread");
+    }
+  }
+  
+  m_frozen = 0;
+  
+  /* Jobs are in note order, so the first job that failed has the
+   * earliest failing note; release the jobs and then import that note
+   * again on this thread to report its error */
+  fault = -1;
+  for(i = 0; i < count; i++) {
+    if ((pj[i]).fault >= 0) {
+      fault = (pj[i]).fault;
+      break;
+    }
+  }
+  
+  free(pj);
+  pj = NULL;
+  
+  if (fault >= 0) {
+    importNote(pd, fault);
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Compute the deferred timing and remove deleted events */
+  timeEvents();
+  compactEvents();
+}
+
+/*
+ * Comparison function for sorting the events within a keyboard bucket.
+ * 
+ * The interface of this function matches the callback function of the
+ * standard library qsort().  Both elements should be int32_t indices
+ * into the event store, which must refer to events that are not
+ * deleted.  All events within a bucket share the same MIDI channel and
+ * MIDI key, so those fields are not compared.
+ * 
+ * The first comparison is by performance time offset.
+ * 
+ * The second comparison is by performance duration in descending order.
+ * 
+ * The third comparison is by event store index in descending order,
+ * which is the same as descending event ID order.
+ * 
+ * Parameters:
+ * 
+ *   pA - pointer to first element
+ * 
+ *   pB - pointer to second element
+ * 
+ * Return:
+ * 
+ *   less than zero, zero, or greater than zero as the first element is
+ *   less than, equal to, or greater than the second element
+ */
+static int cmpSlot(const void *pA, const void *pB) {
+  
+  int result = 0;
+  int32_t i1 = 0;
+  int32_t i2 = 0;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  i1 = *((const int32_t *) pA);
+  i2 = *((const int32_t *) pB);
+  
+  if (m_ev_t[i1] < m_ev_t[i2]) {
+    result = -1;
+  } else if (m_ev_t[i1] > m_ev_t[i2]) {
+    result = 1;
+  }
+  
+  if (result == 0) {
+    if (m_ev_dur[i1] > m_ev_dur[i2]) {
+      result = -1;
+    } else if (m_ev_dur[i1] < m_ev_dur[i2]) {
+      result = 1;
+    }
+  }
+  
+  if (result == 0) {
+    if (i1 > i2) {
+      result = -1;
+    } else if (i1 < i2) {
+      result = 1;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Check whether one event overlaps with another.
+ * 
+ * t1 is the time offset of the first event.  dur is the duration of the
+ * first event, which must be greater than zero.  t2 is the time offset
+ * of the second event, which must be greater than t1.
+ * 
+ * Non-zero is returned only if (t1+dur) > t2.  This function performs
+ * the calculation safely in 64-bit space to avoid potential overflow
+ * problems.
+ * 
+ * Parameters:
+ * 
+ *   t1 - the time offset of the first event
+ * 
+ *   dur - the duration of the first event
+ * 
+ *   t2 - the time offset of the second event
+ * 
+ * Return:
+ * 
+ *   non-zero if first event overlaps second, zero otherwise
+ */
+static int overlaps(int32_t t1, int32_t dur, int32_t t2) {
+  
+  int result = 0;
+  int32_t te = 0;
+  
+  if (dur < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (t2 <= t1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (t1 <= INT32_MAX - dur) {
+    te = t1 + dur;
+    if (te > t2) {
+      result = 1;
+    } else {
+      result = 0;
+    }
+    
   } else {
-    raiseErr(__LINE__, "Event ID generation overflow");
+    result = 0;
+  }
+  
+  return result;
+}
+
+/*
+ * Perform the "keyboard process."
+ * 
+ * This function operates on the event store.  The event store should
+ * already be filled with importNotes().  If this function is run on an
+ * empty event store, it does nothing.
+ * 
+ * Events are first distributed into buckets, one for each combination
+ * of MIDI channel and MIDI key, using a counting pass over the store.
+ * Each bucket is then sorted on its own by time offset, then by
+ * descending duration, and then by descending event ID.  The event
+ * store itself is not reordered, so events are still rendered in the
+ * order they were defined.
+ * 
+ * For each sorted sequence of events in a bucket that share the same
+ * time offset, the first event in the sequence is retained and all
+ * other events are "deleted" by setting their duration to zero, after
+ * which they are compacted out of the store.  This means that when
+ * there are multiple events starting on the same channel on the same
+ * key at the same time, only the longest event is chosen.  If there
+ * are multiple longest events, the latest defined event (as determined
+ * by event ID) is chosen.
+ * 
+ * The first event in each sequence (including sequences of only one
+ * event) is then compared to the first event in the next sequence in
+ * the bucket (if there is a next sequence), and the duration of the
+ * current sequence event is shortened if necessary such that its
+ * release is no later than the onset of the next sequence.
+ * 
+ * This keyboard process guarantees that within each key of each MIDI
+ * channel, there will be no overlapping events.
+ */
+static void keyboard(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t b = 0;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t cur = 0;
+  int32_t *pStart = NULL;
+  int32_t *pSlot = NULL;
+  
+  /* Only proceed if at least two events */
+  if (m_ev_len > 1) {
+    
+    /* Allocate the bucket start array, which has one extra element at
+     * the end, and the slot array */
+    pStart = (int32_t *) calloc(
+                (size_t) (KEY_BUCKETS + 1), sizeof(int32_t));
+    pSlot = (int32_t *) calloc((size_t) m_ev_len, sizeof(int32_t));
+    if ((pStart == NULL) || (pSlot == NULL)) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    
+    /* Count the events in each bucket, storing each count in the
+     * element after the bucket */
+    for(i = 0; i < m_ev_len; i++) {
+      b = (int32_t) (m_ev_code[i] & CODE_BUCKET_MASK);
+      pStart[b + 1]++;
+    }
+    
+    /* Convert counts into starting slot indices */
+    for(b = 0; b < KEY_BUCKETS; b++) {
+      pStart[b + 1] += pStart[b];
+    }
+    
+    /* Distribute event indices into the buckets, advancing each bucket
+     * start as a cursor */
+    for(i = 0; i < m_ev_len; i++) {
+      b = (int32_t) (m_ev_code[i] & CODE_BUCKET_MASK);
+      pSlot[pStart[b]] = i;
+      pStart[b]++;
+    }
+    
+    /* Each bucket start has now advanced to the start of the next
+     * bucket, so shift them back */
+    for(b = KEY_BUCKETS; b > 0; b--) {
+      pStart[b] = pStart[b - 1];
+    }
+    pStart[0] = 0;
+    
+    /* Process each bucket independently */
+    for(b = 0; b < KEY_BUCKETS; b++) {
+      lo = pStart[b];
+      hi = pStart[b + 1];
+      
+      /* Skip buckets with only zero or one event */
+      if (hi - lo < 2) {
+        continue;
+      }
+      
+      /* Sort the bucket */
+      qsort(&(pSlot[lo]), (size_t) (hi - lo), sizeof(int32_t),
+            &cmpSlot);
+      
+      /* Go through the bucket, with cur as the first event of the
+       * current sequence */
+      cur = pSlot[lo];
+      for(j = lo + 1; j < hi; j++) {
+        i = pSlot[j];
+        
+        if (m_ev_t[i] == m_ev_t[cur]) {
+          /* Same time offset as current sequence, so delete */
+          m_ev_dur[i] = 0;
+          
+        } else {
+          /* Next sequence begins, so shorten current sequence event if
+           * necessary to prevent overlap */
+          if (overlaps(m_ev_t[cur], m_ev_dur[cur], m_ev_t[i])) {
+            m_ev_dur[cur] = m_ev_t[i] - m_ev_t[cur];
+          }
+          cur = i;
+        }
+      }
+    }
+    
+    /* Release the arrays */
+    free(pStart);
+    free(pSlot);
+    pStart = NULL;
+    pSlot = NULL;
+    
+    /* Remove deleted events */
+    compactEvents();
+  }
+}
+
+/*
+ * Comparison function between two CHORD_SLOT records.
+ * 
+ * Records are ordered by key and then by event index.
+ * 
+ * Parameters:
+ * 
+ *   pA - pointer to the first CHORD_SLOT
+ * 
+ *   pB - pointer to the second CHORD_SLOT
+ * 
+ * Return:
+ * 
+ *   less than, equal to, or greater than zero as the first record is
+ *   less than, equal to, or greater than the second
+ */
+static int cmpChordSlot(const void *pA, const void *pB) {
+  
+  const CHORD_SLOT *ps1 = NULL;
+  const CHORD_SLOT *ps2 = NULL;
+  int result = 0;
+  
+  if ((pA == NULL) || (pB == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  ps1 = (const CHORD_SLOT *) pA;
+  ps2 = (const CHORD_SLOT *) pB;
+  
+  if (ps1->key < ps2->key) {
+    result = -1;
+  } else if (ps1->key > ps2->key) {
+    result = 1;
+  } else if (ps1->i < ps2->i) {
+    result = -1;
+  } else if (ps1->i > ps2->i) {
+    result = 1;
+  }
+  
+  return result;
+}
+
+/*
+ * Release the chords found by collapse(), if any.
+ */
+static void releaseChords(void) {
+  free(m_chord);
+  free(m_ev_chord);
+  m_chord = NULL;
+  m_ev_chord = NULL;
+  m_chord_len = 0;
+}
+
+/*
+ * Find the chords in the event store whose aftertouch can be collapsed
+ * into channel pressure.
+ * 
+ * This function operates on the event store after the keyboard process.
+ * The events are ordered by MIDI channel and then by time offset, and
+ * each maximal run of events on a channel whose notes overlap in time
+ * is considered in turn.  A run of at least two events becomes a chord
+ * if all of its events have aftertouch enabled with the same rate limit
+ * and the same graph.  Otherwise, its events keep their polyphonic
+ * aftertouch, since channel pressure would also reach the notes that
+ * do not share the graph.
+ * 
+ * Each chord has at least two events, so there are never more than
+ * half as many chords as events, and the chord table is allocated at
+ * that size up front.
+ */
+static void collapse(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t lo = 0;
+  int64_t end = 0;
+  int64_t te = 0;
+  int same = 0;
+  CHORD *pk = NULL;
+  CHORD_SLOT *pSlot = NULL;
+  IR_EVENT e;
+  IR_EVENT f;
+  
+  /* Initialize structures */
+  memset(&e, 0, sizeof(IR_EVENT));
+  memset(&f, 0, sizeof(IR_EVENT));
+  
+  /* Only proceed if at least two events */
+  releaseChords();
+  if (m_ev_len < 2) {
+    return;
+  }
+  
+  /* Allocate the tables */
+  pSlot = (CHORD_SLOT *) calloc((size_t) m_ev_len, sizeof(CHORD_SLOT));
+  m_ev_chord = (uint8_t *) calloc((size_t) m_ev_len, sizeof(uint8_t));
+  m_chord = (CHORD *) calloc((size_t) ((m_ev_len / 2) + 1), sizeof(CHORD));
+  if ((pSlot == NULL) || (m_ev_chord == NULL) || (m_chord == NULL)) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  /* Order the events by channel and time offset */
+  for(i = 0; i < m_ev_len; i++) {
+    loadEvent(i, &e);
+    (pSlot[i]).key = (((uint64_t) e.ch) << 32)
+                      | ((uint64_t) (((uint32_t) e.t)
+                          ^ UINT32_C(0x80000000)));
+    (pSlot[i]).i = i;
+  }
+  qsort(pSlot, (size_t) m_ev_len, sizeof(CHORD_SLOT), &cmpChordSlot);
+  
+  /* Go through each run of overlapping events on a channel */
+  for(lo = 0; lo < m_ev_len; lo = j) {
+    loadEvent((pSlot[lo]).i, &e);
+    end = ((int64_t) e.t) + ((int64_t) e.dur);
+    same = (e.after != 0);
+    
+    for(j = lo + 1; j < m_ev_len; j++) {
+      loadEvent((pSlot[j]).i, &f);
+      if ((f.ch != e.ch) || (((int64_t) f.t) >= end)) {
+        break;
+      }
+      
+      te = ((int64_t) f.t) + ((int64_t) f.dur);
+      if (te > end) {
+        end = te;
+      }
+      if ((f.after != e.after) || (f.gi != e.gi)) {
+        same = 0;
+      }
+    }
+    
+    /* Record the run as a chord if it qualifies */
+    if (same && (j - lo >= 2) && (end <= INT32_MAX)) {
+      pk = &(m_chord[m_chord_len]);
+      pk->t     = e.t;
+      pk->t_end = (int32_t) end;
+      pk->ch    = e.ch;
+      pk->after = e.after;
+      pk->gi    = e.gi;
+      m_chord_len++;
+      
+      for(i = lo; i < j; i++) {
+        m_ev_chord[(pSlot[i]).i] = 1;
+      }
+    }
+  }
+  
+  free(pSlot);
+  pSlot = NULL;
+}
+
+/*
+ * Render the channel pressure messages of the chords found by
+ * collapse().
+ * 
+ * Each chord tracks its graph with the same algorithm and rate limit
+ * as the polyphonic aftertouch of a single note, from the subquantum
+ * after the first note-on up to and including the subquantum before
+ * the last note-off, starting from the velocity at the first note-on.
+ * If any channel pressure was sent, the pressure is returned to zero
+ * at the last note-off, so that later notes on the channel are not
+ * affected by it.
+ */
+static void renderChords(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t v = 0;
+  int32_t t_after = 0;
+  int sent = 0;
+  const CHORD *pk = NULL;
+  const AFTER_LIMIT *pl = NULL;
+  GRAPH_CURSOR *pc = NULL;
+  GRAPH_SPAN span;
+  
+  /* Initialize structures */
+  memset(&span, 0, sizeof(GRAPH_SPAN));
+  
+  for(i = 0; i < m_chord_len; i++) {
+    pk = &(m_chord[i]);
+    pc = eventCursor((int32_t) pk->gi);
+    pl = &(m_alim[pk->after - 1]);
+    
+    v = graph_cursor_query(pc, pointer_pack(pk->t, 1));
+    sent = 0;
+    
+    if (pk->t_end - pk->t >= 2) {
+      graph_cursor_span(
+        pc,
+        &span,
+        pointer_pack(pk->t + 1, 0),
+        pointer_pack(pk->t_end - 1, 2),
+        v,
+        1,
+        1);
+      
+      for(j = 0; j < span.count;
+          j = graph_span_limit(
+                &span, j + 1, pl->interval, pl->delta, t_after, v)) {
+        v = ((span.pNode)[j]).v;
+        if ((v < 1) || (v > MIDI_DATA_MAX)) {
+          raiseErr(__LINE__, "Aftertouch graph value out of range");
+        }
+        
+        t_after = (j > 0) ? ((span.pNode)[j]).t : span.t_first;
+        emitMsg(
+          t_after,
+          (int) pk->ch,
+          MIDI_MSG_CH_AFTERTOUCH,
+          0,
+          (int) v);
+        sent = 1;
+      }
+    }
+    
+    if (sent) {
+      emitMsg(
+        pointer_pack(pk->t_end, 0),
+        (int) pk->ch,
+        MIDI_MSG_CH_AFTERTOUCH,
+        0,
+        0);
+    }
+  }
+}
+
+/*
+ * Get the span of aftertouch changes for an event.
+ * 
+ * The span covers all subquanta of the event between the first and
+ * last, starting from the given note-on velocity v.  The event must
+ * have aftertouch enabled and a duration of at least two subquanta.
+ * 
+ * Spans are looked up in the aftertouch span cache first, and only
+ * computed with graph_cursor_span() if the cache does not have them.
+ * 
+ * Parameters:
+ * 
+ *   pe - the event
+ * 
+ *   v - the note-on velocity of the event
+ * 
+ *   ps - the span structure to fill
+ */
+static void afterSpan(const IR_EVENT *pe, int32_t v, GRAPH_SPAN *ps) {
+  
+  uint32_t h = 0;
+  AFTER_CACHE *pc = NULL;
+  
+  /* Check parameters */
+  if ((pe == NULL) || (ps == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((!(pe->after)) || (pe->dur < 2)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Hash the event to its cache entry */
+  h = ((uint32_t) pe->t) * UINT32_C(2654435761);
+  h ^= ((uint32_t) pe->dur) * UINT32_C(40503);
+  h ^= (uint32_t) pe->gi;
+  pc = &(m_after[(h >> 16) & (AFTER_CACHE_SIZE - 1)]);
+  
+  /* If the entry does not match, compute the span and store it in the
+   * entry */
+  if ((pc->dur != pe->dur) || (pc->t != pe->t) ||
+      (pc->gi != (int32_t) pe->gi)) {
+    graph_cursor_span(
+      eventCursor((int32_t) pe->gi),
+      &(pc->span),
+      pointer_pack(pe->t           + 1, 0),
+      pointer_pack(pe->t + pe->dur - 1, 2),
+      v,
+      1,
+      1);
+    
+    pc->t   = pe->t;
+    pc->dur = pe->dur;
+    pc->gi  = (int32_t) pe->gi;
+  }
+  
+  /* Return the span */
+  memcpy(ps, &(pc->span), sizeof(GRAPH_SPAN));
+}
+
+/*
+ * Add a MIDI message to the MIDI module with midi_message().
+ * 
+ * The message is always added to the moment buffer.  If the fragment
+ * cache is capturing, the message is also recorded in the newest run
+ * of m_frag_new.
+ * 
+ * Parameters:
+ * 
+ *   t - the moment offset
+ * 
+ *   ch - the one-indexed MIDI channel
+ * 
+ *   msg - the MIDI message type
+ * 
+ *   idx - the index value
+ * 
+ *   val - the parameter value
+ */
+static void emitMsg(int32_t t, int ch, int msg, int idx, int val) {
+  
+  FRAG_MSG *pm = NULL;
+  
+  midi_message(t, 0, ch, msg, idx, val);
+  
+  if (m_frag_capture) {
+    fragCapMsg(&m_frag_new, 1);
+    pm = &((m_frag_new.pMsg)[m_frag_new.msg_len]);
+    pm->t = t;
+    pm->val = (int32_t) val;
+    pm->ch = (uint8_t) ch;
+    pm->msg = (uint8_t) msg;
+    pm->idx = (uint8_t) idx;
+    (m_frag_new.msg_len)++;
+    ((m_frag_new.pRun)[m_frag_new.run_len - 1]).len++;
+  }
+}
+
+/*
+ * Render all the events in the event store into MIDI messages.
+ */
+static void renderEvents(void) {
+  
+  int32_t i = 0;
+  int32_t j = 0;
+  int32_t t = 0;
+  int32_t t_end = 0;
+  int32_t t_after = 0;
+  int32_t v = 0;
+  GRAPH_CURSOR *pc = NULL;
+  const AFTER_LIMIT *pl = NULL;
+  IR_EVENT *pe = NULL;
+  IR_EVENT e;
+  GRAPH_SPAN span;
+  
+  /* Initialize structures */
+  memset(&e, 0, sizeof(IR_EVENT));
+  memset(&span, 0, sizeof(GRAPH_SPAN));
+  pe = &e;
+  
+  /* Render each Infrared event into MIDI messages */
+  for(i = 0; i < m_ev_len; i++) {
+    /* Get event and the cursor for its graph */
+    loadEvent(i, pe);
+    pc = eventCursor((int32_t) pe->gi);
+    
+    /* Get the moment offset of the start of the note, using middle of
+     * moment part */
+    t = pointer_pack(pe->t, 1);
+    
+    /* Get the velocity of the note at this moment and check its
+     * range */
+    v = graph_cursor_query(pc, t);
+    if ((v < 1) || (v > MIDI_DATA_MAX)) {
+      raiseErr(__LINE__, "Note velocity graph out of range");
+    }
+    
+    /* Add the note-on message */
+    emitMsg(
+      t,
+      (int) pe->ch,
+      MIDI_MSG_NOTE_ON,
+      (int) pe->key,
+      (int) v);
+    
+    /* Compute the ending moment offset, using start of moment part */
+    if (pe->t <= INT32_MAX - pe->dur) {
+      t_end = pe->t + pe->dur;
+    } else {
+      raiseErr(__LINE__, "Moment offset overflow");
+    }
+    
+    /* At a coarse MIDI time division, extend notes shorter than one
+     * delta time unit so that the note-off does not round to the same
+     * delta time as the note-on and sort before it */
+    while (midi_ticks(t_end) <= midi_ticks(pe->t)) {
+      if (t_end < INT32_MAX) {
+        t_end++;
+      } else {
+        raiseErr(__LINE__, "Moment offset overflow");
+      }
+    }
+    
+    t_end = pointer_pack(t_end, 0);
+    if (t_end <= t) {
+      raiseErr(__LINE__, NULL);
+    }
+    
+    /* Add the note-off message */
+    if (pe->release < 0) {
+      emitMsg(
+        t_end,
+        (int) pe->ch,
+        MIDI_MSG_NOTE_ON,
+        (int) pe->key,
+        0);
+      
+    } else {
+      emitMsg(
+        t_end,
+        (int) pe->ch,
+        MIDI_MSG_NOTE_OFF,
+        (int) pe->key,
+        (int) pe->release);
+    }
+    
+    /* If aftertouch is enabled AND the duration in subquanta is at
+     * least two, generate necessary aftertouch messages for all
+     * subquanta between the first and last, unless the event belongs
+     * to a chord that uses channel pressure instead */
+    if ((pe->after) && (pe->dur >= 2) &&
+        ((m_ev_chord == NULL) || (!(m_ev_chord[i])))) {
+      /* Get the span of graph changes, and generate an aftertouch
+       * message for each change allowed by the rate limit */
+      afterSpan(pe, v, &span);
+      pl = &(m_alim[pe->after - 1]);
+      for(j = 0; j < span.count;
+          j = graph_span_limit(
+                &span, j + 1, pl->interval, pl->delta, t_after, v)) {
+        v = ((span.pNode)[j]).v;
+        if ((v < 1) || (v > MIDI_DATA_MAX)) {
+          raiseErr(__LINE__, "Aftertouch graph value out of range");
+        }
+        
+        t_after = (j > 0) ? ((span.pNode)[j]).t : span.t_first;
+        emitMsg(
+          t_after,
+          (int) pe->ch,
+          MIDI_MSG_POLY_AFTERTOUCH,
+          (int) pe->key,
+          (int) v);
+      }
+    }
+  }
+  
+  /* Render the channel pressure of any collapsed chords */
+  if (m_chord_len > 0) {
+    renderChords();
   }
-  return m_unique;
 }
 
 /*
- * Import all the notes from a parsed NMF data object into a buffer of
- * Infrared events.
- * 
- * The pipeline should be set up, as it will be used to get performance
- * data for the notes.  The buffer must not be allocated yet or an error
- * occurs.
+ * Render a range of notes from a parsed NMF data object into MIDI
+ * messages.
  * 
- * The result will be held in the m_buf buffer, with length given by
- * m_buf_len.  Structures that have negative event IDs should be assumed
- * deleted.
+ * The range includes all notes with index at least lo and less than hi.
+ * The notes are imported and rendered in windows of at most m_window
+ * notes.  The range must not be empty.
  * 
  * Parameters:
  * 
- *   pd - the NMF data to import
+ *   pd - the NMF data to render
+ * 
+ *   lo - the index of the first note in the range
+ * 
+ *   hi - one greater than the index of the last note in the range
  */
-static void importNotes(NMF_DATA *pd) {
-  
-  int32_t i = 0;
-  IR_EVENT *pe = NULL;
-  NMF_NOTE ns;
-  PIPE_RESULT r;
+static void renderRange(NMF_DATA *pd, int32_t lo, int32_t hi) {
   
-  /* Initialize structures */
-  memset(&ns, 0, sizeof(NMF_NOTE));
-  memset(&r, 0, sizeof(PIPE_RESULT));
+  int32_t wlo = 0;
+  int32_t whi = 0;
   
-  /* Check state and parameters */
-  if (m_buf_len > 0) {
+  if (pd == NULL) {
     raiseErr(__LINE__, NULL);
   }
-  if (pd == NULL) {
+  if ((lo < 0) || (hi <= lo) || (m_window < 1)) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Only proceed if at least one note */
-  if (nmf_notes(pd) > 0) {
+  /* Render each window of notes in turn by importing the notes into
+   * Infrared events, performing the keyboard process to remove invalid
+   * overlap, rendering the events into MIDI messages, and then
+   * releasing the events */
+  for(wlo = lo; wlo < hi; wlo = whi) {
+    if (m_window <= hi - wlo) {
+      whi = wlo + m_window;
+    } else {
+      whi = hi;
+    }
     
-    /* Allocate buffer with same length as the number of notes in the
-     * NMF data */
-    m_buf_len = nmf_notes(pd);
-    m_buf = (IR_EVENT *) calloc((size_t) m_buf_len, sizeof(IR_EVENT));
-    if (m_buf == NULL) {
-      raiseErr(__LINE__, NULL);
+    importNotes(pd, wlo, whi);
+    if (m_keyboard) {
+      keyboard();
+    }
+    if (m_collapse) {
+      collapse();
     }
+    diagnostic_debug("Rendering notes %ld to %ld as %ld events",
+      (long) wlo, (long) (whi - 1), (long) m_ev_len);
     
-    /* Import each NMF note */
-    for(i = 0; i < m_buf_len; i++) {
-      /* Get the NMF note and the Infrared event */
-      nmf_get(pd, i, &ns);
-      pe = &(m_buf[i]);
-      
-      /* If NMF duration is zero, then delete the corresponding Infrared
-       * event by setting a negative event ID and skip reset of
-       * processing; else, assign a unique event ID */
-      if (ns.dur == 0) {
-        pe->eid = -1;
-        continue;
-      }
-      pe->eid = eventID();
-      
-      /* Use the pipeline to classify this note */
-      runPipe(&ns, &r);
-      
-      /* Determine performance offset and duration based on whether note
-       * is measured or unmeasured */
-      if (ns.dur > 0) {
-        /* Measured note, so determine performance offset by multiplying
-         * NMF offset by 8 */
-        if (ns.t < 0) {
-          raiseErr(__LINE__, NULL);
-        }
-        if (ns.t <= INT32_MAX / 8) {
-          pe->t = ns.t * 8;
-        } else {
-          raiseErr(__LINE__, "Subquantum offset overflow");
-        }
-        
-        /* Use the articulation object assigned to this note by the
-         * pipeline to compute the performance duration */
-        pe->dur = art_transform(r.pArt, ns.dur);
-        
-      } else if (ns.dur < 0) {
-        /* Unmeasured grace note, so determine performance offset by
-         * multiplying NMF offset by 8 and then applying the ruler */
-        if (ns.t < 0) {
-          raiseErr(__LINE__, NULL);
-        }
-        if (ns.t <= INT32_MAX / 8) {
-          pe->t = ns.t * 8;
-        } else {
-          raiseErr(__LINE__, "Subquantum offset overflow");
-        }
-        pe->t = ruler_pos(r.pRuler, pe->t, ns.dur);
-        
-        /* Take the performance duration from the ruler */
-        pe->dur = ruler_dur(r.pRuler);
-        
-      } else {
-        raiseErr(__LINE__, NULL);
-      }
-      
-      /* Determine MIDI key number by adding 60 to the NMF pitch, since
-       * MIDI key 60 is middle C, which is NMF pitch zero; if the NMF
-       * pitch is in range, the MIDI key number will be in range too */
-      if ((ns.pitch < NMF_MINPITCH) || (ns.pitch > NMF_MAXPITCH)) {
-        raiseErr(__LINE__, NULL);
-      }
-      pe->key = (uint8_t) (ns.pitch + 60);
-      
-      /* The rest of the note data comes from the pipeline */
-      pe->ch = (uint8_t) r.ch;
-      pe->release = (int8_t) r.release;
-      pe->after = (uint8_t) r.after;
-      pe->pg = r.pGraph;
+    /* Each event has exactly one note-on and one note-off message, so
+     * reserve room for them before rendering */
+    if (m_ev_len <= INT32_MAX / 2) {
+      midi_reserve(m_ev_len * 2);
     }
+    renderEvents();
+    releaseEvents();
   }
 }
 
 /*
- * Comparison function for sorting Infrared events to prepare for the
- * keyboard process.
+ * Make room in capacity for a given number of runs in a fragment table.
  * 
- * The interface of this function matches the callback function of the
- * standard library qsort().  Both elements should be IR_EVENT
- * structures.
+ * Parameters:
  * 
- * The first comparison is to sort all the events that have non-negative
- * event IDs before all the events that have negative event IDs.  This
- * ensures that all the "deleted" structures with negative event IDs are
- * at the back of the array.
+ *   pt - the fragment table
  * 
- * Structures that have negative event IDs always compare as equal to
- * other structures that have negative event IDs, since there is no
- * difference between these "deleted" structures.
+ *   n - the number of runs to make room for
+ */
+static void fragCapRun(FRAG_TABLE *pt, int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  if ((pt == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (n <= FRAG_RUN_MAX_CAP - pt->run_len) {
+    target = pt->run_len + n;
+  } else {
+    raiseErr(__LINE__, "Fragment cache run capacity exceeded");
+  }
+  
+  if (target > pt->run_cap) {
+    new_cap = pt->run_cap;
+    if (new_cap < 1) {
+      new_cap = FRAG_RUN_INIT_CAP;
+    }
+    while (new_cap < target) {
+      new_cap *= 2;
+    }
+    if (new_cap > FRAG_RUN_MAX_CAP) {
+      new_cap = FRAG_RUN_MAX_CAP;
+    }
+    
+    pt->pRun = (FRAG_RUN *) realloc(pt->pRun,
+                              ((size_t) new_cap) * sizeof(FRAG_RUN));
+    if (pt->pRun == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    pt->run_cap = new_cap;
+  }
+}
+
+/*
+ * Make room in capacity for a given number of messages in a fragment
+ * table.
  * 
- * The second comparison is by MIDI channel.
+ * Parameters:
  * 
- * The third comparison is by MIDI key.
+ *   pt - the fragment table
  * 
- * The fourth comparison is by performance time offset.
+ *   n - the number of messages to make room for
+ */
+static void fragCapMsg(FRAG_TABLE *pt, int32_t n) {
+  
+  int32_t target = 0;
+  int32_t new_cap = 0;
+  
+  if ((pt == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (n <= FRAG_MSG_MAX_CAP - pt->msg_len) {
+    target = pt->msg_len + n;
+  } else {
+    raiseErr(__LINE__, "Fragment cache message capacity exceeded");
+  }
+  
+  if (target > pt->msg_cap) {
+    new_cap = pt->msg_cap;
+    if (new_cap < 1) {
+      new_cap = FRAG_MSG_INIT_CAP;
+    }
+    while (new_cap < target) {
+      new_cap *= 2;
+    }
+    if (new_cap > FRAG_MSG_MAX_CAP) {
+      new_cap = FRAG_MSG_MAX_CAP;
+    }
+    
+    pt->pMsg = (FRAG_MSG *) realloc(pt->pMsg,
+                              ((size_t) new_cap) * sizeof(FRAG_MSG));
+    if (pt->pMsg == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    pt->msg_cap = new_cap;
+  }
+}
+
+/*
+ * Release all the memory of a fragment table and reset it to empty.
  * 
- * The fifth comparison is by performance duration in descending order.
+ * Parameters:
  * 
- * The sixth comparison is by event ID in descending order.
+ *   pt - the fragment table
+ */
+static void fragRelease(FRAG_TABLE *pt) {
+  if (pt == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (pt->pRun != NULL) {
+    free(pt->pRun);
+  }
+  if (pt->pMsg != NULL) {
+    free(pt->pMsg);
+  }
+  memset(pt, 0, sizeof(FRAG_TABLE));
+}
+
+/*
+ * Mix a 32-bit value into a 64-bit FNV-1a hash, one byte at a time
+ * from least significant.
  * 
  * Parameters:
  * 
- *   pA - pointer to first element
+ *   h - the current hash
  * 
- *   pB - pointer to second element
+ *   val - the value to mix in
  * 
  * Return:
  * 
- *   less than zero, zero, or greater than zero as the first element is
- *   less than, equal to, or greater than the second element
+ *   the updated hash
  */
-static int cmpEvent(const void *pA, const void *pB) {
+static uint64_t fragHash(uint64_t h, uint32_t val) {
   
-  int result = 0;
-  const IR_EVENT *e1 = NULL;
-  const IR_EVENT *e2 = NULL;
+  int i = 0;
   
-  if ((pA == NULL) || (pB == NULL)) {
+  for(i = 0; i < 4; i++) {
+    h ^= (uint64_t) (val & 0xff);
+    h *= UINT64_C(1099511628211);
+    val >>= 8;
+  }
+  
+  return h;
+}
+
+/*
+ * Compute the fragment cache key of a range of NMF notes.
+ * 
+ * The key is a hash of the context hash given to render_cache() and all
+ * the fields of each note in the range.
+ * 
+ * Parameters:
+ * 
+ *   pd - the NMF data
+ * 
+ *   lo - the index of the first note in the range
+ * 
+ *   hi - one greater than the index of the last note in the range
+ * 
+ * Return:
+ * 
+ *   the key
+ */
+static uint64_t fragKey(NMF_DATA *pd, int32_t lo, int32_t hi) {
+  
+  uint64_t h = UINT64_C(14695981039346656037);
+  int32_t i = 0;
+  NMF_NOTE ns;
+  
+  memset(&ns, 0, sizeof(NMF_NOTE));
+  
+  if ((pd == NULL) || (lo < 0) || (hi < lo)) {
     raiseErr(__LINE__, NULL);
   }
   
-  e1 = (const IR_EVENT *) pA;
-  e2 = (const IR_EVENT *) pB;
+  h = fragHash(h, (uint32_t) (m_frag_ctx & UINT32_C(0xffffffff)));
+  h = fragHash(h, (uint32_t) (m_frag_ctx >> 32));
+  h = fragHash(h, (uint32_t) (hi - lo));
+  
+  for(i = lo; i < hi; i++) {
+    nmf_get(pd, i, &ns);
+    h = fragHash(h, (uint32_t) ns.t);
+    h = fragHash(h, (uint32_t) ns.dur);
+    h = fragHash(h, (uint32_t) ns.pitch);
+    h = fragHash(h, (uint32_t) ns.art);
+    h = fragHash(h, (uint32_t) ns.sect);
+    h = fragHash(h, (uint32_t) ns.layer_i);
+  }
   
-  if ((e1->eid < 0) && (e2->eid >= 0)) {
-    result = 1;
-  } else if ((e1->eid >= 0) && (e2->eid < 0)) {
-    result = -1;
+  return h;
+}
+
+/*
+ * Find a run with the given key in the fragments loaded from the cache
+ * file.
+ * 
+ * Parameters:
+ * 
+ *   key - the key to look for
+ * 
+ * Return:
+ * 
+ *   the index of the run in m_frag_old, or -1 if not found
+ */
+static int32_t fragFind(uint64_t key) {
+  
+  int32_t result = -1;
+  int32_t i = 0;
+  
+  for(i = 0; i < m_frag_old.run_len; i++) {
+    if (((m_frag_old.pRun)[i]).key == key) {
+      result = i;
+      break;
+    }
   }
   
-  if ((result == 0) && (e1->eid >= 0)) {
-    
-    if (e1->ch < e2->ch) {
-      result = -1;
-    } else if (e1->ch > e2->ch) {
-      result = 1;
+  return result;
+}
+
+/*
+ * Write an unsigned integer in big-endian order to a cache file.
+ * 
+ * Write errors are detected with ferror() when the file is closed.
+ * 
+ * Parameters:
+ * 
+ *   pOut - the file
+ * 
+ *   val - the value
+ * 
+ *   bytes - the number of bytes to write, in range 1 to 8 inclusive
+ */
+static void fragPut(FILE *pOut, uint64_t val, int bytes) {
+  
+  if ((pOut == NULL) || (bytes < 1) || (bytes > 8)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for( ; bytes > 0; bytes--) {
+    putc((int) ((val >> ((bytes - 1) * 8)) & 0xff), pOut);
+  }
+}
+
+/*
+ * Read an unsigned integer in big-endian order from a cache file.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the file
+ * 
+ *   pVal - receives the value
+ * 
+ *   bytes - the number of bytes to read, in range 1 to 8 inclusive
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file ended or there was an
+ *   error
+ */
+static int fragGet(FILE *pIn, uint64_t *pVal, int bytes) {
+  
+  int status = 1;
+  int c = 0;
+  
+  if ((pIn == NULL) || (pVal == NULL) || (bytes < 1) || (bytes > 8)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  *pVal = 0;
+  for( ; bytes > 0; bytes--) {
+    c = getc(pIn);
+    if (c == EOF) {
+      status = 0;
+      break;
     }
+    *pVal = (*pVal << 8) | ((uint64_t) c);
+  }
+  
+  return status;
+}
+
+/*
+ * Load the fragment cache file into m_frag_old.
+ * 
+ * If the file does not exist, the cache starts out empty.  If the file
+ * is not a valid cache file, a warning is issued and the cache starts
+ * out empty.
+ * 
+ * The file format begins with FRAG_SIGNATURE followed by the run count.
+ * Each run is its key and message count, followed by its messages.
+ * Each message is its moment offset, value, channel, message type, and
+ * index.  All integers are big-endian.
+ */
+static void fragLoad(void) {
+  
+  FILE *fh = NULL;
+  char sig[FRAG_SIGNATURE_LEN];
+  uint64_t v = 0;
+  int32_t count = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  int ok = 1;
+  FRAG_RUN *pr = NULL;
+  FRAG_MSG *pm = NULL;
+  
+  memset(sig, 0, sizeof(sig));
+  
+  if (m_frag_path == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fh = fopen(m_frag_path, "rb");
+  if (fh == NULL) {
+    return;
+  }
+  
+  /* Check the signature and read the run count */
+  if (fread(sig, 1, FRAG_SIGNATURE_LEN, fh) != FRAG_SIGNATURE_LEN) {
+    ok = 0;
+  } else if (memcmp(sig, FRAG_SIGNATURE, FRAG_SIGNATURE_LEN) != 0) {
+    ok = 0;
+  } else if (!fragGet(fh, &v, 4)) {
+    ok = 0;
+  } else if (v > (uint64_t) FRAG_RUN_MAX_CAP) {
+    ok = 0;
+  } else {
+    count = (int32_t) v;
+  }
+  
+  /* Read each run */
+  for(i = 0; ok && (i < count); i++) {
+    fragCapRun(&m_frag_old, 1);
+    pr = &((m_frag_old.pRun)[m_frag_old.run_len]);
     
-    if (result == 0) {
-      if (e1->key < e2->key) {
-        result = -1;
-      } else if (e1->key > e2->key) {
-        result = 1;
-      }
+    if (!fragGet(fh, &(pr->key), 8)) {
+      ok = 0;
+    } else if (!fragGet(fh, &v, 4)) {
+      ok = 0;
+    } else if (v > (uint64_t) (FRAG_MSG_MAX_CAP - m_frag_old.msg_len)) {
+      ok = 0;
     }
-    
-    if (result == 0) {
-      if (e1->t < e2->t) {
-        result = -1;
-      } else if (e1->t > e2->t) {
-        result = 1;
-      }
+    if (!ok) {
+      break;
     }
     
-    if (result == 0) {
-      if (e1->dur > e2->dur) {
-        result = -1;
-      } else if (e1->dur < e2->dur) {
-        result = 1;
-      }
-    }
+    pr->off = m_frag_old.msg_len;
+    pr->len = (int32_t) v;
+    fragCapMsg(&m_frag_old, pr->len);
     
-    if (result == 0) {
-      if (e1->eid > e2->eid) {
-        result = -1;
-      } else if (e1->eid < e2->eid) {
-        result = 1;
+    for(j = 0; j < pr->len; j++) {
+      pm = &((m_frag_old.pMsg)[pr->off + j]);
+      if (!fragGet(fh, &v, 4)) {
+        ok = 0;
+        break;
+      }
+      pm->t = (int32_t) (uint32_t) v;
+      if (!fragGet(fh, &v, 4)) {
+        ok = 0;
+        break;
       }
+      pm->val = (int32_t) (uint32_t) v;
+      if (!fragGet(fh, &v, 3)) {
+        ok = 0;
+        break;
+      }
+      pm->ch = (uint8_t) (v >> 16);
+      pm->msg = (uint8_t) ((v >> 8) & 0xff);
+      pm->idx = (uint8_t) (v & 0xff);
     }
+    if (!ok) {
+      break;
+    }
+    
+    m_frag_old.msg_len += pr->len;
+    (m_frag_old.run_len)++;
   }
   
-  return result;
+  fclose(fh);
+  fh = NULL;
+  
+  if (!ok) {
+    sayWarn(__LINE__, "Ignoring invalid render cache file: %s",
+      m_frag_path);
+    fragRelease(&m_frag_old);
+  }
 }
 
 /*
- * Check whether one event overlaps with another.
+ * Write the runs in m_frag_new to the fragment cache file, replacing
+ * its previous contents.
  * 
- * t1 is the time offset of the first event.  dur is the duration of the
- * first event, which must be greater than zero.  t2 is the time offset
- * of the second event, which must be greater than t1.
- * 
- * Non-zero is returned only if (t1+dur) > t2.  This function performs
- * the calculation safely in 64-bit space to avoid potential overflow
- * problems.
- * 
- * Parameters:
- * 
- *   t1 - the time offset of the first event
+ * See fragLoad() for the file format.  Failure to write the cache file
+ * only issues a warning.
+ */
+static void fragSave(void) {
+  
+  FILE *fh = NULL;
+  int32_t i = 0;
+  int32_t j = 0;
+  int ok = 1;
+  const FRAG_RUN *pr = NULL;
+  const FRAG_MSG *pm = NULL;
+  
+  if (m_frag_path == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fh = fopen(m_frag_path, "wb");
+  if (fh == NULL) {
+    sayWarn(__LINE__, "Failed to write render cache file: %s",
+      m_frag_path);
+    return;
+  }
+  
+  fwrite(FRAG_SIGNATURE, 1, FRAG_SIGNATURE_LEN, fh);
+  fragPut(fh, (uint64_t) m_frag_new.run_len, 4);
+  
+  for(i = 0; i < m_frag_new.run_len; i++) {
+    pr = &((m_frag_new.pRun)[i]);
+    fragPut(fh, pr->key, 8);
+    fragPut(fh, (uint64_t) pr->len, 4);
+    
+    for(j = 0; j < pr->len; j++) {
+      pm = &((m_frag_new.pMsg)[pr->off + j]);
+      fragPut(fh, (uint64_t) (uint32_t) pm->t, 4);
+      fragPut(fh, (uint64_t) (uint32_t) pm->val, 4);
+      fragPut(fh,
+        (((uint64_t) pm->ch) << 16) |
+        (((uint64_t) pm->msg) << 8) |
+        ((uint64_t) pm->idx), 3);
+    }
+  }
+  
+  if (ferror(fh)) {
+    ok = 0;
+  }
+  if (fclose(fh)) {
+    ok = 0;
+  }
+  fh = NULL;
+  
+  if (!ok) {
+    sayWarn(__LINE__, "Failed to write render cache file: %s",
+      m_frag_path);
+  }
+}
+
+/*
+ * Determine whether the notes of a parsed NMF data object are grouped
+ * by section in ascending section order.
  * 
- *   dur - the duration of the first event
+ * Parameters:
  * 
- *   t2 - the time offset of the second event
+ *   pd - the NMF data
  * 
  * Return:
  * 
- *   non-zero if first event overlaps second, zero otherwise
+ *   non-zero if the notes are grouped by section, zero if not
  */
-static int overlaps(int32_t t1, int32_t dur, int32_t t2) {
+static int fragGrouped(NMF_DATA *pd) {
   
-  int result = 0;
-  int32_t te = 0;
+  int result = 1;
+  int32_t i = 0;
+  int32_t count = 0;
+  int32_t prev = 0;
+  NMF_NOTE ns;
   
-  if (dur < 1) {
-    raiseErr(__LINE__, NULL);
-  }
-  if (t2 <= t1) {
+  memset(&ns, 0, sizeof(NMF_NOTE));
+  
+  if (pd == NULL) {
     raiseErr(__LINE__, NULL);
   }
   
-  if (t1 <= INT32_MAX - dur) {
-    te = t1 + dur;
-    if (te > t2) {
-      result = 1;
-    } else {
+  count = nmf_notes(pd);
+  for(i = 0; i < count; i++) {
+    nmf_get(pd, i, &ns);
+    if ((int32_t) ns.sect < prev) {
       result = 0;
+      break;
     }
-    
-  } else {
-    result = 0;
+    prev = (int32_t) ns.sect;
   }
   
   return result;
 }
 
 /*
- * Perform the "keyboard process."
+ * Render all the notes of a parsed NMF data object with the fragment
+ * cache.
  * 
- * This function operates on the event buffer.  The event buffer should
- * already be filled with importNotes().  If this function is run on an
- * empty event buffer, it does nothing.
- * 
- * The function begins by sorting the event buffer (if it has at least
- * two events) using cmpEvent() as the comparison function.  This will
- * put all "deleted" events at the end of the buffer.  The other events
- * will be sorted first by MIDI channel, then by MIDI key, then by time
- * offset, then by descending duration, and then by descending event ID.
- * 
- * For each sorted sequence of events that share the same channel, key,
- * and time offset, the first event in the sequence is retained and all
- * other events are "deleted" by setting their event ID to a negative
- * value.  This means that when there are multiple events starting on
- * the same channel on the same key at the same time, only the longest
- * event is chosen.  If there are multiple longest events, the latest
- * defined event (as determined by event ID) is chosen.
+ * The notes must be grouped by section, as checked by fragGrouped().
+ * Each section is rendered in note order.  If the key of the section
+ * is in the cache, the recorded messages are added to the MIDI module
+ * directly, which produces the same messages with the same event IDs
+ * as rendering the section.  Otherwise, the section is rendered while
+ * capturing its messages.  All the runs of this rendering are then
+ * written back to the cache file.
  * 
- * The first event in each sequence (including sequences of only one
- * event) is then compared to the first event in the next sequence (if
- * there is a next sequence).  If the next sequence has the same MIDI
- * channel and MIDI key, then the duration of the current sequence event
- * is shortened if necessary such that its release is no later than the
- * onset of the next sequence.
+ * Parameters:
  * 
- * This keyboard process guarantees that within each key of each MIDI
- * channel, there will be no overlapping events.
+ *   pd - the NMF data to render
  */
-static void keyboard(void) {
+static void renderCached(NMF_DATA *pd) {
   
-  int32_t i = 0;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  int32_t count = 0;
+  int32_t r = 0;
   int32_t j = 0;
+  uint64_t key = 0;
+  NMF_NOTE ns;
+  const FRAG_RUN *pr = NULL;
+  const FRAG_MSG *pm = NULL;
   
-  /* Only proceed if at least two events */
-  if (m_buf_len > 1) {
-    
-    /* Sort all the events */
-    qsort(m_buf, (size_t) m_buf_len, sizeof(IR_EVENT), &cmpEvent);
-    
-    /* Iterate through all events */
-    for(i = 0; i < m_buf_len; i++) {
-    
-      /* If this event is "deleted" then all the rest are deleted too so
-       * leave loop */
-      if ((m_buf[i]).eid < 0) {
+  memset(&ns, 0, sizeof(NMF_NOTE));
+  
+  if (pd == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  fragLoad();
+  
+  count = nmf_notes(pd);
+  for(lo = 0; lo < count; lo = hi) {
+    /* Find the range of notes in this section */
+    nmf_get(pd, lo, &ns);
+    r = (int32_t) ns.sect;
+    for(hi = lo + 1; hi < count; hi++) {
+      nmf_get(pd, hi, &ns);
+      if ((int32_t) ns.sect != r) {
         break;
       }
-      
-      /* Iterate through all events after this one */
-      for(j = i + 1; j < m_buf_len; j++) {
-        /* If this event is "deleted" then all the rest are deleted too
-         * so leave inner loop */
-        if ((m_buf[j]).eid < 0) {
-          break;
-        }
-        
-        /* If this event does not have the same MIDI channel and MIDI 
-         * key as the outer loop, then leave loop */
-        if (((m_buf[j]).ch  != (m_buf[i]).ch ) ||
-            ((m_buf[j]).key != (m_buf[i]).key)) {
-          break;
-        }
-        
-        /* If we got here, inner loop has same MIDI channel and MIDI
-         * key; check if time offset is also the same */
-        if ((m_buf[j]).t == (m_buf[i]).t) {
-          /* Same MIDI channel, MIDI key, and time offset, so delete
-           * this inner loop event */
-          (m_buf[j]).eid = -1;
-          
-        } else {
-          /* Same MIDI channel and MIDI key, but different time offset;
-           * shorten outer loop event if necessary to prevent overlap */
-          if (overlaps((m_buf[i]).t, (m_buf[i]).dur, (m_buf[j]).t)) {
-            (m_buf[i]).dur = (m_buf[j]).t - (m_buf[i]).t;
-          }
-          
-          /* Decrement j so this next event will be processed again in
-           * the outer loop; then, leave this inner loop */
-          j--;
-          break;
-        }
+    }
+    
+    /* Start a new run for this section */
+    key = fragKey(pd, lo, hi);
+    fragCapRun(&m_frag_new, 1);
+    ((m_frag_new.pRun)[m_frag_new.run_len]).key = key;
+    ((m_frag_new.pRun)[m_frag_new.run_len]).off = m_frag_new.msg_len;
+    ((m_frag_new.pRun)[m_frag_new.run_len]).len = 0;
+    (m_frag_new.run_len)++;
+    
+    /* Splice in the cached run if there is one, else render while
+     * capturing */
+    r = fragFind(key);
+    if (r >= 0) {
+      diagnostic_debug("Render cache hit for notes %ld to %ld",
+        (long) lo, (long) (hi - 1));
+      pr = &((m_frag_old.pRun)[r]);
+      fragCapMsg(&m_frag_new, pr->len);
+      midi_reserve(pr->len);
+      for(j = 0; j < pr->len; j++) {
+        pm = &((m_frag_old.pMsg)[pr->off + j]);
+        midi_message(
+          pm->t, 0,
+          (int) pm->ch, (int) pm->msg, (int) pm->idx, (int) pm->val);
       }
+      memcpy(
+        &((m_frag_new.pMsg)[m_frag_new.msg_len]),
+        &((m_frag_old.pMsg)[pr->off]),
+        ((size_t) pr->len) * sizeof(FRAG_MSG));
+      m_frag_new.msg_len += pr->len;
+      ((m_frag_new.pRun)[m_frag_new.run_len - 1]).len = pr->len;
       
-      /* Advance i if necessary so it's just before j and next iteration
-       * will be index j */
-      i = j - 1;
+    } else {
+      m_frag_capture = 1;
+      renderRange(pd, lo, hi);
+      m_frag_capture = 0;
     }
   }
-}
-
-/*
- * Aftertouch graph tracking callback.
- * 
- * This function interface matches the graph_fp_callback function
- * pointer interface.
- * 
- * The custom data must be an AFTER_STATE structure.
- * 
- * Parameters:
- * 
- *   pCustom - the AFTER_STATE structure
- * 
- *   t - the moment offset of a change in value
- * 
- *   v - the new value being changed to
- */
-static void afterTrack(void *pCustom, int32_t t, int32_t v) {
-  
-  const AFTER_STATE *ps = NULL;
-  
-  /* Check parameters */
-  if (pCustom == NULL) {
-    raiseErr(__LINE__, NULL);
-  }
-  if ((v < 1) || (v > MIDI_DATA_MAX)) {
-    raiseErr(__LINE__, "Aftertouch graph value out of range");
-  }
-  
-  /* Get state */
-  ps = (const AFTER_STATE *) pCustom;
   
-  /* Record the aftertouch message */
-  midi_message(
-    t,
-    0,
-    ps->ch,
-    MIDI_MSG_POLY_AFTERTOUCH,
-    ps->key,
-    (int) v);
+  fragSave();
+  fragRelease(&m_frag_old);
+  fragRelease(&m_frag_new);
 }
 
 /*
@@ -1022,6 +3433,8 @@ void render_classify_graph(
     SET   * pArt,
     GRAPH * pVal) {
   
+  int32_t i = 0;
+  
   if (m_render) {
     raiseErr(__LINE__, "Render function already invoked");
   }
@@ -1039,6 +3452,14 @@ void render_classify_graph(
   (m_pipe[m_pipe_len]).ctype  = CLASS_GRAPH;
   (m_pipe[m_pipe_len]).v.pg   = pVal;
   
+  for(i = 0; i < m_pipe_len; i++) {
+    if (((m_pipe[i]).ctype == CLASS_GRAPH) &&
+        ((m_pipe[i]).v.pg == pVal)) {
+      break;
+    }
+  }
+  (m_pipe[m_pipe_len]).gi = i + 1;
+  
   m_pipe_len++;
 }
 
@@ -1109,6 +3530,48 @@ void render_classify_release(
   m_pipe_len++;
 }
 
+/*
+ * render_after_limit function.
+ */
+void render_after_limit(int32_t interval, int32_t delta, long lnum) {
+  
+  int32_t i = 0;
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  if ((interval < 0) || (interval > RENDER_LIMIT_MAX)) {
+    raiseErr(__LINE__,
+      "Aftertouch interval out of range on script line %ld",
+      srcLine(lnum));
+  }
+  if (delta < 0) {
+    raiseErr(__LINE__,
+      "Aftertouch delta out of range on script line %ld",
+      srcLine(lnum));
+  }
+  
+  /* Look for an existing rate limit, else add a new one */
+  for(i = 0; i < m_alim_len; i++) {
+    if (((m_alim[i]).interval == interval * 3) &&
+        ((m_alim[i]).delta == delta)) {
+      break;
+    }
+  }
+  if (i >= m_alim_len) {
+    if (m_alim_len >= AFTER_LIMIT_MAX) {
+      raiseErr(__LINE__,
+        "Too many aftertouch rate limits on script line %ld",
+        srcLine(lnum));
+    }
+    (m_alim[m_alim_len]).interval = interval * 3;
+    (m_alim[m_alim_len]).delta = delta;
+    m_alim_len++;
+  }
+  
+  m_alim_cur = i;
+}
+
 /*
  * render_classify_aftertouch function.
  */
@@ -1138,25 +3601,122 @@ void render_classify_aftertouch(
   (m_pipe[m_pipe_len]).pArt   = pArt;
   
   (m_pipe[m_pipe_len]).ctype  = CLASS_AFTERTOUCH;
-  (m_pipe[m_pipe_len]).v.iv   = (int) val;
+  if (val) {
+    (m_pipe[m_pipe_len]).v.iv = (int) (m_alim_cur + 1);
+  } else {
+    (m_pipe[m_pipe_len]).v.iv = 0;
+  }
   
   m_pipe_len++;
 }
 
+/*
+ * render_threads function.
+ */
+void render_threads(int32_t n) {
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  if ((n < 1) || (n > RENDER_THREAD_MAX)) {
+    raiseErr(__LINE__, "Invalid render thread count");
+  }
+  
+  m_threads = (int) n;
+}
+
+/*
+ * render_keyboard function.
+ */
+void render_keyboard(int enable) {
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  
+  if (enable) {
+    m_keyboard = 1;
+  } else {
+    m_keyboard = 0;
+  }
+}
+
+/*
+ * render_after_collapse function.
+ */
+void render_after_collapse(int enable) {
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  
+  if (enable) {
+    m_collapse = 1;
+  } else {
+    m_collapse = 0;
+  }
+}
+
+/*
+ * render_window function.
+ */
+void render_window(int32_t n) {
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  if (n < 0) {
+    raiseErr(__LINE__, "Invalid render window size");
+  }
+  
+  m_window = n;
+}
+
+/*
+ * render_sections function.
+ */
+void render_sections(int32_t lo, int32_t hi) {
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  if ((lo < 0) || (hi < lo)) {
+    raiseErr(__LINE__, "Invalid render section range");
+  }
+  
+  m_sect_set = 1;
+  m_sect_lo = lo;
+  m_sect_hi = hi;
+}
+
+/*
+ * render_cache function.
+ */
+void render_cache(const char *pPath, uint64_t ctx) {
+  
+  if (m_render) {
+    raiseErr(__LINE__, "Render function already invoked");
+  }
+  if (pPath == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  m_frag_path = pPath;
+  m_frag_ctx = ctx;
+}
+
 /*
  * render_nmf function.
  */
 void render_nmf(NMF_DATA *pd) {
   
-  int32_t i = 0;
-  int32_t t = 0;
-  int32_t t_end = 0;
-  int32_t v = 0;
-  const IR_EVENT *pe = NULL;
-  AFTER_STATE as;
+  int32_t count = 0;
+  int32_t lo = 0;
+  int32_t hi = 0;
+  NMF_NOTE ns;
   
   /* Initialize structures */
-  memset(&as, 0, sizeof(AFTER_STATE));
+  memset(&ns, 0, sizeof(NMF_NOTE));
   
   /* Check state and update render flag */
   if (m_render) {
@@ -1169,92 +3729,128 @@ void render_nmf(NMF_DATA *pd) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Import all NMF notes into Infrared events, and then perform the
-   * keyboard process to remove invalid overlap */
-  importNotes(pd);
-  /* keyboard(); */
-
-  /* Render each Infrared event into MIDI messages */
-  for(i = 0; i < m_buf_len; i++) {
-    /* Get event */
-    pe = &(m_buf[i]);
-    
-    /* Skip this event if it is deleted */
-    if (pe->eid < 0) {
-      continue;
-    }
-    
-    /* Get the moment offset of the start of the note, using middle of
-     * moment part */
-    t = pointer_pack(pe->t, 1);
-    
-    /* Get the velocity of the note at this moment and check its
-     * range */
-    v = graph_query(pe->pg, t);
-    if ((v < 1) || (v > MIDI_DATA_MAX)) {
-      raiseErr(__LINE__, "Note velocity graph out of range");
+  /* Determine the window size; the keyboard process and the chord
+   * collapse need to see all the notes at once, so windows are only
+   * used without them */
+  count = nmf_notes(pd);
+  if ((m_window < 1) || m_keyboard || m_collapse) {
+    m_window = count;
+  }
+  
+  /* Compile the pipeline into a lookup table */
+  compilePipe();
+  
+  /* Render the notes, using the fragment cache if it is enabled and
+   * sections can be rendered independently; the keyboard process works
+   * across sections, so it rules out the cache, and so does a section
+   * range, since the cache would then only hold the selected sections;
+   * chords may also span sections, so the chord collapse rules out the
+   * cache as well */
+  if (m_sect_set) {
+    if (m_frag_path != NULL) {
+      sayWarn(__LINE__,
+        "Render cache ignored because a section range is selected");
     }
     
-    /* Add the note-on message */
-    midi_message(
-      t, 0,
-      (int) pe->ch,
-      MIDI_MSG_NOTE_ON,
-      (int) pe->key,
-      (int) v);
-    
-    /* Compute the ending moment offset, using start of moment part */
-    if (pe->t <= INT32_MAX - pe->dur) {
-      t_end = pe->t + pe->dur;
-    } else {
-      raiseErr(__LINE__, "Moment offset overflow");
+    /* If the notes are grouped by section, only the notes of the
+     * selected sections need to be visited; otherwise, importNote()
+     * skips the notes outside the range */
+    lo = 0;
+    hi = count;
+    if (fragGrouped(pd)) {
+      for(lo = 0; lo < count; lo++) {
+        nmf_get(pd, lo, &ns);
+        if ((int32_t) ns.sect >= m_sect_lo) {
+          break;
+        }
+      }
+      for(hi = lo; hi < count; hi++) {
+        nmf_get(pd, hi, &ns);
+        if ((int32_t) ns.sect > m_sect_hi) {
+          break;
+        }
+      }
     }
-    
-    t_end = pointer_pack(t_end, 0);
-    if (t_end <= t) {
-      raiseErr(__LINE__, NULL);
+    if (lo < hi) {
+      renderRange(pd, lo, hi);
     }
     
-    /* Add the note-off message */
-    if (pe->release < 0) {
-      midi_message(
-        t_end, 0,
-        (int) pe->ch,
-        MIDI_MSG_NOTE_ON,
-        (int) pe->key,
-        0);
-      
-    } else {
-      midi_message(
-        t_end, 0,
-        (int) pe->ch,
-        MIDI_MSG_NOTE_OFF,
-        (int) pe->key,
-        (int) pe->release);
+  } else if ((m_frag_path != NULL) && (!m_keyboard) && (!m_collapse) &&
+              fragGrouped(pd)) {
+    renderCached(pd);
+  } else {
+    if ((m_frag_path != NULL) && (!m_keyboard) && (!m_collapse)) {
+      sayWarn(__LINE__,
+        "Render cache ignored because notes are not grouped by section");
     }
-    
-    /* If aftertouch is enabled AND the duration in subquanta is at
-     * least two, generate necessary aftertouch messages for all
-     * subquanta between the first and last */
-    if ((pe->after) && (pe->dur >= 2)) {
-      /* Compute the time range for aftertouch messages */
-      t     = pointer_pack(pe->t           + 1, 0);
-      t_end = pointer_pack(pe->t + pe->dur - 1, 2);
-      
-      /* Initialize callback state */
-      as.ch  = (int) pe->ch;
-      as.key = (int) pe->key;
-      
-      /* Track graph changes to generate aftertouch messages */
-      graph_track(
-        pe->pg,
-        &afterTrack,
-        &as,
-        t,
-        t_end,
-        v,
-        1,
-        1);
+    if (count > 0) {
+      renderRange(pd, 0, count);
     }
   }
+  
+  /* Release the lookup table and the graph cursors */
+  releasePipe();
+  if (m_cursor != NULL) {
+    free(m_cursor);
+    m_cursor = NULL;
+  }
+}
+
+/*
+ * render_stats function.
+ */
+void render_stats(RENDER_STATS *ps) {
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  memset(ps, 0, sizeof(RENDER_STATS));
+  ps->pipe_cap = m_pipe_cap;
+  ps->deleted_count = m_deleted;
+}
+
+/*
+ * render_restart function.
+ */
+void render_restart(void) {
+  
+  releasePipe();
+  releaseEvents();
+  
+  if (m_cursor != NULL) {
+    free(m_cursor);
+    m_cursor = NULL;
+  }
+  
+  if (m_pipe != NULL) {
+    free(m_pipe);
+    m_pipe = NULL;
+  }
+  m_pipe_cap = 0;
+  m_pipe_len = 0;
+  
+  fragRelease(&m_frag_old);
+  fragRelease(&m_frag_new);
+  m_frag_path = NULL;
+  m_frag_ctx = 0;
+  m_frag_capture = 0;
+  
+  memset(m_after, 0, sizeof(m_after));
+  memset(m_alim, 0, sizeof(m_alim));
+  m_alim_len = 1;
+  m_alim_cur = 0;
+  
+  m_def_art = NULL;
+  m_def_ruler = NULL;
+  m_def_graph = NULL;
+  
+  m_render = 0;
+  m_frozen = 0;
+  m_threads = 1;
+  m_keyboard = 0;
+  m_collapse = 0;
+  m_window = 0;
+  m_deleted = 0;
+  m_sect_set = 0;
+  m_sect_lo = 0;
+  m_sect_hi = 0;
 }
@@ -23,6 +23,7 @@
  * Requires the following external libraries:
  * 
  *   - libnmf
+ *   - POSIX threads (may require -lpthread)
  */
 
 #include <stddef.h>
@@ -36,6 +37,45 @@
 
 #include "nmf.h"
 
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The maximum number of threads that may be used for importing notes.
+ */
+#define RENDER_THREAD_MAX (64)
+
+/*
+ * The maximum minimum interval for rate-limited aftertouch, in
+ * subquanta.
+ */
+#define RENDER_LIMIT_MAX (INT32_C(0x2aaaaaaa))
+
+/*
+ * Data type declarations
+ * ======================
+ */
+
+/*
+ * Statistics about rendering.
+ */
+typedef struct {
+  
+  /*
+   * The peak capacity of the classifier pipeline, in classifiers.
+   */
+  int32_t pipe_cap;
+  
+  /*
+   * The number of notes that were deleted during rendering, such as by
+   * the keyboard process.
+   */
+  int32_t deleted_count;
+  
+} RENDER_STATS;
+
 /*
  * Public functions
  * ================
@@ -238,6 +278,9 @@ void render_classify_release(
  * The default aftertouch flag value if no aftertouch classifiers apply
  * is zero.
  * 
+ * Aftertouch enabled by this classifier uses the rate limit most
+ * recently set with render_after_limit() before this call.
+ * 
  * The declared classifier applies only if the section index of the NMF
  * note is in the pSect set, AND the layer of the NMF note is in the
  * pLayer set, AND the articulation of the NMF note is in the pArt set.
@@ -269,6 +312,182 @@ void render_classify_aftertouch(
     int32_t   val,
     long      lnum);
 
+/*
+ * Set the rate limit for polyphonic aftertouch.
+ * 
+ * The limit applies to all aftertouch classifiers that are subsequently
+ * added with render_classify_aftertouch() to enable aftertouch, until
+ * the limit is changed again.  The default is no limit.
+ * 
+ * interval is the minimum time between aftertouch messages of a note,
+ * in subquanta.  It must be in range zero to RENDER_LIMIT_MAX
+ * inclusive.  delta is the minimum change in graph value between
+ * aftertouch messages of a note, and must be zero or greater.  If both
+ * are zero, there is no limit.  Changes that do not satisfy both limits
+ * are dropped, except that the value a graph settles at is always sent.
+ * See graph_span_limit() for the details.
+ * 
+ * At most 254 different rate limits may be used in addition to the
+ * unlimited rate limit.
+ * 
+ * The given lnum should be from the Shastina parser, and it is used for
+ * error reports if necessary.
+ * 
+ * Parameters:
+ * 
+ *   interval - the minimum interval in subquanta
+ * 
+ *   delta - the minimum change in value
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+void render_after_limit(int32_t interval, int32_t delta, long lnum);
+
+/*
+ * Set the number of threads used to import NMF notes during rendering.
+ * 
+ * n must be in range 1 to RENDER_THREAD_MAX inclusive.  The default is
+ * one, which imports all notes on the calling thread.  Greater values
+ * split the notes into contiguous ranges that are imported in parallel
+ * by worker threads.  The generated MIDI output is the same regardless
+ * of the number of threads.
+ * 
+ * If an error occurs while importing notes with multiple threads, the
+ * error reported is the one that a single-threaded import would have
+ * reported.
+ * 
+ * This must be called before render_nmf().
+ * 
+ * Parameters:
+ * 
+ *   n - the number of import threads
+ */
+void render_threads(int32_t n);
+
+/*
+ * Enable or disable the keyboard process during rendering.
+ * 
+ * The keyboard process prevents notes on the same key of the same MIDI
+ * channel from overlapping.  When multiple notes start at the same time
+ * on the same key and channel, only the longest is kept (or the one
+ * defined last if there are multiple longest).  Notes that extend past
+ * the start of the next note on the same key and channel are shortened
+ * to end where the next note starts.
+ * 
+ * The keyboard process is disabled by default.
+ * 
+ * This must be called before render_nmf().
+ * 
+ * Parameters:
+ * 
+ *   enable - non-zero to enable the keyboard process, zero to disable
+ */
+void render_keyboard(int enable);
+
+/*
+ * Enable or disable collapsing the aftertouch of chords into channel
+ * pressure.
+ * 
+ * When enabled, each run of notes on a MIDI channel that overlap in
+ * time is checked before rendering.  If the run has at least two notes,
+ * and all of them have aftertouch enabled with the same rate limit and
+ * the same graph, the notes do not generate polyphonic aftertouch.
+ * Instead, a single stream of channel pressure messages tracks the
+ * graph from the first note-on to the last note-off of the run, and
+ * the pressure is returned to zero at the last note-off if any
+ * pressure was sent.  All other notes keep their polyphonic aftertouch.
+ * 
+ * The channel pressure of collapsed chords is not coordinated with
+ * automatically tracked channel pressure, so the two should not be
+ * used on the same channel.  Enabling the collapse makes rendering use
+ * a single window and no render cache, since chords may span windows
+ * and sections.  The collapse is disabled by default.
+ * 
+ * This must be called before render_nmf().
+ * 
+ * Parameters:
+ * 
+ *   enable - non-zero to enable the collapse, zero to disable
+ */
+void render_after_collapse(int enable);
+
+/*
+ * Set the maximum number of NMF notes rendered in each window.
+ * 
+ * Rendering imports the NMF notes into events, renders the events into
+ * MIDI messages, and then releases the events.  With a window size of
+ * n, this is done for each run of n consecutive notes in turn, so that
+ * only n events need to be held in memory at any one time.  A value of
+ * zero, which is the default, renders all the notes in a single window.
+ * The generated MIDI output is the same regardless of the window size.
+ * 
+ * The window size is ignored when the keyboard process or the chord
+ * collapse of render_after_collapse() is enabled, since they must see
+ * all the notes at once.
+ * 
+ * This must be called before render_nmf().
+ * 
+ * Parameters:
+ * 
+ *   n - the window size in notes, or zero for a single window
+ */
+void render_window(int32_t n);
+
+/*
+ * Render only the notes in a range of NMF sections.
+ * 
+ * lo and hi are the first and last section indices of the range,
+ * inclusive.  lo must be zero or greater and hi must be greater than or
+ * equal to lo.  Notes in other sections are skipped during import and
+ * are not counted as deleted notes.  When the notes are grouped by
+ * section, the notes outside the range are not visited at all.
+ * 
+ * The fragment cache is not used when a section range is set.
+ * 
+ * This must be called before render_nmf().
+ * 
+ * Parameters:
+ * 
+ *   lo - the first section to render
+ * 
+ *   hi - the last section to render
+ */
+void render_sections(int32_t lo, int32_t hi);
+
+/*
+ * Enable the fragment cache during rendering.
+ * 
+ * pPath is the path to the cache file.  If the file exists, it is
+ * loaded at the start of render_nmf().  When render_nmf() is done, the
+ * file is replaced with the MIDI messages of the current rendering.  A
+ * missing or invalid cache file is treated as an empty cache.  Failing
+ * to write the cache file only issues a warning.
+ * 
+ * The cache holds the MIDI messages rendered for each NMF section.  Each
+ * section is identified by a hash of ctx and all the notes in it.  The
+ * ctx value must therefore identify everything else that affects
+ * rendering, such as the classifier pipeline and the NMF section table
+ * that the script pointers were resolved against.  Sections that are
+ * found in the cache are copied from it rather than rendered.  The
+ * generated MIDI output is the same as without a cache.
+ * 
+ * The cache is only used when the notes are grouped by section in
+ * ascending section order and the keyboard process is disabled, since
+ * otherwise sections cannot be rendered independently.  If the notes
+ * are not grouped, a warning is issued and the cache is not used.
+ * 
+ * The string at pPath must remain valid until render_nmf() returns.
+ * 
+ * This must be called before render_nmf().
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the cache file
+ * 
+ *   ctx - the hash of the rendering context
+ */
+void render_cache(const char *pPath, uint64_t ctx);
+
 /*
  * Render all the notes in the given parsed NMF data to the Infrared
  * MIDI module.
@@ -285,4 +504,27 @@ void render_classify_aftertouch(
  */
 void render_nmf(NMF_DATA *pd);
 
+/*
+ * Get statistics about rendering.
+ * 
+ * This may be called at any time.  After render_nmf() has returned, the
+ * statistics are final.
+ * 
+ * Parameters:
+ * 
+ *   ps - receives the statistics
+ */
+void render_stats(RENDER_STATS *ps);
+
+/*
+ * Restart the rendering module, releasing the classifier pipeline and
+ * all rendering buffers and returning every setting to its default, so
+ * that render_nmf() may be called again.
+ * 
+ * The default articulation, ruler, and graph objects that the pipeline
+ * used are forgotten, so the modules that own them should be restarted
+ * as well.  This also works after render_nmf() stopped with an error.
+ */
+void render_restart(void);
+
 #endif
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -45,14 +46,6 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
  */
 struct RULER_TAG {
   
-  /*
-   * The next ruler in the allocated ruler chain, or NULL if this is the
-   * last ruler in the chain.
-   * 
-   * The ruler chain allows the shutdown function to free all rulers.
-   */
-  RULER *pNext;
-  
   /*
    * The slot duration in subquanta.
    * 
@@ -107,11 +100,10 @@ static long srcLine(long lnum) {
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last rulers in the ruler chain, or NULL for
- * both if no rulers allocated.
+ * The arena that all rulers are allocated from, which releases them all
+ * at once when the module shuts down.
  */
-static RULER *m_pFirst = NULL;
-static RULER *m_pLast = NULL;
+static ARENA m_arena;
 
 /*
  * Public function implementations
@@ -149,24 +141,11 @@ RULER *ruler_new(int32_t slot, int32_t gap, long lnum) {
       srcLine(lnum));
   }
   
-  pr = (RULER *) calloc(1, sizeof(RULER));
-  if (pr == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
+  pr = (RULER *) arena_alloc(&m_arena, sizeof(RULER));
   
   pr->slot = slot;
   pr->gap  = gap;
   
-  if (m_pLast == NULL) {
-    m_pFirst = pr;
-    m_pLast = pr;
-    pr->pNext = NULL;
-  } else {
-    m_pLast->pNext = pr;
-    pr->pNext = NULL;
-    m_pLast = pr;
-  }
-  
   return pr;
 }
 
@@ -174,22 +153,20 @@ RULER *ruler_new(int32_t slot, int32_t gap, long lnum) {
  * ruler_shutdown function.
  */
 void ruler_shutdown(void) {
-  RULER *pCur = NULL;
-  RULER *pNext = NULL;
-  
   if (!m_shutdown) {
     m_shutdown = 1;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
-    }
-    m_pFirst = NULL;
-    m_pLast = NULL;
+    arena_free(&m_arena);
   }
 }
 
+/*
+ * ruler_restart function.
+ */
+void ruler_restart(void) {
+  ruler_shutdown();
+  m_shutdown = 0;
+}
+
 /*
  * ruler_pos function.
  */
@@ -205,7 +182,6 @@ int32_t ruler_pos(RULER *pr, int32_t beat, int32_t i) {
     raiseErr(__LINE__, NULL);
   }
   
-  
   if (i >= INT32_MIN / pr->slot) {
     i *= pr->slot;
   } else {
@@ -221,6 +197,75 @@ int32_t ruler_pos(RULER *pr, int32_t beat, int32_t i) {
   return i;
 }
 
+/*
+ * ruler_pos_batch function.
+ */
+int32_t ruler_pos_batch(
+          RULER   * pr,
+    const int32_t * pBeat,
+    const int32_t * pIndex,
+          int32_t * pResult,
+          int32_t   n) {
+  
+  int32_t k = 0;
+  int32_t i = 0;
+  int32_t slot = 0;
+  int32_t lim = 0;
+  int32_t fault = -1;
+  int bad = 0;
+  
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Ruler module is shut down");
+  }
+  if ((pr == NULL) || (n < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((n > 0) &&
+      ((pBeat == NULL) || (pIndex == NULL) || (pResult == NULL))) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  slot = pr->slot;
+  lim = INT32_MIN / slot;
+  
+  /* Flag inputs that ruler_pos() would reject, without branching on
+   * the data so that the loop can be vectorized; indices are clamped so
+   * that the check itself does not overflow */
+  for(k = 0; k < n; k++) {
+    i = pIndex[k];
+    bad |= (i >= 0) | (i < lim);
+    i = (i >= 0) ? -1 : i;
+    i = (i < lim) ? lim : i;
+    bad |= (pBeat[k] < INT32_MIN - (i * slot));
+  }
+  
+  /* If anything was flagged, find the first input that ruler_pos()
+   * would reject */
+  if (bad) {
+    for(k = 0; k < n; k++) {
+      i = pIndex[k];
+      if ((i >= 0) || (i < lim)) {
+        break;
+      }
+      if (pBeat[k] < INT32_MIN - (i * slot)) {
+        break;
+      }
+    }
+    if (k < n) {
+      fault = k;
+    }
+  }
+  
+  /* Position all the grace notes if none are rejected */
+  if (fault < 0) {
+    for(k = 0; k < n; k++) {
+      pResult[k] = pBeat[k] + (pIndex[k] * slot);
+    }
+  }
+  
+  return fault;
+}
+
 /*
  * ruler_dur function.
  */
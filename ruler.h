@@ -12,6 +12,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  */
 
@@ -70,6 +71,13 @@ RULER *ruler_new(int32_t slot, int32_t gap, long lnum);
  */
 void ruler_shutdown(void);
 
+/*
+ * Restart the ruler system, releasing all rulers that have been
+ * allocated in the same way as ruler_shutdown(), but leaving the ruler
+ * system ready to be used again.  This also works after a shutdown.
+ */
+void ruler_restart(void);
+
 /*
  * Compute the starting performance time offset of an unmeasured grace
  * note.
@@ -99,6 +107,43 @@ void ruler_shutdown(void);
  */
 int32_t ruler_pos(RULER *pr, int32_t beat, int32_t i);
 
+/*
+ * Compute the offsets of an array of unmeasured grace notes in the
+ * same way as ruler_pos().
+ * 
+ * The arrays are processed in streaming passes that the compiler can
+ * vectorize.  Inputs that ruler_pos() would reject do not raise an
+ * error here.  Instead, the index of the first of them is returned and
+ * no results are stored, so that the caller can report the error in
+ * order, for example by passing that input to ruler_pos().
+ * 
+ * pResult may be the same array as pBeat or pIndex.
+ * 
+ * Parameters:
+ * 
+ *   pr - the ruler
+ * 
+ *   pBeat - the subquanta offsets of the main beats
+ * 
+ *   pIndex - the grace note indices
+ * 
+ *   pResult - the array that receives the subquanta offsets of the
+ *   grace notes
+ * 
+ *   n - the number of grace notes, zero or greater
+ * 
+ * Return:
+ * 
+ *   the index of the first input that ruler_pos() would reject, or -1
+ *   if there is none
+ */
+int32_t ruler_pos_batch(
+          RULER   * pr,
+    const int32_t * pBeat,
+    const int32_t * pIndex,
+          int32_t * pResult,
+          int32_t   n);
+
 /*
  * Determine the performance duration in subquanta (1/8 of an NMF
  * quantum) of an unmeasured grace note.
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -52,6 +53,29 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 #define ACC_INIT_CAP (32)
 #define ACC_MAX_CAP (16384)
 
+/*
+ * Sets where every span starts below SET_BITMAP_BITS also store their
+ * membership as a bitmap of SET_BITMAP_WORDS 32-bit words, which is
+ * large enough for the articulation and small layer and section sets
+ * that the renderer checks for every note.
+ */
+#define SET_BITMAP_BITS (128)
+#define SET_BITMAP_WORDS (SET_BITMAP_BITS / 32)
+
+/*
+ * The initial and maximum capacities of the set intern table, which
+ * must be powers of two.
+ */
+#define HCONS_INIT_CAP (256)
+#define HCONS_MAX_CAP  (INT32_C(1) << 24)
+
+/*
+ * Set operation constants, used with accMerge().
+ */
+#define MERGE_UNION     (1)
+#define MERGE_INTERSECT (2)
+#define MERGE_EXCEPT    (3)
+
 /*
  * Type declarations
  * =================
@@ -63,19 +87,30 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 struct SET_TAG {
   
   /*
-   * The next set in the allocated set chain, or NULL if this is the
-   * last set in the chain.
+   * The number of entries in the set table.
    * 
-   * The set chain allows the shutdown function to free all sets.
+   * Must be in range 0 to SET_MAX_TABLE inclusive.
    */
-  SET *pNext;
+  int32_t len;
   
   /*
-   * The number of entries in the set table.
+   * Non-zero if the set also has a bitmap representation, zero if not.
    * 
-   * Must be in range 0 to SET_MAX_TABLE inclusive.
+   * Only sets where every span in the table starts below
+   * SET_BITMAP_BITS have a bitmap.  Bit (v % 32) of word (v / 32) is
+   * set for each integer value v below SET_BITMAP_BITS that is in the
+   * set.  tail is non-zero if all integer values of SET_BITMAP_BITS and
+   * above are in the set, or zero if none of them are.
    */
-  int32_t len;
+  int is_bitmap;
+  int tail;
+  uint32_t bits[SET_BITMAP_WORDS];
+  
+  /*
+   * The hash of the set table as computed by hashSet(), used by the set
+   * intern table.
+   */
+  uint32_t hash;
   
   /*
    * The set table.
@@ -143,11 +178,16 @@ typedef struct {
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last sets in the set chain, or NULL for 
- * both if no sets allocated.
+ * The arena that all sets are allocated from, which releases them all at
+ * once when the module shuts down.
+ */
+static ARENA m_arena;
+
+/*
+ * The number of sets allocated since the module was started or
+ * restarted, for profiling.
  */
-static SET *m_pFirst = NULL;
-static SET *m_pLast = NULL;
+static int32_t m_count = 0;
 
 /*
  * The current state of the accumulator.
@@ -179,6 +219,22 @@ static int32_t m_acc_cap = 0;
 static int32_t m_acc_len = 0;
 static RANGE *m_acc = NULL;
 
+/*
+ * The set intern table.
+ * 
+ * This is an open-addressing hash table with linear probing that
+ * indexes all sets by their set tables, so that identical sets share a
+ * single set object.
+ * 
+ * The fields here are the current capacity as a record count, which is
+ * always a power of two, the number of records actually in use, and a
+ * pointer to the dynamically allocated record array, where empty slots
+ * are NULL.
+ */
+static int32_t m_hcons_cap = 0;
+static int32_t m_hcons_len = 0;
+static SET **m_hcons = NULL;
+
 /*
  * Local functions
  * ===============
@@ -196,6 +252,19 @@ static int32_t encodeEntry(int32_t v, int o);
 static int32_t decodeEntry(int32_t e, int *po);
 static int scanRange(const SET *ps, int32_t *pi, RANGE *pr);
 
+static void bitsFill(uint32_t *pBits, int32_t lo, int32_t hi);
+static void setBitmap(SET *ps);
+static int accBits(uint32_t *pBits, int *pTail);
+static void accLoadBits(const uint32_t *pBits, int tail, long lnum);
+
+static uint32_t hashSet(const SET *ps);
+static void growHcons(void);
+static int32_t hconsSlot(const SET *ps);
+
+static int32_t rangeComplement(
+    const RANGE *pSrc, int32_t len, RANGE *pDst);
+static void accMerge(SET *ps, int op, long lnum);
+
 /*
  * If the given line number is within valid range, return it as-is.  In
  * all other cases, return -1.
@@ -307,12 +376,12 @@ static void accInsert(int32_t i, const RANGE *pr, long lnum) {
   if ((pr->lo < 0) || (pr->hi < pr->lo)) {
     raiseErr(__LINE__, NULL);
   }
-
+  
   /* Reset if necessary */
   if (m_acc_cap < 1) {
     accReset();
   }
-
+  
   /* Check range fits in position */
   if ((i == -1) && (m_acc_len > 0)) {
     if (pr->lo - 2 < (m_acc[m_acc_len - 1]).hi) {
@@ -329,7 +398,7 @@ static void accInsert(int32_t i, const RANGE *pr, long lnum) {
       }
     }
   }
-
+  
   /* Expand capacity if necessary */
   if (m_acc_len >= m_acc_cap) {
     if (m_acc_len >= ACC_MAX_CAP) {
@@ -365,12 +434,12 @@ static void accInsert(int32_t i, const RANGE *pr, long lnum) {
         sizeof(RANGE));
     }
   }
-
+  
   /* Insert new element */
   if (i < 0) {
     i = m_acc_len;
   }
-
+  
   memcpy(
     &(m_acc[i]),
     pr,
@@ -633,6 +702,578 @@ static int scanRange(const SET *ps, int32_t *pi, RANGE *pr) {
   return status;
 }
 
+/*
+ * Set a range of bits in a bitmap.
+ * 
+ * Parameters:
+ * 
+ *   pBits - the bitmap, with SET_BITMAP_WORDS words
+ * 
+ *   lo - the first bit to set
+ * 
+ *   hi - the last bit to set, which must be less than SET_BITMAP_BITS
+ */
+static void bitsFill(uint32_t *pBits, int32_t lo, int32_t hi) {
+  
+  int32_t v = 0;
+  
+  if ((pBits == NULL) || (lo < 0) || (hi >= SET_BITMAP_BITS)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(v = lo; v <= hi; v++) {
+    pBits[v >> 5] |= (UINT32_C(1) << (v & 31));
+  }
+}
+
+/*
+ * Give a new set object a bitmap representation if possible.
+ * 
+ * The set table must already be filled in.  If any span starts at
+ * SET_BITMAP_BITS or above, the set is left without a bitmap.
+ * 
+ * Parameters:
+ * 
+ *   ps - the set object
+ */
+static void setBitmap(SET *ps) {
+  
+  int32_t i = 0;
+  int retval = 0;
+  RANGE r;
+  
+  memset(&r, 0, sizeof(RANGE));
+  
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Spans are sorted, so only the last one needs to be checked */
+  ps->is_bitmap = 1;
+  if (ps->len > 0) {
+    if (decodeEntry((ps->table)[ps->len - 1], NULL) >= SET_BITMAP_BITS) {
+      ps->is_bitmap = 0;
+    }
+  }
+  
+  /* Fill in the bitmap from the ranges */
+  if (ps->is_bitmap) {
+    memset(ps->bits, 0, sizeof(ps->bits));
+    ps->tail = 0;
+    
+    i = 0;
+    for(retval = scanRange(ps, &i, &r);
+        retval;
+        retval = scanRange(ps, &i, &r)) {
+      
+      if (r.hi >= 0) {
+        bitsFill(ps->bits, r.lo, r.hi);
+      } else {
+        bitsFill(ps->bits, r.lo, SET_BITMAP_BITS - 1);
+        ps->tail = 1;
+      }
+    }
+  }
+}
+
+/*
+ * Get the contents of the accumulator as a bitmap, if possible.
+ * 
+ * This is only possible if all the ranges in the accumulator are below
+ * SET_BITMAP_BITS.  The bitmap and tail flag then have the same format
+ * as in the SET structure.  Positive sets never have a tail and
+ * negative sets always have one.
+ * 
+ * Parameters:
+ * 
+ *   pBits - the bitmap to receive the contents, with SET_BITMAP_WORDS
+ *   words
+ * 
+ *   pTail - receives the tail flag
+ * 
+ * Return:
+ * 
+ *   non-zero if the accumulator was converted, zero if it can not be
+ */
+static int accBits(uint32_t *pBits, int *pTail) {
+  
+  int result = 1;
+  int32_t i = 0;
+  
+  if ((pBits == NULL) || (pTail == NULL) || (m_state == 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (m_acc_len > 0) {
+    if ((m_acc[m_acc_len - 1]).hi >= SET_BITMAP_BITS) {
+      result = 0;
+    }
+  }
+  
+  if (result) {
+    memset(pBits, 0, sizeof(uint32_t) * SET_BITMAP_WORDS);
+    for(i = 0; i < m_acc_len; i++) {
+      bitsFill(pBits, (m_acc[i]).lo, (m_acc[i]).hi);
+    }
+    
+    /* Negative sets track the values that are not in the set */
+    if (m_state < 0) {
+      for(i = 0; i < SET_BITMAP_WORDS; i++) {
+        pBits[i] = ~(pBits[i]);
+      }
+      *pTail = 1;
+    } else {
+      *pTail = 0;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Replace the contents of the accumulator with a bitmap.
+ * 
+ * The bitmap and tail flag have the same format as in the SET
+ * structure.  Sets with a tail are loaded as negative sets and others
+ * as positive sets, which is the same polarity that the range-based
+ * set operations would have ended up with.
+ * 
+ * Parameters:
+ * 
+ *   pBits - the bitmap, with SET_BITMAP_WORDS words
+ * 
+ *   tail - the tail flag
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+static void accLoadBits(const uint32_t *pBits, int tail, long lnum) {
+  
+  int32_t v = 0;
+  int b = 0;
+  RANGE r;
+  
+  memset(&r, 0, sizeof(RANGE));
+  
+  if (pBits == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  if (tail) {
+    m_state = -1;
+  } else {
+    m_state = 1;
+  }
+  accReset();
+  
+  /* Add a range for each run of bits that the accumulator tracks,
+   * which are the bits that are clear for negative sets */
+  r.lo = -1;
+  for(v = 0; v <= SET_BITMAP_BITS; v++) {
+    b = 0;
+    if (v < SET_BITMAP_BITS) {
+      b = (int) ((pBits[v >> 5] >> (v & 31)) & 1);
+      if (tail) {
+        b = !b;
+      }
+    }
+    
+    if (b && (r.lo < 0)) {
+      r.lo = v;
+      
+    } else if ((!b) && (r.lo >= 0)) {
+      r.hi = v - 1;
+      accInsert(-1, &r, lnum);
+      r.lo = -1;
+    }
+  }
+}
+
+/*
+ * Compute the intern hash of a set.
+ * 
+ * This is the 32-bit FNV-1a hash of the entries of the set table, each
+ * taken as four bytes in little-endian order.
+ * 
+ * Parameters:
+ * 
+ *   ps - the set object
+ * 
+ * Return:
+ * 
+ *   the hash of the set table
+ */
+static uint32_t hashSet(const SET *ps) {
+  
+  uint32_t result = UINT32_C(2166136261);
+  uint32_t w = 0;
+  int32_t i = 0;
+  int k = 0;
+  
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  for(i = 0; i < ps->len; i++) {
+    w = (uint32_t) (ps->table)[i];
+    for(k = 0; k < 4; k++) {
+      result ^= (w & UINT32_C(0xff));
+      result *= UINT32_C(16777619);
+      w >>= 8;
+    }
+  }
+  
+  return result;
+}
+
+/*
+ * Allocate the set intern table or double its capacity.
+ * 
+ * When the capacity is doubled, all the existing records are inserted
+ * into the new table.  The table must not already be at its maximum
+ * capacity.
+ */
+static void growHcons(void) {
+  
+  int32_t old_cap = 0;
+  int32_t new_cap = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  SET **pOld = NULL;
+  
+  /* Determine new capacity */
+  old_cap = m_hcons_cap;
+  if (old_cap < 1) {
+    new_cap = HCONS_INIT_CAP;
+  } else if (old_cap < HCONS_MAX_CAP) {
+    new_cap = old_cap * 2;
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Allocate new table with all slots empty */
+  pOld = m_hcons;
+  m_hcons = (SET **) calloc((size_t) new_cap, sizeof(SET *));
+  if (m_hcons == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  m_hcons_cap = new_cap;
+  
+  /* Reinsert existing records */
+  for(i = 0; i < old_cap; i++) {
+    if (pOld[i] != NULL) {
+      j = (int32_t) ((pOld[i])->hash & ((uint32_t) (new_cap - 1)));
+      while (m_hcons[j] != NULL) {
+        j = (j + 1) & (new_cap - 1);
+      }
+      m_hcons[j] = pOld[i];
+    }
+  }
+  
+  /* Release old table */
+  if (pOld != NULL) {
+    free(pOld);
+    pOld = NULL;
+  }
+}
+
+/*
+ * Find the slot of the set intern table for a set.
+ * 
+ * The hash field of the set must already be computed.  The table is
+ * grown first if it is at least half full.  The result is the slot
+ * holding an identical set if there is one, or else the empty slot
+ * where the set should be added.  If the table is full, -1 is returned
+ * and the set should not be interned.
+ * 
+ * Parameters:
+ * 
+ *   ps - the set object
+ * 
+ * Return:
+ * 
+ *   the slot in the set intern table, or -1
+ */
+static int32_t hconsSlot(const SET *ps) {
+  
+  int32_t result = -1;
+  int32_t i = 0;
+  SET *pc = NULL;
+  
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Make sure the table is less than half full, if possible */
+  if ((m_hcons_len >= m_hcons_cap / 2) &&
+      (m_hcons_cap < HCONS_MAX_CAP)) {
+    growHcons();
+  }
+  
+  /* Only proceed if there is an empty slot in the table */
+  if (m_hcons_len < m_hcons_cap - 1) {
+    
+    /* Probe for an identical set or an empty slot */
+    i = (int32_t) (ps->hash & ((uint32_t) (m_hcons_cap - 1)));
+    while (m_hcons[i] != NULL) {
+      pc = m_hcons[i];
+      if ((pc->hash == ps->hash) && (pc->len == ps->len)) {
+        if ((ps->len < 1) || (memcmp(
+              &((pc->table)[0]),
+              &((ps->table)[0]),
+              ((size_t) ps->len) * sizeof(int32_t)) == 0)) {
+          break;
+        }
+      }
+      i = (i + 1) & (m_hcons_cap - 1);
+    }
+    
+    result = i;
+  }
+  
+  return result;
+}
+
+/*
+ * Compute the complement of a list of ranges.
+ * 
+ * The source ranges must be sorted, and they may not overlap or be
+ * immediately adjacent to each other.  The complement is the list of
+ * ranges covering all the integer values from zero up to INT32_MAX that
+ * are not in any of the source ranges, which has the same properties.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the source ranges
+ * 
+ *   len - the number of source ranges
+ * 
+ *   pDst - the array to receive the complement, which must have room
+ *   for len + 1 ranges
+ * 
+ * Return:
+ * 
+ *   the number of ranges in the complement
+ */
+static int32_t rangeComplement(
+    const RANGE *pSrc, int32_t len, RANGE *pDst) {
+  
+  int32_t count = 0;
+  int32_t i = 0;
+  int64_t pos = 0;
+  
+  if ((pSrc == NULL) || (pDst == NULL) || (len < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pos = 0;
+  for(i = 0; i < len; i++) {
+    if ((pSrc[i]).lo > pos) {
+      (pDst[count]).lo = (int32_t) pos;
+      (pDst[count]).hi = (pSrc[i]).lo - 1;
+      count++;
+    }
+    pos = ((int64_t) (pSrc[i]).hi) + 1;
+  }
+  
+  if (pos <= INT32_MAX) {
+    (pDst[count]).lo = (int32_t) pos;
+    (pDst[count]).hi = INT32_MAX;
+    count++;
+  }
+  
+  return count;
+}
+
+/*
+ * Combine the accumulator with a set object in a single pass.
+ * 
+ * The values in the accumulator and the values in the set are both
+ * turned into sorted lists of ranges.  The two lists are then merged by
+ * walking both of them at once, computing the result of the operation
+ * for each stretch of values between consecutive range boundaries.
+ * 
+ * The accumulator is reloaded with the result.  Its polarity is chosen
+ * to be the same as what including or excluding the ranges of the set
+ * one at a time with set_rclose() and set_ropen() would have ended up
+ * with, so that set_end() generates the same set tables.
+ * 
+ * Parameters:
+ * 
+ *   ps - the set object
+ * 
+ *   op - one of the MERGE constants
+ * 
+ *   lnum - the Shastina line number for diagnostic messages
+ */
+static void accMerge(SET *ps, int op, long lnum) {
+  
+  RANGE *pa = NULL;
+  RANGE *pb = NULL;
+  RANGE *pr = NULL;
+  RANGE *pc = NULL;
+  int32_t la = 0;
+  int32_t lb = 0;
+  int32_t lr = 0;
+  int32_t i = 0;
+  int32_t j = 0;
+  int64_t cur = 0;
+  int64_t na = 0;
+  int64_t nb = 0;
+  int64_t nxt = 0;
+  int ina = 0;
+  int inb = 0;
+  int in = 0;
+  int ps_open = 0;
+  int ps_max = 0;
+  int neg = 0;
+  int retval = 0;
+  RANGE r;
+  
+  memset(&r, 0, sizeof(RANGE));
+  
+  if ((ps == NULL) || (m_state == 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Get the values in the accumulator as ranges */
+  pa = (RANGE *) calloc((size_t) (m_acc_len + 1), sizeof(RANGE));
+  if (pa == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  if (m_state > 0) {
+    if (m_acc_len > 0) {
+      memcpy(pa, m_acc, ((size_t) m_acc_len) * sizeof(RANGE));
+    }
+    la = m_acc_len;
+  } else {
+    la = rangeComplement(m_acc, m_acc_len, pa);
+  }
+  
+  /* Get the values in the set as ranges, with open ranges reaching up
+   * to INT32_MAX */
+  pb = (RANGE *) calloc((size_t) (ps->len + 1), sizeof(RANGE));
+  if (pb == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  i = 0;
+  lb = 0;
+  for(retval = scanRange(ps, &i, &r);
+      retval;
+      retval = scanRange(ps, &i, &r)) {
+    
+    if (r.hi < 0) {
+      r.hi = INT32_MAX;
+      ps_open = 1;
+    }
+    if (r.hi == INT32_MAX) {
+      ps_max = 1;
+    }
+    memcpy(&(pb[lb]), &r, sizeof(RANGE));
+    lb++;
+  }
+  
+  /* Merge the two lists */
+  pr = (RANGE *) calloc((size_t) (la + lb + 1), sizeof(RANGE));
+  if (pr == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  i = 0;
+  j = 0;
+  lr = 0;
+  for(cur = 0; cur <= INT32_MAX; cur = nxt) {
+    
+    /* Determine whether cur is in each list and where that changes */
+    while ((i < la) && ((pa[i]).hi < cur)) {
+      i++;
+    }
+    if ((i < la) && ((pa[i]).lo <= cur)) {
+      ina = 1;
+      na = ((int64_t) (pa[i]).hi) + 1;
+    } else {
+      ina = 0;
+      na = (i < la) ? ((int64_t) (pa[i]).lo) : (((int64_t) INT32_MAX) + 1);
+    }
+    
+    while ((j < lb) && ((pb[j]).hi < cur)) {
+      j++;
+    }
+    if ((j < lb) && ((pb[j]).lo <= cur)) {
+      inb = 1;
+      nb = ((int64_t) (pb[j]).hi) + 1;
+    } else {
+      inb = 0;
+      nb = (j < lb) ? ((int64_t) (pb[j]).lo) : (((int64_t) INT32_MAX) + 1);
+    }
+    
+    nxt = (na < nb) ? na : nb;
+    
+    /* Apply the operation to this stretch of values */
+    if (op == MERGE_UNION) {
+      in = ina || inb;
+    } else if (op == MERGE_INTERSECT) {
+      in = ina && inb;
+    } else if (op == MERGE_EXCEPT) {
+      in = ina && (!inb);
+    } else {
+      raiseErr(__LINE__, NULL);
+    }
+    
+    /* Add the stretch to the result, joining it to the previous range
+     * if they are adjacent */
+    if (in) {
+      if ((lr > 0) && (((int64_t) (pr[lr - 1]).hi) == cur - 1)) {
+        (pr[lr - 1]).hi = (int32_t) (nxt - 1);
+      } else {
+        (pr[lr]).lo = (int32_t) cur;
+        (pr[lr]).hi = (int32_t) (nxt - 1);
+        lr++;
+      }
+    }
+  }
+  
+  /* Determine the polarity of the result */
+  if (op == MERGE_UNION) {
+    neg = (m_state < 0) || ps_open;
+  } else if (op == MERGE_INTERSECT) {
+    neg = (m_state < 0) && ps_max;
+  } else if (op == MERGE_EXCEPT) {
+    neg = (m_state < 0) && (!ps_open);
+  } else {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Reload the accumulator, which tracks the values not in the result
+   * for negative sets */
+  if (neg) {
+    pc = (RANGE *) calloc((size_t) (lr + 1), sizeof(RANGE));
+    if (pc == NULL) {
+      raiseErr(__LINE__, "Out of memory");
+    }
+    lr = rangeComplement(pr, lr, pc);
+    free(pr);
+    pr = pc;
+    pc = NULL;
+    m_state = -1;
+  } else {
+    m_state = 1;
+  }
+  
+  accReset();
+  for(i = 0; i < lr; i++) {
+    accInsert(-1, &(pr[i]), lnum);
+  }
+  
+  /* Release the range lists */
+  free(pa);
+  pa = NULL;
+  free(pb);
+  pb = NULL;
+  free(pr);
+  pr = NULL;
+}
+
 /*
  * Public function implementations
  * ===============================
@@ -868,7 +1509,7 @@ void set_rclose(int32_t lo, int32_t hi, int exc, long lnum) {
       accDelete(i);
       i--;
     }
-
+    
     /* If we left the loop without finding a range entirely above the
      * new range, set i to -1 so we will append the new range to the end
      * of the accumulator array; else, leave i as the first range
@@ -880,7 +1521,7 @@ void set_rclose(int32_t lo, int32_t hi, int exc, long lnum) {
     /* Insert or append the new range */
     r.lo = lo;
     r.hi = hi;
-
+    
     accInsert(i, &r, lnum);
   }
 }
@@ -927,7 +1568,9 @@ void set_ropen(int32_t lo, int exc, long lnum) {
      * existing ranges it touches and deleting those ranges */
     for(i = 0; i < m_acc_len; i++) {
       if ((m_acc[i]).hi > lo - 2) {
-        lo = (m_acc[i]).lo;
+        if ((m_acc[i]).lo < lo) {
+          lo = (m_acc[i]).lo;
+        }
         accDelete(i);
         i--;
       }
@@ -1034,10 +1677,8 @@ void set_ropen(int32_t lo, int exc, long lnum) {
 void set_union(SET *ps, long lnum) {
   
   int32_t i = 0;
-  int retval = 0;
-  RANGE r;
-  
-  memset(&r, 0, sizeof(RANGE));
+  int tail = 0;
+  uint32_t bits[SET_BITMAP_WORDS];
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Set module is shut down");
@@ -1051,16 +1692,15 @@ void set_union(SET *ps, long lnum) {
     raiseErr(__LINE__, NULL);
   }
   
-  i = 0;
-  for(retval = scanRange(ps, &i, &r);
-      retval;
-      retval = scanRange(ps, &i, &r)) {
-    
-    if (r.hi >= 0) {
-      set_rclose(r.lo, r.hi, 0, lnum);
-    } else {
-      set_ropen(r.lo, 0, lnum);
+  /* Combine bitmaps word by word if possible, else merge the ranges */
+  if (ps->is_bitmap && accBits(bits, &tail)) {
+    for(i = 0; i < SET_BITMAP_WORDS; i++) {
+      bits[i] |= (ps->bits)[i];
     }
+    accLoadBits(bits, tail || ps->tail, lnum);
+    
+  } else {
+    accMerge(ps, MERGE_UNION, lnum);
   }
 }
 
@@ -1069,12 +1709,9 @@ void set_union(SET *ps, long lnum) {
  */
 void set_intersect(SET *ps, long lnum) {
   
-  int32_t pos = 0;
   int32_t i = 0;
-  int retval = 0;
-  RANGE r;
-  
-  memset(&r, 0, sizeof(RANGE));
+  int tail = 0;
+  uint32_t bits[SET_BITMAP_WORDS];
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Set module is shut down");
@@ -1088,29 +1725,15 @@ void set_intersect(SET *ps, long lnum) {
     raiseErr(__LINE__, NULL);
   }
   
-  i = 0;
-  pos = 0;
-  for(retval = scanRange(ps, &i, &r);
-      retval;
-      retval = scanRange(ps, &i, &r)) {
-    
-    if (pos < 0) {
-      raiseErr(__LINE__, NULL);
-    }
-    
-    if (r.lo > pos) {
-      set_rclose(pos, r.lo - 1, 1, lnum);
+  /* Combine bitmaps word by word if possible, else merge the ranges */
+  if (ps->is_bitmap && accBits(bits, &tail)) {
+    for(i = 0; i < SET_BITMAP_WORDS; i++) {
+      bits[i] &= (ps->bits)[i];
     }
+    accLoadBits(bits, tail && ps->tail, lnum);
     
-    if ((r.hi >= 0) && (r.hi < INT32_MAX)) {
-      pos = r.hi + 1;
-    } else {
-      pos = -1;
-    }
-  }
-  
-  if (pos >= 0) {
-    set_ropen(pos, 1, lnum);
+  } else {
+    accMerge(ps, MERGE_INTERSECT, lnum);
   }
 }
 
@@ -1120,10 +1743,8 @@ void set_intersect(SET *ps, long lnum) {
 void set_except(SET *ps, long lnum) {
   
   int32_t i = 0;
-  int retval = 0;
-  RANGE r;
-  
-  memset(&r, 0, sizeof(RANGE));
+  int tail = 0;
+  uint32_t bits[SET_BITMAP_WORDS];
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Set module is shut down");
@@ -1137,16 +1758,15 @@ void set_except(SET *ps, long lnum) {
     raiseErr(__LINE__, NULL);
   }
   
-  i = 0;
-  for(retval = scanRange(ps, &i, &r);
-      retval;
-      retval = scanRange(ps, &i, &r)) {
-    
-    if (r.hi >= 0) {
-      set_rclose(r.lo, r.hi, 1, lnum);
-    } else {
-      set_ropen(r.lo, 1, lnum);
+  /* Combine bitmaps word by word if possible, else merge the ranges */
+  if (ps->is_bitmap && accBits(bits, &tail)) {
+    for(i = 0; i < SET_BITMAP_WORDS; i++) {
+      bits[i] &= ~((ps->bits)[i]);
     }
+    accLoadBits(bits, tail && (!(ps->tail)), lnum);
+    
+  } else {
+    accMerge(ps, MERGE_EXCEPT, lnum);
   }
 }
 
@@ -1156,6 +1776,8 @@ void set_except(SET *ps, long lnum) {
 SET *set_end(long lnum) {
   
   SET *ps = NULL;
+  int is_new = 1;
+  int32_t slot = 0;
   int32_t count = 0;
   int32_t pos = 0;
   int32_t i = 0;
@@ -1190,7 +1812,7 @@ SET *set_end(long lnum) {
                   srcLine(lnum));
       }
     }
-
+    
     /* Allocate the set structure */
     if (count > 0) {
       sz = (((size_t) (count - 1)) * sizeof(int32_t)) + sizeof(SET);
@@ -1198,15 +1820,12 @@ SET *set_end(long lnum) {
       sz = sizeof(SET);
     }
     
-    ps = (SET *) calloc(1, sz);
-    if (ps == NULL) {
-      raiseErr(__LINE__, "Out of memory");
-    }
+    ps = (SET *) arena_alloc(&m_arena, sz);
     
     /* Generate the set table */
     pt = &(ps->table[0]);
     ps->len = count;
-
+    
     for(i = 0; i < m_acc_len; i++) {
       if ((m_acc[i]).lo == (m_acc[i]).hi) {
         /* Single-element range, so encode as closed span */
@@ -1279,10 +1898,7 @@ SET *set_end(long lnum) {
       sz = sizeof(SET);
     }
     
-    ps = (SET *) calloc(1, sz);
-    if (ps == NULL) {
-      raiseErr(__LINE__, "Out of memory");
-    }
+    ps = (SET *) arena_alloc(&m_arena, sz);
     
     /* Generate the set table */
     pt = &(ps->table[0]);
@@ -1335,15 +1951,29 @@ SET *set_end(long lnum) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Add set to set chain */
-  if (m_pLast == NULL) {
-    m_pFirst = ps;
-    m_pLast = ps;
-    ps->pNext = NULL;
-  } else {
-    m_pLast->pNext = ps;
-    ps->pNext = NULL;
-    m_pLast = ps;
+  /* Look for an identical set, and if there is one, return the new
+   * set to the arena and use that instead */
+  ps->hash = hashSet(ps);
+  slot = hconsSlot(ps);
+  if (slot >= 0) {
+    if (m_hcons[slot] != NULL) {
+      arena_unalloc(&m_arena, ps);
+      ps = m_hcons[slot];
+      is_new = 0;
+    }
+  }
+  
+  if (is_new) {
+    /* Add the bitmap representation for small sets */
+    setBitmap(ps);
+    
+    /* Intern the set, if the table has room */
+    if (slot >= 0) {
+      m_hcons[slot] = ps;
+      m_hcons_len++;
+    }
+    
+    m_count++;
   }
   
   /* Reset accumulator state */
@@ -1358,25 +1988,38 @@ SET *set_end(long lnum) {
  * set_shutdown function.
  */
 void set_shutdown(void) {
-  SET *pCur = NULL;
-  SET *pNext = NULL;
-  
   if (!m_shutdown) {
     m_state = 0;
     accReset();
     
     m_shutdown = 1;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
+    arena_free(&m_arena);
+    
+    if (m_hcons != NULL) {
+      free(m_hcons);
+      m_hcons = NULL;
+      m_hcons_cap = 0;
+      m_hcons_len = 0;
     }
-    m_pFirst = NULL;
-    m_pLast = NULL;
   }
 }
 
+/*
+ * set_restart function.
+ */
+void set_restart(void) {
+  set_shutdown();
+  m_shutdown = 0;
+  m_count = 0;
+}
+
+/*
+ * set_count function.
+ */
+int32_t set_count(void) {
+  return m_count;
+}
+
 /*
  * set_has function.
  */
@@ -1400,8 +2043,16 @@ int set_has(SET *ps, int32_t val) {
     raiseErr(__LINE__, NULL);
   }
   
-  /* Only proceed if non-empty set table */
-  if (ps->len > 0) {
+  /* Use the bitmap if there is one; otherwise, only proceed if non-empty
+   * set table */
+  if (ps->is_bitmap) {
+    if (val < SET_BITMAP_BITS) {
+      result = (int) (((ps->bits)[val >> 5] >> (val & 31)) & 1);
+    } else if (ps->tail) {
+      result = 1;
+    }
+    
+  } else if (ps->len > 0) {
     /* Start with entire table as search range */
     lo = 0;
     hi = ps->len - 1;
@@ -1458,6 +2109,59 @@ int set_has(SET *ps, int32_t val) {
   return result;
 }
 
+/*
+ * set_bounds function.
+ */
+int32_t set_bounds(SET *ps, int32_t *pBuf, int32_t buf_len) {
+  
+  int32_t count = 0;
+  int32_t i = 0;
+  int32_t v = 0;
+  int o = 0;
+  
+  /* Check state and parameters */
+  if (m_shutdown) {
+    raiseErr(__LINE__, "Set module is shut down");
+  }
+  if (ps == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (buf_len < 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((buf_len > 0) && (pBuf == NULL)) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  /* Each span starts at a boundary, and closed spans also have a
+   * boundary just after them unless the next span starts there or the
+   * span is at the end of the integer range */
+  for(i = 0; i < ps->len; i++) {
+    v = decodeEntry((ps->table)[i], &o);
+    
+    if (count < buf_len) {
+      pBuf[count] = v;
+    }
+    count++;
+    
+    if ((!o) && (v < INT32_MAX)) {
+      if (i < ps->len - 1) {
+        if (decodeEntry((ps->table)[i + 1], NULL) == v + 1) {
+          continue;
+        }
+      }
+      
+      if (count < buf_len) {
+        pBuf[count] = v + 1;
+      }
+      count++;
+    }
+  }
+  
+  /* Return total count */
+  return count;
+}
+
 /*
  * set_print function.
  */
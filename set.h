@@ -12,6 +12,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  */
 
@@ -234,6 +235,10 @@ void set_except(SET *ps, long lnum);
  * 
  * There must be a set definition in progress or an error occurs.
  * 
+ * Sets are interned, so if an identical set has already been defined,
+ * that existing set object is returned instead of a new one.  Sets with
+ * the same values can therefore be recognized by pointer comparison.
+ * 
  * The given lnum should be from the Shastina parser, and it is used for
  * error reports if necessary.
  * 
@@ -254,11 +259,33 @@ SET *set_end(long lnum);
  */
 void set_shutdown(void);
 
+/*
+ * Restart the set system, releasing all sets that have been
+ * allocated in the same way as set_shutdown(), but leaving the set
+ * system ready to be used again.  This also works after a shutdown.
+ */
+void set_restart(void);
+
+/*
+ * Return the number of sets that have been allocated since the
+ * module was started or restarted.
+ * 
+ * This is intended for profiling.
+ * 
+ * Return:
+ * 
+ *   the number of sets allocated
+ */
+int32_t set_count(void);
+
 /*
  * Check whether a given value is in a set.
  * 
  * val is the value to check, which must be zero or greater.
  * 
+ * Sets whose ranges all start below 128 are checked in constant time
+ * with a bitmap.  Other sets are checked with a binary search.
+ * 
  * Parameters:
  * 
  *   ps - the set
@@ -271,6 +298,40 @@ void set_shutdown(void);
  */
 int set_has(SET *ps, int32_t val);
 
+/*
+ * Get the boundaries of a set.
+ * 
+ * The boundaries are a sequence of values in strictly ascending order
+ * such that membership in the set is constant over each interval that
+ * starts at one boundary value and ends just before the next boundary
+ * value (or continues to the end of the integer range for the last
+ * boundary).  Membership is also constant over the interval that starts
+ * at zero and ends just before the first boundary value.  The sequence
+ * may include boundaries where membership does not actually change.
+ * 
+ * pBuf is the buffer to receive the boundary values and buf_len is the
+ * number of values it can hold.  If the buffer is too small, only the
+ * first buf_len boundaries are written.  pBuf may be NULL if buf_len is
+ * zero, which allows the total number of boundaries to be determined
+ * before allocating a buffer.
+ * 
+ * The return value is always the total number of boundaries in the set,
+ * regardless of how many were actually written to the buffer.
+ * 
+ * Parameters:
+ * 
+ *   ps - the set
+ * 
+ *   pBuf - the buffer to receive boundary values, or NULL
+ * 
+ *   buf_len - the number of values the buffer can hold
+ * 
+ * Return:
+ * 
+ *   the total number of boundaries in the set
+ */
+int32_t set_bounds(SET *ps, int32_t *pBuf, int32_t buf_len);
+
 /*
  * Print a textual representation of a set to the given output file.
  * 
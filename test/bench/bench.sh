@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# bench.sh
+# ========
+#
+# End-to-end benchmark harness for Infrared.
+#
+# Syntax
+# ------
+#
+#   bench.sh [infrared] [bench_gen]
+#
+# The arguments are the paths to the infrared and bench_gen programs,
+# which default to ./infrared and ./bench_gen.
+#
+# Each benchmark case generates a synthetic NMF input and script with
+# bench_gen, then times complete infrared runs and reports the best
+# wall-clock time of the runs along with the throughput in notes per
+# second.  The same cases always generate the same inputs, so numbers
+# from different builds are comparable on the same machine.
+#
+# The following environment variables are supported:
+#
+#   BENCH_REPEAT - the number of timed runs per case (default 3)
+#
+#   BENCH_SCALE - multiplier for the note counts of all cases
+#   (default 1)
+#
+#   BENCH_ARGS - extra program options to pass to infrared, such as
+#   "-threads 4" or "-format 1"
+#
+# Requirements
+# ------------
+#
+# Requires a date command that supports the %N format for nanoseconds,
+# such as GNU date.
+#
+
+INFRARED=${1:-./infrared}
+BENCH_GEN=${2:-./bench_gen}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_SCALE=${BENCH_SCALE:-1}
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+# Each case is:
+#
+#   name notes sections layers grace chord kind count
+#
+CASES="
+plain       100000  16  4   0 1 pipe     1
+chords      100000  16  4   0 6 pipe     1
+grace       100000  16  4  60 2 pipe     1
+pipeline    100000  64  8  20 3 pipe   200
+log_ramp    100000  16  4  20 3 ramp    50
+derived     100000  16  4  20 3 derive  50
+automation  100000  16  4  20 3 auto    64
+"
+
+printf '%-12s %10s %10s %14s\n' "case" "notes" "seconds" "notes/s"
+
+echo "$CASES" | while read -r name notes sections layers grace chord kind count
+do
+  if [ -z "$name" ]; then
+    continue
+  fi
+
+  notes=$((notes * BENCH_SCALE))
+
+  "$BENCH_GEN" nmf "$notes" "$sections" "$layers" "$grace" "$chord" 1 \
+    > "$WORK/in.nmf" || exit 1
+  "$BENCH_GEN" script "$kind" "$count" "$sections" "$layers" 1 \
+    > "$WORK/script.ir" || exit 1
+
+  best=""
+  i=0
+  while [ "$i" -lt "$BENCH_REPEAT" ]; do
+    t0=$(date +%s.%N)
+    "$INFRARED" $BENCH_ARGS "$WORK/script.ir" \
+      < "$WORK/in.nmf" > "$WORK/out.mid" || exit 1
+    t1=$(date +%s.%N)
+    best=$(echo "$t0 $t1 $best" | \
+            awk '{ d = $2 - $1; if (($3 != "") && ($3 < d)) d = $3; \
+                   printf "%.6f", d }')
+    i=$((i + 1))
+  done
+
+  echo "$name $notes $best" | \
+    awk '{ r = ($3 > 0) ? $2 / $3 : 0; \
+           printf "%-12s %10d %10.3f %14.0f\n", $1, $2, $3, r }'
+done
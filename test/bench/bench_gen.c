@@ -0,0 +1,541 @@
+/*
+ * bench_gen.c
+ * ===========
+ * 
+ * Synthetic input generator for the Infrared benchmark suite.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   bench_gen nmf [notes] [sections] [layers] [grace] [chord] [seed]
+ *   bench_gen script [kind] [count] [sections] [layers] [seed]
+ * 
+ * The nmf mode writes a synthetic NMF file to standard output.  notes
+ * is the total number of notes to generate.  sections is the number of
+ * NMF sections, which divide the notes evenly in time.  layers is the
+ * number of layers within each section.  grace is the percentage in
+ * range 0 to 100 of onsets that are preceded by unmeasured grace notes.
+ * chord is the number of notes at each onset, in range 1 to 8.  seed
+ * selects the pseudo-random sequence.
+ * 
+ * The script mode writes a synthetic Infrared script to standard
+ * output.  kind is one of the following:
+ * 
+ *   pipe - count classifiers in each of the rendering pipelines
+ * 
+ *   ramp - count logarithmic ramp graphs used as note velocity graphs
+ *   with aftertouch enabled
+ * 
+ *   derive - a chain of count graphs, each derived from the previous
+ *   one, used as note velocity graphs
+ * 
+ *   auto - count automatic controllers tracking ramp graphs, plus a
+ *   tempo graph
+ * 
+ * sections and layers should match the values given to the nmf mode,
+ * so that the classifier sets select notes that actually exist.  seed
+ * selects the pseudo-random sequence.
+ * 
+ * All numeric arguments are unsigned decimal integers.  The same
+ * arguments always generate the same output, on any platform.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - diagnostic.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libnmf
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diagnostic.h"
+
+#include "nmf.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The quantum spacing between onsets in generated NMF files, which is
+ * an eighth note.
+ */
+#define ONSET_SPACING (48)
+
+/*
+ * The maximum chord size.
+ */
+#define CHORD_MAX (8)
+
+/*
+ * The maximum number of grace notes before an onset.
+ */
+#define GRACE_MAX (3)
+
+/*
+ * The length of generated graphs in quanta, and the number of regions
+ * in each generated graph.
+ */
+#define GRAPH_LEN (96 * 4 * 64)
+#define GRAPH_REGIONS (16)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static uint32_t m_seed = 1;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t parseArg(const char *pStr);
+static int32_t rnd(int32_t n);
+static void genNMF(
+    int32_t notes,
+    int32_t sections,
+    int32_t layers,
+    int32_t grace,
+    int32_t chord);
+static void putSet(int32_t n);
+static void putGraph(int32_t lo, int32_t hi, int log_ramp);
+static void genScript(
+    const char *pKind,
+    int32_t     count,
+    int32_t     sections,
+    int32_t     layers);
+
+/*
+ * Parse a program argument as an unsigned decimal integer.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the argument to parse
+ * 
+ * Return:
+ * 
+ *   the parsed integer value
+ */
+static int32_t parseArg(const char *pStr) {
+  
+  int32_t iv = 0;
+  int c = 0;
+  
+  if (pStr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (*pStr == 0) {
+    raiseErr(__LINE__, "Invalid numeric argument");
+  }
+  
+  for( ; *pStr != 0; pStr++) {
+    c = *pStr;
+    if ((c < '0') || (c > '9')) {
+      raiseErr(__LINE__, "Invalid numeric argument");
+    }
+    c = c - '0';
+    
+    if (iv <= (INT32_MAX - c) / 10) {
+      iv = (iv * 10) + ((int32_t) c);
+    } else {
+      raiseErr(__LINE__, "Numeric argument out of range");
+    }
+  }
+  
+  return iv;
+}
+
+/*
+ * Get a pseudo-random integer.
+ * 
+ * A linear congruential generator is used rather than rand() so that
+ * the generated inputs are the same on every platform.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of possible values, which must be greater than zero
+ * 
+ * Return:
+ * 
+ *   a pseudo-random integer in range 0 to (n - 1) inclusive
+ */
+static int32_t rnd(int32_t n) {
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_seed = (m_seed * UINT32_C(1664525)) + UINT32_C(1013904223);
+  return (int32_t) ((m_seed >> 8) % ((uint32_t) n));
+}
+
+/*
+ * Generate a synthetic NMF file and write it to standard output.
+ * 
+ * Onsets are spaced ONSET_SPACING quanta apart and rotate through the
+ * layers.  Each onset has a chord of notes, and may be preceded by
+ * grace notes.  Sections begin at evenly spaced note counts.
+ * 
+ * Parameters:
+ * 
+ *   notes - the total number of notes
+ * 
+ *   sections - the number of sections
+ * 
+ *   layers - the number of layers
+ * 
+ *   grace - the percentage of onsets with grace notes
+ * 
+ *   chord - the number of notes at each onset
+ */
+static void genNMF(
+    int32_t notes,
+    int32_t sections,
+    int32_t layers,
+    int32_t grace,
+    int32_t chord) {
+  
+  NMF_DATA *pd = NULL;
+  NMF_NOTE n;
+  int32_t count = 0;
+  int32_t onset = 0;
+  int32_t sect = 0;
+  int32_t gc = 0;
+  int32_t base = 0;
+  int32_t i = 0;
+  
+  memset(&n, 0, sizeof(NMF_NOTE));
+  
+  if ((notes < 1) || (sections < 1) || (layers < 1) ||
+      (grace < 0) || (grace > 100) ||
+      (chord < 1) || (chord > CHORD_MAX)) {
+    raiseErr(__LINE__, "NMF generator argument out of range");
+  }
+  
+  pd = nmf_alloc();
+  
+  for(onset = 0; count < notes; onset++) {
+    n.t = onset * ONSET_SPACING;
+    
+    /* Begin a new section when its share of the notes is reached */
+    while ((sect < sections - 1) &&
+            (count >= (int32_t) ((((int64_t) (sect + 1)) * notes) /
+                                  sections))) {
+      sect++;
+      if (!nmf_sect(pd, n.t)) {
+        raiseErr(__LINE__, "Failed to add NMF section");
+      }
+    }
+    
+    n.sect = (uint16_t) sect;
+    n.layer_i = (uint16_t) (onset % layers);
+    n.art = (uint16_t) rnd(8);
+    base = rnd(48) - 36;
+    
+    /* Grace notes before the onset */
+    if (rnd(100) < grace) {
+      gc = 1 + rnd(GRACE_MAX);
+      for(i = 0; (i < gc) && (count < notes); i++) {
+        n.dur = -(i + 1);
+        n.pitch = (int16_t) (base + 2 + i);
+        if (!nmf_append(pd, &n)) {
+          raiseErr(__LINE__, "Failed to add NMF note");
+        }
+        count++;
+      }
+    }
+    
+    /* Chord at the onset */
+    n.dur = ONSET_SPACING * (1 + rnd(4));
+    for(i = 0; (i < chord) && (count < notes); i++) {
+      n.pitch = (int16_t) (base + (i * 4));
+      if (!nmf_append(pd, &n)) {
+        raiseErr(__LINE__, "Failed to add NMF note");
+      }
+      count++;
+    }
+  }
+  
+  if (!nmf_serialize(pd, stdout)) {
+    raiseErr(__LINE__, "Failed to write NMF output");
+  }
+  
+  nmf_free(pd);
+  pd = NULL;
+}
+
+/*
+ * Write a script expression that pushes a random set of integers below
+ * n, which is sometimes the set of all integers.
+ * 
+ * Parameters:
+ * 
+ *   n - one greater than the largest integer that may be included
+ */
+static void putSet(int32_t n) {
+  
+  int32_t lo = 0;
+  
+  printf("begin_set ");
+  if (rnd(4) == 0) {
+    printf("all ");
+  } else {
+    lo = rnd(n);
+    printf("%ld %ld include ", (long) lo, (long) (lo + rnd(n - lo)));
+  }
+  printf("end_set\n");
+}
+
+/*
+ * Write a script expression that pushes a random graph with regions
+ * spread across GRAPH_LEN quanta of the first section.
+ * 
+ * Parameters:
+ * 
+ *   lo - the smallest graph value
+ * 
+ *   hi - the largest graph value
+ * 
+ *   log_ramp - non-zero for logarithmic ramps, zero for linear ramps
+ */
+static void putGraph(int32_t lo, int32_t hi, int log_ramp) {
+  
+  int32_t i = 0;
+  int32_t step = 0;
+  
+  step = GRAPH_LEN / GRAPH_REGIONS;
+  
+  printf("begin_graph\n");
+  for(i = 0; i < GRAPH_REGIONS - 1; i++) {
+    printf("  ptr 0s %ldq %ld %ld %ld %s\n",
+      (long) (i * step),
+      (long) (lo + rnd(hi - lo + 1)),
+      (long) (lo + rnd(hi - lo + 1)),
+      (long) (1 + rnd(8)),
+      log_ramp ? "graph_ramp_log" : "graph_ramp");
+  }
+  printf("  ptr 0s %ldq %ld graph_const\n",
+    (long) (i * step),
+    (long) (lo + rnd(hi - lo + 1)));
+  printf("end_graph\n");
+}
+
+/*
+ * Generate a synthetic Infrared script and write it to standard output.
+ * 
+ * Parameters:
+ * 
+ *   pKind - the kind of script
+ * 
+ *   count - the size parameter of the script
+ * 
+ *   sections - the number of sections in the NMF input
+ * 
+ *   layers - the number of layers in the NMF input
+ */
+static void genScript(
+    const char *pKind,
+    int32_t     count,
+    int32_t     sections,
+    int32_t     layers) {
+  
+  int32_t i = 0;
+  
+  if (pKind == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if ((count < 1) || (sections < 1) || (layers < 1)) {
+    raiseErr(__LINE__, "Script generator argument out of range");
+  }
+  
+  printf("%%infrared;\n");
+  printf("\n");
+  printf("# Generated by bench_gen script %s %ld\n",
+    pKind, (long) count);
+  printf("\n");
+  
+  if (strcmp(pKind, "pipe") == 0) {
+    /* Classifiers in every pipeline */
+    for(i = 0; i < count; i++) {
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf("%ld %ld %ld %ld art note_art\n",
+        (long) (1 + rnd(4)), (long) 4, (long) rnd(16), (long) -rnd(8));
+      
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf("%ld %ld ruler note_ruler\n",
+        (long) (24 + rnd(48)), (long) -rnd(8));
+      
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf("%ld gval note_graph\n", (long) (1 + rnd(127)));
+      
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf("%ld note_channel\n", (long) (1 + rnd(16)));
+      
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf("%ld note_release\n", (long) (rnd(129) - 1));
+      
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf("%s\n",
+        (rnd(2) == 0) ? "aftertouch_enable" : "aftertouch_disable");
+      printf("\n");
+    }
+    
+  } else if (strcmp(pKind, "ramp") == 0) {
+    /* Logarithmic ramp velocity graphs with aftertouch */
+    printf("begin_set all end_set\n");
+    printf("begin_set all end_set\n");
+    printf("begin_set all end_set\n");
+    printf("aftertouch_enable\n");
+    printf("\n");
+    for(i = 0; i < count; i++) {
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      putGraph(8, 127, 1);
+      printf("note_graph\n");
+      printf("\n");
+    }
+    
+  } else if (strcmp(pKind, "derive") == 0) {
+    /* A chain of derived velocity graphs */
+    putGraph(8, 127, 0);
+    printf("@g0\n");
+    printf("\n");
+    for(i = 1; i <= count; i++) {
+      printf("begin_graph\n");
+      printf("  ptr 0s 0q :g%ld ptr 0s %ldq %ld %ld %ld %ld %ld "
+              "graph_derive\n",
+        (long) (i - 1),
+        (long) (rnd(GRAPH_LEN / 4)),
+        (long) (1 + rnd(4)), (long) 4,
+        (long) (rnd(32) - 8), (long) 1, (long) 127);
+      printf("end_graph\n");
+      printf("@g%ld\n", (long) i);
+      putSet(sections);
+      putSet(layers);
+      putSet(62);
+      printf(":g%ld note_graph\n", (long) i);
+      printf("\n");
+    }
+    
+  } else if (strcmp(pKind, "auto") == 0) {
+    /* Automatic controllers on ramp graphs */
+    putGraph(400000, 700000, 0);
+    printf("auto_tempo\n");
+    printf("\n");
+    for(i = 0; i < count; i++) {
+      switch (rnd(4)) {
+        case 0:
+          printf("%ld %ld\n", (long) (1 + rnd(16)), (long) (0x40 + rnd(32)));
+          putGraph(0, 127, 0);
+          printf("auto_7bit\n");
+          break;
+        
+        case 1:
+          printf("%ld %ld\n", (long) (1 + rnd(16)), (long) (1 + rnd(31)));
+          putGraph(0, 16383, 0);
+          printf("auto_14bit\n");
+          break;
+        
+        case 2:
+          printf("%ld\n", (long) (1 + rnd(16)));
+          putGraph(0, 127, 0);
+          printf("auto_pressure\n");
+          break;
+        
+        default:
+          printf("%ld\n", (long) (1 + rnd(16)));
+          putGraph(0, 16383, 0);
+          printf("auto_pitch\n");
+          break;
+      }
+      printf("\n");
+    }
+    
+  } else {
+    raiseErr(__LINE__, "Unrecognized script kind: %s", pKind);
+  }
+  
+  printf("|;\n");
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  diagnostic_startup(argc, argv, "bench_gen");
+  
+  if (argc < 2) {
+    raiseErr(__LINE__, "Expecting program arguments");
+  }
+  
+  if (strcmp(argv[1], "nmf") == 0) {
+    if (argc != 8) {
+      raiseErr(__LINE__, "Wrong number of program arguments");
+    }
+    m_seed = (uint32_t) parseArg(argv[7]);
+    genNMF(
+      parseArg(argv[2]),
+      parseArg(argv[3]),
+      parseArg(argv[4]),
+      parseArg(argv[5]),
+      parseArg(argv[6]));
+      
+  } else if (strcmp(argv[1], "script") == 0) {
+    if (argc != 7) {
+      raiseErr(__LINE__, "Wrong number of program arguments");
+    }
+    m_seed = (uint32_t) parseArg(argv[6]);
+    genScript(
+      argv[2],
+      parseArg(argv[3]),
+      parseArg(argv[4]),
+      parseArg(argv[5]));
+      
+  } else {
+    raiseErr(__LINE__, "Unrecognized mode: %s", argv[1]);
+  }
+  
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,391 @@
+/*
+ * bench_graph.c
+ * =============
+ * 
+ * Microbenchmark for the graph module of Infrared.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   bench_graph
+ * 
+ * Times graph_query(), graph_query_batch(), and graph_track() on
+ * graphs of several table sizes, and writes one line for each case to
+ * standard output.  Each line has the name of the benchmarked function,
+ * the number of nodes in the graph, and the best time in nanoseconds
+ * per operation over BENCH_ROUNDS rounds.  For queries, an operation
+ * is one query at a pseudo-random moment offset.  For tracking, an
+ * operation is one reported change in value.
+ * 
+ * The output format is the one read by bench_micro.sh.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the <math.h> library with -lm
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - arena.c
+ *   - diagnostic.c
+ *   - graph.c
+ *   - pointer.c
+ *   - ruler.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libnmf
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diagnostic.h"
+#include "graph.h"
+#include "pointer.h"
+#include "ruler.h"
+
+#include "nmf.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of timed rounds of each case, of which the best is
+ * reported.
+ */
+#define BENCH_ROUNDS (3)
+
+/*
+ * The number of graph table sizes, and the number of nodes at each
+ * size, the largest being close to the limit on graph tables.
+ */
+#define SIZE_COUNT (3)
+static const int32_t SIZES[SIZE_COUNT] = {16, 1024, 16000};
+
+/*
+ * The time offset between the nodes of generated graphs.
+ */
+#define NODE_SPACING (32)
+
+/*
+ * The number of moment offsets in the query array, and the number of
+ * passes over the array in each round.
+ */
+#define QUERY_COUNT (4096)
+#define QUERY_PASSES (512)
+
+/*
+ * The minimum number of reported changes in each graph_track() round.
+ */
+#define TRACK_CHANGES (1 << 21)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static uint32_t m_seed = 1;
+
+/*
+ * The moment offsets to query and the array receiving batch results.
+ */
+static int32_t m_query[QUERY_COUNT];
+static int32_t m_result[QUERY_COUNT];
+
+/*
+ * Accumulates benchmark results so that the compiler can not discard
+ * the benchmarked calls.
+ */
+static volatile int32_t m_sink = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t rnd(int32_t n);
+static double wallTime(void);
+static GRAPH *buildGraph(POINTER *pp, int32_t nodes);
+static void countChange(void *pCustom, int32_t t, int32_t v);
+static double timeQuery(GRAPH *pg);
+static double timeBatch(GRAPH *pg);
+static double timeTrack(GRAPH *pg, int32_t nodes);
+
+/*
+ * Get a pseudo-random integer.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of possible values, which must be greater than zero
+ * 
+ * Return:
+ * 
+ *   a pseudo-random integer in range 0 to (n - 1) inclusive
+ */
+static int32_t rnd(int32_t n) {
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_seed = (m_seed * UINT32_C(1664525)) + UINT32_C(1013904223);
+  return (int32_t) ((m_seed >> 8) % ((uint32_t) n));
+}
+
+/*
+ * Get the current wall-clock time from the monotonic clock.
+ * 
+ * Return:
+ * 
+ *   the time in nanoseconds from an arbitrary starting point
+ */
+static double wallTime(void) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read monotonic clock");
+  }
+  
+  return (((double) ts.tv_sec) * 1000000000.0) + ((double) ts.tv_nsec);
+}
+
+/*
+ * Build a graph with the given number of constant regions, each with a
+ * different value than the region before it.
+ * 
+ * Parameters:
+ * 
+ *   pp - a pointer to the start of the first section
+ * 
+ *   nodes - the number of regions
+ * 
+ * Return:
+ * 
+ *   the new graph
+ */
+static GRAPH *buildGraph(POINTER *pp, int32_t nodes) {
+  
+  int32_t *pPoint = NULL;
+  GRAPH *pg = NULL;
+  int32_t i = 0;
+  
+  pPoint = (int32_t *) calloc((size_t) (nodes * 2), sizeof(int32_t));
+  if (pPoint == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  for(i = 0; i < nodes; i++) {
+    pPoint[i * 2] = i * NODE_SPACING;
+    pPoint[(i * 2) + 1] = (i * 7) % 128;
+  }
+  
+  graph_begin(__LINE__);
+  graph_add_points(pp, pPoint, nodes, __LINE__);
+  pg = graph_end(__LINE__);
+  
+  free(pPoint);
+  return pg;
+}
+
+/*
+ * Callback for graph_track() that counts the changes.
+ * 
+ * Parameters:
+ * 
+ *   pCustom - pointer to the int32_t change counter
+ * 
+ *   t - the moment offset of the change
+ * 
+ *   v - the new value
+ */
+static void countChange(void *pCustom, int32_t t, int32_t v) {
+  (void) t;
+  (void) v;
+  (*((int32_t *) pCustom))++;
+}
+
+/*
+ * Time one round of graph_query() calls.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ * Return:
+ * 
+ *   the nanoseconds per query
+ */
+static double timeQuery(GRAPH *pg) {
+  
+  double t0 = 0.0;
+  int32_t sum = 0;
+  int32_t p = 0;
+  int32_t i = 0;
+  
+  t0 = wallTime();
+  for(p = 0; p < QUERY_PASSES; p++) {
+    for(i = 0; i < QUERY_COUNT; i++) {
+      sum += graph_query(pg, m_query[i]);
+    }
+  }
+  m_sink += sum;
+  
+  return (wallTime() - t0) / (((double) QUERY_PASSES) * QUERY_COUNT);
+}
+
+/*
+ * Time one round of graph_query_batch() calls.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ * Return:
+ * 
+ *   the nanoseconds per query
+ */
+static double timeBatch(GRAPH *pg) {
+  
+  double t0 = 0.0;
+  int32_t p = 0;
+  
+  t0 = wallTime();
+  for(p = 0; p < QUERY_PASSES; p++) {
+    graph_query_batch(pg, m_query, m_result, QUERY_COUNT);
+    m_sink += m_result[p % QUERY_COUNT];
+  }
+  
+  return (wallTime() - t0) / (((double) QUERY_PASSES) * QUERY_COUNT);
+}
+
+/*
+ * Time one round of graph_track() calls over the whole graph.
+ * 
+ * Parameters:
+ * 
+ *   pg - the graph
+ * 
+ *   nodes - the number of nodes in the graph
+ * 
+ * Return:
+ * 
+ *   the nanoseconds per reported change
+ */
+static double timeTrack(GRAPH *pg, int32_t nodes) {
+  
+  double t0 = 0.0;
+  int32_t changes = 0;
+  int32_t end = 0;
+  
+  end = nodes * NODE_SPACING * 3;
+  
+  t0 = wallTime();
+  while (changes < TRACK_CHANGES) {
+    graph_track(pg, &countChange, &changes, 0, end, 0, 1, 0);
+  }
+  m_sink += changes;
+  
+  return (wallTime() - t0) / ((double) changes);
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  NMF_DATA *pd = NULL;
+  POINTER *pp = NULL;
+  GRAPH *pg = NULL;
+  double best[3];
+  double ns = 0.0;
+  int32_t s = 0;
+  int32_t r = 0;
+  int32_t i = 0;
+  int32_t k = 0;
+  
+  diagnostic_startup(argc, argv, "bench_graph");
+  
+  if (argc > 1) {
+    raiseErr(__LINE__, "Not expecting program arguments");
+  }
+  
+  pd = nmf_alloc();
+  pointer_init(pd);
+  pp = pointer_new();
+  pointer_reset(pp);
+  pointer_jump(pp, 0, __LINE__);
+  
+  for(s = 0; s < SIZE_COUNT; s++) {
+    pg = buildGraph(pp, SIZES[s]);
+    
+    /* Query moments are spread over the graph and a little beyond */
+    for(i = 0; i < QUERY_COUNT; i++) {
+      m_query[i] = rnd(SIZES[s] * NODE_SPACING * 3 + 1024) - 512;
+    }
+    
+    for(k = 0; k < 3; k++) {
+      best[k] = -1.0;
+    }
+    for(r = 0; r < BENCH_ROUNDS; r++) {
+      for(k = 0; k < 3; k++) {
+        if (k == 0) {
+          ns = timeQuery(pg);
+        } else if (k == 1) {
+          ns = timeBatch(pg);
+        } else {
+          ns = timeTrack(pg, SIZES[s]);
+        }
+        if ((best[k] < 0.0) || (ns < best[k])) {
+          best[k] = ns;
+        }
+      }
+    }
+    
+    printf("%-20s %10ld %12.2f\n",
+      "graph_query", (long) SIZES[s], best[0]);
+    printf("%-20s %10ld %12.2f\n",
+      "graph_query_batch", (long) SIZES[s], best[1]);
+    printf("%-20s %10ld %12.2f\n",
+      "graph_track", (long) SIZES[s], best[2]);
+  }
+  
+  nmf_free(pd);
+  pd = NULL;
+  
+  graph_shutdown();
+  pointer_shutdown();
+  ruler_shutdown();
+  
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#!/bin/sh
+#
+# bench_micro.sh
+# ==============
+#
+# Microbenchmark harness for Infrared.
+#
+# Syntax
+# ------
+#
+#   bench_micro.sh [dir] [baseline]
+#
+# dir is the directory holding the compiled bench_graph, bench_midi,
+# bench_render, bench_set, and bench_string programs, which defaults to
+# the current directory.  baseline is the baseline file to compare
+# against, which defaults to baseline.txt next to this script.
+#
+# Each program times the hot primitives of one module in isolation and
+# writes one line per case, with the benchmarked function, the size
+# parameter of the case, and the nanoseconds per operation.  This
+# script runs all of them several times, keeps the best time of each
+# case across the runs, and prints each result next to its baseline
+# value and the ratio between the two.  A case is marked as a
+# regression if it is slower than the baseline by more than the
+# threshold, and the script then exits unsuccessfully, so that it can
+# gate continuous integration.  Cases missing from the baseline are
+# reported but never count as regressions.
+#
+# The baseline file has the same format as the program output.  Lines
+# starting with # are comments.  Baselines are only comparable on the
+# same machine and compiler, so regenerate the baseline with
+# BENCH_UPDATE=1 whenever either changes.
+#
+# The following environment variables are supported:
+#
+#   BENCH_REPEAT - the number of runs of each program (default 3)
+#
+#   BENCH_THRESHOLD - the allowed slowdown in percent before a case is
+#   marked as a regression (default 25)
+#
+#   BENCH_MIDI_MAX - the largest number of messages for bench_midi
+#   (default 1000000)
+#
+#   BENCH_UPDATE - if set to 1, write the results to the baseline file
+#   instead of comparing against it
+#
+
+DIR=${1:-.}
+BASELINE=${2:-$(dirname "$0")/baseline.txt}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_THRESHOLD=${BENCH_THRESHOLD:-25}
+BENCH_MIDI_MAX=${BENCH_MIDI_MAX:-1000000}
+BENCH_UPDATE=${BENCH_UPDATE:-0}
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT INT TERM
+
+: > "$WORK/runs.txt"
+i=0
+while [ "$i" -lt "$BENCH_REPEAT" ]; do
+  "$DIR/bench_graph" >> "$WORK/runs.txt" || exit 1
+  "$DIR/bench_set" >> "$WORK/runs.txt" || exit 1
+  "$DIR/bench_midi" "$BENCH_MIDI_MAX" >> "$WORK/runs.txt" || exit 1
+  "$DIR/bench_render" >> "$WORK/runs.txt" || exit 1
+  "$DIR/bench_string" >> "$WORK/runs.txt" || exit 1
+  i=$((i + 1))
+done
+
+# Keep the best time of each case, in the order of the first run
+awk '
+  {
+    key = $1 " " $2
+    if (!(key in best)) {
+      order[n++] = key
+      best[key] = $3
+    } else if ($3 < best[key]) {
+      best[key] = $3
+    }
+  }
+  END {
+    for (i = 0; i < n; i++) {
+      split(order[i], f, " ")
+      printf "%-20s %10d %12.2f\n", f[1], f[2], best[order[i]]
+    }
+  }
+' "$WORK/runs.txt" > "$WORK/new.txt" || exit 1
+
+if [ "$BENCH_UPDATE" = "1" ]; then
+  {
+    echo "# Infrared microbenchmark baseline"
+    echo "# $(uname -sm), $(date -u +%Y-%m-%d)"
+    cat "$WORK/new.txt"
+  } > "$BASELINE" || exit 1
+  cat "$WORK/new.txt"
+  exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+  cat "$WORK/new.txt"
+  echo "No baseline file: $BASELINE" >&2
+  exit 0
+fi
+
+awk -v limit="$BENCH_THRESHOLD" '
+  FNR == NR {
+    if (($1 !~ /^#/) && (NF == 3)) {
+      base[$1 " " $2] = $3
+    }
+    next
+  }
+  FNR == 1 {
+    printf "%-20s %10s %12s %12s %8s\n", \
+      "case", "size", "ns/op", "baseline", "ratio"
+  }
+  {
+    key = $1 " " $2
+    if ((key in base) && (base[key] > 0)) {
+      r = $3 / base[key]
+      mark = ""
+      if (r > 1 + (limit / 100)) {
+        mark = "  REGRESSED"
+        bad++
+      }
+      printf "%-20s %10d %12.2f %12.2f %8.2f%s\n", \
+        $1, $2, $3, base[key], r, mark
+    } else {
+      printf "%-20s %10d %12.2f %12s %8s\n", $1, $2, $3, "-", "-"
+    }
+  }
+  END {
+    if (bad > 0) {
+      printf "%d cases regressed by more than %d%%\n", bad, limit
+      exit 1
+    }
+  }
+' "$BASELINE" "$WORK/new.txt"
@@ -0,0 +1,328 @@
+/*
+ * bench_midi.c
+ * ============
+ * 
+ * Microbenchmark for the MIDI module of Infrared.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   bench_midi [max]
+ * 
+ * Times midi_message() and midi_compile_mem() for MIDI files with 10^4
+ * messages, then ten times as many, and so on up to a maximum number of
+ * messages, which defaults to 10^6.  The max argument is an unsigned
+ * decimal that changes the maximum, for example to 10000000 for 10^7
+ * messages.
+ * 
+ * Messages are entered at pseudo-random moment offsets, so that
+ * compilation has to sort them.  One line is written to standard output
+ * for each of the two functions at each size.  Each line has the name
+ * of the benchmarked function, the number of messages, and the best
+ * time in nanoseconds per message over BENCH_ROUNDS rounds.  The time
+ * of midi_compile_mem() includes sorting the moment buffer and encoding
+ * the MIDI file.
+ * 
+ * The output format is the one read by bench_micro.sh.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - arena.c
+ *   - blob.c
+ *   - diagnostic.c
+ *   - midi.c
+ *   - pointer.c
+ *   - ruler.c
+ *   - text.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libnmf
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diagnostic.h"
+#include "midi.h"
+#include "pointer.h"
+
+#include "nmf.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of timed rounds of each case, of which the best is
+ * reported.
+ */
+#define BENCH_ROUNDS (3)
+
+/*
+ * The smallest number of messages and the default maximum.
+ */
+#define SIZE_MIN (10000)
+#define SIZE_DEFAULT (1000000)
+
+/*
+ * The average number of messages at each moment offset.
+ */
+#define MSG_DENSITY (4)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static uint32_t m_seed = 1;
+
+/*
+ * Accumulates benchmark results so that the compiler can not discard
+ * the benchmarked calls.
+ */
+static volatile size_t m_sink = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t parseArg(const char *pStr);
+static int32_t rnd(int32_t n);
+static double wallTime(void);
+static void timeFile(
+    const int32_t * pT,
+          int32_t   n,
+          double  * pMsg,
+          double  * pCompile);
+
+/*
+ * Parse a program argument as an unsigned decimal integer.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the argument to parse
+ * 
+ * Return:
+ * 
+ *   the parsed integer value
+ */
+static int32_t parseArg(const char *pStr) {
+  
+  int32_t iv = 0;
+  int c = 0;
+  
+  if (pStr == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (*pStr == 0) {
+    raiseErr(__LINE__, "Invalid numeric argument");
+  }
+  
+  for( ; *pStr != 0; pStr++) {
+    c = *pStr;
+    if ((c < '0') || (c > '9')) {
+      raiseErr(__LINE__, "Invalid numeric argument");
+    }
+    c = c - '0';
+    
+    if (iv <= (INT32_MAX - c) / 10) {
+      iv = (iv * 10) + ((int32_t) c);
+    } else {
+      raiseErr(__LINE__, "Numeric argument out of range");
+    }
+  }
+  
+  return iv;
+}
+
+/*
+ * Get a pseudo-random integer.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of possible values, which must be greater than zero
+ * 
+ * Return:
+ * 
+ *   a pseudo-random integer in range 0 to (n - 1) inclusive
+ */
+static int32_t rnd(int32_t n) {
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_seed = (m_seed * UINT32_C(1664525)) + UINT32_C(1013904223);
+  return (int32_t) ((m_seed >> 8) % ((uint32_t) n));
+}
+
+/*
+ * Get the current wall-clock time from the monotonic clock.
+ * 
+ * Return:
+ * 
+ *   the time in nanoseconds from an arbitrary starting point
+ */
+static double wallTime(void) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read monotonic clock");
+  }
+  
+  return (((double) ts.tv_sec) * 1000000000.0) + ((double) ts.tv_nsec);
+}
+
+/*
+ * Time one round of building and compiling a MIDI file.
+ * 
+ * The MIDI module is restarted first.  The channel, key, and velocity
+ * of each message are derived from its index.
+ * 
+ * Parameters:
+ * 
+ *   pT - the offsets of the messages
+ * 
+ *   n - the number of messages
+ * 
+ *   pMsg - receives the nanoseconds per midi_message() call
+ * 
+ *   pCompile - receives the nanoseconds per message of compiling
+ */
+static void timeFile(
+    const int32_t * pT,
+          int32_t   n,
+          double  * pMsg,
+          double  * pCompile) {
+  
+  uint8_t *pData = NULL;
+  size_t len = 0;
+  double t0 = 0.0;
+  int32_t i = 0;
+  
+  midi_restart();
+  
+  t0 = wallTime();
+  for(i = 0; i < n; i++) {
+    midi_message(pT[i], 0, (int) ((i % 16) + 1), MIDI_MSG_NOTE_ON,
+      (int) ((i * 7) % 128), (int) (i % 128));
+  }
+  *pMsg = (wallTime() - t0) / ((double) n);
+  
+  t0 = wallTime();
+  midi_compile_mem(&pData, &len);
+  *pCompile = (wallTime() - t0) / ((double) n);
+  
+  m_sink += len;
+  free(pData);
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  NMF_DATA *pd = NULL;
+  int32_t *pT = NULL;
+  int32_t max_n = SIZE_DEFAULT;
+  int32_t n = 0;
+  int32_t i = 0;
+  int32_t r = 0;
+  double best_msg = 0.0;
+  double best_compile = 0.0;
+  double ns_msg = 0.0;
+  double ns_compile = 0.0;
+  
+  diagnostic_startup(argc, argv, "bench_midi");
+  
+  if (argc > 2) {
+    raiseErr(__LINE__, "Wrong number of program arguments");
+  }
+  if (argc == 2) {
+    max_n = parseArg(argv[1]);
+    if (max_n < SIZE_MIN) {
+      raiseErr(__LINE__, "Maximum must be at least %ld", (long) SIZE_MIN);
+    }
+  }
+  
+  pd = nmf_alloc();
+  pointer_init(pd);
+  
+  pT = (int32_t *) calloc((size_t) max_n, sizeof(int32_t));
+  if (pT == NULL) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  for(n = SIZE_MIN; n <= max_n; ) {
+    /* Offsets are spread so that several messages share each one */
+    for(i = 0; i < n; i++) {
+      pT[i] = rnd(n / MSG_DENSITY) * 8;
+    }
+    
+    best_msg = -1.0;
+    best_compile = -1.0;
+    for(r = 0; r < BENCH_ROUNDS; r++) {
+      timeFile(pT, n, &ns_msg, &ns_compile);
+      if ((best_msg < 0.0) || (ns_msg < best_msg)) {
+        best_msg = ns_msg;
+      }
+      if ((best_compile < 0.0) || (ns_compile < best_compile)) {
+        best_compile = ns_compile;
+      }
+    }
+    
+    printf("%-20s %10ld %12.2f\n", "midi_message", (long) n, best_msg);
+    printf("%-20s %10ld %12.2f\n",
+      "midi_compile", (long) n, best_compile);
+    
+    if (n > max_n / 10) {
+      break;
+    }
+    n *= 10;
+  }
+  
+  free(pT);
+  pT = NULL;
+  
+  nmf_free(pd);
+  pd = NULL;
+  
+  midi_restart();
+  pointer_shutdown();
+  
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+/*
+ * bench_render.c
+ * ==============
+ * 
+ * Microbenchmark for the keyboard process of the rendering module of
+ * Infrared.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   bench_render
+ * 
+ * Times render_nmf() for NMF data with 10^4 and 10^5 notes, once with
+ * the keyboard process disabled and once with it enabled, and writes
+ * one line for each case to standard output.  Each line has the name of
+ * the case, the number of notes, and the best time in nanoseconds per
+ * note over BENCH_ROUNDS rounds.  The render_keyboard case includes the
+ * bucket distribution and the per-bucket sorts of the keyboard process,
+ * so the difference between the two cases is the cost of the keyboard
+ * process itself.
+ * 
+ * The notes are spread over a narrow range of keys and overlap
+ * heavily, and several notes on the same key often start at the same
+ * time, so that the keyboard process has to sort large buckets and
+ * delete and shorten events.
+ * 
+ * The output format is the one read by bench_micro.sh.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the <math.h> library with -lm
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - arena.c
+ *   - art.c
+ *   - blob.c
+ *   - diagnostic.c
+ *   - graph.c
+ *   - midi.c
+ *   - pointer.c
+ *   - render.c
+ *   - ruler.c
+ *   - set.c
+ *   - text.c
+ * 
+ * Requires the following external libraries:
+ * 
+ *   - libnmf
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diagnostic.h"
+#include "midi.h"
+#include "pointer.h"
+#include "render.h"
+
+#include "nmf.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of timed rounds of each case, of which the best is
+ * reported.
+ */
+#define BENCH_ROUNDS (3)
+
+/*
+ * The smallest and largest numbers of notes.
+ */
+#define NOTES_MIN (10000)
+#define NOTES_MAX (100000)
+
+/*
+ * The number of distinct NMF pitches that the notes use, starting at
+ * pitch zero.
+ */
+#define PITCH_RANGE (12)
+
+/*
+ * The average number of notes that start at each offset.
+ */
+#define NOTE_DENSITY (8)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static uint32_t m_seed = 1;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t rnd(int32_t n);
+static double wallTime(void);
+static NMF_DATA *genNotes(int32_t n);
+static double timeRender(NMF_DATA *pd, int kb);
+
+/*
+ * Get a pseudo-random integer.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of possible values, which must be greater than zero
+ * 
+ * Return:
+ * 
+ *   a pseudo-random integer in range 0 to (n - 1) inclusive
+ */
+static int32_t rnd(int32_t n) {
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_seed = (m_seed * UINT32_C(1664525)) + UINT32_C(1013904223);
+  return (int32_t) ((m_seed >> 8) % ((uint32_t) n));
+}
+
+/*
+ * Get the current wall-clock time from the monotonic clock.
+ * 
+ * Return:
+ * 
+ *   the time in nanoseconds from an arbitrary starting point
+ */
+static double wallTime(void) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read monotonic clock");
+  }
+  
+  return (((double) ts.tv_sec) * 1000000000.0) + ((double) ts.tv_nsec);
+}
+
+/*
+ * Generate NMF data with a given number of overlapping notes in a
+ * single section.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of notes
+ * 
+ * Return:
+ * 
+ *   the new NMF data, which the caller must free
+ */
+static NMF_DATA *genNotes(int32_t n) {
+  
+  NMF_DATA *pd = NULL;
+  NMF_NOTE ns;
+  int32_t i = 0;
+  
+  memset(&ns, 0, sizeof(NMF_NOTE));
+  
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  pd = nmf_alloc();
+  for(i = 0; i < n; i++) {
+    ns.t = rnd(n / NOTE_DENSITY) * 12;
+    ns.dur = 12 + (rnd(8) * 12);
+    ns.pitch = (int16_t) rnd(PITCH_RANGE);
+    ns.art = 0;
+    ns.sect = 0;
+    ns.layer_i = 0;
+    if (!nmf_append(pd, &ns)) {
+      raiseErr(__LINE__, "Failed to add NMF note");
+    }
+  }
+  
+  return pd;
+}
+
+/*
+ * Time one round of rendering NMF data.
+ * 
+ * The MIDI and rendering modules are restarted first.
+ * 
+ * Parameters:
+ * 
+ *   pd - the NMF data to render
+ * 
+ *   kb - non-zero to enable the keyboard process
+ * 
+ * Return:
+ * 
+ *   the nanoseconds per note of the render_nmf() call
+ */
+static double timeRender(NMF_DATA *pd, int kb) {
+  
+  double t0 = 0.0;
+  
+  if (pd == NULL) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  midi_restart();
+  render_restart();
+  render_keyboard(kb);
+  
+  t0 = wallTime();
+  render_nmf(pd);
+  return (wallTime() - t0) / ((double) nmf_notes(pd));
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  NMF_DATA *pd = NULL;
+  int32_t n = 0;
+  int32_t r = 0;
+  double best_plain = 0.0;
+  double best_kb = 0.0;
+  double ns = 0.0;
+  
+  diagnostic_startup(argc, argv, "bench_render");
+  
+  if (argc > 1) {
+    raiseErr(__LINE__, "Not expecting program arguments");
+  }
+  
+  for(n = NOTES_MIN; n <= NOTES_MAX; n *= 10) {
+    pd = genNotes(n);
+    pointer_init(pd);
+    
+    best_plain = -1.0;
+    best_kb = -1.0;
+    for(r = 0; r < BENCH_ROUNDS; r++) {
+      ns = timeRender(pd, 0);
+      if ((best_plain < 0.0) || (ns < best_plain)) {
+        best_plain = ns;
+      }
+      
+      ns = timeRender(pd, 1);
+      if ((best_kb < 0.0) || (ns < best_kb)) {
+        best_kb = ns;
+      }
+    }
+    
+    printf("%-20s %10ld %12.2f\n", "render_nmf", (long) n, best_plain);
+    printf("%-20s %10ld %12.2f\n", "render_keyboard", (long) n, best_kb);
+    
+    midi_restart();
+    render_restart();
+    pointer_restart();
+    
+    nmf_free(pd);
+    pd = NULL;
+  }
+  
+  return EXIT_SUCCESS;
+}
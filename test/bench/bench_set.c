@@ -0,0 +1,359 @@
+/*
+ * bench_set.c
+ * ===========
+ * 
+ * Microbenchmark for the set module of Infrared.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   bench_set
+ * 
+ * Times set_has() and the set algebra operations on sets with several
+ * numbers of ranges, and writes one line for each case to standard
+ * output.  Each line has the name of the benchmarked operation, the
+ * number of ranges in each set, and the best time in nanoseconds per
+ * operation over BENCH_ROUNDS rounds.
+ * 
+ * The set_has case uses sets with ranges above the bitmap limit, so
+ * that values are found with a binary search, while the set_has_bitmap
+ * case uses sets of small values that are checked with the bitmap.  An
+ * operation of the set_algebra case defines a new set as the union of
+ * one set, intersected with a second, except a third.
+ * 
+ * The output format is the one read by bench_micro.sh.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - arena.c
+ *   - diagnostic.c
+ *   - set.c
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diagnostic.h"
+#include "set.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of timed rounds of each case, of which the best is
+ * reported.
+ */
+#define BENCH_ROUNDS (3)
+
+/*
+ * The number of set sizes, and the number of ranges at each size.
+ */
+#define SIZE_COUNT (3)
+static const int32_t SIZES[SIZE_COUNT] = {1, 16, 1024};
+
+/*
+ * The spacing between the starts of the ranges of large sets, and the
+ * first value of their first range, which is above the bitmap limit.
+ */
+#define RANGE_SPACING (64)
+#define RANGE_BASE (1024)
+
+/*
+ * The number of values in the lookup array, and the number of passes
+ * over the array in each round.
+ */
+#define QUERY_COUNT (4096)
+#define QUERY_PASSES (512)
+
+/*
+ * The number of ranges processed in each set_algebra round, which is
+ * divided by the number of ranges in each set to get the number of sets
+ * defined in the round.
+ */
+#define ALGEBRA_WORK (INT32_C(1) << 19)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static uint32_t m_seed = 1;
+
+/*
+ * The values to look up.
+ */
+static int32_t m_query[QUERY_COUNT];
+
+/*
+ * Accumulates benchmark results so that the compiler can not discard
+ * the benchmarked calls.
+ */
+static volatile int32_t m_sink = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static int32_t rnd(int32_t n);
+static double wallTime(void);
+static SET *buildSet(int32_t ranges, int32_t phase);
+static SET *buildSmall(void);
+static double timeHas(SET *ps);
+static double timeAlgebra(SET *pA, SET *pB, SET *pC, int32_t ranges);
+
+/*
+ * Get a pseudo-random integer.
+ * 
+ * Parameters:
+ * 
+ *   n - the number of possible values, which must be greater than zero
+ * 
+ * Return:
+ * 
+ *   a pseudo-random integer in range 0 to (n - 1) inclusive
+ */
+static int32_t rnd(int32_t n) {
+  if (n < 1) {
+    raiseErr(__LINE__, NULL);
+  }
+  m_seed = (m_seed * UINT32_C(1664525)) + UINT32_C(1013904223);
+  return (int32_t) ((m_seed >> 8) % ((uint32_t) n));
+}
+
+/*
+ * Get the current wall-clock time from the monotonic clock.
+ * 
+ * Return:
+ * 
+ *   the time in nanoseconds from an arbitrary starting point
+ */
+static double wallTime(void) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read monotonic clock");
+  }
+  
+  return (((double) ts.tv_sec) * 1000000000.0) + ((double) ts.tv_nsec);
+}
+
+/*
+ * Build a set of evenly spaced closed ranges above the bitmap limit.
+ * 
+ * Parameters:
+ * 
+ *   ranges - the number of ranges
+ * 
+ *   phase - shift of the ranges within their spacing, so that sets
+ *   with different phases overlap partially
+ * 
+ * Return:
+ * 
+ *   the set
+ */
+static SET *buildSet(int32_t ranges, int32_t phase) {
+  
+  int32_t i = 0;
+  int32_t lo = 0;
+  
+  set_begin(__LINE__);
+  for(i = 0; i < ranges; i++) {
+    lo = RANGE_BASE + (i * RANGE_SPACING) + phase;
+    set_rclose(lo, lo + (RANGE_SPACING / 2) - 1, 0, __LINE__);
+  }
+  return set_end(__LINE__);
+}
+
+/*
+ * Build a set of small values that is checked with the bitmap.
+ * 
+ * Return:
+ * 
+ *   the set
+ */
+static SET *buildSmall(void) {
+  
+  int32_t i = 0;
+  
+  set_begin(__LINE__);
+  for(i = 0; i < 8; i++) {
+    set_rclose(i * 16, (i * 16) + 7, 0, __LINE__);
+  }
+  return set_end(__LINE__);
+}
+
+/*
+ * Time one round of set_has() calls.
+ * 
+ * Parameters:
+ * 
+ *   ps - the set
+ * 
+ * Return:
+ * 
+ *   the nanoseconds per lookup
+ */
+static double timeHas(SET *ps) {
+  
+  double t0 = 0.0;
+  int32_t sum = 0;
+  int32_t p = 0;
+  int32_t i = 0;
+  
+  t0 = wallTime();
+  for(p = 0; p < QUERY_PASSES; p++) {
+    for(i = 0; i < QUERY_COUNT; i++) {
+      sum += set_has(ps, m_query[i]);
+    }
+  }
+  m_sink += sum;
+  
+  return (wallTime() - t0) / (((double) QUERY_PASSES) * QUERY_COUNT);
+}
+
+/*
+ * Time one round of set algebra.
+ * 
+ * Parameters:
+ * 
+ *   pA - the set to start the union from
+ * 
+ *   pB - the set to intersect with
+ * 
+ *   pC - the set to except
+ * 
+ *   ranges - the number of ranges in each of the sets
+ * 
+ * Return:
+ * 
+ *   the nanoseconds per set defined
+ */
+static double timeAlgebra(SET *pA, SET *pB, SET *pC, int32_t ranges) {
+  
+  double t0 = 0.0;
+  int32_t ops = 0;
+  int32_t i = 0;
+  
+  ops = ALGEBRA_WORK / ranges;
+  
+  t0 = wallTime();
+  for(i = 0; i < ops; i++) {
+    set_begin(__LINE__);
+    set_union(pA, __LINE__);
+    set_intersect(pB, __LINE__);
+    set_except(pC, __LINE__);
+    m_sink += set_has(set_end(__LINE__), RANGE_BASE);
+  }
+  
+  return (wallTime() - t0) / ((double) ops);
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  SET *pA = NULL;
+  SET *pB = NULL;
+  SET *pC = NULL;
+  double best[3];
+  double ns = 0.0;
+  int32_t s = 0;
+  int32_t r = 0;
+  int32_t i = 0;
+  int32_t k = 0;
+  
+  diagnostic_startup(argc, argv, "bench_set");
+  
+  if (argc > 1) {
+    raiseErr(__LINE__, "Not expecting program arguments");
+  }
+  
+  for(s = 0; s < SIZE_COUNT; s++) {
+    set_restart();
+    pA = buildSet(SIZES[s], 0);
+    pB = buildSet(SIZES[s], RANGE_SPACING / 4);
+    pC = buildSet(SIZES[s], RANGE_SPACING / 2);
+    
+    /* Lookups are spread over the ranges and a little beyond */
+    for(i = 0; i < QUERY_COUNT; i++) {
+      m_query[i] = rnd((SIZES[s] + 2) * RANGE_SPACING) + RANGE_BASE
+                    - RANGE_SPACING;
+    }
+    
+    for(k = 0; k < 2; k++) {
+      best[k] = -1.0;
+    }
+    for(r = 0; r < BENCH_ROUNDS; r++) {
+      for(k = 0; k < 2; k++) {
+        if (k == 0) {
+          ns = timeHas(pA);
+        } else {
+          ns = timeAlgebra(pA, pB, pC, SIZES[s]);
+        }
+        if ((best[k] < 0.0) || (ns < best[k])) {
+          best[k] = ns;
+        }
+      }
+    }
+    
+    printf("%-20s %10ld %12.2f\n", "set_has", (long) SIZES[s], best[0]);
+    printf("%-20s %10ld %12.2f\n",
+      "set_algebra", (long) SIZES[s], best[1]);
+  }
+  
+  /* Bitmap lookups of small values */
+  set_restart();
+  pA = buildSmall();
+  for(i = 0; i < QUERY_COUNT; i++) {
+    m_query[i] = rnd(160);
+  }
+  best[2] = -1.0;
+  for(r = 0; r < BENCH_ROUNDS; r++) {
+    ns = timeHas(pA);
+    if ((best[2] < 0.0) || (ns < best[2])) {
+      best[2] = ns;
+    }
+  }
+  printf("%-20s %10ld %12.2f\n", "set_has_bitmap", 8L, best[2]);
+  
+  set_shutdown();
+  
+  return EXIT_SUCCESS;
+}
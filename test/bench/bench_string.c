@@ -0,0 +1,278 @@
+/*
+ * bench_string.c
+ * ==============
+ * 
+ * Microbenchmark for the text and blob modules of Infrared.
+ * 
+ * Syntax
+ * ------
+ * 
+ *   bench_string
+ * 
+ * Times text_concat() and blob_concat() with several numbers of
+ * components, followed by the text_ptr() and blob_ptr() calls that
+ * assemble the concatenated views, and writes one line for each case
+ * to standard output.  Each line has the name of the benchmarked
+ * function, the number of components in each concatenation, and the
+ * best time in nanoseconds per call over BENCH_ROUNDS rounds.
+ * 
+ * The output format is the one read by bench_micro.sh.
+ * 
+ * Requirements
+ * ------------
+ * 
+ * May require the POSIX realtime library with -lrt for the monotonic
+ * clock
+ * 
+ * Requires the following Infrared modules:
+ * 
+ *   - arena.c
+ *   - blob.c
+ *   - diagnostic.c
+ *   - text.c
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blob.h"
+#include "diagnostic.h"
+#include "text.h"
+
+/*
+ * Diagnostics
+ * ===========
+ */
+
+static void raiseErr(int lnum, const char *pDetail, ...) {
+  va_list ap;
+  va_start(ap, pDetail);
+  diagnostic_global(1, __FILE__, lnum, pDetail, ap);
+  va_end(ap);
+}
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of timed rounds of each case, of which the best is
+ * reported.
+ */
+#define BENCH_ROUNDS (3)
+
+/*
+ * The number of component counts, and the number of components at each
+ * count.  Text components are seven characters and blob components are
+ * sixteen bytes, so the largest texts stay within TEXT_MAXLEN.
+ */
+#define SIZE_COUNT (3)
+static const int32_t SIZES[SIZE_COUNT] = {2, 16, 128};
+
+/*
+ * The number of components concatenated in each round, which is divided
+ * by the number of components in each concatenation to get the number
+ * of concatenations in the round.
+ */
+#define CONCAT_WORK (INT32_C(1) << 18)
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * Accumulates benchmark results so that the compiler can not discard
+ * the benchmarked calls.
+ */
+static volatile int32_t m_sink = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/* Prototypes */
+static double wallTime(void);
+static void timeText(int32_t parts, double *pConcat, double *pPtr);
+static void timeBlob(int32_t parts, double *pConcat, double *pPtr);
+
+/*
+ * Get the current wall-clock time from the monotonic clock.
+ * 
+ * Return:
+ * 
+ *   the time in nanoseconds from an arbitrary starting point
+ */
+static double wallTime(void) {
+  
+  struct timespec ts;
+  
+  memset(&ts, 0, sizeof(struct timespec));
+  
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    raiseErr(__LINE__, "Failed to read monotonic clock");
+  }
+  
+  return (((double) ts.tv_sec) * 1000000000.0) + ((double) ts.tv_nsec);
+}
+
+/*
+ * Time one round of text concatenation.
+ * 
+ * The text module is restarted first.
+ * 
+ * Parameters:
+ * 
+ *   parts - the number of components in each concatenation
+ * 
+ *   pConcat - receives the nanoseconds per text_concat() call
+ * 
+ *   pPtr - receives the nanoseconds per text_ptr() call
+ */
+static void timeText(int32_t parts, double *pConcat, double *pPtr) {
+  
+  TEXT **ppPart = NULL;
+  TEXT **ppOut = NULL;
+  char buf[8];
+  double t0 = 0.0;
+  int32_t ops = 0;
+  int32_t i = 0;
+  
+  memset(buf, 0, sizeof(buf));
+  ops = CONCAT_WORK / parts;
+  
+  ppPart = (TEXT **) calloc((size_t) parts, sizeof(TEXT *));
+  ppOut = (TEXT **) calloc((size_t) ops, sizeof(TEXT *));
+  if ((ppPart == NULL) || (ppOut == NULL)) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  text_restart();
+  for(i = 0; i < parts; i++) {
+    sprintf(buf, "part%03d", (int) (i % 1000));
+    ppPart[i] = text_literal(buf, __LINE__);
+  }
+  
+  t0 = wallTime();
+  for(i = 0; i < ops; i++) {
+    ppOut[i] = text_concat(ppPart, parts, __LINE__);
+  }
+  *pConcat = (wallTime() - t0) / ((double) ops);
+  
+  t0 = wallTime();
+  for(i = 0; i < ops; i++) {
+    m_sink += (int32_t) text_ptr(ppOut[i])[0];
+  }
+  *pPtr = (wallTime() - t0) / ((double) ops);
+  
+  free(ppPart);
+  free(ppOut);
+}
+
+/*
+ * Time one round of blob concatenation.
+ * 
+ * The blob module is restarted first.
+ * 
+ * Parameters:
+ * 
+ *   parts - the number of components in each concatenation
+ * 
+ *   pConcat - receives the nanoseconds per blob_concat() call
+ * 
+ *   pPtr - receives the nanoseconds per blob_ptr() call
+ */
+static void timeBlob(int32_t parts, double *pConcat, double *pPtr) {
+  
+  BLOB **ppPart = NULL;
+  BLOB **ppOut = NULL;
+  char buf[40];
+  double t0 = 0.0;
+  int32_t ops = 0;
+  int32_t i = 0;
+  
+  memset(buf, 0, sizeof(buf));
+  ops = CONCAT_WORK / parts;
+  
+  ppPart = (BLOB **) calloc((size_t) parts, sizeof(BLOB *));
+  ppOut = (BLOB **) calloc((size_t) ops, sizeof(BLOB *));
+  if ((ppPart == NULL) || (ppOut == NULL)) {
+    raiseErr(__LINE__, "Out of memory");
+  }
+  
+  blob_restart();
+  for(i = 0; i < parts; i++) {
+    sprintf(buf, "%08lx%08lx%08lx%08lx",
+      (unsigned long) i, (unsigned long) (i * 3),
+      (unsigned long) (i * 5), (unsigned long) (i * 7));
+    ppPart[i] = blob_fromHex(buf, __LINE__);
+  }
+  
+  t0 = wallTime();
+  for(i = 0; i < ops; i++) {
+    ppOut[i] = blob_concat(ppPart, parts, __LINE__);
+  }
+  *pConcat = (wallTime() - t0) / ((double) ops);
+  
+  t0 = wallTime();
+  for(i = 0; i < ops; i++) {
+    m_sink += (int32_t) blob_ptr(ppOut[i])[0];
+  }
+  *pPtr = (wallTime() - t0) / ((double) ops);
+  
+  free(ppPart);
+  free(ppOut);
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  double best[4];
+  double ns[4];
+  int32_t s = 0;
+  int32_t r = 0;
+  int32_t k = 0;
+  
+  diagnostic_startup(argc, argv, "bench_string");
+  
+  if (argc > 1) {
+    raiseErr(__LINE__, "Not expecting program arguments");
+  }
+  
+  for(s = 0; s < SIZE_COUNT; s++) {
+    for(k = 0; k < 4; k++) {
+      best[k] = -1.0;
+    }
+    for(r = 0; r < BENCH_ROUNDS; r++) {
+      timeText(SIZES[s], &(ns[0]), &(ns[1]));
+      timeBlob(SIZES[s], &(ns[2]), &(ns[3]));
+      for(k = 0; k < 4; k++) {
+        if ((best[k] < 0.0) || (ns[k] < best[k])) {
+          best[k] = ns[k];
+        }
+      }
+    }
+    
+    printf("%-20s %10ld %12.2f\n", "text_concat", (long) SIZES[s], best[0]);
+    printf("%-20s %10ld %12.2f\n", "text_ptr", (long) SIZES[s], best[1]);
+    printf("%-20s %10ld %12.2f\n", "blob_concat", (long) SIZES[s], best[2]);
+    printf("%-20s %10ld %12.2f\n", "blob_ptr", (long) SIZES[s], best[3]);
+  }
+  
+  text_shutdown();
+  blob_shutdown();
+  
+  return EXIT_SUCCESS;
+}
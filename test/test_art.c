@@ -20,6 +20,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - art.c
  *   - diagnostic.c
  */
@@ -132,6 +133,7 @@ int main(int argc, char *argv[]) {
   int32_t arg_test = 0;
   
   int32_t result = 0;
+  int32_t batch = 0;
   
   ART *pa = NULL;
   
@@ -179,6 +181,13 @@ int main(int argc, char *argv[]) {
   
   printf("Test performance subquanta    : %ld\n", (long) result);
   
+  if (art_transform_batch(pa, &arg_test, &batch, 1) >= 0) {
+    raiseErr(__LINE__, "Batch transform rejected the duration");
+  }
+  if (batch != result) {
+    raiseErr(__LINE__, "Batch transform gave a different result");
+  }
+  
   art_shutdown();
   return EXIT_SUCCESS;
 }
@@ -16,6 +16,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - graph.c
  *   - pointer.c
@@ -63,11 +64,17 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 
 int main(int argc, char *argv[]) {
   
+  int32_t i = 0;
   NMF_DATA *pd = NULL;
   GRAPH *pFirst = NULL;
   GRAPH *pSecond = NULL;
+  GRAPH *pThird = NULL;
   POINTER *pp = NULL;
   POINTER *pp2 = NULL;
+  GRAPH_SPAN span;
+  GRAPH_CURSOR cur;
+  int32_t bt[64];
+  int32_t bv[64];
   
   diagnostic_startup(argc, argv, "test_graph");
   
@@ -111,6 +118,48 @@ int main(int argc, char *argv[]) {
   
   /* === */
   
+  graph_cursor_init(&cur, pFirst);
+  printf("Cursor queries of first at moments 1210, 1850, 1300, 6000:");
+  printf(" %ld", (long) graph_cursor_query(&cur, 1210));
+  printf(" %ld", (long) graph_cursor_query(&cur, 1850));
+  printf(" %ld", (long) graph_cursor_query(&cur, 1300));
+  printf(" %ld", (long) graph_cursor_query(&cur, 6000));
+  printf("\n\n");
+  
+  /* === */
+  
+  for(i = 0; i < 64; i++) {
+    bt[i] = ((i * 37) % 64) * 100 - 500;
+  }
+  graph_query_batch(pFirst, bt, bv, 64);
+  for(i = 0; i < 64; i++) {
+    if (bv[i] != graph_query(pFirst, bt[i])) {
+      raiseErr(__LINE__, "Batch query mismatch at moment %ld",
+        (long) bt[i]);
+    }
+  }
+  printf("Batch queries of first match single queries\n\n");
+  
+  /* === */
+  
+  graph_span(pFirst, &span, 1210, 2400, 0, 1, 0);
+  
+  printf("Span of first from moment 1210 to 2400:");
+  for(i = 0; i < span.count; i++) {
+    if (i > 0) {
+      printf(" (%ld,%ld)",
+        (long) ((span.pNode)[i]).t,
+        (long) ((span.pNode)[i]).v);
+    } else {
+      printf(" (%ld,%ld)",
+        (long) span.t_first,
+        (long) ((span.pNode)[i]).v);
+    }
+  }
+  printf("\n\n");
+  
+  /* === */
+  
   graph_begin(__LINE__);
   
   pointer_reset(pp);
@@ -134,6 +183,49 @@ int main(int argc, char *argv[]) {
   
   /* === */
   
+  for(i = 0; i < 64; i++) {
+    bt[i] = ((i * 37) % 64) * 100 - 500;
+  }
+  graph_query_batch(pSecond, bt, bt, 64);
+  for(i = 0; i < 64; i++) {
+    if (bt[i] != graph_query(pSecond, ((i * 37) % 64) * 100 - 500)) {
+      raiseErr(__LINE__, "Batch query mismatch at index %ld", (long) i);
+    }
+  }
+  printf("Batch queries of second match single queries\n\n");
+  
+  /* === */
+  
+  graph_begin(__LINE__);
+  
+  pointer_reset(pp);
+  pointer_jump(pp, 0, __LINE__);
+  graph_add_ramp(pp, 0, 20000, 1, 0, __LINE__);
+  
+  pointer_advance(pp, 4000, __LINE__);
+  graph_add_constant(pp, 20000, __LINE__);
+  
+  pThird = graph_end(__LINE__);
+  
+  printf("Query third at moments 3, 48000, 95997: %ld %ld %ld\n\n",
+    (long) graph_query(pThird, 3),
+    (long) graph_query(pThird, 48000),
+    (long) graph_query(pThird, 95997));
+  
+  /* === */
+  
+  graph_span(pThird, &span, 0, 96000, 0, 1, 0);
+  for(i = 1; i < span.count; i++) {
+    if (((span.pNode)[i]).v != graph_query(pThird, ((span.pNode)[i]).t)) {
+      raiseErr(__LINE__, "Span mismatch at moment %ld",
+        (long) ((span.pNode)[i]).t);
+    }
+  }
+  printf("Span of third has %ld nodes matching queries\n\n",
+    (long) span.count);
+  
+  /* === */
+  
   nmf_free(pd);
   pd = NULL;
   
@@ -14,6 +14,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - blob.c
  *   - diagnostic.c
  *   - midi.c
@@ -29,10 +30,12 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "diagnostic.h"
 #include "midi.h"
 #include "pointer.h"
+#include "text.h"
 
 #include "nmf.h"
 
@@ -63,7 +66,11 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 int main(int argc, char *argv[]) {
   
   NMF_DATA *pd = NULL;
+  TEXT *pText = NULL;
+  MIDI_STATS ms;
+  int32_t i = 0;
   
+  memset(&ms, 0, sizeof(MIDI_STATS));
   diagnostic_startup(argc, argv, "test_midi");
   
   if (argc > 1) {
@@ -74,7 +81,7 @@ int main(int argc, char *argv[]) {
   pointer_init(pd);
   
   /* === */
-
+  
   midi_null(-1 * 96 * 8 * 3, 0);
   midi_null(10 * 96 * 8 * 3, 0);
   
@@ -92,14 +99,29 @@ int main(int argc, char *argv[]) {
   midi_message(4 * 96 * 8 * 3, 0, 1, MIDI_MSG_NOTE_ON, 64, 64);
   midi_message(5 * 96 * 8 * 3, 0, 1, MIDI_MSG_NOTE_ON, 64, 0);
   
+  /* Repeated payloads, both through the same object and through
+   * separate objects with the same content, must share handles rather
+   * than exhausting the handle table */
+  pText = text_literal("Verse", 0);
+  for(i = 0; i < 20000; i++) {
+    midi_text(i * 3, 0, MIDI_TEXT_MARKER, pText);
+    midi_text(i * 3, 0, MIDI_TEXT_CUE, text_literal("Cue", 0));
+  }
+  
   midi_compile(stdout);
   
+  midi_stats(&ms);
+  if (ms.h_cap > 16) {
+    raiseErr(__LINE__, "Repeated payloads were not deduplicated");
+  }
+  
   /* === */
   
   nmf_free(pd);
   pd = NULL;
   
   pointer_shutdown();
+  text_shutdown();
   
   diagnostic_log("Test successful");
   return EXIT_SUCCESS;
@@ -26,6 +26,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - pointer.c
  *   - ruler.c
@@ -16,6 +16,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - art.c
  *   - blob.c
  *   - diagnostic.c
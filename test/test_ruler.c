@@ -21,6 +21,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - ruler.c
  */
@@ -132,6 +133,7 @@ int main(int argc, char *argv[]) {
   int32_t arg_grace = 0;
   
   int32_t result = 0;
+  int32_t batch = 0;
   
   RULER *pr = NULL;
   
@@ -173,6 +175,13 @@ int main(int argc, char *argv[]) {
   printf("Test performance offset       : %ld\n", (long) result);
   printf("Test performance duration     : %ld\n", (long) ruler_dur(pr));
   
+  if (ruler_pos_batch(pr, &arg_beat, &arg_grace, &batch, 1) >= 0) {
+    raiseErr(__LINE__, "Batch position rejected the grace note");
+  }
+  if (batch != result) {
+    raiseErr(__LINE__, "Batch position gave a different result");
+  }
+  
   ruler_shutdown();
   return EXIT_SUCCESS;
 }
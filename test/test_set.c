@@ -14,6 +14,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - set.c
  */
@@ -58,6 +59,8 @@ int main(int argc, char *argv[]) {
   SET *pMIDINo7 = NULL;
   SET *pMIDI7 = NULL;
   SET *pRejoin = NULL;
+  SET *pHigh = NULL;
+  SET *pNone = NULL;
   
   diagnostic_startup(argc, argv, "test_set");
   
@@ -153,6 +156,38 @@ int main(int argc, char *argv[]) {
   
   /* === */
   
+  set_begin(__LINE__);
+  set_all(__LINE__);
+  set_rclose(100, 1000, 1, __LINE__);
+  pHigh = set_end(__LINE__);
+  
+  printf("\nAll but 100-1000: ");
+  set_print(pHigh, stdout);
+  printf("\n");
+  printf("Is 99 in it: %d\n", set_has(pHigh, 99));
+  printf("Is 500 in it: %d\n", set_has(pHigh, 500));
+  printf("Is 5000 in it: %d\n", set_has(pHigh, 5000));
+  
+  /* === */
+  
+  set_begin(__LINE__);
+  set_all(__LINE__);
+  set_rclose(56, 60, 1, __LINE__);
+  set_intersect(pEmpty, __LINE__);
+  pNone = set_end(__LINE__);
+  
+  printf("\nGapped set intersected with empty set: ");
+  set_print(pNone, stdout);
+  printf("\n");
+  
+  /* === */
+  
+  printf("\nRejoined is MIDI object: %d\n", (pRejoin == pMIDI));
+  printf("Gapped empty is empty object: %d\n", (pNone == pEmpty));
+  printf("MIDI-but-7 is MIDI object: %d\n", (pMIDINo7 == pMIDI));
+  
+  /* === */
+  
   set_shutdown();
   
   printf("\n");
@@ -14,6 +14,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  *   - text.c
  */
@@ -56,6 +57,8 @@ int main(int argc, char *argv[]) {
   TEXT *pWorld = NULL;
   TEXT *pMulti = NULL;
   TEXT *pSub = NULL;
+  TEXT *pRope = NULL;
+  TEXT *pPart = NULL;
   TEXT *ppAr[3];
   
   memset(ppAr, 0, sizeof(TEXT *) * 3);
@@ -82,6 +85,25 @@ int main(int argc, char *argv[]) {
   
   diagnostic_log("World: %s", text_ptr(pSub));
   
+  ppAr[0] = pMulti;
+  ppAr[1] = pMulti;
+  ppAr[2] = pMulti;
+  
+  pRope = text_concat(ppAr, 3, 20);
+  pPart = text_slice(text_slice(pRope, 2, 30, 21), 4, 20, 22);
+  
+  if (text_len(pPart) != 16) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (strcmp(text_ptr(pPart), "world!Hello worl") != 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (strcmp(text_ptr(pRope), "Hello world!Hello world!Hello world!") != 0) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  diagnostic_log("Rope: %s", text_ptr(pRope));
+  
   text_shutdown();
   
   diagnostic_log("Test successful");
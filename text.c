@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "diagnostic.h"
 
 /*
@@ -35,6 +36,24 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
   va_end(ap);
 }
 
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * Concatenations with at most this many characters are copied into a
+ * new contiguous text instead of being made into a view.
+ */
+#define VIEW_MIN_LEN (32)
+
+/*
+ * The maximum depth of views, which bounds the recursion when views
+ * are assembled.  Texts that would be deeper are copied into a new
+ * contiguous text instead.
+ */
+#define VIEW_MAX_DEPTH (32)
+
 /*
  * Type declarations
  * =================
@@ -42,26 +61,60 @@ static void sayWarn(int lnum, const char *pDetail, ...) {
 
 /*
  * TEXT structure.  Prototype given in header.
+ * 
+ * A text is either contiguous, with its characters stored in a single
+ * array that may belong to another text, or a view that refers to
+ * other texts.  A slice view refers to a range of a single source
+ * text, while a concatenation view is a rope that refers to a list of
+ * parts.  Views are only assembled into contiguous storage when
+ * text_ptr() needs it.
  */
 struct TEXT_TAG {
   
   /*
-   * The next text in the allocated text chain, or NULL if this is the
-   * last text in the chain.
+   * The length of text data in characters, excluding the terminating
+   * nul.
+   */
+  int32_t blen;
+  
+  /*
+   * The depth of the text, which is zero if the text is contiguous, or
+   * else one greater than the greatest depth of the texts it refers to.
    * 
-   * The text chain allows the shutdown function to free all texts.
+   * Never exceeds VIEW_MAX_DEPTH.
    */
-  TEXT *pNext;
+  int32_t depth;
   
   /*
-   * The length of text data in characters, excluding the terminating
-   * nul.
+   * Pointer to the contiguous text data, or NULL if the text is a view
+   * that has not been assembled yet.
+   * 
+   * If term is non-zero, the data is followed by a terminating nul.
+   * Otherwise, the data is part of a longer array, and text_ptr() will
+   * need to copy it.
    */
-  int32_t blen;
+  const char *pData;
+  int term;
+  
+  /*
+   * For slice views, the source text and the offset of the slice
+   * within it.  The source is never itself a slice view.  NULL and zero
+   * for other texts.
+   */
+  TEXT *pSrc;
+  int32_t offs;
+  
+  /*
+   * For concatenation views, the number of parts and the array of
+   * parts, none of which are empty.  Zero and NULL for other texts.
+   */
+  int32_t parts;
+  TEXT **ppPart;
   
   /*
-   * The start of the text data buffer.  The rest of the buffer extends
-   * beyond the end of the structure.  It will be nul terminated.
+   * The start of the text data buffer for texts that store their own
+   * data.  The rest of the buffer extends beyond the end of the
+   * structure.  It will be nul terminated.
    */
   char buf[1];
   
@@ -74,6 +127,7 @@ struct TEXT_TAG {
 
 /* Prototypes */
 static long srcLine(long lnum);
+static void fillText(TEXT *pt, int32_t i, int32_t len, char *pDst);
 
 /*
  * If the given line number is within valid range, return it as-is.  In
@@ -94,6 +148,71 @@ static long srcLine(long lnum) {
   return lnum;
 }
 
+/*
+ * Copy a range of characters from a text to a buffer.
+ * 
+ * Views are followed down to the contiguous texts that hold the
+ * characters, so this works for any kind of text.  No terminating nul
+ * is written.
+ * 
+ * Parameters:
+ * 
+ *   pt - the text to copy from
+ * 
+ *   i - the offset of the first character to copy
+ * 
+ *   len - the number of characters to copy
+ * 
+ *   pDst - the buffer to copy to
+ */
+static void fillText(TEXT *pt, int32_t i, int32_t len, char *pDst) {
+  
+  int32_t k = 0;
+  int32_t n = 0;
+  TEXT *pp = NULL;
+  
+  if ((pt == NULL) || (pDst == NULL) || (i < 0) || (len < 0)) {
+    raiseErr(__LINE__, NULL);
+  }
+  if (len > pt->blen - i) {
+    raiseErr(__LINE__, NULL);
+  }
+  
+  while (len > 0) {
+    if (pt->pData != NULL) {
+      /* Contiguous, so copy directly */
+      memcpy(pDst, &((pt->pData)[i]), (size_t) len);
+      len = 0;
+      
+    } else if (pt->pSrc != NULL) {
+      /* Slice view, so continue with the source */
+      i += pt->offs;
+      pt = pt->pSrc;
+      
+    } else {
+      /* Concatenation view, so copy from each part that overlaps */
+      for(k = 0; (k < pt->parts) && (len > 0); k++) {
+        pp = (pt->ppPart)[k];
+        if (i >= pp->blen) {
+          i -= pp->blen;
+        } else {
+          n = pp->blen - i;
+          if (n > len) {
+            n = len;
+          }
+          fillText(pp, i, n, pDst);
+          pDst += n;
+          len -= n;
+          i = 0;
+        }
+      }
+      if (len > 0) {
+        raiseErr(__LINE__, NULL);
+      }
+    }
+  }
+}
+
 /*
  * Local data
  * ==========
@@ -105,11 +224,16 @@ static long srcLine(long lnum) {
 static int m_shutdown = 0;
 
 /*
- * Pointers to the first and last texts in the text chain, or NULL for
- * both if no texts allocated.
+ * The arena that all texts are allocated from, which releases them all
+ * at once when the module shuts down.
  */
-static TEXT *m_pFirst = NULL;
-static TEXT *m_pLast = NULL;
+static ARENA m_arena;
+
+/*
+ * The number of texts allocated since the module was started or
+ * restarted, for profiling.
+ */
+static int32_t m_count = 0;
 
 /*
  * Public function implementations
@@ -139,23 +263,14 @@ TEXT *text_literal(const char *pStr, long lnum) {
               srcLine(lnum));
   }
   
-  pt = (TEXT *) calloc(1, slen + sizeof(TEXT));
-  if (pt == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
+  pt = (TEXT *) arena_alloc(&m_arena, slen + sizeof(TEXT));
   
   pt->blen = (int32_t) slen;
   memcpy(pt->buf, pStr, slen + 1);
+  pt->pData = pt->buf;
+  pt->term = 1;
   
-  if (m_pLast == NULL) {
-    m_pFirst = pt;
-    m_pLast = pt;
-    pt->pNext = NULL;
-  } else {
-    m_pLast->pNext = pt;
-    pt->pNext = NULL;
-    m_pLast = pt;
-  }
+  m_count++;
   
   return pt;
 }
@@ -167,6 +282,7 @@ TEXT *text_concat(TEXT **ppList, int32_t list_len, long lnum) {
   
   int32_t i = 0;
   int32_t full_len = 0;
+  int32_t depth = 0;
   int32_t fill = 0;
   TEXT *pt = NULL;
   
@@ -183,6 +299,7 @@ TEXT *text_concat(TEXT **ppList, int32_t list_len, long lnum) {
   }
   
   full_len = 0;
+  depth = 0;
   for(i = 0; i < list_len; i++) {
     if (ppList[i] == NULL) {
       raiseErr(__LINE__, NULL);
@@ -193,34 +310,45 @@ TEXT *text_concat(TEXT **ppList, int32_t list_len, long lnum) {
         "Concatenated text length too large on script line %ld",
         srcLine(lnum));
     }
+    if ((ppList[i])->depth > depth) {
+      depth = (ppList[i])->depth;
+    }
   }
+  depth++;
   
-  pt = (TEXT *) calloc(1, sizeof(TEXT) + ((size_t) full_len));
-  if (pt == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
-  
-  pt->blen = full_len;
-  
-  fill = 0;
-  for(i = 0; i < list_len; i++) {
-    if ((ppList[i])->blen > 0) {
-      memcpy(
-        &((pt->buf)[fill]),
-        (ppList[i])->buf,
-        (size_t) (ppList[i])->blen);
+  if ((full_len <= VIEW_MIN_LEN) || (depth > VIEW_MAX_DEPTH)) {
+    /* Short or too deep, so copy into a new contiguous text */
+    pt = (TEXT *) arena_alloc(
+                    &m_arena, sizeof(TEXT) + ((size_t) full_len));
+    pt->blen = full_len;
+    
+    fill = 0;
+    for(i = 0; i < list_len; i++) {
+      fillText(ppList[i], 0, (ppList[i])->blen, &((pt->buf)[fill]));
       fill += (ppList[i])->blen;
     }
-  }
-  
-  if (m_pLast == NULL) {
-    raiseErr(__LINE__, NULL);
+    
+    pt->pData = pt->buf;
+    pt->term = 1;
+    
   } else {
-    m_pLast->pNext = pt;
-    pt->pNext = NULL;
-    m_pLast = pt;
+    /* Make a concatenation view of the non-empty parts */
+    pt = (TEXT *) arena_alloc(&m_arena, sizeof(TEXT));
+    pt->blen = full_len;
+    pt->depth = depth;
+    pt->ppPart = (TEXT **) arena_alloc(
+                    &m_arena, ((size_t) list_len) * sizeof(TEXT *));
+    
+    for(i = 0; i < list_len; i++) {
+      if ((ppList[i])->blen > 0) {
+        (pt->ppPart)[pt->parts] = ppList[i];
+        (pt->parts)++;
+      }
+    }
   }
   
+  m_count++;
+  
   return pt;
 }
 
@@ -230,6 +358,7 @@ TEXT *text_concat(TEXT **ppList, int32_t list_len, long lnum) {
 TEXT *text_slice(TEXT *pSrc, int32_t i, int32_t j, long lnum) {
   
   TEXT *pt = NULL;
+  char *pBuf = NULL;
   
   if (m_shutdown) {
     raiseErr(__LINE__, "Text module is shut down");
@@ -248,27 +377,39 @@ TEXT *text_slice(TEXT *pSrc, int32_t i, int32_t j, long lnum) {
       srcLine(lnum));
   }
   
-  pt = (TEXT *) calloc(1, sizeof(TEXT) + ((size_t) (j - i)));
-  if (pt == NULL) {
-    raiseErr(__LINE__, "Out of memory");
-  }
-  
+  pt = (TEXT *) arena_alloc(&m_arena, sizeof(TEXT));
   pt->blen = j - i;
-  if (pt->blen > 0) {
-    memcpy(
-      pt->buf,
-      &((pSrc->buf)[i]),
-      (size_t) pt->blen);
-  }
   
-  if (m_pLast == NULL) {
-    raiseErr(__LINE__, NULL);
+  if (pSrc->pData != NULL) {
+    /* Contiguous source, so share its data, which stays terminated
+     * only if the slice runs to the end */
+    pt->pData = &((pSrc->pData)[i]);
+    if (pSrc->term && (j == pSrc->blen)) {
+      pt->term = 1;
+    }
+    
+  } else if (pSrc->pSrc != NULL) {
+    /* Slice of a slice view, so refer to the underlying source */
+    pt->pSrc = pSrc->pSrc;
+    pt->offs = pSrc->offs + i;
+    pt->depth = pSrc->depth;
+    
+  } else if (pSrc->depth < VIEW_MAX_DEPTH) {
+    /* Slice of a concatenation view */
+    pt->pSrc = pSrc;
+    pt->offs = i;
+    pt->depth = pSrc->depth + 1;
+    
   } else {
-    m_pLast->pNext = pt;
-    pt->pNext = NULL;
-    m_pLast = pt;
+    /* Slice of a concatenation view that is too deep, so copy */
+    pBuf = (char *) arena_alloc(&m_arena, ((size_t) pt->blen) + 1);
+    fillText(pSrc, i, pt->blen, pBuf);
+    pt->pData = pBuf;
+    pt->term = 1;
   }
   
+  m_count++;
+  
   return pt;
 }
 
@@ -276,27 +417,35 @@ TEXT *text_slice(TEXT *pSrc, int32_t i, int32_t j, long lnum) {
  * text_shutdown function.
  */
 void text_shutdown(void) {
-  TEXT *pCur = NULL;
-  TEXT *pNext = NULL;
-  
   if (!m_shutdown) {
     m_shutdown = 1;
-    pCur = m_pFirst;
-    while (pCur != NULL) {
-      pNext = pCur->pNext;
-      free(pCur);
-      pCur = pNext;
-    }
-    m_pFirst = NULL;
-    m_pLast = NULL;
+    arena_free(&m_arena);
   }
 }
 
+/*
+ * text_restart function.
+ */
+void text_restart(void) {
+  text_shutdown();
+  m_shutdown = 0;
+  m_count = 0;
+}
+
+/*
+ * text_count function.
+ */
+int32_t text_count(void) {
+  return m_count;
+}
+
 /*
  * text_ptr function.
  */
 const char *text_ptr(TEXT *pt) {
   
+  char *pBuf = NULL;
+  
   if (m_shutdown) {
     raiseErr(__LINE__, "Text module is shut down");
   }
@@ -304,7 +453,17 @@ const char *text_ptr(TEXT *pt) {
     raiseErr(__LINE__, NULL);
   }
   
-  return pt->buf;
+  /* Assemble views and unterminated slices into a new array the first
+   * time a terminated string is needed */
+  if (!(pt->term)) {
+    pBuf = (char *) arena_alloc(&m_arena, ((size_t) pt->blen) + 1);
+    fillText(pt, 0, pt->blen, pBuf);
+    pt->pData = pBuf;
+    pt->term = 1;
+    pt->depth = 0;
+  }
+  
+  return pt->pData;
 }
 
 /*
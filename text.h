@@ -12,6 +12,7 @@
  * 
  * Requires the following Infrared modules:
  * 
+ *   - arena.c
  *   - diagnostic.c
  */
 
@@ -87,6 +88,10 @@ TEXT *text_literal(const char *pStr, long lnum);
  * The given lnum should be from the Shastina parser, for use in error
  * reports.
  * 
+ * Unless the result is short, the characters are not copied.  The new
+ * text is a view that refers to the component texts, and it is only
+ * assembled when text_ptr() is called on it.
+ * 
  * Parameters:
  * 
  *   ppList - the list of component texts or NULL if empty
@@ -118,6 +123,10 @@ TEXT *text_concat(TEXT **ppList, int32_t list_len, long lnum);
  * the source text, excluding the terminating nul.  If j is equal to i,
  * then the new text will be empty.
  * 
+ * The characters are not copied.  The new text is a view that refers
+ * to the source text, and it is only assembled when text_ptr() is
+ * called on it, unless it shares the terminating nul of the source.
+ * 
  * Parameters:
  * 
  *   pSrc - the source text
@@ -141,6 +150,25 @@ TEXT *text_slice(TEXT *pSrc, int32_t i, int32_t j, long lnum);
  */
 void text_shutdown(void);
 
+/*
+ * Restart the text system, releasing all texts that have been
+ * allocated in the same way as text_shutdown(), but leaving the text
+ * system ready to be used again.  This also works after a shutdown.
+ */
+void text_restart(void);
+
+/*
+ * Return the number of texts that have been allocated since the
+ * module was started or restarted.
+ * 
+ * This is intended for profiling.
+ * 
+ * Return:
+ * 
+ *   the number of texts allocated
+ */
+int32_t text_count(void);
+
 /*
  * Get a pointer to the string within a given text.
  * 
@@ -148,6 +176,10 @@ void text_shutdown(void);
  * be NULL.  The pointer remains valid until the text_shutdown()
  * function is called.
  * 
+ * If the text is a view, the characters are copied into a contiguous
+ * string the first time this is called, and later calls return the
+ * same string.
+ * 
  * Parameters:
  * 
  *   pt - the text